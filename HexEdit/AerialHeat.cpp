@@ -0,0 +1,273 @@
+// AerialHeat.cpp : implementation of the aerial_metrics class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "AerialHeat.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+// Bytes that are common x86/x64 opcodes, prefixes and ModRM values (eg MOV, LEA, CALL, JZ, RET, REX.W)
+static const unsigned char x86_ops[] =
+{
+	0x0F, 0x48, 0x74, 0x75, 0x83, 0x84, 0x85, 0x89, 0x8B, 0x8D, 0xC3, 0xC7, 0xE8, 0xE9, 0xFF, 0x4C,
+};
+
+// Top bytes (little-endian) of common A64 instructions (eg LDR/STR, STP/LDP, ADD/SUB, MOV, BL, B.cond, CBZ, RET)
+static const unsigned char a64_ops[] =
+{
+	0xF9, 0xB9, 0xA9, 0x91, 0xD1, 0xAA, 0x94, 0x97, 0x54, 0xB4, 0xB5, 0x34, 0x35, 0xD6, 0x52, 0x2A,
+};
+
+// Proportion of opcode bytes/words in random data and in typical code (used to scale the scores)
+static const double x86_random = double(sizeof(x86_ops))/256.0, x86_code = 0.28;
+static const double a32_random = 16.0/256.0, a32_code = 0.75;   // top nybble 0xE = "always" condition
+static const double a64_random = double(sizeof(a64_ops))/256.0, a64_code = 0.45;
+
+// Flags for the top byte of a 32-bit word: bit 0 = like A32, bit 1 = like A64
+static const unsigned char *top_flags()
+{
+	static const std::vector<unsigned char> flags = []
+	{
+		std::vector<unsigned char> ff(256);
+		for (int ii = 0xE0; ii <= 0xEF; ++ii)
+			ff[ii] |= 1;
+		for (unsigned char op : a64_ops)
+			ff[op] |= 2;
+		return ff;
+	}();
+	return &flags[0];
+}
+
+// Returns n * log2(n), using a table for counts that fit in an elt
+static double nlog2n(std::uint32_t nn)
+{
+	static const std::vector<double> table = []
+	{
+		std::vector<double> tt(65537);
+		for (std::size_t ii = 1; ii < tt.size(); ++ii)
+			tt[ii] = double(ii) * std::log2(double(ii));
+		return tt;
+	}();
+	return nn < table.size() ? table[nn] : double(nn) * std::log2(double(nn));
+}
+
+void aerial_metrics::clear()
+{
+	memset(hist_, 0, sizeof(hist_));
+	words_ = a32_ = a64_ = 0;
+	count_ = 0;
+	merged_ = false;
+}
+
+void aerial_metrics::merge() const
+{
+	if (merged_)
+		return;
+
+	std::uint32_t most = 0;
+	double sum[4] = { 0.0, 0.0, 0.0, 0.0 };     // separate sums so the adds can overlap
+	for (int ii = 0; ii < 256; ii += 4)
+	{
+		for (int jj = 0; jj < 4; ++jj)
+		{
+			std::uint32_t tt = hist_[0][ii+jj] + hist_[1][ii+jj] + hist_[2][ii+jj] + hist_[3][ii+jj];
+			total_[ii+jj] = tt;
+			most = std::max(most, tt);
+			sum[jj] += nlog2n(tt);
+		}
+	}
+	most_ = most;
+	sum_nlog2n_ = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+	merged_ = true;
+}
+
+void aerial_metrics::add(const unsigned char *buf, std::size_t len)
+{
+	const unsigned char *flags = top_flags();
+	const unsigned char *pp = buf, *pend = buf + len;
+	merged_ = false;
+
+	// Does one byte keeping track of where the aligned words are
+	auto add_byte = [&](unsigned char bb)
+	{
+		++hist_[0][bb];
+		if ((count_ & 3) == 3)
+		{
+			++words_;
+			a32_ += flags[bb] & 1;
+			a64_ += flags[bb] >> 1;
+		}
+		++count_;
+	};
+
+	for ( ; pp < pend && (count_ & 3) != 0; ++pp)
+		add_byte(*pp);
+
+	const unsigned char *pwords = pp + ((pend - pp) & ~std::ptrdiff_t(3));
+	std::size_t nwords = (pwords - pp)/4;
+	for ( ; pp < pwords; pp += 4)
+	{
+		++hist_[0][pp[0]];
+		++hist_[1][pp[1]];
+		++hist_[2][pp[2]];
+		++hist_[3][pp[3]];
+		a32_ += flags[pp[3]] & 1;
+		a64_ += flags[pp[3]] >> 1;
+	}
+	words_ += std::uint32_t(nwords);
+	count_ += nwords * 4;
+
+	for ( ; pp < pend; ++pp)
+		add_byte(*pp);
+}
+
+double aerial_metrics::entropy() const
+{
+	if (count_ == 0)
+		return 0.0;
+	merge();
+	return std::max(0.0, std::log2(double(count_)) - sum_nlog2n_/double(count_));
+}
+
+double aerial_metrics::zero_ratio() const
+{
+	if (count_ == 0)
+		return 0.0;
+	merge();
+	return double(total_[0])/double(count_);
+}
+
+double aerial_metrics::ascii_ratio() const
+{
+	if (count_ == 0)
+		return 0.0;
+	merge();
+	std::uint32_t nn = total_['\t'] + total_['\r'] + total_['\n'];
+	for (int ii = 0x20; ii < 0x7F; ++ii)
+		nn += total_[ii];
+	return double(nn)/double(count_);
+}
+
+double aerial_metrics::high_ratio() const
+{
+	if (count_ == 0)
+		return 0.0;
+	merge();
+	std::uint32_t nn = 0;
+	for (int ii = 0x80; ii < 0x100; ++ii)
+		nn += total_[ii];
+	return double(nn)/double(count_);
+}
+
+double aerial_metrics::x86_score() const
+{
+	if (count_ == 0)
+		return 0.0;
+	merge();
+	std::uint32_t nn = 0;
+	for (unsigned char op : x86_ops)
+		nn += total_[op];
+	return std::max(0.0, (double(nn)/double(count_) - x86_random)/(x86_code - x86_random));
+}
+
+double aerial_metrics::arm_score() const
+{
+	if (words_ == 0)
+		return 0.0;
+	double a32 = (double(a32_)/double(words_) - a32_random)/(a32_code - a32_random);
+	double a64 = (double(a64_)/double(words_) - a64_random)/(a64_code - a64_random);
+	return std::max(0.0, std::max(a32, a64));
+}
+
+aerial_metrics::kind_t aerial_metrics::kind() const
+{
+	if (count_ == 0)
+		return KIND_DATA;
+
+	if (zero_ratio() >= 0.9)
+		return KIND_ZERO;
+	merge();
+	if (double(most_)/double(count_) >= 0.9)
+		return KIND_FILL;
+	if (ascii_ratio() >= 0.9)
+		return KIND_TEXT;
+
+	// Random data does not have a full 8 bits of entropy unless there are a lot of bytes, so
+	// compare against the expected entropy of random bytes (allowing for the bias of the estimate).
+	double bins = double(std::min<std::size_t>(count_, 256));
+	double random = std::log2(bins) - (bins - 1.0)/(2.0 * double(count_) * std::log(2.0));
+	if (entropy() >= 0.97 * random)
+		return KIND_RANDOM;
+
+	double x86 = x86_score(), arm = arm_score();
+	if (arm >= 0.5 && arm >= x86)
+		return KIND_ARM;
+	if (x86 >= 0.5)
+		return KIND_X86;
+	return KIND_DATA;
+}
+
+const char *aerial_metrics::kind_name(kind_t kind)
+{
+	switch (kind)
+	{
+	case KIND_ZERO:   return "Zero padding";
+	case KIND_FILL:   return "Fill bytes";
+	case KIND_TEXT:   return "Text";
+	case KIND_X86:    return "x86 code";
+	case KIND_ARM:    return "ARM code";
+	case KIND_RANDOM: return "Compressed/encrypted";
+	default:          return "Data";
+	}
+}
+
+void aerial_metrics::colour(unsigned char *bgr) const
+{
+	unsigned char r, g, b;
+	switch (kind())
+	{
+	case KIND_ZERO:   r = 0;   g = 0;   b = 0;   break;
+	case KIND_FILL:   r = 64;  g = 64;  b = 64;  break;
+	case KIND_TEXT:   r = 40;  g = 200; b = 40;  break;
+	case KIND_X86:    r = 50;  g = 90;  b = 240; break;
+	case KIND_ARM:    r = 0;   g = 200; b = 210; break;
+	case KIND_RANDOM: r = 235; g = 30;  b = 30;  break;
+	default:
+		// Other data is grey - lighter the higher the entropy
+		r = g = b = static_cast<unsigned char>(80 + int(entropy() * 20.0));
+		break;
+	}
+	bgr[0] = b;
+	bgr[1] = g;
+	bgr[2] = r;
+}
+
+std::size_t aerial_metrics::reduce(const unsigned char *buf, std::size_t len, int level, unsigned char *dest)
+{
+	const std::size_t bpe = std::size_t(1) << level;
+	aerial_metrics mm;
+	std::size_t elts = 0;
+	for (std::size_t off = 0; off < len; off += bpe, dest += 3, ++elts)
+	{
+		mm.clear();
+		mm.add(buf + off, std::min(bpe, len - off));   // last elt of the file may be short
+		mm.colour(dest);
+	}
+	return elts;
+}
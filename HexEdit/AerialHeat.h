@@ -0,0 +1,68 @@
+// AerialHeat.h : statistics of blocks of bytes for the aerial view heat map
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// In heat map mode each elt of the aerial view is coloured by the kind of data in its bytes
+// rather than the average colour of the bytes.  This makes it easy to spot (eg in a firmware
+// image) compressed or encrypted regions, code, text and padding.  The statistics gathered are:
+//
+// - Shannon entropy in bits per byte (8 for random data)
+// - the proportion of zero bytes, ASCII text bytes and bytes with the high bit on
+// - opcode density scores for x86 (common opcode bytes) and ARM (the top byte of each
+//   aligned 32-bit word as used for A32 condition codes and common A64 instructions)
+//
+// The opcode scores are simple heuristics: 0 means like random data and 1 (or more) means
+// like typical compiled code.  Entropy of a few bytes does not mean much so heat map elts
+// are at least 256 bytes (see MIN_LEVEL).
+class aerial_metrics
+{
+public:
+	enum kind_t { KIND_DATA, KIND_ZERO, KIND_FILL, KIND_TEXT, KIND_X86, KIND_ARM, KIND_RANDOM };
+	enum { MIN_LEVEL = 8 };             // log2 of the smallest BPE of a heat map
+
+	aerial_metrics() { clear(); }
+
+	void clear();
+	void add(const unsigned char *buf, std::size_t len);   // accumulate stats of more bytes
+
+	std::size_t count() const { return count_; }
+	double entropy() const;             // bits per byte (0 to 8)
+	double zero_ratio() const;          // proportion of bytes that are zero (0 to 1)
+	double ascii_ratio() const;         // proportion of printable ASCII, tab, CR and LF bytes
+	double high_ratio() const;          // proportion of bytes with the top bit on
+	double x86_score() const;
+	double arm_score() const;
+
+	kind_t kind() const;                // what the bytes probably are
+	static const char *kind_name(kind_t kind);
+	void colour(unsigned char *bgr) const;  // heat map colour (blue, green, red)
+
+	// Calculates heat map elts of 2^level bytes from len bytes at buf, writing 3 bytes
+	// (blue, green, red) per elt to dest.  Returns the number of elts written.
+	static std::size_t reduce(const unsigned char *buf, std::size_t len, int level, unsigned char *dest);
+
+private:
+	std::uint32_t hist_[4][256];        // byte counts (4 tables so consecutive increments don't wait on each other)
+	std::uint32_t words_;               // aligned 32-bit words seen
+	std::uint32_t a32_, a64_;           // words with a top byte like an A32 or A64 instruction
+	std::size_t count_;                 // total bytes
+
+	// Results are calculated from the byte counts when first needed
+	mutable bool merged_;               // are the following valid?
+	mutable std::uint32_t total_[256];  // sum of the hist_ tables
+	mutable std::uint32_t most_;        // highest count of any byte value
+	mutable double sum_nlog2n_;         // sum of count * log2(count) for all byte values (for entropy)
+	void merge() const;
+};
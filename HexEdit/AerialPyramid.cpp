@@ -0,0 +1,259 @@
+// AerialPyramid.cpp : implementation of the aerial_pyramid class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "AerialPyramid.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+void aerial_pyramid::clear()
+{
+	tiles_.clear();
+	memory_ = 0;
+	++generation_;
+}
+
+void aerial_pyramid::set_length(std::int64_t length)
+{
+	ASSERT(length >= 0);
+	if (length != length_)
+	{
+		discard(std::min(length, length_));
+		length_ = length;
+	}
+}
+
+int aerial_pyramid::level_of(int bpe)
+{
+	int level = 0;
+	while (level < MAX_LEVEL && (1 << level) < bpe)
+		++level;
+	return level;
+}
+
+std::int64_t aerial_pyramid::tile_elts(int level, std::int64_t tile) const
+{
+	std::int64_t start = tile * tile_bytes(level);
+	if (tile < 0 || start >= length_)
+		return 0;
+	std::int64_t elts = ((length_ - start - 1) >> level) + 1;
+	return std::min<std::int64_t>(elts, TILE_ELTS);
+}
+
+// Returns true if some elts of the tile need to be calculated from the file, and the range of
+// those elts in first and last.  A tile that has never been calculated needs all its elts.
+bool aerial_pyramid::need(int level, std::int64_t tile, std::int64_t &first, std::int64_t &last) const
+{
+	std::map<key_t, tile_t>::const_iterator pt = tiles_.find(key(level, tile));
+	if (pt == tiles_.end())
+	{
+		first = 0;
+		last = tile_elts(level, tile);
+	}
+	else
+	{
+		first = pt->second.dirty_first;
+		last = pt->second.dirty_last;
+	}
+	return first < last;
+}
+
+void aerial_pyramid::touch(int level, std::int64_t tile)
+{
+	std::map<key_t, tile_t>::iterator pt = tiles_.find(key(level, tile));
+	if (pt != tiles_.end())
+		pt->second.last_used = ++clock_;
+}
+
+// Stores calculated elts [first, first+count) of a tile, creating the tile if necessary.
+void aerial_pyramid::put(int level, std::int64_t tile, std::int64_t first, const unsigned char *bits, std::int64_t count)
+{
+	std::int64_t elts = tile_elts(level, tile);
+	if (first < 0 || first + count > elts || count <= 0)
+	{
+		ASSERT(0);
+		return;
+	}
+
+	std::map<key_t, tile_t>::iterator pt = tiles_.find(key(level, tile));
+	if (pt == tiles_.end())
+	{
+		pt = tiles_.insert(std::make_pair(key(level, tile), tile_t())).first;
+		pt->second.bits.resize(size_t(elts) * BYTES_PER_ELT);
+		pt->second.dirty_first = 0;
+		pt->second.dirty_last = elts;
+		memory_ += pt->second.bits.size();
+	}
+	tile_t &tt = pt->second;
+	memcpy(&tt.bits[size_t(first) * BYTES_PER_ELT], bits, size_t(count) * BYTES_PER_ELT);
+	tt.last_used = ++clock_;
+
+	// Reduce the dirty range by the part we just filled in
+	std::int64_t end = first + count;
+	if (first <= tt.dirty_first && end >= tt.dirty_last)
+		tt.dirty_first = tt.dirty_last = 0;
+	else if (first <= tt.dirty_first && end > tt.dirty_first)
+		tt.dirty_first = end;
+	else if (first < tt.dirty_last && end >= tt.dirty_last)
+		tt.dirty_last = first;
+}
+
+// If the two tiles of the next finer level that cover the same bytes are available (and not
+// dirty) then this makes the tile by averaging pairs of their elts and returns true.
+bool aerial_pyramid::downsample(int level, std::int64_t tile)
+{
+	if (level < 1 || level > MAX_LEVEL)
+		return false;
+	std::int64_t elts = tile_elts(level, tile);
+	if (elts == 0)
+		return false;
+
+	const tile_t *child[2];
+	for (int cc = 0; cc < 2; ++cc)
+	{
+		child[cc] = NULL;
+		if (tile_elts(level - 1, tile*2 + cc) == 0)
+			continue;               // past EOF
+		std::map<key_t, tile_t>::const_iterator pt = tiles_.find(key(level - 1, tile*2 + cc));
+		if (pt == tiles_.end() || pt->second.dirty_first < pt->second.dirty_last)
+			return false;
+		child[cc] = &pt->second;
+	}
+
+	std::vector<unsigned char> bits(size_t(elts) * BYTES_PER_ELT);
+	for (std::int64_t ii = 0; ii < elts; ++ii)
+	{
+		const tile_t *pc = child[ii / (TILE_ELTS/2)];
+		ASSERT(pc != NULL);
+		size_t jj = size_t(ii % (TILE_ELTS/2)) * 2;             // 1st of the 2 child elts
+		const unsigned char *ps = &pc->bits[jj * BYTES_PER_ELT];
+		unsigned char *pd = &bits[size_t(ii) * BYTES_PER_ELT];
+		if ((jj + 1) * BYTES_PER_ELT < pc->bits.size())
+		{
+			for (int kk = 0; kk < BYTES_PER_ELT; ++kk)
+				pd[kk] = static_cast<unsigned char>((ps[kk] + ps[kk + BYTES_PER_ELT] + 1) / 2);
+		}
+		else
+			memcpy(pd, ps, BYTES_PER_ELT);                      // last elt of the file
+	}
+	put(level, tile, 0, &bits[0], elts);
+	return true;
+}
+
+// Copies count elts (starting at elt number first) at a level to dest.  Elts that have not
+// been calculated (or are past EOF) are set to the grey given by fill.  Dirty elts are copied
+// (they are probably only slightly out of date).  Returns false if some elts were not available.
+bool aerial_pyramid::copy(int level, std::int64_t first, std::int64_t count, unsigned char *dest, unsigned char fill)
+{
+	bool retval = true;
+	while (count > 0)
+	{
+		std::int64_t tile = first / TILE_ELTS;
+		std::int64_t offset = first % TILE_ELTS;
+		std::int64_t len = std::min<std::int64_t>(count, TILE_ELTS - offset);
+
+		std::map<key_t, tile_t>::iterator pt = tiles_.find(key(level, tile));
+		std::int64_t avail = 0;
+		if (pt != tiles_.end())
+		{
+			tile_t &tt = pt->second;
+			tt.last_used = ++clock_;
+			avail = std::max<std::int64_t>(0, std::min<std::int64_t>(len, std::int64_t(tt.bits.size()/BYTES_PER_ELT) - offset));
+			memcpy(dest, &tt.bits[size_t(offset) * BYTES_PER_ELT], size_t(avail) * BYTES_PER_ELT);
+			if (tt.dirty_first < tt.dirty_last && tt.dirty_first < offset + len && tt.dirty_last > offset)
+				retval = false;
+		}
+		else if (tile_elts(level, tile) > 0)
+			retval = false;
+		memset(dest + avail * BYTES_PER_ELT, fill, size_t(len - avail) * BYTES_PER_ELT);
+
+		dest += len * BYTES_PER_ELT;
+		first += len;
+		count -= len;
+	}
+	return retval;
+}
+
+// Marks the elts (at all levels) that contain bytes that have been replaced as needing recalculation.
+void aerial_pyramid::invalidate(std::int64_t start, std::int64_t end)
+{
+	if (start >= end)
+		return;
+	++generation_;
+	for (int level = 0; level <= MAX_LEVEL; ++level)
+	{
+		std::int64_t tb = tile_bytes(level);
+		std::map<key_t, tile_t>::iterator pt = tiles_.lower_bound(key(level, start / tb));
+		for ( ; pt != tiles_.end() && pt->first.first == level && pt->first.second * tb < end; ++pt)
+		{
+			tile_t &tt = pt->second;
+			std::int64_t ts = pt->first.second * tb;
+			std::int64_t ff = (std::max(start, ts) - ts) >> level;
+			std::int64_t ll = ((std::min(end, ts + tb) - 1 - ts) >> level) + 1;
+			ll = std::min<std::int64_t>(ll, std::int64_t(tt.bits.size()/BYTES_PER_ELT));
+			if (tt.dirty_first >= tt.dirty_last)
+			{
+				tt.dirty_first = ff;
+				tt.dirty_last = ll;
+			}
+			else
+			{
+				tt.dirty_first = std::min(tt.dirty_first, ff);
+				tt.dirty_last = std::max(tt.dirty_last, ll);
+			}
+		}
+	}
+}
+
+// Discards all tiles (at all levels) that include bytes at or after start.
+void aerial_pyramid::discard(std::int64_t start)
+{
+	++generation_;
+	for (int level = 0; level <= MAX_LEVEL; ++level)
+	{
+		std::map<key_t, tile_t>::iterator pt = tiles_.lower_bound(key(level, start / tile_bytes(level)));
+		while (pt != tiles_.end() && pt->first.first == level)
+		{
+			memory_ -= pt->second.bits.size();
+			pt = tiles_.erase(pt);
+		}
+	}
+}
+
+// Discards the least recently used tiles until the tiles use no more than max_memory bytes.
+// Tiles used since the clock() value keep_since (eg, those currently displayed) are never
+// discarded, otherwise they would just be recalculated again.
+void aerial_pyramid::trim(std::size_t max_memory, unsigned keep_since)
+{
+	if (memory_ <= max_memory)
+		return;
+
+	std::vector<std::pair<unsigned, key_t> > lru;
+	lru.reserve(tiles_.size());
+	for (std::map<key_t, tile_t>::const_iterator pt = tiles_.begin(); pt != tiles_.end(); ++pt)
+		lru.push_back(std::make_pair(pt->second.last_used, pt->first));
+	std::sort(lru.begin(), lru.end());
+
+	for (std::vector<std::pair<unsigned, key_t> >::const_iterator pp = lru.begin();
+		 pp != lru.end() && memory_ > max_memory && pp->first < keep_since;
+		 ++pp)
+	{
+		std::map<key_t, tile_t>::iterator pt = tiles_.find(pp->second);
+		memory_ -= pt->second.bits.size();
+		tiles_.erase(pt);
+	}
+}
@@ -0,0 +1,81 @@
+// AerialPyramid.h : multi-resolution tiles of the aerial view "bitmap"
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+// The aerial view shows one pixel ("elt") for every BPE bytes of the file where BPE is a power
+// of two (1 to 65536).  Rather than one bitmap of the whole file at a single BPE we keep tiles of
+// TILE_ELTS elts at every level (level N has a BPE of 2^N) but only for the parts of the file that
+// are (or have recently been) displayed.  A tile at level N covers the same bytes as two tiles at
+// level N-1 so if those are available it can be made by averaging pairs of elts without reading
+// the file.  Tiles (least recently used first) are discarded to keep within a memory limit.
+//
+// When bytes are replaced only the elts that contain them are marked "dirty", at every level,
+// so that just those elts need to be recalculated.  Insertions and deletions move everything
+// after them so all tiles from that point are discarded.
+//
+// Each elt is 3 bytes (blue, green, red) as used in a 24-bit DIB.
+// Note that this class does no locking - the caller must prevent concurrent access.
+class aerial_pyramid
+{
+public:
+	enum { TILE_ELTS = 65536, MAX_LEVEL = 16, BYTES_PER_ELT = 3 };
+
+	aerial_pyramid() : length_(0), generation_(0), clock_(0), memory_(0) { }
+
+	// Construction
+	void clear();                                           // discard all tiles
+	void set_length(std::int64_t length);                   // file length has changed (discards tiles past EOF)
+
+	// Attributes
+	std::int64_t length() const { return length_; }
+	unsigned generation() const { return generation_; }     // changes whenever tiles are invalidated
+	std::size_t memory() const { return memory_; }          // bytes used by all tile bitmaps
+	std::size_t num_tiles() const { return tiles_.size(); }
+	unsigned clock() const { return clock_; }               // see touch() and trim()
+
+	static int level_of(int bpe);                           // level for a BPE (rounded up to a power of 2)
+	static std::int64_t tile_bytes(int level) { return std::int64_t(TILE_ELTS) << level; }
+	std::int64_t tile_elts(int level, std::int64_t tile) const; // elts in a tile (less than TILE_ELTS at EOF)
+	bool has_tile(int level, std::int64_t tile) const { return tiles_.find(key(level, tile)) != tiles_.end(); }
+
+	// Operations
+	bool need(int level, std::int64_t tile, std::int64_t &first, std::int64_t &last) const;  // elts that need calculating
+	void touch(int level, std::int64_t tile);               // mark a tile as recently used
+	void put(int level, std::int64_t tile, std::int64_t first, const unsigned char *bits, std::int64_t count);
+	bool downsample(int level, std::int64_t tile);          // make tile from finer tiles if they are available
+	bool copy(int level, std::int64_t first, std::int64_t count, unsigned char *dest, unsigned char fill);
+	void invalidate(std::int64_t start, std::int64_t end);  // bytes [start, end) have been replaced
+	void discard(std::int64_t start);                       // bytes from start have moved (insert/delete)
+	void trim(std::size_t max_memory, unsigned keep_since); // discard least recently used tiles (but not any used since keep_since)
+
+private:
+	typedef std::pair<int, std::int64_t> key_t;             // level and tile number
+	static key_t key(int level, std::int64_t tile) { return key_t(level, tile); }
+
+	struct tile_t
+	{
+		std::vector<unsigned char> bits;                    // BYTES_PER_ELT bytes for each elt of the tile
+		std::int64_t dirty_first, dirty_last;               // elts that need recalculating (none if first >= last)
+		unsigned last_used;                                 // value of clock_ when last used
+	};
+	std::map<key_t, tile_t> tiles_;
+
+	std::int64_t length_;                                   // file length
+	unsigned generation_;
+	unsigned clock_;                                        // incremented whenever a tile is used (for LRU)
+	std::size_t memory_;
+};
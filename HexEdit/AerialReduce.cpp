@@ -0,0 +1,116 @@
+// AerialReduce.cpp : implementation of the aerial_reducer class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "AerialReduce.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+aerial_reducer::aerial_reducer()
+{
+	for (int ii = 0; ii < 256; ++ii)
+		set_colour(ii, 0);
+}
+
+void aerial_reducer::set_colour(int value, std::uint32_t rgb)
+{
+	ASSERT(value >= 0 && value < 256);
+	std::uint64_t r = rgb & 0xFF, g = (rgb >> 8) & 0xFF, b = (rgb >> 16) & 0xFF;
+	sum_lut_[value] = b | (g << 16) | (r << 32);
+	bgr_lut_[value][0] = static_cast<unsigned char>(b);
+	bgr_lut_[value][1] = static_cast<unsigned char>(g);
+	bgr_lut_[value][2] = static_cast<unsigned char>(r);
+}
+
+// Returns the packed sums of the colours of count (at most 256) bytes.  Two accumulators
+// are used so that the adds of consecutive bytes do not depend on each other.
+std::uint64_t aerial_reducer::sum_block(const unsigned char *pp, std::size_t count) const
+{
+	ASSERT(count <= 256);
+	std::uint64_t s0 = 0, s1 = 0;
+	const unsigned char *pend = pp + (count & ~std::size_t(3));
+	for ( ; pp < pend; pp += 4)
+	{
+		s0 += sum_lut_[pp[0]] + sum_lut_[pp[2]];
+		s1 += sum_lut_[pp[1]] + sum_lut_[pp[3]];
+	}
+	for (pend += count & 3; pp < pend; ++pp)
+		s0 += sum_lut_[*pp];
+	return s0 + s1;
+}
+
+std::size_t aerial_reducer::reduce(const unsigned char *buf, std::size_t len, int level, unsigned char *dest) const
+{
+	ASSERT(level >= 0 && level <= 16);
+	const std::size_t bpe = std::size_t(1) << level;
+	const std::size_t whole = len >> level;           // elts with all their bytes
+
+	if (level == 0)
+	{
+		for (const unsigned char *pp = buf, *pend = buf + len; pp < pend; ++pp, dest += 3)
+			memcpy(dest, bgr_lut_[*pp], 3);
+		return len;
+	}
+
+	const unsigned char *pp = buf;
+	if (level <= 8)
+	{
+		// The sums of an elt fit in the 16-bit fields
+		for (std::size_t ee = 0; ee < whole; ++ee, pp += bpe, dest += 3)
+		{
+			std::uint64_t sum = sum_block(pp, bpe);
+			dest[0] = static_cast<unsigned char>((sum & 0xFFFF) >> level);
+			dest[1] = static_cast<unsigned char>(((sum >> 16) & 0xFFFF) >> level);
+			dest[2] = static_cast<unsigned char>(((sum >> 32) & 0xFFFF) >> level);
+		}
+	}
+	else
+	{
+		for (std::size_t ee = 0; ee < whole; ++ee, dest += 3)
+		{
+			std::uint32_t b = 0, g = 0, r = 0;
+			for (const unsigned char *pend = pp + bpe; pp < pend; pp += 256)
+			{
+				std::uint64_t sum = sum_block(pp, 256);
+				b += std::uint32_t(sum & 0xFFFF);
+				g += std::uint32_t((sum >> 16) & 0xFFFF);
+				r += std::uint32_t((sum >> 32) & 0xFFFF);
+			}
+			dest[0] = static_cast<unsigned char>(b >> level);
+			dest[1] = static_cast<unsigned char>(g >> level);
+			dest[2] = static_cast<unsigned char>(r >> level);
+		}
+	}
+
+	// Last elt of the file may be short so it is the only one that needs a divide
+	std::size_t left = len - (whole << level);
+	if (left == 0)
+		return whole;
+
+	std::uint32_t b = 0, g = 0, r = 0;
+	for (const unsigned char *pend = buf + len; pp < pend; pp += 256)
+	{
+		std::uint64_t sum = sum_block(pp, std::min<std::size_t>(256, pend - pp));
+		b += std::uint32_t(sum & 0xFFFF);
+		g += std::uint32_t((sum >> 16) & 0xFFFF);
+		r += std::uint32_t((sum >> 32) & 0xFFFF);
+	}
+	dest[0] = static_cast<unsigned char>(b / left);
+	dest[1] = static_cast<unsigned char>(g / left);
+	dest[2] = static_cast<unsigned char>(r / left);
+	return whole + 1;
+}
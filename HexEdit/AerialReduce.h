@@ -0,0 +1,53 @@
+// AerialReduce.h : reduces file bytes to aerial view pixels
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Each elt (pixel) of the aerial view is the average colour of BPE bytes of the file where
+// each byte value has a colour (from the colour scheme of the hex view).  This is the inner
+// loop of the aerial view scan so it avoids per-byte COLORREF unpacking and per-elt divisions:
+//
+// - the blue, green and red values of each colour are packed into 16-bit fields of one 64-bit
+//   table entry so that a single add accumulates all three for a byte
+// - as a 16-bit field can hold the sum of 256 bytes, elts of more than 256 bytes are summed in
+//   blocks of 256 and the fields then added to 32-bit totals
+// - BPE is always a power of two so the averages are calculated with shifts
+//
+// The results are the same as dividing the sum of each colour component by the BPE.
+class aerial_reducer
+{
+public:
+	aerial_reducer();
+
+	// Sets the colour of a byte value (rgb is a Windows COLORREF ie 0x00BBGGRR)
+	void set_colour(int value, std::uint32_t rgb);
+
+	// Sets the colours of all 256 byte values from a container of 256 COLORREFs
+	template <class C> void set_colours(const C &colours)
+	{
+		for (int ii = 0; ii < 256; ++ii)
+			set_colour(ii, static_cast<std::uint32_t>(colours[ii]));
+	}
+
+	// Reduces len bytes at buf to elts of 2^level bytes, writing 3 bytes (blue, green, red) per
+	// elt to dest.  If len is not a multiple of the BPE the last elt is the average of the bytes
+	// that are left (as at EOF).  Returns the number of elts written.
+	std::size_t reduce(const unsigned char *buf, std::size_t len, int level, unsigned char *dest) const;
+
+private:
+	std::uint64_t sum_lut_[256];        // blue, green, red in bits 0-15, 16-31, 32-47
+	unsigned char bgr_lut_[256][3];     // colours for a BPE of 1
+
+	std::uint64_t sum_block(const unsigned char *pp, std::size_t count) const;   // count <= 256
+};
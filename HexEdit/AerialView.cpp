@@ -29,6 +29,8 @@ CAerialView::CAerialView()
 	phev_ = NULL;
 	scrollpos_ = -1;
 	actual_dpix_ = -1;
+	bpe_ = -1;
+	bits_ok_ = false;
 	mouse_down_ = false;
 	rows_ = cols_ = -1;
 
@@ -111,6 +113,8 @@ BEGIN_MESSAGE_MAP(CAerialView, CView)
 	ON_COMMAND(ID_AERIAL_ZOOM14, OnZoom14)
 	ON_COMMAND(ID_AERIAL_ZOOM15, OnZoom15)
 	ON_COMMAND(ID_AERIAL_ZOOM16, OnZoom16)
+	ON_COMMAND(ID_AERIAL_HEAT, OnHeatMap)
+	ON_UPDATE_COMMAND_UI(ID_AERIAL_HEAT, OnUpdateHeatMap)
 	ON_UPDATE_COMMAND_UI(ID_AERIAL_ZOOM1, OnUpdateZoom1)
 	ON_UPDATE_COMMAND_UI(ID_AERIAL_ZOOM2, OnUpdateZoom2)
 	ON_UPDATE_COMMAND_UI(ID_AERIAL_ZOOM3, OnUpdateZoom3)
@@ -149,10 +153,10 @@ END_MESSAGE_MAP()
 ///////////////////////////////////////////////////////////////////////////////
 // CAerialView drawing
 
-// Note that the FreeImage bitmap is a "summary" of the file where one pixel of
+// Note that the bitmap is a "summary" of the file where one pixel of
 // the bitmap corresponds to one or more bytes of the file (see BPE - bytes/elt).
 // The actual display of the bitmap in the view's window requires BLT from the
-// FreeImage bitmap - one bitmap pixel may be BLTed into a block of pixels in the
+// bitmap - one bitmap pixel may be BLTed into a block of pixels in the
 // window (ie single pixel, 2x2, 3x3 ... 7x7) as determined by actual_dpix_.
 // Further is the whole bitmap cannot be displayed we only show part of it
 // as determined by scrollpos_, rows_, and cols_.
@@ -169,8 +173,8 @@ END_MESSAGE_MAP()
 
 // So we have 5 "coordinate" systems:
 // A) file address
-// B) elt as sequential position in FreeImage bitmap
-// C) elt as pixel in FreeImage bitmap - varies depending on how the bitmap has been re-shaped
+// B) elt as sequential position in bitmap
+// C) elt as pixel in bitmap - varies depending on how the bitmap has been re-shaped
 // D) elt as pixel on the screen = C shifted vertically
 // W) windows coords in pixels
 // A to B: divide by BPE
@@ -204,6 +208,12 @@ void CAerialView::OnInitialUpdate()
 	disp_state_ = atoi(pfl->GetData(recent_file_index, CHexFileList::AERIALDISPLAY));
 	scrollpos_ = _atoi64(pfl->GetData(recent_file_index, CHexFileList::AERIALPOS));
 	if (disp_.dpix < 1 || disp_.dpix > MAX_DPIX) disp_.dpix = 1; // make sure we don't get div0 errors
+	if (disp_.level > 0)
+		bpe_ = 1 << std::min<int>(disp_.level - 1, aerial_pyramid::MAX_LEVEL);
+	else
+		bpe_ = GetDocument()->GetBpe();
+	if (bpe_ < min_bpe())
+		bpe_ = min_bpe();
 
 	get_disp_params(rows_, cols_, actual_dpix_);
 
@@ -223,7 +233,7 @@ void CAerialView::OnInitialUpdate()
 }
 
 // OnUpdate is called when the document changes
-// - background calc of elts (FreeImage bitmap) is finished (or is finished for display area)
+// - background calc of elts (bitmap tiles) is finished (or is finished for display area)
 // - doc changes requiring recalc of the elts
 // - bpe changes requiring recalc of the elts
 // - background search finished (CBGSearchHint) - perhaps display bg search occurrences
@@ -249,7 +259,7 @@ void CAerialView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 void CAerialView::OnDraw(CDC* pDC)
 {
 	if (actual_dpix_ == -1) return;          // Seems to happen at startup
-	int width = GetDocument()->GetBpe() * cols_;
+	int width = bpe_ * cols_;
 
 	// Use memory DC for double buffering.  (Will render to pDC in bufDC d'tor.)
 	CMemDC bufDC(*pDC, this);
@@ -269,9 +279,8 @@ void CAerialView::OnDraw(CDC* pDC)
 	GetClientRect(rct);
 
 	// Work out the max row that the BitBlt is going to fill
-	BITMAPINFOHEADER *bih = FreeImage_GetInfoHeader(GetDocument()->dib_);
-	int max_row = int((GetDocument()->NumElts()-1)/cols_) + 1 - 
-				  int(scrollpos_/(GetDocument()->GetBpe() * cols_));
+	int max_row = int((num_elts()-1)/cols_) + 1 - 
+				  int(scrollpos_/(bpe_ * cols_));
 
 	// Fill the borders
 	rct.left = bdr_left_ + cols_*actual_dpix_;
@@ -415,8 +424,8 @@ void CAerialView::OnDraw(CDC* pDC)
 		}
 		else
 		{
-			int left = int(start_addr/GetDocument()->GetBpe()) %cols_;
-			int right = int((end_addr-1)/GetDocument()->GetBpe()) % cols_ + 1;
+			int left = int(start_addr/bpe_) %cols_;
+			int right = int((end_addr-1)/bpe_) % cols_ + 1;
 			if (left < right)
 				draw_top_border(&(bufDC.GetDC()), left, right, clr_sel);
 			else
@@ -489,6 +498,7 @@ BOOL CAerialView::OnEraseBkgnd(CDC* pDC)
 void CAerialView::OnDestroy()
 {
 	StopTimer();
+	GetDocument()->AerialWant(this, bpe_, 0, 0);   // we don't need any more tiles
 	CView::OnDestroy();
 }
 
@@ -500,7 +510,7 @@ void CAerialView::OnVScroll(UINT nSBCode, UINT nPos, CScrollBar* pScrollBar)
 BOOL CAerialView::OnScroll(UINT nScrollCode, UINT nPos, BOOL bDoScroll /*= TRUE*/)
 {
 	CHexEditDoc *pDoc = GetDocument();
-	int width = pDoc->GetBpe() * cols_;
+	int width = bpe_ * cols_;
 	ASSERT(scrollpos_/width < INT_MAX);
 	int pos = int(scrollpos_/width);                    // current pos as row no
 	ASSERT((pDoc->length()-1)/width + 1 < INT_MAX);
@@ -543,7 +553,7 @@ BOOL CAerialView::OnScroll(UINT nScrollCode, UINT nPos, BOOL bDoScroll /*= TRUE*
 void CAerialView::OnKeyDown(UINT nChar, UINT nRepCnt, UINT nFlags)
 {
 	CHexEditDoc *pDoc = GetDocument();
-	int width = GetDocument()->GetBpe() * cols_;
+	int width = bpe_ * cols_;
 	ASSERT(scrollpos_/width < INT_MAX);
 	int pos = int(scrollpos_/width);                    // current pos as row no
 	ASSERT((pDoc->length()-1)/width + 1 < INT_MAX);
@@ -590,27 +600,36 @@ BOOL CAerialView::OnMouseWheel(UINT nFlags, short zDelta, CPoint pt)
 		ScreenToClient(&pt);
 		int old_elt = elt_at(pt);       // Elt which the mouse is over
 
-		// Adjust the preferred zoom amount (disp_.dpix) and recalculate display based on the new value
+		// Adjust the BPE or the preferred zoom amount (disp_.dpix) and recalculate display based on the new value
 		int prev_dpix = actual_dpix_;
+		int prev_bpe = bpe_;
 		if (old_elt != -1)              // Only zoom if over a valid elt
 		{
 			bool zoomIn = zDelta > 0;
 			if (theApp.reverse_zoom_) zoomIn = !zoomIn;
 
-			// Zoom by binary multiple (ie double/half size)
-			if (zoomIn)
+			// Zoom by binary multiple (ie double/half size).  When zooming in we first show
+			// more detail (smaller BPE) until we get to one byte per elt, then make elts bigger.
+			// Zooming out makes elts smaller until they are one pixel, then increases the BPE.
+			if (zoomIn && bpe_ > min_bpe())
+				set_bpe(bpe_/2);
+			else if (zoomIn)
 			{
 				if (actual_dpix_*2 < MAX_DPIX)
 					set_zoom(actual_dpix_*2);
 				else
 					set_zoom(MAX_DPIX);
 			}
-			else if (!zoomIn && disp_.dpix/2 > 0)    // zoom in
+			else if (disp_.dpix/2 > 0)
 				set_zoom(disp_.dpix/2, false);
+			else if (bpe_ < (1 << aerial_pyramid::MAX_LEVEL))
+				set_bpe(bpe_*2);
 		}
 
-		if (actual_dpix_ != prev_dpix)
+		if (actual_dpix_ != prev_dpix || bpe_ != prev_bpe)
 		{
+			old_elt = int((FILE_ADDRESS(old_elt) * prev_bpe)/bpe_);  // elt at the same address with the new BPE
+
 			// Work out row of old_elt in new layout then and subtract no of rows
 			// to top of display to get the new scrollpos_.
 			int newpos = old_elt/cols_ - (pt.y - bdr_top_)/actual_dpix_;
@@ -622,9 +641,9 @@ BOOL CAerialView::OnMouseWheel(UINT nFlags, short zDelta, CPoint pt)
 
 			// Move the mouse pointer so it stays over the same address
 			// Note that we add actual_dpix_/2 to both X and Y to put it in the centre of the elt.
-			ASSERT(old_elt >= scrollpos_/GetDocument()->GetBpe());
+			ASSERT(old_elt >= scrollpos_/bpe_);
 			pt.x = bdr_left_ + old_elt%cols_ * actual_dpix_ + actual_dpix_/2;
-			pt.y = bdr_top_ + (old_elt - int(scrollpos_/GetDocument()->GetBpe()))/cols_ * actual_dpix_ + actual_dpix_/2;
+			pt.y = bdr_top_ + (old_elt - int(scrollpos_/bpe_))/cols_ * actual_dpix_ + actual_dpix_/2;
 			ClientToScreen(&pt);
 			ShowCursor(FALSE);          // we seem to get 2 cursors unless we hide before moving
 			SetCursorPos(pt.x, pt.y);
@@ -633,8 +652,8 @@ BOOL CAerialView::OnMouseWheel(UINT nFlags, short zDelta, CPoint pt)
 	}
 	else
 	{
-		ASSERT(scrollpos_/(GetDocument()->GetBpe() * cols_) < INT_MAX);
-		SetScroll(int(scrollpos_/(GetDocument()->GetBpe() * cols_)) - zDelta/actual_dpix_);
+		ASSERT(scrollpos_/(bpe_ * cols_) < INT_MAX);
+		SetScroll(int(scrollpos_/(bpe_ * cols_)) - zDelta/actual_dpix_);
 	}
 	return TRUE;
 }
@@ -642,13 +661,13 @@ BOOL CAerialView::OnMouseWheel(UINT nFlags, short zDelta, CPoint pt)
 void CAerialView::OnSize(UINT nType, int cx, int cy)
 {
 	if (phev_ == NULL || scrollpos_ < 0) return;
-	if (cx > 0 && cy > 0 && GetDocument()->GetBpe() > -1)
+	if (cx > 0 && cy > 0 && bpe_ > 0)
 	{
-		int width = GetDocument()->GetBpe() * cols_;        // old row width in bytes
+		int width = bpe_ * cols_;                           // old row width in bytes
 		ASSERT(scrollpos_/width < INT_MAX);
 		int pos = int(scrollpos_/width);                    // old pos as row no
 		get_disp_params(rows_, cols_, actual_dpix_);
-		width = GetDocument()->GetBpe() * cols_;            // new row width in bytes
+		width = bpe_ * cols_;                               // new row width in bytes
 		scrollpos_ = pos * width;                           // new scroll pos
 		update_bars();
 		update_display();
@@ -669,7 +688,7 @@ void CAerialView::OnTimer(UINT nIDEvent)
 			InvalidateRect(&rct, FALSE);
 		}
 
-		int width = GetDocument()->GetBpe() * cols_;
+		int width = bpe_ * cols_;
 		if (disp_.draw_ants_sel)
 		{
 			// Invalidate selection range
@@ -761,7 +780,7 @@ LRESULT CAerialView::OnMouseHover(WPARAM, LPARAM lp)
 	// Time to show a tip window if we are in the right place
 	CPoint pt(LOWORD(lp), HIWORD(lp));  // client window coords
 	int elt = elt_at(pt);
-	if (elt != -1 && elt < GetDocument()->NumElts() && update_tip(elt))
+	if (elt != -1 && elt < num_elts() && update_tip(elt))
 	{
 		CPoint tip_pt;
 		tip_pt = pt + CSize(::GetSystemMetrics(SM_CXCURSOR)/2, ::GetSystemMetrics(SM_CXCURSOR)/2); // Move tip window away from under mouse
@@ -826,7 +845,7 @@ void CAerialView::OnLButtonDblClk(UINT nFlags, CPoint point)
 	}
 	else
 	{
-		FILE_ADDRESS bpe = GetDocument()->GetBpe();     // use 64 bit int so next expression does not overflow
+		FILE_ADDRESS bpe = bpe_;                        // use 64 bit int so next expression does not overflow
 		FILE_ADDRESS addr = elt * bpe;
 		FILE_ADDRESS end;
 		if (bpe == 1)
@@ -864,7 +883,7 @@ void CAerialView::OnViewTest()
 // Make sure an address is visible within the display
 void CAerialView::ShowPos(FILE_ADDRESS addr)
 {
-	int width = GetDocument()->GetBpe() * cols_;                // row width in bytes
+	int width = bpe_ * cols_;                           // row width in bytes
 	int zone = 0;                                               // no of rows from top/bottom before scrolling
 	if (phev_ != NULL) zone = phev_->GetVertBufferZone();
 	if (zone > rows_/2) zone = rows_/2;                         // Can't be more than half window height
@@ -884,7 +903,7 @@ void CAerialView::ShowPos(FILE_ADDRESS addr)
 void CAerialView::SetScroll(int newpos)
 {
 	CHexEditDoc *pDoc = GetDocument();
-	int width = pDoc->GetBpe() * cols_;                 // row width in bytes
+	int width = bpe_ * cols_;                           // row width in bytes
 	ASSERT(scrollpos_/width < INT_MAX);
 	int pos = int(scrollpos_/width);                    // current pos as row no
 	ASSERT((pDoc->length()-1)/width + 1 < INT_MAX);
@@ -955,7 +974,7 @@ void CAerialView::update_bars()
 	si.fMask = SIF_ALL;
 
 	CHexEditDoc *pDoc = GetDocument();
-	int width = pDoc->GetBpe() * cols_;
+	int width = bpe_ * cols_;
 	int pos = int(scrollpos_/width);                    // current pos as row no
 	int endpos = int((pDoc->length()-1)/width + 1);     // row just past eof
 
@@ -998,7 +1017,7 @@ void CAerialView::get_disp_params(int &rows, int &cols, int &actual_dpix)
 			break;
 
 		// Check if we have expanded the size so it would no longer fit in the window
-		if ((GetDocument()->NumElts()-1) / cols + 1 > rows)
+		if ((num_elts()-1) / cols + 1 > rows)
 			break;
 	}
 	if (actual_dpix > disp_.dpix)
@@ -1015,7 +1034,7 @@ void CAerialView::get_disp_params(int &rows, int &cols, int &actual_dpix)
 	}
 
 	// Adjust scrollbar scaling factor as scroll bars seem to be limited to signed 16 bit numbers
-	int endy = int((GetDocument()->length()-1)/(GetDocument()->GetBpe() * cols_) + 1);
+	int endy = int((GetDocument()->length()-1)/(bpe_ * cols_) + 1);
 	// Make sure vertical dimensions do not overflow a signed 32 bit int as
 	// the bitmap cannot handle it.
 	ASSERT(endy < INT_MAX);
@@ -1027,12 +1046,17 @@ void CAerialView::get_disp_params(int &rows, int &cols, int &actual_dpix)
 
 void CAerialView::update_display()
 {
+	// Tell the document which tiles we need and get the displayed elts again when we draw
+	FILE_ADDRESS width = FILE_ADDRESS(bpe_) * cols_;
+	GetDocument()->AerialWant(this, bpe_, scrollpos_, scrollpos_ + rows_*width, disp_.heat != 0);
+	bits_ok_ = false;
+
 	// Find all search occurrences within the display
 	search_pair_.clear();
 	if (GetDocument()->CanDoSearch() && theApp.pboyer_ != NULL)
 	{
 		// Cache search occurrences found in the display area
-		FILE_ADDRESS end = scrollpos_ + rows_*cols_*GetDocument()->GetBpe();
+		FILE_ADDRESS end = scrollpos_ + rows_*cols_*bpe_;
 		size_t len = theApp.pboyer_->length();
 		std::vector<FILE_ADDRESS> sf = GetDocument()->SearchAddresses(scrollpos_ - len + 1, end + len);
 
@@ -1075,15 +1099,15 @@ void CAerialView::update_display()
 void CAerialView::invalidate_addr_range(FILE_ADDRESS start_addr, FILE_ADDRESS end_addr, bool no_border /*=false*/)
 {
 	CHexEditDoc *pDoc = GetDocument();
-	int width = GetDocument()->GetBpe() * cols_;
+	int width = bpe_ * cols_;
 
 	// Restrict to just what is in the display then convert to window device coords
 	if (start_addr < scrollpos_) start_addr = scrollpos_;
 	if (end_addr > scrollpos_ + width*rows_) end_addr = scrollpos_ + width*rows_;
 
 	// Work out the elts we are invalidating offset from the elt at the top-left
-	int start_elt = int((start_addr - scrollpos_)/GetDocument()->GetBpe());
-	int end_elt   = int((end_addr - 1 - scrollpos_)/GetDocument()->GetBpe() + 1);
+	int start_elt = int((start_addr - scrollpos_)/bpe_);
+	int end_elt   = int((end_addr - 1 - scrollpos_)/bpe_ + 1);
 	if (start_elt >= end_elt)
 		return;                         // Nothing to invalidate or all outside display
 
@@ -1170,15 +1194,15 @@ void CAerialView::invalidate_addr_range(FILE_ADDRESS start_addr, FILE_ADDRESS en
 void CAerialView::invalidate_addr_range_boundary(FILE_ADDRESS start_addr, FILE_ADDRESS end_addr)
 {
 	CHexEditDoc *pDoc = GetDocument();
-	int width = GetDocument()->GetBpe() * cols_;
+	int width = bpe_ * cols_;
 
 	// Restrict to just what is in the display then convert to window device coords
 	if (start_addr < scrollpos_) start_addr = scrollpos_;
 	if (end_addr > scrollpos_ + width*rows_) end_addr = scrollpos_ + width*rows_;
 
 	// Work out the elts we are invalidating offset from the elt at the top-left
-	int start_elt = int((start_addr - scrollpos_)/GetDocument()->GetBpe());
-	int end_elt   = int((end_addr - 1 - scrollpos_)/GetDocument()->GetBpe() + 1);
+	int start_elt = int((start_addr - scrollpos_)/bpe_);
+	int end_elt   = int((end_addr - 1 - scrollpos_)/bpe_ + 1);
 	if (start_elt >= end_elt)
 		return;                         // Nothing to invalidate or all outside display
 
@@ -1234,59 +1258,65 @@ void CAerialView::invalidate_addr_range_boundary(FILE_ADDRESS start_addr, FILE_A
 #endif
 
 // Redraws the part of the bitmap that need to be shown in the window.
-// The source (FreeImage) bitmap is reshaped to fit across the display:
-// 1. The width (bih->biWidth) is modified so that the correct number of
-//    elements for the client window width is used.
+// The displayed rows of elts are copied from the document's tiles (at this view's BPE)
+// into bits_ which is then BLTed as a DIB with a width of cols_.
 // Note that this relies on the bitmap width always being a multiple
 // of 4 (actually we use 8 for possible future compatibility) so that there
 // are no pad bytes on the end of the scan lines.
-// 2. The height (bih->biHeight) is calculated so that the bitmap size
-//    includes all elements in the bitmap.
-// Note that this means that the actual bitmap size varies depending on
-// the width, but that has been allowed for by allocating a bit of extra
-// space at the end (see CHexEditDoc::AddAerialView).
 
 void CAerialView::draw_bitmap(CDC* pDC)
 {
 	CHexEditDoc *pDoc = GetDocument();
-	ASSERT(pDoc != NULL && pDoc->dib_ != NULL);
-	if (pDoc == NULL || pDoc->dib_ == NULL)
+	ASSERT(pDoc != NULL && bpe_ > 0);
+	if (pDoc == NULL || pDoc->length() == 0)
 		return;
 
-	BITMAPINFOHEADER *bih = FreeImage_GetInfoHeader(pDoc->dib_);
-	ASSERT(bih->biCompression == BI_RGB && bih->biHeight > 0);
-
-	// Work out how to "reshape" the bitmap based cols_ (already calced from width of the window and dpix)
-	// Note: changing the bitmap header (ie width/height) should only be done just before BLTing
-	// the bitmap as more than one view can use the same bitmap and they may require different "shapes".
-	bih->biWidth = cols_;
 	ASSERT(cols_ % 8 == 0 && cols_ > 0 && cols_ <= CHexEditDoc::MAX_WIDTH);
-	ASSERT((pDoc->length_-1)/bih->biWidth < LONG_MAX);
-	bih->biHeight = LONG((pDoc->NumElts()-1)/bih->biWidth) + 1;
+	int pos = int(scrollpos_/(bpe_ * cols_));                       // no of rows above top of window
+	int nrows = std::min(rows_, int((num_elts() - 1)/cols_) + 1 - pos); // no of rows of the bitmap in the window
+	if (nrows <= 0)
+		return;
+
+	// Get the elts to display (any not yet calculated are shown in a grey close to the background)
+	if (!bits_ok_ || bits_.size() != size_t(nrows)*cols_*3)
+	{
+		bits_.resize(size_t(nrows)*cols_*3);
+		pDoc->GetAerialBits(bpe_, FILE_ADDRESS(pos)*cols_, FILE_ADDRESS(nrows)*cols_, &bits_[0],
+		                    GetRValue(same_hue(phev_->GetBackgroundCol(), 0 /*saturation*/)), disp_.heat != 0);
+		bits_ok_ = true;
+	}
+
+	BITMAPINFO bmi;
+	memset(&bmi, 0, sizeof(bmi));
+	bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+	bmi.bmiHeader.biWidth = cols_;
+	bmi.bmiHeader.biHeight = nrows;
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 24;
+	bmi.bmiHeader.biCompression = BI_RGB;
 
-	int pos = int(scrollpos_/(GetDocument()->GetBpe() * cols_));    // no of rows above top of window
 	CRect cliprct; pDC->GetClipBox(&cliprct);                       // only BLT the area that needs it
 
-	// Work out src rect
+	// Work out src rect (rows relative to the top of the window)
 	int sl = (cliprct.left - bdr_left_)/actual_dpix_;
 	if (sl < 0) sl = 0;
-	int st = pos + (cliprct.top - bdr_top_)/actual_dpix_;
+	int st = (cliprct.top - bdr_top_)/actual_dpix_;
 	if (st < 0) st = 0;
 	int sr = (cliprct.right - bdr_left_ - 1)/actual_dpix_ + 1;
-	if (sr > bih->biWidth) sr = bih->biWidth;
-	int sb = pos + (cliprct.bottom - bdr_top_ - 1)/actual_dpix_ + 1;
-	if (sb > bih->biHeight) sb = bih->biHeight;
+	if (sr > cols_) sr = cols_;
+	int sb = (cliprct.bottom - bdr_top_ - 1)/actual_dpix_ + 1;
+	if (sb > nrows) sb = nrows;
 
 	// Work out dest rect
 	int dl = bdr_left_ + sl*actual_dpix_;
-	int dt = bdr_top_ + (st - pos)*actual_dpix_;
+	int dt = bdr_top_ + st*actual_dpix_;
 	int dr = bdr_left_ + sr*actual_dpix_;
-	int db = bdr_top_ + (sb - pos)*actual_dpix_;
+	int db = bdr_top_ + sb*actual_dpix_;
 
 	::StretchDIBits(pDC->GetSafeHdc(),
 					dl, dt, dr - dl, db - dt,
 					sl, sb + 1, sr - sl, st - sb,
-					FreeImage_GetBits(pDoc->dib_), FreeImage_GetInfo(pDoc->dib_),
+					&bits_[0], &bmi,
 					DIB_RGB_COLORS, SRCCOPY);
 }
 
@@ -1297,7 +1327,7 @@ void CAerialView::draw_bitmap(CDC* pDC)
 // and cycles the timer_count_ value which determines where the ants are.
 void CAerialView::draw_ants(CDC* pDC, FILE_ADDRESS start_addr, FILE_ADDRESS end_addr, COLORREF clr)
 {
-	int width = GetDocument()->GetBpe() * cols_;
+	int width = bpe_ * cols_;
 	ASSERT(scrollpos_ % width == 0);
 
 	if (end_addr <= scrollpos_ || start_addr >= scrollpos_ + width*rows_)
@@ -1323,8 +1353,8 @@ void CAerialView::draw_ants(CDC* pDC, FILE_ADDRESS start_addr, FILE_ADDRESS end_
 void CAerialView::draw_lines(CDC* pDC, FILE_ADDRESS start_addr, FILE_ADDRESS end_addr, COLORREF clr1, COLORREF clr2)
 {
 	ASSERT(actual_dpix_ == 1);  // Only really to be used in this case (+ it makes calcs slightly easier)
-	int ss = int((start_addr - scrollpos_)/GetDocument()->GetBpe());       // pixel starting from top left, moving acros by rows then down
-	int ee = int((end_addr - scrollpos_)/GetDocument()->GetBpe());
+	int ss = int((start_addr - scrollpos_)/bpe_);       // pixel starting from top left, moving acros by rows then down
+	int ee = int((end_addr - scrollpos_)/bpe_);
 
 	for (int cc = ss; cc < ee; ++cc)
 		draw_pixel(pDC, cc, cc%cols_, cc/cols_, clr1, clr2);
@@ -1332,13 +1362,13 @@ void CAerialView::draw_lines(CDC* pDC, FILE_ADDRESS start_addr, FILE_ADDRESS end
 
 void CAerialView::draw_bounds(CDC* pDC, FILE_ADDRESS start_addr, FILE_ADDRESS end_addr, COLORREF clr1, COLORREF clr2)
 {
-	int width = GetDocument()->GetBpe() * cols_;
+	int width = bpe_ * cols_;
 	// Make sure we have something to show and it is all within the display area
 	ASSERT(start_addr < end_addr);
 
 	// Work out the elts involved offset from the elt at the top-left of the display
-	int start_elt = int((start_addr - scrollpos_)/GetDocument()->GetBpe());
-	int end_elt   = int((end_addr - 1 - scrollpos_)/GetDocument()->GetBpe() + 1);
+	int start_elt = int((start_addr - scrollpos_)/bpe_);
+	int end_elt   = int((end_addr - 1 - scrollpos_)/bpe_ + 1);
 	ASSERT(start_elt < end_elt);
 
 	// Work out the bounding box in elts (for pixels we still have to multiply by actual_dpix_)
@@ -1519,11 +1549,11 @@ int CAerialView::elt_at(CPoint pt)
 
 
 	// Work out absolute elt in the file
-	int elt = int(scrollpos_/GetDocument()->GetBpe()) + pt.y * cols_ + pt.x;
+	int elt = int(scrollpos_/bpe_) + pt.y * cols_ + pt.x;
 	if (elt < 0)
 		elt = 0;
-	else if (elt > GetDocument()->NumElts())
-		elt = GetDocument()->NumElts();
+	else if (elt > num_elts())
+		elt = num_elts();
 	return elt;
 }
 
@@ -1540,7 +1570,7 @@ void CAerialView::go_border_elt(CPoint pt)
 		return;
 
 	FILE_ADDRESS start = -1, end;
-	FILE_ADDRESS bpe = GetDocument()->GetBpe();
+	FILE_ADDRESS bpe = bpe_;
 	int row_start = int(scrollpos_/bpe) + pt.y * cols_;
 	int row_end = int(scrollpos_/bpe) + (pt.y + 1) * cols_;
 
@@ -1635,7 +1665,7 @@ void CAerialView::set_zoom(int z, bool scroll /*=true*/)
 	// Check if the display has changed at all
 	if (scroll && actual_dpix_ != prev_dpix)
 	{
-		int newpos = int(scrollpos_/(GetDocument()->GetBpe() * cols_));
+		int newpos = int(scrollpos_/(bpe_ * cols_));
 		// scrollpos_ is now invalid (recalculated in SetScroll below).  However, we need
 		// to set it to this value to force SetScroll to redraw and not scroll the window.
 		// We can't just invalidate the display here as scrollpos_ is inconsistent with cols_.
@@ -1644,13 +1674,46 @@ void CAerialView::set_zoom(int z, bool scroll /*=true*/)
 	}
 }
 
+// Changes the number of bytes of the file shown in each elt.  Note that this does not scroll
+// the window (scrollpos_ is left inconsistent) so the caller must call SetScroll.
+void CAerialView::set_bpe(int bpe)
+{
+	int level = aerial_pyramid::level_of(std::max(bpe, min_bpe()));
+	disp_.level = level + 1;
+	bpe_ = 1 << level;
+	get_disp_params(rows_, cols_, actual_dpix_);
+}
+
+// Returns the smallest BPE that can be used with this file as the number of
+// elts (and rows of elts) in the whole file has to fit in an int.
+// Heat map elts are also never less than 256 bytes (see aerial_metrics).
+int CAerialView::min_bpe()
+{
+	int bpe = disp_.heat ? 1 << aerial_metrics::MIN_LEVEL : 1;
+	while (bpe < (1 << aerial_pyramid::MAX_LEVEL) && (GetDocument()->length() - 1)/bpe >= INT_MAX - CHexEditDoc::MAX_WIDTH)
+		bpe <<= 1;
+	return bpe;
+}
+
+// Switches between showing the colours of the bytes and the heat map
+void CAerialView::OnHeatMap()
+{
+	disp_.heat = !disp_.heat;
+	if (bpe_ < min_bpe())
+		set_bpe(min_bpe());
+
+	int newpos = int(scrollpos_/(bpe_ * cols_));
+	scrollpos_ = INT_MIN;           // force SetScroll to redraw (see set_zoom)
+	SetScroll(newpos);
+}
+
 // Returns true if tip text was updated or false if there is nothing to show.
 // The parameter (elt) if the elt about which we show information
 bool CAerialView::update_tip(int elt)
 {
 	tip_elt_ = elt;
 	tip_.Clear();
-	FILE_ADDRESS addr = FILE_ADDRESS(elt)*GetDocument()->GetBpe();
+	FILE_ADDRESS addr = FILE_ADDRESS(elt)*bpe_;
 
 	ASSERT(phev_ != NULL);
 	if (phev_->DecAddresses())
@@ -1666,6 +1729,25 @@ bool CAerialView::update_tip(int elt)
 		dec_addr_tip(addr);
 	}
 
+	if (disp_.heat)
+	{
+		// Show the stats of the elt's bytes that were used to colour it
+		CHexEditDoc *pDoc = GetDocument();
+		std::vector<unsigned char> buf(size_t(std::min<FILE_ADDRESS>(bpe_, pDoc->length() - addr)));
+		aerial_metrics mm;
+		if (!buf.empty())
+			mm.add(&buf[0], pDoc->GetData(&buf[0], buf.size(), addr));
+
+		CString ss;
+		tip_.AddString(aerial_metrics::kind_name(mm.kind()));
+		ss.Format("Entropy: %.2f bits/byte", mm.entropy());
+		tip_.AddString(ss);
+		ss.Format("Zero: %.0f%%  ASCII: %.0f%%  High bit: %.0f%%", mm.zero_ratio()*100.0, mm.ascii_ratio()*100.0, mm.high_ratio()*100.0);
+		tip_.AddString(ss);
+		ss.Format("Code score: x86 %.2f  ARM %.2f", mm.x86_score(), mm.arm_score());
+		tip_.AddString(ss);
+	}
+
 	tip_.SetAlpha(theApp.tip_transparency_);
 	return true;
 }
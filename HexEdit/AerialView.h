@@ -49,7 +49,7 @@ public:
 	virtual void OnDraw(CDC* pDC);      // overridden to draw this view
 
 	void SetScroll(int newpos);
-	void SetScroll(FILE_ADDRESS newpos) { SetScroll(int(newpos/(GetDocument()->GetBpe() * cols_))); }
+	void SetScroll(FILE_ADDRESS newpos) { SetScroll(int(newpos/(bpe_ * cols_))); }
 	void ShowPos(FILE_ADDRESS pos);
 	void StoreOptions(CHexFileList *pfl, int idx);
 	void InvalidateRange(FILE_ADDRESS start_addr, FILE_ADDRESS end_addr);
@@ -132,6 +132,8 @@ protected:
 	afx_msg void OnUpdateZoom14(CCmdUI *pCmdUI) { pCmdUI->SetCheck(disp_.dpix == 14); }
 	afx_msg void OnUpdateZoom15(CCmdUI *pCmdUI) { pCmdUI->SetCheck(disp_.dpix == 15); }
 	afx_msg void OnUpdateZoom16(CCmdUI *pCmdUI) { pCmdUI->SetCheck(disp_.dpix == 16); }
+	afx_msg void OnHeatMap();
+	afx_msg void OnUpdateHeatMap(CCmdUI *pCmdUI) { pCmdUI->SetCheck(disp_.heat); }
 
 	afx_msg void OnUpdateDisable(CCmdUI* pCmdUI) { pCmdUI->Enable(FALSE); }
 	DECLARE_MESSAGE_MAP()
@@ -157,6 +159,8 @@ private:
 	void draw_left_border(CDC* pDC, int left, int right, int row, COLORREF clr);
 	void draw_top_border(CDC* pDC, int x, int ncols, COLORREF clr);
 	void set_zoom(int z, bool scroll = true);
+	void set_bpe(int bpe);
+	int min_bpe();
 
 	union
 	{
@@ -180,6 +184,8 @@ private:
 			unsigned int res2: 3;               // reserve 3 more bits for future border options
 
 			unsigned int dpix: 6;               // Currently only the bottom 4 bits are used
+			unsigned int level: 5;              // log2(BPE) + 1, or zero to use the document default
+			unsigned int heat: 1;               // show heat map (kind of data) rather than byte colours
 		} disp_;
 	};
 
@@ -210,22 +216,28 @@ private:
 	int rows_, cols_;                   // Current number of rows and cols of elts shown in the window
 
 	// Note: There are 2 different "zooms" which may be a bit confusing.
-	// 1. BPE = number of bytes that contributes to an "elt" (ie, a "pixel" of the FreeImage bitmap).
+	// 1. BPE = number of bytes that contributes to an "elt" (ie, a "pixel" of the bitmap).
 	//    This allows the user to "zoom" in and out on large files to see more or less of the file.
-	//    User can choose from between 1 and 65536, (restricted to the 16 values that are powers of 2?)
-	//    For large files there is a limit on the smallest BPE allowed,
-	//    otherwise a 1 TByte file would require 3 TBytes of memory at a BPE of 1.
-	//    BPE says how big the FreeImage bitmap is so (like the bitmap) it is part of the 
-	//    document and when it changes the FreeImage bitmap needs to be completely recalculated.
+	//    It is a power of 2 from 1 to 65536.  The document keeps tiles of the bitmap at all BPEs
+	//    (see aerial_pyramid) but only for the parts of the file that are displayed, so each
+	//    view can have its own BPE and even a 1 TByte file can be viewed at a BPE of 1.
+	//    The only limit is that the number of elts in the file must fit in an int.
 	// 2. DPIX = number of screen pixels required to display one "elt".
 	//    Values are 1,2,3...8 for a 1x1, 2x2, 3x3, ... 8x8 square.
 	//    Larger values allow individual elts to be visible on a high resolution display.
 	//    For a small file in a large aerial view the "actual" value may be increased from the
 	//    user specified value in order to make use of the extra screen real estate.
-	//    When this value changes the FreeImage bitmap does not need to be recalculated (only
+	//    When this value changes the bitmap does not need to be recalculated (only
 	//    reshaped) hence this can vary between views and is stored here.
 	int actual_dpix_;   // Actual display pixel size - may be larger than dpix_ if the whole file fits in the window
 	void get_disp_params(int &rows, int &cols, int &actual_dpix);
+	int bpe_;           // Bytes per elt for this view (power of 2)
+	int num_elts() { return int((GetDocument()->length() - 1)/bpe_) + 1; }    // Number of elts required for the whole file
+
+	// We keep a copy of the displayed part of the bitmap which is refreshed from the
+	// document's tiles when the display changes or new tiles are calculated.
+	std::vector<unsigned char> bits_;   // 3 bytes (BGR) for each elt of rows_ rows starting at scrollpos_
+	bool bits_ok_;                      // false if bits_ needs to be refreshed
 
 	// We cache the search occurrences that are currently drawn in the window.
 	// This speeds up redraws espe the marching ants when there are millions of
@@ -0,0 +1,375 @@
+// AnchoredDiff.cpp : implementation of the anchored_diff class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "AnchoredDiff.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+static const std::size_t buf_size = 65536;     // buffer size for extending anchors etc
+
+static inline std::uint64_t rotl64(std::uint64_t xx, int rr)
+{
+	return (xx << rr) | (xx >> (64 - rr));
+}
+
+// Random values for the Gear rolling hash (generated with splitmix64 so they are always the same)
+static const std::uint64_t *gear_table()
+{
+	static const std::vector<std::uint64_t> table = []
+	{
+		std::vector<std::uint64_t> tt(256);
+		std::uint64_t seed = 0x4845584544495400ULL;
+		for (std::uint64_t &vv : tt)
+		{
+			std::uint64_t zz = (seed += 0x9E3779B97F4A7C15ULL);
+			zz = (zz ^ (zz >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			zz = (zz ^ (zz >> 27)) * 0x94D049BB133111EBULL;
+			vv = zz ^ (zz >> 31);
+		}
+		return tt;
+	}();
+	return &table[0];
+}
+
+// 64-bit hash of a chunk's bytes (similar to MurmurHash3 but 8 bytes at a time)
+static std::uint64_t hash_bytes(const unsigned char *pp, std::size_t len)
+{
+	const std::uint64_t k1 = 0x87C37B91114253D5ULL, k2 = 0x4CF5AD432745937FULL;
+	std::uint64_t hh = len * k1;
+	std::size_t ii;
+	for (ii = 0; ii + 8 <= len; ii += 8)
+	{
+		std::uint64_t ww;
+		memcpy(&ww, pp + ii, 8);
+		hh ^= rotl64(ww * k1, 31) * k2;
+		hh = rotl64(hh, 27) * 5 + 0x52DCE729;
+	}
+	if (ii < len)
+	{
+		std::uint64_t ww = 0;
+		memcpy(&ww, pp + ii, len - ii);
+		hh ^= rotl64(ww * k1, 31) * k2;
+	}
+	hh ^= hh >> 33;
+	hh *= 0xFF51AFD7ED558CCDULL;
+	hh ^= hh >> 33;
+	hh *= 0xC4CEB9FE1A85EC53ULL;
+	hh ^= hh >> 33;
+	return hh;
+}
+
+// Reads len bytes (or up to EOF) returning the number of bytes read
+static std::size_t read_all(const anchored_diff::reader_t &read, unsigned char *buf, std::size_t len, std::int64_t addr)
+{
+	std::size_t got = 0;
+	while (got < len)
+	{
+		std::size_t nn = read(buf + got, len - got, addr + got);
+		if (nn == 0 || nn > len - got)
+			break;              // EOF or error
+		got += nn;
+	}
+	return got;
+}
+
+anchored_diff::anchored_diff(reader_t read_a, std::int64_t len_a, reader_t read_b, std::int64_t len_b)
+	: read_a_(read_a), read_b_(read_b), len_a_(len_a), len_b_(len_b)
+{
+}
+
+bool anchored_diff::make_chunks(reader_t read, std::int64_t len, std::vector<chunk> &chunks, progress_t progress /*=progress_t()*/)
+{
+	const std::uint64_t *gear = gear_table();
+	std::vector<unsigned char> buf(1024*1024 + MAX_CHUNK);
+
+	chunks.clear();
+	std::int64_t addr = 0;      // file address of buf[0]
+	std::size_t got = 0;        // bytes in buf
+	std::size_t start = 0;      // start of the current chunk in buf
+	for (;;)
+	{
+		// Make sure we have MAX_CHUNK bytes after start (unless we are at EOF)
+		if (got - start < MAX_CHUNK && addr + std::int64_t(got) < len)
+		{
+			memmove(&buf[0], &buf[start], got - start);
+			addr += start;
+			got -= start;
+			start = 0;
+			std::size_t to_read = std::size_t(std::min<std::int64_t>(buf.size() - got, len - (addr + got)));
+			std::size_t nn = read_all(read, &buf[got], to_read, addr + got);
+			if (nn < to_read)
+				len = addr + got + nn;      // file is shorter than we thought
+			got += nn;
+
+			if (progress && !progress(len > 0 ? double(addr)/double(len) : 1.0))
+				return false;
+		}
+		if (start >= got)
+			break;
+
+		// Find the end of the chunk.  As the rolling hash only depends on the last 64 bytes
+		// we don't need to start calculating it until 64 bytes before MIN_CHUNK.
+		const unsigned char *pp = &buf[start];
+		std::size_t avail = std::min<std::size_t>(got - start, MAX_CHUNK);
+		std::size_t clen = avail;
+		if (avail > MIN_CHUNK)
+		{
+			std::uint64_t hh = 0;
+			for (std::size_t ii = MIN_CHUNK - 64; ii < avail; ++ii)
+			{
+				hh = (hh << 1) + gear[pp[ii]];
+				if (ii + 1 >= MIN_CHUNK && (hh >> (64 - AVG_BITS)) == 0)
+				{
+					clen = ii + 1;
+					break;
+				}
+			}
+		}
+
+		chunk cc;
+		cc.start = addr + start;
+		cc.len = std::uint32_t(clen);
+		cc.hash = hash_bytes(pp, clen);
+		chunks.push_back(cc);
+		start += clen;
+	}
+	return true;
+}
+
+// Matches chunks of A with those of B and returns the longest run of matching chunks that are
+// in the same order in both files (as merged ranges of bytes).
+std::vector<anchored_diff::anchor> anchored_diff::match(const std::vector<chunk> &ca, const std::vector<chunk> &cb) const
+{
+	typedef std::pair<std::uint64_t, std::uint32_t> hash_idx_t;     // chunk hash and index into cb
+	std::vector<hash_idx_t> index(cb.size());
+	for (std::size_t jj = 0; jj < cb.size(); ++jj)
+		index[jj] = hash_idx_t(cb[jj].hash, std::uint32_t(jj));
+	std::sort(index.begin(), index.end());
+
+	// For each chunk of A find a matching chunk of B.  If the same chunk appears more than once
+	// in B (eg runs of zeroes) we prefer the first one after the one matched by the last A chunk.
+	std::vector<std::pair<std::uint32_t, std::uint32_t> > pairs;    // indices into ca and cb
+	std::int64_t prev = -1;
+	for (std::size_t ii = 0; ii < ca.size(); ++ii)
+	{
+		const chunk &cc = ca[ii];
+		std::int64_t found = -1;
+		if (prev >= 0 && prev + 1 < std::int64_t(cb.size()) && cb[size_t(prev + 1)].hash == cc.hash)
+			found = prev + 1;       // most common case is that the next chunks also match
+		else
+		{
+			std::vector<hash_idx_t>::const_iterator pi = std::lower_bound(index.begin(), index.end(), hash_idx_t(cc.hash, std::uint32_t(prev + 1)));
+			if (pi == index.end() || pi->first != cc.hash)
+				pi = std::lower_bound(index.begin(), index.end(), hash_idx_t(cc.hash, 0));   // only before prev
+			if (pi != index.end() && pi->first == cc.hash)
+				found = pi->second;
+		}
+		if (found >= 0 && cb[size_t(found)].len == cc.len)
+		{
+			pairs.push_back(std::make_pair(std::uint32_t(ii), std::uint32_t(found)));
+			prev = found;
+		}
+	}
+
+	// Find the longest increasing sequence of B indices (patience sorting).  Matches that are not
+	// part of it have been moved (ie are out of order compared to the other matches).
+	std::vector<std::size_t> tails;                     // index into pairs of the end of the best sequence of each length
+	std::vector<std::ptrdiff_t> back(pairs.size());     // previous pair in the sequence
+	for (std::size_t kk = 0; kk < pairs.size(); ++kk)
+	{
+		std::uint32_t jj = pairs[kk].second;
+		std::size_t lo = 0, hi = tails.size();
+		while (lo < hi)
+		{
+			std::size_t mid = (lo + hi)/2;
+			if (pairs[tails[mid]].second < jj)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		back[kk] = lo > 0 ? std::ptrdiff_t(tails[lo - 1]) : -1;
+		if (lo == tails.size())
+			tails.push_back(kk);
+		else
+			tails[lo] = kk;
+	}
+
+	std::vector<std::size_t> chain;
+	for (std::ptrdiff_t kk = tails.empty() ? -1 : std::ptrdiff_t(tails.back()); kk >= 0; kk = back[size_t(kk)])
+		chain.push_back(size_t(kk));
+	std::reverse(chain.begin(), chain.end());
+
+	// Merge adjacent chunks into anchors
+	std::vector<anchor> retval;
+	for (std::size_t kk : chain)
+	{
+		const chunk &aa = ca[pairs[kk].first];
+		const chunk &bb = cb[pairs[kk].second];
+		if (!retval.empty() && retval.back().a + retval.back().len == aa.start && retval.back().b + retval.back().len == bb.start)
+			retval.back().len += aa.len;
+		else
+		{
+			anchor an = { aa.start, bb.start, aa.len };
+			retval.push_back(an);
+		}
+	}
+	return retval;
+}
+
+// Returns how many bytes (up to max) are the same in both files starting at a and b
+std::int64_t anchored_diff::extend_forward(std::int64_t a, std::int64_t b, std::int64_t max)
+{
+	std::int64_t retval = 0;
+	while (retval < max)
+	{
+		std::size_t len = std::size_t(std::min<std::int64_t>(max - retval, buf_size));
+		std::size_t gota = read_all(read_a_, &bufa_[0], len, a + retval);
+		std::size_t gotb = read_all(read_b_, &bufb_[0], len, b + retval);
+		std::size_t nn = std::min(gota, gotb), ii = 0;
+		while (ii < nn && bufa_[ii] == bufb_[ii])
+			++ii;
+		retval += ii;
+		if (ii < len)
+			break;
+	}
+	return retval;
+}
+
+// Returns how many bytes (up to max) are the same in both files ending just before a and b
+std::int64_t anchored_diff::extend_backward(std::int64_t a, std::int64_t b, std::int64_t max)
+{
+	std::int64_t retval = 0;
+	while (retval < max)
+	{
+		std::size_t len = std::size_t(std::min<std::int64_t>(max - retval, buf_size));
+		std::size_t gota = read_all(read_a_, &bufa_[0], len, a - retval - len);
+		std::size_t gotb = read_all(read_b_, &bufb_[0], len, b - retval - len);
+		if (gota < len || gotb < len)
+			break;
+		std::size_t ii = 0;
+		while (ii < len && bufa_[len - 1 - ii] == bufb_[len - 1 - ii])
+			++ii;
+		retval += ii;
+		if (ii < len)
+			break;
+	}
+	return retval;
+}
+
+// Adds replacement blocks for the bytes that differ in len bytes at a and b
+void anchored_diff::add_replacements(std::int64_t a, std::int64_t b, std::int64_t len)
+{
+	for (std::int64_t done = 0; done < len; )
+	{
+		std::size_t nn = std::size_t(std::min<std::int64_t>(len - done, buf_size));
+		std::size_t gota = read_all(read_a_, &bufa_[0], nn, a + done);
+		std::size_t gotb = read_all(read_b_, &bufb_[0], nn, b + done);
+		nn = std::min(gota, gotb);
+		if (nn == 0)
+			break;
+
+		for (std::size_t ii = 0; ii < nn; )
+		{
+			while (ii < nn && bufa_[ii] == bufb_[ii])
+				++ii;
+			std::size_t diff = ii;
+			while (ii < nn && bufa_[ii] != bufb_[ii])
+				++ii;
+			if (ii > diff)
+				add_block(KIND_REPLACE, a + done + diff, b + done + diff, ii - diff);
+		}
+		done += nn;
+	}
+}
+
+// Adds a difference, joining it to the previous one if they are adjacent
+void anchored_diff::add_block(kind_t kind, std::int64_t a, std::int64_t b, std::int64_t len)
+{
+	if (!blocks_.empty())
+	{
+		block &last = blocks_.back();
+		std::int64_t end_a = last.a + (last.kind == KIND_DELETE ? 0 : last.len);
+		std::int64_t end_b = last.b + (last.kind == KIND_INSERT ? 0 : last.len);
+		if (last.kind == kind && end_a == a && end_b == b)
+		{
+			last.len += len;
+			return;
+		}
+	}
+	block bb = { kind, a, b, len };
+	blocks_.push_back(bb);
+}
+
+bool anchored_diff::run(progress_t progress /*=progress_t()*/)
+{
+	blocks_.clear();
+
+	// Progress of each stage is scaled to part of the whole
+	auto stage = [&](double from, double to) -> progress_t
+	{
+		if (!progress)
+			return progress_t();
+		return [=](double done) { return progress(from + done*(to - from)); };
+	};
+
+	std::vector<anchor> anchors;
+	{
+		std::vector<chunk> ca, cb;
+		if (!make_chunks(read_a_, len_a_, ca, stage(0.0, 0.45)) ||
+			!make_chunks(read_b_, len_b_, cb, stage(0.45, 0.9)))
+		{
+			return false;
+		}
+		anchors = match(ca, cb);
+	}
+	anchor eof = { len_a_, len_b_, 0 };
+	anchors.push_back(eof);         // so that we handle the gap before the end of the files
+
+	bufa_.resize(buf_size);
+	bufb_.resize(buf_size);
+	std::int64_t pa = 0, pb = 0;    // end of the previous anchor
+	for (std::size_t kk = 0; kk < anchors.size(); ++kk)
+	{
+		if (progress && kk % 256 == 0 && !progress(0.9 + 0.1*double(kk)/double(anchors.size())))
+			return false;
+
+		// Extend the previous anchor forward and this one back into the gap between them
+		std::int64_t na = anchors[kk].a, nb = anchors[kk].b;
+		std::int64_t ext = extend_forward(pa, pb, std::min(na - pa, nb - pb));
+		pa += ext;
+		pb += ext;
+		ext = extend_backward(na, nb, std::min(na - pa, nb - pb));
+		na -= ext;
+		nb -= ext;
+
+		// What is left of the gap is replaced, with any extra bytes inserted/deleted at the end
+		std::int64_t lena = na - pa, lenb = nb - pb;
+		std::int64_t common = std::min(lena, lenb);
+		add_replacements(pa, pb, common);
+		if (lena > lenb)
+			add_block(KIND_INSERT, pa + common, pb + common, lena - lenb);
+		else if (lenb > lena)
+			add_block(KIND_DELETE, pa + common, pb + common, lenb - lena);
+
+		pa = anchors[kk].a + anchors[kk].len;
+		pb = anchors[kk].b + anchors[kk].len;
+	}
+	std::vector<unsigned char>().swap(bufa_);
+	std::vector<unsigned char>().swap(bufb_);
+	return true;
+}
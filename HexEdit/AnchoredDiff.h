@@ -0,0 +1,84 @@
+// AnchoredDiff.h : compare two files by matching content-defined chunks
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// The normal background compare only finds insertions/deletions where the files get back in
+// sync within its buffer, so a large block inserted in one file makes everything after it
+// one big replacement.  This compare works in near-linear time whatever the size of the
+// insertions and deletions:
+//
+// 1. Both files are split into chunks at "content-defined" boundaries, ie where a rolling hash
+//    (Gear) of the previous 64 bytes has its top AVG_BITS bits zero.  As boundaries depend only
+//    on nearby bytes, an insertion or deletion only changes the chunks around it.  Each chunk
+//    also gets a 64-bit hash of all its bytes.
+// 2. The chunks of A are matched with chunks of B with the same hash (using a sorted index
+//    of B's hashes).  Of these, the longest sequence that is in order in both files is used as
+//    anchors.  Chunks that matched but are out of order have been moved - they are reported as
+//    a deletion where they were and an insertion where they now are.
+// 3. The anchors are extended a byte at a time into the gaps between them.  What is left of a
+//    gap is compared byte by byte for replacements, and any extra bytes in one file are an
+//    insertion or deletion at the end of the gap.
+//
+// Note that this class does no locking.  The data of each file is obtained using a reader
+// function which must return the number of bytes read (less than asked for only at EOF).
+class anchored_diff
+{
+public:
+	typedef std::function<std::size_t(unsigned char *buf, std::size_t len, std::int64_t addr)> reader_t;
+	typedef std::function<bool(double done)> progress_t;   // done is 0 to 1; return false to abort
+
+	enum { MIN_CHUNK = 2048, MAX_CHUNK = 65536, AVG_BITS = 13 };
+
+	// A difference found.  Note that INSERT means bytes in A that are not in B and DELETE
+	// means bytes in B that are not in A (as with CHexEditDoc::CompResult).
+	enum kind_t { KIND_REPLACE, KIND_INSERT, KIND_DELETE };
+	struct block
+	{
+		kind_t kind;
+		std::int64_t a, b;      // address in each file
+		std::int64_t len;       // bytes replaced, inserted in A or deleted from A
+	};
+
+	struct chunk
+	{
+		std::int64_t start;
+		std::uint32_t len;
+		std::uint64_t hash;     // hash of all bytes of the chunk
+	};
+
+	anchored_diff(reader_t read_a, std::int64_t len_a, reader_t read_b, std::int64_t len_b);
+
+	bool run(progress_t progress = progress_t());       // returns false if aborted
+	const std::vector<block> &blocks() const { return blocks_; }    // in address order
+
+	// Splits a file into chunks (progress is reported from 0 to 1 through the file)
+	static bool make_chunks(reader_t read, std::int64_t len, std::vector<chunk> &chunks, progress_t progress = progress_t());
+
+private:
+	struct anchor { std::int64_t a, b, len; };
+
+	reader_t read_a_, read_b_;
+	std::int64_t len_a_, len_b_;
+	std::vector<block> blocks_;
+	std::vector<unsigned char> bufa_, bufb_;
+
+	std::vector<anchor> match(const std::vector<chunk> &ca, const std::vector<chunk> &cb) const;
+	std::int64_t extend_forward(std::int64_t a, std::int64_t b, std::int64_t max);
+	std::int64_t extend_backward(std::int64_t a, std::int64_t b, std::int64_t max);
+	void add_replacements(std::int64_t a, std::int64_t b, std::int64_t len);
+	void add_block(kind_t kind, std::int64_t a, std::int64_t b, std::int64_t len);
+};
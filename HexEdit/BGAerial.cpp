@@ -15,6 +15,18 @@ A background thread is created to scan the file to build up a bitmap for
 display in an "aerial view" which can show an alternative view to the
 normal hex view of a document.
 
+The "bitmap" is not one big bitmap of the whole file but tiles at different
+BPEs (bytes per elt) - see aerial_pyramid in AerialPyramid.h.  Each aerial
+view tells the document which part of the file it is displaying and at what
+BPE (see AerialWant) and the thread only calculates the tiles that are
+needed for that.  So a view can zoom in to one byte per pixel on a huge file
+and only the displayed part of the file is ever read.
+
+A view can also show a "heat map" where each elt is coloured by the kind of
+data (zeroes, text, code, compressed/encrypted etc) rather than the colours of
+its bytes - see aerial_metrics in AerialHeat.h.  These use separate tiles
+(aerial_heat_tiles_) calculated by the same thread as they are wanted.
+
 Note This background scan  may later also be used to generate stats
 on the file such as byte counts.
 
@@ -31,6 +43,9 @@ aerial_state_: updated by the thread to say what it's doing: waiting, scanning o
 aerial_fin_: true if last scan finished OK, false if none done yet or last stopped
 docdata_: a critical section to protect access to shared document members
 
+aerial_tiles_: the tiles (only accessed with docdata_ locked)
+aerial_want_: the part of the file at what BPE that each view needs
+
 pfile3_: is a ptr to file open the same as pfile1_.  Using a separate file allows the main thread
 		 to read from the file without having to lock docdata_.  Locking is only required
 		 when the background thread accesses the file or the main thread changes it.
@@ -44,15 +59,16 @@ Background thread
 
 The thread has 4 states: starting, waiting, scanning and dying.  When waiting it is
 blocked by the event (start_aerial_event_), and to change the state the event needs to be
-pulsed (and a command given).
+pulsed (and a command given).  The event is also pulsed when a view wants tiles that
+have not been calculated.
 
 While scanning it regularly checks for a new command (aerial_command_) while in its
 processing loop.  If it detects a "stop" command it goes back into the wait state.
 If it detects a "die" command the thread terminates itself.
 
-After the thread scans the whole file it also goes back into the wait state.
-But first it signals the main thread which is passed on to the document
-and thence to all aerial views so they can update themselves.
+After the thread calculates each tile it signals the main thread which is passed on
+to the document and thence to all aerial views so they can update themselves.  When
+there are no more tiles wanted it goes back into the wait state.
 Note that if a modal dialog is active when the ::PostThreadMessage is called
 to send the message to the main thread then the message is lost.
 It also sets aerial_fin_ to true.
@@ -60,21 +76,18 @@ It also sets aerial_fin_ to true.
 Changes (CHexEditDoc::Change, CHexEditDoc::Undo in DocData.cpp)
 -------
 
-When a document is changed the scan needs to be restarted.
-
-This may later be changed to allow small document changes to update
-the bitmap without having to rescan the whole thing.  This would work
-fine for replacements.  For deletions a memove() would be required.
-For small insertions only a memove may be required but it may be that
-the bitmap has to be resized, which may be handled by realloc or
-just a complete re-scan.
+When bytes are replaced only the elts (at all BPEs) that contain the changed
+bytes are marked as needing to be recalculated (see aerial_change).  Insertions
+and deletions move all following bytes so all tiles from the change to EOF are
+discarded.  Either way the scan is then restarted to recalculate the tiles that
+the views want.
 
 
 Views (see CBGAerialHint used by CHexEditView::OnUpdate)
 -----
 
 When the colour scheme of the view used to generate the aerial view
-is changed then the file has to be rescanned as the bitmap
+is changed then all tiles are discarded as the bitmap
 colours may be completely different.  This is complicated by the 
 fact that a document may have more than one view using different
 colour schemes.
@@ -98,7 +111,7 @@ static char THIS_FILE[] = __FILE__;
 // can free up things when there are no more.  (There can be more than one if a 2nd
 // window has been opened on the same document.)
 // It has to know the associated CHexEditView in order to know the colour scheme and
-// hence the colours assigned in the FreeImage bitmap.
+// hence the colours assigned in the bitmap.
 
 void CHexEditDoc::AddAerialView(CHexEditView *pview)
 {
@@ -132,9 +145,17 @@ void CHexEditDoc::AddAerialView(CHexEditView *pview)
 			}
 		}
 
-		//get bitmap & clear it to closest grey to hex view's background
-		GetAerialBitmap(GetRValue(same_hue(pview->GetBackgroundCol(), 0 /*saturation*/)));
+		// Work out the default BPE for new views.  This is the smallest (power of 2) value
+		// that would allow a bitmap of the whole file to fit in theApp.aerial_max_ bytes.
+		for (bpe_ = 1; bpe_ < 65536 && (length_*3)/bpe_ > theApp.aerial_max_; bpe_ <<= 1)
+			;
+
+		aerial_tiles_.clear();
+		aerial_tiles_.set_length(length_);
+		aerial_heat_tiles_.clear();
+		aerial_heat_tiles_.set_length(length_);
 		pview->get_colours(kala_);   // get colours for the bitmap pixels
+		aerial_reduce_.set_colours(kala_);
 
 		// Create the background thread and start it scanning
 		CreateAerialThread();
@@ -150,10 +171,9 @@ void CHexEditDoc::RemoveAerialView()
 	{
 		if (pthread3_ != NULL)
 			KillAerialThread();
-		FIBITMAP *dib = dib_;
-		dib_ = NULL;
-		TRACE("+++  FreeImage_Unload(%d)\n", dib);
-		FreeImage_Unload(dib);
+		aerial_tiles_.clear();      // free the memory
+		aerial_heat_tiles_.clear();
+		aerial_want_.clear();
 	}
 	TRACE("+++  Aerial --- %d\n", av_count_);
 }
@@ -185,16 +205,16 @@ void CHexEditDoc::AerialChange(CHexEditView *pview /*= NULL*/)
 	SetThreadPriority(pthread3_->m_hThread, THREAD_PRIORITY_LOWEST);
 	ASSERT(waiting);
 
-	// Make sure we have a big enough bitmap and the right colours
+	// Make sure we have the right colours
 	docdata_.Lock();
 	if (pview != NULL)
 	{
-		// ensure bitmap is big enough & clear it to closest grey to hex view's background
-		GetAerialBitmap(GetRValue(same_hue(pview->GetBackgroundCol(), 0 /*saturation*/)));
 		pview->get_colours(kala_);     // get colour ranges in case they have changed
+		aerial_reduce_.set_colours(kala_);
+		aerial_tiles_.clear();         // all tiles have to be recalculated with the new colours (heat map tiles are not affected)
 	}
-	else
-		GetAerialBitmap(-1);
+	aerial_tiles_.set_length(length_);  // in case the file length changed outside of Change/Undo
+	aerial_heat_tiles_.set_length(length_);
 
 	// Restart the scan
 	aerial_command_ = NONE;  // make sure we don't stop the scan before it starts
@@ -214,56 +234,122 @@ int CHexEditDoc::AerialProgress()
 	}
 
 	CSingleLock sl(&docdata_, TRUE);
-	if (aerial_state_ != SCANNING) return -1;
+	if (aerial_state_ != SCANNING || aerial_end_ <= aerial_start_) return -1;
 
-	return 1 + int((aerial_addr_ * 99)/length_);
+	// Progress of the current tile
+	return 1 + int(((aerial_addr_ - aerial_start_) * 99)/(aerial_end_ - aerial_start_));
 }
 
-// Gets a new FreeImage bitmap if we haven't got one yet or the current one is too small.
-// On entry the background thread must not be scanning the bitmap - eg waiting.
-// The parameter 'clear' is the value to clear the bitmap to - effectively clears to
-// a grey of colour RGB(clear, clear, clear), or -1 to not clear.
-void CHexEditDoc::GetAerialBitmap(int clear /*= 0xC0*/)
+// Called by an aerial view to say what part of the file it is displaying and at what BPE,
+// so that the background thread can calculate any tiles that are not yet available.
+// If start >= end the view no longer wants anything (eg it is being closed).
+// If heat is true the view is displaying a heat map (see AerialHeat.h).
+void CHexEditDoc::AerialWant(const void *pview, int bpe, FILE_ADDRESS start, FILE_ADDRESS end, bool heat /*=false*/)
 {
-	// If we already have a bitmap make sure it is big enough
-	if (dib_ != NULL)
+	CSingleLock sl(&docdata_, TRUE);
+
+	std::vector<aerial_want>::iterator pw;
+	for (pw = aerial_want_.begin(); pw != aerial_want_.end(); ++pw)
+		if (pw->pview == pview)
+			break;
+	if (start >= end)
+	{
+		if (pw != aerial_want_.end())
+			aerial_want_.erase(pw);
+		return;
+	}
+	if (pw == aerial_want_.end())
 	{
-		int dib_size = FreeImage_GetPitch(dib_) * FreeImage_GetHeight(dib_);
-		int dib_rows = int(length_/bpe_/MAX_WIDTH) + 2;
-		if (dib_size >= MAX_WIDTH*dib_rows*3)
+		aerial_want_.push_back(aerial_want());
+		pw = aerial_want_.end() - 1;
+		pw->pview = pview;
+	}
+	pw->level = aerial_pyramid::level_of(bpe);
+	pw->start = start;
+	pw->end = end;
+	pw->heat = heat;
+	ASSERT(!heat || pw->level >= aerial_metrics::MIN_LEVEL);
+
+	// Wake up the thread if it is waiting and there is something for it to do
+	const aerial_pyramid &tiles = heat ? aerial_heat_tiles_ : aerial_tiles_;
+	FILE_ADDRESS tb = aerial_pyramid::tile_bytes(pw->level);
+	for (FILE_ADDRESS tile = start/tb; tile*tb < end; ++tile)
+	{
+		FILE_ADDRESS first, last;
+		if (tiles.need(pw->level, tile, first, last))
 		{
-			if (clear > -1)
-				memset(FreeImage_GetBits(dib_), clear, dib_size);
-			return;
+			if (pthread3_ != NULL && aerial_state_ == WAITING)
+			{
+				aerial_command_ = NONE;
+				start_aerial_event_.SetEvent();
+			}
+			break;
 		}
-
-		// Not big enough so free it and reallocate (below)
-		FIBITMAP *dib = dib_;
-		dib_ = NULL;
-		TRACE("+++ FreeImage_Unload(%d)\n", dib);
-		FreeImage_Unload(dib);
-		if (clear <= -1)
-			clear = 0xC0;  // if we get a new bitmap we must clear it
 	}
+}
 
-	// TBD: TODO we need user options for default bpe and MAX_BMP (min 16Mb = 1 TByte file @ BPE 65536)
-	bpe_ = 1;
+// Copies count elts (starting at elt number first) for a BPE to dest (BGR, 3 bytes per elt).
+// Elts that have not been calculated yet are set to the grey given by fill.
+// Returns false if any elts are not available (yet).
+bool CHexEditDoc::GetAerialBits(int bpe, FILE_ADDRESS first, FILE_ADDRESS count, unsigned char *dest, unsigned char fill, bool heat /*=false*/)
+{
+	CSingleLock sl(&docdata_, TRUE);
+	aerial_pyramid &tiles = heat ? aerial_heat_tiles_ : aerial_tiles_;
+	return tiles.copy(aerial_pyramid::level_of(bpe), first, count, dest, fill);
+}
 
-	// Keep increasing bpe_ by powers of two until we get a small enough bitmap
-	while (bpe_ <= 65536 && (length_*3)/bpe_ > theApp.aerial_max_)
-		bpe_ = bpe_<<1;
+// Finds the next tile that a view wants that needs calculating from the file (returning the
+// range of elts of the tile that need calculating).  Tiles that can be made from the tiles
+// of the next lower BPE are done here as that does not require reading the file.  (This is
+// not done for heat map tiles as the stats of a block can't be made from those of its halves.)
+// Must be called with docdata_ locked.  Returns false if there is nothing to do.
+bool CHexEditDoc::aerial_next(bool &heat, int &level, FILE_ADDRESS &tile, FILE_ADDRESS &first, FILE_ADDRESS &last)
+{
+	for (std::vector<aerial_want>::const_iterator pw = aerial_want_.begin(); pw != aerial_want_.end(); ++pw)
+	{
+		aerial_pyramid &tiles = pw->heat ? aerial_heat_tiles_ : aerial_tiles_;
+		FILE_ADDRESS tb = aerial_pyramid::tile_bytes(pw->level);
+		for (FILE_ADDRESS tt = pw->start/tb; tt*tb < pw->end && tt*tb < tiles.length(); ++tt)
+		{
+			tiles.touch(pw->level, tt);             // make sure it's not discarded (see trim)
+			if (!tiles.need(pw->level, tt, first, last))
+				continue;
+			if (!pw->heat && !tiles.has_tile(pw->level, tt) && tiles.downsample(pw->level, tt))
+			{
+				aerial_fin_ = true;                 // tell views there is something new to show
+				continue;
+			}
+			heat = pw->heat;
+			level = pw->level;
+			tile = tt;
+			return true;
+		}
+	}
+	return false;
+}
 
-	// Work out the number of bitmap rows we would need at the widest bitmap size
-	int rows = int(length_/bpe_/MAX_WIDTH) + 2;    // Round up to next row plus add one more row to allow for "reshaping"
-	ASSERT((rows-2)*MAX_WIDTH < theApp.aerial_max_);
+// Called when the document has changed so that the affected tiles can be recalculated.
+void CHexEditDoc::aerial_change(enum mod_type utype, FILE_ADDRESS address, FILE_ADDRESS len)
+{
+	if (av_count_ == 0)
+		return;
 
-	dib_ = FreeImage_Allocate(MAX_WIDTH, rows, 24);
+	CSingleLock sl(&docdata_, TRUE);
+	if (len < 1)
+		len = 1;                        // 2nd nybble of hex edit changes last byte of previous change
 
-	dib_size_ = MAX_WIDTH*rows*3;           // DIB size in bytes since we have 3 bytes per pixel and no pad bytes at the end of each scan line
-	ASSERT(dib_size_ == FreeImage_GetPitch(dib_) * FreeImage_GetHeight(dib_));
-	TRACE("+++ FreeImage_Allocate %d at %p end %p\n", dib_, FreeImage_GetBits(dib_), FreeImage_GetBits(dib_)+dib_size_);
-	if (clear > -1)
-		memset(FreeImage_GetBits(dib_), clear, dib_size_);       // Clear to a grey
+	if (utype == mod_replace || utype == mod_repback)
+	{
+		aerial_tiles_.invalidate(address, address + len);
+		aerial_heat_tiles_.invalidate(address, address + len);
+	}
+	else
+	{
+		aerial_tiles_.discard(address); // all bytes after the insertion/deletion have moved
+		aerial_heat_tiles_.discard(address);
+	}
+	aerial_tiles_.set_length(length_);
+	aerial_heat_tiles_.set_length(length_);
 }
 
 // Sends a message for the thread to kill itself then tidies up shared members. 
@@ -394,19 +480,8 @@ UINT CHexEditDoc::RunAerialThread()
 		if (AerialProcessStop())
 			continue;
 
-		// Reset for new scan
-		docdata_.Lock();
-		aerial_fin_ = false;
-		aerial_addr_ = 0;
-		FILE_ADDRESS file_len = length_;
-		int file_bpe = bpe_;
-		unsigned char *file_dib = FreeImage_GetBits(dib_);
-		unsigned dib_size = FreeImage_GetDIBSize(dib_);
-		docdata_.Unlock();
-		TRACE("+++ BGAerial: using bitmap at %p\n", file_dib);
-
-		// Get the file buffer
-		size_t buf_len = (size_t)std::min<FILE_ADDRESS>(file_len, 65536);
+		// Get the file buffer.  Note that the buffer size must be a multiple of the biggest BPE.
+		const size_t buf_len = 65536;
 		ASSERT(aerial_buf_ == NULL);
 		aerial_buf_ = new unsigned char[buf_len];
 
@@ -416,37 +491,87 @@ UINT CHexEditDoc::RunAerialThread()
 			if (AerialProcessStop())
 				break;   // stop processing and go back to WAITING state
 
-			// Check if we have finished scanning the file
-			if (aerial_addr_ >= file_len)
+			// Find the next tile (or part of a tile) wanted by a view that needs calculating
+			bool heat;
+			int level;
+			FILE_ADDRESS tile, first, last;
+			unsigned generation, keep_since;
+			FILE_ADDRESS file_len;
 			{
-				TRACE2("+++ BGAerial: finished scan for %p at address %p\n", this, file_dib + 3*size_t(aerial_addr_/file_bpe));
 				CSingleLock sl(&docdata_, TRUE); // Protect shared data access
-
-				aerial_fin_ = true;
-				break;                          // falls out to end_scan
+				unsigned keep_colour = aerial_tiles_.clock() + 1, keep_heat = aerial_heat_tiles_.clock() + 1;
+				if (!aerial_next(heat, level, tile, first, last))
+				{
+					TRACE1("+++ BGAerial: finished scan for %p\n", this);
+					aerial_fin_ = true;
+					aerial_state_ = WAITING;    // set now so we don't miss a request (see AerialWant)
+					break;
+				}
+				keep_since = heat ? keep_heat : keep_colour;
+				generation = heat ? aerial_heat_tiles_.generation() : aerial_tiles_.generation();
+				file_len = aerial_tiles_.length();
+				aerial_start_ = aerial_addr_ = tile*aerial_pyramid::tile_bytes(level) + (first << level);
+				aerial_end_ = std::min(tile*aerial_pyramid::tile_bytes(level) + (last << level), file_len);
 			}
 
-			// Get the next buffer full from the file and scan it
-			size_t got = GetData(aerial_buf_, buf_len, aerial_addr_, 3);
-			ASSERT(got <= buf_len);
-
-			unsigned char *pbm = file_dib + 3*size_t(aerial_addr_/file_bpe);    // where we write to bitmap
-			unsigned char *pbuf;                                        // where we read from the file buffer
-			for (pbuf = aerial_buf_; pbuf < aerial_buf_ + got; pbuf += file_bpe, pbm += 3)
+			aerial_elts_.resize(size_t(last - first) * 3);
+			unsigned char *pbm = &aerial_elts_[0];                              // where we write to bitmap
+			bool stopped = false;
+			while (aerial_addr_ < aerial_end_)
 			{
-				int r, g, b;
-				r = g = b = 0;
-				for (unsigned char *pp = pbuf; pp < pbuf + file_bpe; ++pp)
+				if (AerialProcessStop())
+				{
+					stopped = true;
+					break;
+				}
+
+				// Holes in a sparse file are all zeroes so every whole elt in a hole is the same
+				// colour - just work it out once rather than reading the hole
+				FILE_ADDRESS hole_elts = (std::min(HoleEnd(aerial_addr_), aerial_end_) - aerial_addr_) >> level;
+				if (hole_elts > 0)
 				{
-					r += GetRValue(kala_[*pp]);
-					g += GetGValue(kala_[*pp]);
-					b += GetBValue(kala_[*pp]);
+					size_t elt_len = size_t(1) << level;
+					ASSERT(elt_len <= buf_len);
+					memset(aerial_buf_, '\0', elt_len);
+					if (heat)
+						aerial_metrics::reduce(aerial_buf_, elt_len, level, pbm);
+					else
+						aerial_reduce_.reduce(aerial_buf_, elt_len, level, pbm);
+					for (FILE_ADDRESS ii = 1; ii < hole_elts; ++ii)
+						memcpy(pbm + ii*3, pbm, 3);
+					pbm += hole_elts * 3;
+					aerial_addr_ += hole_elts << level;
+					continue;
 				}
-				*pbm     = unsigned char(b/file_bpe);
-				*(pbm+1) = unsigned char(g/file_bpe);
-				*(pbm+2) = unsigned char(r/file_bpe);
+
+				// Get the next buffer full from the file and scan it
+				size_t got = GetData(aerial_buf_, size_t(std::min<FILE_ADDRESS>(aerial_end_ - aerial_addr_, buf_len)), aerial_addr_, 3);
+				ASSERT(got <= buf_len);
+				if (got == 0)
+					break;                                              // file has been truncated
+
+				// Since buf_len is a multiple of the BPE only the last elt of the file may be short
+				if (heat)
+					pbm += aerial_metrics::reduce(aerial_buf_, got, level, pbm) * 3;
+				else
+					pbm += aerial_reduce_.reduce(aerial_buf_, got, level, pbm) * 3;
+				aerial_addr_ += got;
+			}
+			if (stopped)
+				break;
+
+			// Store the tile unless the document changed while we were calculating it
+			CSingleLock sl(&docdata_, TRUE);
+			aerial_pyramid &tiles = heat ? aerial_heat_tiles_ : aerial_tiles_;
+			if (tiles.generation() == generation)
+			{
+				tiles.put(level, tile, first, &aerial_elts_[0], last - first);
+
+				// Both sets of tiles share the memory limit
+				size_t other = heat ? aerial_tiles_.memory() : aerial_heat_tiles_.memory();
+				tiles.trim(theApp.aerial_max_ > other ? theApp.aerial_max_ - other : 0, keep_since);
 			}
-			aerial_addr_ += got;
+			aerial_fin_ = true;                 // tell the views to show the new tile
 		}
 
 		delete[] aerial_buf_;
@@ -473,6 +598,7 @@ bool CHexEditDoc::AerialProcessStop()
 		sl.Unlock();                // we need this here as AfxEndThread() never returns so d'tor is not called
 		delete[] aerial_buf_;
 		aerial_buf_ = NULL;
+		std::vector<unsigned char>().swap(aerial_elts_);
 		AfxEndThread(1);            // kills thread (no return)
 		break;                      // Avoid warning
 	case NONE:                      // nothing needed here - just continue scanning
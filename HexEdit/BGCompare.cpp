@@ -16,6 +16,12 @@
 #include "Dialog.h"
 #include "NewCompare.h"
 #include "Misc.h"
+#include "AnchoredDiff.h"
+#include "ParallelCompare.h"
+#include "SnapshotStore.h"
+
+#include <memory>
+#include <stdexcept>
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -166,6 +172,7 @@ view_t CHexEditDoc::GetCompareFile(view_t view_type, bool & auto_sync, bool & au
 		dlg.insdel_ = 1;
 		dlg.minmatch_ = compMinMatch_;
 	}
+	dlg.anchored_ = compAnchored_ ? 1 : 0;
 	dlg.auto_sync_ = auto_sync;
 	dlg.auto_scroll_= auto_scroll;
 
@@ -181,6 +188,7 @@ view_t CHexEditDoc::GetCompareFile(view_t view_type, bool & auto_sync, bool & au
 	{
 		compMinMatch_ = dlg.minmatch_;
 	}
+	compAnchored_ = dlg.insdel_ && dlg.anchored_;
 	auto_sync = dlg.auto_sync_ != 0;
 	auto_scroll = dlg.auto_scroll_ != 0;
 
@@ -409,108 +417,52 @@ std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::GetFirstOtherDiff(int rr /*=0
 std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::get_first_diff(bool other, int rr)
 {
 	ASSERT(rr >= 0 && rr < comp_.size());
-	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval;
-	retval.first = LLONG_MAX;                           // default value indicates "not found"
+	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval(-1, 0);   // default to "not found"
 
 	if (pthread4_ == NULL) return retval;              // no background compare is happening
 
 	CSingleLock sl(&docdata_, TRUE);
 	if (comp_state_ != WAITING) return retval;         // not finished
 
-	const std::vector<FILE_ADDRESS> * replace_addr;
-	const std::vector<FILE_ADDRESS> * replace_len;
-	const std::vector<FILE_ADDRESS> * insert_addr;
-	const std::vector<FILE_ADDRESS> * insert_len;
-	const std::vector<FILE_ADDRESS> * delete_addr;
-	if (other)
-	{
-		replace_addr = &comp_[rr].m_replace_B;
-		replace_len  = &comp_[rr].m_replace_len;
-		insert_addr  = &comp_[rr].m_insert_B;
-		insert_len   = &comp_[rr].m_delete_len;   // size of deletion in A == insertion in B
-		delete_addr  = &comp_[rr].m_delete_B;
-	}
-	else
-	{
-		replace_addr = &comp_[rr].m_replace_A;
-		replace_len  = &comp_[rr].m_replace_len;
-		insert_addr  = &comp_[rr].m_insert_A;
-		insert_len   = &comp_[rr].m_insert_len;
-		delete_addr  = &comp_[rr].m_delete_A;
-	}
-
-	if (!replace_addr->empty())
-	{
-		retval.first  = (*replace_addr)[0];
-		retval.second = (*replace_len)[0];
-	}
-
-	if (!insert_addr->empty())
+	const diff_index &idx = other ? comp_[rr].m_index_B : comp_[rr].m_index_A;
+	const diff_index::extent *pe = idx.first();
+	if (pe != NULL)
 	{
-		if ((*insert_addr)[0] < retval.first)
-		{
-			retval.first = (*insert_addr)[0];
-			retval.second = - (*insert_len)[0];        // use -ve length to indicate insertion
-		}
+		retval.first = pe->addr;
+		retval.second = pe->diff_len();            // +ve for replacement, -ve for insertion, 0 for deletion
 	}
-
-	if (!delete_addr->empty())
-	{
-		if ((*delete_addr)[0] < retval.first)
-		{
-			retval.first = (*delete_addr)[0];
-			retval.second = 0;                        // use zero length to indicate a deletion
-		}
-	}
-
-	if (retval.first == LLONG_MAX)
-		retval.first = -1;           // signal not found
 	return retval;
 }
 
+// Rebuilds the merged index of the diffs of all results (revisions) - must be called
+// (with docdata_ locked) whenever comp_ is changed.
+void CHexEditDoc::update_comp_all()
+{
+	std::vector<const diff_index *> revs;
+	for (const CompResult &cr : comp_)
+		revs.push_back(&cr.m_index_A);
+	comp_all_.merge(revs);
+}
+
 // GetFirstDiffAll returns the first difference of all diffs in self-compare
 // returns a pair of numbers representing the type of difference and location in the original file
 //   first = address of the difference in the original file (or -1 if there are no diffs)
 //   second = length of the difference (+ve for replacement, -ve for insertion, zero for deletion)
 std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::GetFirstDiffAll()
 {
-	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval;
-	retval.first = LLONG_MAX;                          // default value indicates "not found"
+	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval(-1, 0);   // default to "not found"
 
 	if (pthread4_ == NULL) return retval;              // no background compare is happening
 
 	CSingleLock sl(&docdata_, TRUE);
 	if (comp_state_ != WAITING) return retval;         // not finished
 
-	for (int rr = 0; rr < comp_.size(); ++rr)
+	const diff_index::extent *pe = comp_all_.first();
+	if (pe != NULL)
 	{
-		if (!comp_[rr].m_replace_A.empty())
-		{
-			retval.first  = comp_[rr].m_replace_A[0];
-			retval.second = comp_[rr].m_replace_len[0];
-		}
-
-		if (!comp_[rr].m_insert_A.empty())
-		{
-			if (comp_[rr].m_insert_A[0] < retval.first)
-			{
-				retval.first = comp_[rr].m_insert_A[0];
-				retval.second = - comp_[rr].m_insert_len[0];        // use -ve length to indicate insertion
-			}
-		}
-
-		if (!comp_[rr].m_delete_A.empty())
-		{
-			if (comp_[rr].m_delete_A[0] < retval.first)
-			{
-				retval.first = comp_[rr].m_delete_A[0];
-				retval.second = 0;                        // use zero length to indicate a deletion
-			}
-		}
+		retval.first = pe->addr;
+		retval.second = pe->diff_len();
 	}
-
-	if (retval.first == LLONG_MAX)
-		retval.first = -1;           // signal not found
 	return retval;
 }
 
@@ -539,68 +491,20 @@ std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::GetPrevOtherDiff(FILE_ADDRESS
 std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::get_prev_diff(bool other, FILE_ADDRESS from, int rr)
 {
 	ASSERT(rr >= 0 && rr < comp_.size());
-	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval;
-	retval.first = -1;                                 // default to "not found"
+	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval(-1, 0);   // default to "not found"
 
 	if (pthread4_ == NULL) return retval;              // no background compare is happening
 
 	CSingleLock sl(&docdata_, TRUE);
 	if (comp_state_ != WAITING) return retval;         // not finished
 
-	const std::vector<FILE_ADDRESS> * replace_addr;
-	const std::vector<FILE_ADDRESS> * replace_len;
-	const std::vector<FILE_ADDRESS> * insert_addr;
-	const std::vector<FILE_ADDRESS> * insert_len;
-	const std::vector<FILE_ADDRESS> * delete_addr;
-	if (other)
-	{
-		replace_addr = &comp_[rr].m_replace_B;
-		replace_len  = &comp_[rr].m_replace_len;
-		insert_addr  = &comp_[rr].m_insert_B;
-		insert_len   = &comp_[rr].m_delete_len;
-		delete_addr  = &comp_[rr].m_delete_B;
-	}
-	else
-	{
-		replace_addr = &comp_[rr].m_replace_A;
-		replace_len  = &comp_[rr].m_replace_len;
-		insert_addr  = &comp_[rr].m_insert_A;
-		insert_len   = &comp_[rr].m_insert_len;
-		delete_addr  = &comp_[rr].m_delete_A;
-	}
-
-	int idx;
-
-	// First check for a replacement that is before the address
-	if ((idx = AddressAt(*replace_addr, from) - 1) >= 0)
+	const diff_index &idx = other ? comp_[rr].m_index_B : comp_[rr].m_index_A;
+	const diff_index::extent *pe = idx.prev(from);
+	if (pe != NULL)
 	{
-		ASSERT(idx < replace_addr->size());
-		retval.first  = (*replace_addr)[idx];
-		retval.second = (*replace_len)[idx];
+		retval.first = pe->addr;
+		retval.second = pe->diff_len();            // +ve for replacement, -ve for insertion, 0 for deletion
 	}
-
-	// Check for an insertion that is before the address
-	if ((idx = AddressAt(*insert_addr, from) - 1) >= 0)
-	{
-		// Check if it is closer to the address than what we have (for replacement)
-		if ((*insert_addr)[idx] > retval.first)
-		{
-			retval.first = (*insert_addr)[idx];
-			retval.second = - (*insert_len)[idx];      // use -ve length to indicate insertion
-		}
-	}
-
-	// Check if there is a deletion before the address
-	if ((idx = AddressAt(*delete_addr, from) - 1) >= 0)
-	{
-		// Check if it is closer to the address than what we have
-		if ((*delete_addr)[idx] > retval.first)
-		{
-			retval.first = (*delete_addr)[idx];
-			retval.second = 0;                                  // use zero length to indicate a deletion
-		}
-	}
-
 	return retval;
 }
 
@@ -611,49 +515,19 @@ std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::get_prev_diff(bool other, FIL
 //   second = length of the difference (+ve for replacement, -ve for insertion, zero for deletion)
 std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::GetPrevDiffAll(FILE_ADDRESS from)
 {
-	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval;
-	retval.first = -1;
+	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval(-1, 0);   // default to "not found"
 
-	if (pthread4_ == NULL) return retval;
+	if (pthread4_ == NULL) return retval;              // no background compare is happening
 
 	CSingleLock sl(&docdata_, TRUE);
 	if (comp_state_ != WAITING) return retval;         // not finished
 
-	int idx;
-
-	for (int rr = 0; rr < comp_.size(); ++rr)
+	const diff_index::extent *pe = comp_all_.prev(from);
+	if (pe != NULL)
 	{
-		// First check for a replacement that is before the address
-		if ((idx = AddressAt(comp_[rr].m_replace_A, from) - 1) >= 0)
-		{
-			ASSERT(idx < comp_[rr].m_replace_A.size());
-			retval.first  = comp_[rr].m_replace_A[idx];
-			retval.second = comp_[rr].m_replace_len[idx];
-		}
-
-		// Check for an insertion that is before the address
-		if ((idx = AddressAt(comp_[rr].m_insert_A, from) - 1) >= 0)
-		{
-			// Check if it is closer to the address than what we have (for replacement)
-			if (comp_[rr].m_insert_A[idx] > retval.first)
-			{
-				retval.first = comp_[rr].m_insert_A[idx];
-				retval.second = - comp_[rr].m_insert_len[idx];      // use -ve length to indicate insertion
-			}
-		}
-
-		// Check if there is a deletion before the address
-		if ((idx = AddressAt(comp_[rr].m_delete_A, from) - 1) >= 0)
-		{
-			// Check if it is closer to the address than what we have
-			if (comp_[rr].m_delete_A[idx] > retval.first)
-			{
-				retval.first = comp_[rr].m_delete_A[idx];
-				retval.second = 0;                                  // use zero length to indicate a deletion
-			}
-		}
+		retval.first = pe->addr;
+		retval.second = pe->diff_len();
 	}
-
 	return retval;
 }
 
@@ -682,118 +556,43 @@ std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::GetNextOtherDiff(FILE_ADDRESS
 std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::get_next_diff(bool other, FILE_ADDRESS from, int rr)
 {
 	ASSERT(rr >= 0 && rr < comp_.size());
-	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval;
-	retval.first = LLONG_MAX;                          // default value indicates "not found"
+	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval(-1, 0);   // default to "not found"
 
 	if (pthread4_ == NULL) return retval;              // no background compare is happening
 
 	CSingleLock sl(&docdata_, TRUE);
 	if (comp_state_ != WAITING) return retval;         // not finished
 
-	const std::vector<FILE_ADDRESS> * replace_addr;
-	const std::vector<FILE_ADDRESS> * replace_len;
-	const std::vector<FILE_ADDRESS> * insert_addr;
-	const std::vector<FILE_ADDRESS> * insert_len;
-	const std::vector<FILE_ADDRESS> * delete_addr;
-	if (other)
+	const diff_index &idx = other ? comp_[rr].m_index_B : comp_[rr].m_index_A;
+	const diff_index::extent *pe = idx.next(from);
+	if (pe != NULL)
 	{
-		replace_addr = &comp_[rr].m_replace_B;
-		replace_len  = &comp_[rr].m_replace_len;
-		insert_addr  = &comp_[rr].m_insert_B;
-		insert_len   = &comp_[rr].m_delete_len;
-		delete_addr  = &comp_[rr].m_delete_B;
-	}
-	else
-	{
-		replace_addr = &comp_[rr].m_replace_A;
-		replace_len  = &comp_[rr].m_replace_len;
-		insert_addr  = &comp_[rr].m_insert_A;
-		insert_len   = &comp_[rr].m_insert_len;
-		delete_addr  = &comp_[rr].m_delete_A;
-	}
-
-	int idx;
-
-	if ((idx = AddressAt(*replace_addr, from)) < replace_addr->size())
-	{
-		retval.first  = (*replace_addr)[idx];
-		retval.second = (*replace_len)[idx];
-	}
-
-	if ((idx = AddressAt(*insert_addr, from)) < insert_addr->size())
-	{
-		if ((*insert_addr)[idx] < retval.first)
-		{
-			retval.first  = (*insert_addr)[idx];
-			retval.second = - (*insert_len)[idx];      // use -ve length to indicate insertion
-		}
-	}
-
-	if ((idx = AddressAt(*delete_addr, from)) < delete_addr->size())
-	{
-		if ((*delete_addr)[idx] < retval.first)
-		{
-			retval.first = (*delete_addr)[idx];
-			retval.second = 0;                                  // use zero length to indicate a deletion
-		}
+		retval.first = pe->addr;
+		retval.second = pe->diff_len();            // +ve for replacement, -ve for insertion, 0 for deletion
 	}
-
-	if (retval.first == LLONG_MAX)
-		retval.first = -1;           // signal not found
 	return retval;
 }
 
-// GetNextDiffAll returns the first difference before a specified address of all diffs in self-compare
-//   from = the address to start looking backwards from
+// GetNextDiffAll returns the first difference after a specified address of all diffs in self-compare
+//   from = the address to start looking (forward) from
 // returns a pair of numbers representing the type of difference and where it occurs in the original file
 //   first = address of the difference in the original file (or -1 if not found)
 //   second = length of the difference (+ve for replacement, -ve for insertion, zero for deletion)
 std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::GetNextDiffAll(FILE_ADDRESS from)
 {
-	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval;
-	retval.first = LLONG_MAX;                          // default value indicates "not found"
+	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval(-1, 0);   // default to "not found"
 
-	if (pthread4_ == NULL) return retval;
+	if (pthread4_ == NULL) return retval;              // no background compare is happening
 
 	CSingleLock sl(&docdata_, TRUE);
 	if (comp_state_ != WAITING) return retval;         // not finished
 
-	int idx;
-
-	for (int rr = 0; rr < comp_.size(); ++rr)
+	const diff_index::extent *pe = comp_all_.next(from);
+	if (pe != NULL)
 	{
-		// First check for a replacement that is before the address
-		if ((idx = AddressAt(comp_[rr].m_replace_A, from) - 1) < comp_[rr].m_replace_A.size())
-		{
-			retval.first  = comp_[rr].m_replace_A[idx];
-			retval.second = comp_[rr].m_replace_len[idx];
-		}
-
-		// Check for an insertion that is before the address
-		if ((idx = AddressAt(comp_[rr].m_insert_A, from) - 1) < comp_[rr].m_insert_A.size())
-		{
-			// Check if it is closer to the address than what we have (for replacement)
-			if (comp_[rr].m_insert_A[idx] < retval.first)
-			{
-				retval.first = comp_[rr].m_insert_A[idx];
-				retval.second = - comp_[rr].m_insert_len[idx];      // use -ve length to indicate insertion
-			}
-		}
-
-		// Check if there is a deletion before the address
-		if ((idx = AddressAt(comp_[rr].m_delete_A, from) - 1) < comp_[rr].m_delete_A.size())
-		{
-			// Check if it is closer to the address than what we have
-			if (comp_[rr].m_delete_A[idx] < retval.first)
-			{
-				retval.first = comp_[rr].m_delete_A[idx];
-				retval.second = 0;                                  // use zero length to indicate a deletion
-			}
-		}
+		retval.first = pe->addr;
+		retval.second = pe->diff_len();
 	}
-
-	if (retval.first == LLONG_MAX)
-		retval.first = -1;           // signal not found
 	return retval;
 }
 
@@ -820,104 +619,42 @@ std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::GetLastOtherDiff(int rr /*=0*
 std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::get_last_diff(bool other, int rr)
 {
 	ASSERT(rr >= 0 && rr < comp_.size());
-	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval;
-	retval.first = -1;                                 // default to "not found"
+	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval(-1, 0);   // default to "not found"
 
 	if (pthread4_ == NULL) return retval;              // no background compare is happening
 
 	CSingleLock sl(&docdata_, TRUE);
 	if (comp_state_ != WAITING) return retval;         // not finished
 
-	const std::vector<FILE_ADDRESS> * replace_addr;
-	const std::vector<FILE_ADDRESS> * replace_len;
-	const std::vector<FILE_ADDRESS> * insert_addr;
-	const std::vector<FILE_ADDRESS> * insert_len;
-	const std::vector<FILE_ADDRESS> * delete_addr;
-	if (other)
-	{
-		replace_addr = &comp_[rr].m_replace_B;
-		replace_len  = &comp_[rr].m_replace_len;
-		insert_addr  = &comp_[rr].m_insert_B;
-		insert_len   = &comp_[rr].m_delete_len;
-		delete_addr  = &comp_[rr].m_delete_B;
-	}
-	else
-	{
-		replace_addr = &comp_[rr].m_replace_A;
-		replace_len  = &comp_[rr].m_replace_len;
-		insert_addr  = &comp_[rr].m_insert_A;
-		insert_len   = &comp_[rr].m_insert_len;
-		delete_addr  = &comp_[rr].m_delete_A;
-	}
-
-	if (!replace_addr->empty())
-	{
-		retval.first  = (*replace_addr).back();
-		retval.second = (*replace_len).back();
-	}
-
-	if (!insert_addr->empty())
+	const diff_index &idx = other ? comp_[rr].m_index_B : comp_[rr].m_index_A;
+	const diff_index::extent *pe = idx.last();
+	if (pe != NULL)
 	{
-		if ((*insert_addr).back() > retval.first)
-		{
-			retval.first = (*insert_addr).back();
-			retval.second = - (*insert_len).back();        // use -ve length to indicate insertion not replacement
-		}
-	}
-
-	if (!delete_addr->empty())
-	{
-		if ((*delete_addr).back() > retval.first)
-		{
-			retval.first = (*delete_addr).back();
-			retval.second = 0;                                  // use zero length to indicate a deletion
-		}
+		retval.first = pe->addr;
+		retval.second = pe->diff_len();            // +ve for replacement, -ve for insertion, 0 for deletion
 	}
-
 	return retval;
 }
 
-// GetLastDiffAll returns the first difference in the original file of all diffs (in self compare)
+// GetLastDiffAll returns the last difference in the original file of all diffs (in self compare)
 // returns a pair of numbers representing the type of difference and location in the original file
 //   first = address of the difference in the original file (or -1 if there are no diffs)
 //   second = length of the difference (+ve for replacement, -ve for insertion, zero for deletion)
 std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::GetLastDiffAll()
 {
-	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval;
-	retval.first = -1;
+	std::pair<FILE_ADDRESS, FILE_ADDRESS> retval(-1, 0);   // default to "not found"
 
-	if (pthread4_ == NULL) return retval;
+	if (pthread4_ == NULL) return retval;              // no background compare is happening
 
 	CSingleLock sl(&docdata_, TRUE);
 	if (comp_state_ != WAITING) return retval;         // not finished
 
-	for (int rr = 0; rr < comp_.size(); ++rr)
+	const diff_index::extent *pe = comp_all_.last();
+	if (pe != NULL)
 	{
-		if (!comp_[rr].m_replace_A.empty())
-		{
-			retval.first  = comp_[rr].m_replace_A.back();
-			retval.second = comp_[rr].m_replace_len.back();
-		}
-
-		if (!comp_[rr].m_insert_A.empty())
-		{
-			if (comp_[rr].m_insert_A.back() > retval.first)
-			{
-				retval.first = comp_[rr].m_insert_A.back();
-				retval.second = - comp_[rr].m_insert_len.back();        // use -ve length to indicate insertion
-			}
-		}
-
-		if (!comp_[rr].m_delete_A.empty())
-		{
-			if (comp_[rr].m_delete_A.back() > retval.first)
-			{
-				retval.first = comp_[rr].m_delete_A.back();
-				retval.second = 0;                        // use zero length to indicate a deletion
-			}
-		}
+		retval.first = pe->addr;
+		retval.second = pe->diff_len();
 	}
-
 	return retval;
 }
 
@@ -932,21 +669,27 @@ std::pair<FILE_ADDRESS, FILE_ADDRESS> CHexEditDoc::GetLastDiffAll()
 //   pfile1_compare_, pfile4_compare_ is file to compare with
 // When doing self-compare:
 //   pfile1_ is original file
-//   pfile4_ is newer temp file (file name = tempFileA_)
-//   pfile1_compare_, pfile4_compare_ is older temp file (file name = tempFileB_)
+//   pfile4_ is the latest snapshot of the file (version 0 of snap_)
+//   pfile1_compare_, pfile4_compare_ is the previous snapshot (version 1 of snap_)
 bool CHexEditDoc::OpenCompFile()
 {
+	ASSERT(!bCompSelf_ || snap_ != NULL);
+	if (bCompSelf_ && snap_ == NULL)
+		return false;
+
 	// Open file to be used by background thread
 	if (pfile1_ != NULL)
 	{
 		CString fileName;
 		if (bCompSelf_)
-			fileName = tempFileA_;
+			fileName = snap_->store_name().c_str();
 		else
 			fileName = pfile1_->GetFilePath();
 		ASSERT(!fileName.IsEmpty());
 
-		if (IsDevice() && !bCompSelf_)
+		if (bCompSelf_)
+			pfile4_ = new CFileSnapshot(snap_, 0);
+		else if (IsDevice())
 			pfile4_ = new CFileNC();
 		else
 			pfile4_ = new CFile64();
@@ -971,14 +714,20 @@ bool CHexEditDoc::OpenCompFile()
 
 	CString fileName;
 	if (!bCompSelf_)
+	{
 		fileName = compFileName_;
+		pfile1_compare_ = new CFile64();
+		pfile4_compare_ = new CFile64();
+	}
 	else if (pfile1_ != NULL)
-		fileName = tempFileB_.IsEmpty() ? pfile1_->GetFilePath() : tempFileB_;
+	{
+		fileName = snap_->store_name().c_str();
+		pfile1_compare_ = new CFileSnapshot(snap_, 1);
+		pfile4_compare_ = new CFileSnapshot(snap_, 1);
+	}
 	else
 		return false;
 
-	pfile1_compare_ = new CFile64();
-	pfile4_compare_ = new CFile64();
 	if (!pfile1_compare_->Open(fileName, CFile::modeRead|CFile::shareDenyNone|CFile::typeBinary) ||
 		!pfile4_compare_->Open(fileName, CFile::modeRead|CFile::shareDenyNone|CFile::typeBinary))
 	{
@@ -1024,26 +773,50 @@ void CHexEditDoc::CloseCompFile()
 	}
 }
 
-// Makes a new temp file name and copies the current file to it
-bool CHexEditDoc::MakeTempFile()
+// Makes the snapshot store (in a new temp file) used for self-compare and copies the current file to it
+bool CHexEditDoc::MakeSnapshot()
 {
-	if (!tempFileA_.IsEmpty() && _access(tempFileA_, 0) != -1)
-		return true;    // temp file already present when swapping between tab/split views
+	if (snap_ != NULL)
+		return true;    // snapshot already present when swapping between tab/split views
 
 	char temp_dir[_MAX_PATH];
 	char temp_file[_MAX_PATH];
-	CWaitCursor wc;     // displays Hour glass until destroyed on function exit
 	if (pfile1_ == NULL ||
 		!::GetTempPath(sizeof(temp_dir), temp_dir) ||
-		!::GetTempFileName(temp_dir, _T("_HE"), 0, temp_file) ||
-		!::CopyFile(pfile1_->GetFilePath(), temp_file, FALSE))
+		!::GetTempFileName(temp_dir, _T("_HE"), 0, temp_file))
+	{
+		return false;
+	}
+	snap_ = new snapshot_store(temp_file);
+	if (!TakeSnapshot())
 	{
+		delete snap_;
+		snap_ = NULL;
 		return false;
 	}
-	tempFileA_ = temp_file;
 	return true;
 }
 
+// Adds the current file to the snapshot store.  Only blocks that have changed since the
+// last snapshot are copied, and the last snapshot becomes the previous version.
+bool CHexEditDoc::TakeSnapshot()
+{
+	ASSERT(snap_ != NULL && pfile1_ != NULL);
+	CWaitCursor wc;     // displays Hour glass until destroyed on function exit
+	CFile64 ff;
+	if (!ff.Open(pfile1_->GetFilePath(), CFile::modeRead|CFile::shareDenyNone|CFile::typeBinary))
+		return false;
+
+	bool ok = snap_->take([&ff](unsigned char *buf, size_t len, std::int64_t addr) -> size_t
+		{
+			if (ff.Seek(addr, CFile::begin) == -1)
+				return -1;
+			return ff.Read(buf, DWORD(len));
+		}, ff.GetLength());
+	ff.Close();
+	return ok;
+}
+
 bool CHexEditDoc::IsCompWaiting()
 {
 	CSingleLock sl(&docdata_, TRUE);
@@ -1146,20 +919,8 @@ void CHexEditDoc::KillCompThread()
 
 	// Free resources that are only needed during bg compares
 	CloseCompFile();
-	if (bCompSelf_)
-	{
-		if (!tempFileA_.IsEmpty())
-		{
-			VERIFY(::remove(tempFileA_) == 0);
-			tempFileA_.Empty();
-		}
-		if (!tempFileB_.IsEmpty())
-		{
-			VERIFY(::remove(tempFileB_) == 0);
-			tempFileB_.Empty();
-		}
-	}
-	ASSERT(tempFileA_.IsEmpty() && tempFileB_.IsEmpty());
+	delete snap_;                       // also deletes the store file
+	snap_ = NULL;
 }
 
 static UINT bg_func(LPVOID pParam)
@@ -1182,6 +943,7 @@ bool CHexEditDoc::CreateCompThread()
 	comp_progress_ = 0;
 	comp_.clear();
 	comp_.push_front(CompResult());  // always has at least one elt = current/last compare results
+	comp_all_.clear();
 
 	// Save current file modification time so we don't keep restarting the compare
 	CFileStatus stat;
@@ -1227,9 +989,20 @@ UINT CHexEditDoc::RunCompThread()
 		comp_progress_ = 0;
 		CompResult result;
 		int min_match = compMinMatch_;
+		bool anchored = compAnchored_ && compMinMatch_ > 0;
 		result = comp_[0];
 		docdata_.Unlock();
 
+		if (bCompSelf_ && RunSnapshotCompare(result, min_match))
+			continue;
+		if (anchored)
+		{
+			RunAnchoredCompare(result);
+			continue;
+		}
+		if (min_match == 0 && RunParallelCompare(result))
+			continue;
+
 		// Get buffers for each source
 		const size_t buf_size = 8192;   // xxx may need to be dynamic later (based on sync length)
 		ASSERT(comp_bufa_ == NULL && comp_bufb_ == NULL);
@@ -1484,6 +1257,7 @@ UINT CHexEditDoc::RunCompThread()
 					CSingleLock sl(&docdata_, TRUE); // Protect shared data access
 
 					comp_[0] = result;
+					update_comp_all();
 					comp_fin_ = true;
 					comp_progress_ = length_;
 				}
@@ -1502,6 +1276,246 @@ UINT CHexEditDoc::RunCompThread()
 	return 0;  // never reached
 }
 
+// Does the compare for RunCompThread when finding insertions/deletions by matching chunks.
+// This handles large insertions/deletions (and moved blocks) in time proportional to file size.
+void CHexEditDoc::RunAnchoredCompare(CompResult &result)
+{
+	anchored_diff diff(
+		[this](unsigned char *buf, size_t len, std::int64_t addr) { return GetData(buf, len, addr, 4); },
+		length_,
+		[this](unsigned char *buf, size_t len, std::int64_t addr) { return GetCompData(buf, len, addr, true); },
+		CompLength());
+
+	FILE_ADDRESS total = length_;
+	bool ok = diff.run([this, total](double done) -> bool
+	{
+		if (CompProcessStop())
+			return false;
+		CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+		comp_progress_ = FILE_ADDRESS(done * total);
+		return true;
+	});
+	if (!ok)
+		return;                             // stopped - go back to WAITING state
+
+	for (const anchored_diff::block &blk : diff.blocks())
+	{
+		switch (blk.kind)
+		{
+		case anchored_diff::KIND_REPLACE:
+			result.m_replace_A.push_back(blk.a);
+			result.m_replace_B.push_back(blk.b);
+			result.m_replace_len.push_back(blk.len);
+			break;
+		case anchored_diff::KIND_INSERT:    // Insertion in a == deletion from b
+			result.m_insert_A.push_back(blk.a);
+			result.m_delete_B.push_back(blk.b);
+			result.m_insert_len.push_back(blk.len);
+			break;
+		case anchored_diff::KIND_DELETE:    // Deletion from a == insertion in b
+			result.m_delete_A.push_back(blk.a);
+			result.m_insert_B.push_back(blk.b);
+			result.m_delete_len.push_back(blk.len);
+			break;
+		}
+	}
+	result.Final();
+
+	TRACE("+++ BGCompare: finished anchored scan for %p\n", this);
+	CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+	comp_[0] = result;
+	update_comp_all();
+	comp_fin_ = true;
+	comp_progress_ = length_;
+}
+
+// Does the compare for RunCompThread when not detecting insertions/deletions, using several
+// threads.  Returns false if this could not be done (so the compare is done the normal way).
+bool CHexEditDoc::RunParallelCompare(CompResult &result)
+{
+	// The workers open the files by name which we can't do for the versions in a snapshot store
+	if (bCompSelf_)
+		return false;
+
+	// Each worker thread needs its own file handles so the file must not have been modified.
+	// (Reads of a modified file go through GetData which does one at a time, so the workers
+	// would just wait for each other - the normal compare is as fast.)
+	bool unmodified;
+	{
+		CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+		unmodified = loc_.size() == 1 && (loc_.front().dlen >> 62) == 1 && loc_.front().fileaddr == 0;
+	}
+	if (!unmodified)
+		return false;
+
+	CString nameA = pfile4_->GetFilePath(), nameB = pfile4_compare_->GetFilePath();
+	bool deviceA = IsDevice() != FALSE, deviceB = ::IsDevice(nameB) != FALSE;
+
+	auto file_reader = [](const CString &name, bool nc) -> parallel_compare::reader_t
+	{
+		CFile64 *pf = nc ? new CFileNC() : new CFile64();
+		if (!pf->Open(name, CFile::modeRead|CFile::shareDenyNone|CFile::typeBinary))
+		{
+			delete pf;
+			throw std::runtime_error("compare file open failed");
+		}
+		std::shared_ptr<CFile64> file(pf, [](CFile64 *pp) { pp->Close(); delete pp; });
+		return [file](unsigned char *buf, size_t len, std::int64_t addr) -> size_t
+		{
+			if (file->Seek(addr, CFile::begin) == -1)
+				return -1;
+			return file->Read(buf, DWORD(len));
+		};
+	};
+	parallel_compare::opener_t open_a = [=]() { return file_reader(nameA, deviceA); };
+	parallel_compare::opener_t open_b = [=]() { return file_reader(nameB, deviceB); };
+
+	FILE_ADDRESS comp_len = CompLength();
+	FILE_ADDRESS common = std::min(length_, comp_len);
+	parallel_compare pc(open_a, open_b, common);
+
+	// Holes of both files (if they are sparse) are equal so are not read.  (Our file is
+	// unmodified so file_holes_ are at the same addresses in the document.)
+	std::shared_ptr<range_set<FILE_ADDRESS> > both_holes = std::make_shared<range_set<FILE_ADDRESS> >(get_holes(pfile4_compare_));
+	{
+		CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+		*both_holes &= file_holes_;
+	}
+	if (!both_holes->empty())
+	{
+		pc.set_holes([both_holes](std::int64_t addr) -> std::int64_t
+		{
+			range_set<FILE_ADDRESS>::range_t::const_iterator ph = both_holes->find_segment(addr);
+			return ph != both_holes->range_.end() && ph->sfirst <= addr ? ph->slast : addr;
+		});
+	}
+	bool ok = pc.run([this](std::int64_t done) -> bool
+	{
+		CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+		if (comp_command_ != NONE)
+			return false;               // let the workers finish before CompProcessStop (below) is called
+		comp_progress_ = done;
+		return true;
+	});
+	if (CompProcessStop())
+		return true;                    // stopped - go back to WAITING state
+	if (!ok)
+	{
+		TRACE("+++ BGCompare: parallel compare failed for %p\n", this);
+		return false;
+	}
+
+	for (const auto &dd : pc.diffs())
+	{
+		result.m_replace_A.push_back(dd.first);
+		result.m_replace_B.push_back(dd.first);
+		result.m_replace_len.push_back(dd.second);
+	}
+	if (length_ > common)
+	{
+		// Insertion in a == deletion from b
+		result.m_insert_A.push_back(common);
+		result.m_delete_B.push_back(common);
+		result.m_insert_len.push_back(length_ - common);    // to eof
+	}
+	else if (comp_len > common)
+	{
+		// Deletion from a == insertion in b
+		result.m_delete_A.push_back(common);
+		result.m_insert_B.push_back(common);
+		result.m_delete_len.push_back(comp_len - common);   // to EOF of compare file
+	}
+	result.Final();
+
+	TRACE("+++ BGCompare: finished parallel scan (%d threads) for %p\n", pc.threads(), this);
+	CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+	comp_[0] = result;
+	update_comp_all();
+	comp_fin_ = true;
+	comp_progress_ = length_;
+	return true;
+}
+
+// Does the compare for RunCompThread for self-compare by only comparing the blocks that changed
+// between the last two snapshots.  Returns false if this could not be done (so the compare is
+// done the normal way).
+bool CHexEditDoc::RunSnapshotCompare(CompResult &result, int min_match)
+{
+	ASSERT(snap_ != NULL);
+
+	// The latest snapshot is only what we are comparing if the file has not been modified
+	bool unmodified;
+	{
+		CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+		unmodified = loc_.size() == 1 && (loc_.front().dlen >> 62) == 1 && loc_.front().fileaddr == 0;
+	}
+	if (!unmodified)
+		return false;
+
+	// If detecting insertions/deletions then we need a full compare if anything may have been
+	// inserted or deleted.  The snapshot only knows which blocks changed, so assume an insertion
+	// or deletion if the length changed, if the changed blocks run to the end of the file (as
+	// everything after an insertion/deletion is moved), or if lots of blocks changed.
+	if (min_match > 0)
+	{
+		std::int64_t len = snap_->length(0);
+		if (len != snap_->length(1) || snap_->changed_bytes() > len / 8)
+			return false;
+		for (const snapshot_store::extent &ee : snap_->changed())
+			if (ee.start + ee.len >= len)
+				return false;
+	}
+
+	std::vector<snapshot_store::change> changes;
+	FILE_ADDRESS total = length_;
+	bool stopped = false;
+	bool ok = snap_->diff(changes, [this, total, &stopped](double done) -> bool
+	{
+		if (CompProcessStop())
+		{
+			stopped = true;
+			return false;
+		}
+		CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+		comp_progress_ = FILE_ADDRESS(done * total);
+		return true;
+	});
+	if (!ok)
+		return stopped;                     // if stopped go back to WAITING state, else (read error) do a full compare
+
+	// Addresses are the same in both versions since nothing was inserted (except at the end)
+	for (const snapshot_store::change &chg : changes)
+	{
+		switch (chg.kind)
+		{
+		case snapshot_store::KIND_REPLACE:
+			result.m_replace_A.push_back(chg.addr);
+			result.m_replace_B.push_back(chg.addr);
+			result.m_replace_len.push_back(chg.len);
+			break;
+		case snapshot_store::KIND_INSERT:   // file has grown
+			result.m_insert_A.push_back(chg.addr);
+			result.m_delete_B.push_back(chg.addr);
+			result.m_insert_len.push_back(chg.len);
+			break;
+		case snapshot_store::KIND_DELETE:   // file is shorter
+			result.m_delete_A.push_back(chg.addr);
+			result.m_insert_B.push_back(chg.addr);
+			result.m_delete_len.push_back(chg.len);
+			break;
+		}
+	}
+	result.Final();
+
+	TRACE("+++ BGCompare: finished snapshot compare (%d changes) for %p\n", int(changes.size()), this);
+	CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+	comp_[0] = result;
+	update_comp_all();
+	comp_fin_ = true;
+	comp_progress_ = length_;
+	return true;
+}
+
 // Check for a stop scanning (or kill) of the background thread
 bool CHexEditDoc::CompProcessStop()
 {
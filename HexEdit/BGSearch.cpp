@@ -776,6 +776,22 @@ UINT CHexEditDoc::RunSearchThread()
 			continue;
 		}
 
+		// Work out how much of a hole (zero bytes of a sparse file) can be skipped without reading.
+		// If the first byte of the search cannot match zero then a match can't start in the hole,
+		// else if any byte cannot then a match can't be completely in the hole.
+		FILE_ADDRESS hole_back = -1;    // How far back from end of hole to start searching (-1 = don't skip)
+		if (tt == 0 || tt == 1)
+		{
+			for (size_t ii = bb.length(); ii-- > 0; )
+			{
+				unsigned char pm = bb.pattern()[ii];
+				if (bb.mask() != NULL)
+					pm &= bb.mask()[ii];
+				if (pm != 0)
+					hole_back = ii == 0 ? 0 : bb.length() - 1;
+			}
+		}
+
 		buf_len = (size_t)std::min<FILE_ADDRESS>(file_len, 32768 + bb.length() - 1);
 		ASSERT(search_buf_ == NULL);
 		search_buf_ = new unsigned char[buf_len + 1];
@@ -882,6 +898,18 @@ UINT CHexEditDoc::RunSearchThread()
 					}
 					file_len = length_;   // file length may have changed
 
+					// Skip (most of) any hole without reading it
+					if (hole_back >= 0)
+					{
+						FILE_ADDRESS hole_end = std::min(HoleEnd(addr_buf), end) - hole_back;
+						if (hole_end > addr_buf)
+						{
+							addr_buf = hole_end;
+							find_done_ = double(addr_buf - start) / double(end - start);
+							continue;
+						}
+					}
+
 					// Get a buffer full (plus an extra char for wholeword test at end of buffer)
 					got = GetData(search_buf_, size_t(std::min<FILE_ADDRESS>(buf_len, end - addr_buf)) + 1, addr_buf, 2);
 					ASSERT(got == std::min<FILE_ADDRESS>(buf_len, end - addr_buf) || got == std::min<FILE_ADDRESS>(buf_len, end - addr_buf) + 1);
@@ -0,0 +1,449 @@
+// BGTemplate.cpp : template (data format) scan in background thread (part of CHexEditDoc)
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+#include "HexEdit.h"
+#include "HexEditDoc.h"
+#include "MainFrm.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+// Scanning a large file using a template can take a long time so the scan is done in a
+// background thread.  As each element is finished it is made available (see template_yield
+// and add_branch) and a CDFFDPartialHint is sent to the views (see CheckBGProcessing) so that
+// the user can look at the start of the tree while the rest is being built.
+
+// Starts a template scan in the background and returns TRUE if the scan was started.  The
+// caller can use TemplateScanning() to tell if the scan is in progress, in which case the
+// views are updated as elements become available and when it finishes (see CheckBGProcessing).
+// (The main thread does not wait here, even for small files, as that would stall it.)
+BOOL CHexEditDoc::ScanFileBG()
+{
+	if (ptree_ == NULL || ptree_->Error())
+		return ScanFile();              // just sets up the error message
+
+	// The template editing commands change the XML while the user edits it in a dialog
+	// so while editing we just scan in this thread (see CDataFormatView::OnGridRClick)
+	if (DffdEditMode())
+		return ScanFile();
+
+	// Templates that ask the user for values (getint etc) must be run in the main thread
+	CString ss = ptree_->DumpXML();
+	ss.MakeUpper();
+	if (ss.Find("GETINT") != -1 || ss.Find("GETSTRING") != -1 || ss.Find("GETBOOL") != -1)
+		return ScanFile();
+
+	if (pthread7_ == NULL)
+		CreateTemplateThread();
+	if (pthread7_ == NULL)
+		return ScanFile();              // fall back to scanning in this thread
+
+	df_init_ = TRUE;
+	StartTemplate();
+	return TRUE;
+}
+
+// Doc has changed - restart the scan if one is in progress
+void CHexEditDoc::TemplateChange()
+{
+	if (pthread7_ == NULL || !df_scanning_) return;
+
+	StartTemplate();
+	CDFFDHint dffdh;
+	UpdateAllViews(NULL, 0, &dffdh);    // Views now show an empty tree until elements are available
+}
+
+// Return how far our scan has progressed as a percentage (0 to 100).
+int CHexEditDoc::TemplateProgress()
+{
+	CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+	return template_progress_;
+}
+
+// Checks (in the main thread) if a bg scan has just finished.  If so it returns true after
+// reporting any problems to the user - the caller should then update the views.
+bool CHexEditDoc::template_done()
+{
+	if (!df_scanning_)
+		return false;
+
+	bool extra;
+	{
+		CSingleLock sl(&docdata_, TRUE);
+		if (!template_fin_)
+			return false;
+		extra = template_extra_;
+	}
+
+	df_scanning_ = false;
+	{
+		CSingleLock sl(&docdata_, TRUE);
+		dfp_index_.reset();             // df_index_ is now used (see FindDffdEltsIn)
+	}
+	((CMainFrame *)AfxGetMainWnd())->Progress(-1);
+	report_scan(extra);
+	save_template_cache(extra);
+	return true;
+}
+
+// Stops the current background template scan (if any).  It does not return
+// until the scan is aborted and the thread is waiting again.
+void CHexEditDoc::StopTemplate()
+{
+	df_scanning_ = false;
+	if (pthread7_ == NULL) return;
+
+	bool waiting;
+	docdata_.Lock();
+	template_command_ = STOP;
+	docdata_.Unlock();
+	SetThreadPriority(pthread7_->m_hThread, THREAD_PRIORITY_NORMAL);
+	for (int ii = 0; ii < 1000; ++ii)
+	{
+		// The thread only notices the STOP when it next yields (see template_yield)
+		docdata_.Lock();
+		waiting = template_state_ == WAITING;
+		docdata_.Unlock();
+		if (waiting)
+			break;
+		TRACE("+++ StopTemplate - thread not waiting (yet)\n");
+		Sleep(1);
+	}
+	SetThreadPriority(pthread7_->m_hThread, THREAD_PRIORITY_LOWEST);
+	ASSERT(waiting);
+}
+
+// Start a new background scan.
+void CHexEditDoc::StartTemplate()
+{
+	StopTemplate();
+
+	// The views are told about elements as they become available
+	{
+		CSingleLock sl(&df_lock_, TRUE);
+		clear_tree();
+	}
+	df_shown_ = 0;
+	df_scanning_ = true;
+	df_scan_start_ = clock();
+	update_needed_ = false;
+
+	// Setup up the info for the new scan
+	docdata_.Lock();
+	template_command_ = NONE;
+	template_fin_ = false;
+	template_extra_ = false;
+	template_progress_ = 0;
+	template_avail_ = 0;
+	dfp_index_.reset();
+	docdata_.Unlock();
+
+	TRACE("+++ Pulsing template event for %p\n", this);
+	start_template_event_.SetEvent();
+}
+
+// Kill background task and wait until it is dead
+void CHexEditDoc::KillTemplateThread()
+{
+	ASSERT(pthread7_ != NULL);
+	if (pthread7_ == NULL) return;
+
+	HANDLE hh = pthread7_->m_hThread;    // Save handle since it will be lost when thread is killed and object is destroyed
+	TRACE("+++ Killing template thread for %p\n", this);
+
+	// Signal thread to kill itself
+	docdata_.Lock();
+	template_command_ = DIE;
+	docdata_.Unlock();
+
+	SetThreadPriority(pthread7_->m_hThread, THREAD_PRIORITY_NORMAL); // Make it a quick and painless death
+	bool waiting, dying;
+	for (int ii = 0; ii < 1000; ++ii)
+	{
+		// Wait just a little bit in case the thread was just about to go into wait state
+		docdata_.Lock();
+		waiting = template_state_ == WAITING;
+		dying   = template_state_ == DYING;
+		docdata_.Unlock();
+		if (waiting || dying)
+			break;
+		Sleep(1);
+	}
+	ASSERT(waiting || dying);
+
+	// Send start message if it is on hold
+	if (waiting)
+		start_template_event_.SetEvent();
+
+	pthread7_ = NULL;
+	DWORD wait_status = ::WaitForSingleObject(hh, INFINITE);
+	ASSERT(wait_status == WAIT_OBJECT_0 || wait_status == WAIT_FAILED);
+	df_scanning_ = false;
+
+	// Free resources that are only needed during bg scan
+	if (pfile7_ != NULL)
+	{
+		pfile7_->Close();
+		delete pfile7_;
+		pfile7_ = NULL;
+	}
+	for (int ii = 0; ii < doc_loc::max_data_files; ++ii)
+	{
+		if (data_file7_[ii] != NULL)
+		{
+			data_file7_[ii]->Close();
+			delete data_file7_[ii];
+			data_file7_[ii] = NULL;
+		}
+	}
+}
+
+static UINT bg_func(LPVOID pParam)
+{
+	CHexEditDoc *pDoc = (CHexEditDoc *)pParam;
+
+	TRACE("+++ Template thread started for doc %p\n", pDoc);
+
+	return pDoc->RunTemplateThread();
+}
+
+void CHexEditDoc::CreateTemplateThread()
+{
+	ASSERT(pthread7_ == NULL);
+	ASSERT(pfile7_ == NULL);
+
+	// Open copy of file to be used by background thread
+	if (pfile1_ != NULL)
+	{
+		if (IsDevice())
+			pfile7_ = new CFileNC();
+		else
+			pfile7_ = new CFile64();
+		if (!pfile7_->Open(pfile1_->GetFilePath(),
+					CFile::modeRead|CFile::shareDenyNone|CFile::typeBinary) )
+		{
+			TRACE("+++ File7 open failed for %p\n", this);
+			delete pfile7_;
+			pfile7_ = NULL;
+			return;
+		}
+	}
+
+	// Open copy of any data files in use too
+	for (int ii = 0; ii < doc_loc::max_data_files; ++ii)
+	{
+		ASSERT(data_file7_[ii] == NULL);
+		if (data_file_[ii] != NULL)
+			data_file7_[ii] = new CFile64(data_file_[ii]->GetFilePath(),
+										  CFile::modeRead|CFile::shareDenyWrite|CFile::typeBinary);
+	}
+
+	// Create new thread
+	template_command_ = NONE;
+	template_state_ = STARTING;
+	template_fin_ = false;
+	template_progress_ = 0;
+	TRACE("+++ Creating template thread for %p\n", this);
+	pthread7_ = AfxBeginThread(&bg_func, this, THREAD_PRIORITY_LOWEST);
+	ASSERT(pthread7_ != NULL);
+}
+
+// This is the main loop for the worker thread
+UINT CHexEditDoc::RunTemplateThread()
+{
+	::CoInitializeEx(NULL, COINIT_MULTITHREADED);   // we access the (free-threaded) template DOM
+
+	// Keep looping until we get the kill signal
+	for (;;)
+	{
+		{
+			CSingleLock sl(&docdata_, TRUE);
+			template_state_ = WAITING;
+		}
+		DWORD wait_status = ::WaitForSingleObject(HANDLE(start_template_event_), INFINITE);
+		docdata_.Lock();
+		template_state_ = SCANNING;
+		docdata_.Unlock();
+		start_template_event_.ResetEvent();      // Force ourselves to wait
+		ASSERT(wait_status == WAIT_OBJECT_0);
+
+		if (TemplateProcessStop())
+			continue;
+
+		CHexExpr ee(this, 7);
+		try
+		{
+			template_lock();
+			dfp_type_.clear();
+			dfp_size_.clear();
+			dfp_address_.clear();
+			dfp_extra_.clear();
+			dfp_elt_.clear();
+			dfp_info_.clear();
+			dfp_indent_.clear();
+			dfp_enum_.clear();
+			dfp_max_indent_ = 1;
+			m_last_checked = clock();
+
+			bool extra = scan_template(ee);
+			df_lock_.Unlock();
+
+			CSingleLock sl(&docdata_, TRUE);
+			template_extra_ = extra;
+			template_fin_ = true;
+			template_progress_ = 100;
+			TRACE("+++ BGTemplate: finished scan for %p\n", this);
+		}
+		catch (enum BG_COMMAND)
+		{
+			// Scan was stopped (see template_lock)
+		}
+	}
+	return 0;  // never reached
+}
+
+bool CHexEditDoc::TemplateProcessStop()
+{
+	bool retval = false;
+
+	CSingleLock sl(&docdata_, TRUE);
+	switch (template_command_)
+	{
+	case STOP:                      // stop scan and wait
+		retval = true;
+		break;
+	case DIE:                       // terminate this thread
+		template_state_ = DYING;
+		sl.Unlock();                // we need this here as AfxEndThread() never returns so d'tor is not called
+		::CoUninitialize();
+		AfxEndThread(1);            // kills thread (no return)
+		break;                      // Avoid warning
+	case NONE:                      // nothing needed here - just continue scanning
+		break;
+	default:                        // should not happen
+		ASSERT(0);
+	}
+
+	template_command_ = NONE;
+	return retval;
+}
+
+// Locks df_lock_ (in the template thread).  Since the main thread may hold the lock while
+// it waits for the scan to stop (see StopTemplate) we keep checking if we have been told
+// to stop and if so throw STOP, which is caught in RunTemplateThread.  We also don't take
+// the lock while the main thread is waiting for it (see CTemplateLock).
+void CHexEditDoc::template_lock()
+{
+	for (;;)
+	{
+		// Note that we must not have the lock when checking as the thread may be killed
+		if (TemplateProcessStop())
+			throw STOP;
+		if (df_wanted_ == 0 && ::TryEnterCriticalSection(&df_lock_.m_sect))
+			break;
+		Sleep(1);
+	}
+}
+
+// Returns the index of the published elements (NULL if none) - see dfp_index_
+std::shared_ptr<const CHexEditDoc::index_parts_t> CHexEditDoc::published_index()
+{
+	CSingleLock sl(&docdata_, TRUE);
+	return dfp_index_;
+}
+
+// Adds the index of newly published elements to dfp_index_.  This is called in the template
+// thread (which is the only one that changes dfp_index_) without df_lock_ held, since merging
+// parts can take a while.  The new part is merged with the last parts until they are all at
+// least twice the size of the part after them.
+void CHexEditDoc::publish_index(std::shared_ptr<template_index> part)
+{
+	std::shared_ptr<index_parts_t> parts = dfp_index_ ? std::make_shared<index_parts_t>(*dfp_index_)
+	                                                  : std::make_shared<index_parts_t>();
+	while (!parts->empty() && parts->back()->size() < 2*part->size())
+	{
+		std::shared_ptr<template_index> merged = std::make_shared<template_index>(*parts->back());
+		merged->add(*part);
+		merged->build();
+		part = merged;
+		parts->pop_back();
+	}
+	parts->push_back(part);
+
+	CSingleLock sl(&docdata_, TRUE);
+	dfp_index_ = parts;
+}
+
+// Called regularly (in the template thread) while the tree is being built.  The first
+// avail elements are complete so they are published (copied to dfp_address_ etc) and then
+// the main thread is given a chance to look at them before we continue the scan.  This is
+// done every 50 msecs or as soon as the main thread is waiting for df_lock_.
+void CHexEditDoc::template_yield(size_t avail, FILE_ADDRESS addr)
+{
+	if (df_wanted_ == 0 && clock() - m_last_checked < CLOCKS_PER_SEC/20)
+		return;
+
+	// Publish any newly completed elements
+	std::shared_ptr<template_index> part;
+	if (avail > dfp_address_.size())
+	{
+		part = std::make_shared<template_index>();
+		add_to_index(*part, dfp_address_.size(), avail, true);
+		part->build();
+	}
+	for (size_t ii = dfp_address_.size(); ii < avail; ++ii)
+	{
+		dfp_type_.push_back(df_type_[ii]);
+		dfp_size_.push_back(df_size_[ii]);
+		dfp_address_.push_back(df_address_[ii]);
+		dfp_extra_.push_back(df_extra_[ii]);
+		dfp_elt_.push_back(df_elt_[ii]);
+		dfp_info_.push_back(df_info_[ii]);
+		dfp_indent_.push_back(df_indent_[ii]);
+	}
+	dfp_enum_.insert(df_enum_.begin(), df_enum_.end());
+	dfp_max_indent_ = max_indent_;
+
+	{
+		CSingleLock sl(&docdata_, TRUE);
+		template_avail_ = dfp_address_.size();
+		if (length_ > 0 && addr >= 0 && !in_jump_)
+			template_progress_ = addr < length_ ? int((addr*100)/length_) : 100;
+	}
+
+	// Let other threads at the published elements
+	template_swap();
+	df_lock_.Unlock();
+	if (part && !part->empty())
+		publish_index(part);
+	if (df_wanted_ == 0)
+		Sleep(1);                   // else template_lock waits until the main thread is done
+	template_lock();        // Note that if this throws the vectors are left swapped but that's OK as the scan is restarted
+	template_swap();
+
+	m_last_checked = clock();
+}
+
+// Swap the elements of the tree being built with those published (see template_yield)
+void CHexEditDoc::template_swap()
+{
+	df_type_.swap(dfp_type_);
+	df_size_.swap(dfp_size_);
+	df_address_.swap(dfp_address_);
+	df_extra_.swap(dfp_extra_);
+	df_elt_.swap(dfp_elt_);
+	df_info_.swap(dfp_info_);
+	df_indent_.swap(dfp_indent_);
+	df_enum_.swap(dfp_enum_);
+	std::swap(max_indent_, dfp_max_indent_);
+}
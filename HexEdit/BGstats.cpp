@@ -466,7 +466,27 @@ UINT CHexEditDoc::RunStatsThread()
 
 			size_t got;
 
-			if ((got = GetData(stats_buf_, buf_size, addr, 5)) <= 0)
+			// Holes in a sparse file are all zero bytes so are not read, and if there
+			// are no digests to calculate the whole hole is just added to the count of 0
+			FILE_ADDRESS hole_len = HoleEnd(addr) - addr;
+			if (hole_len > 0 && !do_crc32 && !do_md5 && !do_sha1 && !do_sha256 && !do_sha512)
+			{
+				if (c32_ != NULL)
+					c32_[0] += long(hole_len);
+				else
+					c64_[0] += hole_len;
+				addr += hole_len;
+				CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+				stats_progress_ = int((addr * 100)/file_len);
+				continue;
+			}
+
+			if (hole_len > 0)
+			{
+				got = size_t(std::min(FILE_ADDRESS(buf_size), hole_len));
+				memset(stats_buf_, '\0', got);
+			}
+			else if ((got = GetData(stats_buf_, buf_size, addr, 5)) <= 0)
 			{
 				// We reached the end of the file at last - save results and go back to wait state
 				CSingleLock sl(&docdata_, TRUE); // Protect shared data access
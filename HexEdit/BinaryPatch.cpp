@@ -0,0 +1,540 @@
+// BinaryPatch.cpp : implementation of the binary_patch class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include <zlib.h>
+
+#include "BinaryPatch.h"
+#include "AnchoredDiff.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+static const std::size_t buf_size = 1024*1024;  // buffer size for reading/writing files
+static const char magic[4] = { 'H', 'X', 'D', 'P' };
+
+// Reads len bytes (or up to EOF) returning the number of bytes read
+static std::size_t read_all(const binary_patch::reader_t &read, unsigned char *buf, std::size_t len, std::int64_t addr)
+{
+	std::size_t got = 0;
+	while (got < len)
+	{
+		std::size_t nn = read(buf + got, len - got, addr + got);
+		if (nn == 0 || nn > len - got)
+			break;              // EOF or error
+		got += nn;
+	}
+	return got;
+}
+
+static inline std::uint64_t zigzag(std::int64_t vv)
+{
+	return (std::uint64_t(vv) << 1) ^ std::uint64_t(vv >> 63);
+}
+
+static inline std::int64_t unzigzag(std::uint64_t vv)
+{
+	return std::int64_t(vv >> 1) ^ -std::int64_t(vv & 1);
+}
+
+// Stores vv as an unsigned LEB128 varint returning the number of bytes used (max 10)
+static std::size_t encode_varint(unsigned char *pp, std::uint64_t vv)
+{
+	std::size_t len = 0;
+	while (vv >= 0x80)
+	{
+		pp[len++] = static_cast<unsigned char>(vv | 0x80);
+		vv >>= 7;
+	}
+	pp[len++] = static_cast<unsigned char>(vv);
+	return len;
+}
+
+// Reads an unsigned LEB128 varint from a stream
+static bool read_varint(std::istream &is, std::uint64_t &vv)
+{
+	vv = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		int cc = is.get();
+		if (cc == EOF)
+			return false;
+		vv |= std::uint64_t(cc & 0x7F) << shift;
+		if ((cc & 0x80) == 0)
+			return true;
+	}
+	return false;               // too long
+}
+
+static void encode_crc(unsigned char *pp, std::uint32_t crc)
+{
+	for (int ii = 0; ii < 4; ++ii)
+		pp[ii] = static_cast<unsigned char>(crc >> (8*ii));
+}
+
+static std::uint32_t decode_crc(const unsigned char *pp)
+{
+	return std::uint32_t(pp[0]) | std::uint32_t(pp[1]) << 8 | std::uint32_t(pp[2]) << 16 | std::uint32_t(pp[3]) << 24;
+}
+
+// CRC-32 of a whole file
+static binary_patch::status_t file_crc(const binary_patch::reader_t &read, std::int64_t len, std::uint32_t &crc,
+                                       const binary_patch::progress_t &progress)
+{
+	std::vector<unsigned char> buf(buf_size);
+	crc = crc32(0L, Z_NULL, 0);
+	for (std::int64_t addr = 0; addr < len; )
+	{
+		std::size_t nn = std::size_t(std::min<std::int64_t>(buf_size, len - addr));
+		if (read_all(read, &buf[0], nn, addr) != nn)
+			return binary_patch::STATUS_READ_ERROR;
+		crc = crc32(crc, &buf[0], uInt(nn));
+		addr += nn;
+		if (progress && !progress(double(addr)/double(len)))
+			return binary_patch::STATUS_ABORTED;
+	}
+	return binary_patch::STATUS_OK;
+}
+
+// Writes the ops of a delta, compressing them if required
+class delta_writer
+{
+public:
+	delta_writer(std::ostream &os, bool compress) : os_(os), compress_(compress), used_(0), buf_(buf_size)
+	{
+		if (compress_)
+		{
+			zs_.zalloc = Z_NULL;
+			zs_.zfree = Z_NULL;
+			zs_.opaque = Z_NULL;
+			if (deflateInit(&zs_, Z_DEFAULT_COMPRESSION) != Z_OK)
+				os_.setstate(std::ios::badbit);
+			zbuf_.resize(buf_size);
+		}
+	}
+	~delta_writer()
+	{
+		if (compress_)
+			deflateEnd(&zs_);
+	}
+
+	bool put(const unsigned char *pp, std::size_t len)
+	{
+		while (len > 0)
+		{
+			std::size_t nn = std::min(len, buf_.size() - used_);
+			std::copy(pp, pp + nn, &buf_[used_]);
+			used_ += nn;
+			pp += nn;
+			len -= nn;
+			if (used_ == buf_.size() && !flush(Z_NO_FLUSH))
+				return false;
+		}
+		return true;
+	}
+	bool put_byte(unsigned char cc) { return put(&cc, 1); }
+	bool put_varint(std::uint64_t vv)
+	{
+		unsigned char tmp[10];
+		return put(tmp, encode_varint(tmp, vv));
+	}
+	bool finish() { return flush(Z_FINISH) && os_.flush().good(); }
+
+private:
+	std::ostream &os_;
+	bool compress_;
+	std::size_t used_;                      // bytes of buf_ not yet written
+	std::vector<unsigned char> buf_, zbuf_;
+	z_stream zs_;
+
+	bool flush(int zflush)
+	{
+		if (!compress_)
+			os_.write(reinterpret_cast<const char *>(&buf_[0]), std::streamsize(used_));
+		else
+		{
+			zs_.next_in = &buf_[0];
+			zs_.avail_in = uInt(used_);
+			for (;;)
+			{
+				zs_.next_out = &zbuf_[0];
+				zs_.avail_out = uInt(zbuf_.size());
+				int ret = deflate(&zs_, zflush);
+				if (ret == Z_STREAM_ERROR)
+					return false;
+				os_.write(reinterpret_cast<const char *>(&zbuf_[0]), std::streamsize(zbuf_.size() - zs_.avail_out));
+				if (zflush == Z_FINISH ? ret == Z_STREAM_END : zs_.avail_out != 0)
+					break;
+			}
+		}
+		used_ = 0;
+		return os_.good();
+	}
+};
+
+// Reads the ops of a delta, decompressing them if required
+class delta_reader
+{
+public:
+	delta_reader(std::istream &is, bool compressed) : is_(is), compressed_(compressed), ok_(true), zend_(false), pos_(0), end_(0), buf_(buf_size)
+	{
+		if (compressed_)
+		{
+			zs_.zalloc = Z_NULL;
+			zs_.zfree = Z_NULL;
+			zs_.opaque = Z_NULL;
+			zs_.next_in = Z_NULL;
+			zs_.avail_in = 0;
+			ok_ = inflateInit(&zs_) == Z_OK;
+			zbuf_.resize(buf_size);
+		}
+	}
+	~delta_reader()
+	{
+		if (compressed_)
+			inflateEnd(&zs_);
+	}
+
+	// Returns false if there are not len bytes left
+	bool get(unsigned char *pp, std::size_t len)
+	{
+		while (len > 0)
+		{
+			if (pos_ == end_ && !fill())
+				return false;
+			std::size_t nn = std::min(len, end_ - pos_);
+			std::copy(&buf_[pos_], &buf_[pos_] + nn, pp);
+			pos_ += nn;
+			pp += nn;
+			len -= nn;
+		}
+		return true;
+	}
+	bool get_varint(std::uint64_t &vv)
+	{
+		vv = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			unsigned char cc;
+			if (!get(&cc, 1))
+				return false;
+			vv |= std::uint64_t(cc & 0x7F) << shift;
+			if ((cc & 0x80) == 0)
+				return true;
+		}
+		return false;           // too long
+	}
+
+private:
+	std::istream &is_;
+	bool compressed_;
+	bool ok_;                   // false after a read or decompression error
+	bool zend_;                 // got to the end of the compressed data
+	std::size_t pos_, end_;     // bytes of buf_ used and available
+	std::vector<unsigned char> buf_, zbuf_;
+	z_stream zs_;
+
+	bool fill()
+	{
+		pos_ = end_ = 0;
+		if (!ok_)
+			return false;
+		if (!compressed_)
+		{
+			is_.read(reinterpret_cast<char *>(&buf_[0]), std::streamsize(buf_.size()));
+			end_ = std::size_t(is_.gcount());
+			return end_ > 0;
+		}
+
+		while (!zend_)
+		{
+			if (zs_.avail_in == 0)
+			{
+				is_.read(reinterpret_cast<char *>(&zbuf_[0]), std::streamsize(zbuf_.size()));
+				zs_.next_in = &zbuf_[0];
+				zs_.avail_in = uInt(is_.gcount());
+				if (zs_.avail_in == 0)
+					break;      // truncated
+			}
+			zs_.next_out = &buf_[0];
+			zs_.avail_out = uInt(buf_.size());
+			int ret = inflate(&zs_, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END)
+				zend_ = true;
+			else if (ret != Z_OK && ret != Z_BUF_ERROR)
+				break;          // corrupt
+			end_ = buf_.size() - zs_.avail_out;
+			if (end_ > 0)
+				return true;
+		}
+		ok_ = false;
+		return false;
+	}
+};
+
+const char *binary_patch::message(status_t status)
+{
+	switch (status)
+	{
+	case STATUS_OK:
+		return "OK";
+	case STATUS_ABORTED:
+		return "Aborted";
+	case STATUS_READ_ERROR:
+		return "Error reading file";
+	case STATUS_WRITE_ERROR:
+		return "Error writing file";
+	case STATUS_BAD_DELTA:
+		return "Delta file is corrupt or not a delta file";
+	case STATUS_WRONG_SOURCE:
+		return "Delta file was not made from this file";
+	case STATUS_BAD_RESULT:
+		return "Patched file does not match the original (CRC error)";
+	}
+	return "Unknown error";
+}
+
+binary_patch::status_t binary_patch::make(reader_t read_old, std::int64_t len_old, reader_t read_new, std::int64_t len_new,
+                                          std::ostream &delta, bool compress, progress_t progress /*=progress_t()*/)
+{
+	// Progress of each stage is scaled to part of the whole
+	auto stage = [&](double from, double to) -> progress_t
+	{
+		if (!progress)
+			return progress_t();
+		return [=](double done) { return progress(from + done*(to - from)); };
+	};
+
+	// The CRC of the old file goes in the header so apply() can check it before doing anything
+	std::uint32_t crc_old;
+	status_t status = file_crc(read_old, len_old, crc_old, stage(0.0, 0.1));
+	if (status != STATUS_OK)
+		return status;
+
+	// Find what is the same - A is the new file (so inserted bytes are those only in the new file)
+	anchored_diff ad(read_new, len_new, read_old, len_old);
+	if (!ad.run(stage(0.1, 0.8)))
+		return STATUS_ABORTED;
+
+	unsigned char hdr[4 + 2 + 10 + 10 + 4];
+	std::size_t hlen = 0;
+	std::copy(magic, magic + 4, hdr);
+	hlen += 4;
+	hdr[hlen++] = VERSION;
+	hdr[hlen++] = compress ? FLAG_COMPRESSED : 0;
+	hlen += encode_varint(hdr + hlen, std::uint64_t(len_old));
+	hlen += encode_varint(hdr + hlen, std::uint64_t(len_new));
+	encode_crc(hdr + hlen, crc_old);
+	hlen += 4;
+	delta.write(reinterpret_cast<const char *>(hdr), std::streamsize(hlen));
+	if (!delta)
+		return STATUS_WRITE_ERROR;
+
+	// The new file is read once from start to end to get its CRC and the inserted bytes
+	delta_writer dw(delta, compress);
+	std::vector<unsigned char> buf(buf_size);
+	std::uint32_t crc_new = crc32(0L, Z_NULL, 0);
+	progress_t emit_progress = stage(0.8, 1.0);
+	std::int64_t done = 0;          // bytes of the new file processed
+	std::int64_t copy_end = 0;      // end (in the old file) of the last copy
+	std::int64_t next_progress = buf_size;
+
+	// Processes the next len bytes of the new file, adding them to the delta if insert is true
+	auto next_bytes = [&](std::int64_t len, bool insert) -> status_t
+	{
+		if (insert && len > 0 && (!dw.put_byte(OP_INSERT) || !dw.put_varint(std::uint64_t(len))))
+			return STATUS_WRITE_ERROR;
+		while (len > 0)
+		{
+			std::size_t nn = std::size_t(std::min<std::int64_t>(buf_size, len));
+			if (read_all(read_new, &buf[0], nn, done) != nn)
+				return STATUS_READ_ERROR;
+			crc_new = crc32(crc_new, &buf[0], uInt(nn));
+			if (insert && !dw.put(&buf[0], nn))
+				return STATUS_WRITE_ERROR;
+			done += nn;
+			len -= nn;
+			if (emit_progress && done >= next_progress)
+			{
+				if (!emit_progress(double(done)/double(len_new)))
+					return STATUS_ABORTED;
+				next_progress = done + buf_size;
+			}
+		}
+		return STATUS_OK;
+	};
+
+	// Bytes between the differences are copied from the old file, unless there are so few
+	// that it's shorter to just insert them
+	auto same = [&](std::int64_t a, std::int64_t b, std::int64_t len) -> status_t
+	{
+		if (len < MIN_COPY)
+			return STATUS_OK;   // left for the next insert
+
+		status_t ss = next_bytes(a - done, true);
+		if (ss != STATUS_OK)
+			return ss;
+		if (!dw.put_byte(OP_COPY) || !dw.put_varint(zigzag(b - copy_end)) || !dw.put_varint(std::uint64_t(len)))
+			return STATUS_WRITE_ERROR;
+		copy_end = b + len;
+		return next_bytes(len, false);
+	};
+
+	std::int64_t pa = 0, pb = 0;    // end of the previous difference in each file
+	for (const anchored_diff::block &bb : ad.blocks())
+	{
+		if ((status = same(pa, pb, std::min(bb.a - pa, bb.b - pb))) != STATUS_OK)
+			return status;
+		pa = bb.a + (bb.kind == anchored_diff::KIND_DELETE ? 0 : bb.len);
+		pb = bb.b + (bb.kind == anchored_diff::KIND_INSERT ? 0 : bb.len);
+	}
+	if ((status = same(pa, pb, std::min(len_new - pa, len_old - pb))) != STATUS_OK ||
+		(status = next_bytes(len_new - done, true)) != STATUS_OK)
+	{
+		return status;
+	}
+
+	unsigned char crc_buf[4];
+	encode_crc(crc_buf, crc_new);
+	if (!dw.put_byte(OP_END) || !dw.put(crc_buf, 4) || !dw.finish())
+		return STATUS_WRITE_ERROR;
+	return STATUS_OK;
+}
+
+binary_patch::status_t binary_patch::read_header(std::istream &delta, header &hdr)
+{
+	char mm[4];
+	if (!delta.read(mm, 4) || !std::equal(mm, mm + 4, magic))
+		return STATUS_BAD_DELTA;
+
+	int cc;
+	if ((hdr.version = delta.get()) != VERSION || (cc = delta.get()) == EOF || (cc & ~FLAG_COMPRESSED) != 0)
+		return STATUS_BAD_DELTA;
+	hdr.flags = unsigned(cc);
+
+	std::uint64_t len_old, len_new;
+	if (!read_varint(delta, len_old) || !read_varint(delta, len_new) ||
+		len_old > std::uint64_t(INT64_MAX) || len_new > std::uint64_t(INT64_MAX))
+	{
+		return STATUS_BAD_DELTA;
+	}
+	hdr.len_old = std::int64_t(len_old);
+	hdr.len_new = std::int64_t(len_new);
+
+	unsigned char crc_buf[4];
+	if (!delta.read(reinterpret_cast<char *>(crc_buf), 4))
+		return STATUS_BAD_DELTA;
+	hdr.crc_old = decode_crc(crc_buf);
+	return STATUS_OK;
+}
+
+binary_patch::status_t binary_patch::apply(reader_t read_old, std::int64_t len_old, std::istream &delta,
+                                           std::ostream &out, progress_t progress /*=progress_t()*/)
+{
+	header hdr;
+	status_t status = read_header(delta, hdr);
+	if (status != STATUS_OK)
+		return status;
+
+	// Check that we have the right file before writing anything
+	std::uint32_t crc_old;
+	if (hdr.len_old != len_old)
+		return STATUS_WRONG_SOURCE;
+	progress_t crc_progress;
+	if (progress)
+		crc_progress = [&](double done) { return progress(0.2*done); };
+	if ((status = file_crc(read_old, len_old, crc_old, crc_progress)) != STATUS_OK)
+		return status;
+	if (crc_old != hdr.crc_old)
+		return STATUS_WRONG_SOURCE;
+
+	delta_reader dr(delta, (hdr.flags & FLAG_COMPRESSED) != 0);
+	std::vector<unsigned char> buf(buf_size);
+	std::uint32_t crc_new = crc32(0L, Z_NULL, 0);
+	std::int64_t done = 0;          // bytes of the new file written
+	std::int64_t copy_end = 0;      // end (in the old file) of the last copy
+	std::int64_t next_progress = buf_size;
+
+	auto write_out = [&](std::size_t nn) -> status_t
+	{
+		crc_new = crc32(crc_new, &buf[0], uInt(nn));
+		if (!out.write(reinterpret_cast<const char *>(&buf[0]), std::streamsize(nn)))
+			return STATUS_WRITE_ERROR;
+		done += nn;
+		if (progress && done >= next_progress)
+		{
+			if (!progress(0.2 + 0.8*double(done)/double(hdr.len_new)))
+				return STATUS_ABORTED;
+			next_progress = done + buf_size;
+		}
+		return STATUS_OK;
+	};
+
+	for (;;)
+	{
+		unsigned char op;
+		std::uint64_t vv, len;
+		if (!dr.get(&op, 1))
+			return STATUS_BAD_DELTA;
+		if (op == OP_END)
+			break;
+		else if (op == OP_COPY)
+		{
+			if (!dr.get_varint(vv) || !dr.get_varint(len))
+				return STATUS_BAD_DELTA;
+			std::int64_t from = copy_end + unzigzag(vv);
+			if (from < 0 || from > len_old || len > std::uint64_t(len_old - from) || len > std::uint64_t(hdr.len_new - done))
+				return STATUS_BAD_DELTA;
+			copy_end = from + std::int64_t(len);
+
+			while (len > 0)
+			{
+				std::size_t nn = std::size_t(std::min<std::uint64_t>(buf_size, len));
+				if (read_all(read_old, &buf[0], nn, from) != nn)
+					return STATUS_READ_ERROR;
+				if ((status = write_out(nn)) != STATUS_OK)
+					return status;
+				from += nn;
+				len -= nn;
+			}
+		}
+		else if (op == OP_INSERT)
+		{
+			if (!dr.get_varint(len) || len > std::uint64_t(hdr.len_new - done))
+				return STATUS_BAD_DELTA;
+			while (len > 0)
+			{
+				std::size_t nn = std::size_t(std::min<std::uint64_t>(buf_size, len));
+				if (!dr.get(&buf[0], nn))
+					return STATUS_BAD_DELTA;
+				if ((status = write_out(nn)) != STATUS_OK)
+					return status;
+				len -= nn;
+			}
+		}
+		else
+			return STATUS_BAD_DELTA;
+	}
+
+	unsigned char crc_buf[4];
+	if (!dr.get(crc_buf, 4) || done != hdr.len_new)
+		return STATUS_BAD_DELTA;
+	if (decode_crc(crc_buf) != crc_new)
+		return STATUS_BAD_RESULT;
+	return out.flush() ? STATUS_OK : STATUS_WRITE_ERROR;
+}
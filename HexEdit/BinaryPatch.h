@@ -0,0 +1,80 @@
+// BinaryPatch.h : make and apply compact binary delta (patch) files
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+
+// Makes a delta that turns an old file into a new file, using anchored_diff to find what
+// is the same, and applies it.  Neither uses MFC so they can be used from HexPatch (the
+// command line tool) as well as HexEdit.
+//
+// The delta starts with a header (not compressed):
+//   "HXDP"   magic
+//   byte     format version (1)
+//   byte     flags (FLAG_COMPRESSED if the rest of the delta is zlib compressed)
+//   varint   length of the old file
+//   varint   length of the new file
+//   4 bytes  CRC-32 of the old file (little-endian)
+// followed by the ops (varints are unsigned LEB128):
+//   OP_COPY   varint offset, varint len - copy len bytes from the old file.  The offset is
+//             relative to the end of the previous copy (zigzag encoded as it may be -ve).
+//   OP_INSERT varint len, len bytes   - bytes of the new file not found in the old one
+//   OP_END    4 bytes CRC-32 of the new file
+//
+// Both are done with streaming I/O so memory use does not depend on the file sizes.  The
+// old and new files are read using reader functions (as for anchored_diff) since making a
+// delta compares them in any order, and applying it copies from anywhere in the old file.
+class binary_patch
+{
+public:
+	typedef std::function<std::size_t(unsigned char *buf, std::size_t len, std::int64_t addr)> reader_t;
+	typedef std::function<bool(double done)> progress_t;   // done is 0 to 1; return false to abort
+
+	enum { VERSION = 1 };
+	enum { FLAG_COMPRESSED = 1 };
+	enum { OP_END, OP_COPY, OP_INSERT };
+	enum { MIN_COPY = 16 };     // shorter runs of equal bytes are inserted (smaller than a copy op)
+
+	enum status_t
+	{
+		STATUS_OK,
+		STATUS_ABORTED,
+		STATUS_READ_ERROR,      // error reading the old or new file
+		STATUS_WRITE_ERROR,     // error writing the delta or the new file
+		STATUS_BAD_DELTA,       // delta is corrupt, truncated or not a delta
+		STATUS_WRONG_SOURCE,    // old file is not the one the delta was made from
+		STATUS_BAD_RESULT,      // CRC of the new file does not match
+	};
+	static const char *message(status_t status);
+
+	struct header
+	{
+		int version;
+		unsigned flags;
+		std::int64_t len_old, len_new;
+		std::uint32_t crc_old;
+	};
+
+	// Writes a delta (to a binary stream) that turns the old file into the new one
+	static status_t make(reader_t read_old, std::int64_t len_old, reader_t read_new, std::int64_t len_new,
+	                     std::ostream &delta, bool compress, progress_t progress = progress_t());
+
+	// Writes the new file to a binary stream given the old file and a delta made by make()
+	static status_t apply(reader_t read_old, std::int64_t len_old, std::istream &delta,
+	                      std::ostream &out, progress_t progress = progress_t());
+
+	// Reads just the header of a delta
+	static status_t read_header(std::istream &delta, header &hdr);
+};
@@ -0,0 +1,445 @@
+// BlockStorage.cpp : Win32 and POSIX implementations of block_storage
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>           // BLKGETSIZE64, BLKSSZGET
+#endif
+#endif
+
+#include "BlockStorage.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+bool storage_device::start(request *req)
+{
+	ASSERT(done_ == NULL);
+	std::size_t got = storage_->read(req->addr, req->buf, req->len);
+	if (got == req->len)
+		req->status = 0;
+	else if ((req->status = storage_->last_error()) == 0)
+		req->status = std::uint32_t(-1);    // EOF
+	done_ = req;
+	return true;
+}
+
+sector_device::request *storage_device::wait()
+{
+	request *retval = done_;
+	done_ = NULL;
+	return retval;
+}
+
+#ifdef _WIN32
+
+///////////////////////////////////////////////////////////////////////////
+// Win32
+
+class win32_storage : public block_storage
+{
+public:
+	win32_storage(HANDLE hh, bool device, std::size_t sector_size, bool owned = true)
+		: handle_(hh), device_(device), sector_size_(sector_size), owned_(owned) { }
+	virtual ~win32_storage() { if (owned_) ::CloseHandle(handle_); }
+
+	virtual std::int64_t length() const
+	{
+		if (device_)
+		{
+			GET_LENGTH_INFORMATION gli;
+			DWORD junk;
+			if (!::DeviceIoControl(handle_, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0, &gli, sizeof(gli), &junk, NULL))
+				return 0;
+			return gli.Length.QuadPart;
+		}
+		LARGE_INTEGER len;
+		if (!::GetFileSizeEx(handle_, &len))
+			return 0;
+		return len.QuadPart;
+	}
+	virtual std::size_t sector_size() const { return sector_size_; }
+	virtual bool is_device() const { return device_; }
+
+	virtual std::size_t read(std::int64_t addr, void *buf, std::size_t len)
+	{
+		error_ = 0;
+		std::size_t done = 0;
+		while (done < len)
+		{
+			// The offset in an OVERLAPPED makes a positional read even for a synchronous handle
+			OVERLAPPED ov;
+			memset(&ov, '\0', sizeof(ov));
+			ov.Offset = DWORD(addr + done);
+			ov.OffsetHigh = DWORD((addr + done) >> 32);
+			DWORD got;
+			DWORD toread = DWORD(std::min<std::size_t>(len - done, 0x40000000));
+			if (!::ReadFile(handle_, (char *)buf + done, toread, &got, &ov))
+			{
+				error_ = ::GetLastError();
+				if (error_ == ERROR_HANDLE_EOF)
+					error_ = 0;
+				break;
+			}
+			if (got == 0)
+				break;
+			done += got;
+		}
+		return done;
+	}
+
+	virtual std::size_t write(std::int64_t addr, const void *buf, std::size_t len)
+	{
+		error_ = 0;
+		std::size_t done = 0;
+		while (done < len)
+		{
+			OVERLAPPED ov;
+			memset(&ov, '\0', sizeof(ov));
+			ov.Offset = DWORD(addr + done);
+			ov.OffsetHigh = DWORD((addr + done) >> 32);
+			DWORD written;
+			DWORD towrite = DWORD(std::min<std::size_t>(len - done, 0x40000000));
+			if (!::WriteFile(handle_, (const char *)buf + done, towrite, &written, &ov) || written == 0)
+			{
+				error_ = ::GetLastError();
+				break;
+			}
+			done += written;
+		}
+		return done;
+	}
+
+	virtual bool set_length(std::int64_t len)
+	{
+		error_ = 0;
+		LARGE_INTEGER pos;
+		pos.QuadPart = len;
+		if (!::SetFilePointerEx(handle_, pos, NULL, FILE_BEGIN) || !::SetEndOfFile(handle_))
+		{
+			error_ = ::GetLastError();
+			return false;
+		}
+		return true;
+	}
+
+	virtual bool flush()
+	{
+		error_ = 0;
+		if (!::FlushFileBuffers(handle_))
+		{
+			error_ = ::GetLastError();
+			return false;
+		}
+		return true;
+	}
+
+	virtual bool allocated_ranges(std::int64_t start, std::int64_t end, ranges_t &ranges) const
+	{
+		ranges.clear();
+		BY_HANDLE_FILE_INFORMATION info;
+		if (device_ || !::GetFileInformationByHandle(handle_, &info) ||
+			(info.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) == 0)
+		{
+			return false;
+		}
+
+		FILE_ALLOCATED_RANGE_BUFFER query;
+		FILE_ALLOCATED_RANGE_BUFFER result[64];
+		query.FileOffset.QuadPart = start;
+		query.Length.QuadPart = end - start;
+		while (query.Length.QuadPart > 0)
+		{
+			DWORD returned = 0;
+			BOOL ok = ::DeviceIoControl(handle_, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query),
+			                            result, sizeof(result), &returned, NULL);
+			if (!ok && ::GetLastError() != ERROR_MORE_DATA)
+			{
+				ranges.clear();
+				return false;
+			}
+			DWORD count = returned / sizeof(result[0]);
+			for (DWORD ii = 0; ii < count; ++ii)
+				ranges.push_back(std::make_pair(result[ii].FileOffset.QuadPart,
+				                                result[ii].FileOffset.QuadPart + result[ii].Length.QuadPart));
+			if (ok || count == 0)
+				break;
+			query.FileOffset.QuadPart = ranges.back().second;
+			query.Length.QuadPart = end - ranges.back().second;
+		}
+		return true;
+	}
+
+	// Windows only takes access hints when the file is opened (FILE_FLAG_SEQUENTIAL_SCAN etc)
+	virtual void advise(std::int64_t, std::int64_t, access_t) { }
+
+private:
+	HANDLE handle_;
+	bool device_;
+	std::size_t sector_size_;
+	bool owned_;                    // close the handle when done?
+};
+
+block_storage *block_storage::attach(HANDLE hh, bool device, std::size_t sector_size)
+{
+	return new win32_storage(hh, device, sector_size, false);
+}
+
+block_storage *block_storage::open(const std::string &name, int flags /*=OPEN_READ*/, std::uint32_t *error /*=NULL*/)
+{
+	// Volumes (\\.\C:) and physical drives (\\.\PhysicalDrive0) are devices
+	bool device = name.compare(0, 4, "\\\\.\\") == 0;
+	DWORD attr = 0;
+	if ((flags & OPEN_DIRECT) != 0 || device)
+		attr |= FILE_FLAG_NO_BUFFERING;
+	if ((flags & OPEN_SEQUENTIAL) != 0)
+		attr |= FILE_FLAG_SEQUENTIAL_SCAN;
+	DWORD access = (flags & OPEN_WRITE) != 0 ? GENERIC_READ|GENERIC_WRITE : GENERIC_READ;
+
+	HANDLE hh = ::CreateFile(name.c_str(), access, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_EXISTING, attr, NULL);
+	if (hh == INVALID_HANDLE_VALUE)
+	{
+		if (error != NULL)
+			*error = ::GetLastError();
+		return NULL;
+	}
+
+	std::size_t sector_size = 1;
+	if (device)
+	{
+		DISK_GEOMETRY dg;
+		DWORD junk;
+		if (::DeviceIoControl(hh, IOCTL_DISK_GET_DRIVE_GEOMETRY, NULL, 0, &dg, sizeof(dg), &junk, NULL))
+			sector_size = dg.BytesPerSector;
+		else
+			sector_size = 4096;     // safe for all current drives
+	}
+	else if ((attr & FILE_FLAG_NO_BUFFERING) != 0)
+	{
+		// Non-cached files need the sector size of the volume they are on
+		char full[MAX_PATH];
+		DWORD sec_per_clus, bytes_per_sec, free_clus, total_clus;
+		if (::GetFullPathName(name.c_str(), MAX_PATH, full, NULL) > 2 && full[1] == ':')
+		{
+			char root[4] = "?:\\";
+			root[0] = full[0];
+			if (::GetDiskFreeSpace(root, &sec_per_clus, &bytes_per_sec, &free_clus, &total_clus))
+				sector_size = bytes_per_sec;
+			else
+				sector_size = 4096;
+		}
+		else
+			sector_size = 4096;
+	}
+	return new win32_storage(hh, device, sector_size);
+}
+
+#else // _WIN32
+
+///////////////////////////////////////////////////////////////////////////
+// POSIX
+
+class posix_storage : public block_storage
+{
+public:
+	posix_storage(int fd, bool device, std::size_t sector_size)
+		: fd_(fd), device_(device), sector_size_(sector_size) { }
+	virtual ~posix_storage() { ::close(fd_); }
+
+	virtual std::int64_t length() const
+	{
+#ifdef BLKGETSIZE64
+		if (device_)
+		{
+			std::uint64_t len;
+			if (::ioctl(fd_, BLKGETSIZE64, &len) == 0)
+				return std::int64_t(len);
+		}
+#endif
+		struct stat st;
+		if (::fstat(fd_, &st) != 0)
+			return 0;
+		return std::int64_t(st.st_size);
+	}
+	virtual std::size_t sector_size() const { return sector_size_; }
+	virtual bool is_device() const { return device_; }
+
+	virtual std::size_t read(std::int64_t addr, void *buf, std::size_t len)
+	{
+		error_ = 0;
+		std::size_t done = 0;
+		while (done < len)
+		{
+			ssize_t got = ::pread(fd_, (char *)buf + done, len - done, off_t(addr + done));
+			if (got < 0 && errno == EINTR)
+				continue;
+			if (got < 0)
+				error_ = errno;
+			if (got <= 0)
+				break;
+			done += std::size_t(got);
+		}
+		return done;
+	}
+
+	virtual std::size_t write(std::int64_t addr, const void *buf, std::size_t len)
+	{
+		error_ = 0;
+		std::size_t done = 0;
+		while (done < len)
+		{
+			ssize_t written = ::pwrite(fd_, (const char *)buf + done, len - done, off_t(addr + done));
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written <= 0)
+			{
+				error_ = written < 0 ? errno : EIO;
+				break;
+			}
+			done += std::size_t(written);
+		}
+		return done;
+	}
+
+	virtual bool set_length(std::int64_t len)
+	{
+		error_ = 0;
+		if (::ftruncate(fd_, off_t(len)) != 0)
+		{
+			error_ = errno;
+			return false;
+		}
+		return true;
+	}
+
+	virtual bool flush()
+	{
+		error_ = 0;
+		if (::fsync(fd_) != 0)
+		{
+			error_ = errno;
+			return false;
+		}
+		return true;
+	}
+
+	virtual bool allocated_ranges(std::int64_t start, std::int64_t end, ranges_t &ranges) const
+	{
+		ranges.clear();
+#ifdef SEEK_DATA
+		if (device_)
+			return false;
+
+		// Note that file systems without hole support report all the file as data
+		for (off_t pos = off_t(start); pos < off_t(end); )
+		{
+			off_t data = ::lseek(fd_, pos, SEEK_DATA);
+			if (data < 0 && errno == ENXIO)
+				break;                  // no more data (rest is a hole)
+			if (data < 0)
+			{
+				ranges.clear();
+				return false;
+			}
+			if (data >= off_t(end))
+				break;
+			off_t hole = ::lseek(fd_, data, SEEK_HOLE);
+			if (hole < 0)
+			{
+				ranges.clear();
+				return false;
+			}
+			ranges.push_back(std::make_pair(std::int64_t(data), std::min(std::int64_t(hole), end)));
+			pos = hole;
+		}
+		return true;
+#else
+		(void)start; (void)end;
+		return false;
+#endif
+	}
+
+	virtual void advise(std::int64_t addr, std::int64_t len, access_t how)
+	{
+#ifdef POSIX_FADV_NORMAL
+		static const int advice[] =
+		{
+			POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM, POSIX_FADV_WILLNEED, POSIX_FADV_DONTNEED,
+		};
+		(void)::posix_fadvise(fd_, off_t(addr), off_t(len), advice[how]);
+#else
+		(void)addr; (void)len; (void)how;
+#endif
+	}
+
+private:
+	int fd_;
+	bool device_;
+	std::size_t sector_size_;
+};
+
+block_storage *block_storage::open(const std::string &name, int flags /*=OPEN_READ*/, std::uint32_t *error /*=NULL*/)
+{
+	int oflags = (flags & OPEN_WRITE) != 0 ? O_RDWR : O_RDONLY;
+#ifdef O_DIRECT
+	if ((flags & OPEN_DIRECT) != 0)
+		oflags |= O_DIRECT;
+#endif
+	int fd = ::open(name.c_str(), oflags);
+	if (fd < 0)
+	{
+		if (error != NULL)
+			*error = errno;
+		return NULL;
+	}
+
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+	{
+		if (error != NULL)
+			*error = errno;
+		::close(fd);
+		return NULL;
+	}
+	bool device = S_ISBLK(st.st_mode);
+
+	std::size_t sector_size = 1;
+	if (device || (flags & OPEN_DIRECT) != 0)
+	{
+		sector_size = std::size_t(st.st_blksize);
+#ifdef BLKSSZGET
+		int ss;
+		if (device && ::ioctl(fd, BLKSSZGET, &ss) == 0 && ss > 0)
+			sector_size = std::size_t(ss);
+#endif
+	}
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	if ((flags & OPEN_SEQUENTIAL) != 0)
+		(void)::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	return new posix_storage(fd, device, sector_size);
+}
+
+#endif // _WIN32
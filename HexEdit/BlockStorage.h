@@ -0,0 +1,118 @@
+// BlockStorage.h : random access to a file or block device that does not depend on the OS
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SectorReader.h"
+
+// Random access to the bytes of a file or device as an interface with an implementation for
+// Win32 (handles, IOCTL_DISK_GET_LENGTH_INFO, FSCTL_QUERY_ALLOCATED_RANGES) and one for POSIX
+// systems (pread, O_DIRECT, posix_fadvise, BLKGETSIZE64, SEEK_DATA/SEEK_HOLE).  Use open() to
+// get the one for the system being built for.  CFile64 does its reads, writes, seeks and
+// length changes through this (see attach) so that they do not depend on the OS, though the
+// rest of it (locking, file information, and the device handling of CFileNC) still uses the
+// Win32 handle.  Note that there is only a Windows build so the POSIX implementation is not
+// built or tested at present.
+//
+// Reads and writes are positional (there is no file pointer) so one object can be shared by
+// threads.  If opened with OPEN_DIRECT (non-cached) then addresses, lengths and buffers must be
+// multiples of sector_size() - see aligned_buffer.
+class block_storage
+{
+public:
+	enum
+	{
+		OPEN_READ   = 0x0,
+		OPEN_WRITE  = 0x1,          // open for read and write
+		OPEN_DIRECT = 0x2,          // bypass the OS cache (as CFileNC does)
+		OPEN_SEQUENTIAL = 0x4,      // hint that the file will be mostly read from start to end
+	};
+
+	// How the data is going to be accessed (see advise)
+	enum access_t { ACCESS_NORMAL, ACCESS_SEQUENTIAL, ACCESS_RANDOM, ACCESS_WILLNEED, ACCESS_DONTNEED };
+
+	typedef std::vector<std::pair<std::int64_t, std::int64_t> > ranges_t;  // [start, end) pairs
+
+	// Opens a file or device returning NULL on error (with the system error in *error)
+	static block_storage *open(const std::string &name, int flags = OPEN_READ, std::uint32_t *error = NULL);
+#ifdef _WIN32
+	// Uses a handle that is already open (as CFile64::Open does, with its share modes etc).
+	// The handle is not closed when the block_storage is destroyed.
+	static block_storage *attach(HANDLE hh, bool device, std::size_t sector_size);
+#endif
+
+	virtual ~block_storage() { }
+
+	virtual std::int64_t length() const = 0;
+	virtual std::size_t sector_size() const = 0;    // size reads must be aligned to (1 if none)
+	virtual bool is_device() const = 0;
+
+	// Read/write at an address.  They return the number of bytes done which is less than
+	// len only at end of file or on error (see last_error).
+	virtual std::size_t read(std::int64_t addr, void *buf, std::size_t len) = 0;
+	virtual std::size_t write(std::int64_t addr, const void *buf, std::size_t len) = 0;
+
+	virtual bool set_length(std::int64_t len) = 0;
+	virtual bool flush() = 0;
+
+	// Gets the parts of [start, end) that have disk space allocated.  The rest are holes
+	// (of a sparse file) that read as zeroes.  Returns false if not known (all should be read).
+	virtual bool allocated_ranges(std::int64_t start, std::int64_t end, ranges_t &ranges) const = 0;
+
+	// Tells the OS how an area will be accessed (may do nothing)
+	virtual void advise(std::int64_t addr, std::int64_t len, access_t how) = 0;
+
+	std::uint32_t last_error() const { return error_; }   // of the last read/write/set_length/flush (0 if OK)
+
+protected:
+	block_storage() : error_(0) { }
+	std::uint32_t error_;           // last system error (0 = none)
+};
+
+// Memory aligned to a sector size as needed for direct (non-cached) reads
+class aligned_buffer
+{
+public:
+	aligned_buffer(std::size_t len, std::size_t align)
+		: mem_(len + align), ptr_(mem_.data() + (align - reinterpret_cast<std::uintptr_t>(mem_.data()) % align) % align), len_(len) { }
+	unsigned char *data() { return ptr_; }
+	std::size_t size() const { return len_; }
+
+private:
+	std::vector<unsigned char> mem_;
+	unsigned char *ptr_;
+	std::size_t len_;
+};
+
+// A sector_device that reads block_storage, so that sector_reader can be used with any storage.
+// Reads are done (one at a time) when started, so this does not have several reads in progress
+// at once like the Win32 overlapped_device (see CFile64.cpp) but has the same retry handling.
+class storage_device : public sector_device
+{
+public:
+	explicit storage_device(block_storage *storage) : storage_(storage), done_(NULL) { }
+
+	virtual std::size_t sector_size() const { return storage_->sector_size(); }
+	virtual std::int64_t length() const { return storage_->length(); }
+	virtual int max_requests() const { return 1; }
+	virtual bool start(request *req);
+	virtual request *wait();
+
+private:
+	block_storage *storage_;
+	request *done_;                 // read that has been done but not returned by wait()
+};
@@ -0,0 +1,144 @@
+// ByteText.cpp : lookup tables and functions for converting bytes and addresses to text
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <immintrin.h>          // for SSSE3 intrinsics
+
+#include "ByteText.h"
+#include "Misc.h"               // for GetSimdLevel
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+static constexpr byte_text_tables make_tables()
+{
+	byte_text_tables tt = {};
+	for (int ii = 0; ii < 256; ++ii)
+	{
+		tt.hex_upper[ii][0] = "0123456789ABCDEF"[ii >> 4];
+		tt.hex_upper[ii][1] = "0123456789ABCDEF"[ii & 0xF];
+		tt.hex_lower[ii][0] = "0123456789abcdef"[ii >> 4];
+		tt.hex_lower[ii][1] = "0123456789abcdef"[ii & 0xF];
+	}
+	for (int ii = 0; ii < 100; ++ii)
+	{
+		tt.dec[ii][0] = char('0' + ii/10);
+		tt.dec[ii][1] = char('0' + ii%10);
+	}
+	return tt;
+}
+extern constexpr byte_text_tables byte_text = make_tables();
+
+// Converts 16 bytes at a time: the digits of each nybble are looked up with PSHUFB, then the
+// pairs of digits are shuffled out to 3 chars per byte (0x80 in a shuffle mask gives a zero
+// char which is then ORed with a space).
+static char *hex_bytes_ssse3(char *out, const unsigned char *in, std::size_t len, bool upper)
+{
+	const __m128i digits = _mm_loadu_si128((const __m128i *)(upper ? "0123456789ABCDEF" : "0123456789abcdef"));
+	const __m128i nybble = _mm_set1_epi8(0x0F);
+	const __m128i m0 = _mm_setr_epi8(0, 1, -128, 2, 3, -128, 4, 5, -128, 6, 7, -128, 8, 9, -128, 10);
+	const __m128i m1a = _mm_setr_epi8(11, -128, 12, 13, -128, 14, 15, -128, -128, -128, -128, -128, -128, -128, -128, -128);
+	const __m128i m1b = _mm_setr_epi8(-128, -128, -128, -128, -128, -128, -128, -128, 0, 1, -128, 2, 3, -128, 4, 5);
+	const __m128i m2 = _mm_setr_epi8(-128, 6, 7, -128, 8, 9, -128, 10, 11, -128, 12, 13, -128, 14, 15, -128);
+	const __m128i s0 = _mm_setr_epi8(0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0);
+	const __m128i s1 = _mm_setr_epi8(0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0);
+	const __m128i s2 = _mm_setr_epi8(' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ');
+
+	for ( ; len >= 16; len -= 16, in += 16, out += 48)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i *)in);
+		__m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), nybble));  // PSHUFB
+		__m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, nybble));
+		__m128i p0 = _mm_unpacklo_epi8(hi, lo);         // digits of bytes 0-7
+		__m128i p1 = _mm_unpackhi_epi8(hi, lo);         // digits of bytes 8-15
+		_mm_storeu_si128((__m128i *)out, _mm_or_si128(_mm_shuffle_epi8(p0, m0), s0));
+		_mm_storeu_si128((__m128i *)(out + 16),
+		                 _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(p0, m1a), _mm_shuffle_epi8(p1, m1b)), s1));
+		_mm_storeu_si128((__m128i *)(out + 32), _mm_or_si128(_mm_shuffle_epi8(p1, m2), s2));
+	}
+	for (const unsigned char *end = in + len; in < end; ++in)
+	{
+		const char *pp = hex_text(*in, upper);
+		*out++ = pp[0];
+		*out++ = pp[1];
+		*out++ = ' ';
+	}
+	return out;
+}
+
+char *hex_bytes(char *out, const unsigned char *in, std::size_t len, bool upper)
+{
+	if (len >= 16 && GetSimdLevel() >= SIMD_SSSE3)
+		return hex_bytes_ssse3(out, in, len, upper);
+
+	const char (*table)[2] = upper ? byte_text.hex_upper : byte_text.hex_lower;
+	for (const unsigned char *end = in + len; in < end; ++in)
+	{
+		*out++ = table[*in][0];
+		*out++ = table[*in][1];
+		*out++ = ' ';
+	}
+	return out;
+}
+
+char *format_hex(char *out, std::uint64_t val, int width, bool upper)
+{
+	// Generate the digits backwards, 2 at a time
+	char buf[16];
+	char *pp = buf + sizeof(buf);
+	const char (*table)[2] = upper ? byte_text.hex_upper : byte_text.hex_lower;
+	do
+	{
+		pp -= 2;
+		pp[0] = table[val & 0xFF][0];
+		pp[1] = table[val & 0xFF][1];
+		val >>= 8;
+	} while (val != 0);
+	if (*pp == '0' && pp < buf + sizeof(buf) - 1)
+		++pp;                   // odd number of digits
+
+	int ndigits = int(buf + sizeof(buf) - pp);
+	for (int ii = ndigits; ii < width; ++ii)
+		*out++ = '0';
+	return std::copy(pp, buf + sizeof(buf), out);
+}
+
+char *format_dec(char *out, std::int64_t val, int width)
+{
+	char buf[24];
+	char *pp = buf + sizeof(buf);
+	std::uint64_t uval = val < 0 ? 0 - std::uint64_t(val) : std::uint64_t(val);
+	while (uval >= 100)
+	{
+		pp -= 2;
+		pp[0] = byte_text.dec[uval % 100][0];
+		pp[1] = byte_text.dec[uval % 100][1];
+		uval /= 100;
+	}
+	if (uval >= 10)
+	{
+		pp -= 2;
+		pp[0] = byte_text.dec[uval][0];
+		pp[1] = byte_text.dec[uval][1];
+	}
+	else
+		*--pp = char('0' + uval);
+	if (val < 0)
+		*--pp = '-';
+
+	int nchars = int(buf + sizeof(buf) - pp);
+	for (int ii = nchars; ii < width; ++ii)
+		*out++ = ' ';
+	return std::copy(pp, buf + sizeof(buf), out);
+}
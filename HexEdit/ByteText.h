@@ -0,0 +1,44 @@
+// ByteText.h : fast conversion of bytes and addresses to text
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Displaying, copying and exporting bytes as hex text used to build each byte's digits from a
+// "0123456789ABCDEF" string (or sprintf/CString::Format for ruler labels and addresses).  These
+// instead look up the text of a byte in tables that are built at compile time, and convert
+// rows of bytes to hex text 16 bytes at a time when the processor has SSSE3 (ie GetSimdLevel()
+// is SIMD_SSSE3 or better).
+//
+// None of these add a terminating nul character.  They return a pointer to the char after the
+// last one written.
+
+// The text of each byte value: 2 hex digits (upper or lower case) and 2 decimal digits for 0 to 99
+struct byte_text_tables
+{
+	char hex_upper[256][2];
+	char hex_lower[256][2];
+	char dec[100][2];
+};
+extern const byte_text_tables byte_text;
+
+inline const char *hex_text(unsigned char byte, bool upper) { return upper ? byte_text.hex_upper[byte] : byte_text.hex_lower[byte]; }
+inline const char *dec_text(int val) { return byte_text.dec[val]; }  // val must be 0 to 99
+
+// Writes 3 chars for each byte - 2 hex digits and a space
+char *hex_bytes(char *out, const unsigned char *in, std::size_t len, bool upper);
+
+// Writes a number with at least width digits, padded with zeroes (hex) or spaces (decimal) like
+// sprintf("%0*I64X") and sprintf("%*I64d").
+char *format_hex(char *out, std::uint64_t val, int width, bool upper);
+char *format_dec(char *out, std::int64_t val, int width);
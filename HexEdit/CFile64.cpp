@@ -24,6 +24,9 @@
 #include "hexedit.h"
 #include "misc.h"
 #include "ntapi.h"      // Our header for NT native API funcs/structures
+#include "SnapshotStore.h"
+#include "SectorReader.h"
+#include "BlockStorage.h"
 
 #pragma hdrstop
 
@@ -217,6 +220,8 @@ CFile64::CFile64() :
 	m_SecurityAttributes_p{ nullptr },
 	m_SecurityDescriptor_p{ nullptr },
 	m_FileHandle{ INVALID_HANDLE_VALUE },
+	m_Storage{ nullptr },
+	m_Position{ 0 },
 	m_PathName{},
 	m_FileName{},
 	m_FileTitle{},
@@ -235,6 +240,7 @@ CFile64::CFile64( int file_handle )
 
    m_hFile = (UINT) hFileNull;
    m_FileHandle           = INVALID_HANDLE_VALUE;
+   m_Storage              = NULL;
    m_SecurityAttributes_p = (SECURITY_ATTRIBUTES *) NULL;
    m_SecurityDescriptor_p = (SECURITY_DESCRIPTOR *) NULL;
 
@@ -242,6 +248,8 @@ CFile64::CFile64( int file_handle )
 
    m_hFile         = file_handle; // Stupid public member that is never used internally
    m_FileHandle    = (HANDLE) file_handle;
+   m_Storage       = block_storage::attach( m_FileHandle, false, 1 );
+   m_Position      = 0;
    m_CloseOnDelete = FALSE;
 }
 
@@ -251,6 +259,7 @@ CFile64::CFile64( LPCTSTR filename, UINT open_flags )
 
    m_hFile = (UINT) hFileNull;
    m_FileHandle           = INVALID_HANDLE_VALUE;
+   m_Storage              = NULL;
    m_SecurityAttributes_p = (SECURITY_ATTRIBUTES *) NULL;
    m_SecurityDescriptor_p = (SECURITY_DESCRIPTOR *) NULL;
 
@@ -281,6 +290,7 @@ CFile64::~CFile64()
       Close();
    }
 
+   delete m_Storage;    // (does not close the handle)
    m_Uninitialize();
 
    m_SecurityAttributes_p = (SECURITY_ATTRIBUTES *) NULL;
@@ -293,6 +303,9 @@ void CFile64::Abort( void )
 
    BOOL return_value = TRUE;
 
+   delete m_Storage;
+   m_Storage = NULL;
+
    if ( m_FileHandle != INVALID_HANDLE_VALUE )
    {
       if (!::CloseHandle(m_FileHandle))
@@ -320,6 +333,9 @@ void CFile64::Close( void )
 
    BOOL return_value = TRUE;
 
+   delete m_Storage;
+   m_Storage = NULL;
+
    if ( m_FileHandle != INVALID_HANDLE_VALUE )
    {
       if (!::CloseHandle(m_FileHandle))
@@ -749,6 +765,10 @@ CFile64 * CFile64::Duplicate( void ) const
    {
       return_value->m_hFile         = (UINT) duplicate_file_handle; // Stupid public attribute that will never be used internally
       return_value->m_FileHandle    = duplicate_file_handle;
+      return_value->m_Storage       = block_storage::attach( duplicate_file_handle, m_Length != -1, m_Storage != NULL ? m_Storage->sector_size() : 1 );
+      return_value->m_Position      = m_Position;
+      return_value->m_SectorSize    = m_SectorSize;
+      return_value->m_Length        = m_Length;
       return_value->m_CloseOnDelete = m_CloseOnDelete;
       return_value->m_PathName      = m_PathName;
       return_value->m_FileName      = m_FileName;
@@ -762,20 +782,33 @@ void CFile64::Flush( void )
 {
 //   WFCLTRACEINIT( TEXT( "CFile64::Flush()" ) );
 
-   if ( m_FileHandle == INVALID_HANDLE_VALUE )
+   if ( m_Storage == NULL )
    {
       return;
    }
 
-   if ( ::FlushFileBuffers( m_FileHandle ) == FALSE )
+   if ( ! m_Storage->flush() )
    {
-//      WFCTRACEERROR( ::GetLastError() );
+//      WFCTRACEERROR( m_Storage->last_error() );
 #if ! defined( WFC_STL )
-      CFileException::ThrowOsError( (LONG) ::GetLastError() );
+      CFileException::ThrowOsError( (LONG) m_Storage->last_error() );
 #endif // WFC_STL
    }
 }
 
+// Only normal files (marked as sparse) can have holes - see block_storage::allocated_ranges
+BOOL CFile64::GetAllocatedRanges( LONGLONG start, LONGLONG end, std::vector<std::pair<LONGLONG, LONGLONG> >& ranges ) const
+{
+   ranges.clear();
+
+   if ( m_Storage == NULL || m_Length != -1 )
+   {
+      return( FALSE );
+   }
+
+   return( m_Storage->allocated_ranges( start, end, ranges ) ? TRUE : FALSE );
+}
+
 CString CFile64::GetFileName( void ) const
 {
 //   WFCLTRACEINIT( TEXT( "CFile64::GetFileName()" ) );
@@ -825,55 +858,25 @@ LONGLONG CFile64::GetLength( void ) const
    if (m_Length != -1)
       return m_Length;
 
-   LARGE_INTEGER length;
-
-   length.QuadPart = 0;
-
-   if ( m_FileHandle == INVALID_HANDLE_VALUE )
-   {
-      return( length.QuadPart );
-   }
-
-   length.LowPart = ::GetFileSize( m_FileHandle, (DWORD *) &length.HighPart );
-
-   if ( length.LowPart == 0xffffFFFF && ( ::GetLastError() != NO_ERROR ) )
+   if ( m_Storage == NULL )
    {
-//      WFCTRACEERROR( ::GetLastError() );
-      length.QuadPart = 0;
+      return( 0 );
    }
 
-   return( length.QuadPart );
+   return( m_Storage->length() );     // (0 on error)
 }
 
 LONGLONG CFile64::GetPosition( void ) const
 {
 //   WFCLTRACEINIT( TEXT( "CFile64::GetHandle()" ) );
 
-   if ( m_FileHandle == INVALID_HANDLE_VALUE )
+   if ( m_Storage == NULL )
    {
 //      WFCTRACE( TEXT( "File is not open." ) );
       return( (LONGLONG) -1 );
    }
 
-   LARGE_INTEGER return_value;
-
-   return_value.QuadPart = 0;
-
-   return_value.LowPart = ::SetFilePointer( m_FileHandle, 0, &return_value.HighPart, FILE_CURRENT );
-
-   if ( return_value.LowPart == 0xffffFFFF && ::GetLastError() != NO_ERROR )
-   {
-      // An Error Occurred
-//      WFCTRACEERROR( ::GetLastError() );
-//      WFCTRACE( TEXT( "Can't SetFilePointer() because of above error." ) );
-#if ! defined( WFC_STL )
-      CFileException::ThrowOsError( (LONG) ::GetLastError() );
-#else // WFC_STL
-      return_value.QuadPart = 0I64;
-#endif // WFC_STL
-   }
-
-   return( return_value.QuadPart );
+   return( m_Position );
 }
 
 SECURITY_ATTRIBUTES * CFile64::GetSecurityAttributes( void ) const
@@ -1283,6 +1286,12 @@ BOOL CFile64::Open( LPCTSTR filename, UINT open_flags )
 								&TotalNumberOfClusters));
 	}
 
+	// Reads and writes are done through a block_storage at m_Position (rather than using the
+	// Win32 file pointer).  Note: for a device CFileNC sets the sector size later.
+	DWORD align = (open_flags & osNoBuffer) != 0 && m_SectorSize > 0 ? m_SectorSize : 1;
+	m_Storage = block_storage::attach(m_FileHandle, ::IsDevice(filename) != FALSE, align);
+	m_Position = 0;
+
 	return TRUE;
 }
 
@@ -1312,19 +1321,20 @@ DWORD CFile64::Read( void * buffer, DWORD number_of_bytes_to_read )
       return( 0 );
    }
 
-   if ( m_FileHandle == INVALID_HANDLE_VALUE )
+   if ( m_Storage == NULL )
    {
       return( 0 );
    }
 
-   DWORD number_of_bytes_read = 0;
+   DWORD number_of_bytes_read = (DWORD) m_Storage->read( m_Position, buffer, number_of_bytes_to_read );
+   m_Position += number_of_bytes_read;
 
-   if ( ::ReadFile( m_FileHandle, buffer, number_of_bytes_to_read, &number_of_bytes_read, NULL ) == FALSE )
+   if ( number_of_bytes_read < number_of_bytes_to_read && m_Storage->last_error() != 0 )
    {
-//      WFCTRACEERROR( ::GetLastError() );
+//      WFCTRACEERROR( m_Storage->last_error() );
 //      WFCTRACE( TEXT( "Can't read from file because of above error." ) );
 #if ! defined( WFC_STL )
-      CFileException::ThrowOsError( (LONG) ::GetLastError() );
+      CFileException::ThrowOsError( (LONG) m_Storage->last_error() );
 #endif // WFC_STL
    }
 
@@ -1355,32 +1365,32 @@ LONGLONG CFile64::Seek( LONGLONG offset, UINT from )
 {
 //   WFCLTRACEINIT( TEXT( "CFile64::Seek()" ) );
 
-   if ( m_FileHandle == INVALID_HANDLE_VALUE )
+   if ( m_Storage == NULL )
    {
 //      WFCTRACE( TEXT( "File is not open." ) );
       return( (LONGLONG) -1 );
    }
 
-   DWORD move_method = 0;
+   LONGLONG new_position = 0;
 
    switch( from )
    {
      case CFile::begin:
 
 //        WFCTRACEVAL( TEXT( "From beginning to " ), offset );
-        move_method = FILE_BEGIN;
+        new_position = offset;
         break;
 
      case CFile::current:
 
 //        WFCTRACEVAL( TEXT( "From current to " ), offset );
-        move_method = FILE_CURRENT;
+        new_position = m_Position + offset;
         break;
 
      case CFile::end:
 
 //        WFCTRACEVAL( TEXT( "From end to " ), offset );
-        move_method = FILE_END;
+        new_position = GetLength() + offset;
         break;
 
      default:
@@ -1389,21 +1399,19 @@ LONGLONG CFile64::Seek( LONGLONG offset, UINT from )
         return( (LONGLONG) -1 );
    }
 
-   LARGE_INTEGER return_value;
-
-   return_value.QuadPart = offset;
-
-   return_value.LowPart = ::SetFilePointer( m_FileHandle, return_value.LowPart, &return_value.HighPart, move_method );
-
-   if ( return_value.LowPart == INVALID_SET_FILE_POINTER && ::GetLastError() != NO_ERROR )
+   // Like SetFilePointer seeking past the end is OK but not before the start
+   if ( new_position < 0 )
    {
-//      WFCTRACEERROR( ::GetLastError() );
+//      WFCTRACEERROR( ERROR_NEGATIVE_SEEK );
 #if ! defined( WFC_STL )
-      CFileException::ThrowOsError( (LONG) ::GetLastError() );
+      CFileException::ThrowOsError( (LONG) ERROR_NEGATIVE_SEEK );
 #endif // WFC_STL
+      return( (LONGLONG) -1 );
    }
 
-   return( return_value.QuadPart );
+   m_Position = new_position;
+
+   return( m_Position );
 }
 
 void CFile64::SeekToBegin( void )
@@ -1428,9 +1436,9 @@ BOOL CFile64::SetEndOfFile( LONGLONG length )
       return( FALSE );
    }
 
-   if ( ::SetEndOfFile( m_FileHandle ) == FALSE )
+   if ( ! m_Storage->set_length( length ) )
    {
-//      WFCTRACEERROR( ::GetLastError() );
+//      WFCTRACEERROR( m_Storage->last_error() );
 //      WFCTRACE( TEXT( "Can't set end of file because of above error." ) );
       return( FALSE );
    }
@@ -1490,13 +1498,22 @@ void CFile64::Write( const void * buffer, DWORD number_of_bytes_to_write )
       return;
    }
 
-   DWORD number_of_bytes_written = 0;
+   if ( m_Storage == NULL )
+   {
+#if ! defined( WFC_STL )
+      CFileException::ThrowOsError( (LONG) ERROR_INVALID_HANDLE, m_FileName );
+#endif // WFC_STL
+      return;
+   }
+
+   DWORD number_of_bytes_written = (DWORD) m_Storage->write( m_Position, buffer, number_of_bytes_to_write );
+   m_Position += number_of_bytes_written;
 
-   if ( ::WriteFile( m_FileHandle, buffer, number_of_bytes_to_write, &number_of_bytes_written, NULL ) == FALSE )
+   if ( number_of_bytes_written < number_of_bytes_to_write && m_Storage->last_error() != 0 )
    {
-//      WFCTRACEERROR( ::GetLastError() );
+//      WFCTRACEERROR( m_Storage->last_error() );
 #if ! defined( WFC_STL )
-      CFileException::ThrowOsError( (LONG) ::GetLastError(), m_FileName );
+      CFileException::ThrowOsError( (LONG) m_Storage->last_error(), m_FileName );
 #endif // WFC_STL
    }
 
@@ -1518,12 +1535,177 @@ CFile64::operator HFILE ( void ) const
 ///////////////////////////////////////////////////////////////////////////
 // CFileNC: used to access file in non-cached (FILE_FLAG_NO_BUFFERING) mode.
 
+// Reads sectors of a device or non-cached file with several reads in progress at once.  The
+// handle must be opened for overlapped I/O - ie CreateFile with FILE_FLAG_OVERLAPPED or (for a
+// native physical device) NtOpenFile without FILE_SYNCHRONOUS_IO_* - and is closed when done.
+class overlapped_device : public sector_device
+{
+public:
+	enum { MAX_REQUESTS = 8 };
+
+	overlapped_device(HANDLE hh, bool native, std::size_t sector_size, std::int64_t length)
+		: m_handle(hh), m_native(native), m_sector_size(sector_size), m_length(length)
+	{
+		for (int ii = 0; ii < MAX_REQUESTS; ++ii)
+		{
+			m_slots[ii].event = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+			m_slots[ii].req = NULL;
+		}
+	}
+
+	virtual ~overlapped_device()
+	{
+		// Make sure nothing is still writing into buffers before we go
+		::CancelIo(m_handle);
+		while (wait() != NULL)
+			;
+		for (int ii = 0; ii < MAX_REQUESTS; ++ii)
+			::CloseHandle(m_slots[ii].event);
+		if (m_native)
+			(*pfClose)(m_handle);
+		else
+			::CloseHandle(m_handle);
+	}
+
+	virtual std::size_t sector_size() const { return m_sector_size; }
+	virtual std::int64_t length() const { return m_length; }
+	virtual int max_requests() const { return MAX_REQUESTS; }
+
+	virtual bool start(request *req)
+	{
+		int ii;
+		for (ii = 0; ii < MAX_REQUESTS; ++ii)
+			if (m_slots[ii].req == NULL)
+				break;
+		ASSERT(ii < MAX_REQUESTS);
+		if (ii == MAX_REQUESTS)
+		{
+			req->status = ERROR_BUSY;
+			return false;
+		}
+		slot &ss = m_slots[ii];
+		::ResetEvent(ss.event);
+
+		if (m_native)
+		{
+			LARGE_INTEGER pos;
+			pos.QuadPart = req->addr;
+			NTSTATUS ns = (*pfReadFile)(m_handle, ss.event, 0, 0, &ss.iosb, req->buf, ULONG(req->len), &pos, 0);
+			if (!NT_SUCCESS(ns))
+			{
+				req->status = ns;
+				return false;
+			}
+		}
+		else
+		{
+			memset(&ss.ov, '\0', sizeof(ss.ov));
+			ss.ov.Offset = DWORD(req->addr);
+			ss.ov.OffsetHigh = DWORD(req->addr >> 32);
+			ss.ov.hEvent = ss.event;
+			if (!::ReadFile(m_handle, req->buf, DWORD(req->len), NULL, &ss.ov) && ::GetLastError() != ERROR_IO_PENDING)
+			{
+				req->status = ::GetLastError();
+				return false;
+			}
+		}
+		ss.req = req;
+		return true;
+	}
+
+	virtual request *wait()
+	{
+		HANDLE events[MAX_REQUESTS];
+		int idx[MAX_REQUESTS];
+		int count = 0;
+		for (int ii = 0; ii < MAX_REQUESTS; ++ii)
+		{
+			if (m_slots[ii].req != NULL)
+			{
+				events[count] = m_slots[ii].event;
+				idx[count++] = ii;
+			}
+		}
+		if (count == 0)
+			return NULL;
+
+		DWORD rr = ::WaitForMultipleObjects(count, events, FALSE, INFINITE);
+		ASSERT(rr >= WAIT_OBJECT_0 && rr < WAIT_OBJECT_0 + count);
+		slot &ss = m_slots[idx[rr - WAIT_OBJECT_0]];
+		request *req = ss.req;
+		ss.req = NULL;
+
+		if (m_native)
+		{
+			if (!NT_SUCCESS(ss.iosb.Status))
+				req->status = ss.iosb.Status;
+			else
+				req->status = ss.iosb.Information == req->len ? 0 : ERROR_HANDLE_EOF;
+		}
+		else
+		{
+			DWORD got;
+			if (!::GetOverlappedResult(m_handle, &ss.ov, &got, FALSE))
+				req->status = ::GetLastError();
+			else
+				req->status = got == req->len ? 0 : ERROR_HANDLE_EOF;
+		}
+		return req;
+	}
+
+private:
+	struct slot
+	{
+		HANDLE event;               // signalled when the read finishes
+		OVERLAPPED ov;              // used with ReadFile
+		IO_STATUS_BLOCK iosb;       // used with NtReadFile
+		request *req;               // read in progress or NULL if slot is free
+	};
+
+	HANDLE m_handle;
+	bool m_native;                  // handle is from NtOpenFile (use NtReadFile)
+	std::size_t m_sector_size;
+	std::int64_t m_length;
+	slot m_slots[MAX_REQUESTS];
+};
+
+static const DWORD async_buffer_size = 1024*1024;   // CFileNC buffer size when reading with overlapped_device
+
+// Gets the bad sector map for a file/device, shared by all the CFileNCs that have it open
+static std::shared_ptr<bad_sector_map> shared_bad_map(LPCTSTR filename)
+{
+	static std::mutex mutex;
+	static std::map<CString, std::weak_ptr<bad_sector_map> > maps;
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Remove maps no longer in use
+	for (std::map<CString, std::weak_ptr<bad_sector_map> >::iterator pp = maps.begin(); pp != maps.end(); )
+	{
+		if (pp->second.expired())
+			pp = maps.erase(pp);
+		else
+			++pp;
+	}
+
+	CString key(filename);
+	key.MakeUpper();
+	std::shared_ptr<bad_sector_map> retval = maps[key].lock();
+	if (!retval)
+	{
+		retval = std::make_shared<bad_sector_map>();
+		maps[key] = retval;
+	}
+	return retval;
+}
+
 // Note: Even though the code for this constructor is exactly the same as for
 // the base class (CFile64) constructor we have to override so that we call
 // the derived version of Open().
 CFileNC::CFileNC( LPCTSTR filename, UINT open_flags )
 {
 	m_Buffer = NULL;
+	m_device = NULL;
+	m_reader = NULL;
 	m_hFile = (UINT) hFileNull;
 	m_FileHandle           = INVALID_HANDLE_VALUE;
 	m_SecurityAttributes_p = (SECURITY_ATTRIBUTES *) NULL;
@@ -1548,6 +1730,13 @@ CFileNC::CFileNC( LPCTSTR filename, UINT open_flags )
 #endif // WFC_STL
 }
 
+CFileNC::~CFileNC()
+{
+	// Normally already done in Close()
+	delete m_reader;
+	delete m_device;
+}
+
 // CFileNC::Open handles several different types of filenames:
 // 0. NTAPI device name (\device\*) - these are no longer passed in as the filename
 // 1. Fake device name - NT/2K/XP only - converted to NTAPI device name: \\.\FloppyN => \device\FloppyN,
@@ -1915,12 +2104,85 @@ scan_failed:
 	// Check that if not scanning for end (in release build) then m_Length is correct
 	ASSERT(m_Length == saved_length || scan_for_end);
 
+	if (theApp.is_nt_)
+		open_async(filename);
+
 	m_FilePos = 0;                 // Begin at start of file
 	m_start = m_end = 0;           // Indicate that buffer contains nothing currently
 	m_dirty = false;
 	return TRUE;
 }
 
+// Opens a 2nd (read only) handle for the file/device for overlapped reads.  If it can't be
+// opened (eg the file was opened for exclusive access) then reads are done as before.
+void CFileNC::open_async(LPCTSTR filename)
+{
+	ASSERT(m_device == NULL && m_reader == NULL);
+	HANDLE hh = INVALID_HANDLE_VALUE;
+	if (m_retries >= 0)
+	{
+		// Physical device - open without FILE_SYNCHRONOUS_IO_* so NtReadFile does not wait
+		OBJECT_ATTRIBUTES oa;
+		IO_STATUS_BLOCK iosb;
+		UNICODE_STRING us;
+		BSTR name = GetPhysicalDeviceName(filename);
+		(*pfInitUnicodeString)(&us, name);
+
+		oa.Length = sizeof(oa);
+		oa.RootDirectory = NULL;
+		oa.ObjectName = &us;
+		oa.Attributes = OBJ_CASE_INSENSITIVE;
+		oa.SecurityDescriptor = NULL;
+		oa.SecurityQualityOfService = NULL;
+
+		if ((*pfOpenFile)(&hh, FILE_READ_DATA|SYNCHRONIZE, &oa, &iosb, FILE_SHARE_READ|FILE_SHARE_WRITE,
+			              FILE_NON_DIRECTORY_FILE) != STATUS_SUCCESS)
+			hh = INVALID_HANDLE_VALUE;
+		::SysFreeString(name);
+	}
+	else
+	{
+		hh = ::CreateFile(filename, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+		                  FILE_FLAG_OVERLAPPED|FILE_FLAG_NO_BUFFERING, NULL);
+	}
+	if (hh == INVALID_HANDLE_VALUE)
+		return;
+
+	// Use a bigger buffer so that several blocks can be read at once
+	ASSERT(async_buffer_size % (m_SectorSize*2) == 0);
+	LPVOID buf = VirtualAlloc(NULL, async_buffer_size, MEM_COMMIT, PAGE_READWRITE);
+	if (buf == NULL)
+	{
+		if (m_retries >= 0)
+			(*pfClose)(hh);
+		else
+			::CloseHandle(hh);
+		return;
+	}
+	if (m_Buffer != NULL)
+		VirtualFree(m_Buffer, 0, MEM_RELEASE);
+	m_Buffer = buf;
+	m_BufferSize = async_buffer_size;
+
+	m_device = new overlapped_device(hh, m_retries >= 0, m_SectorSize, m_Length);
+	m_reader = new sector_reader(m_device, 64*1024, m_retries >= 0 ? m_retries : 1, shared_bad_map(filename));
+}
+
+bool CFileNC::HasError()
+{
+	if (m_reader != NULL)
+		return !m_reader->bad().empty();
+	return !m_bad.empty();
+}
+
+DWORD CFileNC::Error(__int64 sec)
+{
+	if (m_reader != NULL)
+		return m_reader->pending(sec) ? ERROR_IO_PENDING : m_reader->error(sec);
+	std::map<__int64, DWORD>::const_iterator pp = m_bad.find(sec);
+	return pp == m_bad.end() ? 0 : pp->second;
+}
+
 // Normally file name inc. ext. - for devices an extension is fabricated depending on filesystem in use (or RAW for none)
 CString CFileNC::GetFileName( void ) const
 {
@@ -1974,6 +2236,7 @@ DWORD CFileNC::Read( void * buffer, DWORD len )
 		get_current();
 
 		DWORD tocopy = (DWORD)((end_address > m_end ? m_end : end_address) - m_FilePos);
+		get_pending(m_FilePos, m_FilePos + tocopy);
 		memcpy((char *)buffer + done, (char *)m_Buffer + m_FilePos - m_start, tocopy);
 		done += tocopy;
 		m_FilePos += tocopy;
@@ -1993,6 +2256,7 @@ void CFileNC::Write( const void * buffer, DWORD len )
 	while (m_FilePos < end_address)
 	{
 		get_current();
+		get_pending(m_start, m_end);    // as the whole buffer is written back
 
 		DWORD tocopy = (DWORD)((end_address > m_end ? m_end : end_address) - m_FilePos);
 		memcpy((char *)m_Buffer + m_FilePos - m_start, (char *)buffer + done, tocopy);
@@ -2042,6 +2306,19 @@ void CFileNC::get_current()
 
 		TRACE("Device READ non-cached %ld\r\n", long(m_FilePos));
 
+		if (m_reader != NULL)
+		{
+			// Read the (aligned) buffer containing m_FilePos so that sequential reads (forwards
+			// or backwards) don't read anything twice; bad sectors are zeroed (see Error()) and
+			// sectors still being retried are zeroed for now (see get_pending)
+			m_start = (m_FilePos/m_BufferSize) * m_BufferSize;
+			m_end = std::min(m_start + (LONGLONG)m_BufferSize, GetLength());
+			m_pending.clear();
+			if (!m_reader->read(m_start, (unsigned char *)m_Buffer, size_t(m_end - m_start)))
+				m_reader->pending(m_start, size_t(m_end - m_start), m_pending);
+			return;
+		}
+
 		// Work out which bit of the file we need to read
 		m_start = (m_FilePos/m_SectorSize) * m_SectorSize - m_BufferSize/2;
 		if (m_start < 0) m_start = 0;
@@ -2144,6 +2421,29 @@ void CFileNC::get_current()
 	}
 }
 
+// Makes sure that the bytes of the buffer from lo to hi do not include sectors that were still
+// being retried when the buffer was read (and so were zeroed).  This waits for all our retries
+// then reads the pending sectors again, which gets the data of ones that were retried OK.
+void CFileNC::get_pending(LONGLONG lo, LONGLONG hi)
+{
+	bool wanted = false;
+	for (std::vector<__int64>::const_iterator pp = m_pending.begin(); pp != m_pending.end(); ++pp)
+		if (*pp*m_SectorSize < hi && (*pp + 1)*m_SectorSize > lo)
+			wanted = true;
+	if (!wanted)
+		return;
+
+	ASSERT(m_reader != NULL);
+	m_reader->finish_retries();
+	for (std::vector<__int64>::const_iterator pp = m_pending.begin(); pp != m_pending.end(); ++pp)
+	{
+		unsigned char *buf = (unsigned char *)m_Buffer + size_t(*pp*m_SectorSize - m_start);
+		if (!m_reader->read(*pp*m_SectorSize, buf, m_SectorSize) && m_reader->pending(*pp))
+			m_reader->read_sector(*pp, buf);    // being retried by another CFileNC of the device
+	}
+	m_pending.clear();
+}
+
 // Write out the "dirty" buffer
 void CFileNC::make_clean()
 {
@@ -2224,6 +2524,11 @@ void CFileNC::Close()
 {
 	if (m_dirty)
 		make_clean();  // Write out current buffer if necessary.
+	m_pending.clear();
+	delete m_reader;
+	m_reader = NULL;
+	delete m_device;   // closes the overlapped handle
+	m_device = NULL;
 	if (m_retries >= 0)
 	{
 		if ( m_FileHandle != INVALID_HANDLE_VALUE )
@@ -2241,6 +2546,51 @@ void CFileNC::Close()
 	}
 }
 
+LONGLONG CFileSnapshot::GetLength( void ) const
+{
+	return m_psnap->length(m_ver);
+}
+
+DWORD CFileSnapshot::Read( void * buffer, DWORD len )
+{
+	DWORD done = 0;                                         // Bytes copied to output buffer so far
+	std::size_t avail;
+	std::int64_t pos;
+	while (done < len && (pos = m_psnap->locate(m_ver, m_FilePos, avail)) >= 0)
+	{
+		// Read as much of the current block as we can from where it is in the store
+		if (CFile64::Seek(pos, CFile::begin) == -1)
+			break;
+		DWORD toread = DWORD(std::min<std::size_t>(avail, len - done));
+		DWORD got = CFile64::Read((char *)buffer + done, toread);
+		done += got;
+		m_FilePos += got;
+		if (got < toread)
+			break;
+	}
+	return done;
+}
+
+LONGLONG CFileSnapshot::Seek( LONGLONG offset, UINT from )
+{
+	switch (from)
+	{
+	default:
+		ASSERT(0);
+		// fall through
+	case CFile::begin:
+		m_FilePos = offset;
+		break;
+	case CFile::current:
+		m_FilePos += offset;
+		break;
+	case CFile::end:
+		m_FilePos = GetLength() + offset;
+		break;
+	}
+	return m_FilePos;
+}
+
 // TBD: TODO checks/fixes:
 // Flush allowed on FILE_FLAG_NO_BUFFERING files?
 // Make sure GetFileTitle, GetFileName, GetInformation,
@@ -4,6 +4,10 @@
 
 #include <winioctl.h>
 #include <map>
+#include <utility>
+#include <vector>
+
+class block_storage;
 
 #if ! defined( FILE_ATTRIBUTE_ENCRYPTED )
 #define FILE_ATTRIBUTE_ENCRYPTED (0x00000040)
@@ -35,6 +39,8 @@ class CFile64
       SECURITY_DESCRIPTOR * m_SecurityDescriptor_p;
 
       HANDLE m_FileHandle;
+      block_storage * m_Storage;  // Reads/writes m_FileHandle (see BlockStorage.h) or NULL if not open
+      LONGLONG m_Position;        // Current file position (as block_storage reads/writes at an address)
 
       CString m_PathName;
       CString m_FileName;
@@ -106,6 +112,9 @@ class CFile64
       virtual void                  Close( void );
       virtual CFile64 *             Duplicate( void ) const;
       virtual void                  Flush( void );
+      // Gets the parts of [start, end) that have disk space allocated - the rest are holes (of a
+      // sparse file) that read as zeroes.  Returns FALSE if not known (all should be read).
+      virtual BOOL                  GetAllocatedRanges( LONGLONG start, LONGLONG end, std::vector<std::pair<LONGLONG, LONGLONG> >& ranges ) const;
       virtual CString               GetFileName( void ) const;
       virtual CString               GetFilePath( void ) const;
       virtual CString               GetFileTitle( void ) const;
@@ -155,11 +164,21 @@ class CFile64
 // CFileNC: used to access file in non-cached (FILE_FLAG_NO_BUFFERING) mode.
 // This hides restrictions on offsets and block sizes for seek, read, write etc.
 // Volumes and physical drives must (in general) be opened non-cached.
+// If possible reads are done through a 2nd handle opened for overlapped I/O using
+// sector_reader (see SectorReader.h) so that several blocks are read at once and
+// the sectors of a block that fails are retried in the background of later reads.
+// Read() only waits for the retries when the bytes asked for include a sector still
+// being retried.  All the CFileNCs open on a device (eg the ones a document opens
+// for its background scans) share one bad sector map.
+
+class sector_device;
+class sector_reader;
 
 class CFileNC : public CFile64
 {
 public:
-	CFileNC() : CFile64() { m_Buffer = NULL; m_dirty = false; }
+	CFileNC() : CFile64() { m_Buffer = NULL; m_dirty = false; m_device = NULL; m_reader = NULL; }
+	virtual ~CFileNC();
 
 	virtual CString GetFileName( void ) const;
 	virtual CString GetFileTitle( void ) const;
@@ -191,12 +210,14 @@ public:
 		return m_FilePos = GetLength();
 	}
 
-	bool HasError() { return !m_bad.empty(); }         // returns true if at least one sector had a read error
-	DWORD Error(__int64 sec) { if (m_bad.find(sec) == m_bad.end()) return 0; else return m_bad[sec]; }  // return sector error or 0 if none
+	bool HasError();            // returns true if at least one sector had a read error
+	DWORD Error(__int64 sec);   // return sector error (ERROR_IO_PENDING while being retried) or 0 if none
 
 private:
 	void make_clean();          // Write buffer to disk (must be dirty)
 	void get_current();         // Read buffer from disk
+	void get_pending(LONGLONG lo, LONGLONG hi); // Wait for retries of sectors of the buffer in range
+	void open_async(LPCTSTR filename);  // Open 2nd handle for overlapped reads (m_device, m_reader)
 
 	LONGLONG m_FilePos;         // current file posn requested
 	DWORD m_BufferSize;         // how big is the buffer we have allocated
@@ -204,10 +225,57 @@ private:
 
 	LONGLONG m_start, m_end;	// Address range of bytes in m_Buffer
 	bool m_dirty;               // Does the current buffer have changes that need writing back?
-	std::map<__int64, DWORD> m_bad; // Bad sectors and the error they had
+	std::map<__int64, DWORD> m_bad; // Bad sectors and the error they had (if m_reader is NULL)
+
+	sector_device *m_device;    // Overlapped reads of the file/device or NULL if not available
+	sector_reader *m_reader;    // Reads using m_device (and has the bad sector map)
+	std::vector<__int64> m_pending; // Sectors in the buffer that were being retried when it was read
 
 	// Note m_retries > -1 indicates that this is a windows native API physical device
 	int m_retries;				// number of read retries on physical devices
 };
 
+///////////////////////////////////////////////////////////////////////////
+// CFileSnapshot: read-only access to one version of a file kept in a snapshot store
+// (see SnapshotStore.h).  Open() must be given the name of the store file.  Reads of the
+// version are mapped to where its blocks are in the store.
+
+class snapshot_store;
+
+class CFileSnapshot : public CFile64
+{
+public:
+	CFileSnapshot(const snapshot_store *psnap, int ver) : CFile64(), m_psnap(psnap), m_ver(ver), m_FilePos(0) { }
+
+	virtual LONGLONG GetLength( void ) const;
+	virtual DWORD Read( void * buffer, DWORD len );
+	virtual LONGLONG Seek( LONGLONG offset, UINT from );
+
+	virtual LONGLONG GetPosition( void ) const
+	{
+		return m_FilePos;
+	}
+
+	virtual void SeekToBegin( void )
+	{
+		m_FilePos = 0;
+	}
+
+	virtual LONGLONG SeekToEnd( void )
+	{
+		return m_FilePos = GetLength();
+	}
+
+	// The handle is for the store file so it says nothing about holes in the version
+	virtual BOOL GetAllocatedRanges( LONGLONG, LONGLONG, std::vector<std::pair<LONGLONG, LONGLONG> >& ) const
+	{
+		return FALSE;
+	}
+
+private:
+	const snapshot_store *m_psnap;
+	int m_ver;                  // version of the file (0 = latest, 1 = previous)
+	LONGLONG m_FilePos;         // current position in the version
+};
+
 #endif // FILE_64_CLASS_HEADER
@@ -12,6 +12,7 @@
 #include "HexEditDoc.h"
 #include "HexEditView.h"
 #include "CompareView.h"
+#include "ByteText.h"
 
 // xxx TBD
 // Testing:
@@ -293,11 +294,7 @@ void CCompareView::OnDraw(CDC* pDC)
 
 	pDC->SetBkMode(TRANSPARENT);
 
-	const char *hex;
-	if (theApp.hex_ucase_)
-		hex = "0123456789ABCDEF?";
-	else
-		hex = "0123456789abcdef?";
+	const bool upper = theApp.hex_ucase_ != 0;  // hex digits case (see ByteText.h)
 
 	CRectAp doc_rect;                           // Display area relative to whole document
 	CRect norm_rect;                            // Display area (norm. logical coords)
@@ -533,21 +530,18 @@ void CCompareView::OnDraw(CDC* pDC)
 						if (!between)
 						{
 							// Draw 2 digit number above every column
-							ss.Format(theApp.hex_ucase_ ? "%02X" : "%02x", (column + phev_->display_.addrbase1)%256);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char(column + phev_->display_.addrbase1), theApp.hex_ucase_ != 0), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else if (column%16 == 0 && theApp.ruler_hex_nums_ > 3)
 						{
 							// Draw 2 digit numbers to mark end of 16 columns
 							rect.left -= (char_width+1)/2;
-							ss.Format(theApp.hex_ucase_ ? "%02X" : "%02x", column%256);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char(column), theApp.hex_ucase_ != 0), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else
 						{
 							// Draw single digit number in between columns
-							ss.Format(theApp.hex_ucase_ ? "%1X" : "%1x", column%16);
-							pDC->DrawText(ss, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char(column%16), theApp.hex_ucase_ != 0) + 1, 1, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 					}
 				// Show hex offsets above char area or stacked display
@@ -574,19 +568,16 @@ void CCompareView::OnDraw(CDC* pDC)
 
 						if (!between)
 						{
-							ss.Format(theApp.hex_ucase_ ? "%1X" : "%1x", (column + phev_->display_.addrbase1)%16);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char((column + phev_->display_.addrbase1)%16), theApp.hex_ucase_ != 0) + 1, 1, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else if (column%16 == 0 && theApp.ruler_hex_nums_ > 3)
 						{
 							rect.left -= (char_width+1)/2;
-							ss.Format(theApp.hex_ucase_ ? "%02X" : "%02x", column%256);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char(column), theApp.hex_ucase_ != 0), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else
 						{
-							ss.Format(theApp.hex_ucase_ ? "%1X" : "%1x", column%16);
-							pDC->DrawText(ss, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char(column%16), theApp.hex_ucase_ != 0) + 1, 1, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 					}
 				vert += phev_->text_height_;  // Move down for anything to be drawn underneath
@@ -622,19 +613,16 @@ void CCompareView::OnDraw(CDC* pDC)
 						rect.right = rect.left + phev_->text_width_ + phev_->text_width_;
 						if (!between)
 						{
-							ss.Format("%02d", (column + phev_->display_.addrbase1)%100);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text((column + phev_->display_.addrbase1)%100), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else if (column%10 == 0 && theApp.ruler_dec_nums_ > 4)
 						{
 							rect.left -= (char_width+1)/2;
-							ss.Format("%02d", column%100);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text(column%100), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else
 						{
-							ss.Format("%1d", column%10);
-							pDC->DrawText(ss, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text(column%10) + 1, 1, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 					}
 				// Decimal offsets above char area or stacked display
@@ -661,21 +649,18 @@ void CCompareView::OnDraw(CDC* pDC)
 
 						if (!between)
 						{
-							ss.Format("%1d", (column + phev_->display_.addrbase1)%10);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text((column + phev_->display_.addrbase1)%10) + 1, 1, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else if (column%10 == 0 && theApp.ruler_dec_nums_ > 4)
 						{
 							// If displaying nums every 5 or 10 then display 2 digits fo tens column
 							rect.left -= (char_width+1)/2;
-							ss.Format("%02d", column%100);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text(column%100), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else
 						{
 							// Display single dit between columns
-							ss.Format("%1d", column%10);
-							pDC->DrawText(ss, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text(column%10) + 1, 1, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 					}
 				vert += phev_->text_height_;   // Move down for anything to be drawn underneath (currently nothing)
@@ -811,11 +796,9 @@ void CCompareView::OnDraw(CDC* pDC)
 			{
 				int ww = hex_width_ + 1;
 				char *addr_buf = ss.GetBuffer(24);             // reserve space for 64 bit address
-				sprintf(addr_buf,
-					theApp.hex_ucase_ ? "%0*I64X:" : "%0*I64x:",
-						hex_width_,
-						(line*phev_->rowsize_ - offset > first_addr ? line*phev_->rowsize_ - offset : first_addr) + phev_->display_.addrbase1);
-				ss.ReleaseBuffer(-1);
+				char *pp = format_hex(addr_buf, (line*phev_->rowsize_ - offset > first_addr ? line*phev_->rowsize_ - offset : first_addr) + phev_->display_.addrbase1, hex_width_, theApp.hex_ucase_ != 0);
+				*pp++ = ':';
+				ss.ReleaseBuffer(int(pp - addr_buf));
 				if (theApp.nice_addr_)
 				{
 					AddSpaces(ss);
@@ -831,11 +814,9 @@ void CCompareView::OnDraw(CDC* pDC)
 			{
 				int ww = dec_width_ + 1;
 				char *addr_buf = ss.GetBuffer(24);             // reserve space for 64 bit address
-				sprintf(addr_buf,
-						"%*I64d:",
-						dec_width_,
-						(line*phev_->rowsize_ - offset > first_addr ? line*phev_->rowsize_ - offset : first_addr) + phev_->display_.addrbase1);
-				ss.ReleaseBuffer(-1);
+				char *pp = format_dec(addr_buf, (line*phev_->rowsize_ - offset > first_addr ? line*phev_->rowsize_ - offset : first_addr) + phev_->display_.addrbase1, dec_width_);
+				*pp++ = ':';
+				ss.ReleaseBuffer(int(pp - addr_buf));
 				if (theApp.nice_addr_)
 				{
 					AddCommas(ss);
@@ -851,11 +832,9 @@ void CCompareView::OnDraw(CDC* pDC)
 			{
 				int ww = num_width_ + 1;
 				char *addr_buf = ss.GetBuffer(24);             // reserve space for 64 bit address
-				sprintf(addr_buf,
-						"%*I64d:",
-						num_width_,
-						line + phev_->display_.addrbase1);
-				ss.ReleaseBuffer(-1);
+				char *pp = format_dec(addr_buf, line + phev_->display_.addrbase1, num_width_);
+				*pp++ = ':';
+				ss.ReleaseBuffer(int(pp - addr_buf));
 				if (theApp.nice_addr_)
 				{
 					AddCommas(ss);
@@ -952,20 +931,14 @@ void CCompareView::OnDraw(CDC* pDC)
 					}
 
 					// Display the hex digits below that, one below the other
-					pDC->TextOut(posx + (jj + jj/phev_->group_by_)*char_width_w, tt.top + vert_offset,   &hex[(buf[jj]>>4)&0xF], 1);
-					pDC->TextOut(posx + (jj + jj/phev_->group_by_)*char_width_w, tt.top + vert_offset*2, &hex[buf[jj]&0xF], 1);
+					pDC->TextOut(posx + (jj + jj/phev_->group_by_)*char_width_w, tt.top + vert_offset,   hex_text(buf[jj], upper), 1);
+					pDC->TextOut(posx + (jj + jj/phev_->group_by_)*char_width_w, tt.top + vert_offset*2, hex_text(buf[jj], upper) + 1, 1);
 				}
 				else
 				{
-					char hh[2];
-
-					// Create hex digits and display them
-					hh[0] = hex[(buf[jj]>>4)&0xF];
-					hh[1] = hex[buf[jj]&0xF];
-
 					// This actually displays the bytes (in hex)!
 					// Note: removed calcs that were previously encapsulated in hex_pos
-					pDC->TextOut(posx + (jj*3 + jj/phev_->group_by_)*char_width, tt.top, hh, 2);
+					pDC->TextOut(posx + (jj*3 + jj/phev_->group_by_)*char_width, tt.top, hex_text(buf[jj], upper), 2);
 				}
 			}
 		}
@@ -1469,11 +1442,8 @@ void CCompareView::draw_deletions(CDC* pDC, const std::vector<FILE_ADDRESS> & ad
 	COLORREF prev_col = pDC->SetTextColor(phev_->bg_col_);  // so digit or * is visible on coloured background
 
 	int ii;
-	// Skip blocks above the top of the display area
-	// [This needs to be a binary search in case we get a large number of compare diffs]
-	for (ii = 0; ii < addr.size(); ++ii)
-		if (addr[ii] >= first_virt)
-			break;
+	// Skip blocks above the top of the display area (binary search as there may be a huge number of diffs)
+	ii = int(std::lower_bound(addr.begin(), addr.end(), first_virt) - addr.begin());
 
 	for ( ; ii < addr.size(); ++ii)
 	{
@@ -1537,11 +1507,11 @@ void CCompareView::draw_backgrounds(CDC* pDC,
 	int ii;
 	if (!ScrollUp())
 	{
-		// Skip blocks above the top of the display area
-		// [This needs to be a binary search in case we get a large number of compare diffs]
-		for (ii = 0; ii < addr.size(); ++ii)
-			if (addr[ii] + len[ii] > first_virt)
-				break;
+		// Skip blocks above the top of the display area.  The blocks don't overlap so only
+		// the one before the first that starts after first_virt can extend into the display.
+		ii = int(std::upper_bound(addr.begin(), addr.end(), first_virt) - addr.begin());
+		if (ii > 0 && addr[ii - 1] + len[ii - 1] > first_virt)
+			--ii;
 
 		for ( ; ii < addr.size(); ++ii)
 		{
@@ -1559,10 +1529,7 @@ void CCompareView::draw_backgrounds(CDC* pDC,
 	else
 	{
 		// Starting at end skip blocks below the display area
-		// [This needs to be a binary search in case we get a large number of compare diffs]
-		for (ii = addr.size() - 1; ii >= 0; ii--)
-			if (addr[ii] < last_virt)
-				break;
+		ii = int(std::lower_bound(addr.begin(), addr.end(), last_virt) - addr.begin()) - 1;
 
 		for ( ; ii >= 0; ii--)
 		{
@@ -30,6 +30,7 @@
 #include "DFFDMisc.h"
 #include "TParser.h"
 #include "TParseDlg.h"
+#include "Serialization/TableExporter.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -68,6 +69,7 @@ void CGridCtrl2::OnBeginDrag()
 	if (row >= frc)
 	{
 		ASSERT(pdoc_ != NULL);
+		CTemplateLock tl(pdoc_);                // the template thread may be adding elements
 
 		// Make sure only one row of the tree is selected
 		if (sel.GetMinRow() != sel.GetMaxRow())
@@ -109,6 +111,7 @@ void CGridCtrl2::OnBeginDrag()
 		if (pdoc_->df_type_[row-frc] == CHexEditDoc::DF_DEFINE_STRUCT)
 		{
 			// If dragging a "define_struct" just allow it to be copied
+			tl.Unlock();
 			ods.DoDragDrop(DROPEFFECT_COPY);
 		}
 		else
@@ -167,7 +170,10 @@ void CGridCtrl2::OnBeginDrag()
 			}
 			ASSERT(allowed_de != 0);
 
-			if (ods.DoDragDrop(allowed_de) == DROPEFFECT_MOVE)
+			tl.Unlock();                        // don't hold up the scan while dragging
+			DROPEFFECT de = ods.DoDragDrop(allowed_de);
+			tl.Lock();
+			if (de == DROPEFFECT_MOVE)
 			{
 				// Drag and drop completed now and move requested so remove source
 				ASSERT(children > 1 &&
@@ -207,6 +213,7 @@ DROPEFFECT CGridCtrl2::OnDragOver(COleDataObject* pDataObject, DWORD dwKeyState,
 	if (cell.row >= frc && cell.col == fcc)
 	{
 		ASSERT(pdoc_ != NULL);
+		CTemplateLock tl(pdoc_);
 
 #if 0  // Drop hilighting does not restore the background colour properly
 		// Remove drop highlight for last cell
@@ -294,6 +301,7 @@ DROPEFFECT CGridCtrl2::OnDragEnter(COleDataObject* pDataObject, DWORD dwKeyState
 	if (cell.row >= frc && cell.col == fcc)
 	{
 		ASSERT(pdoc_ != NULL);
+		CTemplateLock tl(pdoc_);
 
 		// If not a valid drop target then disable
 		if ((pdoc_->df_type_[cell.row-frc] != CHexEditDoc::DF_STRUCT && 
@@ -361,6 +369,7 @@ BOOL CGridCtrl2::OnDrop(COleDataObject* pDataObject, DROPEFFECT de, CPoint point
 	if (m_LastDragOverCell.row >= frc && m_LastDragOverCell.col == fcc)
 	{
 		ASSERT(pdoc_ != NULL);
+		CTemplateLock tl(pdoc_);
 
 		// If not a valid drop target then cancel drop
 		if ((pdoc_->df_type_[m_LastDragOverCell.row-frc] != CHexEditDoc::DF_STRUCT && 
@@ -545,6 +554,9 @@ BOOL CGridCtrl2::PreTranslateMessage(MSG* pMsg)
 		IsValid(m_idCurrentCell) && 
 		m_idCurrentCell.col == GetFixedColumnCount())
 	{
+		ASSERT(pdoc_ != NULL);
+		CTemplateLock tl(pdoc_);
+
 		// Note: we had to do this here instead of OnKeyDown as some of these keys are accelerators
 		// (eg '+' key) and invoke commands (eg inc byte) so we never get to see the WM_KEYDOWN message.
 		switch (pMsg->wParam)
@@ -669,6 +681,9 @@ CDataFormatView::CDataFormatView()
 	tree_init_ = false;
 	phev_ = NULL;
 	edit_row_type_changed_ = -1;
+	rows_done_ = 0;
+	consec_count_ = 0;
+	past_defns_ = false;
 }
 
 CDataFormatView::~CDataFormatView()
@@ -728,10 +743,7 @@ void CDataFormatView::InitTree()
 	}
 
 	CWaitCursor wait;
-
-	// Init progress bar
-	CMainFrame *mm = (CMainFrame *)AfxGetMainWnd();
-	clock_t last_checked = clock();
+	CTemplateLock tl(pdoc);                  // Template may still be being scanned (see BGTemplate.cpp)
 
 	// Make the default cell height zero while the tree is built, otherwise TreeDisplayOutline(1)
 	// tries to call SetRowHeight to hide most of the rows.  This results in ResetScrollBars()
@@ -740,43 +752,113 @@ void CDataFormatView::InitTree()
 	default_height_ = pdefault_cell->GetHeight();
 	pdefault_cell->SetHeight(0);
 
-	tree_col_.TreeSetup(&grid_, grid_.GetFixedColumnCount(), pdoc->df_indent_.size(), 1, &pdoc->df_indent_[0], TRUE, FALSE);
+	tree_col_.TreeSetup(&grid_, grid_.GetFixedColumnCount(), pdoc->df_indent_.size(), 1,
+						pdoc->df_indent_.empty() ? NULL : &pdoc->df_indent_[0], TRUE, FALSE);
 	tree_col_.TreeDisplayOutline(1);
 
+	// Fill the tree/grid with info about each element
+	rows_done_ = 0;
+	consec_count_ = 0;
+	for_name_.clear();
+	for_count_.clear();
+	past_defns_ = false;
+	parents_.clear();
+	add_rows();
+
+	if (!pdoc->TemplateScanning())
+		((CMainFrame *)AfxGetMainWnd())->Progress(-1);
+
+	// Set default cell height back to what it was before we set it to zero (above).
+	pdefault_cell->SetHeight(default_height_);
+
+	// This just display the top level folder row (& perhaps extra data past expected EOF row)
+#if 0
+	tree_col_.TreeDisplayOutline(1);
+#else
+	tree_col_.TreeRefreshRows();
+#endif
+	//    tree_col_.SetTreeLineColor(RGB(0x80, 0x80, 0x80) );
+
+	tree_init_ = true;
+}
+
+// Fills in the grid rows for all elements after those already done (rows_done_).  This is
+// called from InitTree and, if the template is being scanned in the background, whenever
+// more elements become available (see CDFFDPartialHint).  The caller must lock df_lock_.
+void CDataFormatView::add_rows()
+{
+	CHexEditDoc *pdoc = GetDocument();
+	int first = int(rows_done_);
+	if (first >= (int)pdoc->df_type_.size())
+		return;
+
+	COLORREF bg1, bg2, bg3;
+	calc_colours(bg1, bg2, bg3);
+
+	// Init progress bar
+	CMainFrame *mm = (CMainFrame *)AfxGetMainWnd();
+	clock_t last_checked = clock();
+
+	int fcr = grid_.GetFixedRowCount();
+	bool append = grid_.GetRowCount() - fcr < (int)pdoc->df_type_.size();
+	if (append)
+		tree_col_.InsertTreeBranch(&pdoc->df_indent_[first], int(pdoc->df_type_.size()) - first, -1, FALSE);
+
+	// Rows can be added to a branch (eg elements of an array) that is already shown, so each
+	// appended row is shown if its parent is shown and expanded (ie its first child is shown).
+	// The first child of a row starts collapsed, except for the children of the root.
+	for (int ii = first; ii < (int)pdoc->df_type_.size(); ++ii)
+	{
+		while (!parents_.empty() && pdoc->df_indent_[parents_.back()] >= pdoc->df_indent_[ii])
+			parents_.pop_back();
+		if (append && !parents_.empty())
+		{
+			int pp = parents_.back();
+			bool show = tree_col_.IsTreeRowDisplayed(fcr + pp) &&
+			            (pp + 1 < ii ? tree_col_.IsTreeRowDisplayed(fcr + pp + 1) : pdoc->df_indent_[pp] <= 1);
+			tree_col_.TreeDataPrepOutline(show ? 0x80 : 1, ii, 1);  // (level 1 hides all but the root)
+		}
+		parents_.push_back(ii);
+	}
+	if (append)
+		tree_col_.TreeRefreshRows();
+
 	GV_ITEM item;
 #if _MSC_VER >= 1300
 	GV_ITEMW itemw;
 	itemw.nState = 0;
 	itemw.crFgClr = phev_->GetDefaultTextCol();
 #endif
-	// Fill the tree/grid with info about each element
 //    item.nState = GVIS_READONLY;      // Whether or not editing is allowed is now handled by OnGridBeginLabelEdit
 	item.nState = 0;
 
-	// Set colour of top tree cell - sets colour for whole tree column
-	item.row = grid_.GetFixedRowCount();
-	item.col = grid_.GetFixedColumnCount();
-	item.mask = GVIF_BKCLR|GVIF_FGCLR;  // Just changing fg and bg colours
-	item.crBkClr = bg1;
-	item.crFgClr = phev_->GetDefaultTextCol();
-	grid_.SetItem(&item);
+	if (first == 0)
+	{
+		// Set colour of top tree cell - sets colour for whole tree column
+		item.row = fcr;
+		item.col = grid_.GetFixedColumnCount();
+		item.mask = GVIF_BKCLR|GVIF_FGCLR;  // Just changing fg and bg colours
+		item.crBkClr = bg1;
+		item.crFgClr = phev_->GetDefaultTextCol();
+		grid_.SetItem(&item);
+	}
 
 	char disp[128];                     // Holds output of sprintf
-	int consec_count = 0;               // Counts consecutive data lines so we can paint backgrounds
 
 	// These are used to work out element names for array elements
-	std::vector<CString> for_name(size_t(pdoc->max_indent_+1));
-	std::vector<int>     for_count(size_t(pdoc->max_indent_+1));
+	if (for_name_.size() < size_t(pdoc->max_indent_+1))
+	{
+		for_name_.resize(size_t(pdoc->max_indent_+1));
+		for_count_.resize(size_t(pdoc->max_indent_+1));
+	}
 
 	ASSERT(pdoc->df_type_.size() == pdoc->df_elt_.size());
 	ASSERT(pdoc->df_indent_.size() == pdoc->df_elt_.size());
 
-	bool past_defns = false;           // Signals that past struct defns - so we can show greyed rows
-
-	for (int ii = 0; ii < (int)pdoc->df_type_.size(); ++ii)
+	for (int ii = first; ii < (int)pdoc->df_type_.size(); ++ii)
 	{
 		if (pdoc->df_indent_[ii] == 2 && pdoc->df_type_[ii] != CHexEditDoc::DF_DEFINE_STRUCT)
-			past_defns = true;
+			past_defns_ = true;
 
 		// Set row of cells that we are modifying
 		item.row = ii + grid_.GetFixedRowCount();
@@ -795,13 +877,13 @@ void CDataFormatView::InitTree()
 		// Give data rows alternating background colours
 		if (abs(pdoc->df_type_[ii]) < CHexEditDoc::DF_DATA)
 		{
-			consec_count = 0;
+			consec_count_ = 0;
 			item.crBkClr = bg1;  // Non-data row has normal background colour
 #if _MSC_VER >= 1300
 			itemw.crBkClr = bg1;  // Non-data row has normal background colour
 #endif
 		}
-		else if (++consec_count%2 == 1)
+		else if (++consec_count_%2 == 1)
 		{
 			item.crBkClr = bg2;
 #if _MSC_VER >= 1300
@@ -818,17 +900,17 @@ void CDataFormatView::InitTree()
 
 		if (ii > 0)
 		{
-			for_count[pdoc->df_indent_[ii]] = 0;
+			for_count_[pdoc->df_indent_[ii]] = 0;
 			// Work out names of array elements if nec.
 			if (pdoc->df_type_[ii] != CHexEditDoc::DF_FORF && pdoc->df_type_[ii] != CHexEditDoc::DF_FORV)
-				for_name[pdoc->df_indent_[ii]] = CString("");
-			else if (for_name[pdoc->df_indent_[ii]-1].IsEmpty())
-				for_name[pdoc->df_indent_[ii]] = pdoc->df_elt_[ii].GetAttr("name");
+				for_name_[pdoc->df_indent_[ii]] = CString("");
+			else if (for_name_[pdoc->df_indent_[ii]-1].IsEmpty())
+				for_name_[pdoc->df_indent_[ii]] = pdoc->df_elt_[ii].GetAttr("name");
 			else
-				for_name[pdoc->df_indent_[ii]].Format("%s[%d]", for_name[pdoc->df_indent_[ii]-1], for_count[pdoc->df_indent_[ii]-1]);
+				for_name_[pdoc->df_indent_[ii]].Format("%s[%d]", for_name_[pdoc->df_indent_[ii]-1], for_count_[pdoc->df_indent_[ii]-1]);
 
-			if (!for_name[pdoc->df_indent_[ii]-1].IsEmpty())
-				++for_count[pdoc->df_indent_[ii]-1];
+			if (!for_name_[pdoc->df_indent_[ii]-1].IsEmpty())
+				++for_count_[pdoc->df_indent_[ii]-1];
 		}
 
 		for (item.col = grid_.GetFixedColumnCount(); item.col < grid_.GetColumnCount(); ++item.col)
@@ -852,14 +934,14 @@ void CDataFormatView::InitTree()
 #else
 				item.mask = GVIF_STATE|GVIF_FORMAT|GVIF_IMAGE|GVIF_TEXT;
 #endif
-				if (!for_name[pdoc->df_indent_[ii]].IsEmpty())
-					item.strText = for_name[pdoc->df_indent_[ii]];
-				else if (for_name[pdoc->df_indent_[ii]-1].IsEmpty())
+				if (!for_name_[pdoc->df_indent_[ii]].IsEmpty())
+					item.strText = for_name_[pdoc->df_indent_[ii]];
+				else if (for_name_[pdoc->df_indent_[ii]-1].IsEmpty())
 					item.strText = pdoc->df_elt_[ii].GetAttr("name");
 				else
 					item.strText.Format("%s[%d]",
-										for_name[pdoc->df_indent_[ii]-1],
-										for_count[pdoc->df_indent_[ii]-1]-1 );
+										for_name_[pdoc->df_indent_[ii]-1],
+										for_count_[pdoc->df_indent_[ii]-1]-1 );
 				ASSERT(ii == 0 || item.strText == get_name(ii));
 #if _MSC_VER >= 1300
 				// Init cell of tree column (InitTree) then expand tree to display the row if
@@ -867,10 +949,10 @@ void CDataFormatView::InitTree()
 				// - address is -1 which indicates that the element is not present (eg past EOF, non-taken IF etc)
 				// - AND if we are past the struct defns at the start (since they have address -1 ??)
 				itemw.strText = item.strText;   // Copy string to wide string
-				if ((InitTreeCol(ii, itemw) || pdoc->df_address_[ii] == -1) && past_defns)
+				if ((InitTreeCol(ii, itemw) || pdoc->df_address_[ii] == -1) && past_defns_)
 					show_row(ii);
 #else
-				if ((InitTreeCol(ii, item) || pdoc->df_address_[ii] == -1) && past_defns)
+				if ((InitTreeCol(ii, item) || pdoc->df_address_[ii] == -1) && past_defns_)
 					show_row(ii);
 #endif
 				break;
@@ -1195,28 +1277,65 @@ void CDataFormatView::InitTree()
 #endif
 		}
 
-		// Update scan progress no more than once every 5 seconds
-		if (double(clock() - last_checked)/CLOCKS_PER_SEC > 5)
+		// Update scan progress no more than once every 5 seconds (unless showing template scan progress)
+		if (!pdoc->TemplateScanning() && double(clock() - last_checked)/CLOCKS_PER_SEC > 5)
 		{
 			mm->Progress(int((ii*100)/pdoc->df_type_.size()));
 			last_checked = clock();
 		}
 	}
+	rows_done_ = pdoc->df_type_.size();
+}
 
-	mm->Progress(-1);
+// Updates the data column and tree column image (which shows if the value is invalid) for
+// the specified elements.  This is used after bytes of the file have been replaced that
+// do not change the layout of the tree (see CHexEditDoc::ScanDirty) so that we don't need
+// to rebuild the whole grid with InitTree().
+void CDataFormatView::refresh_rows(const std::vector<size_t> &elts)
+{
+	CHexEditDoc *pdoc = GetDocument();
+	if (!tree_init_ || pdoc == NULL)
+		return;
 
-	// Set default cell height back to what it was before we set it to zero (above).
-	pdefault_cell->SetHeight(default_height_);
+	for (std::vector<size_t>::const_iterator pe = elts.begin(); pe != elts.end(); ++pe)
+	{
+		int ii = int(*pe);
+		int row = ii + grid_.GetFixedRowCount();
+		ASSERT(ii < (int)pdoc->df_type_.size());
+		if (row >= grid_.GetRowCount() || abs(pdoc->df_type_[ii]) < CHexEditDoc::DF_DATA)
+			continue;
 
-	// This just display the top level folder row (& perhaps extra data past expected EOF row)
-#if 0
-	tree_col_.TreeDisplayOutline(1);
+		for (int col = grid_.GetFixedColumnCount(); col < grid_.GetColumnCount(); ++col)
+		{
+#if _MSC_VER >= 1300
+			GV_ITEMW item;
 #else
-	tree_col_.TreeRefreshRows();
+			GV_ITEM item;
 #endif
-	//    tree_col_.SetTreeLineColor(RGB(0x80, 0x80, 0x80) );
+			item.row = row;
+			item.col = col;
+			item.nState = 0;
 
-	tree_init_ = true;
+			switch (grid_.GetItemData(0, col))
+			{
+			case COL_TREE:
+				// The name of a data element does not change, just the image
+				if (InitTreeCol(ii, item))
+					show_row(ii);
+				grid_.SetItemImage(row, col, item.iImage);
+				break;
+			case COL_DATA:
+				item.mask = GVIF_STATE|GVIF_FORMAT|GVIF_TEXT|GVIF_BKCLR|GVIF_FGCLR;
+				item.nFormat = DT_RIGHT|DT_VCENTER|DT_SINGLELINE|DT_END_ELLIPSIS;
+				item.crBkClr = grid_.GetItemBkColour(row, col);
+				item.crFgClr = phev_->GetDefaultTextCol();
+				InitDataCol(ii, item);
+				grid_.SetItem(&item);
+				break;
+			}
+		}
+		grid_.RedrawRow(row);
+	}
 }
 
 #if 0
@@ -3143,6 +3262,7 @@ void CDataFormatView::SelectAt(FILE_ADDRESS addr)
 {
 	if (!tree_init_) return;
 
+	CTemplateLock tl(GetDocument());
 	size_t elt =  GetDocument()->FindDffdEltAt(addr);
 
 	// How could this happen?
@@ -3170,6 +3290,8 @@ BOOL CDataFormatView::ReadOnly(FILE_ADDRESS addr, FILE_ADDRESS end_addr /*=-1*/)
 	if (!tree_init_)
 		return FALSE;                   // If no template then we can write to any byte
 
+	CTemplateLock tl(pdoc);
+
 	if (pdoc->df_type_.size() == 0)
 	{
 		ASSERT(0);
@@ -3246,6 +3368,49 @@ void CDataFormatView::expand_all(int row)
 	grid_.EnsureVisible(frc + row, 0);
 }
 
+// Export the elements of an array (FOR) as rows of a CSV or columnar (.hxcol) file
+void CDataFormatView::export_table(int row)
+{
+	CHexEditDoc *pdoc = GetDocument();
+	CString name;
+	{
+		CTemplateLock tl(pdoc);
+		ASSERT(pdoc != NULL && row < (int)pdoc->df_type_.size());
+		name = pdoc->df_elt_[row].GetAttr("name");
+	}
+	if (name.IsEmpty())
+		name = "table";
+	CHexFileDialog dlgFile("TableExportFileDlg", HIDD_FILE_SAVE, FALSE, "csv", name + ".csv",
+						   OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT | OFN_SHOWHELP | OFN_NOCHANGEDIR,
+						   "CSV files (*.csv)|*.csv|Columnar files (*.hxcol)|*.hxcol|All Files (*.*)|*.*||");
+	dlgFile.m_ofn.lpstrTitle = "Export Table";
+	if (dlgFile.DoModal() != IDOK)
+		return;
+
+	std::unique_ptr<CFile> pfile(new CFile);
+	CFileException fe;
+	if (!pfile->Open(dlgFile.GetPathName(), CFile::modeCreate | CFile::modeWrite | CFile::shareExclusive | CFile::typeBinary, &fe))
+	{
+		TaskMessageBox("Export Error", ::FileErrorMessage(&fe, CFile::modeWrite));
+		return;
+	}
+
+	std::unique_ptr<hex::TableExporter> exporter;
+	if (dlgFile.GetFileExt().CompareNoCase("hxcol") == 0)
+		exporter.reset(new hex::ColumnarTableExporter(std::move(pfile)));
+	else
+		exporter.reset(new hex::CsvTableExporter(std::move(pfile)));
+
+	CWaitCursor wc;
+	if (!pdoc->ExportTemplateTable(row, *exporter))
+	{
+		CString mess = exporter->Error();
+		if (mess.IsEmpty())
+			mess = "There are no data elements in this array to export.";
+		TaskMessageBox("Export Error", mess);
+	}
+}
+
 // Expand to show children (ie one level only) - returns false if already expanded
 bool CDataFormatView::expand_one(int row)
 {
@@ -3436,7 +3601,9 @@ void CDataFormatView::save_tree_state()
 	std::vector<bool> curr_done;        // Prevents more than one sibling being added (if one is viewable then all are)
 	int curr = 0;                       // Current indent level
 
-	for (int ii = 0; ii < (int)pdoc->df_indent_.size() && pdoc->df_type_[ii] != CHexEditDoc::DF_EXTRA; ++ii)
+	// Note that the grid may not have rows for all elements (yet) if the template was scanned in the background
+	int rows = grid_.GetRowCount() - grid_.GetFixedRowCount();
+	for (int ii = 0; ii < (int)pdoc->df_indent_.size() && ii < rows && pdoc->df_type_[ii] != CHexEditDoc::DF_EXTRA; ++ii)
 	{
 		CGridTreeCell* pGridTreeCell = (CGridTreeCell*)grid_.
 			GetCell(ii + grid_.GetFixedRowCount(), grid_.GetFixedColumnCount());
@@ -3757,6 +3924,8 @@ void CDataFormatView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 {
 	if (GetDocument()->ptree_ == NULL) return;
 
+	CTemplateLock tl(GetDocument());        // in case the template thread is scanning
+
 	if (pHint != NULL && pHint->IsKindOf(RUNTIME_CLASS(CSaveStateHint)))
 	{
 		save_tree_state();
@@ -3765,6 +3934,18 @@ void CDataFormatView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 	{
 		restore_tree_state();
 	}
+	else if (pHint != NULL && pHint->IsKindOf(RUNTIME_CLASS(CDFFDValueHint)))
+	{
+		// Some values have changed but the tree is the same
+		refresh_rows(dynamic_cast<CDFFDValueHint *>(pHint)->elts_);
+	}
+	else if (pHint != NULL && pHint->IsKindOf(RUNTIME_CLASS(CDFFDPartialHint)))
+	{
+		// More elements are available from the background template scan
+		ASSERT(dynamic_cast<CDFFDPartialHint *>(pHint)->avail_ == GetDocument()->df_type_.size());
+		if (tree_init_)
+			add_rows();
+	}
 	else if (pHint != NULL && pHint->IsKindOf(RUNTIME_CLASS(CDFFDHint)))
 	{
 		// Selected DFFD has changed
@@ -3848,8 +4029,12 @@ void CDataFormatView::OnDffdSync()
 	int row = sel.GetMinRow();
 
 	// Work out the file address of this element
-	FILE_ADDRESS start = pdoc->df_address_[row-frc];
-	FILE_ADDRESS end = pdoc->df_address_[row-frc] + mac_abs(pdoc->df_size_[row-frc]);
+	FILE_ADDRESS start, end;
+	{
+		CTemplateLock tl(pdoc);
+		start = pdoc->df_address_[row-frc];
+		end = pdoc->df_address_[row-frc] + mac_abs(pdoc->df_size_[row-frc]);
+	}
 
 	if (start < 0 || start > pdoc->length())
 	{
@@ -3879,11 +4064,16 @@ void CDataFormatView::OnUpdateDffdSync(CCmdUI* pCmdUI)
 void CDataFormatView::OnDffdWeb()
 {
 	CHexEditDoc *pdoc = GetDocument();
-
-	if (pdoc == NULL || pdoc->df_elt_.size() < 1)
+	if (pdoc == NULL)
 		return;
 
-	CString ss = pdoc->df_elt_[0].GetAttr("web_site");
+	CString ss;
+	{
+		CTemplateLock tl(pdoc);
+		if (pdoc->df_elt_.size() < 1)
+			return;
+		ss = pdoc->df_elt_[0].GetAttr("web_site");
+	}
 	if (ss.IsEmpty())
 		return;
 	else if (ss.Left(7) != "http://")
@@ -3895,9 +4085,14 @@ void CDataFormatView::OnDffdWeb()
 void CDataFormatView::OnUpdateDffdWeb(CCmdUI* pCmdUI)
 {
 	CHexEditDoc *pdoc = GetDocument();
+	if (pdoc == NULL)
+	{
+		pCmdUI->Enable(FALSE);
+		return;
+	}
 
-	pCmdUI->Enable(pdoc != NULL && 
-				   pdoc->df_elt_.size() > 0 &&
+	CTemplateLock tl(pdoc);
+	pCmdUI->Enable(pdoc->df_elt_.size() > 0 &&
 				   !pdoc->df_elt_[0].GetAttr("web_site").IsEmpty());
 }
 
@@ -3923,6 +4118,7 @@ void CDataFormatView::OnGridDoubleClick(NMHDR *pNotifyStruct, LRESULT* /*pResult
 	{
 		int index = pItem->iRow - grid_.GetFixedRowCount();
 		CHexEditDoc *pdoc = GetDocument();
+		CTemplateLock tl(pdoc);
 		ASSERT(index >= 0 && index < (int)pdoc->df_type_.size());
 		ASSERT(pdoc->df_type_.size() == pdoc->df_indent_.size());
 
@@ -3934,6 +4130,7 @@ void CDataFormatView::OnGridDoubleClick(NMHDR *pNotifyStruct, LRESULT* /*pResult
 		else if (!pdoc->DffdEditMode())
 		{
 			// Double-click on data element (not in edit mode) jumps to the data (requested by Member 4289613 on CodeProject)
+			tl.Unlock();                // OnDffdSync may display a message
 			OnDffdSync();
 		}
 		else if (pdoc->df_type_[index] != CHexEditDoc::DF_MORE && pdoc->df_type_[index] != CHexEditDoc::DF_EXTRA)
@@ -4022,6 +4219,7 @@ void CDataFormatView::OnGridRClick(NMHDR *pNotifyStruct, LRESULT* /*pResult*/)
 	{
 		int item = -1;
 		CHexEditDoc *pdoc = GetDocument();
+		CTemplateLock tl(pdoc);
 		int index = pItem->iRow - grid_.GetFixedRowCount();
 		ASSERT(index >= 0 && index < (int)pdoc->df_type_.size());
 		ASSERT(pdoc->df_type_.size() == pdoc->df_indent_.size());
@@ -4036,6 +4234,16 @@ void CDataFormatView::OnGridRClick(NMHDR *pNotifyStruct, LRESULT* /*pResult*/)
 		ASSERT(ok);
 		if (!ok) return;
 
+		// Let the template thread carry on while the menu is displayed
+		auto track = [&](CMenu *pm)
+		{
+			tl.Unlock();
+			int retval = pm->TrackPopupMenu(TPM_LEFTALIGN | TPM_RIGHTBUTTON | TPM_NONOTIFY | TPM_RETURNCMD,
+											mouse_pt.x, mouse_pt.y, this);
+			tl.Lock();
+			return retval;
+		};
+
 		signed char parent_type;        // The type of parent affects the behaviour of the dialog
 		if (!pdoc->DffdEditMode() && pdoc->df_type_[index] == CHexEditDoc::DF_FILE)
 		{
@@ -4046,8 +4254,7 @@ void CDataFormatView::OnGridRClick(NMHDR *pNotifyStruct, LRESULT* /*pResult*/)
 
 			ASSERT(ppop != NULL);
 			if (ppop != NULL)
-				item = ppop->TrackPopupMenu(TPM_LEFTALIGN | TPM_RIGHTBUTTON | TPM_NONOTIFY | TPM_RETURNCMD,
-											mouse_pt.x, mouse_pt.y, this);
+				item = track(ppop);
 		}
 		else if (!pdoc->DffdEditMode() && pdoc->df_type_[index] < CHexEditDoc::DF_LEAF1)
 		{
@@ -4058,8 +4265,15 @@ void CDataFormatView::OnGridRClick(NMHDR *pNotifyStruct, LRESULT* /*pResult*/)
 
 			ASSERT(ppop != NULL);
 			if (ppop != NULL)
-				item = ppop->TrackPopupMenu(TPM_LEFTALIGN | TPM_RIGHTBUTTON | TPM_NONOTIFY | TPM_RETURNCMD,
-											mouse_pt.x, mouse_pt.y, this);
+			{
+				// Only arrays can be exported as a table (and only when the scan is complete)
+				if ((pdoc->df_type_[index] != CHexEditDoc::DF_FORF && pdoc->df_type_[index] != CHexEditDoc::DF_FORV) ||
+					pdoc->df_address_[index] == -1 || pdoc->TemplateScanning())
+				{
+					ppop->EnableMenuItem(ID_DFFD_EXPORT, MF_BYCOMMAND | MF_GRAYED);
+				}
+				item = track(ppop);
+			}
 		}
 		else if (!pdoc->DffdEditMode())
 		{
@@ -4080,8 +4294,7 @@ void CDataFormatView::OnGridRClick(NMHDR *pNotifyStruct, LRESULT* /*pResult*/)
 
 			ASSERT(ppop != NULL);
 			if (ppop != NULL)
-				item = ppop->TrackPopupMenu(TPM_LEFTALIGN | TPM_RIGHTBUTTON | TPM_NONOTIFY | TPM_RETURNCMD,
-											mouse_pt.x, mouse_pt.y, this);
+				item = track(ppop);
 		}
 		else if (pdoc->df_type_[index] == CHexEditDoc::DF_DEFINE_STRUCT)
 		{
@@ -4095,8 +4308,7 @@ void CDataFormatView::OnGridRClick(NMHDR *pNotifyStruct, LRESULT* /*pResult*/)
 
 			ASSERT(ppop != NULL);
 			if (ppop != NULL)
-				item = ppop->TrackPopupMenu(TPM_LEFTALIGN | TPM_RIGHTBUTTON | TPM_NONOTIFY | TPM_RETURNCMD,
-											mouse_pt.x, mouse_pt.y, this);
+				item = track(ppop);
 		}
 		else
 		{
@@ -4134,9 +4346,7 @@ void CDataFormatView::OnGridRClick(NMHDR *pNotifyStruct, LRESULT* /*pResult*/)
 						ppop->EnableMenuItem(ID_DFFD_DELETE, MF_BYCOMMAND | MF_GRAYED);
 					if (pdoc->df_type_[index] >= CHexEditDoc::DF_LEAF1)
 						ppop->EnableMenuItem(ID_DFFD_EXPANDALL, MF_BYCOMMAND | MF_GRAYED);
-					item = ppop->TrackPopupMenu(TPM_LEFTALIGN | TPM_RIGHTBUTTON | TPM_NONOTIFY | TPM_RETURNCMD,
-//                                                (rct.left+rct.right)/2, (rct.top+rct.bottom)/2, this);
-												mouse_pt.x, mouse_pt.y, this);
+					item = track(ppop);
 				}
 				break;
 
@@ -4157,9 +4367,7 @@ void CDataFormatView::OnGridRClick(NMHDR *pNotifyStruct, LRESULT* /*pResult*/)
 				{
 					if (pdoc->df_type_[index] >= CHexEditDoc::DF_LEAF1)
 						ppop->EnableMenuItem(ID_DFFD_EXPANDALL, MF_BYCOMMAND | MF_GRAYED);
-					item = ppop->TrackPopupMenu(TPM_LEFTALIGN | TPM_RIGHTBUTTON | TPM_NONOTIFY | TPM_RETURNCMD,
-//                                                (rct.left+rct.right)/2, (rct.top+rct.bottom)/2, this);
-												mouse_pt.x, mouse_pt.y, this);
+					item = track(ppop);
 				}
 				break;
 
@@ -4171,11 +4379,17 @@ void CDataFormatView::OnGridRClick(NMHDR *pNotifyStruct, LRESULT* /*pResult*/)
 
 		top.DestroyMenu();
 
+		// The lock is kept for the template editing commands below as the template is
+		// not scanned in the background in edit mode (see ScanFileBG).
 		switch (item)
 		{
 		case ID_DFFD_EXPANDALL:
 			expand_all(index);
 			break;
+		case ID_DFFD_EXPORT:
+			tl.Unlock();                // export_table shows dialogs and locks when it needs to
+			export_table(index);
+			break;
 		case ID_DFFD_EDIT_MODE:
 			{
 				pdoc->SetDffdEditMode(TRUE);
@@ -4383,6 +4597,7 @@ void CDataFormatView::OnGridEndSelChange(NMHDR *pNotifyStruct, LRESULT* /*pResul
 		return;                         // Don't do anything for header rows
 
 	CHexEditDoc *pdoc = GetDocument();
+	CTemplateLock tl(pdoc);
 
 	int ii = pItem->iRow - grid_.GetFixedRowCount();
 
@@ -4416,6 +4631,7 @@ void CDataFormatView::OnGridBeginLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResul
 	if (pItem->iRow == 0 && pItem->iColumn == grid_.GetFixedColumnCount())
 		return;   // This is OK - allow selection of template using drop down list
 
+	CTemplateLock tl(pdoc);                 // released while message boxes are shown
 	int ii = pItem->iRow - grid_.GetFixedRowCount();   // index into arrays
 	signed char df_type;
 	ASSERT(ii < (int)pdoc->df_type_.size());
@@ -4440,6 +4656,7 @@ void CDataFormatView::OnGridBeginLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResul
 	if (read_only_str.CompareNoCase("true") == 0)
 	{
 		// This may be unexpected so tell the user what happened
+		tl.Unlock();
 		TaskMessageBox("Field is read only",
 			"This field cannot be modified - see the \"read_only\" attribute for this field.");
 		*pResult = -1;
@@ -4826,6 +5043,7 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 	}
 
 	CHexEditDoc *pdoc = GetDocument();
+	CTemplateLock tl(pdoc);                 // released while message boxes are shown
 	int ii = pItem->iRow - grid_.GetFixedRowCount();   // index into arrays
 	ASSERT(ii < (int)pdoc->df_type_.size());  // make sure grid row is not past end of arrays
 	signed char df_type = mac_abs(pdoc->df_type_[ii]);
@@ -4876,6 +5094,7 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 					CString strTmp;
 					strTmp.Format("The following string does not match any member of the enum list:\n\"%s\"\n\n"
 						"See the \"domain\" attribute for this field in the template.", ss);
+					tl.Unlock();
 					TaskMessageBox("Invalid enum member", strTmp);
 					*pResult = -1;
 					return;
@@ -4920,6 +5139,7 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 				// Variable sized string field and new string is different length to previous string
 				if (phev_->display_.overtype)
 				{
+					tl.Unlock();
 					if (TaskMessageBox("Invalid length",
 						               "You can't change the string length in overtype mode.\n\n"
 									   "Do you want to turn off overtype mode?",
@@ -4930,7 +5150,10 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 						return;
 					}
 					else
+					{
+						tl.Lock();
 						phev_->do_insert();
+					}
 				}
 				ss += char(pdoc->df_extra_[ii]);     // Add terminator
 				new_size = ss.GetLength();
@@ -4948,9 +5171,11 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 				// String longer than field (fixed length string field)
 				ss = ss.Left(df_size);
 				grid_.SetItemText(pItem->iRow, pItem->iColumn, ss);
+				tl.Unlock();
 				AvoidableTaskDialog(IDS_DFFD_TRUNCATED,
 					"The string you entered is too long for the "
 					"template field and has been truncated to fit.");
+				tl.Lock();
 			}
 			// ELSE string is length of fixed field (excluding terminator)
 			// OR var length field and string is same length as before
@@ -4982,6 +5207,7 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 				// Variable sized string field and new string is different length to previous string
 				if (phev_->display_.overtype)
 				{
+					tl.Unlock();
 					if (TaskMessageBox("Invalid length",
 						               "You can't change the string length in overtype mode.\n\n"
 									   "Do you want to turn off overtype mode?",
@@ -4992,7 +5218,10 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 						return;
 					}
 					else
+					{
+						tl.Lock();
 						phev_->do_insert();
+					}
 				}
 				sw += wchar_t(pdoc->df_extra_[ii]);     // Add terminator
 				new_size = 2 * (sw.GetLength());
@@ -5010,9 +5239,11 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 				// String longer than field (fixed length string field)
 				sw = sw.Left(df_size/2);
 				grid_.SetItemText(pItem->iRow, pItem->iColumn, sw);
+				tl.Unlock();
 				AvoidableTaskDialog(IDS_DFFD_TRUNCATED,
 					"The string you entered is too long for the "
 					"template field and has been truncated to fit.");
+				tl.Lock();
 			}
 			// else string is length of fixed length field OR var length field but string is same length as before
 			pdata = (unsigned char *)(const wchar_t *)sw;
@@ -5054,9 +5285,11 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 				}
 				if (inv)
 				{
+					tl.Unlock();
 					AvoidableTaskDialog(IDS_DFFD_INVALID_EBCDIC,
 						"One or more characters were used that cannot be converted to EBCDIC.  "
 						"These have been converted to null (zero) bytes.");
+					tl.Lock();
 				}
 			}
 			else
@@ -5226,8 +5459,10 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 				ASSERT(bit_mask <= 0x7F);
 				if (tmp8 > bit_mask)
 				{
+					tl.Unlock();
 					AvoidableTaskDialog(IDS_DFFD_EXTRA_IGNORED,
 						"The value exceeds the bits available in the bit-field, and has been truncated.");
+					tl.Lock();
 					tmp8 &= bit_mask;
 				}
 				// Mask out (set to zero) the existing bits
@@ -5251,8 +5486,10 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 				ASSERT(bit_mask <= 0x7FFF);
 				if (tmp16 > bit_mask)
 				{
+					tl.Unlock();
 					AvoidableTaskDialog(IDS_DFFD_EXTRA_IGNORED,
 						"The value exceeds the bits available in the bit-field, and has been truncated.");
+					tl.Lock();
 					tmp16 &= bit_mask;
 				}
 				// Mask out (set to zero) the existing bits
@@ -5276,8 +5513,10 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 				ASSERT(bit_mask <= 0x7fffFFFF);
 				if (tmp32 > bit_mask)
 				{
+					tl.Unlock();
 					AvoidableTaskDialog(IDS_DFFD_EXTRA_IGNORED,
 						"The value exceeds the bits available in the bit-field, and has been truncated.");
+					tl.Lock();
 					tmp32 &= bit_mask;
 				}
 				// Mask out (set to zero) the existing bits
@@ -5300,8 +5539,10 @@ void CDataFormatView::OnGridEndLabelEdit(NMHDR *pNotifyStruct, LRESULT* pResult)
 				unsigned __int64 bit_mask = (__int64(1)<<(pdoc->df_extra_[ii]>>8)) - 1;
 				if (tmp64 > bit_mask)
 				{
+					tl.Unlock();
 					AvoidableTaskDialog(IDS_DFFD_EXTRA_IGNORED,
 						"The value exceeds the bits available in the bit-field, and has been truncated.");
+					tl.Lock();
 					tmp64 &= bit_mask;
 				}
 				// Mask out (set to zero) the existing bits
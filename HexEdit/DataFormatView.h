@@ -95,6 +95,8 @@ public:
 	void InitColumnHeadings();
 	CString GetColWidths();
 	void InitTree();
+	void add_rows();                        // add rows for elements after rows_done_ (see CDFFDPartialHint)
+	void refresh_rows(const std::vector<size_t> &elts); // redisplay values of some elements (layout unchanged)
 	void save_tree_state();
 	void restore_tree_state();
 	void set_colours();
@@ -103,6 +105,7 @@ public:
 	bool has_children(int row);             // returns true if row below has indent one more
 	void show_row(int row);                 // expands all ancestors so that a row is shown
 	void expand_all(int row);               // expands all nodes below
+	void export_table(int row);             // exports elements of an array to a table file
 	bool expand_one(int row);               // expands one level - returns false if already expanded
 	bool collapse(int row);					// hides all sub-nodes - returns false if already collpased
 	void goto_parent(int row);              // move to parent of specified row
@@ -172,6 +175,14 @@ protected:
 	int default_height_;                    // Default cell height
 	int edit_row_type_changed_;             // Row where we have set a new cell type for data column when editing
 
+	// These keep track of where add_rows is up to so that rows can be added as they become available
+	size_t rows_done_;                      // Number of elements that have rows in the grid
+	int consec_count_;                      // Counts consecutive data lines so we can paint backgrounds
+	std::vector<CString> for_name_;         // Used to work out element names for array elements
+	std::vector<int>     for_count_;
+	bool past_defns_;                       // Signals that past struct defns - so we can show greyed rows
+	std::vector<int> parents_;              // Elements that are ancestors of the last row added
+
 	std::vector<CString> tree_state_;
 	CString              get_full_name(std::vector<int> &curr_state, bool use_comma = false);
 
@@ -0,0 +1,102 @@
+// DiffIndex.cpp : implementation of the diff_index class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+
+#include "DiffIndex.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+static bool extent_less(const diff_index::extent &e1, const diff_index::extent &e2)
+{
+	return e1.addr < e2.addr || (e1.addr == e2.addr && e1.kind < e2.kind);
+}
+
+void diff_index::build(const addr_vec &rep_this, const addr_vec &rep_other, const addr_vec &rep_len,
+                       const addr_vec &ins_this, const addr_vec &ins_other, const addr_vec &ins_len,
+                       const addr_vec &del_this, const addr_vec &del_other, const addr_vec &del_len)
+{
+	ASSERT(rep_this.size() == rep_other.size() && rep_this.size() == rep_len.size());
+	ASSERT(ins_this.size() == ins_other.size() && ins_this.size() == ins_len.size());
+	ASSERT(del_this.size() == del_other.size() && del_this.size() == del_len.size());
+
+	extents_.clear();
+	extents_.reserve(rep_this.size() + ins_this.size() + del_this.size());
+
+	// Each vector is already sorted so we just append them and merge in place (linear time)
+	for (std::size_t ii = 0; ii < rep_this.size(); ++ii)
+		extents_.push_back(extent{ rep_this[ii], rep_other[ii], rep_len[ii], KIND_REPLACE, 0 });
+	std::size_t mid = extents_.size();
+	for (std::size_t ii = 0; ii < ins_this.size(); ++ii)
+		extents_.push_back(extent{ ins_this[ii], ins_other[ii], ins_len[ii], KIND_INSERT, 0 });
+	std::inplace_merge(extents_.begin(), extents_.begin() + mid, extents_.end(), extent_less);
+	mid = extents_.size();
+	for (std::size_t ii = 0; ii < del_this.size(); ++ii)
+		extents_.push_back(extent{ del_this[ii], del_other[ii], del_len[ii], KIND_DELETE, 0 });
+	std::inplace_merge(extents_.begin(), extents_.begin() + mid, extents_.end(), extent_less);
+}
+
+void diff_index::merge(const std::vector<const diff_index *> &from)
+{
+	extents_.clear();
+	std::size_t total = 0;
+	for (const diff_index *pdi : from)
+		total += pdi->size();
+	extents_.reserve(total);
+
+	for (std::size_t rr = 0; rr < from.size(); ++rr)
+	{
+		std::size_t mid = extents_.size();
+		for (extent ee : from[rr]->extents_)
+		{
+			ee.rev = int(rr);
+			extents_.push_back(ee);
+		}
+		// Stable, so at the same address/kind lower (more recent) revisions come first
+		std::inplace_merge(extents_.begin(), extents_.begin() + mid, extents_.end(), extent_less);
+	}
+}
+
+// Returns the first extent with the same address as *pe (so a replacement is
+// preferred to an insertion or deletion at the same address).
+const diff_index::extent *diff_index::first_at(std::vector<extent>::const_iterator pe) const
+{
+	ASSERT(pe >= extents_.begin() && pe < extents_.end());
+	std::int64_t addr = pe->addr;
+	pe = std::partition_point(extents_.begin(), pe, [addr](const extent &ee) { return ee.addr < addr; });
+	return &*pe;
+}
+
+const diff_index::extent *diff_index::first() const
+{
+	return extents_.empty() ? NULL : &extents_.front();
+}
+
+const diff_index::extent *diff_index::last() const
+{
+	return extents_.empty() ? NULL : first_at(extents_.end() - 1);
+}
+
+const diff_index::extent *diff_index::next(std::int64_t from) const
+{
+	auto pe = std::partition_point(extents_.begin(), extents_.end(), [from](const extent &ee) { return ee.addr <= from; });
+	return pe == extents_.end() ? NULL : &*pe;
+}
+
+const diff_index::extent *diff_index::prev(std::int64_t from) const
+{
+	auto pe = std::partition_point(extents_.begin(), extents_.end(), [from](const extent &ee) { return ee.addr <= from; });
+	return pe == extents_.begin() ? NULL : first_at(pe - 1);
+}
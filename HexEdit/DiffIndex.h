@@ -0,0 +1,73 @@
+// DiffIndex.h : sorted index of the differences found by a compare
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A compare result keeps replacements, insertions and deletions in separate vectors so
+// finding the next (or previous) difference of any type means searching each of them and
+// picking the closest.  This keeps all the differences as seen from one of the files in
+// a single array sorted by address (and type, so replacements come before insertions and
+// deletions at the same address), so that navigation is a single binary search.
+//
+// An index can also be the merge of several other indexes (eg all the revisions of a
+// self-compare), in which case each extent remembers which revision it came from.
+class diff_index
+{
+public:
+	// Note that INSERT means bytes in this file that are not in the other file and DELETE
+	// means bytes in the other file that are not in this one (ie they are "missing" here).
+	enum kind_t { KIND_REPLACE, KIND_INSERT, KIND_DELETE };
+
+	struct extent
+	{
+		std::int64_t addr;      // address in this file
+		std::int64_t other;     // corresponding address in the other file
+		std::int64_t len;       // bytes replaced, inserted or deleted
+		kind_t kind;
+		int rev;                // revision it came from (merged indexes only)
+
+		// Length as returned by CHexEditDoc::GetNextDiff etc (+ve for replacement,
+		// -ve for insertion, zero for deletion)
+		std::int64_t diff_len() const { return kind == KIND_REPLACE ? len : kind == KIND_INSERT ? -len : 0; }
+	};
+
+	typedef std::vector<std::int64_t> addr_vec;
+
+	void clear() { extents_.clear(); }
+
+	// Builds the index from the separate (sorted) vectors of each type of difference.
+	// The vectors for each type are the address in this file, in the other file and the length.
+	void build(const addr_vec &rep_this, const addr_vec &rep_other, const addr_vec &rep_len,
+	           const addr_vec &ins_this, const addr_vec &ins_other, const addr_vec &ins_len,
+	           const addr_vec &del_this, const addr_vec &del_other, const addr_vec &del_len);
+
+	// Makes this index the union of other indexes (the position in the vector is the revision)
+	void merge(const std::vector<const diff_index *> &from);
+
+	bool empty() const { return extents_.empty(); }
+	std::size_t size() const { return extents_.size(); }
+	const extent &operator[](std::size_t ii) const { return extents_[ii]; }
+
+	// The following return NULL if there is no such difference
+	const extent *first() const;
+	const extent *last() const;
+	const extent *next(std::int64_t from) const;    // first difference starting after from
+	const extent *prev(std::int64_t from) const;    // last difference starting at or before from
+
+private:
+	std::vector<extent> extents_;   // sorted by addr then kind
+
+	const extent *first_at(std::vector<extent>::const_iterator pe) const;
+};
@@ -48,6 +48,8 @@ IMPLEMENT_DYNAMIC(CBGAerialHint, CObject)   // background scan has finished (bit
 IMPLEMENT_DYNAMIC(CSaveStateHint, CObject)  // save tree state (typically before redraw)
 IMPLEMENT_DYNAMIC(CRestoreStateHint, CObject) // restore tree state (typically after redraw)
 IMPLEMENT_DYNAMIC(CDFFDHint, CObject)       // redraw required due to changed doc, template etc
+IMPLEMENT_DYNAMIC(CDFFDValueHint, CObject)  // redraw some template rows (values changed but not layout)
+IMPLEMENT_DYNAMIC(CDFFDPartialHint, CObject) // more template elements available (bg scan in progress)
 IMPLEMENT_DYNAMIC(CCompHint, CObject)       // redraw required due to changes in compare file
 IMPLEMENT_DYNAMIC(CBookmarkHint, CObject)   // A bookmark has been added/removed
 IMPLEMENT_DYNAMIC(CTrackHint, CObject)      // Need to invalidate extra things for change tracking
@@ -55,7 +57,7 @@ IMPLEMENT_DYNAMIC(CBGPreviewHint, CObject)  // load of preview bitmap has finish
 
 size_t CHexEditDoc::GetData(unsigned char *buf, size_t len, FILE_ADDRESS address, int use_bg /*= -1*/)
 {
-	ASSERT(use_bg == -1 || use_bg == 2 || use_bg == 3 || use_bg == 4 || use_bg == 5);   // 0 and 1 are no longer used
+	ASSERT(use_bg == -1 || use_bg == 2 || use_bg == 3 || use_bg == 4 || use_bg == 5 || use_bg == 7);   // 0 and 1 are no longer used
 	ASSERT(address >= 0);
 	FILE_ADDRESS pos;           // Tracks file position of current location record
 	ploc_t pl;                  // Current location record
@@ -75,6 +77,9 @@ size_t CHexEditDoc::GetData(unsigned char *buf, size_t len, FILE_ADDRESS address
 	case 5:
 		pfile = pfile5_;        // Stats thread file
 		break;
+	case 7:
+		pfile = pfile7_;        // Template thread file
+		break;
 	default:
 		ASSERT(0);
 		// fall through
@@ -102,16 +107,34 @@ size_t CHexEditDoc::GetData(unsigned char *buf, size_t len, FILE_ADDRESS address
 		ASSERT(tocopy < 0x10000000);
 		if ((pl->dlen >> 62) == 1)
 		{
-			// Read data from the original file
-			UINT actual;                // Number of bytes actually read from file
-
-			pfile->Seek(pl->fileaddr + start, CFile::begin);
-			if ((actual = pfile->Read((void *)buf, (UINT)tocopy)) < tocopy)
+			// Read data from the original file, except holes (sparse file) which are just zeroes
+			FILE_ADDRESS faddr = pl->fileaddr + start;
+			size_t done;                // Number of bytes of this block already in buf
+			for (done = 0; done < tocopy; )
 			{
-				ASSERT(shared_);  // We should only run out of data if underlying file size has changed (should only happen if file was opened shareable)
+				size_t seg_len = tocopy - done;
+				range_set<FILE_ADDRESS>::range_t::const_iterator ph = file_holes_.find_segment(faddr + done);
+				if (ph != file_holes_.range_.end() && ph->sfirst <= faddr + done)
+				{
+					seg_len = size_t(std::min(FILE_ADDRESS(seg_len), ph->slast - (faddr + done)));
+					memset(buf + done, '\0', seg_len);
+					done += seg_len;
+					continue;
+				}
+				else if (ph != file_holes_.range_.end())
+					seg_len = size_t(std::min(FILE_ADDRESS(seg_len), ph->sfirst - (faddr + done)));
 
-				// File on disk is now shorter - just fill missing bytes with zero
-				memset(buf + actual, '\0', tocopy - actual);
+				UINT actual;            // Number of bytes actually read from file
+
+				pfile->Seek(faddr + done, CFile::begin);
+				if ((actual = pfile->Read((void *)(buf + done), (UINT)seg_len)) < seg_len)
+				{
+					ASSERT(shared_);  // We should only run out of data if underlying file size has changed (should only happen if file was opened shareable)
+
+					// File on disk is now shorter - just fill missing bytes with zero
+					memset(buf + done + actual, '\0', seg_len - actual);
+				}
+				done += seg_len;
 			}
 		}
 		else if ((pl->dlen >> 62) == 2)
@@ -155,6 +178,11 @@ size_t CHexEditDoc::GetData(unsigned char *buf, size_t len, FILE_ADDRESS address
 				data_file6_[idx]->Seek(fileaddr + start, CFile::begin);
 				actual = data_file6_[idx]->Read((void *)buf, (UINT)tocopy);
 				break;
+			case 7:
+				ASSERT(data_file7_[idx] != NULL);
+				data_file7_[idx]->Seek(fileaddr + start, CFile::begin);
+				actual = data_file7_[idx]->Read((void *)buf, (UINT)tocopy);
+				break;
 			default:
 				ASSERT(0);
 				// fall through
@@ -183,6 +211,59 @@ size_t CHexEditDoc::GetData(unsigned char *buf, size_t len, FILE_ADDRESS address
 	return len - left;
 }
 
+// Returns the end of the hole (of the original sparse file) that address is in, but not
+// past the end of the block of the original file, so that background scans can handle
+// the zeroes without reading them.  Returns address if it is not in a hole.
+FILE_ADDRESS CHexEditDoc::HoleEnd(FILE_ADDRESS address)
+{
+	CSingleLock sl(&docdata_, TRUE);
+	if (file_holes_.empty())
+		return address;
+
+	FILE_ADDRESS pos;
+	ploc_t pl;
+	for (pos = 0, pl = loc_.begin(); pl != loc_.end(); pos += (pl->dlen&doc_loc::mask), ++pl)
+	{
+		if (address < pos + FILE_ADDRESS(pl->dlen&doc_loc::mask))
+			break;
+	}
+	if (pl == loc_.end() || (pl->dlen >> 62) != 1)
+		return address;
+
+	FILE_ADDRESS faddr = pl->fileaddr + (address - pos);
+	range_set<FILE_ADDRESS>::range_t::const_iterator ph = file_holes_.find_segment(faddr);
+	if (ph == file_holes_.range_.end() || ph->sfirst > faddr)
+		return address;
+
+	return std::min(address + (ph->slast - faddr), pos + FILE_ADDRESS(pl->dlen&doc_loc::mask));
+}
+
+// Gets the holes in the original file (if it is sparse) so they are not read
+void CHexEditDoc::get_holes()
+{
+	range_set<FILE_ADDRESS> holes;
+	if (pfile1_ != NULL && !shared_)
+		holes = get_holes(pfile1_);
+
+	CSingleLock sl(&docdata_, TRUE);
+	file_holes_.swap(holes);
+}
+
+range_set<FILE_ADDRESS> CHexEditDoc::get_holes(CFile64 *pf)
+{
+	range_set<FILE_ADDRESS> holes;
+	std::vector<std::pair<LONGLONG, LONGLONG> > alloc;
+	FILE_ADDRESS len = pf->GetLength();
+	if (pf->GetAllocatedRanges(0, len, alloc))
+	{
+		range_set<FILE_ADDRESS> data;
+		for (std::vector<std::pair<LONGLONG, LONGLONG> >::const_iterator pp = alloc.begin(); pp != alloc.end(); ++pp)
+			data.insert_range(pp->first, pp->second);
+		holes = data.complement(0, len);
+	}
+	return holes;
+}
+
 // Create a new temp data file so that we can save to disk rather than using lots of memory
 int CHexEditDoc::AddDataFile(LPCTSTR name, BOOL temp /*=FALSE*/)
 {
@@ -231,6 +312,12 @@ int CHexEditDoc::AddDataFile(LPCTSTR name, BOOL temp /*=FALSE*/)
 				ASSERT(data_file6_[ii] == NULL);
 				data_file6_[ii] = new CFile64(name, CFile::modeRead|CFile::shareDenyWrite|CFile::typeBinary);
 			}
+			// If template thread is on also open 7th copy of the file
+			if (pthread7_ != NULL)
+			{
+				ASSERT(data_file7_[ii] == NULL);
+				data_file7_[ii] = new CFile64(name, CFile::modeRead|CFile::shareDenyWrite|CFile::typeBinary);
+			}
 
 			temp_file_[ii] = temp;
 			return ii;
@@ -285,6 +372,13 @@ void CHexEditDoc::RemoveDataFile(int idx)
 			delete data_file6_[idx];
 			data_file6_[idx] = NULL;
 		}
+		if (pthread7_ != NULL)
+		{
+			ASSERT(data_file7_[idx] != NULL);
+			data_file7_[idx]->Close();
+			delete data_file7_[idx];
+			data_file7_[idx] = NULL;
+		}
 		// If the data file was a temp file remove it now it is closed
 		if (temp_file_[idx])
 			remove(ss);
@@ -561,7 +655,8 @@ void CHexEditDoc::Change(enum mod_type utype, FILE_ADDRESS address, FILE_ADDRESS
 	// Rebuild the location list
 	regenerate();
 
-	update_needed_ = true;
+	dffd_change(utype, address, clen);
+	aerial_change(utype, address, clen);
 	send_change_hint(address);
 
 	// Unlock now since nothing below is protected by the docdata_
@@ -579,6 +674,8 @@ void CHexEditDoc::Change(enum mod_type utype, FILE_ADDRESS address, FILE_ADDRESS
 	}
 	SetModifiedFlag(TRUE);
 	UpdateAllViews(NULL, 0, &hh);
+
+	ScanDirty();                // Update template values if the change did not affect the layout
 }
 
 // Undo removes the last change made by calling Change() [above]
@@ -819,11 +916,14 @@ BOOL CHexEditDoc::Undo(CView *pview, int index, BOOL same_view)
 
 	doc_changed_ = true;        // Remember to restart bg scans when we get a chance
 
-	update_needed_ = true;
+	dffd_change(hh.utype, change_address, hh.len);
+	aerial_change(hh.utype, change_address, hh.len);
 	send_change_hint(change_address);
 
 	// Update views because doc contents have changed
 	UpdateAllViews(NULL, 0, &hh);
+
+	ScanDirty();                // Update template values if the change did not affect the layout
 	return TRUE;
 }
 
@@ -1065,6 +1165,7 @@ void CHexEditDoc::WriteInPlace()
 		}
 #endif
 		pfile1_->Flush();
+		get_holes();                    // Writes may have filled in holes
 	}
 	catch (CFileException *pfe)
 	{
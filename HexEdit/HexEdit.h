@@ -74,6 +74,7 @@ typedef __int64 FILE_ADDRESS;
 #define FILENAME_RECENTFILES _T("RecentFiles")
 #define FILENAME_BACKGROUND  _T("Backgrnd.bmp")
 #define DIRNAME_PREVIEW      _T("PreviewThumbnails\\")
+#define DIRNAME_TEMPLATECACHE _T("TemplateCache\\")
 #define FILENAME_ABOUTBG     _T("About.jpg")
 #define FILENAME_SPLASH      _T("Splash.bmp")
 #define FILENAME_DTD         _T("BinaryFileFormat.DTD")
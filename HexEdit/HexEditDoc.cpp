@@ -86,11 +86,12 @@ CHexEditDoc::CHexEditDoc()
    start_aerial_event_(FALSE, TRUE), aerial_buf_(NULL),
    start_comp_event_  (FALSE, TRUE), comp_bufa_(NULL), comp_bufb_(NULL),
    stats_buf_(NULL), c32_(NULL), c64_(NULL),
+   start_template_event_(FALSE, TRUE),
    preview_address_(0L), preview_fif_(FREE_IMAGE_FORMAT(-999)), preview_file_fif_(FREE_IMAGE_FORMAT(-999))
 {
 	doc_changed_ = false;
 
-	pfile1_ = pfile2_ = pfile3_ = pfile5_ = pfile6_ = NULL;
+	pfile1_ = pfile2_ = pfile3_ = pfile5_ = pfile6_ = pfile7_ = NULL;
 	pfile1_compare_ = pfile4_ = pfile4_compare_ = NULL;  // Files used for compares
 
 	for (int ii = 0; ii < doc_loc::max_data_files; ++ii)
@@ -101,6 +102,7 @@ CHexEditDoc::CHexEditDoc()
 		data_file4_[ii] = NULL;
 		data_file5_[ii] = NULL;
 		data_file6_[ii] = NULL;
+		data_file7_[ii] = NULL;
 		temp_file_[ii] = FALSE;
 	}
 
@@ -115,15 +117,17 @@ CHexEditDoc::CHexEditDoc()
 	// Aerial view thread
 	pthread3_ = NULL;
 	av_count_ = 0;
-	dib_ = NULL;
 	bpe_ = -1;
+	aerial_addr_ = aerial_start_ = aerial_end_ = 0;
 
 	// BG compare thread
 	TRACE1("+++ Setting compare thread to NULL for %p\n", this);
 	pthread4_ = NULL;
 	cv_count_ = 0;
 	bCompSelf_ = false;
+	snap_ = NULL;
 	compMinMatch_ = 0;
+	compAnchored_ = false;
 
 	// BG stats thread
 	pthread5_ = NULL;
@@ -133,6 +137,14 @@ CHexEditDoc::CHexEditDoc()
 	preview_count_ = 0;
 	preview_dib_ = NULL;
 
+	// BG template thread
+	pthread7_ = NULL;
+	df_scanning_ = false;
+	df_shown_ = 0;
+	df_keep_state_ = false;
+	df_scan_start_ = 0;
+	df_wanted_ = 0;
+
 	// Template
 	ptree_ = NULL;         // XML tree wrapper for data format view
 	df_init_ = FALSE;
@@ -373,6 +385,7 @@ BOOL CHexEditDoc::OnOpenDocument(LPCTSTR lpszPathName)
 		       data_file4_[ii] == NULL &&
 			   data_file5_[ii] == NULL &&
 			   data_file6_[ii] == NULL &&
+			   data_file7_[ii] == NULL &&
 			   data_file_[ii] == NULL );
 #endif
 
@@ -403,6 +416,7 @@ BOOL CHexEditDoc::OnOpenDocument(LPCTSTR lpszPathName)
 		int flags = atoi(pfl->GetData(recent_file_index, CHexFileList::DOC_FLAGS));
 		keep_times_ = (flags & 0x1) != 0;
 		dffd_edit_mode_ = (flags & 0x2) != 0;
+		compAnchored_ = (flags & 0x4) != 0;
 		view_time_ = timer(atof(pfl->GetData(recent_file_index, CHexFileList::VIEW_TIME)));
 		edit_time_ = timer(atof(pfl->GetData(recent_file_index, CHexFileList::EDIT_TIME)));
 		compMinMatch_ = atoi(pfl->GetData(recent_file_index, CHexFileList::COMPMINMATCH));
@@ -926,6 +940,13 @@ BOOL CHexEditDoc::OnSaveDocument(LPCTSTR lpszPathName)
 				delete data_file6_[ii];
 				data_file6_[ii] = NULL;
 			}
+			if (pthread7_ != NULL)
+			{
+				ASSERT(data_file7_[ii] != NULL);
+				data_file7_[ii]->Close();
+				delete data_file7_[ii];
+				data_file7_[ii] = NULL;
+			}
 
 			// If the data file was a temp file remove it now it is closed
 			if (temp_file_[ii])
@@ -939,7 +960,7 @@ BOOL CHexEditDoc::OnSaveDocument(LPCTSTR lpszPathName)
 	base_type_ = 0;                        // Now we can use the saved file as base for compare
 
 	// Remove all tracking changes from views
-	CTrackHint th(0, length_);
+	CTrackHint th(0, length_, true);
 	UpdateAllViews(NULL, 0, &th);
 
 	// Update bookmarks
@@ -1055,6 +1076,7 @@ void CHexEditDoc::close_file()
 		delete pfile1_;
 		pfile1_ = NULL;
 	}
+	file_holes_.clear();
 
 	if (pthread2_ != NULL && pfile2_ != NULL)
 	{
@@ -1084,6 +1106,12 @@ void CHexEditDoc::close_file()
 		delete pfile6_;
 		pfile6_ = NULL;
 	}
+	if (pthread7_ != NULL && pfile7_ != NULL)
+	{
+		pfile7_->Close();
+		delete pfile7_;
+		pfile7_ = NULL;
+	}
 }
 
 BOOL CHexEditDoc::open_file(LPCTSTR lpszPathName)
@@ -1226,6 +1254,8 @@ BOOL CHexEditDoc::open_file(LPCTSTR lpszPathName)
 		return FALSE;
 	}
 
+	get_holes();
+
 	// If doing background searches and the newly opened file is not the same
 	// as pfile2_ then close pfile2_ and open it as the new file.
 	if (pthread2_ != NULL && 
@@ -1316,6 +1346,27 @@ BOOL CHexEditDoc::open_file(LPCTSTR lpszPathName)
 			return FALSE;
 		}
 	}
+	if (pthread7_ != NULL && 
+		(pfile7_ == NULL || pfile1_->GetFilePath() != pfile7_->GetFilePath()) )
+	{
+		if (pfile7_ != NULL)
+		{
+			pfile7_->Close();
+			delete pfile7_;
+			pfile7_ = NULL;
+		}
+
+		if (IsDevice())
+			pfile7_ = new CFileNC();
+		else
+			pfile7_ = new CFile64();
+		if (!pfile7_->Open(pfile1_->GetFilePath(),
+					CFile::modeRead|CFile::shareDenyNone|CFile::typeBinary) )
+		{
+			TRACE1("BG template scan file open failed for %p\n", this);
+			return FALSE;
+		}
+	}
 
 	GetInitialStatus();
 
@@ -1344,6 +1395,8 @@ void CHexEditDoc::DeleteContents()
 		KillStatsThread();
 	if (pthread6_ != NULL)
 		KillPreviewThread();
+	if (pthread7_ != NULL)
+		KillTemplateThread();
 
 	undo_.clear();
 	loc_.clear();               // Done after thread killed so no docdata_ lock needed
@@ -1366,6 +1419,7 @@ void CHexEditDoc::DeleteContents()
 		ASSERT(data_file4_[ii] == NULL);  // should have been closed in KillCompThread() call
 		ASSERT(data_file5_[ii] == NULL);  // should have been closed in KillStatsThread() call
 		ASSERT(data_file6_[ii] == NULL);  // should have been closed in KillPreviewThread()
+		ASSERT(data_file7_[ii] == NULL);  // should have been closed in KillTemplateThread()
 	}
 
 	// Reset change tracking
@@ -1447,11 +1501,13 @@ void CHexEditDoc::CheckBGProcessing()
 		AerialChange();
 		StatsChange();
 		PreviewChange();
+		TemplateChange();
 	}
 
 	// Now check if any bg processing has just finished so we can update the display
 	bool search_finished = false;
 	bool aerial_finished = false;
+	bool aerial_waiting = false;
 	bool comp_finished = false;
 	bool preview_load_finished = false;
 
@@ -1465,6 +1521,7 @@ void CHexEditDoc::CheckBGProcessing()
 
 	aerial_finished = aerial_fin_;
 	aerial_fin_ = false;
+	aerial_waiting = aerial_state_ == WAITING;   // all tiles wanted by the views are done
 
 	comp_finished = comp_fin_;
 	if (comp_finished)
@@ -1490,7 +1547,8 @@ void CHexEditDoc::CheckBGProcessing()
 	if (aerial_finished)
 	{
 #ifdef SYS_SOUNDS
-		CSystemSound::Play("Background Scan Finished");
+		if (aerial_waiting)
+			CSystemSound::Play("Background Scan Finished");
 #endif
 		CBGAerialHint bgah;
 		UpdateAllViews(NULL, 0, &bgah);
@@ -1512,6 +1570,41 @@ void CHexEditDoc::CheckBGProcessing()
 		UpdateAllViews(NULL, 0, &bgph);
 	}
 
+	// Check if the bg template scan has finished or has more elements for the views
+	if (template_done())
+	{
+		if (!df_keep_state_)
+		{
+			CSaveStateHint ssh;
+			UpdateAllViews(NULL, 0, &ssh);
+		}
+		df_keep_state_ = false;
+		CDFFDHint dffdh;
+		UpdateAllViews(NULL, 0, &dffdh);
+		CRestoreStateHint rsh;
+		UpdateAllViews(NULL, 0, &rsh);
+	}
+	else if (df_scanning_)
+	{
+		size_t avail;
+		int progress;
+		docdata_.Lock();
+		avail = template_avail_;
+		progress = template_progress_;
+		docdata_.Unlock();
+
+		if (avail > df_shown_)
+		{
+			((CMainFrame *)AfxGetMainWnd())->Progress(progress);
+
+			CTemplateLock tl(this);            // stop the template thread changing the elements
+			CDFFDPartialHint dph;
+			dph.avail_ = df_address_.size();
+			UpdateAllViews(NULL, 0, &dph);
+			df_shown_ = dph.avail_;
+		}
+	}
+
 	// For bg compares we also need to check if the compare file has changed since
 	// we last scanned it and if so start a new scan else if we just finished a
 	// scan we have to update the views.
@@ -1530,7 +1623,10 @@ void CHexEditDoc::CheckBGProcessing()
 			docdata_.Lock();
 			// If the current revision zero is not empty push a new empty revision at front
 			if (!comp_[0].m_replace_A.empty() || !comp_[0].m_insert_A.empty() || !comp_[0].m_replace_A.empty())
+			{
 				comp_.push_front(CompResult());
+				update_comp_all();                  // revision numbers have changed
+			}
 			docdata_.Unlock();
 		}
 		else
@@ -1538,20 +1634,10 @@ void CHexEditDoc::CheckBGProcessing()
 
 		ASSERT(IsCompWaiting());  // the thread cannot be doing anything while files are closed
 
-		// Get new copy of file
+		// Add the changes to the snapshot (the current version becomes the previous one)
 		CloseCompFile();
-		TRACE("oooooooo copying file to temp\r\n");
-		// Remove older temp file since we no longer need it
-		if (!tempFileB_.IsEmpty())
-		{
-			VERIFY(::remove(tempFileB_) == 0);
-			tempFileB_.Empty();
-		}
-		// Move newer temp file to older temp file
-		tempFileB_ = tempFileA_;
-		tempFileA_.Empty();
-		// Make new temp file from current file
-		VERIFY(MakeTempFile());
+		TRACE("oooooooo updating snapshot\r\n");
+		VERIFY(TakeSnapshot());
 		if (OpenCompFile())
 			StartComp();
 	}
@@ -1991,7 +2077,7 @@ FILE_ADDRESS CHexEditDoc::insert_block(FILE_ADDRESS addr, _int64 params, const c
 				return -1;              // open_file has already set mac_error_ = 10
 
 			length_ = file_len;
-			ASSERT(pthread2_ == NULL && pthread3_ == NULL && pthread4_ == NULL && pthread5_ == NULL && pthread6_ == NULL);   // Must modify loc_ before creating threads (else docdata_ needs to be locked)
+			ASSERT(pthread2_ == NULL && pthread3_ == NULL && pthread4_ == NULL && pthread5_ == NULL && pthread6_ == NULL && pthread7_ == NULL);   // Must modify loc_ before creating threads (else docdata_ needs to be locked)
 			loc_.push_back(doc_loc(FILE_ADDRESS(0), file_len));
 
 			// Get status as when the file was created on disk
@@ -20,6 +20,8 @@
 #include <list>
 #include <set>
 #include <algorithm>
+#include <functional>
+#include <memory>
 #include <afxmt.h>              // For MFC IPC (CEvent etc)
 #include <boost/tuple/tuple.hpp>
 
@@ -28,6 +30,14 @@
 #include "xmltree.h"
 #include "expr.h"
 #include "timer.h"
+#include "TemplateIndex.h"
+#include "AerialPyramid.h"
+#include "AerialReduce.h"
+#include "AerialHeat.h"
+#include "DiffIndex.h"
+#include "SnapshotStore.h"
+
+namespace hex { class TableExporter; struct Cell; }
 
 // This enum is for the different modification types that can be made
 // to the document.  It is used for keeping track of changes made in the
@@ -54,6 +64,8 @@ enum view_t { none, splitter, tabbed };
 // CBGAerialHint - aerial view bitmap has changed
 // CBGPreviewHint - preview bitmap has changed
 // CDFFDHint - template has changed
+// CDFFDValueHint - template values (but not layout) have changed for some elements
+// CDFFDPartialHint - more template elements are available (background scan in progress)
 // CSaveStateHint - tell tree view to save its state
 // CRestoreStateHint - tell tree view to try to restore its state
 // CCompHint - file compare data has changed
@@ -177,6 +189,32 @@ protected:
 	DECLARE_DYNAMIC(CDFFDHint)          // Required for MFC run-time type info.
 };
 
+// This object is passed to view OnUpdate() functions as the (3rd) hint
+// parameter.  It is used to tell the tree views that the values of some
+// template elements have changed but the layout of the tree has not, so
+// only the rows for the listed elements need to be redisplayed.
+class CDFFDValueHint : public CObject
+{
+public:
+	std::vector<size_t> elts_;          // Indices (into df_address_ etc) of elements to redisplay
+
+protected:
+	DECLARE_DYNAMIC(CDFFDValueHint)     // Required for MFC run-time type info.
+};
+
+// This object is passed to view OnUpdate() functions as the (3rd) hint
+// parameter.  It is sent while the file is being scanned using the template
+// in the background to say that more elements (of the doc's df_address_ etc)
+// are now ready.  The elements already shown in the tree do not change.
+class CDFFDPartialHint : public CObject
+{
+public:
+	size_t avail_;                      // Number of elements now available
+
+protected:
+	DECLARE_DYNAMIC(CDFFDPartialHint)   // Required for MFC run-time type info.
+};
+
 // This object is passed to view OnUpdate() functions as the (3rd) hint
 // parameter.  It is used to tell the tree views to save their tree state.
 class CSaveStateHint : public CObject
@@ -223,7 +261,8 @@ class CTrackHint : public CObject
 {
 public:
 	FILE_ADDRESS start_, end_;          // range that needs redrawing
-	CTrackHint(FILE_ADDRESS ss, FILE_ADDRESS ee) { start_ = ss; end_ = ee; }
+	bool reset_;                        // all change tracking removed (else a CHexHint follows)
+	CTrackHint(FILE_ADDRESS ss, FILE_ADDRESS ee, bool reset = false) { start_ = ss; end_ = ee; reset_ = reset; }
 
 protected:
 	DECLARE_DYNAMIC(CTrackHint)        // Required for MFC run-time type info.
@@ -389,16 +428,43 @@ struct adjustment
 class CHexExpr : public expr_eval
 {
 public:
-	CHexExpr(CHexEditDoc *pp) { pdoc = pp; }
+	CHexExpr(CHexEditDoc *pp, int use_bg = -1) { pdoc = pp; use_bg_ = use_bg; offset_ = 0; pbuf_ = NULL; buf_addr_ = 0; buf_len_ = 0; dep_mode_ = DEP_NONE; dep_elt_ = -1; }
+	int UseBg() const { return use_bg_; }
+	void SetSource(FILE_ADDRESS offset, const unsigned char *buf = NULL, FILE_ADDRESS buf_addr = 0, size_t buf_len = 0)
+	{
+		offset_ = offset; pbuf_ = buf; buf_addr_ = buf_addr; buf_len_ = buf_len;
+	}
 	value_t find_symbol(const char *sym, value_t parent, size_t index, int *pac,
 						__int64 &sym_size, __int64 &sym_address, CString &sym_str) override;
 	CHexExpr::value_t get_value(int ii, __int64 &sym_size, __int64 &sym_address);
 
+	// File bytes that the template tree depends on (see CHexEditDoc::df_layout_).  They are
+	// only recorded by the evaluator doing a full scan (see CHexEditDoc::scan_template) and
+	// stored in the document when the scan finishes, so that expressions evaluated by other
+	// threads while a background scan is running are not recorded.
+	enum { DEP_NONE, DEP_LAYOUT, DEP_VALUE };
+	int dep_mode_;                      // What file accesses are being recorded for
+	int dep_elt_;                       // Element whose domain is being checked (when dep_mode_ == DEP_VALUE)
+	range_set<FILE_ADDRESS> dep_layout_;
+	std::vector<FILE_ADDRESS> dep_address_;
+	std::vector<FILE_ADDRESS> dep_size_;
+	std::vector<size_t> dep_elt_list_;
+	void note_access(int ii, FILE_ADDRESS addr, FILE_ADDRESS len);   // Record bytes read when evaluating an expression
+
 private:
 	BOOL sym_found(const char * sym, int ii, CHexExpr::value_t &val, int *pac,
 				   __int64 &sym_size, __int64 &sym_address);
 
+	size_t get_data(unsigned char *buf, size_t len, FILE_ADDRESS addr);
+
 	CHexEditDoc *pdoc;
+	int use_bg_;                        // Thread number passed to GetData (-1 for main thread)
+
+	// Used when exporting array elements that are not in the tree (see TemplateExport.cpp)
+	FILE_ADDRESS offset_;               // Added to the address of elements read by get_value
+	const unsigned char *pbuf_;         // Data already read from the file (or NULL)
+	FILE_ADDRESS buf_addr_;             // File address of pbuf_[0]
+	size_t buf_len_;                    // Number of bytes at pbuf_
 };
 
 class CHexEditDoc : public CDocument
@@ -410,6 +476,7 @@ class CHexEditDoc : public CDocument
 	friend class CCompareView;
 	friend class CPrevwView;
 	friend class CHexExpr;
+	friend class CTemplateLock;
 
 protected: // create from serialization only
 		CHexEditDoc();
@@ -420,7 +487,7 @@ public:
 	CFile64 *pfile1_;
 	FILE_ADDRESS length() const { return length_; }
 	BOOL read_only() { return readonly_; }
-	int doc_flags() { return (keep_times_ ? 1 : 0) | (dffd_edit_mode_ ? 2 : 0); }
+	int doc_flags() { return (keep_times_ ? 1 : 0) | (dffd_edit_mode_ ? 2 : 0) | (compAnchored_ ? 4 : 0); }
 	BOOL readonly_;
 	BOOL shared_;
 
@@ -485,6 +552,7 @@ public:
 
 // Operations
 	size_t GetData(unsigned char *buf, size_t len, FILE_ADDRESS loc, int use_bg = -1);
+	FILE_ADDRESS HoleEnd(FILE_ADDRESS address);     // end of zeroes (not on disk) at address
 	BOOL WriteData(const CString fname, FILE_ADDRESS start, FILE_ADDRESS end, BOOL append = FALSE);
 	void WriteInPlace();
 	void Change(enum mod_type, FILE_ADDRESS address, FILE_ADDRESS len,
@@ -591,6 +659,8 @@ private:
 	void loc_add(pundo_t pu, FILE_ADDRESS &pos, ploc_t &pl);
 	void loc_del(FILE_ADDRESS address, FILE_ADDRESS len, FILE_ADDRESS &pos, ploc_t &pl);
 	void loc_split(FILE_ADDRESS address, FILE_ADDRESS pos, ploc_t pl);
+	void get_holes();       // Get file_holes_ from the file system
+	static range_set<FILE_ADDRESS> get_holes(CFile64 *pf);  // Get the holes of any (sparse) file
 
 	// We allow up to 4 external files to hold some of the file data (if too big for memory)
 	CFile64 *data_file_[4 /*doc_loc::max_data_files*/];     // Ptrs to files or NULL if not (yet) used
@@ -599,6 +669,7 @@ private:
 	CFile64 *data_file4_[4 /*doc_loc::max_data_files*/];    // Ptrs to dupes for use by background compare thread
 	CFile64 *data_file5_[4 /*doc_loc::max_data_files*/];    // Ptrs to dupes for use by background stats thread
 	CFile64 *data_file6_[4 /*doc_loc::max_data_files*/];    // Ptrs to dupes for use by preview thread
+	CFile64 *data_file7_[4 /*doc_loc::max_data_files*/];    // Ptrs to dupes for use by background template thread
 	BOOL temp_file_[4 /*doc_loc::max_data_files*/];         // Says if the file is temporary (should be deleted when doc closed)
 
 	// The following are used for change tracking
@@ -649,6 +720,10 @@ private:
 	// List of locations of where to find doc data (disk file/memory)
 	std::list <doc_loc> loc_;
 
+	// Holes (unallocated areas) of the original file if it is a sparse file.  These read as
+	// zeroes so are not read from disk, and bg scans skip them (see HoleEnd).
+	range_set<FILE_ADDRESS> file_holes_;
+
 public:
 	void CheckBGProcessing();   // check if bg searching or bg scan has finished
 
@@ -680,8 +755,9 @@ public:
 	UINT RunAerialThread();     // Main func in bg thread
 	int AerialProgress();       // 0 to 100 (or -1 if not scanning)
 
-	int GetBpe() { return bpe_; }
-	int NumElts() { return int((length_ - 1)/bpe_) + 1; }    // Number of elts required for the whole file
+	int GetBpe() { return bpe_; }  // Default bytes per elt for a new aerial view (whole file fits in aerial_max_)
+	void AerialWant(const void *pview, int bpe, FILE_ADDRESS start, FILE_ADDRESS end, bool heat = false);  // Say which part of the file a view is displaying
+	bool GetAerialBits(int bpe, FILE_ADDRESS first, FILE_ADDRESS count, unsigned char *dest, unsigned char fill, bool heat = false);
 
 	// Bitmap preview
 	void AddPreviewView(CHexEditView *pview);
@@ -786,6 +862,18 @@ public:
 	void StopStats();
 	int StatsProgress();      // How far are we through the file (0 to 100)
 
+	// Background template scan thread (BGTemplate.cpp)
+	BOOL ScanFileBG();        // Like ScanFile() but scan is done in background thread
+	void TemplateChange();    // Signal template thread to rescan if a scan is in progress (eg when doc changed)
+	UINT RunTemplateThread(); // Main func in bg thread (needs to be public so it can be called from bg_func)
+	void StartTemplate();
+	void StopTemplate();
+	int TemplateProgress();   // How far are we through the file (0 to 100)
+	bool TemplateScanning() const { return df_scanning_; }
+
+	// Export of template arrays to a table (TemplateExport.cpp)
+	bool ExportTemplateTable(size_t ii, hex::TableExporter &exporter);
+
 	FILE_ADDRESS GetByteCounts(std::vector<FILE_ADDRESS> &);  // returns largest count, or -4 if not on, or -2 if still in progress
 	int GetCRC32(unsigned long & crc32);     // returns -1, -2, -4, or 0 if CRC32 is passed bask in ref param
 	int GetMd5(unsigned char buf[16]);       // returns -1, -2, -4, or 0 if MD5 is passed back in buf
@@ -882,6 +970,7 @@ public:
 //    std::vector<CString> const &XMLFileList() const { return theApp.xml_file_name_; }
 	BOOL ScanInit();
 	BOOL ScanFile();
+	void ScanDirty();       // Recheck values of elements affected by replacements since the last scan
 	void CheckUpdate();
 
 	// Bitmap/preview stuff
@@ -947,20 +1036,34 @@ private:
 	CEvent start_aerial_event_; // Starts the thread going
 	enum BG_COMMAND aerial_command_;
 	enum BG_STATE   aerial_state_;
-	bool aerial_fin_;           // Flags that the bg scan is finished and the view needs updating
+	bool aerial_fin_;           // Flags that new tiles are available and the views need updating
 	unsigned char *aerial_buf_; // Buffer used for holding file data for scan
+	std::vector<unsigned char> aerial_elts_; // Elts calculated for the current tile
 
 	FILE_ADDRESS aerial_addr_;  // Current address we are processing (used to show progress)
+	FILE_ADDRESS aerial_start_, aerial_end_;  // Range of addresses being processed for the current tile
 
 	// NOTE: kala must not be modified while the bg thread is running!
 	std::vector<COLORREF> kala_;// 256 colours from the first hex view for use in aerial view
+	aerial_reducer aerial_reduce_; // converts bytes to elts using the kala_ colours
 
 	CFile64 *pfile3_;           // Using a copy of the file avoids synchronising access problems
 	// Also see data_file3_ (above)
 	int av_count_;              // Number of aerial views of this document
-	int bpe_;                   // Bytes per bitmap pixel (1 to 65536)
-	FIBITMAP *dib_;             // The FreeImage bitmap
-	int dib_size_;              // Actual number of bytes allocated
+	int bpe_;                   // Default bytes per bitmap pixel for new views (1 to 65536)
+	aerial_pyramid aerial_tiles_;  // Tiles of the "bitmap" at all BPEs (see AerialPyramid.h)
+	aerial_pyramid aerial_heat_tiles_;  // Tiles of the heat map (see AerialHeat.h)
+
+	// Each aerial view tells us the part of the file it is displaying and at what BPE so that the
+	// bg thread only calculates the tiles that are needed.
+	struct aerial_want
+	{
+		const void *pview;
+		int level;              // aerial_pyramid level (log2 of BPE)
+		FILE_ADDRESS start, end;
+		bool heat;              // heat map rather than colour of bytes
+	};
+	std::vector<aerial_want> aerial_want_;
 
 	// MAX_WIDTH = widest we can "reshape" the bitmap to.  Like any width used for the bitmap it must
 	// be a multiple of 8 (so there are never "pad" bytes on the end of scan lines).
@@ -969,8 +1072,9 @@ private:
 
 	void CreateAerialThread();  // Create background thread which fills in the aerial view bitmap
 	void KillAerialThread();    // Kill background thread ASAP
-	void GetAerialBitmap(int clear = 0xC0); // Check if bitmap has been allocated/is big enough and get it if not
 	bool AerialProcessStop();   // Check if the scanning should stop
+	bool aerial_next(bool &heat, int &level, FILE_ADDRESS &tile, FILE_ADDRESS &first, FILE_ADDRESS &last);  // Find a wanted tile to calculate
+	void aerial_change(enum mod_type utype, FILE_ADDRESS address, FILE_ADDRESS len);  // Invalidate tiles affected by a change
 
 	// ------------- bitmap preview view (see BGpreview.cpp) -----------
 	CWinThread *pthread6_;       // Ptr to thread or NULL
@@ -1007,15 +1111,17 @@ private:
 	CFile64 *pfile1_compare_, *pfile4_compare_;   // The file we are comparing with (for fg + bg threads)
 	CString compFileName_;      // Name of file comparing with (or last compare file)
 	int compMinMatch_;          // Min number of match bytes when searching for insertions/deletions (min 7, or 0 if insertions/deletions not allowed)
+	bool compAnchored_;         // Find insertions/deletions by matching chunks (see AnchoredDiff.h) rather than using compMinMatch_
 	size_t GetCompData(unsigned char *buf, size_t len, FILE_ADDRESS loc, bool use_bg = false);  // bytes from compare file
 	bool CreateCompThread();  // Create background thread which does the compare
 	void KillCompThread();    // Kill background thread ASAP
 	bool OpenCompFile();
 	void CloseCompFile();
-	bool MakeTempFile();
+	bool MakeSnapshot();        // create snap_ (if not already) with the current file
+	bool TakeSnapshot();        // update snap_ with changes to the file
 	bool CompProcessStop();     // Check if the scanning should stop (called in the thread)
 	bool bCompSelf_;            // says if we are comparing with earlier version of same file
-	CString tempFileA_, tempFileB_; // when doing self-compare we need to make 2 temp copies of the file
+	snapshot_store *snap_;      // when doing self-compare keeps the current and previous versions of the file
 
 	int cv_count_;              // Number of aerial views of this document
 	CWinThread *pthread4_;      // Ptr to thread or NULL
@@ -1039,9 +1145,20 @@ private:
 			m_insert_A.clear();   m_insert_B.clear();   m_insert_len.clear();
 			m_delete_A.clear();   m_delete_B.clear();   m_delete_len.clear();
 			m_replace_A.clear();  m_replace_B.clear();  m_replace_len.clear();
+			m_index_A.clear();    m_index_B.clear();
 			m_fileTime = tm;
 		}
-		void Final() { m_compTime = CTime::GetCurrentTime(); }
+		void Final()
+		{
+			// Build the indexes used for navigation (insertions in A are deletions in B and vice versa)
+			m_index_A.build(m_replace_A, m_replace_B, m_replace_len,
+			                m_insert_A,  m_delete_B,  m_insert_len,
+			                m_delete_A,  m_insert_B,  m_delete_len);
+			m_index_B.build(m_replace_B, m_replace_A, m_replace_len,
+			                m_insert_B,  m_delete_A,  m_delete_len,
+			                m_delete_B,  m_insert_A,  m_insert_len);
+			m_compTime = CTime::GetCurrentTime();
+		}
 
 	private:
 		// These vectors store info about the 3 types of diffs found.
@@ -1057,11 +1174,20 @@ private:
 		std::vector<FILE_ADDRESS> m_replace_B;
 		std::vector<FILE_ADDRESS> m_replace_len;
 
+		// All of the above merged and sorted by address in each file (built by Final())
+		diff_index m_index_A;
+		diff_index m_index_B;
+
 		CTime m_fileTime;        // file modification time when we did the compare (used to check for file changes)
 		CTime m_compTime;        // when we did the compare (used to "age" the diffs when comparing to oneself)
 	};
 
 	std::deque<CompResult> comp_;
+	diff_index comp_all_;       // diffs of all results in comp_ (in original file) for self-compare
+	void update_comp_all();
+	void RunAnchoredCompare(CompResult &result);    // compare by matching chunks (called in the thread)
+	bool RunParallelCompare(CompResult &result);    // compare without insertions/deletions using several threads
+	bool RunSnapshotCompare(CompResult &result, int min_match);  // self-compare of just the blocks that changed
 	std::pair<FILE_ADDRESS, FILE_ADDRESS> get_first_diff(bool other, int rr);
 	std::pair<FILE_ADDRESS, FILE_ADDRESS> get_prev_diff(bool other, FILE_ADDRESS from, int rr);
 	std::pair<FILE_ADDRESS, FILE_ADDRESS> get_next_diff(bool other, FILE_ADDRESS from, int rr);
@@ -1106,6 +1232,32 @@ private:
 	unsigned char sha256_[32];  // SHA2-256 message digest if theApp.bg_stats_sha256_ == TRUE
 	unsigned char sha512_[64];  // SHA2-512 message digest if theApp.bg_stats_sha512_ == TRUE
 
+	// ------- To scan the file using the template in background thread (see BGTemplate.cpp) ----------
+	CWinThread *pthread7_;      // Ptr to background template thread or NULL
+	CEvent start_template_event_; // Signal to bg thread to start scan, or check for termination
+	enum BG_COMMAND template_command_; // signals thread to do something
+	enum BG_STATE   template_state_;   // indicates what the thread is doing
+	bool template_fin_;         // Flags that the scan is finished
+	bool template_extra_;       // Scan found data past the expected EOF (warning is shown when finished)
+	int template_progress_;     // How much has been done (if template_fin_ == false) in range: 0 to 100
+	size_t template_avail_;     // Number of elements (at start of df_address_ etc) that are complete
+
+	bool df_scanning_;          // Background scan started but views not yet updated (only used in main thread)
+	size_t df_shown_;           // Number of elements that views have been told about (only used in main thread)
+	bool df_keep_state_;        // Tree state was saved before the scan started so restore it when finished
+
+	CFile64 *pfile7_;           // We need a copy of file_ so we can access the same file for scanning
+	// Also see data_file7_ (above)
+
+	void CreateTemplateThread();// Create background thread which scans the file
+	void KillTemplateThread();  // Kill background thread ASAP
+	bool TemplateProcessStop(); // Check if the scanning should stop (called in the thread)
+	void template_lock();       // Get df_lock_ in the bg thread (throws STOP if scan is stopped while waiting)
+	void template_yield(size_t avail, FILE_ADDRESS addr);  // Publish partial results and let main thread at them
+	void template_swap();       // Swap elements being scanned with those published so far
+	void publish_index(std::shared_ptr<template_index> part);  // Add index of newly published elements to dfp_index_
+	bool template_done();       // Check (in main thread) if the bg scan has finished and report any problems
+
 	// -------------- template (DFFD) (see Template.cpp) ----------------
 	// Each df_size_ gives the size of a data field or whole array/structure.  If -ve take abs value.
 	// Each df_address_ gives the location within the file.  If -1, all or part is not present.
@@ -1120,6 +1272,7 @@ private:
 
 	int add_branch(CXmlTree::CElt parent, FILE_ADDRESS addr, unsigned char ind, CHexExpr &ee,
 				   FILE_ADDRESS &returned_size, int child_num = -1, bool ok_bitfield_at_end = false);
+	void check_domain(int ii, CHexExpr &ee, bool report);  // Make df_size_[ii] -ve if value is not in its domain
 	CHexExpr::value_t Evaluate(CString ss, CHexExpr &ee, int ref, int &ref_ac);
 
 	BOOL df_init_;
@@ -1143,8 +1296,68 @@ private:
 	std::vector<ExprStringType> df_info_;   // Info for user ("expr" for STRUCT, jump address for JUMP, etc)
 	std::vector<unsigned char> df_indent_;  // Use in CTreeColumn (1=root 2=branch off root etc)
 	unsigned char max_indent_;              // The largest value in df_indent_
+	template_index df_index_;               // Address index of data elements (built at end of ScanFile)
+	void build_index();
+	void add_to_index(template_index &index, size_t first, size_t last, bool valid_only);
+	void export_more(hex::TableExporter &exporter, FILE_ADDRESS addr, FILE_ADDRESS elt_size, size_t count,
+					 FILE_ADDRESS first_addr, std::function<void(CHexExpr &, std::vector<hex::Cell> &)> get_row,
+					 size_t num_cols, std::function<void(size_t)> progress);  // Export array elements not in the tree (see TemplateExport.cpp)
+	void clear_tree();
+	bool scan_template(CHexExpr &ee);       // Does the work of ScanFile - returns true if data found past expected EOF
+	void report_scan(bool extra);           // Displays any problems found in scan_template
+	clock_t df_scan_start_;                 // When the current scan started (used to decide if the tree is worth caching)
+
+	// Cache of the tree saved between sessions (TemplateCache.cpp)
+	CString template_cache_name(bool create);
+	bool can_cache_template();
+	void save_template_cache(bool extra);   // Saves the tree if the scan was slow
+	bool load_template_cache();             // Restores the tree (instead of scanning) if the cache is valid
+	bool restore_template_cache(const unsigned char *base, size_t file_len, bool &extra);
+
+	// While the template is being scanned in the background the tree is built in the vectors
+	// above (df_address_ etc) by the template thread.  Any elements that are complete are
+	// copied to the vectors below.  When the template thread lets other threads at the tree
+	// (see template_yield) the vectors are swapped so that df_address_ etc only contain the
+	// completed elements.  Other threads must lock df_lock_ before accessing them (the main
+	// thread uses CTemplateLock).
+	CCriticalSection df_lock_;
+	std::vector<signed char> dfp_type_;
+	std::vector<FILE_ADDRESS> dfp_size_;
+	std::vector<FILE_ADDRESS> dfp_address_;
+	std::vector<size_t> dfp_extra_;
+	std::vector<CXmlTree::CElt> dfp_elt_;
+	std::vector<ExprStringType> dfp_info_;
+	std::vector<unsigned char> dfp_indent_;
+	unsigned char dfp_max_indent_;
+
+	// The template thread only lets go of df_lock_ every 50 msecs (see template_yield) unless
+	// the main thread is waiting for it - see CTemplateLock which counts waiters in df_wanted_.
+	volatile LONG df_wanted_;
+
+	// The hex view needs to find the published elements (see FindDffdEltsIn) whenever it draws
+	// but df_index_ is only built when the scan finishes, so the template thread also indexes
+	// them when they are published.  The parts of this index are never changed once published
+	// so the main thread only needs docdata_ to get the list of parts, not df_lock_.  Each time
+	// elements are published a part is made for them and merged with any parts that are not
+	// much bigger, so there are only O(log n) parts to search.
+	typedef std::vector<std::shared_ptr<const template_index> > index_parts_t;
+	std::shared_ptr<const index_parts_t> dfp_index_;
+	std::shared_ptr<const index_parts_t> published_index();
 
 	int in_jump_;                           // Keep track of nested jumps (we don't update progress bar in JUMPs since address is funny)
+	int in_absent_;                         // Nesting of add_branch for elts not in the file (their rows are changed afterwards so are not published)
+
+	// Incremental update: the layout of the tree (addresses, sizes, array counts, which IF/SWITCH
+	// branches are taken, etc) only depends on the file bytes recorded in df_layout_.  If bytes are
+	// replaced that are not in df_layout_ then only the domain of the data elements that overlap the
+	// change (or whose domain expression reads the changed bytes) needs to be checked again.
+	// (These are recorded in the CHexExpr of the scan - see CHexExpr::note_access.)
+	range_set<FILE_ADDRESS> df_layout_;     // File bytes that determine the layout of the tree
+	std::vector<FILE_ADDRESS> df_dep_address_; // Bytes read by the domain expression of another element ...
+	std::vector<FILE_ADDRESS> df_dep_size_;
+	std::vector<size_t> df_dep_elt_list_;   // ... and the element whose domain it was
+	range_set<FILE_ADDRESS> df_dirty_;      // Bytes replaced since the last scan whose elements need rechecking
+	void dffd_change(enum mod_type utype, FILE_ADDRESS address, FILE_ADDRESS len);  // Work out if a full scan is needed
 
 	// These are used for keeping track of consecutive bitfields
 	FILE_ADDRESS last_size_;                // Storage unit size of previous element if a bitfield (1,2,4, or 8) or 0
@@ -1154,6 +1367,7 @@ private:
 	// Storage for enums
 	typedef std::map<__int64, CString> enum_t; // One enum: maps values to names
 	std::map<MSXML2::IXMLDOMElementPtr::Interface *, enum_t> df_enum_; // Stores all enums: maps an element to its enum
+	std::map<MSXML2::IXMLDOMElementPtr::Interface *, enum_t> dfp_enum_; // Enums of published elements (see df_lock_)
 	bool add_enum(CXmlTree::CElt &ee, LPCTSTR estr); // Returns false if error parsing enum string
 	enum_t &get_enum(CXmlTree::CElt &ee);   // Returns ref. to enum for an element
 	ExprStringType get_str(CHexExpr::value_t val, int ii);
@@ -1163,5 +1377,35 @@ private:
 #endif
 };
 
+// Locks the template tree (df_address_ etc) in the main thread.  While it is waiting the
+// template thread is asked to let go of the lock at the next element (see template_yield)
+// rather than at the end of its time slice, so that the views do not stall during a scan.
+// Use Unlock() and Lock() to let the scan continue while a menu or dialog is displayed.
+class CTemplateLock
+{
+public:
+	explicit CTemplateLock(CHexEditDoc *pdoc) : pdoc_(pdoc), locked_(false) { Lock(); }
+	~CTemplateLock() { if (locked_) Unlock(); }
+
+	void Lock()
+	{
+		ASSERT(!locked_);
+		::InterlockedIncrement(&pdoc_->df_wanted_);
+		pdoc_->df_lock_.Lock();
+		::InterlockedDecrement(&pdoc_->df_wanted_);
+		locked_ = true;
+	}
+	void Unlock()
+	{
+		ASSERT(locked_);
+		pdoc_->df_lock_.Unlock();
+		locked_ = false;
+	}
+
+private:
+	CHexEditDoc *pdoc_;
+	bool locked_;
+};
+
 /////////////////////////////////////////////////////////////////////////////
 #endif
@@ -29,6 +29,7 @@
 #include "Boyer.h"
 #include "SystemSound.h"
 #include "Misc.h"
+#include "ByteText.h"     // For hex text export and copy
 #include "BCGMisc.h"
 #include "Serialization/SRecordExporter.h"  // For import of Motorola S record files
 #include "Serialization/SRecordImporter.h"  // For import of Motorola S record files
@@ -720,7 +721,7 @@ BEGIN_MESSAGE_MAP(CHexEditView, CScrView)
 
 /////////////////////////////////////////////////////////////////////////////
 // CHexEditView construction/destruction
-	CHexEditView::CHexEditView() : tip_(INFOTIPS_OPTIONS_PAGE), sel_tip_(DISPLAY_OPTIONS_PAGE), ruler_tip_(DISPLAY_OPTIONS_PAGE)
+	CHexEditView::CHexEditView() : tip_(INFOTIPS_OPTIONS_PAGE), sel_tip_(DISPLAY_OPTIONS_PAGE), ruler_tip_(DISPLAY_OPTIONS_PAGE), bg_spans_(BG_LAYERS)
 {
 	nav_moves_ = -1;
 	expr_.SetView(this);
@@ -958,6 +959,7 @@ void CHexEditView::OnInitialUpdate()
 
 		std::istringstream strstr((const char *)pfl->GetData(recent_file_index, CHexFileList::HIGHLIGHTS));
 		strstr >> hl_set_;
+		bg_spans_.invalidate(BG_HIGHLIGHT);
 
 		CRect newpos;
 		newpos.top =  atoi(pfl->GetData(recent_file_index, CHexFileList::TOP));
@@ -2018,6 +2020,20 @@ void CHexEditView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 		CHexHint *phh = dynamic_cast<CHexHint *>(pHint);
 		ASSERT(phh->address >= 0 && phh->address <= GetDocument()->length());
 
+		// Make sure the changed bytes are read again when redrawn (insertions and deletions move all following bytes)
+		if (phh->utype == mod_replace || phh->utype == mod_repback)
+			window_buf_.invalidate(phh->address, phh->address + phh->len);
+		else
+			window_buf_.invalidate(phh->address);
+		// Also update the repeat index and the backgrounds (change tracking and highlights)
+		FILE_ADDRESS old_len = phh->len, new_len = phh->len;
+		if (phh->utype == mod_insert || phh->utype == mod_insert_file)
+			old_len = 0;
+		else if (phh->utype == mod_delback || phh->utype == mod_delforw)
+			new_len = 0;
+		repeat_idx_.change(phh->address, old_len, new_len, GetDocument()->length());
+		change_bg_spans(phh->address, old_len, new_len);
+
 		// Is this the start of a doc modification?
 		// (phh->index == -1 if this a continued modification)
 		if (!phh->is_undo && phh->index > -1)
@@ -2084,63 +2100,12 @@ void CHexEditView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 				mark_ = phh->address;
 		}
 
-		// Fix highlights
+		// Fix highlights (bytes inserted within a highlight are highlighted,
+		// deleted ones are removed and following highlights are moved)
 		if (phh->utype == mod_insert || phh->utype == mod_insert_file)
-		{
-			range_set<FILE_ADDRESS>::range_t::iterator pp =
-				lower_bound(hl_set_.range_.begin(),
-							hl_set_.range_.end(),
-							range_set<FILE_ADDRESS>::segment(phh->address+1, phh->address+1),
-							segment_compare());
-			// If there is a highlight before insert posn check if insert is within it
-			if (pp != hl_set_.range_.begin())
-			{
-				pp --;
-				// If bytes inserted within highlight move end
-				if (pp->slast > phh->address)
-					pp->slast += phh->len;
-				++pp;
-			}
-			// Move up all the following highlights
-			for ( ; pp != hl_set_.range_.end(); ++pp)
-			{
-				ASSERT(pp->sfirst > phh->address);
-				pp->sfirst += phh->len;
-				pp->slast += phh->len;
-			}
-		}
+			hl_set_.shift(phh->address, phh->len);
 		else if (phh->utype == mod_delback || phh->utype == mod_delforw)
-		{
-			// Remove highlights for deleted bytes (if any)
-			hl_set_.erase_range(phh->address, phh->address+phh->len);
-			range_set<FILE_ADDRESS>::range_t::iterator pp =
-				lower_bound(hl_set_.range_.begin(),
-							hl_set_.range_.end(),
-							range_set<FILE_ADDRESS>::segment(phh->address, phh->address),
-							segment_compare());
-			if (pp != hl_set_.range_.begin() && pp != hl_set_.range_.end())
-			{
-				range_set<FILE_ADDRESS>::range_t::iterator tmp = pp;
-				tmp--;
-				// If previous abuts current then join them together
-				if (pp->sfirst - phh->len <= tmp->slast)
-				{
-					ASSERT(pp->sfirst - phh->len == tmp->slast);
-					tmp->slast = pp->slast - phh->len;
-					// Remove extra list elt (and leave pp pointing to next)
-					tmp = pp;
-					pp++;
-					hl_set_.range_.erase(tmp);
-				}
-			}
-			// Move all the following highlights down
-			for ( ; pp != hl_set_.range_.end(); ++pp)
-			{
-				ASSERT(pp->sfirst > phh->address);
-				pp->sfirst -= phh->len;
-				pp->slast -= phh->len;
-			}
-		}
+			hl_set_.shift(phh->address, -phh->len);
 
 		// Work out the addresses of the first and last line displayed
 		CRect rct;
@@ -2261,6 +2226,7 @@ void CHexEditView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 			// Remove all displayed search strings (but save a copy in tmp for invalidating)
 			std::vector<std::pair<FILE_ADDRESS, FILE_ADDRESS> > tmp;
 			tmp.swap(search_pair_);    // Save search_pair_ in tmp (and make it empty)
+			bg_spans_.invalidate(BG_SEARCH);
 
 			// Invalidate any areas where search string is currently displayed
 			std::vector<std::pair<FILE_ADDRESS, FILE_ADDRESS> >::const_iterator pp, pend;
@@ -2268,8 +2234,9 @@ void CHexEditView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 				invalidate_addr_range(pp->first, pp->second);
 		}
 	}
-	else if (pHint != NULL && pHint->IsKindOf(RUNTIME_CLASS(CDFFDHint)))
+	else if (pHint != NULL && (pHint->IsKindOf(RUNTIME_CLASS(CDFFDHint)) || pHint->IsKindOf(RUNTIME_CLASS(CDFFDPartialHint))))
 	{
+		// Template changed or more of it is available from the background scan - just redo the field areas
 		std::vector<boost::tuple<FILE_ADDRESS, FILE_ADDRESS, COLORREF> > tmp;
 		tmp.swap(dffd_bg_);   // save old bg areas to invalidate below
 		get_dffd_in_range(GetScroll());
@@ -2281,6 +2248,11 @@ void CHexEditView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 		for (pdffd = dffd_bg_.rbegin(), penddffd = dffd_bg_.rend(); pdffd != penddffd; ++pdffd)
 			invalidate_addr_range(pdffd->get<0>(), pdffd->get<1>());
 	}
+	else if (pHint != NULL && pHint->IsKindOf(RUNTIME_CLASS(CDFFDValueHint)))
+	{
+		// Only template values changed (the bytes changed are redrawn for the CHexHint) and
+		// the template field areas/colours are the same so there is nothing to do
+	}
 	else if (pHint != NULL && pHint->IsKindOf(RUNTIME_CLASS(CSaveStateHint)))
 	{
 	}
@@ -2294,14 +2266,21 @@ void CHexEditView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 	}
 	else if (pHint != NULL && pHint->IsKindOf(RUNTIME_CLASS(CTrackHint)))
 	{
-		if (!display_.hide_replace || !display_.hide_insert || !display_.hide_delete)
+		CTrackHint *pth = dynamic_cast<CTrackHint *>(pHint);
+		if (pth->reset_)
 		{
-			CTrackHint *pth = dynamic_cast<CTrackHint *>(pHint);
-			invalidate_addr_range(pth->start_, pth->end_);
+			// Else the change tracking backgrounds are updated when we get the CHexHint
+			bg_spans_.invalidate(BG_TRK_INSERT);
+			bg_spans_.invalidate(BG_TRK_REPLACE);
 		}
+		if (!display_.hide_replace || !display_.hide_insert || !display_.hide_delete)
+			invalidate_addr_range(pth->start_, pth->end_);
 	}
 	else
 	{
+		window_buf_.clear();        // file may have changed on disk
+		repeat_idx_.reset(0, 0, 0); // rebuilt when printing (see OnDraw)
+		bg_spans_.invalidate_all(); // also sent when compare results change (CCompHint)
 		recalc_display();
 		CScrView::OnUpdate(pSender, lHint, pHint);
 	}
@@ -3194,6 +3173,7 @@ void CHexEditView::get_search_in_range(CPointAp &pos)
 	// Get search occurrences currently in display area whenever we change the scroll posn -
 	// this saves checking all addresses (could be millions) in OnDraw
 	search_pair_.clear();
+	bg_spans_.invalidate(BG_SEARCH);
 	if (GetDocument()->CanDoSearch() && theApp.pboyer_ != NULL)
 	{
 		CHexEditDoc *pdoc = GetDocument();
@@ -3241,6 +3221,7 @@ void CHexEditView::get_dffd_in_range(CPointAp &pos)
 {
 	// Get template fields (address range and background colour) in the display area
 	dffd_bg_.clear();
+	bg_spans_.invalidate(BG_TEMPLATE);
 	if (pdfv_ != NULL)
 	{
 		CRect cli;
@@ -5768,6 +5749,7 @@ void CHexEditView::OnHighlightClear()
 		undo_.push_back(view_undo(undo_highlight));
 		undo_.back().phl = new range_set<FILE_ADDRESS>(hl_set_);
 		hl_set_.clear();
+		bg_spans_.invalidate(BG_HIGHLIGHT);
 		DoInvalidate();
 	}
 	aa->SaveToMacro(km_highlight);
@@ -5892,13 +5874,12 @@ void CHexEditView::add_highlight(FILE_ADDRESS start, FILE_ADDRESS end, BOOL ptoo
 		undo_.push_back(view_undo(undo_highlight, ptoo));
 		undo_.back().phl = new range_set<FILE_ADDRESS>(hl_set_);
 
-		range_set<FILE_ADDRESS> tt = hl_set_;
-		tt.insert_range(start, end);
 		// If selected area is already part of highlighted area
-		if (tt == hl_set_)
+		if (hl_set_.contains_range(start, end))
 			hl_set_.erase_range(start, end);    // Remove it from highlight
 		else
-			hl_set_.swap(tt);                   // else add it to highlight
+			hl_set_.insert_range(start, end);   // else add it to highlight
+		bg_spans_.invalidate(BG_HIGHLIGHT);
 		invalidate_addr_range(start, end);
 	}
 }
@@ -7434,6 +7415,7 @@ void CHexEditView::do_import(hex::HexImporter& importer, km_type macro_type)
 			undo_.push_back(view_undo(undo_highlight));
 			undo_.back().phl = new range_set<FILE_ADDRESS>(hl_set_);
 			hl_set_.clear();
+			bg_spans_.invalidate(BG_HIGHLIGHT);
 			DoInvalidate();
 			ptoo = TRUE;
 		}
@@ -8144,19 +8126,21 @@ void CHexEditView::OnExportHexText()
 		return;
 	}
 
-	// This could be perhaps 2 or 3 times faster by buffering more than a line of text at a time
+	// Several lines are read, converted and written at a time as doing it a line at a time is slow
+	size_t line_len = theApp.export_line_len_;
+	size_t block_len = std::max<size_t>(1, 65536/line_len) * line_len;  // bytes processed at a time
 
 	// Buffer used to hold bits of the binary file to convert
 	unsigned char *buf = NULL;  // Buffer to hold some input
-	char *out = NULL;           // Buffer for output of one line of text
+	char *out = NULL;           // Buffer for output of the lines of text
 	unsigned char *pin;
 	FILE_ADDRESS curr;
 	size_t len;
 
 	try
 	{
-		buf = new unsigned char[theApp.export_line_len_];
-		out = new char[3*theApp.export_line_len_ + 5];
+		buf = new unsigned char[block_len];
+		out = new char[3*block_len + 2*(block_len/line_len)];
 	}
 	catch (std::bad_alloc)
 	{
@@ -8165,31 +8149,23 @@ void CHexEditView::OnExportHexText()
 		goto func_return;
 	}
 
-	const char *hex;
-	if (theApp.hex_ucase_)
-		hex = "0123456789ABCDEF?";
-	else
-		hex = "0123456789abcdef?";
-
 	clock_t last_checked = clock();
 
 	for (curr = start_addr; curr < end_addr; curr += len)
 	{
 		// Get the data bytes
-		len = size_t(std::min(FILE_ADDRESS(theApp.export_line_len_), end_addr - curr));
+		len = size_t(std::min(FILE_ADDRESS(block_len), end_addr - curr));
 		VERIFY(GetDocument()->GetData(buf, len, curr) == len);
 
-		// Convert to hex text
+		// Convert to hex text a line at a time
 		char *pout = out;
 
-		for(pin = buf; pin < buf+len; ++pin)
+		for (pin = buf; pin < buf+len; pin += line_len)
 		{
-			*pout++ = hex[(*pin>>4)&0xF];
-			*pout++ = hex[*pin&0xF];
-			*pout++ = ' ';
+			pout = hex_bytes(pout, pin, std::min(line_len, size_t(buf+len - pin)), theApp.hex_ucase_ != 0);
+			*pout++ = '\r';
+			*pout++ = '\n';
 		}
-		*pout++ = '\r';
-		*pout++ = '\n';
 
 		// Write the string to the file
 		try
@@ -8738,29 +8714,33 @@ bool CHexEditView::copy2cb_hextext(FILE_ADDRESS start, FILE_ADDRESS end, bool fr
 		return false;
 	}
 
-	unsigned char cc;
-	const char *hex;
-	if (theApp.hex_ucase_)
-		hex = "0123456789ABCDEF?";
-	else
-		hex = "0123456789abcdef?";
+	unsigned char buf[8192];
+	size_t len;
 
 	pp = p_cb;
 
-	FILE_ADDRESS curr;
-	for (curr = start; curr < end; )
+	FILE_ADDRESS curr = start;
+	while (curr < end)
 	{
+		// Get the next buffer full from the document
+		len = size_t(std::min<FILE_ADDRESS>(sizeof(buf), end - curr));
 		if (fromCompFile)
-			VERIFY(GetDocument()->GetCompData(&cc, 1, curr) == 1);
+			VERIFY(GetDocument()->GetCompData(buf, len, curr) == len);
 		else
-			VERIFY(GetDocument()->GetData(&cc, 1, curr) == 1);
-		*pp++ = hex[(cc>>4)&0xF];
-		*pp++ = hex[cc&0xF];
-		*pp++ = ' ';
-		if ((++curr + offset_)%rowsize_ == 0)
+			VERIFY(GetDocument()->GetData(buf, len, curr) == len);
+
+		// Convert up to the end of each row then start a new line
+		for (unsigned char *pin = buf; pin < buf + len; )
 		{
-			*pp++ = '\r';
-			*pp++ = '\n';
+			size_t nn = std::min(size_t(buf + len - pin), size_t(rowsize_ - (curr + offset_)%rowsize_));
+			pp = hex_bytes(pp, pin, nn, theApp.hex_ucase_ != 0);
+			pin += nn;
+			curr += nn;
+			if ((curr + offset_)%rowsize_ == 0)
+			{
+				*pp++ = '\r';
+				*pp++ = '\n';
+			}
 		}
 	}
 	if ((curr + offset_)%rowsize_ != 0)
@@ -10286,6 +10266,7 @@ BOOL CHexEditView::do_undo()
 
 	case undo_highlight:
 		hl_set_ = *(undo_.back().phl);
+		bg_spans_.invalidate(BG_HIGHLIGHT);
 		DoInvalidate();
 		break;
 	case undo_unknown:
@@ -17102,7 +17083,7 @@ bool CHexEditView::DoCompSplit(bool auto_sync, bool auto_scroll, CString compare
 	// Update compare parameters
 	GetDocument()->bCompSelf_ = compareFile == "*";
 	if (GetDocument()->bCompSelf_)
-		VERIFY(GetDocument()->MakeTempFile());
+		VERIFY(GetDocument()->MakeSnapshot());
 	else
 		GetDocument()->compFileName_ = compareFile;
 
@@ -17168,7 +17149,7 @@ bool CHexEditView::DoCompTab(bool auto_sync, bool auto_scroll, CString compareFi
 
 	GetDocument()->bCompSelf_ = compareFile == "*";
 	if (GetDocument()->bCompSelf_)
-		VERIFY(GetDocument()->MakeTempFile());
+		VERIFY(GetDocument()->MakeSnapshot());
 	else
 		GetDocument()->compFileName_ = compareFile;
 
@@ -14,6 +14,10 @@
 #include "optypes.h"
 // #include "Partition.h" // no longer used when schemes added
 #include "range_set.h"
+#include "RepeatIndex.h"
+#include "RowFormatter.h"
+#include "SpanIndex.h"
+#include "WindowBuffer.h"
 #include "Serialization/HexExporter.h"
 #include "Serialization/HexImporter.h"
 #include "TipWnd.h"
@@ -285,12 +289,13 @@ public:
 						const CRectAp &doc_rect, bool neg_x, bool neg_y,
 						int line_height, int char_width, int char_width_w,
 						COLORREF colour);
-	void draw_backgrounds(CDC* pDC,
-						const std::vector<FILE_ADDRESS> & addr, const std::vector<FILE_ADDRESS> & len,
-						FILE_ADDRESS first_virt, FILE_ADDRESS last_virt,
-						const CRectAp &doc_rect, bool neg_x, bool neg_y,
-						int line_height, int char_width, int char_width_w,
-						COLORREF colour, bool merge = true, int draw_height = -1);
+	void draw_bg_spans(CDC* pDC, const CRectAp &doc_rect, bool neg_x, bool neg_y,
+					   int line_height, int char_width, int char_width_w,
+					   FILE_ADDRESS first_addr, FILE_ADDRESS last_addr, unsigned which);
+	void draw_runs(CDC* pDC, const row_formatter &rf, int left, int top, int cell_width,
+				   int dot_pad, int bad_pad, COLORREF &current_colour);
+	void update_bg_spans();
+	void change_bg_spans(FILE_ADDRESS addr, FILE_ADDRESS old_len, FILE_ADDRESS new_len);
 	void do_mouse(CPoint dev_down, CSizeAp doc_dist) ;
 	void do_shift_mouse(CPoint dev_down, CSizeAp doc_dist) ;
 	void do_autofit(int state = -1);
@@ -1016,6 +1021,13 @@ private:
 
 	CString scheme_name_;
 	COLORREF kala[256];         // Actual colours for each byte value
+	std::vector<int> run_dx_;   // character widths passed to ExtTextOut by draw_runs
+	window_buffer window_buf_;  // bytes of the lines displayed (see OnDraw)
+	repeat_index repeat_idx_;   // rows that are the same as the previous row (for merging duplicate lines when printing)
+
+	// Layers of bg_spans_ in the order they are drawn
+	enum { BG_TRK_INSERT, BG_TRK_REPLACE, BG_COMP_INSERT, BG_COMP_REPLACE, BG_HIGHLIGHT, BG_SEARCH, BG_TEMPLATE, BG_LAYERS };
+	span_index bg_spans_;       // backgrounds drawn by OnDraw (rebuilt from the sources below when invalidated)
 
 	// Current bg search position displayed
 //    std::vector<FILE_ADDRESS> search_found_;
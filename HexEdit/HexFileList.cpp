@@ -213,8 +213,20 @@ void CHexFileList::Add(LPCTSTR lpszPathName)
 	ASSERT(Check());
 }
 
+// Deletes the template cache file (see TemplateCache.cpp) of an entry, since they can be large
+void CHexFileList::delete_template_cache(int index)
+{
+	CString name = GetData(index, TEMPLATECACHE);
+	CString dir;
+	if (!name.IsEmpty() && ::GetDataPath(dir))
+		::DeleteFile(dir + DIRNAME_TEMPLATECACHE + name);
+}
+
 void CHexFileList::ClearAll()
 {
+	for (int ii = 0; ii < int(data_.size()); ++ii)
+		delete_template_cache(ii);
+
 	name_.clear();
 	hash_.clear();
 	opened_.clear();
@@ -238,6 +250,7 @@ void CHexFileList::Remove(int nIndex)
 	ASSERT(data_.size() == name_.size());
 
 	((CMainFrame *)AfxGetMainWnd())->UpdateExplorer(name_[nIndex]);  // Let explorer update (last opened time is now gone)
+	delete_template_cache(int(data_.size()) - nIndex - 1);
 
 	name_  .erase(name_  .begin() + (name_  .size() - nIndex - 1));
 	hash_  .erase(hash_  .begin() + (hash_  .size() - nIndex - 1));
@@ -340,6 +353,8 @@ bool CHexFileList::ReadFile()
 	{
 		CString ss;
 		ss.Format("Truncated recent file list to most recent %d files", max_keep);
+		for (int ii = 0; ii < int(data_.size()) - max_keep; ++ii)
+			delete_template_cache(ii);      // as for Remove()
 		name_.erase(name_.begin(), name_.begin() + (name_.size() - max_keep));
 		hash_.erase(hash_.begin(), hash_.begin() + (hash_.size() - max_keep));
 		opened_.erase(opened_.begin(), opened_.begin() + (opened_.size() - max_keep));
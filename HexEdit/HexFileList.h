@@ -42,6 +42,7 @@ public:
 					 PREVIEWVIEW, PREVIEWZOOM,            // used for preview of a file (no relationship to PREVIEWFILENAME) - currently just bitmap files
 					   PREVIEWX, PREVIEWY, PREVIEWBG,     // position (when zooomed in) and background type (for bitmaps with alpha channel)
 					 COMPMINMATCH, COMPMAXDIST,           // more compare params used by bg compare - (ie used by CHexEditDoc not CCompareView)
+					 TEMPLATECACHE,                       // name of file where the template tree is cached (see TemplateCache.cpp)
 	};
 
 // Attributes
@@ -84,6 +85,7 @@ public:
 protected:
 	bool ReadFile();
 	bool WriteFile();
+	void delete_template_cache(int index);
 #ifdef _DEBUG
 	bool Check();
 #endif
@@ -11,6 +11,7 @@
 #include "HexEdit.h"
 #include "HexEditDoc.h"
 #include "HexEditView.h"
+#include "ByteText.h"
 
 /////////////////////////////////////////////////////////////////////////////
 // CHexEditView drawing
@@ -204,6 +205,12 @@ void CHexEditView::OnDraw(CDC* pDC)
 			//  We don't know what the last line will be so set to end of selection
 			last_line = (last_addr - 1 + offset_)/rowsize_ + 1;
 			last_virt = last_line * rowsize_ - offset_;
+
+			// Find repeated rows in the rows that this page needs (rows already checked are not read again)
+			if (repeat_idx_.row_size() != rowsize_ || repeat_idx_.offset() != offset_)
+				repeat_idx_.reset(rowsize_, offset_, pDoc->length());
+			repeat_idx_.scan_lines([pDoc](unsigned char *pp, size_t len, FILE_ADDRESS addr) { return pDoc->GetData(pp, len, addr); },
+			                       first_line, last_line, lines_per_page_ + 1);
 		}
 
 		/* Work out where to display the 1st line */
@@ -469,21 +476,18 @@ void CHexEditView::OnDraw(CDC* pDC)
 						if (!between)
 						{
 							// Draw 2 digit number above every column
-							ss.Format(theApp.hex_ucase_ ? "%02X" : "%02x", (column + display_.addrbase1)%256);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char(column + display_.addrbase1), theApp.hex_ucase_ != 0), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else if (column%16 == 0 && theApp.ruler_hex_nums_ > 3)
 						{
 							// Draw 2 digit numbers to mark end of 16 columns
 							rect.left -= (char_width+1)/2;
-							ss.Format(theApp.hex_ucase_ ? "%02X" : "%02x", column%256);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char(column), theApp.hex_ucase_ != 0), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else
 						{
 							// Draw single digit number in between columns
-							ss.Format(theApp.hex_ucase_ ? "%1X" : "%1x", column%16);
-							pDC->DrawText(ss, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char(column%16), theApp.hex_ucase_ != 0) + 1, 1, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 					}
 				// Show hex offsets above char area or stacked display
@@ -510,19 +514,16 @@ void CHexEditView::OnDraw(CDC* pDC)
 
 						if (!between)
 						{
-							ss.Format(theApp.hex_ucase_ ? "%1X" : "%1x", (column + display_.addrbase1)%16);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char((column + display_.addrbase1)%16), theApp.hex_ucase_ != 0) + 1, 1, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else if (column%16 == 0 && theApp.ruler_hex_nums_ > 3)
 						{
 							rect.left -= (char_width+1)/2;
-							ss.Format(theApp.hex_ucase_ ? "%02X" : "%02x", column%256);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char(column), theApp.hex_ucase_ != 0), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else
 						{
-							ss.Format(theApp.hex_ucase_ ? "%1X" : "%1x", column%16);
-							pDC->DrawText(ss, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(hex_text(unsigned char(column%16), theApp.hex_ucase_ != 0) + 1, 1, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 					}
 				vert += text_height_;  // Move down for anything to be drawn underneath
@@ -558,19 +559,16 @@ void CHexEditView::OnDraw(CDC* pDC)
 						rect.right = rect.left + text_width_ + text_width_;
 						if (!between)
 						{
-							ss.Format("%02d", (column + display_.addrbase1)%100);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text((column + display_.addrbase1)%100), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else if (column%10 == 0 && theApp.ruler_dec_nums_ > 4)
 						{
 							rect.left -= (char_width+1)/2;
-							ss.Format("%02d", column%100);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text(column%100), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else
 						{
-							ss.Format("%1d", column%10);
-							pDC->DrawText(ss, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text(column%10) + 1, 1, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 					}
 				// Decimal offsets above char area or stacked display
@@ -597,21 +595,18 @@ void CHexEditView::OnDraw(CDC* pDC)
 
 						if (!between)
 						{
-							ss.Format("%1d", (column + display_.addrbase1)%10);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text((column + display_.addrbase1)%10) + 1, 1, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else if (column%10 == 0 && theApp.ruler_dec_nums_ > 4)
 						{
 							// If displaying nums every 5 or 10 then display 2 digits fo tens column
 							rect.left -= (char_width+1)/2;
-							ss.Format("%02d", column%100);
-							pDC->DrawText(ss, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text(column%100), 2, &rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 						else
 						{
 							// Display single dit between columns
-							ss.Format("%1d", column%10);
-							pDC->DrawText(ss, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
+							pDC->DrawText(dec_text(column%10) + 1, 1, &rect, DT_BOTTOM | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
 						}
 					}
 				vert += text_height_;   // Move down for anything to be drawn underneath (currently nothing)
@@ -977,39 +972,18 @@ void CHexEditView::OnDraw(CDC* pDC)
 	// Note that these are *not* drawn/printed if:
 	//  - during printing and global print_change_ settings is off
 	//  - deletions are not shown if view's hide_delete option is on
-	//  - insertions are not shown if view's hide_insert option is on
-	//  - replacements are not shown if view's hide_replace option is on
-	if (!pDC->IsPrinting() || theApp.print_change_)
+	//  - insertions/replacements are not shown if hidden (see draw_bg_spans)
+	if ((!pDC->IsPrinting() || theApp.print_change_) && !display_.hide_delete)
 	{
-		// Draw deletions unless hidden
-		if (!display_.hide_delete)
-		{
-			std::pair<std::vector<FILE_ADDRESS> *, std::vector<FILE_ADDRESS> *> alp = GetDocument()->Deletions();
-			draw_deletions(pDC, *alp.first, *alp.second,
-						   first_virt, last_virt, doc_rect, neg_x, neg_y,
-						   line_height, char_width, char_width_w, trk_col_);
-		}
-
-		// Draw insertions unless hidden
-		if (!display_.hide_insert)
-		{
-			std::pair<std::vector<FILE_ADDRESS> *, std::vector<FILE_ADDRESS> *> alp = GetDocument()->Insertions();
-			draw_backgrounds(pDC, *alp.first, *alp.second,
-							 first_virt, last_virt, doc_rect, neg_x, neg_y,
-							 line_height, char_width, char_width_w, trk_bg_col_);
-		}
-
-		// Draw replacements unless hidden
-		if (!display_.hide_replace)
-		{
-			std::pair<std::vector<FILE_ADDRESS> *, std::vector<FILE_ADDRESS> *> alp = GetDocument()->Replacements();
-			draw_backgrounds(pDC, *alp.first, *alp.second,
-							 first_virt, last_virt, doc_rect, neg_x, neg_y,
-							 line_height, char_width, char_width_w,	trk_col_,
-							 true, (pDC->IsPrinting() ? print_text_height_ : text_height_)/8);
-		}
+		std::pair<std::vector<FILE_ADDRESS> *, std::vector<FILE_ADDRESS> *> alp = GetDocument()->Deletions();
+		draw_deletions(pDC, *alp.first, *alp.second,
+					   first_virt, last_virt, doc_rect, neg_x, neg_y,
+					   line_height, char_width, char_width_w, trk_col_);
 	}
+	draw_bg_spans(pDC, doc_rect, neg_x, neg_y, line_height, char_width, char_width_w, first_addr, last_addr,
+				  (1u << BG_TRK_INSERT) | (1u << BG_TRK_REPLACE));
 
+	// Compare differences (deletions are drawn over change tracking but under compare insertions/replacements)
 	if (!((GetDocument()->CompareDifferences() <= 0) || pDC->IsPrinting() && !theApp.print_compare_))
 	{
 		CSingleLock sl(&(GetDocument()->docdata_), TRUE); // Protect shared data access to the returned vectors
@@ -1019,120 +993,27 @@ void CHexEditView::OnDraw(CDC* pDC)
 		draw_deletions(pDC, *alp.first, *alp.second,
 						first_virt, last_virt, doc_rect, neg_x, neg_y,
 						line_height, char_width, char_width_w, comp_col_);
-
-		alp = GetDocument()->OrigInsertions();
-		draw_backgrounds(pDC, *alp.first, *alp.second,
-							first_virt, last_virt, doc_rect, neg_x, neg_y,
-							line_height, char_width, char_width_w, comp_bg_col_);
-
-		alp = GetDocument()->OrigReplacements();
-		draw_backgrounds(pDC, *alp.first, *alp.second,
-							first_virt, last_virt, doc_rect, neg_x, neg_y,
-							line_height, char_width, char_width_w,	comp_col_,
-							true, (pDC->IsPrinting() ? print_text_height_ : text_height_)/8);
 	}
 
-	// Don't print highlights if hide_highlight is on OR printing and print_highlights_ is off
-	if (!(display_.hide_highlight || pDC->IsPrinting() && !theApp.print_highlights_))
-	{
-		if (!pDC->IsPrinting() && ScrollUp())
-		{
-			// Draw highlighted areas bottom up
-			range_set<FILE_ADDRESS>::range_t::reverse_iterator pr;
-			for (pr = hl_set_.range_.rbegin(); pr != hl_set_.range_.rend(); ++pr)
-				if (pr->sfirst < last_addr)
-					break;
-			for ( ; pr != hl_set_.range_.rend(); ++pr)
-			{
-				if (pr->slast <= first_addr)
-					break;
-				draw_bg(pDC, doc_rect, neg_x, neg_y,
-						line_height, char_width, char_width_w, hi_col_,
-						std::max(pr->sfirst, first_addr), 
-						std::min(pr->slast, last_addr));
-			}
-		}
-		else
-		{
-			// Draw highlighted areas top down
-			range_set<FILE_ADDRESS>::range_t::const_iterator pr;
-			for (pr = hl_set_.range_.begin(); pr != hl_set_.range_.end(); ++pr)
-				if (pr->slast > first_addr)
-					break;
-			for ( ; pr != hl_set_.range_.end(); ++pr)
-			{
-				if (pr->sfirst > last_addr)
-					break;
-				draw_bg(pDC, doc_rect, neg_x, neg_y,
-						line_height, char_width, char_width_w, hi_col_,
-						std::max(pr->sfirst, first_addr), 
-						std::min(pr->slast, last_addr));
-			}
-		}
-	}
-
-	if (pDC->IsPrinting())
-	{
-		// Only print search occurrences if print_search_ is on
-		if (theApp.print_search_)
-		{
-			// Draw search string occurrences
-			// Note this goes through all search occurrences (since search_pair_ is
-			// calculated for the current window) which may be slow but then so is printing.
-			std::vector<FILE_ADDRESS> sf = GetDocument()->SearchAddresses(first_addr-search_length_, last_addr+search_length_);
-			std::vector<FILE_ADDRESS>::const_iterator pp;
+	// Compare insertions/replacements, highlights, search occurrences and template fields
+	draw_bg_spans(pDC, doc_rect, neg_x, neg_y, line_height, char_width, char_width_w, first_addr, last_addr,
+				  ~((1u << BG_TRK_INSERT) | (1u << BG_TRK_REPLACE)));
 
-			for (pp = sf.begin(); pp != sf.end(); ++pp)
-			{
-				draw_bg(pDC, doc_rect, neg_x, neg_y,
-						line_height, char_width, char_width_w, search_col_,
-						std::max(*pp, first_addr), 
-						std::min(*pp + search_length_, last_addr));
-			}
-		}
-	}
-	else if (ScrollUp())
+	// Only print search occurrences if print_search_ is on
+	if (pDC->IsPrinting() && theApp.print_search_)
 	{
-		// Draw search string occurrences bottom up
-		std::vector<std::pair<FILE_ADDRESS, FILE_ADDRESS> >::reverse_iterator pp, pend;
-		for (pp = search_pair_.rbegin(), pend = search_pair_.rend(); pp != pend; ++pp)
-		{
-			draw_bg(pDC, doc_rect, neg_x, neg_y,
-					line_height, char_width, char_width_w, search_col_,
-					std::max(pp->first, first_addr), 
-					std::min(pp->second, last_addr));
-		}
+		// Draw search string occurrences
+		// Note this goes through all search occurrences (since search_pair_ is
+		// calculated for the current window) which may be slow but then so is printing.
+		std::vector<FILE_ADDRESS> sf = GetDocument()->SearchAddresses(first_addr-search_length_, last_addr+search_length_);
+		std::vector<FILE_ADDRESS>::const_iterator pp;
 
-		// Draw template field backgrounds bottom up
-		std::vector<boost::tuple<FILE_ADDRESS, FILE_ADDRESS, COLORREF> >::reverse_iterator pdffd, penddffd;
-		for (pdffd = dffd_bg_.rbegin(), penddffd = dffd_bg_.rend(); pdffd != penddffd; ++pdffd)
-		{
-			draw_bg(pDC, doc_rect, neg_x, neg_y,
-				line_height, char_width, char_width_w, pdffd->get<2>(),
-				std::max(pdffd->get<0>(), first_addr), 
-				std::min(pdffd->get<1>(), last_addr));
-		}
-	}
-	else
-	{
-		// Draw search string occurrences from top down
-		std::vector<std::pair<FILE_ADDRESS, FILE_ADDRESS> >::const_iterator pp, pend;
-		for (pp = search_pair_.begin(), pend = search_pair_.end(); pp != pend; ++pp)
+		for (pp = sf.begin(); pp != sf.end(); ++pp)
 		{
 			draw_bg(pDC, doc_rect, neg_x, neg_y,
 					line_height, char_width, char_width_w, search_col_,
-					std::max(pp->first, first_addr), 
-					std::min(pp->second, last_addr));
-		}
-
-		// Draw template field backgrounds from top down
-		std::vector<boost::tuple<FILE_ADDRESS, FILE_ADDRESS, COLORREF> >::const_iterator pdffd, penddffd;
-		for (pdffd = dffd_bg_.begin(), penddffd = dffd_bg_.end(); pdffd != penddffd; ++pdffd)
-		{
-			draw_bg(pDC, doc_rect, neg_x, neg_y,
-				line_height, char_width, char_width_w, pdffd->get<2>(),
-				std::max(pdffd->get<0>(), first_addr), 
-				std::min(pdffd->get<1>(), last_addr));
+					std::max(*pp, first_addr), 
+					std::min(*pp + search_length_, last_addr));
 		}
 	}
 
@@ -1142,7 +1023,7 @@ end_of_background_drawing:
 	size_t last_col = 0;                     // Number of bytes in buf to display
 	unsigned char prev_buf[max_buf];         // Copy of last buf - used for merging repeated lines
 	size_t prev_last_col;                    // Number of bytes in last buf that were displayed
-	int repeat_count = 0;                    // Number of consec. duplicate lines found so far
+	FILE_ADDRESS repeat_count = 0;           // Number of consec. duplicate lines found so far
 
 	// Move declarations outside loop (faster?)
 	CString ss(' ', 24);                     // Temp string for formatting
@@ -1167,6 +1048,42 @@ end_of_background_drawing:
 	if (display_.char_set == CHARSET_CODEPAGE && max_cp_bytes_ > 1)
 		cp_first = codepage_startchar(first_addr, last_addr);
 
+	// Used to format each line of the hex and char areas into runs of text of the same colour
+	row_formatter::options fmt_opt;
+	fmt_opt.ascii = display_.char_set == CHARSET_ASCII;
+	fmt_opt.ebcdic = display_.char_set == CHARSET_EBCDIC;
+	fmt_opt.oem = display_.char_set == CHARSET_OEM;
+	fmt_opt.control = display_.control;
+	fmt_opt.first_char = first_char_;
+	fmt_opt.last_char = last_char_;
+	fmt_opt.group_by = group_by_;
+	fmt_opt.upper_case = theApp.hex_ucase_ != 0;
+	fmt_opt.e2a = e2a_tab;
+	fmt_opt.colours = reinterpret_cast<const std::uint32_t *>(kala);   // COLORREF is a 32 bit DWORD
+	row_formatter formatter(fmt_opt);
+
+	// Get the bytes of all the lines to be displayed with one read into window_buf_, which only
+	// reads bytes it did not get for the last repaint (eg just the new line after a scroll)
+	const int extra_bytes = 8;      // we need to read extra bytes past the end of the line for displaying MBCS characters
+	FILE_ADDRESS win_start = 0, win_end = 0;
+	size_t win_len = 0;
+	if (!pDC->IsPrinting())
+	{
+		FILE_ADDRESS lo = std::min(first_line, last_line - line_inc), hi = std::max(first_line, last_line - line_inc) + 1;
+		win_start = std::max<FILE_ADDRESS>(0, lo*rowsize_ - offset_);
+		win_end = std::max(win_start, hi*rowsize_ - offset_ + extra_bytes);
+		win_len = window_buf_.fetch(win_start, win_end,
+		                            [pDoc](unsigned char *pp, size_t len, FILE_ADDRESS addr) { return pDoc->GetData(pp, len, addr); });
+	}
+	auto get_data = [&](unsigned char *pp, size_t len, FILE_ADDRESS addr) -> size_t
+	{
+		if (addr < win_start || addr + FILE_ADDRESS(len) > win_end)
+			return pDoc->GetData(pp, len, addr);  // printing (or not in the window)
+		size_t nn = size_t(std::max<FILE_ADDRESS>(0, std::min<FILE_ADDRESS>(len, win_start + win_len - addr)));
+		memcpy(pp, window_buf_.data() + (addr - win_start), nn);
+		return nn;
+	};
+
 	// THIS IS WHERE THE ACTUAL LINES ARE DRAWN
 	// Note: we use != (line != last_line) since we may be drawing from bottom or top
 	FILE_ADDRESS line;
@@ -1191,6 +1108,21 @@ end_of_background_drawing:
 		if (!pDC->RectVisible(&tt) || line*rowsize_ - offset_ > pDoc->length())
 			continue;
 
+		// Skip rows already known to repeat the last line output without reading them (but
+		// not the last row of the selection if it is only partly selected)
+		if (pDC->IsPrinting() && print_sel_ && dup_lines_ && (curpage_ > 0 || line > first_line+1) && last_col == size_t(rowsize_) &&
+			repeat_idx_.row_size() == rowsize_ && repeat_idx_.offset() == offset_ && repeat_idx_.repeated(line))
+		{
+			FILE_ADDRESS next = std::min(repeat_idx_.run_end(line), (last_addr + offset_)/rowsize_);
+			if (next > line)
+			{
+				repeat_count += next - line;
+				line = next - line_inc;
+				norm_rect -= rect_inc;
+				continue;
+			}
+		}
+
 		// Take a copy of the last line output to check for repeated lines
 		if (pDC->IsPrinting() && print_sel_ && dup_lines_ && last_col > 0)
 			memcpy(prev_buf, buf, last_col);
@@ -1198,18 +1130,17 @@ end_of_background_drawing:
 
 		// Get the bytes to display
 		size_t ii;                      // Column of first byte
-		const int extra_bytes = 8;      // we need to read extra bytes past the end of the line for displaying MBCS characters
 
 		if (line*rowsize_ - offset_ < first_addr)
 		{
-			last_col = pDoc->GetData(buf + offset_, rowsize_ - offset_ + extra_bytes, line*rowsize_) +
+			last_col = get_data(buf + offset_, rowsize_ - offset_ + extra_bytes, line*rowsize_) +
 						offset_;
 			ii = size_t(first_addr - (line*rowsize_ - offset_));
 			ASSERT(int(ii) < rowsize_);
 		}
 		else
 		{
-			last_col = pDoc->GetData(buf, rowsize_ + extra_bytes, line*rowsize_ - offset_);
+			last_col = get_data(buf, rowsize_ + extra_bytes, line*rowsize_ - offset_);
 			ii = 0;
 		}
 		if (last_col > rowsize_) last_col = rowsize_;  // Don't let extra_bytes affect number of columns to display
@@ -1241,7 +1172,7 @@ end_of_background_drawing:
 				if (repeat_count == 1)
 					mess = "Repeated once";
 				else
-					mess.Format("Repeated %d more times", repeat_count);
+					mess.Format("Repeated %I64d more times", repeat_count);
 				CRect mess_rect = tt;
 				mess_rect.left += hex_pos(0, char_width);
 				pDC->DrawText(mess, &mess_rect, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_SINGLELINE);
@@ -1313,11 +1244,9 @@ end_of_background_drawing:
 			{
 				int ww = hex_width_ + 1;
 				char *addr_buf = ss.GetBuffer(24);             // reserve space for 64 bit address
-				sprintf(addr_buf,
-					theApp.hex_ucase_ ? "%0*I64X:" : "%0*I64x:",
-						hex_width_,
-						(line*rowsize_ - offset_ > first_addr ? line*rowsize_ - offset_ : first_addr) + display_.addrbase1);
-				ss.ReleaseBuffer(-1);
+				char *pp = format_hex(addr_buf, (line*rowsize_ - offset_ > first_addr ? line*rowsize_ - offset_ : first_addr) + display_.addrbase1, hex_width_, theApp.hex_ucase_ != 0);
+				*pp++ = ':';
+				ss.ReleaseBuffer(int(pp - addr_buf));
 				if (theApp.nice_addr_)
 				{
 					AddSpaces(ss);
@@ -1333,11 +1262,9 @@ end_of_background_drawing:
 			{
 				int ww = dec_width_ + 1;
 				char *addr_buf = ss.GetBuffer(24);             // reserve space for 64 bit address
-				sprintf(addr_buf,
-						"%*I64d:",
-						dec_width_,
-						(line*rowsize_ - offset_ > first_addr ? line*rowsize_ - offset_ : first_addr) + display_.addrbase1);
-				ss.ReleaseBuffer(-1);
+				char *pp = format_dec(addr_buf, (line*rowsize_ - offset_ > first_addr ? line*rowsize_ - offset_ : first_addr) + display_.addrbase1, dec_width_);
+				*pp++ = ':';
+				ss.ReleaseBuffer(int(pp - addr_buf));
 				if (theApp.nice_addr_)
 				{
 					AddCommas(ss);
@@ -1353,11 +1280,9 @@ end_of_background_drawing:
 			{
 				int ww = num_width_ + 1;
 				char *addr_buf = ss.GetBuffer(24);             // reserve space for 64 bit address
-				sprintf(addr_buf,
-						"%*I64d:",
-						num_width_,
-						line + display_.addrbase1);
-				ss.ReleaseBuffer(-1);
+				char *pp = format_dec(addr_buf, line + display_.addrbase1, num_width_);
+				*pp++ = ':';
+				ss.ReleaseBuffer(int(pp - addr_buf));
 				if (theApp.nice_addr_)
 				{
 					AddCommas(ss);
@@ -1404,55 +1329,228 @@ end_of_background_drawing:
 		{
 			int posx = tt.left + hex_pos(0, char_width);                 // Horiz pos of 1st hex column
 
-			// Display each byte as hex (and char if nec.)
-			for (size_t jj = ii ; jj < last_col; ++jj)
+			// Work out which columns are visible
+			size_t from = ii, to;
+			if (display_.vert_display)
+			{
+				while (from < last_col && posx + int(from + 1 + from/group_by_)*char_width_w < 0)
+					++from;
+				for (to = from; to < last_col && posx + int(to + to/group_by_)*char_width_w < tt.right; ++to)
+					;
+			}
+			else
+			{
+				while (from < last_col && posx + int((from+1)*3 + from/group_by_)*char_width < 0)
+					++from;
+				for (to = from; to < last_col && posx + int(to*3 + to/group_by_)*char_width < tt.right; ++to)
+					;
+			}
+
+			if (!display_.vert_display)
+			{
+				// This actually displays the bytes (in hex)!  Each run of bytes of the same colour is drawn in one go.
+				formatter.hex_area(buf, from, to);
+				draw_runs(pDC, formatter, posx, tt.top, char_width, 0, 0, current_colour);
+			}
+			else
 			{
-				if (display_.vert_display)
+				// Display byte in char display area (as ASCII, EBCDIC etc)
+				if (display_.char_set != CHARSET_CODEPAGE)
 				{
-					if (posx + int(jj + 1 + jj/group_by_)*char_width_w < 0)
-						continue;
-					else if (posx + int(jj + jj/group_by_)*char_width_w >= tt.right)
-						break;
+					formatter.char_area(buf, from, to, true);
+					draw_runs(pDC, formatter, posx, tt.top, char_width_w, dot_pad, dot_pad, current_colour);
 				}
 				else
 				{
-					if (posx + int((jj+1)*3 + jj/group_by_)*char_width < 0)
-						continue;
-					else if (posx + int(jj*3 + jj/group_by_)*char_width >= tt.right)
-						break;
-				}
+					// Code page characters need Windows to convert them so are drawn one at a time
+					for (size_t jj = from; jj < to; ++jj)
+					{
+						if (current_colour != kala[buf[jj]])
+						{
+							current_colour = kala[buf[jj]];
+							pDC->SetTextColor(current_colour);
+						}
 
-				if (current_colour != kala[buf[jj]])
-				{
-					current_colour = kala[buf[jj]];
-					pDC->SetTextColor(current_colour);
+						if (display_.char_set == CHARSET_CODEPAGE &&
+							cp_first.size() > 0 &&
+							jj < start_col)
+						{
+							// Continuation byte of MBCS character
+							::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + cont_pad, tt.top, ContChar(), 1);
+						}
+						else if (buf[jj] < 32 && display_.char_set != CHARSET_EBCDIC && display_.char_set != CHARSET_OEM)
+						{
+							// Control characters are diplayed the same for all char sets except for
+							//  - EBCDIC (some chars < 32 may not be graphical) and 
+							//  - OEM (there are graphic characters for chars < 32)
+							if (display_.control == 0)
+							{
+								// Display control char and other chars as a dot (normally in red)
+								::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + dot_pad, tt.top, &dot, 1);
+							}
+							else if (display_.control == 1)
+							{
+								// Display control chars as red uppercase equiv.
+								char cc = buf[jj] + 0x40;
+								pDC->TextOut(posx + (jj + jj/group_by_)*char_width_w, tt.top, &cc, 1);
+							}
+							else if (display_.control == 2)
+							{
+								// Display control chars as C escape code (in red)
+								const char *check = "\a\b\f\n\r\t\v\0";
+								const char *display = "abfnrtv0";
+								const char *pp;
+								if ((pp = strchr(check, buf[jj])) != NULL)
+									pDC->TextOut(posx + (jj + jj/group_by_)*char_width_w, tt.top, display + (pp-check), 1);
+								else
+									::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + dot_pad, tt.top, &dot, 1);
+							}
+
+							// For MBCS char sets we need to keep track that we have done this character
+							if (display_.char_set == CHARSET_CODEPAGE && cp_first.size() > 0)
+								++start_col;
+						}
+						else if (display_.char_set == CHARSET_CODEPAGE && code_page_ == CP_UTF8)
+						{
+							// Handle UTF 8 specially since it is not like other Windows code pages
+							ASSERT(cp_first.size() == 0 && max_cp_bytes_ == 0);
+							if ((buf[jj] & 0xC0) == 0x80)
+								::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + cont_pad, tt.top, ContChar(), 1);
+							else
+							{
+								// The top 2 bits determine how many following (continuation) bytes there are.  If top bit
+								// is zero then len == 1 (no cont bytes) since it is ASCII
+								size_t len;
+								if ((buf[jj] & 0x80) == 0x00)
+									len = 1;
+								else if ((buf[jj] & 0xE0) == 0xC0)
+									len = 2;
+								else if ((buf[jj] & 0xF0) == 0xE0)
+									len = 3;
+								else if ((buf[jj] & 0xF8) == 0xF0)
+									len = 4;
+								else if ((buf[jj] & 0xFC) == 0xF8)
+									len = 5;
+								else if ((buf[jj] & 0xFE) == 0xFC)
+									len = 6;
+								else
+									len = 0;   // invalid UTF-8
+
+								wchar_t wc;                               // equivalent Unicode (UTF-16) character
+								if (len == 0 || 
+									MultiByteToWideChar(code_page_, 0, (char *)&buf[jj], len, &wc, 1) == 0 ||
+									wc >= 0xE000 && wc < 0xF900)
+								{
+									// Character translation returned no bytes or Unicode value in "Private Use Area"
+									wc = *BadChar();
+								}
+
+								CSize size;
+								::GetTextExtentPoint32W(pDC->GetSafeHdc(), &wc, 1, &size);
+								::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + (char_width_w-size.cx)/2, tt.top, &wc, 1);
+							}
+						}
+						else if (display_.char_set == CHARSET_CODEPAGE && max_cp_bytes_ <= 1)
+						{
+							// Handle single byte code page
+							ASSERT(cp_first.size() == 0 && max_cp_bytes_ == 1);
+							wchar_t wc;                               // equivalent Unicode (UTF-16) character
+							if (MultiByteToWideChar(code_page_, 0, (char *)&buf[jj], 1, &wc, 1) != 1 ||
+								wc >= 0xE000 && wc < 0xF900)
+							{
+								// Character translation returned no bytes or Unicode value in "Private Use Area"
+								::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + bad_pad, tt.top, BadChar(), 1);
+								wc = *BadChar();
+							}
+
+							CSize size;
+							::GetTextExtentPoint32W(pDC->GetSafeHdc(), &wc, 1, &size);
+							::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + (char_width_w-size.cx)/2, tt.top, &wc, 1);
+						}
+						else if (display_.char_set == CHARSET_CODEPAGE)
+						{
+							// Handle MBCS code pages
+							ASSERT(cp_first.size() > 0 && jj == start_col);
+							size_t len = CharNextExA(code_page_, (const char *)&buf[jj], 0) - (char *)&buf[jj];
+							// Display the multibyte character that starts at this byte then find the start of the next one
+							wchar_t wc;                               // equivalent Unicode (UTF-16) character
+							if (MultiByteToWideChar(code_page_, 0, (char *)&buf[jj], len, &wc, 1) != 1 ||
+								wc >= 0xE000 && wc < 0xF900)
+							{
+								// Character translation returned no bytes or Unicode value in "Private Use Area"
+								wc = *BadChar();
+								++start_col;
+							}
+							else
+							{
+								// Character translation was good so ouput the character
+								start_col += len;
+							}
+
+							CSize size;
+							::GetTextExtentPoint32W(pDC->GetSafeHdc(), &wc, 1, &size);
+							::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + (char_width_w-size.cx)/2, tt.top, &wc, 1);
+						}
+					}
 				}
 
-				if (display_.vert_display)
+				// Display the hex digits below that, one below the other
+				formatter.hex_digits(buf, from, to, 4);
+				draw_runs(pDC, formatter, posx, tt.top + vert_offset, char_width_w, 0, 0, current_colour);
+				formatter.hex_digits(buf, from, to, 0);
+				draw_runs(pDC, formatter, posx, tt.top + vert_offset*2, char_width_w, 0, 0, current_colour);
+			}
+		}
+
+		if (!display_.vert_display && display_.char_area)
+		{
+			int posc = tt.left + char_pos(0, char_width, char_width_w);  // Horiz pos of 1st char column
+
+			size_t from = ii, to;       // visible columns
+			while (from < last_col && posc + int(from+1)*char_width_w < 0)
+				++from;
+			for (to = from; to < last_col && posc + int(to)*char_width_w < tt.right; ++to)
+				;
+
+			if (display_.char_set != CHARSET_CODEPAGE)
+			{
+				// Display bytes in the char (right) area (as ASCII, EBCDIC etc) a run of the same colour at a time
+				formatter.char_area(buf, from, to, false);
+				draw_runs(pDC, formatter, posc, tt.top, char_width_w, dot_pad, bad_pad, current_colour);
+			}
+			else
+			{
+				// Code page characters need Windows to convert them so are drawn one at a time
+				for (size_t kk = from; kk < to; ++kk)
 				{
-					// Display byte in char display area (as ASCII, EBCDIC etc)
+					if (current_colour != kala[buf[kk]])
+					{
+						current_colour = kala[buf[kk]];
+						pDC->SetTextColor(current_colour);
+					}
+
 					if (display_.char_set == CHARSET_CODEPAGE &&
 						cp_first.size() > 0 &&
-						jj < start_col)
+						kk < start_col)
 					{
 						// Continuation byte of MBCS character
-						::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + cont_pad, tt.top, ContChar(), 1);
+						::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + cont_pad, tt.top, ContChar(), 1);
 					}
-					else if (buf[jj] < 32 && display_.char_set != CHARSET_EBCDIC && display_.char_set != CHARSET_OEM)
+					else if (buf[kk] < 32 && display_.char_set != CHARSET_EBCDIC && display_.char_set != CHARSET_OEM)
 					{
 						// Control characters are diplayed the same for all char sets except for
-						//  - EBCDIC (some chars < 32 may not be graphical) and 
+						//  - EBCDIC (some chars < 32 may not be graphical) and
 						//  - OEM (there are graphic characters for chars < 32)
 						if (display_.control == 0)
 						{
 							// Display control char and other chars as a dot (normally in red)
-							::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + dot_pad, tt.top, &dot, 1);
+							::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + dot_pad, tt.top, &dot, 1);
 						}
 						else if (display_.control == 1)
 						{
 							// Display control chars as red uppercase equiv.
-							char cc = buf[jj] + 0x40;
-							pDC->TextOut(posx + (jj + jj/group_by_)*char_width_w, tt.top, &cc, 1);
+							char cc = buf[kk] + 0x40;
+							pDC->TextOut(posc + kk*char_width_w, tt.top, &cc, 1);
 						}
 						else if (display_.control == 2)
 						{
@@ -1460,10 +1558,10 @@ end_of_background_drawing:
 							const char *check = "\a\b\f\n\r\t\v\0";
 							const char *display = "abfnrtv0";
 							const char *pp;
-							if ((pp = strchr(check, buf[jj])) != NULL)
-								pDC->TextOut(posx + (jj + jj/group_by_)*char_width_w, tt.top, display + (pp-check), 1);
+							if ((pp = strchr(check, buf[kk])) != NULL)
+								pDC->TextOut(posc + kk*char_width_w, tt.top, display + (pp-check), 1);
 							else
-								::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + dot_pad, tt.top, &dot, 1);
+								::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + dot_pad, tt.top, &dot, 1);
 						}
 
 						// For MBCS char sets we need to keep track that we have done this character
@@ -1474,32 +1572,43 @@ end_of_background_drawing:
 					{
 						// Handle UTF 8 specially since it is not like other Windows code pages
 						ASSERT(cp_first.size() == 0 && max_cp_bytes_ == 0);
-						if ((buf[jj] & 0xC0) == 0x80)
-							::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + cont_pad, tt.top, ContChar(), 1);
+						if ((buf[kk] & 0xC0) == 0x80)
+							::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + cont_pad, tt.top, ContChar(), 1);
 						else
 						{
 							// The top 2 bits determine how many following (continuation) bytes there are.  If top bit
 							// is zero then len == 1 (no cont bytes) since it is ASCII
 							size_t len;
-							if ((buf[jj] & 0x80) == 0x00)
+							if ((buf[kk] & 0x80) == 0x00)
 								len = 1;
-							else if ((buf[jj] & 0xE0) == 0xC0)
+							else if ((buf[kk] & 0xE0) == 0xC0)
 								len = 2;
-							else if ((buf[jj] & 0xF0) == 0xE0)
+							else if ((buf[kk] & 0xF0) == 0xE0)
 								len = 3;
-							else if ((buf[jj] & 0xF8) == 0xF0)
+							else if ((buf[kk] & 0xF8) == 0xF0)
 								len = 4;
-							else if ((buf[jj] & 0xFC) == 0xF8)
+							else if ((buf[kk] & 0xFC) == 0xF8)
 								len = 5;
-							else if ((buf[jj] & 0xFE) == 0xFC)
+							else if ((buf[kk] & 0xFE) == 0xFC)
 								len = 6;
 							else
 								len = 0;   // invalid UTF-8
 
+							// MultiByteToWideChar (at least in XP) does not handle some invalid sequences properly,
+							// eg C0 67 return "g" (the C0 appears to be ignored) - so we need to check ourselves
+							bool isBad = false;
+							for (int nn = 1; nn < len; ++nn)
+								if ((buf[kk+nn] &0x80) != 0x80)
+								{
+									isBad = true;
+									break;
+								}
+
 							wchar_t wc;                               // equivalent Unicode (UTF-16) character
-							if (len == 0 || 
-								MultiByteToWideChar(code_page_, 0, (char *)&buf[jj], len, &wc, 1) == 0 ||
-								wc >= 0xE000 && wc < 0xF900)
+							if (len == 0 ||                                                                // 1111111X is not a valid byte
+								isBad ||                                                                   // not enough cont bytes
+								MultiByteToWideChar(code_page_, 0, (char *)&buf[kk], len, &wc, 1) == 0 ||  // could not convert for some other reason
+								wc >= 0xE000 && wc < 0xF900)                                               // invalid byte sequence
 							{
 								// Character translation returned no bytes or Unicode value in "Private Use Area"
 								wc = *BadChar();
@@ -1507,7 +1616,7 @@ end_of_background_drawing:
 
 							CSize size;
 							::GetTextExtentPoint32W(pDC->GetSafeHdc(), &wc, 1, &size);
-							::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + (char_width_w-size.cx)/2, tt.top, &wc, 1);
+							::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + (char_width_w-size.cx)/2, tt.top, &wc, 1);
 						}
 					}
 					else if (display_.char_set == CHARSET_CODEPAGE && max_cp_bytes_ <= 1)
@@ -1515,26 +1624,25 @@ end_of_background_drawing:
 						// Handle single byte code page
 						ASSERT(cp_first.size() == 0 && max_cp_bytes_ == 1);
 						wchar_t wc;                               // equivalent Unicode (UTF-16) character
-						if (MultiByteToWideChar(code_page_, 0, (char *)&buf[jj], 1, &wc, 1) != 1 ||
+						if (MultiByteToWideChar(code_page_, 0, (char *)&buf[kk], 1, &wc, 1) != 1 ||
 							wc >= 0xE000 && wc < 0xF900)
 						{
 							// Character translation returned no bytes or Unicode value in "Private Use Area"
-							::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + bad_pad, tt.top, BadChar(), 1);
 							wc = *BadChar();
 						}
 
 						CSize size;
 						::GetTextExtentPoint32W(pDC->GetSafeHdc(), &wc, 1, &size);
-						::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + (char_width_w-size.cx)/2, tt.top, &wc, 1);
+						::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + (char_width_w-size.cx)/2, tt.top, &wc, 1);
 					}
 					else if (display_.char_set == CHARSET_CODEPAGE)
 					{
 						// Handle MBCS code pages
-						ASSERT(cp_first.size() > 0 && jj == start_col);
-						size_t len = CharNextExA(code_page_, (const char *)&buf[jj], 0) - (char *)&buf[jj];
+						ASSERT(cp_first.size() > 0 && kk == start_col);
+						size_t len = CharNextExA(code_page_, (const char *)&buf[kk], 0) - (char *)&buf[kk];
 						// Display the multibyte character that starts at this byte then find the start of the next one
 						wchar_t wc;                               // equivalent Unicode (UTF-16) character
-						if (MultiByteToWideChar(code_page_, 0, (char *)&buf[jj], len, &wc, 1) != 1 ||
+						if (MultiByteToWideChar(code_page_, 0, (char *)&buf[kk], len, &wc, 1) != 1 ||
 							wc >= 0xE000 && wc < 0xF900)
 						{
 							// Character translation returned no bytes or Unicode value in "Private Use Area"
@@ -1547,226 +1655,11 @@ end_of_background_drawing:
 							start_col += len;
 						}
 
-						CSize size;
-						::GetTextExtentPoint32W(pDC->GetSafeHdc(), &wc, 1, &size);
-						::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + (char_width_w-size.cx)/2, tt.top, &wc, 1);
-					}
-					else if (display_.char_set == CHARSET_EBCDIC)
-					{
-						// Display EBCDIC (or red dot if not valid EBCDIC char)
-						if (e2a_tab[buf[jj]] == '\0')
-						{
-							::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + dot_pad, tt.top, &dot, 1);
-						}
-						else
-						{
-							pDC->TextOut(posx + (jj + jj/group_by_)*char_width_w, tt.top, (char *)&e2a_tab[buf[jj]], 1);
-						}
-					}
-					else if (display_.char_set == CHARSET_ASCII && buf[jj] < 127 ||
-							 display_.char_set != CHARSET_ASCII && buf[jj] >= first_char_ && buf[jj] <= last_char_)
-					{
-						// Display normal char or graphic char if in font
-						pDC->TextOut(posx + (jj + jj/group_by_)*char_width_w, tt.top, (char *)&buf[jj], 1);
-					}
-					else
-					{
-						// Display chars "out of range" as dots
-						::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + dot_pad, tt.top, &dot, 1);
-						//::TextOutW(pDC->GetSafeHdc(), posx + (jj + jj/group_by_)*char_width_w + bad_pad, tt.top, BadChar(), 1);
-  					}
-
-					// Display the hex digits below that, one below the other
-					pDC->TextOut(posx + (jj + jj/group_by_)*char_width_w, tt.top + vert_offset,   &hex[(buf[jj]>>4)&0xF], 1);
-					pDC->TextOut(posx + (jj + jj/group_by_)*char_width_w, tt.top + vert_offset*2, &hex[buf[jj]&0xF], 1);
-				}
-				else
-				{
-					char hh[2];
-
-					// Create hex digits and display them
-					hh[0] = hex[(buf[jj]>>4)&0xF];
-					hh[1] = hex[buf[jj]&0xF];
-
-					// This actually displays the bytes (in hex)!
-					// Note: removed calcs that were previously encapsulated in hex_pos
-					pDC->TextOut(posx + (jj*3 + jj/group_by_)*char_width, tt.top, hh, 2);
-				}
-			}
-		}
-
-		if (!display_.vert_display && display_.char_area)
-		{
-			int posc = tt.left + char_pos(0, char_width, char_width_w);  // Horiz pos of 1st char column
-
-			for (size_t kk = ii ; kk < last_col; ++kk)
-			{
-				if (posc + int(kk+1)*char_width_w < 0)
-					continue;
-				else if (posc + int(kk)*char_width_w >= tt.right)
-					break;
-
-				if (current_colour != kala[buf[kk]])
-				{
-					current_colour = kala[buf[kk]];
-					pDC->SetTextColor(current_colour);
-				}
-
-				// Display byte in the char (right) area (as ASCII, EBCDIC etc)
-				if (display_.char_set == CHARSET_CODEPAGE &&
-					cp_first.size() > 0 &&
-					kk < start_col)
-				{
-					// Continuation byte of MBCS character
-					::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + cont_pad, tt.top, ContChar(), 1);
-				}
-				else if (buf[kk] < 32 && display_.char_set != CHARSET_EBCDIC && display_.char_set != CHARSET_OEM)
-				{
-					// Control characters are diplayed the same for all char sets except for
-					//  - EBCDIC (some chars < 32 may not be graphical) and
-					//  - OEM (there are graphic characters for chars < 32)
-					if (display_.control == 0)
-					{
-						// Display control char and other chars as a dot (normally in red)
-						::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + dot_pad, tt.top, &dot, 1);
-					}
-					else if (display_.control == 1)
-					{
-						// Display control chars as red uppercase equiv.
-						char cc = buf[kk] + 0x40;
-						pDC->TextOut(posc + kk*char_width_w, tt.top, &cc, 1);
-					}
-					else if (display_.control == 2)
-					{
-						// Display control chars as C escape code (in red)
-						const char *check = "\a\b\f\n\r\t\v\0";
-						const char *display = "abfnrtv0";
-						const char *pp;
-						if ((pp = strchr(check, buf[kk])) != NULL)
-							pDC->TextOut(posc + kk*char_width_w, tt.top, display + (pp-check), 1);
-						else
-							::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + dot_pad, tt.top, &dot, 1);
-					}
-
-					// For MBCS char sets we need to keep track that we have done this character
-					if (display_.char_set == CHARSET_CODEPAGE && cp_first.size() > 0)
-						++start_col;
-				}
-				else if (display_.char_set == CHARSET_CODEPAGE && code_page_ == CP_UTF8)
-				{
-					// Handle UTF 8 specially since it is not like other Windows code pages
-					ASSERT(cp_first.size() == 0 && max_cp_bytes_ == 0);
-					if ((buf[kk] & 0xC0) == 0x80)
-						::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + cont_pad, tt.top, ContChar(), 1);
-					else
-					{
-						// The top 2 bits determine how many following (continuation) bytes there are.  If top bit
-						// is zero then len == 1 (no cont bytes) since it is ASCII
-						size_t len;
-						if ((buf[kk] & 0x80) == 0x00)
-							len = 1;
-						else if ((buf[kk] & 0xE0) == 0xC0)
-							len = 2;
-						else if ((buf[kk] & 0xF0) == 0xE0)
-							len = 3;
-						else if ((buf[kk] & 0xF8) == 0xF0)
-							len = 4;
-						else if ((buf[kk] & 0xFC) == 0xF8)
-							len = 5;
-						else if ((buf[kk] & 0xFE) == 0xFC)
-							len = 6;
-						else
-							len = 0;   // invalid UTF-8
-
-						// MultiByteToWideChar (at least in XP) does not handle some invalid sequences properly,
-						// eg C0 67 return "g" (the C0 appears to be ignored) - so we need to check ourselves
-						bool isBad = false;
-						for (int nn = 1; nn < len; ++nn)
-							if ((buf[kk+nn] &0x80) != 0x80)
-							{
-								isBad = true;
-								break;
-							}
-
-						wchar_t wc;                               // equivalent Unicode (UTF-16) character
-						if (len == 0 ||                                                                // 1111111X is not a valid byte
-							isBad ||                                                                   // not enough cont bytes
-							MultiByteToWideChar(code_page_, 0, (char *)&buf[kk], len, &wc, 1) == 0 ||  // could not convert for some other reason
-							wc >= 0xE000 && wc < 0xF900)                                               // invalid byte sequence
-						{
-							// Character translation returned no bytes or Unicode value in "Private Use Area"
-							wc = *BadChar();
-						}
-
 						CSize size;
 						::GetTextExtentPoint32W(pDC->GetSafeHdc(), &wc, 1, &size);
 						::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + (char_width_w-size.cx)/2, tt.top, &wc, 1);
 					}
 				}
-				else if (display_.char_set == CHARSET_CODEPAGE && max_cp_bytes_ <= 1)
-				{
-					// Handle single byte code page
-					ASSERT(cp_first.size() == 0 && max_cp_bytes_ == 1);
-					wchar_t wc;                               // equivalent Unicode (UTF-16) character
-					if (MultiByteToWideChar(code_page_, 0, (char *)&buf[kk], 1, &wc, 1) != 1 ||
-						wc >= 0xE000 && wc < 0xF900)
-					{
-						// Character translation returned no bytes or Unicode value in "Private Use Area"
-						wc = *BadChar();
-					}
-
-					CSize size;
-					::GetTextExtentPoint32W(pDC->GetSafeHdc(), &wc, 1, &size);
-					::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + (char_width_w-size.cx)/2, tt.top, &wc, 1);
-				}
-				else if (display_.char_set == CHARSET_CODEPAGE)
-				{
-					// Handle MBCS code pages
-					ASSERT(cp_first.size() > 0 && kk == start_col);
-					size_t len = CharNextExA(code_page_, (const char *)&buf[kk], 0) - (char *)&buf[kk];
-					// Display the multibyte character that starts at this byte then find the start of the next one
-					wchar_t wc;                               // equivalent Unicode (UTF-16) character
-					if (MultiByteToWideChar(code_page_, 0, (char *)&buf[kk], len, &wc, 1) != 1 ||
-						wc >= 0xE000 && wc < 0xF900)
-					{
-						// Character translation returned no bytes or Unicode value in "Private Use Area"
-						wc = *BadChar();
-						++start_col;
-					}
-					else
-					{
-						// Character translation was good so ouput the character
-						start_col += len;
-					}
-
-					CSize size;
-					::GetTextExtentPoint32W(pDC->GetSafeHdc(), &wc, 1, &size);
-					::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + (char_width_w-size.cx)/2, tt.top, &wc, 1);
-				}
-				else if (display_.char_set == CHARSET_EBCDIC)
-				{
-					// Display EBCDIC (or red dot if not valid EBCDIC char)
-					if (e2a_tab[buf[kk]] == '\0')
-					{
-						::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + dot_pad, tt.top, &dot, 1);
-					}
-					else
-					{
-						pDC->TextOut(posc + kk*char_width_w, tt.top, (char *)&e2a_tab[buf[kk]], 1);
-					}
-				}
-				else if (display_.char_set == CHARSET_ASCII && buf[kk] < 127 ||
-					     display_.char_set != CHARSET_ASCII && buf[kk] >= first_char_ && buf[kk] <= last_char_)
-				{
-					// Display normal char or graphic char if in font
-					pDC->TextOut(posc + kk*char_width_w, tt.top, (char *)&buf[kk], 1);
-				}
-				else
-				{
-					// Display chars "out of range" as dots
-					::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + bad_pad, tt.top, &dot, 1);
-					//::TextOutW(pDC->GetSafeHdc(), posc + kk*char_width_w + bad_pad, tt.top, BadChar(), 1);
-  				}
 			}
 		}
 
@@ -1928,7 +1821,7 @@ end_of_background_drawing:
 			if (repeat_count == 1)
 				mess = "Repeated once";
 			else
-				mess.Format("Repeated %d more times", repeat_count);
+				mess.Format("Repeated %I64d more times", repeat_count);
 			CRect mess_rect = norm_rect;
 			if (neg_x)
 			{
@@ -1952,6 +1845,31 @@ end_of_background_drawing:
 //    move_dlgs();
 }
 
+// Draws the runs of text of a row_formatter (made for one line of the hex or char area) with one
+// call per run.  Every char is given the width of a cell so that they line up with the columns.
+void CHexEditView::draw_runs(CDC* pDC, const row_formatter &rf, int left, int top, int cell_width,
+							 int dot_pad, int bad_pad, COLORREF &current_colour)
+{
+	for (const row_formatter::run &rr : rf.runs())
+	{
+		if (run_dx_.size() < rr.len || run_dx_[0] != cell_width)
+			run_dx_.assign(std::max(run_dx_.size(), rr.len), cell_width);
+
+		if (current_colour != rr.colour)
+		{
+			current_colour = rr.colour;
+			pDC->SetTextColor(current_colour);
+		}
+
+		int xx = left + rr.cell*cell_width;
+		if (rr.glyph == row_formatter::GLYPH_TEXT)
+			pDC->ExtTextOut(xx, top, 0, NULL, rf.narrow(rr), UINT(rr.len), &run_dx_[0]);
+		else
+			::ExtTextOutW(pDC->GetSafeHdc(), xx + (rr.glyph == row_formatter::GLYPH_DOT ? dot_pad : bad_pad), top,
+						  0, NULL, rf.wide(rr), UINT(rr.len), &run_dx_[0]);
+	}
+}
+
 #ifdef RULER_ADJUST
 // Draws adjuster handles in the ruler
 void CHexEditView::draw_adjusters(CDC* pDC)
@@ -2400,6 +2318,189 @@ void CHexEditView::draw_bg(CDC* pDC, const CRectAp &doc_rect, bool neg_x, bool n
 	return;
 }
 
+// Draws the backgrounds of the layers of bg_spans_ in which (bits are 1 << BG_TRK_INSERT etc)
+// that are shown from first_addr to last_addr
+void CHexEditView::draw_bg_spans(CDC* pDC, const CRectAp &doc_rect, bool neg_x, bool neg_y,
+								 int line_height, int char_width, int char_width_w,
+								 FILE_ADDRESS first_addr, FILE_ADDRESS last_addr, unsigned which)
+{
+	// Work out which layers are shown.  Change tracking is not drawn if hidden or (when printing)
+	// print_change_ is off, and similarly for compare differences and highlights.
+	bool show_change = !pDC->IsPrinting() || theApp.print_change_;
+	unsigned layers = 0;
+	if (show_change && !display_.hide_insert)
+		layers |= 1 << BG_TRK_INSERT;
+	if (show_change && !display_.hide_replace)
+		layers |= 1 << BG_TRK_REPLACE;
+	if (!((GetDocument()->CompareDifferences() <= 0) || pDC->IsPrinting() && !theApp.print_compare_))
+		layers |= (1 << BG_COMP_INSERT) | (1 << BG_COMP_REPLACE);
+	if (!(display_.hide_highlight || pDC->IsPrinting() && !theApp.print_highlights_))
+		layers |= 1 << BG_HIGHLIGHT;
+	if (!pDC->IsPrinting())
+		layers |= (1 << BG_SEARCH) | (1 << BG_TEMPLATE);  // these are only for the window (see get_search_in_range)
+
+	layers &= which;
+	if (layers == 0)
+		return;
+
+	update_bg_spans();
+	std::vector<span_index::span> bg;
+	bg_spans_.find(first_addr, last_addr, layers, bg);
+
+	int underline = (pDC->IsPrinting() ? print_text_height_ : text_height_)/8;  // height of replacement bars
+	bool bottom_up = !pDC->IsPrinting() && ScrollUp();
+	for (size_t ii = 0; ii < bg.size(); )
+	{
+		size_t end = ii;                // one past the last span of this layer
+		while (end < bg.size() && bg[end].layer == bg[ii].layer)
+			++end;
+
+		COLORREF clr;
+		switch (bg[ii].layer)
+		{
+		case BG_TRK_INSERT:   clr = trk_bg_col_;  break;
+		case BG_TRK_REPLACE:  clr = trk_col_;     break;
+		case BG_COMP_INSERT:  clr = comp_bg_col_; break;
+		case BG_COMP_REPLACE: clr = comp_col_;    break;
+		case BG_HIGHLIGHT:    clr = hi_col_;      break;
+		case BG_SEARCH:       clr = search_col_;  break;
+		default:              clr = -1;           break;  // template fields have their own colour
+		}
+		bool replace = bg[ii].layer == BG_TRK_REPLACE || bg[ii].layer == BG_COMP_REPLACE;
+
+		// Draw the spans of the layer (bottom up if scrolling up)
+		for (size_t jj = ii; jj < end; ++jj)
+		{
+			const span_index::span &ss = bg[bottom_up ? ii + end - 1 - jj : jj];
+			draw_bg(pDC, doc_rect, neg_x, neg_y,
+					line_height, char_width, char_width_w, clr == -1 ? ss.colour : clr,
+					ss.start, ss.end, true, replace ? underline : -1);
+		}
+		ii = end;
+	}
+}
+
+// Rebuilds the layers of bg_spans_ whose source has changed since they were last drawn
+void CHexEditView::update_bg_spans()
+{
+	if (!bg_spans_.valid(BG_TRK_INSERT))
+	{
+		std::pair<std::vector<FILE_ADDRESS> *, std::vector<FILE_ADDRESS> *> alp = GetDocument()->Insertions();
+		bg_spans_.set(BG_TRK_INSERT, *alp.first, *alp.second);
+	}
+	if (!bg_spans_.valid(BG_TRK_REPLACE))
+	{
+		std::pair<std::vector<FILE_ADDRESS> *, std::vector<FILE_ADDRESS> *> alp = GetDocument()->Replacements();
+		bg_spans_.set(BG_TRK_REPLACE, *alp.first, *alp.second);
+	}
+	if (!bg_spans_.valid(BG_COMP_INSERT) || !bg_spans_.valid(BG_COMP_REPLACE))
+	{
+		CSingleLock sl(&(GetDocument()->docdata_), TRUE); // Protect shared data access to the returned vectors
+		std::pair<const std::vector<FILE_ADDRESS> *, const std::vector<FILE_ADDRESS> *> alp = GetDocument()->OrigInsertions();
+		bg_spans_.set(BG_COMP_INSERT, *alp.first, *alp.second);
+		alp = GetDocument()->OrigReplacements();
+		bg_spans_.set(BG_COMP_REPLACE, *alp.first, *alp.second);
+	}
+	if (!bg_spans_.valid(BG_HIGHLIGHT))
+	{
+		std::vector<span_index::span> spans;
+		spans.reserve(hl_set_.range_.size());
+		range_set<FILE_ADDRESS>::range_t::const_iterator pr;
+		for (pr = hl_set_.range_.begin(); pr != hl_set_.range_.end(); ++pr)
+		{
+			span_index::span ss = { pr->sfirst, pr->slast, 0, BG_HIGHLIGHT };
+			spans.push_back(ss);
+		}
+		bg_spans_.set(BG_HIGHLIGHT, std::move(spans));
+	}
+	if (!bg_spans_.valid(BG_SEARCH))
+	{
+		std::vector<span_index::span> spans;
+		std::vector<std::pair<FILE_ADDRESS, FILE_ADDRESS> >::const_iterator pp;
+		for (pp = search_pair_.begin(); pp != search_pair_.end(); ++pp)
+		{
+			span_index::span ss = { pp->first, pp->second, 0, BG_SEARCH };
+			spans.push_back(ss);
+		}
+		bg_spans_.set(BG_SEARCH, std::move(spans));
+	}
+	if (!bg_spans_.valid(BG_TEMPLATE))
+	{
+		std::vector<span_index::span> spans;
+		std::vector<boost::tuple<FILE_ADDRESS, FILE_ADDRESS, COLORREF> >::const_iterator pdffd;
+		for (pdffd = dffd_bg_.begin(); pdffd != dffd_bg_.end(); ++pdffd)
+		{
+			span_index::span ss = { pdffd->get<0>(), pdffd->get<1>(), pdffd->get<2>(), BG_TEMPLATE };
+			spans.push_back(ss);
+		}
+		bg_spans_.set(BG_TEMPLATE, std::move(spans));
+	}
+}
+
+// Widens lo to hi to include the blocks that overlap or touch it, where the blocks are sorted
+// and do not overlap (as for the document's change tracking vectors)
+static void extend_blocks(const std::vector<FILE_ADDRESS> &addr, const std::vector<FILE_ADDRESS> &len,
+						  FILE_ADDRESS &lo, FILE_ADDRESS &hi)
+{
+	size_t ii = std::upper_bound(addr.begin(), addr.end(), hi) - addr.begin();
+	while (ii > 0 && addr[ii-1] + len[ii-1] >= lo)
+	{
+		--ii;
+		lo = std::min(lo, addr[ii]);
+		hi = std::max(hi, addr[ii] + len[ii]);
+	}
+}
+
+// Gets the blocks that start from lo to hi-1 as spans of a layer
+static std::vector<span_index::span> get_blocks(const std::vector<FILE_ADDRESS> &addr, const std::vector<FILE_ADDRESS> &len,
+												FILE_ADDRESS lo, FILE_ADDRESS hi, int layer)
+{
+	std::vector<span_index::span> retval;
+	for (size_t ii = std::lower_bound(addr.begin(), addr.end(), lo) - addr.begin(); ii < addr.size() && addr[ii] < hi; ++ii)
+	{
+		span_index::span ss = { addr[ii], addr[ii] + len[ii], 0, layer };
+		retval.push_back(ss);
+	}
+	return retval;
+}
+
+// Updates the layers of bg_spans_ for a change to the document, where old_len bytes at addr
+// were replaced with new_len bytes (one is zero for an insertion or deletion).  Rather than
+// rebuilding them (see update_bg_spans) the spans after the change are moved.  Highlights are
+// moved as hl_set_ is.  The change can merge with nearby change tracking (eg an insertion
+// where bytes were deleted is shown as a replacement) so the spans that touch the change are
+// replaced with those from the document.
+void CHexEditView::change_bg_spans(FILE_ADDRESS addr, FILE_ADDRESS old_len, FILE_ADDRESS new_len)
+{
+	bg_spans_.shift(BG_HIGHLIGHT, addr, new_len - old_len);
+
+	if (!bg_spans_.valid(BG_TRK_INSERT) || !bg_spans_.valid(BG_TRK_REPLACE))
+	{
+		// One will be rebuilt anyway so rebuild both
+		bg_spans_.invalidate(BG_TRK_INSERT);
+		bg_spans_.invalidate(BG_TRK_REPLACE);
+		return;
+	}
+	bg_spans_.shift(BG_TRK_INSERT, addr, new_len - old_len);
+	bg_spans_.shift(BG_TRK_REPLACE, addr, new_len - old_len);
+
+	std::pair<std::vector<FILE_ADDRESS> *, std::vector<FILE_ADDRESS> *> ins = GetDocument()->Insertions();
+	std::pair<std::vector<FILE_ADDRESS> *, std::vector<FILE_ADDRESS> *> rep = GetDocument()->Replacements();
+	FILE_ADDRESS lo = addr, hi = addr + new_len;
+	for (;;)
+	{
+		FILE_ADDRESS prev_lo = lo, prev_hi = hi;
+		bg_spans_.extend(BG_TRK_INSERT, lo, hi);
+		bg_spans_.extend(BG_TRK_REPLACE, lo, hi);
+		extend_blocks(*ins.first, *ins.second, lo, hi);
+		extend_blocks(*rep.first, *rep.second, lo, hi);
+		if (lo == prev_lo && hi == prev_hi)
+			break;
+	}
+	bg_spans_.splice(BG_TRK_INSERT, lo, hi, get_blocks(*ins.first, *ins.second, lo, hi, BG_TRK_INSERT));
+	bg_spans_.splice(BG_TRK_REPLACE, lo, hi, get_blocks(*rep.first, *rep.second, lo, hi, BG_TRK_REPLACE));
+}
+
 // xxx TODO TBD test deletion at end (when last_virt == last_addr)
 // xxx can we pass first_addr/last_addr instead of first_virt/last_virt
 // xxx comments
@@ -2415,11 +2516,8 @@ void CHexEditView::draw_deletions(CDC* pDC, const std::vector<FILE_ADDRESS> & ad
 	COLORREF prev_col = pDC->SetTextColor(bg_col_);
 
 	int ii;
-	// Skip blocks above the top of the display area
-	// [This needs to be a binary search in case we get a large number of compare diffs]
-	for (ii = 0; ii < addr.size(); ++ii)
-		if (addr[ii] >= first_virt)
-			break;
+	// Skip blocks above the top of the display area (binary search as there may be a huge number of diffs)
+	ii = int(std::lower_bound(addr.begin(), addr.end(), first_virt) - addr.begin());
 
 	for ( ; ii < addr.size(); ++ii)
 	{
@@ -2468,58 +2566,3 @@ void CHexEditView::draw_deletions(CDC* pDC, const std::vector<FILE_ADDRESS> & ad
 
 	pDC->SetTextColor(prev_col);   // restore text colour
 }
-
-void CHexEditView::draw_backgrounds(CDC* pDC,
-									const std::vector<FILE_ADDRESS> & addr, const std::vector<FILE_ADDRESS> & len,
-									FILE_ADDRESS first_virt, FILE_ADDRESS last_virt,
-									const CRectAp &doc_rect, bool neg_x, bool neg_y,
-									int line_height, int char_width, int char_width_w,
-									COLORREF colour, bool merge /*=true*/, int draw_height /*=-1*/)
-{
-	ASSERT(addr.size() == len.size());                                 // arrays should be equal size
-	FILE_ADDRESS first_addr = std::max<FILE_ADDRESS>(0, first_virt);        // First address to actually display
-	FILE_ADDRESS last_addr  = std::min(GetDocument()->length(), last_virt); // One past last address actually displayed
-
-	int ii;
-	if (!ScrollUp())
-	{
-		// Skip blocks above the top of the display area
-		// [This needs to be a binary search in case we get a large number of compare diffs]
-		for (ii = 0; ii < addr.size(); ++ii)
-			if (addr[ii] + len[ii] > first_virt)
-				break;
-
-		for ( ; ii < addr.size(); ++ii)
-		{
-			// Check if we are now past the end of the display area
-			if (addr[ii] > last_virt)
-				break;
-
-			draw_bg(pDC, doc_rect, neg_x, neg_y,
-					line_height, char_width, char_width_w, colour,
-					std::max(addr[ii], first_addr), 
-					std::min(addr[ii] + len[ii], last_addr),
-					merge, draw_height);
-		}
-	}
-	else
-	{
-		// Starting at end skip blocks below the display area
-		// [This needs to be a binary search in case we get a large number of compare diffs]
-		for (ii = addr.size() - 1; ii >= 0; ii--)
-			if (addr[ii] < last_virt)
-				break;
-
-		for ( ; ii >= 0; ii--)
-		{
-			if (addr[ii] + len[ii] <= first_virt)
-				break;
-
-			draw_bg(pDC, doc_rect, neg_x, neg_y,
-					line_height, char_width, char_width_w, colour,
-					std::max(addr[ii], first_addr), 
-					std::min(addr[ii] + len[ii], last_addr),
-					merge, draw_height);
-		}
-	}
-}
@@ -102,6 +102,8 @@ Description:    Like AddCommas() above but adds spaces to a hex number rather
 #include <boost/crc.hpp>        // For CRCs
 #pragma warning(pop)
 #include <random>
+#include <intrin.h>             // For __cpuid, _BitScanForward etc
+#include <immintrin.h>          // For SSE2, AVX2 and AVX-512 intrinsics
 
 #include <imagehlp.h>           // For ::MakeSureDirectoryPathExists()
 #include <winioctl.h>           // For DISK_GEOMETRY, IOCTL_DISK_GET_DRIVE_GEOMETRY etc
@@ -2108,168 +2110,335 @@ unsigned long rand_good()
 //-----------------------------------------------------------------------------
 // Memory
 
-static const int SZCHK = sizeof(__m128i);                     // Size of a chunk used by SSE2 instructions (128 bits or 16 bytes)
+// FindFirstDiff, FindFirstSame and Search4 have versions using SSE2 (16 bytes at a time), AVX2 (32 bytes)
+// and AVX-512 (64 bytes).  The best version supported by the CPU (and OS) is chosen the first time
+// one is called, using CPUID.  All versions use unaligned loads so buffers can have any alignment.
 
-// FindFirstDiff:
-//    Quickly find the first byte that is different in two buffers.
-//
-// Parameters:
-//    buf1, buf2 = the buffers to compare
-//    buflen = how far to look
-//
-// Notes:
-//    IMPORTANT - buf1, and buf2 must have the same 16-byte alignment, though the actual
-//    first byte does not have to be on a 16-byte boundary (ie: buf1%16 == buf2%16).
-//
-// Return value:
-//    The number of bytes up to the first difference OR
-//    buflen if both buffers are the same
-std::size_t FindFirstDiff(const unsigned char * buf1, const unsigned char * buf2, size_t buflen)
+// Returns the index of the lowest bit that is on in a (non-zero) mask
+static inline unsigned lowest_bit(unsigned mask)
 {
-	assert(buf1);
-	assert(buf2);
+	unsigned long retval;
+	_BitScanForward(&retval, mask);
+	return retval;
+}
 
-	assert((int)buf1 % SZCHK == (int)buf2 % SZCHK);         // ensure same memory alignment
+static inline unsigned lowest_bit64(unsigned __int64 mask)
+{
+	unsigned long retval;
+#ifdef _M_X64
+	_BitScanForward64(&retval, mask);
+#else
+	if (!_BitScanForward(&retval, (unsigned long)mask))
+	{
+		_BitScanForward(&retval, (unsigned long)(mask >> 32));
+		retval += 32;
+	}
+#endif
+	return retval;
+}
 
-	// Work out where to start the SSE2 compare by rounding up to next 16-byte memory chunk
-	__m128i * pchunk1 = (__m128i *)((((int)buf1 + SZCHK-1)/SZCHK)*SZCHK);
-	assert((int)pchunk1 % SZCHK == 0);
+// Finds the first byte (within len bytes) where the buffers are different (same is false) or the same (same is true)
+static size_t find_first_sse2(const unsigned char * buf1, const unsigned char * buf2, size_t len, bool same)
+{
+	const unsigned flip = same ? 0 : 0xFFFF;        // invert the compare results if looking for a difference
+	size_t ii;
+	for (ii = 0; ii + 16 <= len; ii += 16)
+	{
+		__m128i cmp = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf1 + ii)),
+		                             _mm_loadu_si128((const __m128i *)(buf2 + ii)));   // PCMPEQB
+		unsigned mask = unsigned(_mm_movemask_epi8(cmp)) ^ flip;                            // PMOVMSKB
+		if (mask != 0)
+			return ii + lowest_bit(mask);
+	}
+	if (ii < len && len >= 16)
+	{
+		// Check the last (partial) chunk by loading the last 16 bytes (overlapping bytes already checked)
+		size_t last = len - 16;
+		__m128i cmp = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf1 + last)),
+		                             _mm_loadu_si128((const __m128i *)(buf2 + last)));
+		unsigned mask = (unsigned(_mm_movemask_epi8(cmp)) ^ flip) >> (ii - last);
+		if (mask != 0)
+			return ii + lowest_bit(mask);
+		return len;
+	}
+	for ( ; ii < len; ++ii)
+		if ((buf1[ii] == buf2[ii]) == same)
+			return ii;
+	return len;
+}
 
-	const unsigned char * p1, * p2;
-	const unsigned char * pend = (const unsigned char *)pchunk1;
-	if (pend > buf1 + buflen)
+static size_t find_first_avx2(const unsigned char * buf1, const unsigned char * buf2, size_t len, bool same)
+{
+	const unsigned flip = same ? 0 : 0xFFFFFFFF;
+	size_t ii;
+	for (ii = 0; ii + 64 <= len; ii += 64)
+	{
+		// Check 2 chunks at once (the loop is limited by the loads and compares not the branch)
+		__m256i cmp0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf1 + ii)),
+		                                 _mm256_loadu_si256((const __m256i *)(buf2 + ii)));
+		__m256i cmp1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf1 + ii + 32)),
+		                                 _mm256_loadu_si256((const __m256i *)(buf2 + ii + 32)));
+		unsigned mask0 = unsigned(_mm256_movemask_epi8(cmp0)) ^ flip;
+		unsigned mask1 = unsigned(_mm256_movemask_epi8(cmp1)) ^ flip;
+		if ((mask0 | mask1) != 0)
+			return mask0 != 0 ? ii + lowest_bit(mask0) : ii + 32 + lowest_bit(mask1);
+	}
+	for ( ; ii + 32 <= len; ii += 32)
+	{
+		__m256i cmp = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf1 + ii)),
+		                                _mm256_loadu_si256((const __m256i *)(buf2 + ii)));    // VPCMPEQB
+		unsigned mask = unsigned(_mm256_movemask_epi8(cmp)) ^ flip;                             // VPMOVMSKB
+		if (mask != 0)
+			return ii + lowest_bit(mask);
+	}
+	if (ii < len && len >= 32)
 	{
-		pend = buf1 + buflen;
+		size_t last = len - 32;
+		__m256i cmp = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf1 + last)),
+		                                _mm256_loadu_si256((const __m256i *)(buf2 + last)));
+		unsigned mask = (unsigned(_mm256_movemask_epi8(cmp)) ^ flip) >> (ii - last);
+		if (mask != 0)
+			return ii + lowest_bit(mask);
+		return len;
 	}
+	return ii + find_first_sse2(buf1 + ii, buf2 + ii, len - ii, same);
+}
 
-	// Check up to 15 bytes before the first 16-byte aligned chunk
-	for (p1 = buf1, p2 = buf2; p1 < pend; ++p1, ++p2)
+static size_t find_first_avx512(const unsigned char * buf1, const unsigned char * buf2, size_t len, bool same)
+{
+	size_t ii;
+	for (ii = 0; ii + 128 <= len; ii += 128)
 	{
-		if (*p1 != *p2)
-		{
-			return p1 - buf1;
-		}
+		__m512i aa0 = _mm512_loadu_si512(buf1 + ii), bb0 = _mm512_loadu_si512(buf2 + ii);
+		__m512i aa1 = _mm512_loadu_si512(buf1 + ii + 64), bb1 = _mm512_loadu_si512(buf2 + ii + 64);
+		unsigned __int64 mask0 = same ? _mm512_cmpeq_epi8_mask(aa0, bb0) : _mm512_cmpneq_epi8_mask(aa0, bb0);
+		unsigned __int64 mask1 = same ? _mm512_cmpeq_epi8_mask(aa1, bb1) : _mm512_cmpneq_epi8_mask(aa1, bb1);
+		if ((mask0 | mask1) != 0)
+			return mask0 != 0 ? ii + lowest_bit64(mask0) : ii + 64 + lowest_bit64(mask1);
+	}
+	for ( ; ii + 64 <= len; ii += 64)
+	{
+		__m512i aa = _mm512_loadu_si512(buf1 + ii), bb = _mm512_loadu_si512(buf2 + ii);
+		unsigned __int64 mask = same ? _mm512_cmpeq_epi8_mask(aa, bb) : _mm512_cmpneq_epi8_mask(aa, bb);   // VPCMPB
+		if (mask != 0)
+			return ii + lowest_bit64(mask);
+	}
+	if (ii < len)
+	{
+		// Use a mask to only load the bytes that are left (no reads past the end of the buffers)
+		__mmask64 left = (1ULL << (len - ii)) - 1;        // len - ii is less than 64
+		__m512i aa = _mm512_maskz_loadu_epi8(left, buf1 + ii), bb = _mm512_maskz_loadu_epi8(left, buf2 + ii);
+		unsigned __int64 mask = (same ? _mm512_cmpeq_epi8_mask(aa, bb) : _mm512_cmpneq_epi8_mask(aa, bb)) & left;
+		if (mask != 0)
+			return ii + lowest_bit64(mask);
 	}
+	return len;
+}
+
+// Search memory for another chunk of memory (like strstr). Returns a pointer to the first byte or NULL if not found.
+// Note: This may not be efficient - needs to be optimised (and inlined?) if used to search large blocks of memory
+static const unsigned char * memmem(const unsigned char * buf, size_t buflen, const unsigned char * to_find, size_t to_find_len)
+{
+	for (const unsigned char * pp = buf; pp + to_find_len <= buf + buflen; ++pp)
+		if (memcmp(pp, to_find, to_find_len) == 0)
+			return pp;
 
-	__m128i * pchunk2 = (__m128i *)((((int)buf2 + SZCHK-1)/SZCHK)*SZCHK);
-	assert((int)pchunk2 % SZCHK == 0);
+	return NULL;
+}
 
-	pend = buf1 + buflen;
+// Parameters of a Search4 (see below) passed to the search functions for each instruction set
+struct search4_t
+{
+	const unsigned char * buf;          // start of buffer being searched
+	const unsigned char * to_find;
+	size_t max_back, max_forw;
+	int min_match;
+	unsigned __int32 pat[4];            // the 4 patterns of 4 bytes we are looking for
 
-	__m128i cmp;                                                // holds result of comparing 16 bytes where each DWORD is either all bits on or off
+	const unsigned char * retval;       // best match found so far (or NULL)
+	int ret_offset;
 
-	for ( ; (const unsigned char *)pchunk1 < pend - SZCHK; ++pchunk1, ++pchunk2)
+	// Checks a 4 byte match of pattern pnum at pmatch to see if it is really a long enough match
+	void check(const unsigned char * pmatch, int pnum)
 	{
-		cmp = _mm_cmpeq_epi32(*pchunk1, *pchunk2);              // PCMPEQD
-		if (_mm_movemask_ps(_mm_castsi128_ps(cmp)) != 0xF)      // MOVMSKPS
+		const unsigned char * ppat = to_find + pnum;
+
+		// Scan backwards from match since we can be up to 3 bytes past where the bytes are actually the same
+		for (int ii = 0; ii < 3; ++ii)
 		{
-			// There is at least one difference in the 16 bytes - find the first diff. byte
-			for (p1 = (const unsigned char *)pchunk1, p2 = (const unsigned char *)pchunk2; *p1 == *p2; ++p1, ++p2)
-			{
-				; // nothing required in the loop body
-			}
-			assert(p1 - (const unsigned char *)pchunk1 < SZCHK); // else we have done something wrong (or PCMPEQD did not work)
-			return p1 - buf1;
+			if (pmatch <= buf || ppat <= to_find - max_back || *(pmatch-1) != *(ppat-1))
+				break;
+			pmatch--;
+			ppat--;
+		}
+
+		if ((to_find + max_forw) - ppat < min_match)
+			return;             // not enough bytes to compare
+
+		if (memcmp(pmatch, ppat, min_match) != 0)
+			return;             // difference found before match length
+
+		// We found a match! Now check if it is before any previously found match in this chunk
+		if (retval == NULL || pmatch < retval)
+		{
+			retval = pmatch;
+			ret_offset = int(ppat - to_find);
 		}
 	}
+};
+
+// Each of these searches whole chunks from pp (up to end), stopping at the end of the first chunk
+// with a match.  On return pp points to the first byte not searched.
+static void search4_sse2(search4_t & ss, const unsigned char * & pp, const unsigned char * end)
+{
+	__m128i pat[4];
+	for (int pnum = 0; pnum < 4; ++pnum)
+		pat[pnum] = _mm_set1_epi32(int(ss.pat[pnum]));
 
-	// Check up to 15 bytes past the last 16-byte aligned chunk
-	for (p1 = (const unsigned char *)pchunk1, p2 = (const unsigned char *)pchunk2; p1 < pend; ++p1, ++p2)
+	for ( ; pp + 16 <= end && ss.retval == NULL; pp += 16)
 	{
-		if (*p1 != *p2)
+		__m128i data = _mm_loadu_si128((const __m128i *)pp);
+		for (int pnum = 0; pnum < 4; ++pnum)
 		{
-			return p1 - buf1;
+			// Bottom 4 bits of mask say which copy (or copies) of the pattern were matched
+			unsigned mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(pat[pnum], data)));  // PCMPEQD, MOVMSKPS
+			for ( ; mask != 0; mask &= mask - 1)
+				ss.check(pp + 4*lowest_bit(mask), pnum);
 		}
 	}
-
-	return buflen;
 }
 
-// FindFirstSame:
-//    Quickly find the first byte that is the same in two buffers.
-//
-// Parameters:
-//    buf1, buf2 = the buffers to compare
-//    buflen = how far to look
-//
-// Notes:
-//    IMPORTANT - buf1, and buf2 must have the same 16-byte alignment, though the actual
-//    first byte does not have to be on a 16-byte boundary (ie: buf1%16 == buf2%16).
-//
-// Return value:
-//    The number of bytes up to the first byte that is the same OR
-//    buflen if all bytes at corresponding position in both buffers are different
-std::size_t FindFirstSame(const unsigned char * buf1, const unsigned char * buf2, size_t buflen)
+static void search4_avx2(search4_t & ss, const unsigned char * & pp, const unsigned char * end)
 {
-	assert((int)buf1 % SZCHK == (int)buf2 % SZCHK);         // ensure same memory alignment
-
-	// Work out where to start the SSE2 compare by rounding up to next 16-byte memory chunk
-	__m128i * pchunk1 = (__m128i *)((((int)buf1 + SZCHK-1)/SZCHK)*SZCHK);
-	assert((int)pchunk1 % SZCHK == 0);
-
-	const unsigned char * p1, * p2;
-	const unsigned char * pend = (const unsigned char *)pchunk1;
-	if (pend > buf1 + buflen)
-		pend = buf1 + buflen;
+	__m256i pat[4];
+	for (int pnum = 0; pnum < 4; ++pnum)
+		pat[pnum] = _mm256_set1_epi32(int(ss.pat[pnum]));
 
-	// Check up to 15 bytes before the first 16-byte aligned chunk
-	for (p1 = buf1, p2 = buf2; p1 < pend; ++p1, ++p2)
+	for ( ; pp + 32 <= end && ss.retval == NULL; pp += 32)
 	{
-		if (*p1 == *p2)
-			return p1 - buf1;
+		__m256i data = _mm256_loadu_si256((const __m256i *)pp);
+		for (int pnum = 0; pnum < 4; ++pnum)
+		{
+			unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(pat[pnum], data)));   // VPCMPEQD, VMOVMSKPS
+			for ( ; mask != 0; mask &= mask - 1)
+				ss.check(pp + 4*lowest_bit(mask), pnum);
+		}
 	}
+}
 
-	__m128i * pchunk2 = (__m128i *)((((int)buf2 + SZCHK-1)/SZCHK)*SZCHK);
-	assert((int)pchunk2 % SZCHK == 0);
-
-	pend = buf1 + buflen;
-
-	__m128i cmp;                                                // holds result of comparing 16 bytes where each DWORD is either all bits on or off
+static void search4_avx512(search4_t & ss, const unsigned char * & pp, const unsigned char * end)
+{
+	__m512i pat[4];
+	for (int pnum = 0; pnum < 4; ++pnum)
+		pat[pnum] = _mm512_set1_epi32(int(ss.pat[pnum]));
 
-	for ( ; (const unsigned char *)pchunk1 < pend - SZCHK; ++pchunk1, ++pchunk2)
+	for ( ; pp + 64 <= end && ss.retval == NULL; pp += 64)
 	{
-		cmp = _mm_cmpeq_epi8(*pchunk1, *pchunk2);               // PCMPEQB
-		if (_mm_movemask_epi8(cmp) != 0)                        // PMOVMSKB
+		__m512i data = _mm512_loadu_si512(pp);
+		for (int pnum = 0; pnum < 4; ++pnum)
 		{
-			// There is at least one difference in the 16 bytes - find the first diff. byte
-			for (p1 = (const unsigned char *)pchunk1, p2 = (const unsigned char *)pchunk2; *p1 != *p2; ++p1, ++p2)
-			{
-				; // nothing required in the loop body
-			}
-			assert(p1 - (const unsigned char *)pchunk1 < SZCHK); // else we have done something wrong (or PCMPEQD did not work)
-			return p1 - buf1;
+			unsigned mask = _mm512_cmpeq_epi32_mask(pat[pnum], data);      // VPCMPEQD
+			for ( ; mask != 0; mask &= mask - 1)
+				ss.check(pp + 4*lowest_bit(mask), pnum);
 		}
 	}
+}
 
-	// Check up to 15 bytes past the last 16-byte aligned chunk
-	for (p1 = (const unsigned char *)pchunk1, p2 = (const unsigned char *)pchunk2; p1 < pend; ++p1, ++p2)
+// Returns the best instruction set supported by the processor and the OS
+simd_t SimdSupported()
+{
+	static const simd_t supported = []
 	{
-		if (*p1 == *p2)
-			return p1 - buf1;
-	}
+		int info[4];
+		__cpuid(info, 0);
+		const int max_leaf = info[0];
+		__cpuid(info, 1);
+		const int ssse3 = 1 << 9, osxsave = 1 << 27, avx = 1 << 28;
+		const simd_t basic = (info[2] & ssse3) != 0 ? SIMD_SSSE3 : SIMD_SSE2;   // all x64 CPUs have SSE2
+		if (max_leaf < 7 || (info[2] & (osxsave|avx)) != (osxsave|avx))
+			return basic;
 
-	return buflen;
+		unsigned __int64 xcr0 = _xgetbv(0);             // which registers the OS saves on a context switch
+		__cpuidex(info, 7, 0);
+		const int avx2 = 1 << 5, avx512f = 1 << 16, avx512bw = 1 << 30;
+		if ((info[1] & (avx512f|avx512bw)) == (avx512f|avx512bw) && (xcr0 & 0xE6) == 0xE6)
+			return SIMD_AVX512;                         // OS saves ZMM and opmask registers
+		if ((info[1] & avx2) != 0 && (xcr0 & 0x6) == 0x6)
+			return SIMD_AVX2;                           // OS saves YMM registers
+		return basic;
+	}();
+	return supported;
 }
 
-// Search memory for another chunk of memory (like strstr). Returns a pointer to the first byte or NULL if not found.
-// Note: This may not be efficient - needs to be optimised (and inlined?) if used to search large blocks of memory
-static const unsigned char * memmem(const unsigned char * buf, size_t buflen, const unsigned char * to_find, size_t to_find_len)
+static simd_t simd_level = SimdSupported();
+
+simd_t GetSimdLevel()
 {
-	for (const unsigned char * pp = buf; pp < buf + buflen - to_find_len; ++pp)
-		if (memcmp(pp, to_find, to_find_len) == 0)
-			return pp;
+	return simd_level;
+}
 
-	return NULL;
+void SetSimdLevel(simd_t level)
+{
+	simd_level = std::min(level, SimdSupported());
+}
+
+// FindFirstDiff:
+//    Quickly find the first byte that is different in two buffers.
+//
+// Parameters:
+//    buf1, buf2 = the buffers to compare (may have any memory alignment)
+//    buflen = how far to look
+//
+// Return value:
+//    The number of bytes up to the first difference OR
+//    buflen if both buffers are the same
+std::size_t FindFirstDiff(const unsigned char * buf1, const unsigned char * buf2, size_t buflen)
+{
+	assert(buf1);
+	assert(buf2);
+
+	switch (simd_level)
+	{
+	case SIMD_AVX512:
+		return find_first_avx512(buf1, buf2, buflen, false);
+	case SIMD_AVX2:
+		return find_first_avx2(buf1, buf2, buflen, false);
+	default:
+		return find_first_sse2(buf1, buf2, buflen, false);
+	}
+}
+
+// FindFirstSame:
+//    Quickly find the first byte that is the same in two buffers.
+//
+// Parameters:
+//    buf1, buf2 = the buffers to compare (may have any memory alignment)
+//    buflen = how far to look
+//
+// Return value:
+//    The number of bytes up to the first byte that is the same OR
+//    buflen if all bytes at corresponding position in both buffers are different
+std::size_t FindFirstSame(const unsigned char * buf1, const unsigned char * buf2, size_t buflen)
+{
+	switch (simd_level)
+	{
+	case SIMD_AVX512:
+		return find_first_avx512(buf1, buf2, buflen, true);
+	case SIMD_AVX2:
+		return find_first_avx2(buf1, buf2, buflen, true);
+	default:
+		return find_first_sse2(buf1, buf2, buflen, true);
+	}
 }
 
 // Search4:
-//    Performs a fast search through memory comparing 16 bytes at a time (using SSE2 instructions) and looking
+//    Performs a fast search through memory comparing 16 (or 32 or 64) bytes at a time and looking
 //    for 4 different patterns of 4 bytes. That is if we are searching for the first letters of the alphabet it
 //    will look for "abcd", "bcde", "cdef", and "defg" (and thence check for the correct match length) - so the
 //    bytes "cdefghijklm" will be matched even though they do not start with "abcd".
 //
 // Parameters:
-//    buf = the buffer to search - should be aligned on a 16-byte boundary
+//    buf = the buffer to search (any alignment, but patterns are only compared at multiples of 4 bytes from buf)
 //    buflen = length of the buffer
 //    to_find = what to look for - alignment not important but must have at least 7 bytes
 //    to_find_len - length of the to_find buffer - needs to be at least 7 and probably min_match + 3
@@ -2282,89 +2451,46 @@ static const unsigned char * memmem(const unsigned char * buf, size_t buflen, co
 //    Note that the first byte pointed to may be any of the first 4 bytes of to_find as indicated byt ret_offset
 const unsigned char * Search4(const unsigned char * buf, size_t buflen, const unsigned char * to_find, size_t max_back, size_t max_forw, int &ret_offset, int min_match /*=10*/)
 {
-	static const size_t chunk_size = sizeof(__m128i);
-	assert((int)buf % chunk_size == 0); // ensure correct memory alignment
 	assert(min_match >= 7);             // this is a requirement due to the way the search is performed
 
 	// Set up the search patterns
 	if (max_forw < 7)
 		return NULL;                    // we need 7 bytes to fill our 4 patterns
-	__m128i pat[4];
-	pat[0].m128i_u32[0] = pat[0].m128i_u32[1] = pat[0].m128i_u32[2] = pat[0].m128i_u32[3] = *(unsigned __int32 *)(to_find+0);
-	pat[1].m128i_u32[0] = pat[1].m128i_u32[1] = pat[1].m128i_u32[2] = pat[1].m128i_u32[3] = *(unsigned __int32 *)(to_find+1);
-	pat[2].m128i_u32[0] = pat[2].m128i_u32[1] = pat[2].m128i_u32[2] = pat[2].m128i_u32[3] = *(unsigned __int32 *)(to_find+2);
-	pat[3].m128i_u32[0] = pat[3].m128i_u32[1] = pat[3].m128i_u32[2] = pat[3].m128i_u32[3] = *(unsigned __int32 *)(to_find+3);
-
-	__m128i * pp, *endbuf, cmp;
-	ret_offset = -99;
-	int which_dword = 0;                // bottom 4 bits are a mask which says which copy (or copies) of the pattern were matched
-	const unsigned char * retval = NULL;
-
-	//timer t(true);
-	endbuf = (__m128i *)(buf + (buflen - buflen%chunk_size));
-	assert((int)endbuf % chunk_size == 0);
-	for (pp = (__m128i *)buf; pp < endbuf; ++pp)
-	{
-		for (int pnum = 0; pnum < 4; ++pnum)
-		{
-			cmp = _mm_cmpeq_epi32(pat[pnum], *pp);                           // PCMPEQD
-			if (which_dword = _mm_movemask_ps(_mm_castsi128_ps(cmp)))        // MOVMSKPS
-			{
-				// We found 1 (or more) matches of this (pnum) pattern in this (pp to pp+15) chunk
-				// Now we need to check if any match meets the length requirements
-				const unsigned char * pmatch, * ppat;
-
-				// Check each match (indicated by the bottom 4 bits of which_dword)
-				for (int which = 0; which < 4; ++which, which_dword >>= 1)
-				{
-					if ((which_dword & 0x1) == 0)
-						continue;
-
-					// Get address of the dword we matched
-					pmatch = (const unsigned char *)pp + which*4;
-					ppat = to_find + pnum;
-
-					// Scan backwards from match since we can be up to 3 bytes past where the bytes are actually the same
-					for (int ii = 0; ii < 3; ++ii)
-					{
-						if (pmatch <= buf || ppat <= to_find - max_back || *(pmatch-1) != *(ppat-1))
-							break;
-						pmatch--;
-						ppat--;
-					}
-
-					if ((to_find + max_forw) - ppat < min_match)
-						continue;       // not enough bytes to compare
-
-					if (memcmp(pmatch, ppat, min_match) != 0)
-						continue;       // difference found before match length
-
-					// We found a match! Now check if it is before any previously found match in this chunk
-					if (retval == NULL || pmatch < retval)
-					{
-						retval = pmatch;
-						ret_offset = ppat - to_find;
-					}
-				}
-			}
-		}
-
-		if (retval != NULL)
-			break;                                          // stop searching when we found a long enough match
-	}
+	search4_t ss;
+	ss.buf = buf;
+	ss.to_find = to_find;
+	ss.max_back = max_back;
+	ss.max_forw = max_forw;
+	ss.min_match = min_match;
+	for (int pnum = 0; pnum < 4; ++pnum)
+		memcpy(&ss.pat[pnum], to_find + pnum, sizeof(ss.pat[pnum]));
+	ss.retval = NULL;
+	ss.ret_offset = -99;
+
+	// Search with the widest chunks possible then narrower chunks for what is left
+	const unsigned char * pp = buf, * end = buf + buflen;
+	if (simd_level >= SIMD_AVX512)
+		search4_avx512(ss, pp, end);
+	if (ss.retval == NULL && simd_level >= SIMD_AVX2)
+		search4_avx2(ss, pp, end);
+	if (ss.retval == NULL)
+		search4_sse2(ss, pp, end);
+	ret_offset = ss.ret_offset;
+	const unsigned char * retval = ss.retval;
 
 	// If buflen is not multiple of 16 we need to check the bit past the last "chunk" without using SSE2
-	size_t len = (buf + buflen) - (unsigned char *)endbuf;
-	if (retval == NULL && len >= min_match)
+	const unsigned char * endbuf = pp;
+	size_t len = end - endbuf;
+	if (retval == NULL && len >= size_t(min_match))
 	{
 		const unsigned char * pmatch, * ppat;
 		for (int pnum = 0; pnum < 4; ++pnum)
 		{
-			pmatch = (unsigned char *)endbuf;
+			pmatch = endbuf;
 			for (;;)
 			{
 				ppat = to_find + pnum;
-				pmatch = memmem(pmatch, len, ppat, min_match - 3);
+				pmatch = memmem(pmatch, end - pmatch, ppat, min_match - 3);
 				if (pmatch == NULL)
 					break;  // not found
 
@@ -2379,12 +2505,12 @@ const unsigned char * Search4(const unsigned char * buf, size_t buflen, const un
 				}
 
 				// Check we have enough matching bytes
-				if (memcmp(pmatch, ppat, min_match) == 0)
+				if ((to_find + max_forw) - ppat >= min_match && memcmp(pmatch, ppat, min_match) == 0)
 				{
 					if (retval == NULL || pmatch < retval)
 					{
 						retval = pmatch;
-						ret_offset = ppat - to_find;
+						ret_offset = int(ppat - to_find);
 					}
 					break;
 				}
@@ -2393,8 +2519,6 @@ const unsigned char * Search4(const unsigned char * buf, size_t buflen, const un
 		}
 	}
 
-	//t.stop();
-	//printf("%g  %d\n", (double)t.elapsed(), (int)ret_offset);
 	assert(retval == NULL || retval < buf + buflen);
 	return retval;
 }
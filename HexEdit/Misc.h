@@ -177,6 +177,11 @@ void encrypt(void *buffer, size_t len);
 void decrypt(void *buffer, size_t len);
 
 // Memory manipulation
+// The instruction set used by FindFirstDiff, FindFirstSame and Search4 (and hex_bytes) defaults to the best the CPU supports
+enum simd_t { SIMD_SSE2, SIMD_SSSE3, SIMD_AVX2, SIMD_AVX512 };   // each level includes those before it
+simd_t SimdSupported();
+simd_t GetSimdLevel();
+void SetSimdLevel(simd_t level);        // mainly for testing (can't be set higher than SimdSupported())
 //int next_diff(const void * buf1, const void * buf2, size_t len);
 std::size_t FindFirstDiff(const unsigned char * buf1, const unsigned char * buf2, size_t buflen);
 std::size_t FindFirstSame(const unsigned char * buf1, const unsigned char * buf2, size_t buflen);
@@ -25,6 +25,7 @@ CNewCompare::CNewCompare(CWnd* pParent /*=NULL*/)
 	compare_display_ = 0;
 	insdel_ = 0;
 	minmatch_ = 10;
+	anchored_ = 0;
 	auto_sync_ = auto_scroll_ = 1;
 }
 
@@ -41,6 +42,7 @@ void CNewCompare::DoDataExchange(CDataExchange* pDX)
 	DDX_Check(pDX, IDC_COMPARE_INSDEL, insdel_);
 	DDX_Text(pDX, IDC_COMPARE_MINMATCH, minmatch_);
 	DDV_MinMaxUInt(pDX, minmatch_, 7, 64);
+	DDX_Check(pDX, IDC_COMPARE_ANCHORED, anchored_);
 	DDX_Check(pDX, IDC_COMPARE_AUTOSYNC, auto_sync_);
 	DDX_Check(pDX, IDC_COMPARE_AUTOSCROLL, auto_scroll_);
 	//DDX_Text(pDX, IDC_COMPARE_COMMENT, comment_);
@@ -49,6 +51,7 @@ void CNewCompare::DoDataExchange(CDataExchange* pDX)
 	DDX_Control(pDX, IDC_COMPARE_COMMENT, ctl_comment_);
 	DDX_Control(pDX, IDC_COMPARE_STATIC1, ctl_static1_);
 	DDX_Control(pDX, IDC_COMPARE_MINMATCH, ctl_minmatch_);
+	DDX_Control(pDX, IDC_COMPARE_ANCHORED, ctl_anchored_);
 }
 
 BEGIN_MESSAGE_MAP(CNewCompare, CHexDialog)
@@ -56,6 +59,7 @@ BEGIN_MESSAGE_MAP(CNewCompare, CHexDialog)
 	ON_BN_CLICKED(IDC_COMPARE_FILE, &CNewCompare::OnBnClickedCompareFile)
 	ON_BN_CLICKED(IDC_COMPARE_BROWSE, &CNewCompare::OnBnClickedAttachmentBrowse)
 	ON_BN_CLICKED(IDC_COMPARE_INSDEL, &CNewCompare::OnBnClickedInsDel)
+	ON_BN_CLICKED(IDC_COMPARE_ANCHORED, &CNewCompare::OnBnClickedInsDel)
 	ON_WM_HELPINFO()
 	ON_WM_CONTEXTMENU()
 	ON_BN_CLICKED(IDC_COMPARE_HELP, OnHelp)
@@ -132,8 +136,9 @@ void CNewCompare::fix_controls()
 		ctl_comment_.SetWindowText("Show previous version of file in:");
 	else
 		ctl_comment_.SetWindowText("Show file, to be compared with, in:");
-	ctl_static1_.EnableWindow(insdel_ == 1);
-	ctl_minmatch_.EnableWindow(insdel_ == 1);
+	ctl_static1_.EnableWindow(insdel_ == 1 && anchored_ == 0);
+	ctl_minmatch_.EnableWindow(insdel_ == 1 && anchored_ == 0);
+	ctl_anchored_.EnableWindow(insdel_ == 1);
 }
 
 // CNewCompare message handlers
@@ -150,6 +155,7 @@ static DWORD id_pairs[] = {
 	IDC_COMPARE_TABBED, HIDC_COMPARE_TABBED, 
 	IDC_COMPARE_BROWSE, HIDC_COMPARE_BROWSE, 
 	IDC_COMPARE_INSDEL, HIDC_COMPARE_INSDEL, 
+	IDC_COMPARE_ANCHORED, HIDC_COMPARE_INSDEL, 
 	IDC_COMPARE_STATIC1, HIDC_COMPARE_MINMATCH, 
 	IDC_COMPARE_MINMATCH, HIDC_COMPARE_MINMATCH, 
 	IDC_COMPARE_MINMATCH_SPIN, HIDC_COMPARE_MINMATCH, 
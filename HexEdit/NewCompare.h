@@ -29,6 +29,7 @@ private:
 	CStatic ctl_comment_;
 	CStatic ctl_static1_;
 	CEdit ctl_minmatch_;
+	CButton ctl_anchored_;
 
 public:
 	int compare_type_;    // 0 = self, 1 = another file
@@ -36,6 +37,7 @@ public:
 	int compare_display_; // 0 = split window, 1 = tabbed
 	int insdel_;          // detect inserions/deltions (0/1)
 	UINT minmatch_;       // min match when searching for insertions/deletions
+	int anchored_;        // find insertions/deletions by matching chunks (0/1)
 	int auto_sync_;       // auto sync (0/1)
 	int auto_scroll_;     // auto scroll (0/1)
 	bool orig_shared_;    // can only do self-compare if the original is shareable
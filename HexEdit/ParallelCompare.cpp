@@ -0,0 +1,158 @@
+// ParallelCompare.cpp : implementation of the parallel_compare class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include "ParallelCompare.h"
+#include "Misc.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+parallel_compare::parallel_compare(opener_t open_a, opener_t open_b, std::int64_t len, int threads /*=0*/,
+                                   std::int64_t range_size /*=RANGE_SIZE*/)
+	: open_a_(open_a), open_b_(open_b), len_(len), threads_(threads), range_size_(range_size),
+	  next_range_(0), done_(0), stop_(false), finished_(0), failed_(false)
+{
+	if (threads_ <= 0)
+		threads_ = std::min<int>(std::max<int>(std::thread::hardware_concurrency(), 1), MAX_THREADS);
+}
+
+bool parallel_compare::run(poll_t poll /*=poll_t()*/)
+{
+	int nranges = int((len_ + range_size_ - 1)/range_size_);
+	ranges_.assign(nranges, diffs_t());
+	diffs_.clear();
+	next_range_ = 0;
+	done_ = 0;
+	stop_ = false;
+	finished_ = 0;
+	failed_ = false;
+
+	int nthreads = std::min(threads_, nranges);
+	std::vector<std::thread> workers;
+	for (int ii = 0; ii < nthreads; ++ii)
+		workers.push_back(std::thread(&parallel_compare::worker, this));
+
+	// Wait for the workers to finish, checking progress and if we have been asked to stop
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (!cv_.wait_for(lock, std::chrono::milliseconds(POLL_MS), [&] { return finished_ == nthreads; }))
+		{
+			lock.unlock();
+			if (poll && !poll(done_))
+				stop_ = true;
+			lock.lock();
+		}
+	}
+	for (std::thread &tt : workers)
+		tt.join();
+
+	if (stop_ || failed_)
+		return false;
+
+	// Join the diffs of all the ranges, including those that straddle the end of a range
+	for (const diffs_t &range : ranges_)
+	{
+		for (const auto &dd : range)
+		{
+			if (!diffs_.empty() && diffs_.back().first + diffs_.back().second == dd.first)
+				diffs_.back().second += dd.second;
+			else
+				diffs_.push_back(dd);
+		}
+	}
+	std::vector<diffs_t>().swap(ranges_);
+	return true;
+}
+
+void parallel_compare::worker()
+{
+	// Buffers must have the same alignment for FindFirstDiff etc (and sector alignment is good for non-cached reads)
+	unsigned char *bufa = (unsigned char *)_aligned_malloc(BUF_SIZE, 4096);
+	unsigned char *bufb = (unsigned char *)_aligned_malloc(BUF_SIZE, 4096);
+	try
+	{
+		if (bufa == NULL || bufb == NULL)
+			throw std::bad_alloc();
+
+		reader_t read_a = open_a_(), read_b = open_b_();
+		int range;
+		while (!stop_ && (range = next_range_++) < int(ranges_.size()))
+			compare_range(read_a, read_b, range, bufa, bufb);
+	}
+	catch (CException *pe)
+	{
+		pe->Delete();                       // MFC exceptions (eg CFileException) must be deleted
+		failed_ = true;
+		stop_ = true;                       // no point in the others continuing
+	}
+	catch (...)
+	{
+		failed_ = true;
+		stop_ = true;
+	}
+	_aligned_free(bufa);
+	_aligned_free(bufb);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	++finished_;
+	cv_.notify_one();
+}
+
+void parallel_compare::compare_range(const reader_t &read_a, const reader_t &read_b, int range,
+                                     unsigned char *bufa, unsigned char *bufb)
+{
+	diffs_t &diffs = ranges_[range];
+	std::int64_t start = std::int64_t(range)*range_size_;
+	std::int64_t end = std::min(start + range_size_, len_);
+	for (std::int64_t addr = start; addr < end && !stop_; )
+	{
+		// Skip a hole in both files (all zeroes in both) without reading it
+		std::int64_t hole_end = hole_end_ ? std::min(hole_end_(addr), end) : addr;
+		if (hole_end > addr)
+		{
+			done_ += hole_end - addr;
+			addr = hole_end;
+			continue;
+		}
+
+		std::size_t len = std::size_t(std::min<std::int64_t>(end - addr, BUF_SIZE));
+		std::size_t gota = read_a(bufa, len, addr);
+		std::size_t gotb = read_b(bufb, len, addr);
+		if (gota > len || gotb > len)
+			throw std::runtime_error("compare read failed");
+		len = std::min(gota, gotb);
+		if (len == 0)
+			break;                          // file is shorter than expected (has been truncated?)
+
+		for (std::size_t diff = ::FindFirstDiff(bufa, bufb, len); diff < len; )
+		{
+			std::size_t same = diff + ::FindFirstSame(bufa + diff, bufb + diff, len - diff);
+			if (!diffs.empty() && diffs.back().first + diffs.back().second == addr + std::int64_t(diff))
+				diffs.back().second += same - diff;     // continues from the end of the previous buffer
+			else
+				diffs.push_back(std::make_pair(addr + std::int64_t(diff), std::int64_t(same - diff)));
+			if (same >= len)
+				break;
+			diff = same + ::FindFirstDiff(bufa + same, bufb + same, len - same);
+		}
+		addr += len;
+		done_ += len;
+	}
+}
@@ -0,0 +1,78 @@
+// ParallelCompare.h : positional compare of two files using several threads
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// When insertions/deletions are not being detected a compare just finds the bytes that differ
+// at the same address in both files.  Each part of the files can be compared independently, so
+// the files are split into ranges of RANGE_SIZE bytes which are handed out to worker threads.
+// Each worker reads BUF_SIZE bytes at a time (using its own file handles so that reads can
+// overlap) and records the runs of different bytes found in its ranges.  At the end the runs
+// of all the ranges are joined in address order, including joining a run that finishes at the
+// end of one range with one that starts at the start of the next.
+//
+// The thread that calls run() does not compare anything but polls the workers for progress,
+// so it can respond quickly to a request to stop.
+//
+// If both files are sparse, bytes in a hole of both files are all zero in both so are equal.
+// set_holes() gives a function that finds these so the workers can skip them without reading.
+class parallel_compare
+{
+public:
+	typedef std::function<std::size_t(unsigned char *buf, std::size_t len, std::int64_t addr)> reader_t;
+	typedef std::function<reader_t()> opener_t;     // creates a reader for use by one worker thread
+	typedef std::function<bool(std::int64_t done)> poll_t;  // bytes compared so far; return false to stop
+	typedef std::function<std::int64_t(std::int64_t addr)> hole_end_t;    // end of hole in both files at addr (or addr)
+
+	enum { RANGE_SIZE = 64*1024*1024, BUF_SIZE = 1024*1024, POLL_MS = 50, MAX_THREADS = 8 };
+
+	typedef std::vector<std::pair<std::int64_t, std::int64_t> > diffs_t;    // address and length of different bytes
+
+	// Compares the first len bytes of 2 files.  If threads is zero one is used per processor core.
+	parallel_compare(opener_t open_a, opener_t open_b, std::int64_t len, int threads = 0, std::int64_t range_size = RANGE_SIZE);
+
+	void set_holes(hole_end_t hole_end) { hole_end_ = hole_end; }  // must be callable from several threads at once
+	bool run(poll_t poll = poll_t());       // returns false if stopped (or a read failed)
+	bool failed() const { return failed_; } // did a worker fail (eg could not open a file)?
+	const diffs_t &diffs() const { return diffs_; }     // in address order
+	int threads() const { return threads_; }
+
+private:
+	opener_t open_a_, open_b_;
+	std::int64_t len_;
+	int threads_;
+	std::int64_t range_size_;
+	hole_end_t hole_end_;
+
+	std::vector<diffs_t> ranges_;           // differences found in each range
+	diffs_t diffs_;                         // all ranges joined
+
+	std::atomic<int> next_range_;           // next range for a worker to compare
+	std::atomic<std::int64_t> done_;        // bytes compared so far
+	std::atomic<bool> stop_;
+	std::mutex mutex_;                      // protects finished_
+	std::condition_variable cv_;            // signalled when a worker finishes
+	int finished_;                          // number of workers that have finished
+	bool failed_;                           // did a worker fail (eg file exception)?
+
+	void worker();
+	void compare_range(const reader_t &read_a, const reader_t &read_b, int range,
+	                   unsigned char *bufa, unsigned char *bufb);
+};
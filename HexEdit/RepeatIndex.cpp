@@ -0,0 +1,191 @@
+// RepeatIndex.cpp : implementation of the repeat_index class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "RepeatIndex.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+static const std::int64_t no_row = std::numeric_limits<std::int64_t>::max();
+
+void repeat_index::reset(int row_size, int offset, std::int64_t length)
+{
+	row_size_ = row_size;
+	offset_ = offset;
+	length_ = length;
+	repeats_.clear();
+	dirty_.clear();
+	if (row_size_ > 0)
+		make_dirty(first_row(), end_row());
+}
+
+void repeat_index::change(std::int64_t addr, std::int64_t old_len, std::int64_t new_len, std::int64_t length)
+{
+	if (row_size_ <= 0)
+		return;
+
+	std::int64_t row = (addr + offset_)/row_size_;     // row of the first changed byte
+	std::int64_t delta = new_len - old_len;
+	length_ = length;
+
+	// If whole rows were inserted or deleted the following rows are just moved
+	bool whole_rows = delta != 0 && delta % row_size_ == 0;
+	if (whole_rows)
+	{
+		repeats_.shift(row + 1, delta/row_size_);
+		dirty_.shift(row + 1, delta/row_size_);
+	}
+	repeats_.erase_range(end_row(), no_row);
+	dirty_.erase_range(end_row(), no_row);
+
+	if (delta == 0)
+		make_dirty(row, (addr + new_len - 1 + offset_)/row_size_ + 2);  // changed rows and the row after
+	else if (whole_rows)
+		make_dirty(row, row + std::max<std::int64_t>(0, delta/row_size_) + 2);
+	else
+		make_dirty(row, no_row);            // all following rows now start at different bytes
+}
+
+bool repeat_index::scan(const reader_t &read, std::int64_t max_bytes /*=SCAN_BLOCK*/)
+{
+	for (std::int64_t done = 0; !dirty_.empty() && done < max_bytes; )
+	{
+		// Get the next dirty rows
+		std::int64_t first = dirty_.range_.front().sfirst;
+		std::int64_t rows = std::min<std::int64_t>(dirty_.range_.front().slast - first,
+		                                           std::max<std::int64_t>(1, SCAN_BLOCK/row_size_));
+		check_rows(read, first, rows);
+		done += (rows + 1)*row_size_;
+	}
+	return dirty_.empty();
+}
+
+void repeat_index::scan(const reader_t &read, std::int64_t first, std::int64_t end)
+{
+	const range_set<std::int64_t>::range_t &rr = dirty_.range_;
+	for (;;)
+	{
+		// Find the first dirty segment that ends after first
+		range_set<std::int64_t>::range_t::const_iterator pp =
+			std::upper_bound(rr.begin(), rr.end(), first,
+			                 [](std::int64_t vv, const range_set<std::int64_t>::segment &seg) { return vv < seg.slast; });
+		if (pp == rr.end() || pp->sfirst >= end)
+			break;
+
+		first = std::max(first, pp->sfirst);
+		std::int64_t rows = std::min<std::int64_t>(std::min(pp->slast, end) - first,
+		                                           std::max<std::int64_t>(1, SCAN_BLOCK/row_size_));
+		check_rows(read, first, rows);      // (invalidates pp)
+		first += rows;
+	}
+}
+
+std::int64_t repeat_index::scan_lines(const reader_t &read, std::int64_t first, std::int64_t end, std::int64_t lines)
+{
+	std::int64_t row = first;
+	bool in_run = false;                    // last line counted is a run of repeats
+	while (row < end && (lines > 0 || in_run))
+	{
+		// Check enough rows to fill the lines if none repeat, or the next block of a run
+		std::int64_t next = std::min(end, row + (in_run ? std::max<std::int64_t>(1, SCAN_BLOCK/row_size_) : lines));
+		scan(read, row, next);
+		while (row < next && (lines > 0 || in_run))
+		{
+			if (repeated(row))
+			{
+				if (!in_run)
+					--lines;
+				in_run = true;
+				row = std::min(run_end(row), end);
+			}
+			else if (lines > 0)
+			{
+				--lines;
+				in_run = false;
+				++row;
+			}
+			else
+				in_run = false;             // end of the run that filled the last line
+		}
+	}
+	return row;
+}
+
+std::int64_t repeat_index::run_end(std::int64_t row) const
+{
+	const range_set<std::int64_t>::range_t &rr = repeats_.range_;
+	range_set<std::int64_t>::range_t::const_iterator pp =
+		std::upper_bound(rr.begin(), rr.end(), row,
+		                 [](std::int64_t vv, const range_set<std::int64_t>::segment &seg) { return vv < seg.slast; });
+	return pp != rr.end() && pp->sfirst <= row ? pp->slast : row;
+}
+
+// Compares rows (which must all be dirty) with the row before each, reading them and the row
+// before the first in one go
+void repeat_index::check_rows(const reader_t &read, std::int64_t first, std::int64_t rows)
+{
+	std::size_t len = std::size_t((rows + 1)*row_size_);
+	std::int64_t addr = (first - 1)*row_size_ - offset_;
+	buf_.resize(len);
+	std::size_t got = 0;
+	while (got < len)
+	{
+		std::size_t nn = read(&buf_[got], len - got, addr + got);
+		if (nn == 0 || nn > len - got)
+			break;
+		got += nn;
+	}
+	dirty_.erase_range(first, first + rows);
+	if (got < len)
+		return;                             // read error - leave as not repeats
+
+	const unsigned char *pp = &buf_[0];
+	if (std::memcmp(pp + row_size_, pp, std::size_t(rows*row_size_)) == 0)
+	{
+		// All the rows are the same (eg all zero)
+		repeats_.insert_range(first, first + rows);
+		return;
+	}
+
+	std::int64_t run = -1;                  // first row of current run of repeats
+	for (std::int64_t ii = 0; ii < rows; ++ii)
+	{
+		bool same = std::memcmp(pp + (ii + 1)*row_size_, pp + ii*row_size_, row_size_) == 0;
+		if (same && run < 0)
+			run = ii;
+		else if (!same && run >= 0)
+		{
+			repeats_.insert_range(first + run, first + ii);
+			run = -1;
+		}
+	}
+	if (run >= 0)
+		repeats_.insert_range(first + run, first + rows);
+}
+
+// Marks rows as needing to be compared again (only those that can be repeats)
+void repeat_index::make_dirty(std::int64_t first, std::int64_t end)
+{
+	first = std::max(first, first_row());
+	end = std::min(end, end_row());
+	if (first < end)
+	{
+		repeats_.erase_range(first, end);
+		dirty_.insert_range(first, end);
+	}
+}
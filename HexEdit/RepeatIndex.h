@@ -0,0 +1,86 @@
+// RepeatIndex.h : index of the rows of a file that are the same as the row before
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "range_set.h"
+
+// When a selection is printed with duplicate lines merged, each row had to be read and
+// compared with the one before while drawing the page, so a large zero-filled area was
+// read row by row to print "Repeated N more times".  This remembers which rows repeat
+// (as row numbers in a range_set, so a huge run of repeats is just one segment) and is
+// built by scan() for just the rows needed (eg by scan_lines() for the page being printed).
+//
+// A file of length bytes is split into rows of row_size bytes, where row N starts at address
+// N*row_size - offset (as in the hex view).  Only full rows are compared, so the first and last
+// rows (if partial) are never repeats.  Rows not yet scanned (or changed since) are "dirty" and
+// are neither known repeats nor known non-repeats; the caller tells the index about changes to
+// the file with change(), which keeps what it can (eg insertions of whole rows just move the
+// following rows) and marks the rest dirty.
+class repeat_index
+{
+public:
+	typedef std::function<std::size_t(unsigned char *buf, std::size_t len, std::int64_t addr)> reader_t;
+
+	enum { SCAN_BLOCK = 1024*1024 };    // bytes read at a time by scan()
+
+	repeat_index() : row_size_(0), offset_(0), length_(0) { }
+
+	// Forgets everything and marks all rows dirty
+	void reset(int row_size, int offset, std::int64_t length);
+	int row_size() const { return row_size_; }
+	int offset() const { return offset_; }
+
+	// Bytes were replaced (old_len == new_len), inserted (old_len == 0) or deleted (new_len == 0)
+	// at addr, making the file length bytes long
+	void change(std::int64_t addr, std::int64_t old_len, std::int64_t new_len, std::int64_t length);
+
+	// Checks dirty rows (in order) reading up to about max_bytes of the file.
+	// Returns true if there are no dirty rows left.
+	bool scan(const reader_t &read, std::int64_t max_bytes = SCAN_BLOCK);
+	bool done() const { return dirty_.empty(); }
+
+	// Checks the dirty rows from row first up to (not including) row end
+	void scan(const reader_t &read, std::int64_t first, std::int64_t end);
+
+	// Checks just the rows from row first (and before row end) that are needed to fill lines
+	// output lines where each run of repeated rows takes one line (as when printing with
+	// duplicate lines merged).  A run that is started has to be checked to its end to count
+	// it.  Returns the row after the last one checked.
+	std::int64_t scan_lines(const reader_t &read, std::int64_t first, std::int64_t end, std::int64_t lines);
+
+	// Returns true if the row is known to be the same as the row before
+	bool repeated(std::int64_t row) const { return repeats_.count(row) > 0; }
+
+	// Returns the first row from row on that is not a known repeat (row itself if it is not)
+	std::int64_t run_end(std::int64_t row) const;
+
+	// All known repeated rows
+	const range_set<std::int64_t> &repeats() const { return repeats_; }
+
+private:
+	int row_size_, offset_;
+	std::int64_t length_;
+	range_set<std::int64_t> repeats_;   // rows that are the same as the previous row
+	range_set<std::int64_t> dirty_;     // rows that need to be compared with the previous row
+	std::vector<unsigned char> buf_;
+
+	// Range of rows that could be repeats (full rows that follow a full row)
+	std::int64_t first_row() const { return (std::int64_t(offset_) + row_size_ - 1)/row_size_ + 1; }
+	std::int64_t end_row() const { return (length_ + offset_)/row_size_; }
+	void make_dirty(std::int64_t first, std::int64_t end);
+	void check_rows(const reader_t &read, std::int64_t first, std::int64_t rows);
+};
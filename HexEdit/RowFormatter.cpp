@@ -0,0 +1,149 @@
+// RowFormatter.cpp : implementation of the row_formatter class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "RowFormatter.h"
+#include "ByteText.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+static const wchar_t dot = 0x00B7;     // Unicode char for middle dot
+
+void row_formatter::hex_area(const unsigned char *buf, std::size_t from, std::size_t to)
+{
+	clear();
+	for (std::size_t jj = from; jj < to; )
+	{
+		// Convert the bytes up to the end of the group or a change of colour together
+		std::uint32_t colour = opt_.colours[buf[jj]];
+		std::size_t end = std::min(to, (jj/opt_.group_by + 1)*opt_.group_by), kk;
+		for (kk = jj + 1; kk < end && opt_.colours[buf[kk]] == colour; ++kk)
+			;
+		add_hex(hex_cell(jj), colour, buf + jj, kk - jj);
+		jj = kk;
+	}
+}
+
+void row_formatter::hex_digits(const unsigned char *buf, std::size_t from, std::size_t to, int shift)
+{
+	clear();
+	for (std::size_t jj = from; jj < to; ++jj)
+		add_char(char_cell(jj, true), opt_.colours[buf[jj]], GLYPH_TEXT, hex_text(buf[jj], opt_.upper_case)[shift == 0 ? 1 : 0]);
+}
+
+void row_formatter::char_area(const unsigned char *buf, std::size_t from, std::size_t to, bool vert)
+{
+	clear();
+	glyph_t glyph;
+	char cc;
+	for (std::size_t kk = from; kk < to; ++kk)
+		if (char_glyph(buf[kk], vert, glyph, cc))
+			add_char(char_cell(kk, vert), opt_.colours[buf[kk]], glyph, cc);
+}
+
+void row_formatter::clear()
+{
+	runs_.clear();
+	narrow_.clear();
+	wide_.clear();
+}
+
+// Adds a char to the last run if it can be, filling any gap with spaces, else starts a new run
+void row_formatter::add_char(int cell, std::uint32_t colour, glyph_t glyph, char cc)
+{
+	if (runs_.empty() || runs_.back().colour != colour || runs_.back().glyph != glyph ||
+		runs_.back().cell + int(runs_.back().len) > cell)
+	{
+		run rr = { cell, colour, glyph, glyph == GLYPH_TEXT ? narrow_.size() : wide_.size(), 0 };
+		runs_.push_back(rr);
+	}
+
+	run &rr = runs_.back();
+	std::size_t gap = std::size_t(cell - rr.cell) - rr.len;
+	if (glyph == GLYPH_TEXT)
+	{
+		narrow_.append(gap, ' ');
+		narrow_.push_back(cc);
+	}
+	else
+	{
+		wide_.append(gap, L' ');
+		wide_.push_back(dot);
+	}
+	rr.len += gap + 1;
+}
+
+// Adds the hex digits of len bytes (with a space between each) like add_char
+void row_formatter::add_hex(int cell, std::uint32_t colour, const unsigned char *pp, std::size_t len)
+{
+	if (runs_.empty() || runs_.back().colour != colour || runs_.back().glyph != GLYPH_TEXT ||
+		runs_.back().cell + int(runs_.back().len) > cell)
+	{
+		run rr = { cell, colour, GLYPH_TEXT, narrow_.size(), 0 };
+		runs_.push_back(rr);
+	}
+
+	run &rr = runs_.back();
+	std::size_t gap = std::size_t(cell - rr.cell) - rr.len;
+	narrow_.append(gap, ' ');
+	std::size_t pos = narrow_.size();
+	narrow_.resize(pos + 3*len);
+	hex_bytes(&narrow_[pos], pp, len, opt_.upper_case);
+	narrow_.pop_back();         // no space after the last byte
+	rr.len += gap + 3*len - 1;
+}
+
+// Works out how a byte is shown in the char area (or top row of vertical display), in the
+// same way as CHexEditView::OnDraw did a char at a time.  Returns false if nothing is shown.
+bool row_formatter::char_glyph(unsigned char byte, bool vert, glyph_t &glyph, char &cc) const
+{
+	glyph = GLYPH_TEXT;
+	cc = char(byte);
+	if (byte < 32 && !opt_.ebcdic && !opt_.oem)
+	{
+		// Control characters are diplayed the same for all char sets except for
+		//  - EBCDIC (some chars < 32 may not be graphical) and
+		//  - OEM (there are graphic characters for chars < 32)
+		if (opt_.control == 0)
+			glyph = GLYPH_DOT;
+		else if (opt_.control == 1)
+			cc = char(byte + 0x40);         // uppercase equivalent
+		else if (opt_.control == 2)
+		{
+			// C escape code (note that strchr finds the terminating nul for zero)
+			const char *check = "\a\b\f\n\r\t\v\0";
+			const char *display = "abfnrtv0";
+			const char *pp;
+			if ((pp = std::strchr(check, byte)) != NULL)
+				cc = display[pp - check];
+			else
+				glyph = GLYPH_DOT;
+		}
+		else
+			return false;
+	}
+	else if (opt_.ebcdic)
+	{
+		if (opt_.e2a[byte] == '\0')
+			glyph = GLYPH_DOT;
+		else
+			cc = char(opt_.e2a[byte]);
+	}
+	else if (!((opt_.ascii && byte < 127) || (!opt_.ascii && byte >= opt_.first_char && byte <= opt_.last_char)))
+		glyph = vert ? GLYPH_DOT : GLYPH_BAD;  // "out of range" chars
+	return true;
+}
@@ -0,0 +1,89 @@
+// RowFormatter.h : turns a row of bytes into runs of text for drawing
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Drawing each byte of a row of the hex view with its own TextOut call is slow for wide
+// rows, so instead the row is formatted into runs of characters that can each be drawn with
+// one call.  A run has the same colour and type of glyph and covers consecutive character
+// cells (the gaps between bytes and groups are filled with spaces, which are not seen as text
+// is drawn with a transparent background).
+//
+// This does not use Windows, so it can be tested and timed separately.  The caller draws each
+// run at cell*cell_width (plus the padding for centring dots) using a width of cell_width for
+// every character (eg using ExtTextOut), so that the font does not have to be fixed pitch.
+//
+// Code page character sets are not handled here as they need Windows to convert characters.
+class row_formatter
+{
+public:
+	enum glyph_t
+	{
+		GLYPH_TEXT,             // normal characters (narrow)
+		GLYPH_DOT,              // middle dots (wide) for invalid/control characters
+		GLYPH_BAD,              // middle dots (wide) for chars outside the font's range (char area only)
+	};
+
+	struct run
+	{
+		int cell;               // character cell of the first character
+		std::uint32_t colour;
+		glyph_t glyph;
+		std::size_t start;      // index of first char in narrow() or wide() depending on glyph
+		std::size_t len;
+	};
+
+	// How characters are displayed (see CHexEditView::display_ and the font)
+	struct options
+	{
+		bool ascii;             // CHARSET_ASCII (show bytes < 127)
+		bool ebcdic;            // CHARSET_EBCDIC (translate using e2a)
+		bool oem;               // CHARSET_OEM (there are glyphs for control chars)
+		int control;            // how control chars are shown: 0 = dot, 1 = uppercase, 2 = C escape letter
+		unsigned char first_char, last_char;    // range of chars in the font (not ASCII)
+		int group_by;           // bytes per group (an extra space between groups)
+		bool upper_case;        // hex digits A-F (else a-f)
+		const unsigned char *e2a;               // EBCDIC to ASCII table (0 = not valid)
+		const std::uint32_t *colours;           // colour of each byte value (256 entries)
+	};
+
+	explicit row_formatter(const options &opt) : opt_(opt) { }
+	void set_options(const options &opt) { opt_ = opt; }
+
+	// Each of these replaces the runs with those for bytes buf[from] to buf[to-1]
+	void hex_area(const unsigned char *buf, std::size_t from, std::size_t to);  // "XX " for each byte
+	void char_area(const unsigned char *buf, std::size_t from, std::size_t to, bool vert);     // 1 char per byte
+	void hex_digits(const unsigned char *buf, std::size_t from, std::size_t to, int shift);   // 1 hex digit per byte (vertical display)
+
+	// The cell of a byte in each area.  In vertical display the chars are grouped like the hex digits.
+	int hex_cell(std::size_t col) const { return int(col*3 + col/opt_.group_by); }
+	int char_cell(std::size_t col, bool vert) const { return int(vert ? col + col/opt_.group_by : col); }
+
+	const std::vector<run> &runs() const { return runs_; }
+	const char *narrow(const run &rr) const { return narrow_.data() + rr.start; }
+	const wchar_t *wide(const run &rr) const { return wide_.data() + rr.start; }
+
+private:
+	options opt_;
+	std::vector<run> runs_;
+	std::string narrow_;
+	std::wstring wide_;
+
+	void clear();
+	void add_char(int cell, std::uint32_t colour, glyph_t glyph, char cc);
+	void add_hex(int cell, std::uint32_t colour, const unsigned char *pp, std::size_t len);
+	bool char_glyph(unsigned char byte, bool vert, glyph_t &glyph, char &cc) const;
+};
@@ -0,0 +1,334 @@
+// SectorReader.cpp : implementation of the sector_reader class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "SectorReader.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+std::uint32_t bad_sector_map::error(std::int64_t sector) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::map<std::int64_t, std::uint32_t>::const_iterator pp = bad_.find(sector);
+	return pp == bad_.end() ? 0 : pp->second;
+}
+
+bool bad_sector_map::pending(std::int64_t sector) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return pending_.count(sector) > 0;
+}
+
+std::map<std::int64_t, std::uint32_t> bad_sector_map::bad() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return bad_;
+}
+
+void bad_sector_map::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	bad_.clear();
+}
+
+void bad_sector_map::get(std::int64_t first, std::int64_t end, std::vector<std::pair<std::int64_t, std::uint32_t> > &out) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::map<std::int64_t, std::uint32_t>::const_iterator pb = bad_.lower_bound(first);
+	std::set<std::int64_t>::const_iterator pp = pending_.lower_bound(first);
+	for (;;)
+	{
+		bool more_bad = pb != bad_.end() && pb->first < end;
+		bool more_pending = pp != pending_.end() && *pp < end;
+		if (more_bad && (!more_pending || pb->first < *pp))
+			out.push_back(*pb++);
+		else if (more_pending)
+			out.push_back(std::make_pair(*pp++, std::uint32_t(0)));
+		else
+			break;
+	}
+}
+
+bool bad_sector_map::start_retry(std::int64_t sector)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (bad_.count(sector) > 0)
+		return false;
+	return pending_.insert(sector).second;
+}
+
+void bad_sector_map::end_retry(std::int64_t sector, std::uint32_t error)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	pending_.erase(sector);
+	if (error != 0)
+		bad_[sector] = error;
+}
+
+sector_reader::sector_reader(sector_device *dev, std::size_t block_size /*=64K*/, int retries /*=1*/,
+                             std::shared_ptr<bad_sector_map> bad /*=std::shared_ptr<bad_sector_map>()*/)
+	: dev_(dev), retries_(retries), bad_(bad)
+{
+	if (!bad_)
+		bad_ = std::make_shared<bad_sector_map>();
+	std::size_t sec_size = dev_->sector_size();
+	block_size_ = std::max(sec_size, block_size/sec_size*sec_size);
+	int depth = std::max(1, dev_->max_requests());
+	reqs_.resize(depth);
+	pieces_.resize(depth);
+	for (int ii = depth; ii-- > 0; )
+		free_.push_back(ii);
+
+	// Retries read into our own buffer (as the caller's buffer is gone when they finish)
+	retry_mem_.resize((depth + 1)*sec_size);
+	std::uintptr_t pp = std::uintptr_t(&retry_mem_[0]);
+	retry_buf_ = &retry_mem_[0] + ((pp + sec_size - 1)/sec_size*sec_size - pp);
+}
+
+// Waits for retries in progress (since they read into retry_buf_) but forgets queued ones
+sector_reader::~sector_reader()
+{
+	while (free_.size() < reqs_.size())
+	{
+		int idx = wait();
+		if (idx == -1)
+			break;
+		finished(pieces_[idx], reqs_[idx].status, reqs_[idx].buf);
+	}
+	for (const piece &pp : retry_)
+		bad_->end_retry(pp.addr/std::int64_t(dev_->sector_size()), 0);
+}
+
+void sector_reader::pending(std::int64_t addr, std::size_t len, std::vector<std::int64_t> &sectors) const
+{
+	std::int64_t sec_size = std::int64_t(dev_->sector_size());
+	std::vector<std::pair<std::int64_t, std::uint32_t> > skip;
+	bad_->get(addr/sec_size, (addr + std::int64_t(len) + sec_size - 1)/sec_size, skip);
+	for (const auto &ss : skip)
+		if (ss.second == 0)
+			sectors.push_back(ss.first);
+}
+
+bool sector_reader::read(std::int64_t addr, unsigned char *buf, std::size_t len)
+{
+	std::int64_t sec_size = std::int64_t(dev_->sector_size());
+	ASSERT(addr % sec_size == 0 && len % sec_size == 0);
+	bool ok = true;
+
+	// Split into blocks, skipping (zeroing) sectors that are bad or pending and copying
+	// sectors that were read OK by a retry since the last read
+	std::vector<std::pair<std::int64_t, std::uint32_t> > skip;
+	std::int64_t end = addr + std::int64_t(len);
+	bad_->get(addr/sec_size, end/sec_size, skip);
+	std::vector<std::pair<std::int64_t, std::uint32_t> >::const_iterator pskip = skip.begin();
+	std::map<std::int64_t, std::vector<unsigned char> >::iterator prec = recovered_.lower_bound(addr/sec_size);
+	std::deque<piece> todo;
+	for (std::int64_t curr = addr; curr < end; )
+	{
+		if (prec != recovered_.end() && prec->first*sec_size == curr)
+		{
+			memcpy(buf + (curr - addr), &prec->second[0], size_t(sec_size));
+			prec = recovered_.erase(prec);
+			if (pskip != skip.end() && pskip->first*sec_size == curr)
+				++pskip;                    // (it may have been found bad by another reader since)
+			curr += sec_size;
+			continue;
+		}
+		if (pskip != skip.end() && pskip->first*sec_size == curr)
+		{
+			memset(buf + (curr - addr), '\0', size_t(sec_size));
+			ok = false;
+			curr += sec_size;
+			++pskip;
+			continue;
+		}
+		std::int64_t next = std::min(end, curr + std::int64_t(block_size_));
+		if (pskip != skip.end() && pskip->first*sec_size < next)
+			next = pskip->first*sec_size;
+		if (prec != recovered_.end() && prec->first*sec_size < next)
+			next = prec->first*sec_size;
+		piece pp = { curr, size_t(next - curr), buf + (curr - addr), 0 };
+		todo.push_back(pp);
+		curr = next;
+	}
+
+	// Keep as many reads in progress as possible, starting retries (from this or previous
+	// reads) only when all our blocks have been started.  Don't wait for the retries.
+	int own = 0;                            // blocks of this read in progress
+	while (!todo.empty() || own > 0)
+	{
+		while (!free_.empty() && (!todo.empty() || !retry_.empty()))
+		{
+			if (todo.empty())
+			{
+				piece pp = retry_.front();
+				retry_.pop_front();
+				start(pp);
+			}
+			else
+			{
+				piece pp = todo.front();
+				todo.pop_front();
+				if (start(pp))
+					++own;
+				else
+					ok = false;
+			}
+		}
+
+		int idx = wait();
+		if (idx == -1)
+			continue;
+		if (pieces_[idx].buf != NULL)
+		{
+			--own;
+			if (reqs_[idx].status != 0)
+				ok = false;
+		}
+		finished(pieces_[idx], reqs_[idx].status, reqs_[idx].buf);
+	}
+
+	return ok;
+}
+
+void sector_reader::finish_retries()
+{
+	while (!retry_.empty() || free_.size() < reqs_.size())
+	{
+		while (!free_.empty() && !retry_.empty())
+		{
+			piece pp = retry_.front();
+			retry_.pop_front();
+			start(pp);
+		}
+		int idx = wait();
+		if (idx != -1)
+			finished(pieces_[idx], reqs_[idx].status, reqs_[idx].buf);
+	}
+}
+
+bool sector_reader::read_sector(std::int64_t sector, unsigned char *buf)
+{
+	std::int64_t sec_size = std::int64_t(dev_->sector_size());
+	for (int tries = 0; tries <= retries_; ++tries)
+	{
+		if (free_.empty())
+		{
+			int idx = wait();
+			if (idx != -1)
+				finished(pieces_[idx], reqs_[idx].status, reqs_[idx].buf);
+		}
+		piece pp = { sector*sec_size, std::size_t(sec_size), buf, 0 };
+		if (!start(pp))
+			continue;
+
+		// Only retries can be in progress apart from ours
+		for (;;)
+		{
+			int idx = wait();
+			if (idx == -1)
+				break;
+			std::uint32_t status = reqs_[idx].status;
+			bool ours = pieces_[idx].buf != NULL;
+			finished(pieces_[idx], status, reqs_[idx].buf);
+			if (ours)
+			{
+				if (status == 0)
+					return true;
+				break;
+			}
+		}
+	}
+	return false;
+}
+
+// Starts reading a piece (a block of a read or a sector being retried).  Returns false if
+// the read could not be started (which is handled as a failed read).
+bool sector_reader::start(const piece &pp)
+{
+	ASSERT(!free_.empty());
+	int idx = free_.back();
+	free_.pop_back();
+
+	pieces_[idx] = pp;
+	sector_device::request &req = reqs_[idx];
+	req.addr = pp.addr;
+	req.len = pp.len;
+	req.buf = pp.buf != NULL ? pp.buf : retry_buf_ + idx*dev_->sector_size();
+	req.status = 0;
+	if (!dev_->start(&req))
+	{
+		free_.push_back(idx);
+		finished(pp, req.status == 0 ? std::uint32_t(-1) : req.status, NULL);
+		return false;
+	}
+	return true;
+}
+
+// Waits for a read to finish, returning the index of its request (or -1 if none in progress)
+int sector_reader::wait()
+{
+	sector_device::request *preq = dev_->wait();
+	if (preq == NULL)
+	{
+		ASSERT(free_.size() == reqs_.size());
+		return -1;
+	}
+	int idx = int(preq - &reqs_[0]);
+	ASSERT(idx >= 0 && idx < int(reqs_.size()));
+	free_.push_back(idx);
+	return idx;
+}
+
+// Handles the end of a read of data.  When a block fails each of its sectors is queued to be
+// retried (unless another reader is already retrying it) and zero-filled for now.  A sector
+// that is retried OK is kept for the next read, and one that fails retries_ more times is
+// recorded as bad.
+void sector_reader::finished(const piece &pp, std::uint32_t status, const unsigned char *data)
+{
+	std::size_t sec_size = dev_->sector_size();
+	if (pp.buf == NULL)
+	{
+		std::int64_t sec = pp.addr/std::int64_t(sec_size);
+		if (status == 0)
+		{
+			recovered_[sec].assign(data, data + sec_size);
+			bad_->end_retry(sec, 0);
+		}
+		else if (pp.tries < retries_)
+		{
+			piece p1 = pp;
+			++p1.tries;
+			retry_.push_back(p1);
+		}
+		else
+			bad_->end_retry(sec, status);
+	}
+	else if (status != 0)
+	{
+		memset(pp.buf, '\0', pp.len);
+		for (std::size_t done = 0; done < pp.len; done += sec_size)
+		{
+			std::int64_t addr = pp.addr + std::int64_t(done);
+			if (bad_->start_retry(addr/std::int64_t(sec_size)))
+			{
+				piece p1 = { addr, sec_size, NULL, 0 };
+				retry_.push_back(p1);
+			}
+		}
+	}
+}
@@ -0,0 +1,137 @@
+// SectorReader.h : reads sectors of a device with several requests in progress and retries of bad sectors
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+// A device (or non-cached file) that can have several reads in progress at once, such as
+// a handle opened for overlapped I/O.  Reads are of whole sectors into sector aligned buffers.
+class sector_device
+{
+public:
+	struct request
+	{
+		std::int64_t addr;          // address of first byte (multiple of the sector size)
+		std::size_t len;            // bytes to read (multiple of the sector size)
+		unsigned char *buf;         // where to put the data (sector aligned)
+		std::uint32_t status;       // set by the device when done: 0 if all read OK else an error
+	};
+
+	virtual ~sector_device() { }
+	virtual std::size_t sector_size() const = 0;
+	virtual std::int64_t length() const = 0;
+
+	// Starts reading - returns false (with req->status set) if the read could not be started.
+	// Up to max_requests() reads may be in progress at once.
+	virtual bool start(request *req) = 0;
+	virtual int max_requests() const = 0;
+
+	// Waits for one of the reads in progress to finish and returns it (NULL if none in progress)
+	virtual request *wait() = 0;
+};
+
+// The bad sectors of a device found by any of the sector_readers reading it (eg the several
+// files that a document opens on a device for its background scans) so that a sector found bad
+// by one is not read again by the others.  A sector is "pending" while a reader is retrying it,
+// so that other readers don't retry it too.  May be used from several threads at once.
+class bad_sector_map
+{
+public:
+	std::uint32_t error(std::int64_t sector) const;     // 0 if not known to be bad
+	bool pending(std::int64_t sector) const;
+	std::map<std::int64_t, std::uint32_t> bad() const;  // sector number => error
+	void clear();                                       // forgets bad (not pending) sectors
+
+	// Appends the sectors from first to end-1 that are bad (with their error) or pending
+	// (with an error of 0) to out, in order
+	void get(std::int64_t first, std::int64_t end, std::vector<std::pair<std::int64_t, std::uint32_t> > &out) const;
+
+	bool start_retry(std::int64_t sector);  // makes it pending - returns false if already bad or pending
+	void end_retry(std::int64_t sector, std::uint32_t error);  // error is 0 if it was read OK
+
+private:
+	mutable std::mutex mutex_;
+	std::map<std::int64_t, std::uint32_t> bad_;
+	std::set<std::int64_t> pending_;
+};
+
+// CFileNC used to read a device one sector at a time, waiting for each.  When imaging a failing
+// drive each bad sector holds up everything for the device timeout, and is read again (with
+// another timeout) whenever the buffer holding it is reloaded.  This keeps several block reads
+// in progress at once.  When a block fails all its sectors are queued for retrying one at a
+// time (so several are retried at once) but read() does not wait for them - the sectors are
+// zero-filled and left pending, and the retries continue in free request slots during later
+// reads (or finish_retries()).  A sector read OK by a retry is kept until next read, and one
+// that still fails after the retries is recorded in the bad sector map with its error.  Known
+// bad sectors are not read again.
+//
+// The device is not owned (see CFileNC for the Windows one and the tests for a simulated one).
+// The bad sector map can be shared with other readers of the same device.
+class sector_reader
+{
+public:
+	sector_reader(sector_device *dev, std::size_t block_size = 64*1024, int retries = 1,
+	              std::shared_ptr<bad_sector_map> bad = std::shared_ptr<bad_sector_map>());
+	~sector_reader();
+
+	// Reads len bytes at addr (both multiples of the sector size) into buf (sector aligned).
+	// Returns false if any sectors are bad or pending (and so were zero-filled).
+	bool read(std::int64_t addr, unsigned char *buf, std::size_t len);
+
+	// Waits for the sectors this reader is retrying so none of them are pending
+	void finish_retries();
+
+	// Reads a sector now (with retries) whatever the bad sector map says, eg one that another
+	// reader is retrying, since that reader may not get to it for a while.  Does not change
+	// the map.  Returns false (with the sector zero-filled) if it could not be read.
+	bool read_sector(std::int64_t sector, unsigned char *buf);
+
+	std::map<std::int64_t, std::uint32_t> bad() const { return bad_->bad(); }
+	std::uint32_t error(std::int64_t sector) const { return bad_->error(sector); }
+	bool pending(std::int64_t sector) const { return bad_->pending(sector); }
+	void pending(std::int64_t addr, std::size_t len, std::vector<std::int64_t> &sectors) const;
+	void forget_bad() { bad_->clear(); }    // allows bad sectors to be retried
+
+private:
+	struct piece
+	{
+		std::int64_t addr;
+		std::size_t len;
+		unsigned char *buf;         // where to read to (NULL for a retry which uses retry_buf_)
+		int tries;                  // number of times a retried sector has failed
+	};
+
+	sector_device *dev_;
+	std::size_t block_size_;
+	int retries_;
+	std::shared_ptr<bad_sector_map> bad_;
+
+	std::vector<sector_device::request> reqs_;  // one for each read that can be in progress
+	std::vector<piece> pieces_;                 // the piece that each of reqs_ is reading
+	std::vector<int> free_;                     // indices of reqs_ not in use
+	std::vector<unsigned char> retry_mem_;
+	unsigned char *retry_buf_;                  // a sector (aligned) for each of reqs_ for retries
+	std::deque<piece> retry_;                   // sectors waiting to be retried
+	std::map<std::int64_t, std::vector<unsigned char> > recovered_;    // sectors read OK by a retry
+
+	bool start(const piece &pp);
+	void finished(const piece &pp, std::uint32_t status, const unsigned char *data);
+	int wait();
+};
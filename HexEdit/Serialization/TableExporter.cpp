@@ -0,0 +1,291 @@
+#include "Stdafx.h"
+#include "TableExporter.h"
+
+#include "../Misc.h"
+
+
+namespace hex
+{
+    // The stream is written in large blocks as tables can have millions of rows.
+    static const std::size_t bufferSize = 65536;
+
+
+    TableExporter::TableExporter(std::unique_ptr<CFile> stream) :
+        _stream{ std::move(stream) },
+        _buffer{},
+        _columns{},
+        _error{},
+        _rowsWritten{ 0 }
+    {
+        _buffer.reserve(bufferSize);
+    }
+
+    TableExporter::~TableExporter()
+    {
+        try
+        {
+            if (_stream)
+            {
+                Flush();
+                _stream->Close();
+            }
+        }
+        catch (CFileException* ex)
+        {
+            ex->Delete();
+        }
+    }
+
+
+    void TableExporter::WriteHeader(const std::vector<Column>& columns)
+    {
+        _columns = columns;
+    }
+
+    void TableExporter::WriteRow(const std::vector<Cell>& cells)
+    {
+        ASSERT(cells.size() == _columns.size());
+
+        WriteRowData(cells);
+        _rowsWritten++;
+    }
+
+    void TableExporter::WriteEpilogue()
+    {
+        Flush();
+    }
+
+
+    void TableExporter::Write(const void* data, std::size_t count)
+    {
+        if (!_error.IsEmpty())
+        {
+            return;     // don't keep trying after a write has failed
+        }
+
+        const char* pp = static_cast<const char*>(data);
+        if (_buffer.size() + count > bufferSize)
+        {
+            Flush();
+        }
+
+        if (count >= bufferSize)
+        {
+            try
+            {
+                _stream->Write(pp, static_cast<UINT>(count));
+            }
+            catch (CFileException* ex)
+            {
+                _error = ::FileErrorMessage(ex, CFile::modeWrite);
+                ex->Delete();
+            }
+        }
+        else
+        {
+            _buffer.insert(_buffer.end(), pp, pp + count);
+        }
+    }
+
+    void TableExporter::Flush()
+    {
+        if (_buffer.empty())
+        {
+            return;
+        }
+
+        if (_error.IsEmpty())
+        {
+            try
+            {
+                _stream->Write(_buffer.data(), static_cast<UINT>(_buffer.size()));
+            }
+            catch (CFileException* ex)
+            {
+                _error = ::FileErrorMessage(ex, CFile::modeWrite);
+                ex->Delete();
+            }
+        }
+        _buffer.clear();
+    }
+
+
+    CsvTableExporter::CsvTableExporter(std::unique_ptr<CFile> stream) :
+        TableExporter{ std::move(stream) }
+    { }
+
+    void CsvTableExporter::WriteHeader(const std::vector<Column>& columns)
+    {
+        TableExporter::WriteHeader(columns);
+
+        for (std::size_t col = 0; col < columns.size(); ++col)
+        {
+            if (col > 0)
+            {
+                Write(",", 1);
+            }
+            WriteField(CStringA(CW2A(CStringW(columns[col].name), CP_UTF8)));
+        }
+        Write("\r\n", 2);
+    }
+
+    void CsvTableExporter::WriteRowData(const std::vector<Cell>& cells)
+    {
+        for (std::size_t col = 0; col < cells.size(); ++col)
+        {
+            if (col > 0)
+            {
+                Write(",", 1);
+            }
+            if (!cells[col].isNull)
+            {
+                WriteField(cells[col].text);
+            }
+        }
+        Write("\r\n", 2);
+    }
+
+    // Writes one field, quoting it (and doubling any embedded quotes) if necessary.
+    void CsvTableExporter::WriteField(const CStringA& text)
+    {
+        if (text.FindOneOf(",\"\r\n") == -1)
+        {
+            Write(text.GetString(), text.GetLength());
+            return;
+        }
+
+        CStringA quoted = text;
+        quoted.Replace("\"", "\"\"");
+        Write("\"", 1);
+        Write(quoted.GetString(), quoted.GetLength());
+        Write("\"", 1);
+    }
+
+
+    ColumnarTableExporter::ColumnarTableExporter(std::unique_ptr<CFile> stream, std::size_t rowGroupSize) :
+        TableExporter{ std::move(stream) },
+        _rowGroupSize{ rowGroupSize > 0 ? rowGroupSize : 1 },
+        _groupRows{ 0 },
+        _data{}
+    { }
+
+    void ColumnarTableExporter::WriteHeader(const std::vector<Column>& columns)
+    {
+        TableExporter::WriteHeader(columns);
+
+        Write("HXCOLS01", 8);
+        WriteUInt32(static_cast<std::uint32_t>(columns.size()));
+        for (const Column& column : columns)
+        {
+            CStringA name(CW2A(CStringW(column.name), CP_UTF8));
+            std::uint8_t type = static_cast<std::uint8_t>(column.type);
+
+            Write(&type, 1);
+            WriteUInt32(static_cast<std::uint32_t>(name.GetLength()));
+            Write(name.GetString(), name.GetLength());
+        }
+
+        _data.assign(columns.size(), ColumnData{});
+        _groupRows = 0;
+    }
+
+    void ColumnarTableExporter::WriteEpilogue()
+    {
+        if (_groupRows > 0)
+        {
+            WriteRowGroup();
+        }
+
+        std::uint64_t total = static_cast<std::uint64_t>(RowsWritten());
+        WriteUInt32(0);
+        Write(&total, sizeof(total));
+
+        TableExporter::WriteEpilogue();
+    }
+
+    void ColumnarTableExporter::WriteRowData(const std::vector<Cell>& cells)
+    {
+        const std::vector<Column>& columns = Columns();
+        std::size_t bit = _groupRows % 8;
+
+        for (std::size_t col = 0; col < cells.size(); ++col)
+        {
+            ColumnData& data = _data[col];
+            const Cell& cell = cells[col];
+
+            if (bit == 0)
+            {
+                data.present.push_back(0);
+            }
+            if (!cell.isNull)
+            {
+                data.present.back() |= static_cast<std::uint8_t>(1 << bit);
+            }
+
+            switch (columns[col].type)
+            {
+            case ColumnType::Integer:
+                data.ints.push_back(cell.isNull ? 0 : cell.intValue);
+                break;
+            case ColumnType::Real:
+                data.reals.push_back(cell.isNull ? 0.0 : cell.realValue);
+                break;
+            default:
+                if (data.offsets.empty())
+                {
+                    data.offsets.push_back(0);
+                }
+                if (!cell.isNull)
+                {
+                    data.text.insert(data.text.end(), cell.text.GetString(), cell.text.GetString() + cell.text.GetLength());
+                }
+                data.offsets.push_back(static_cast<std::uint32_t>(data.text.size()));
+                break;
+            }
+        }
+
+        if (++_groupRows >= _rowGroupSize)
+        {
+            WriteRowGroup();
+        }
+    }
+
+    void ColumnarTableExporter::WriteRowGroup()
+    {
+        const std::vector<Column>& columns = Columns();
+
+        WriteUInt32(static_cast<std::uint32_t>(_groupRows));
+        for (std::size_t col = 0; col < _data.size(); ++col)
+        {
+            ColumnData& data = _data[col];
+
+            Write(data.present.data(), data.present.size());
+            switch (columns[col].type)
+            {
+            case ColumnType::Integer:
+                Write(data.ints.data(), data.ints.size() * sizeof(std::int64_t));
+                break;
+            case ColumnType::Real:
+                Write(data.reals.data(), data.reals.size() * sizeof(double));
+                break;
+            default:
+                Write(data.offsets.data(), data.offsets.size() * sizeof(std::uint32_t));
+                Write(data.text.data(), data.text.size());
+                break;
+            }
+
+            // Clear the values but keep the memory for the next group
+            data.present.clear();
+            data.ints.clear();
+            data.reals.clear();
+            data.offsets.clear();
+            data.text.clear();
+        }
+        _groupRows = 0;
+    }
+
+    void ColumnarTableExporter::WriteUInt32(std::uint32_t value)
+    {
+        Write(&value, sizeof(value));
+    }
+}
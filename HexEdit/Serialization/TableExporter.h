@@ -0,0 +1,160 @@
+#pragma once
+#include <afx.h>
+#include <afxstr.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace hex
+{
+    /// \brief  The type of the values in a table column.
+    enum class ColumnType : std::uint8_t
+    {
+        Text = 1,
+        Integer = 2,
+        Real = 3,
+    };
+
+    /// \brief  Describes one column of an exported table.
+    struct Column
+    {
+        CString name;
+        ColumnType type;
+    };
+
+    /// \brief  One value of an exported table row.
+    ///
+    /// \remarks  The text is always filled in (UTF-8) so that text-based exporters
+    ///           do not need to know how the value was formatted.
+    struct Cell
+    {
+        bool isNull;
+        std::int64_t intValue;
+        double realValue;
+        CStringA text;
+    };
+
+
+    /// \brief  Base class for exporters of tables of values (eg, the elements of a template array).
+    class TableExporter
+    {
+    protected:
+        /// \brief  Constructor.
+        ///
+        /// \param  stream  The stream to write to.
+        explicit TableExporter(std::unique_ptr<CFile> stream);
+
+    public:
+        virtual ~TableExporter();
+
+
+        /// \brief  Gets the last error message.
+        CString Error() const { return _error; }
+
+        /// \brief  Gets the number of rows that have been written.
+        std::int64_t RowsWritten() const { return _rowsWritten; }
+
+
+        /// \brief  Writes the table header.  Must be called once before any rows are written.
+        ///
+        /// \param  columns  The columns of the table.
+        virtual void WriteHeader(const std::vector<Column>& columns);
+
+        /// \brief  Writes one row of the table.
+        ///
+        /// \param  cells  The values of the row, one for each column passed to WriteHeader.
+        void WriteRow(const std::vector<Cell>& cells);
+
+        /// \brief  Writes anything needed after the last row and flushes the stream.
+        virtual void WriteEpilogue();
+
+
+    protected:
+        /// \brief  Writes one row of the table.
+        virtual void WriteRowData(const std::vector<Cell>& cells) = 0;
+
+        /// \brief  Buffers bytes for writing to the stream.
+        void Write(const void* data, std::size_t count);
+
+        /// \brief  Writes the buffered bytes to the stream.
+        void Flush();
+
+        /// \brief  Gets the columns passed to WriteHeader.
+        const std::vector<Column>& Columns() const { return _columns; }
+
+
+    private:
+        std::unique_ptr<CFile> _stream;
+        std::vector<char> _buffer;
+        std::vector<Column> _columns;
+        CString _error;
+        std::int64_t _rowsWritten;
+    };
+
+
+    /// \brief  Exports a table as comma-separated values.
+    class CsvTableExporter : public TableExporter
+    {
+    public:
+        /// \brief  Constructor.
+        ///
+        /// \param  stream  The stream to write to.
+        explicit CsvTableExporter(std::unique_ptr<CFile> stream);
+
+        void WriteHeader(const std::vector<Column>& columns) override;
+
+    protected:
+        void WriteRowData(const std::vector<Cell>& cells) override;
+
+    private:
+        void WriteField(const CStringA& text);
+    };
+
+
+    /// \brief  Exports a table in a simple binary columnar format.
+    ///
+    /// \remarks  Rows are buffered into groups and each group is written column by
+    ///           column so that readers can load a column without parsing every row.
+    ///           All values are little-endian:
+    ///
+    ///               "HXCOLS01"  uint32 ncols  { uint8 type  uint32 len  char name[len] }...
+    ///               { uint32 nrows  { uint8 present[(nrows+7)/8]  values }... }...
+    ///               uint32 0  uint64 total_rows
+    ///
+    ///           where values are int64[nrows] (Integer), double[nrows] (Real) or
+    ///           uint32 offsets[nrows+1] followed by the UTF-8 bytes (Text).
+    class ColumnarTableExporter : public TableExporter
+    {
+    public:
+        /// \brief  Constructor.
+        ///
+        /// \param  stream        The stream to write to.
+        /// \param  rowGroupSize  The number of rows in each row group.
+        explicit ColumnarTableExporter(std::unique_ptr<CFile> stream, std::size_t rowGroupSize = 65536);
+
+        void WriteHeader(const std::vector<Column>& columns) override;
+        void WriteEpilogue() override;
+
+    protected:
+        void WriteRowData(const std::vector<Cell>& cells) override;
+
+    private:
+        void WriteRowGroup();
+        void WriteUInt32(std::uint32_t value);
+
+        struct ColumnData
+        {
+            std::vector<std::uint8_t> present;
+            std::vector<std::int64_t> ints;
+            std::vector<double> reals;
+            std::vector<std::uint32_t> offsets;
+            std::vector<char> text;
+        };
+
+        std::size_t _rowGroupSize;
+        std::size_t _groupRows;
+        std::vector<ColumnData> _data;
+    };
+}
@@ -0,0 +1,273 @@
+// SnapshotStore.cpp : implementation of the snapshot_store class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "SnapshotStore.h"
+#include "Misc.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+// Keeps reading until we get all the bytes asked for or EOF/error
+static std::size_t read_all(const snapshot_store::reader_t &read, unsigned char *buf, std::size_t len, std::int64_t addr)
+{
+	std::size_t done = 0;
+	while (done < len)
+	{
+		std::size_t got = read(buf + done, len - done, addr + done);
+		if (got == 0 || got == std::size_t(-1))
+			break;
+		done += got;
+	}
+	return done;
+}
+
+// Adds a difference, joining it to the previous replacement if they are adjacent
+static void add_change(std::vector<snapshot_store::change> &changes, snapshot_store::kind_t kind, std::int64_t addr, std::int64_t len)
+{
+	if (kind == snapshot_store::KIND_REPLACE && !changes.empty() &&
+		changes.back().kind == snapshot_store::KIND_REPLACE &&
+		changes.back().addr + changes.back().len == addr)
+	{
+		changes.back().len += len;
+	}
+	else
+		changes.push_back(snapshot_store::change{ kind, addr, len });
+}
+
+snapshot_store::snapshot_store(const std::string &store_name)
+	: store_name_(store_name), slots_(0), versions_(0), len_(0), prev_len_(0)
+{
+	store_.open(store_name_.c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+}
+
+snapshot_store::~snapshot_store()
+{
+	if (store_.is_open())
+	{
+		store_.close();
+		std::remove(store_name_.c_str());
+	}
+}
+
+bool snapshot_store::take(reader_t read, std::int64_t len, progress_t progress /*=progress_t()*/)
+{
+	if (!ok())
+		return false;
+
+	std::size_t nblocks = std::size_t((len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+	std::vector<std::int64_t> loc(nblocks);
+	std::vector<std::uint64_t> hash(nblocks);
+	std::vector<extent> changed;
+	std::vector<std::int64_t> written;          // blocks of the store we have used (given back if we fail)
+	buf_.resize(BLOCK_SIZE);
+
+	bool success = true;
+	for (std::size_t bb = 0; bb < nblocks; ++bb)
+	{
+		std::int64_t addr = std::int64_t(bb) * BLOCK_SIZE;
+		std::size_t want = std::size_t(std::min<std::int64_t>(BLOCK_SIZE, len - addr));
+		if (read_all(read, &buf_[0], want, addr) != want)
+		{
+			success = false;                    // read error or file has been truncated
+			break;
+		}
+
+		hash[bb] = block_hash(&buf_[0], want);
+		if (versions_ > 0 && bb < hash_.size() && hash[bb] == hash_[bb] &&
+			std::min<std::int64_t>(BLOCK_SIZE, len_ - addr) == std::int64_t(want))
+		{
+			loc[bb] = loc_[bb];                 // unchanged so share the block with the previous version
+		}
+		else
+		{
+			if ((loc[bb] = write_block(&buf_[0], want)) < 0)
+			{
+				success = false;
+				break;
+			}
+			written.push_back(loc[bb]);
+			if (!changed.empty() && changed.back().start + changed.back().len == addr)
+				changed.back().len += want;
+			else
+				changed.push_back(extent{ addr, std::int64_t(want) });
+		}
+
+		if (progress && bb % 16 == 15 && !progress(double(bb + 1) / nblocks))
+		{
+			success = false;
+			break;
+		}
+	}
+	if (success)
+	{
+		store_.flush();
+		success = !store_.fail();
+	}
+	if (!success)
+	{
+		store_.clear();
+		free_.insert(free_.end(), written.begin(), written.end());
+		return false;
+	}
+
+	// Blocks only used by the version we are dropping can now be reused
+	if (versions_ > 1)
+	{
+		for (std::size_t bb = 0; bb < prev_loc_.size(); ++bb)
+			if (bb >= loc_.size() || prev_loc_[bb] != loc_[bb])
+				free_.push_back(prev_loc_[bb]);
+	}
+
+	prev_loc_.swap(loc_);
+	loc_.swap(loc);
+	hash_.swap(hash);
+	prev_len_ = len_;
+	len_ = len;
+	changed_.swap(changed);
+	if (versions_ < 2)
+		++versions_;
+	return true;
+}
+
+std::int64_t snapshot_store::locate(int ver, std::int64_t addr, std::size_t &avail) const
+{
+	const std::vector<std::int64_t> &loc = ver == 0 || versions_ < 2 ? loc_ : prev_loc_;
+	std::int64_t len = length(ver);
+	if (addr < 0 || addr >= len)
+		return -1;
+
+	std::int64_t off = addr % BLOCK_SIZE;
+	avail = std::size_t(std::min<std::int64_t>(BLOCK_SIZE - off, len - addr));
+	return loc[std::size_t(addr / BLOCK_SIZE)] + off;
+}
+
+std::size_t snapshot_store::read(int ver, unsigned char *buf, std::size_t len, std::int64_t addr)
+{
+	std::size_t done = 0, avail;
+	std::int64_t pos;
+	while (done < len && (pos = locate(ver, addr + done, avail)) >= 0)
+	{
+		std::size_t nn = std::min(avail, len - done);
+		store_.seekg(std::streamoff(pos));
+		store_.read(reinterpret_cast<char *>(buf + done), std::streamsize(nn));
+		if (store_.gcount() != std::streamsize(nn))
+		{
+			store_.clear();
+			break;
+		}
+		done += nn;
+	}
+	return done;
+}
+
+std::int64_t snapshot_store::changed_bytes() const
+{
+	if (versions_ < 2)
+		return 0;
+
+	std::int64_t common = std::min(len_, prev_len_), retval = 0;
+	for (const extent &ee : changed_)
+		if (ee.start < common)
+			retval += std::min(ee.start + ee.len, common) - ee.start;
+	return retval;
+}
+
+bool snapshot_store::diff(std::vector<change> &changes, progress_t progress /*=progress_t()*/)
+{
+	changes.clear();
+	if (versions_ < 2)
+		return true;
+
+	std::int64_t common = std::min(len_, prev_len_);
+	std::int64_t total = changed_bytes(), done = 0;
+	buf_.resize(BLOCK_SIZE);
+	buf2_.resize(BLOCK_SIZE);
+	for (const extent &ee : changed_)
+	{
+		std::int64_t end = std::min(ee.start + ee.len, common);
+		for (std::int64_t addr = ee.start; addr < end; )
+		{
+			std::size_t nn = std::size_t(std::min<std::int64_t>(BLOCK_SIZE, end - addr));
+			if (read(0, &buf_[0], nn, addr) != nn || read(1, &buf2_[0], nn, addr) != nn)
+				return false;
+
+			for (std::size_t ii = 0; ii < nn; )
+			{
+				ii += FindFirstDiff(&buf_[ii], &buf2_[ii], nn - ii);
+				if (ii == nn)
+					break;
+				std::size_t start = ii;
+				ii += FindFirstSame(&buf_[ii], &buf2_[ii], nn - ii);
+				add_change(changes, KIND_REPLACE, addr + start, std::int64_t(ii - start));
+			}
+
+			addr += nn;
+			done += nn;
+			if (progress && !progress(double(done) / total))
+				return false;
+		}
+	}
+
+	// Anything past the end of the shorter version is an insertion or deletion
+	if (len_ > prev_len_)
+		add_change(changes, KIND_INSERT, prev_len_, len_ - prev_len_);
+	else if (len_ < prev_len_)
+		add_change(changes, KIND_DELETE, len_, prev_len_ - len_);
+	return true;
+}
+
+// Writes a block of the latest version to the store returning where it was written (or -1 on error)
+std::int64_t snapshot_store::write_block(const unsigned char *buf, std::size_t len)
+{
+	ASSERT(len <= BLOCK_SIZE);
+	std::int64_t pos;
+	if (!free_.empty())
+	{
+		pos = free_.back();
+		free_.pop_back();
+	}
+	else
+		pos = slots_++ * BLOCK_SIZE;
+
+	store_.seekp(std::streamoff(pos));
+	store_.write(reinterpret_cast<const char *>(buf), std::streamsize(len));
+	if (store_.fail())
+	{
+		free_.push_back(pos);
+		return -1;
+	}
+	return pos;
+}
+
+// Hash of all the bytes of a block, used to tell if the block has changed
+std::uint64_t snapshot_store::block_hash(const unsigned char *buf, std::size_t len)
+{
+	const std::uint64_t mult = 0x9E3779B97F4A7C15ULL;
+	std::uint64_t hh = len * mult;
+	std::size_t ii = 0;
+	for ( ; ii + 8 <= len; ii += 8)
+	{
+		std::uint64_t ww;
+		std::memcpy(&ww, buf + ii, 8);
+		hh = (hh ^ ww) * mult;
+		hh ^= hh >> 31;
+	}
+	for ( ; ii < len; ++ii)
+		hh = (hh ^ buf[ii]) * mult;
+	return hh ^ (hh >> 29);
+}
@@ -0,0 +1,106 @@
+// SnapshotStore.h : keeps the last two versions of a file for self-compare
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Self-compare compares a file with how it was when it last changed, so we need a copy of the
+// previous version and (since the file may change again while we compare) the latest version.
+// Rather than two full copies of the file, this keeps one store file of BLOCK_SIZE blocks:
+//
+// - The first snapshot copies every block into the store.
+// - Later snapshots hash each block of the file and compare it with the hash of the same block
+//   in the previous snapshot.  Only changed (or new) blocks are copied into the store, into
+//   space no longer needed by older versions if there is any.
+//
+// So for a large log file that is appended to, each snapshot only adds the new blocks at the
+// end (plus the old last block if it was partial).  The blocks that changed are remembered
+// so that, as long as nothing was inserted or deleted in the middle of the file, diff() can
+// find the differences by only comparing those blocks.
+//
+// Note that this class does no locking.  take() must not be called while anything is reading
+// the store (eg using locate() to find the data of a version).
+class snapshot_store
+{
+public:
+	typedef std::function<std::size_t(unsigned char *buf, std::size_t len, std::int64_t addr)> reader_t;
+	typedef std::function<bool(double done)> progress_t;   // done is 0 to 1; return false to abort
+
+	enum { BLOCK_SIZE = 65536 };
+
+	// A difference between the latest and the previous version (at the same address in both).
+	// As with CHexEditDoc::CompResult INSERT means bytes in the latest version that are not in
+	// the previous one (ie the file has grown) and DELETE means the file has got shorter.
+	enum kind_t { KIND_REPLACE, KIND_INSERT, KIND_DELETE };
+	struct change
+	{
+		kind_t kind;
+		std::int64_t addr;
+		std::int64_t len;
+	};
+
+	struct extent { std::int64_t start, len; };
+
+	explicit snapshot_store(const std::string &store_name);
+	~snapshot_store();                                 // deletes the store file
+
+	bool ok() const { return store_.is_open(); }
+	const std::string &store_name() const { return store_name_; }
+
+	// Makes a new snapshot (which becomes version 0, the previous latest becomes version 1).
+	// The reader must return the number of bytes read (less than asked for only at EOF).
+	// Returns false on error or if aborted in which case the versions are unchanged.
+	bool take(reader_t read, std::int64_t len, progress_t progress = progress_t());
+
+	// Information about versions: 0 = latest, 1 = previous.  Before there are two snapshots
+	// version 1 is the same as version 0.
+	int versions() const { return versions_; }
+	std::int64_t length(int ver) const { return ver == 0 || versions_ < 2 ? len_ : prev_len_; }
+
+	// Returns where in the store the byte at addr of a version is, and how many bytes (up to the
+	// end of its block) follow it there.  Returns -1 if addr is past the end.
+	std::int64_t locate(int ver, std::int64_t addr, std::size_t &avail) const;
+
+	// Reads from a version (using the store file of this object so not to be used by other threads)
+	std::size_t read(int ver, unsigned char *buf, std::size_t len, std::int64_t addr);
+
+	const std::vector<extent> &changed() const { return changed_; }     // blocks of version 0 not the same as version 1
+	std::int64_t changed_bytes() const;             // total of changed() within both versions
+	std::int64_t store_size() const { return std::int64_t(slots_) * BLOCK_SIZE; }
+
+	// Finds the differences between version 0 and version 1 by comparing the changed blocks.
+	// This only gives the same result as comparing the whole files if there were no insertions
+	// or deletions (apart from at the end) so it is best used when changed_bytes() is small.
+	bool diff(std::vector<change> &changes, progress_t progress = progress_t());
+
+private:
+	std::string store_name_;
+	std::fstream store_;
+	std::int64_t slots_;                    // number of blocks in the store file
+	std::vector<std::int64_t> free_;        // blocks in the store not used by either version
+
+	int versions_;                          // number of snapshots taken (max 2)
+	std::int64_t len_, prev_len_;           // length of each version
+	std::vector<std::int64_t> loc_, prev_loc_;      // where each block of each version is in the store
+	std::vector<std::uint64_t> hash_;       // hash of each block of the latest version
+	std::vector<extent> changed_;
+
+	std::vector<unsigned char> buf_, buf2_;
+
+	std::int64_t write_block(const unsigned char *buf, std::size_t len);
+	static std::uint64_t block_hash(const unsigned char *buf, std::size_t len);
+};
@@ -0,0 +1,267 @@
+// SpanIndex.cpp : implementation of the span_index class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+
+#include "SpanIndex.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+void span_index::set(int layer, std::vector<span> spans)
+{
+	layer_t &ll = layers_[layer];
+	spans.erase(std::remove_if(spans.begin(), spans.end(), [](const span &ss) { return ss.end <= ss.start; }),
+	            spans.end());
+	for (span &ss : spans)
+		ss.layer = layer;
+	std::stable_sort(spans.begin(), spans.end(), [](const span &a, const span &b) { return a.start < b.start; });
+	ll.spans.swap(spans);
+	build(ll);
+}
+
+void span_index::set(int layer, const std::vector<std::int64_t> &addr, const std::vector<std::int64_t> &len, std::uint32_t colour /*=0*/)
+{
+	std::vector<span> spans;
+	std::size_t count = std::min(addr.size(), len.size());
+	spans.reserve(count);
+	for (std::size_t ii = 0; ii < count; ++ii)
+	{
+		span ss = { addr[ii], addr[ii] + len[ii], colour, layer };
+		spans.push_back(ss);
+	}
+	set(layer, std::move(spans));          // already sorted so the sort is quick
+}
+
+void span_index::shift(int layer, std::int64_t addr, std::int64_t offset)
+{
+	layer_t &ll = layers_[layer];
+	if (!ll.valid || offset == 0)
+		return;
+
+	// Addresses before addr don't move so only spans after the first one that ends after addr
+	// change (and they stay in order of start address since the addresses only move up or down
+	// together)
+	std::size_t first = first_ending_after(ll, addr), out = first;
+	std::int64_t del_end = addr - offset;           // end of deleted bytes (if offset < 0)
+	for (std::size_t ii = first; ii < ll.spans.size(); ++ii)
+	{
+		span ss = ll.spans[ii];
+		if (offset > 0)
+		{
+			if (ss.start > addr)
+				ss.start += offset;
+			if (ss.end > addr)
+				ss.end += offset;
+		}
+		else
+		{
+			ss.start = ss.start <= addr ? ss.start : ss.start < del_end ? addr : ss.start + offset;
+			ss.end = ss.end <= addr ? ss.end : ss.end < del_end ? addr : ss.end + offset;
+			if (ss.end <= ss.start)
+				continue;                           // all of the span was deleted
+		}
+		ll.spans[out++] = ss;
+	}
+	ll.spans.resize(out);
+	build(ll, first);
+}
+
+void span_index::splice(int layer, std::int64_t lo, std::int64_t hi, std::vector<span> spans)
+{
+	layer_t &ll = layers_[layer];
+	if (!ll.valid)
+		return;
+
+	// Spans that start in the range are together in the array - keep those that end after it
+	auto by_start = [](const span &a, const span &b) { return a.start < b.start; };
+	span key = { lo, lo, 0, layer };
+	std::vector<span>::iterator p0 = std::lower_bound(ll.spans.begin(), ll.spans.end(), key, by_start);
+	key.start = hi;
+	std::vector<span>::iterator p1 = std::lower_bound(p0, ll.spans.end(), key, by_start);
+	std::size_t first = p0 - ll.spans.begin();
+	for (std::vector<span>::iterator pp = p0; pp != p1; ++pp)
+		if (pp->end > hi)
+			spans.push_back(*pp);
+
+	spans.erase(std::remove_if(spans.begin(), spans.end(), [](const span &ss) { return ss.end <= ss.start; }),
+	            spans.end());
+	for (span &ss : spans)
+	{
+		ASSERT(ss.start >= lo && ss.start < hi);
+		ss.layer = layer;
+	}
+	std::stable_sort(spans.begin(), spans.end(), by_start);
+
+	p0 = ll.spans.erase(p0, p1);
+	ll.spans.insert(p0, spans.begin(), spans.end());
+	build(ll, first);
+}
+
+void span_index::extend(int layer, std::int64_t &lo, std::int64_t &hi) const
+{
+	const layer_t &ll = layers_[layer];
+	std::vector<span> tmp;
+	for (;;)
+	{
+		tmp.clear();
+		find(ll, lo - 1, hi + 1, tmp, false);
+		std::int64_t new_lo = lo, new_hi = hi;
+		for (const span &ss : tmp)
+		{
+			new_lo = std::min(new_lo, ss.start);
+			new_hi = std::max(new_hi, ss.end);
+		}
+		if (new_lo == lo && new_hi == hi)
+			break;
+		lo = new_lo;
+		hi = new_hi;
+	}
+}
+
+void span_index::invalidate_all()
+{
+	for (layer_t &ll : layers_)
+		ll.valid = false;
+}
+
+void span_index::find(std::int64_t lo, std::int64_t hi, unsigned mask, std::vector<span> &out) const
+{
+	for (std::size_t ii = 0; ii < layers_.size(); ++ii)
+		if ((mask & (1u << ii)) != 0)
+			find(layers_[ii], lo, hi, out);
+}
+
+// Fills in max_end for the implicit tree.  Nodes at level k are at indices with k trailing 1
+// bits, so the leaves are the even indices and the root is at 2^max_level - 1.  If the number
+// of spans is not 2^n - 1 the last nodes are missing, and a node whose right child is missing
+// uses the max_end of the last node that exists at the same level (called last here).
+// Spans before from have not changed since the last build so only nodes whose subtree
+// includes from or a later span are recalculated.
+void span_index::build(layer_t &ll, std::size_t from /*=0*/)
+{
+	const std::vector<span> &ss = ll.spans;
+	std::size_t nn = ss.size();
+	ll.max_end.resize(nn);
+	ll.valid = true;
+	ll.max_level = -1;
+	if (nn == 0)
+		return;
+
+	// Gets the first node of a level (nodes at i0 + n*step) whose subtree (of nodes within
+	// half of the node) reaches from
+	auto first_node = [from](std::size_t i0, std::size_t step, std::size_t half) -> std::size_t
+	{
+		return from <= i0 + half ? i0 : i0 + (from - i0 - half + step - 1) / step * step;
+	};
+
+	std::size_t ii, last_i = (nn - 1) & ~std::size_t(1);
+	for (ii = first_node(0, 2, 0); ii < nn; ii += 2)
+		ll.max_end[ii] = ss[ii].end;
+	std::int64_t last = ll.max_end[last_i];
+
+	int kk;
+	for (kk = 1; (std::size_t(1) << kk) <= nn; ++kk)
+	{
+		std::size_t xx = std::size_t(1) << (kk - 1), i0 = (xx << 1) - 1, step = xx << 2;
+		for (ii = first_node(i0, step, i0); ii < nn; ii += step)
+		{
+			std::int64_t el = ll.max_end[ii - xx];                  // left child always exists
+			std::int64_t er = ii + xx < nn ? ll.max_end[ii + xx] : last;
+			ll.max_end[ii] = std::max(ss[ii].end, std::max(el, er));
+		}
+		last_i = (last_i >> kk & 1) != 0 ? last_i - xx : last_i + xx;
+		if (last_i < nn && ll.max_end[last_i] > last)
+			last = ll.max_end[last_i];
+	}
+	ll.max_level = kk - 1;
+}
+
+// Finds the first span in the array that ends after addr (or returns the number of spans if
+// none do).  Each left subtree is only entered if its max_end says that such a span is there.
+std::size_t span_index::first_ending_after(const layer_t &ll, std::int64_t addr)
+{
+	const std::vector<span> &ss = ll.spans;
+	std::size_t nn = ss.size();
+	if (ll.max_level < 0)
+		return nn;
+
+	std::size_t node = (std::size_t(1) << ll.max_level) - 1;
+	for (int level = ll.max_level; level > 0; --level)
+	{
+		std::size_t half = std::size_t(1) << (level - 1);
+		if (node - half < nn && ll.max_end[node - half] > addr)
+			node -= half;                           // it's in the left subtree
+		else if (node >= nn)
+			return nn;                              // no node or right subtree
+		else if (ss[node].end > addr)
+			return node;
+		else
+			node += half;
+	}
+	return node < nn && ss[node].end > addr ? node : nn;
+}
+
+// Appends the spans that overlap lo to hi-1 to out, clipped to the range if clip is true
+void span_index::find(const layer_t &ll, std::int64_t lo, std::int64_t hi, std::vector<span> &out, bool clip /*=true*/)
+{
+	const std::vector<span> &ss = ll.spans;
+	std::size_t nn = ss.size();
+	if (ll.max_level < 0 || lo >= hi)
+		return;
+
+	auto add = [&](const span &sp)
+	{
+		span clipped = sp;
+		if (clip)
+		{
+			clipped.start = std::max(sp.start, lo);
+			clipped.end = std::min(sp.end, hi);
+		}
+		out.push_back(clipped);
+	};
+
+	// Walk the tree in order (so spans are found sorted by start) skipping subtrees that
+	// all end before lo or all start at or after hi
+	struct item { std::size_t node; int level; bool left_done; };
+	item stack[64];
+	int top = 0;
+	stack[top++] = { (std::size_t(1) << ll.max_level) - 1, ll.max_level, false };
+	while (top > 0)
+	{
+		item it = stack[--top];
+		if (it.level <= 3)
+		{
+			// Small subtree - just scan it
+			std::size_t i0 = it.node >> it.level << it.level;
+			std::size_t i1 = std::min(nn, i0 + (std::size_t(1) << (it.level + 1)) - 1);
+			for (std::size_t ii = i0; ii < i1 && ss[ii].start < hi; ++ii)
+				if (ss[ii].end > lo)
+					add(ss[ii]);
+		}
+		else if (!it.left_done)
+		{
+			std::size_t left = it.node - (std::size_t(1) << (it.level - 1));   // may be past the end
+			stack[top++] = { it.node, it.level, true };
+			if (left >= nn || ll.max_end[left] > lo)
+				stack[top++] = { left, it.level - 1, false };
+		}
+		else if (it.node < nn && ss[it.node].start < hi)
+		{
+			if (ss[it.node].end > lo)
+				add(ss[it.node]);
+			stack[top++] = { it.node + (std::size_t(1) << (it.level - 1)), it.level - 1, false };
+		}
+	}
+}
@@ -0,0 +1,90 @@
+// SpanIndex.h : index of the coloured address ranges drawn behind the bytes of a view
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The hex view draws several kinds of background: change tracking, compare differences,
+// highlights, search occurrences and template fields.  Each used to be found by its own scan
+// of a different container every time the window was drawn (the highlights in a list from
+// the start of the file).  Instead each kind is a layer of this index and find() returns the
+// spans of all the wanted layers that overlap the window, in layer (drawing) order.
+//
+// The spans of a layer may overlap (eg nested template fields).  They are kept sorted by start
+// address in an array which is also an implicit binary tree (as in Heng Li's cgranges): the
+// node at index i is at level L where L is the number of trailing 1 bits of i, and each node
+// stores the largest end address of its subtree.  So find() is O(log n + k) for a layer of n
+// spans of which k overlap the window.
+//
+// A layer is rebuilt only when its source changes - the owner calls invalidate() when it gets
+// a hint that the source changed, then before drawing rebuilds each layer that is not valid().
+// When bytes are inserted or deleted a layer can instead be moved with shift() and the spans
+// around the change replaced with splice(), which only touch the spans after the change.
+class span_index
+{
+public:
+	struct span
+	{
+		std::int64_t start, end;        // addresses of first byte and one past the last
+		std::uint32_t colour;
+		int layer;
+	};
+
+	explicit span_index(int layers) : layers_(layers) { }
+
+	// Replace all spans of a layer.  The first replaces them with a copy of the spans (which
+	// may be in any order - the layer field is ignored), the second with the blocks in the
+	// parallel address and length vectors (as used for change tracking and compare results).
+	void set(int layer, std::vector<span> spans);
+	void set(int layer, const std::vector<std::int64_t> &addr, const std::vector<std::int64_t> &len, std::uint32_t colour = 0);
+
+	void invalidate(int layer) { layers_[layer].valid = false; }
+	void invalidate_all();
+	bool valid(int layer) const { return layers_[layer].valid; }
+	std::size_t size(int layer) const { return layers_[layer].spans.size(); }
+
+	// Moves the spans of a layer for offset bytes inserted (offset > 0) or deleted (offset < 0)
+	// at addr, as range_set::shift does.  A span that contains addr grows to include inserted
+	// bytes and deleted bytes are removed from spans (spans left empty are removed).
+	void shift(int layer, std::int64_t addr, std::int64_t offset);
+
+	// Replaces the spans of a layer that are within lo to hi-1 with spans, which should all be
+	// within the same range.  Use extend() first so that no span crosses lo or hi.
+	void splice(int layer, std::int64_t lo, std::int64_t hi, std::vector<span> spans);
+
+	// Widens lo to hi to include all spans of the layer that overlap or touch it, including
+	// spans that touch those and so on.
+	void extend(int layer, std::int64_t &lo, std::int64_t &hi) const;
+
+	// Appends to out the spans (clipped to lo to hi) that overlap the addresses from lo to hi-1.
+	// Only layers that have their bit in the mask are searched.  The spans are sorted by layer
+	// then start address.
+	void find(std::int64_t lo, std::int64_t hi, unsigned mask, std::vector<span> &out) const;
+
+private:
+	struct layer_t
+	{
+		std::vector<span> spans;            // sorted by start
+		std::vector<std::int64_t> max_end;  // largest end of the subtree of each node
+		int max_level;                      // level of the root (-1 if empty)
+		bool valid;
+
+		layer_t() : max_level(-1), valid(false) { }
+	};
+	std::vector<layer_t> layers_;
+
+	static void build(layer_t &ll, std::size_t from = 0);
+	static void find(const layer_t &ll, std::int64_t lo, std::int64_t hi, std::vector<span> &out, bool clip = true);
+	static std::size_t first_ending_after(const layer_t &ll, std::int64_t addr);
+};
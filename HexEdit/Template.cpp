@@ -100,7 +100,7 @@ void CHexEditDoc::OnUpdateDffdRefresh(CCmdUI* pCmdUI)
 void CHexEditDoc::OnDffdNew()
 {
 	OpenDataFormatFile("default");
-	ScanFile();
+	ScanFileBG();
 	CDFFDHint dffdh;
 	UpdateAllViews(NULL, 0, &dffdh);
 
@@ -113,7 +113,7 @@ void CHexEditDoc::OnDffdOpen(UINT nID)
 {
 	ASSERT(nID - ID_DFFD_OPEN_FIRST < DFFD_RESERVED);
 	OpenDataFormatFile(theApp.xml_file_name_[nID - ID_DFFD_OPEN_FIRST]);
-	ScanFile();
+	ScanFileBG();
 	CDFFDHint dffdh;
 	UpdateAllViews(NULL, 0, &dffdh);
 
@@ -216,13 +216,18 @@ void CHexEditDoc::CheckUpdate()
 	{
 		CSaveStateHint ssh;
 		UpdateAllViews(NULL, 0, &ssh);
-		ScanFile();  // rescan doc (for tree views) since it has changed
+		ScanFileBG();  // rescan doc (for tree views) since it has changed
 		//CRefreshHint rh;
 		//UpdateAllViews(NULL, 0, &rh);
 		CDFFDHint dffdh;
 		UpdateAllViews(NULL, 0, &dffdh);
-		CRestoreStateHint rsh;
-		UpdateAllViews(NULL, 0, &rsh);
+		if (TemplateScanning())
+			df_keep_state_ = true;      // restore state when the bg scan finishes (see CheckBGProcessing)
+		else
+		{
+			CRestoreStateHint rsh;
+			UpdateAllViews(NULL, 0, &rsh);
+		}
 //        update_needed_ = false;   // This is done in ScanFile()
 	}
 }
@@ -354,46 +359,107 @@ void CHexEditDoc::OpenDataFormatFile(LPCTSTR data_file_name /*=NULL*/)
 
 // Returns the (first) element that contains the passed address
 // OR returns one past the last element if not found.
-// [Note: This does a linear search but is very fast - it replaces
-// find_address() (= binary search) which failed when JUMPs are used.]
+// [Note: This uses df_index_ which handles overlapping elements (as when JUMPs are used)
+// as well as the usual case where data elements are in address order.]
 size_t CHexEditDoc::FindDffdEltAt(FILE_ADDRESS addr)
 {
-	int ii, end = df_address_.size();
+	CTemplateLock tl(this);             // in case the template thread is scanning
+	size_t retval = df_address_.size();
 
-	for (ii = 0; ii < end; ++ii)
+	if (df_scanning_)
 	{
-		if (df_type_[ii] > DF_DATA)
+		// df_index_ is not built until the scan finishes so use the index of the published
+		// elements (which only has valid data elements - see publish_index)
+		std::shared_ptr<const index_parts_t> parts = published_index();
+		if (parts)
 		{
-			FILE_ADDRESS aa = df_address_[ii];
-			if (addr >= aa && addr < aa + df_size_[ii])
-				return ii;
+			for (const std::shared_ptr<const template_index> &part : *parts)
+			{
+				size_t ii = part->find(addr);
+				if (ii < retval)
+					retval = ii;
+			}
 		}
+		return retval;
 	}
-	return end;  // not found
+
+	df_index_.for_each_in(addr, addr + 1, [&](size_t pos)
+	{
+		size_t ii = df_index_.elt(pos);
+		if (ii < retval && df_type_[ii] > DF_DATA && df_size_[ii] > 0)
+			retval = ii;
+	});
+	return retval;  // one past end if not found
 }
 
 void  CHexEditDoc::FindDffdEltsIn(FILE_ADDRESS start, FILE_ADDRESS end, std::vector<boost::tuple<FILE_ADDRESS, FILE_ADDRESS, COLORREF> > & retval)
 {
 	retval.clear();
 
-	int ii, last_ii = df_address_.size();
-
-	for (ii = 0; ii < last_ii; ++ii)
+	if (df_scanning_)
 	{
-		if (df_type_[ii] > DF_DATA)
+		// Use the index of the published elements so that drawing does not wait for the template thread
+		std::shared_ptr<const index_parts_t> parts = published_index();
+		if (!parts)
+			return;
+		for (const std::shared_ptr<const template_index> &part : *parts)
 		{
-			FILE_ADDRESS ss = df_address_[ii];
-			FILE_ADDRESS ee = ss  + df_size_[ii];
-			if (ss < end && ee > start)
+			part->for_each_in(start, end, [&](size_t pos)
 			{
-				CString str = df_elt_[ii].GetAttr("color");
-				if (!str.IsEmpty())
-				{
-					COLORREF clr = (DWORD)(strtoul(str, NULL, 16) & 0xffFFFF);
-					retval.push_back(boost::tuple<FILE_ADDRESS, FILE_ADDRESS, COLORREF>(ss, ee, clr));
-				}
-			}
+				if (part->colour(pos) != template_index::no_colour)
+					retval.push_back(boost::tuple<FILE_ADDRESS, FILE_ADDRESS, COLORREF>(part->address(pos), part->end(pos), part->colour(pos)));
+			});
 		}
+		if (parts->size() > 1)
+			std::stable_sort(retval.begin(), retval.end(),
+							 [](const boost::tuple<FILE_ADDRESS, FILE_ADDRESS, COLORREF> &a, const boost::tuple<FILE_ADDRESS, FILE_ADDRESS, COLORREF> &b)
+							 { return a.get<0>() < b.get<0>(); });
+		return;
+	}
+
+	CSingleLock sl(&df_lock_, TRUE);    // not contended as the template thread is not scanning
+	df_index_.for_each_in(start, end, [&](size_t pos)
+	{
+		size_t ii = df_index_.elt(pos);
+		if (df_index_.colour(pos) != template_index::no_colour && df_type_[ii] > DF_DATA && df_size_[ii] > 0)
+			retval.push_back(boost::tuple<FILE_ADDRESS, FILE_ADDRESS, COLORREF>(df_index_.address(pos), df_index_.end(pos), df_index_.colour(pos)));
+	});
+}
+
+// Builds df_index_ from the data elements found by the scan.
+void CHexEditDoc::build_index()
+{
+	df_index_.clear();
+	add_to_index(df_index_, 0, df_address_.size(), false);
+	df_index_.build();
+}
+
+// Adds data elements first to last-1 to an index (the caller must then call build()).  The
+// "color" attribute is looked up here (once per XML element) so that drawing does not have
+// to query the DOM.  If valid_only is true elements are left out if they are not valid data
+// (eg domain errors) which FindDffdEltAt and FindDffdEltsIn would skip anyway.
+void CHexEditDoc::add_to_index(template_index &index, size_t first, size_t last, bool valid_only)
+{
+	std::map<MSXML2::IXMLDOMElementPtr::Interface *, std::uint32_t> colour;
+
+	for (size_t ii = first; ii < last; ++ii)
+	{
+		if (abs(df_type_[ii]) <= DF_DATA || df_address_[ii] == -1)
+			continue;
+		if (valid_only && (df_type_[ii] <= DF_DATA || df_size_[ii] <= 0))
+			continue;
+
+		MSXML2::IXMLDOMElementPtr::Interface * pelt = (MSXML2::IXMLDOMElementPtr::Interface *)df_elt_[ii].m_pelt;
+		std::map<MSXML2::IXMLDOMElementPtr::Interface *, std::uint32_t>::const_iterator pc = colour.find(pelt);
+		if (pc == colour.end())
+		{
+			CString str = df_elt_[ii].GetAttr("color");
+			std::uint32_t clr = template_index::no_colour;
+			if (!str.IsEmpty())
+				clr = (DWORD)(strtoul(str, NULL, 16) & 0xffFFFF);
+			pc = colour.insert(std::make_pair(pelt, clr)).first;
+		}
+		index.add(df_address_[ii], mac_abs(df_size_[ii]), ii, pc->second);
 	}
 }
 
@@ -401,7 +467,11 @@ void  CHexEditDoc::FindDffdEltsIn(FILE_ADDRESS start, FILE_ADDRESS end, std::vec
 BOOL CHexEditDoc::ScanInit()
 {
 	if (!df_init_)          // only scan once
-		return ScanFile();
+	{
+		if (load_template_cache())
+			return TRUE;
+		return ScanFileBG();
+	}
 	else
 		return !df_mess_.IsEmpty();
 }
@@ -420,6 +490,7 @@ BOOL CHexEditDoc::ScanInit()
 // give MSXML (via CXmlTree) a chance to load and process the XML file asynchronously.
 BOOL CHexEditDoc::ScanFile()
 {
+	StopTemplate();         // make sure a background scan is not also building the tree
 	df_init_ = TRUE;
 
 	if (ptree_ == NULL || ptree_->Error())
@@ -432,9 +503,21 @@ BOOL CHexEditDoc::ScanFile()
 
 	// Init progress bar
 	CMainFrame *mm = (CMainFrame *)AfxGetMainWnd();
-	m_last_checked = clock();
+	m_last_checked = df_scan_start_ = clock();
 
-	df_mess_.Empty();
+	CHexExpr ee(this);
+	bool extra = scan_template(ee);
+	report_scan(extra);
+	save_template_cache(extra);
+
+	mm->Progress(-1);  // Turn off progress now
+	update_needed_ = false;
+	return TRUE;
+}
+
+// Clears all info about the template tree
+void CHexEditDoc::clear_tree()
+{
 	max_indent_ = 1;
 
 	df_type_.clear();
@@ -445,6 +528,24 @@ BOOL CHexEditDoc::ScanFile()
 	df_elt_.clear();
 	df_info_.clear();
 	df_enum_.clear();
+	df_index_.clear();
+	df_layout_.clear();
+	df_dep_address_.clear();
+	df_dep_size_.clear();
+	df_dep_elt_list_.clear();
+	df_dirty_.clear();
+}
+
+// Builds the template tree for ScanFile() or the background template thread (see
+// BGTemplate.cpp).  Since we may not be in the main thread nothing is displayed here
+// but any error message is left in df_mess_ and the return value is true if the file
+// is longer than the template says it should be (see report_scan).
+bool CHexEditDoc::scan_template(CHexExpr &ee)
+{
+	bool retval = false;
+
+	df_mess_.Empty();
+	clear_tree();
 	ASSERT(ptree_->GetRoot().GetName() == "binary_file_format");
 
 	default_byte_order_ = ptree_->GetRoot().GetAttr("default_byte_order");
@@ -460,11 +561,12 @@ BOOL CHexEditDoc::ScanFile()
 	df_elt_.push_back(ptree_->GetRoot());   // root element in CXmlTree
 	df_info_.push_back(ExprStringType());
 	in_jump_ = 0;                           // we are not in any JUMPs
+	in_absent_ = 0;
 	bits_used_ = 0;                         // we have not seen a bitfield yet
 	last_size_ = 0;                         // store 0 when bits_used_ == 0
 
 	FILE_ADDRESS size_tmp;
-	CHexExpr ee(this);
+	ee.dep_mode_ = CHexExpr::DEP_LAYOUT;    // record file bytes that the layout depends on
 	try
 	{
 		add_branch(ptree_->GetRoot(), 0, 2, ee, size_tmp); // process whole tree (getting size)
@@ -473,8 +575,6 @@ BOOL CHexEditDoc::ScanFile()
 		df_size_[0] = size_tmp;
 		if (!df_mess_.IsEmpty())
 		{
-			// Display any error message
-			TaskMessageBox("Template Scan Error", df_mess_);
 			df_address_[0] = -1;
 		}
 		else
@@ -498,7 +598,7 @@ BOOL CHexEditDoc::ScanFile()
 		// Check that we're at EOF
 		if (size_tmp < length_)
 		{
-			TaskMessageBox("Template Warning", "Data past expected end of file");
+			retval = true;
 
 			df_type_.push_back(DF_EXTRA);           // represents extra unexpected data
 			df_address_.push_back(size_tmp);        // address is where EOF expected
@@ -514,10 +614,139 @@ BOOL CHexEditDoc::ScanFile()
 		(void)mess;
 		TRACE1("Caught %s in ScanFile\n", mess);
 	}
+	catch (...)
+	{
+		ee.dep_mode_ = CHexExpr::DEP_NONE;  // scan stopped (see template_lock)
+		throw;
+	}
+	ee.dep_mode_ = CHexExpr::DEP_NONE;
 
-	mm->Progress(-1);  // Turn off progress now
-	update_needed_ = false;
-	return TRUE;
+	// The dependencies go with the tree (the template thread already has df_lock_)
+	{
+		CSingleLock sl(&df_lock_, TRUE);
+		df_layout_.swap(ee.dep_layout_);
+		df_dep_address_.swap(ee.dep_address_);
+		df_dep_size_.swap(ee.dep_size_);
+		df_dep_elt_list_.swap(ee.dep_elt_list_);
+	}
+	build_index();
+
+	return retval;
+}
+
+// Display any problems found by scan_template (in the main thread)
+void CHexEditDoc::report_scan(bool extra)
+{
+	if (!df_mess_.IsEmpty())
+		TaskMessageBox("Template Scan Error", df_mess_);
+	if (extra)
+		TaskMessageBox("Template Warning", "Data past expected end of file");
+}
+
+// Called when the document has been modified to decide whether the template tree needs
+// to be rebuilt.  Insertions and deletions move everything after them so they always
+// require a full rescan, as do replacements of bytes that the layout depends on (eg, a
+// "count" or "test" field) or at EOF.  Other replacements only change values so the bytes
+// are remembered in df_dirty_ and the affected elements are re-checked by ScanDirty().
+void CHexEditDoc::dffd_change(enum mod_type utype, FILE_ADDRESS address, FILE_ADDRESS len)
+{
+	if (df_scanning_)
+		return;                         // the bg scan is restarted (see TemplateChange)
+
+	if (update_needed_ || !df_init_ || df_address_.empty())
+	{
+		update_needed_ = true;          // no tree yet or already invalid
+		return;
+	}
+
+	if (len < 1)
+		len = 1;                        // 2nd nybble of hex edit changes last byte of previous change
+
+	if ((utype != mod_replace && utype != mod_repback) || address + len >= length_)
+	{
+		update_needed_ = true;
+		return;
+	}
+
+	range_set<FILE_ADDRESS>::const_iterator pp = df_layout_.lower_bound(address);
+	if (pp != df_layout_.end() && *pp < address + len)
+	{
+		update_needed_ = true;          // changed bytes that determine layout
+		df_dirty_.clear();
+	}
+	else
+		df_dirty_.insert_range(address, address + len);
+}
+
+// Re-checks the domain of all data elements whose value may have changed due to replacements
+// recorded in df_dirty_ (see dffd_change), then tells the tree views to redisplay those rows.
+// This avoids rebuilding the whole tree when only values (not the layout) have changed.
+void CHexEditDoc::ScanDirty()
+{
+	if (df_dirty_.empty())
+		return;
+
+	if (update_needed_ || df_scanning_ || ptree_ == NULL || ptree_->Error())
+	{
+		df_dirty_.clear();              // a full rescan is required anyway
+		return;
+	}
+
+	// Returns true if any bytes in [ss, ee) have been replaced
+	auto is_dirty = [this](FILE_ADDRESS ss, FILE_ADDRESS ee) -> bool
+	{
+		range_set<FILE_ADDRESS>::const_iterator pp = df_dirty_.lower_bound(ss);
+		return pp != df_dirty_.end() && *pp < ee;
+	};
+
+	CDFFDValueHint dvh;
+	for (range_set<FILE_ADDRESS>::range_t::const_iterator pr = df_dirty_.range_.begin(); pr != df_dirty_.range_.end(); ++pr)
+	{
+		df_index_.for_each_in(pr->sfirst, pr->slast, [&](size_t pos)
+		{
+			dvh.elts_.push_back(df_index_.elt(pos));
+		});
+	}
+	// Also recheck elements whose domain expression uses the value of a changed element
+	for (size_t jj = 0; jj < df_dep_elt_list_.size(); ++jj)
+	{
+		if (is_dirty(df_dep_address_[jj], df_dep_address_[jj] + df_dep_size_[jj]))
+			dvh.elts_.push_back(df_dep_elt_list_[jj]);
+	}
+	std::sort(dvh.elts_.begin(), dvh.elts_.end());
+	dvh.elts_.erase(std::unique(dvh.elts_.begin(), dvh.elts_.end()), dvh.elts_.end());
+
+	CHexExpr ee(this);                      // does not record dependencies (kept from the last full scan)
+	for (std::vector<size_t>::const_iterator pe = dvh.elts_.begin(); pe != dvh.elts_.end(); ++pe)
+	{
+		df_size_[*pe] = mac_abs(df_size_[*pe]);     // assume valid until checked
+		check_domain(int(*pe), ee, false);
+	}
+
+	df_dirty_.clear();
+	if (!dvh.elts_.empty())
+		UpdateAllViews(NULL, 0, &dvh);
+}
+
+// Record the bytes of the file accessed when an expression uses the value of element ii.
+// During a full scan (see scan_template) expressions that affect the layout of the tree store
+// the bytes in dep_layout_, while domain checks record which other elements they depend on.
+void CHexExpr::note_access(int ii, FILE_ADDRESS addr, FILE_ADDRESS len)
+{
+	if (addr == -1 || len <= 0)
+		return;
+
+	if (dep_mode_ == DEP_LAYOUT)
+	{
+		// Elements are mostly scanned in address order so use end() as the insertion hint
+		dep_layout_.insert_range(dep_layout_.end(), addr, addr + len);
+	}
+	else if (dep_mode_ == DEP_VALUE && ii != dep_elt_)
+	{
+		dep_address_.push_back(addr);
+		dep_size_.push_back(len);
+		dep_elt_list_.push_back(dep_elt_);
+	}
 }
 
 // Adds a complete branch of the display tree and returns the size (bytes) of all the data of the tree.
@@ -547,6 +776,16 @@ int CHexEditDoc::add_branch(CXmlTree::CElt parent, FILE_ADDRESS addr, unsigned c
 {
 	ASSERT(DF_LAST < 128);
 
+	// When scanning in the background, elements are published (see template_yield) as each
+	// one is finished, including those inside a struct or array (eg the elements of a large
+	// FOR) so the tree can be shown while the scan continues.  Their parents are shown as they
+	// were when published (eg size not yet known) until the scan is finished.  Elements that
+	// are not in the file (addr == -1, shown greyed in edit mode) are not published until the
+	// branch containing them is done, as their sizes/addresses are changed afterwards.
+	bool absent = addr == -1;
+	if (absent)
+		++in_absent_;
+
 	// Keep track of the maximum indent
 	if (ind > max_indent_)
 	{
@@ -1475,7 +1714,7 @@ int CHexEditDoc::add_branch(CXmlTree::CElt parent, FILE_ADDRESS addr, unsigned c
 
 					df_size_[ii] = 0;
 					ASSERT(sizeof(buf)%2 == 0);   // Must be even length for wide chars
-					while ((got = GetData((unsigned char *)buf, sizeof(buf), addr + df_size_[ii])) > 0)
+					while ((got = GetData((unsigned char *)buf, sizeof(buf), addr + df_size_[ii], ee.UseBg())) > 0)
 					{
 						if ((pp = wmemchr(buf, term, got/2)) != NULL)
 						{
@@ -1487,6 +1726,7 @@ int CHexEditDoc::add_branch(CXmlTree::CElt parent, FILE_ADDRESS addr, unsigned c
 						df_size_[ii] += got;
 					}
 					last_ac = ii;               // Indicate that we looked at the data (to find end of string)
+					ee.note_access(ii, addr, df_size_[ii]); // position of terminator determines the layout
 				}
 			}
 #endif
@@ -1531,7 +1771,7 @@ int CHexEditDoc::add_branch(CXmlTree::CElt parent, FILE_ADDRESS addr, unsigned c
 					size_t got;
 
 					df_size_[ii] = 0;
-					while ((got = GetData(buf, sizeof(buf), addr + df_size_[ii])) > 0)
+					while ((got = GetData(buf, sizeof(buf), addr + df_size_[ii], ee.UseBg())) > 0)
 					{
 						if ((pp = (unsigned char *)memchr(buf, df_extra_[ii], got)) != NULL)
 						{
@@ -1543,6 +1783,7 @@ int CHexEditDoc::add_branch(CXmlTree::CElt parent, FILE_ADDRESS addr, unsigned c
 						df_size_[ii] += got;
 					}
 					last_ac = ii;               // We had to access the data of this element to find end of string
+					ee.note_access(ii, addr, df_size_[ii]); // position of terminator determines the layout
 				}
 			}
 			else if (data_type == "char")
@@ -1802,67 +2043,7 @@ int CHexEditDoc::add_branch(CXmlTree::CElt parent, FILE_ADDRESS addr, unsigned c
 
 			// Only check value against domain if we can read it
 			if (addr != -1)
-			{
-				// Check if the data is within its domain
-				CString strDomain = df_elt_[ii].GetAttr("domain");
-
-				if (!strDomain.IsEmpty() && strDomain[0] == '{')
-				{
-					// Check the value is one of the enums
-					__int64 sym_size, sym_addr;  // not used
-
-					// Get the value of the data type and make sure it is integer data
-					CHexExpr::value_t tmp = ee.get_value(ii, sym_size, sym_addr);
-
-					if (tmp.typ != CHexExpr::TYPE_INT)
-					{
-						ASSERT(df_size_[ii] > 0);
-						df_size_[ii] = -df_size_[ii];  // Make -ve to indicate that it's invalid
-
-						if (tmp.typ == CHexExpr::TYPE_NONE)
-							HandleError(CString(ee.get_error_message()) + "\nin \"domain\" attribute.");
-						else
-							HandleError("An enum domain is only valid for integer data.\n");
-					}
-					else
-					{
-						if (!add_enum(df_elt_[ii], strDomain))
-						{
-							// Syntax error in enum string
-							ASSERT(df_size_[ii] > 0);
-							df_size_[ii] = -df_size_[ii];  // Make -ve to indicate that it's invalid
-							HandleError("Invalid enumeration in \"domain\" attribute.");
-						}
-						else
-						{
-							enum_t &ev = get_enum(df_elt_[ii]);
-							if (ev.find(tmp.int64) == ev.end())
-							{
-								// Value not found
-								ASSERT(df_size_[ii] > 0);
-								df_size_[ii] = -df_size_[ii];  // Make -ve to indicate that it's invalid
-							}
-						}
-					}
-				}
-				else if (!strDomain.IsEmpty())
-				{
-					int expr_ac;                            // Last node accessed by test expression
-
-					CHexExpr::value_t tmp = ee.evaluate(strDomain, ii, expr_ac);
-					if (tmp.typ != CHexExpr::TYPE_BOOLEAN || !tmp.boolean)
-					{
-						ASSERT(df_size_[ii] > 0);
-						df_size_[ii] = -df_size_[ii];  // Make -ve to indicate that it's invalid
-
-						if (tmp.typ == CHexExpr::TYPE_NONE)
-							HandleError(CString(ee.get_error_message()) + "\nin \"domain\" attribute.");
-						else if (tmp.typ != CHexExpr::TYPE_BOOLEAN)
-							HandleError("The \"domain\" attribute expression of the\n"
-										  "\"data\" tag must yield a boolean result.\n");
-					}
-				}
-			}
+				check_domain(ii, ee, true);
 
 			// Advance address unless it was a bitfield
 			if (data_type != "int" || data_bits == 0)
@@ -1889,8 +2070,8 @@ int CHexEditDoc::add_branch(CXmlTree::CElt parent, FILE_ADDRESS addr, unsigned c
 				df_info_.pop_back();
 			}
 
-			// Update scan progress no more than once every 5 seconds
-			if (length_ > 0 && addr > 0 && (clock() - m_last_checked)/CLOCKS_PER_SEC > 5 && !in_jump_)
+			// Update scan progress no more than once every 5 seconds (bg scan progress is done in template_yield)
+			if (ee.UseBg() == -1 && length_ > 0 && addr > 0 && (clock() - m_last_checked)/CLOCKS_PER_SEC > 5 && !in_jump_)
 			{
 				((CMainFrame *)AfxGetMainWnd())->Progress(addr < length_ ? int((addr*100)/length_) : 100);
 				m_last_checked = clock();
@@ -1910,6 +2091,9 @@ int CHexEditDoc::add_branch(CXmlTree::CElt parent, FILE_ADDRESS addr, unsigned c
 			dump_tree();    // Set IP here to dump the tree
 #endif
 
+		if (ee.UseBg() != -1)
+			template_yield(in_absent_ == 0 ? df_address_.size() : 0, addr);
+
 		if (child_num != -1)
 			break;          // if not -1 we are only doing a single child
 
@@ -1929,11 +2113,101 @@ int CHexEditDoc::add_branch(CXmlTree::CElt parent, FILE_ADDRESS addr, unsigned c
 		bits_used_ = 0;                     // Indicate that there is now no bitfield in effect
 	}
 
+	if (absent)
+		--in_absent_;
 	return last_ac;
 }
 
+// Checks if the value of data element ii is within its domain (if it has a "domain"
+// attribute) and if not makes df_size_[ii] -ve to indicate that it's invalid.
+// If report is false errors are not displayed (used when rechecking values after a
+// replacement - see ScanDirty - so that the user is not asked about them every edit).
+void CHexEditDoc::check_domain(int ii, CHexExpr &ee, bool report)
+{
+	CString strDomain = df_elt_[ii].GetAttr("domain");
+	if (strDomain.IsEmpty())
+		return;
+
+	// While scanning remember which elements the domain depends on (see CHexExpr::note_access)
+	int saved_mode = ee.dep_mode_;
+	if (ee.dep_mode_ != CHexExpr::DEP_NONE)
+	{
+		ee.dep_mode_ = CHexExpr::DEP_VALUE;
+		ee.dep_elt_ = ii;
+	}
+
+	if (strDomain[0] == '{')
+	{
+		// Check the value is one of the enums
+		__int64 sym_size, sym_addr;  // not used
+
+		// Get the value of the data type and make sure it is integer data
+		CHexExpr::value_t tmp = ee.get_value(ii, sym_size, sym_addr);
+		ee.dep_mode_ = saved_mode;
+
+		if (tmp.typ != CHexExpr::TYPE_INT)
+		{
+			ASSERT(df_size_[ii] > 0);
+			df_size_[ii] = -df_size_[ii];  // Make -ve to indicate that it's invalid
+
+			if (report && tmp.typ == CHexExpr::TYPE_NONE)
+				HandleError(CString(ee.get_error_message()) + "\nin \"domain\" attribute.");
+			else if (report)
+				HandleError("An enum domain is only valid for integer data.\n");
+		}
+		else
+		{
+			if (!add_enum(df_elt_[ii], strDomain))
+			{
+				// Syntax error in enum string
+				ASSERT(df_size_[ii] > 0);
+				df_size_[ii] = -df_size_[ii];  // Make -ve to indicate that it's invalid
+				if (report)
+					HandleError("Invalid enumeration in \"domain\" attribute.");
+			}
+			else
+			{
+				enum_t &ev = get_enum(df_elt_[ii]);
+				if (ev.find(tmp.int64) == ev.end())
+				{
+					// Value not found
+					ASSERT(df_size_[ii] > 0);
+					df_size_[ii] = -df_size_[ii];  // Make -ve to indicate that it's invalid
+				}
+			}
+		}
+	}
+	else
+	{
+		int expr_ac;                            // Last node accessed by test expression
+
+		CHexExpr::value_t tmp = ee.evaluate(strDomain, ii, expr_ac);
+		ee.dep_mode_ = saved_mode;
+
+		if (tmp.typ != CHexExpr::TYPE_BOOLEAN || !tmp.boolean)
+		{
+			ASSERT(df_size_[ii] > 0);
+			df_size_[ii] = -df_size_[ii];  // Make -ve to indicate that it's invalid
+
+			if (report && tmp.typ == CHexExpr::TYPE_NONE)
+				HandleError(CString(ee.get_error_message()) + "\nin \"domain\" attribute.");
+			else if (report && tmp.typ != CHexExpr::TYPE_BOOLEAN)
+				HandleError("The \"domain\" attribute expression of the\n"
+							  "\"data\" tag must yield a boolean result.\n");
+		}
+	}
+}
+
 void CHexEditDoc::HandleError(const char *mess)
 {
+	// We can't ask the user in the template thread so just stop the scan (see report_scan)
+	if (pthread7_ != NULL && ::GetCurrentThreadId() == pthread7_->m_nThreadID)
+	{
+		if (df_mess_.IsEmpty())
+			df_mess_ = mess;
+		throw mess;
+	}
+
 	CString ss = CString(mess) + "\n\nDo you want to continue?";
 
 	if (TaskMessageBox("Template Error", ss, MB_YESNO) != IDYES)
@@ -2268,11 +2542,12 @@ CHexExpr::value_t CHexExpr::find_symbol(const char *sym, value_t parent, size_t
 		ASSERT(ii < pdoc->df_address_.size() - 1);
 		unsigned char val;                                      // Byte obtained from the file
 		retval.typ = TYPE_INT;
+		note_access(int(ii), pdoc->df_address_[ii] + index, 1);
 
 		// If data element does not exist, index is past end of BLOB or just couln't read it for some reason
 		if (pdoc->df_address_[ii] == -1 ||
 			index > pdoc->df_size_[ii] ||
-			pdoc->GetData(&val, 1, pdoc->df_address_[ii] + index) != 1)
+			pdoc->GetData(&val, 1, pdoc->df_address_[ii] + index, use_bg_) != 1)
 		{
 			// Set flag to say there is a problem and use null data
 			retval.error = true;
@@ -2402,6 +2677,8 @@ CHexExpr::value_t CHexExpr::get_value(int ii, __int64 &sym_size, __int64 &sym_ad
 
 	sym_size = mac_abs(pdoc->df_size_[ii]);
 	sym_address = pdoc->df_address_[ii];
+	if (sym_address != -1)
+		sym_address += offset_;
 	if (sym_address == -1)
 	{
 		retval.typ = TYPE_NONE;
@@ -2433,6 +2710,7 @@ CHexExpr::value_t CHexExpr::get_value(int ii, __int64 &sym_size, __int64 &sym_ad
 		ASSERT(df_type >= CHexEditDoc::DF_DATA);
 		if (df_type <= CHexEditDoc::DF_NO_TYPE || pdoc->df_address_[ii] == -1)
 			df_size = 0;
+		note_access(ii, sym_address, df_size);
 		unsigned char *buf = NULL;
 		unsigned char small_buf[128];                      // avoid heap memory for small (most) things
 		unsigned char *large_buf = NULL;                   // Only needed for long strings
@@ -2447,7 +2725,7 @@ CHexExpr::value_t CHexExpr::get_value(int ii, __int64 &sym_size, __int64 &sym_ad
 				large_buf = new unsigned char[size_t(df_size)];
 				buf = large_buf;
 			}
-			if (pdoc->GetData(buf, size_t(df_size), pdoc->df_address_[ii]) != df_size)
+			if (get_data(buf, size_t(df_size), sym_address) != df_size)
 			{
 				// Set flag to say there is a problem and use null data
 				retval.error = true;
@@ -2712,6 +2990,17 @@ CHexExpr::value_t CHexExpr::get_value(int ii, __int64 &sym_size, __int64 &sym_ad
 	return retval;
 }
 
+// Gets bytes for get_value, from the buffer set with SetSource if possible
+size_t CHexExpr::get_data(unsigned char *buf, size_t len, FILE_ADDRESS addr)
+{
+	if (pbuf_ != NULL && addr >= buf_addr_ && addr + len <= buf_addr_ + FILE_ADDRESS(buf_len_))
+	{
+		memcpy(buf, pbuf_ + size_t(addr - buf_addr_), len);
+		return len;
+	}
+	return pdoc->GetData(buf, len, addr, use_bg_);
+}
+
 #if 0  // This was in the DTD but caused problems
 /*
 <!--
@@ -0,0 +1,344 @@
+// TemplateCache.cpp : saves the template tree between sessions (part of CHexEditDoc)
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+#include <io.h>
+#include <imagehlp.h>       // For ::MakeSureDirectoryPathExists()
+#include <cstdint>
+
+#include "HexEdit.h"
+#include "HexEditDoc.h"
+#include "HexFileList.h"
+#include "TemplateCacheFile.h"
+#include "Misc.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+// Scanning a large file with a complex template can take a long time and was repeated every
+// time the file was opened.  So after a slow scan the tree is saved to a cache file (in the
+// TemplateCache folder of the user's application data) whose name is kept in the recent file
+// list (see CHexFileList::TEMPLATECACHE).  When the file is reopened the cache file is mapped
+// into memory and used instead of scanning, provided the file and the template have not
+// changed.  The file is checked using its size, modification time and CRCs of samples of its
+// contents spread evenly through the file.
+//
+// The XML elements of the template (df_elt_) are stored by their position in the template
+// (see get_template_elts).  Enums are not stored as they are quickly rebuilt from the template.
+// The layout of the file (and its checks) is in template_cache_file (see TemplateCacheFile.h).
+
+namespace
+{
+	enum { NUM_SAMPLES = template_cache_file::NUM_SAMPLES, SAMPLE_LEN = template_cache_file::SAMPLE_LEN };
+
+	// Gets the key for the current state of the document's file and template
+	bool get_cache_key(CHexEditDoc *pdoc, template_cache_file::key_t &key)
+	{
+		memset(&key, 0, sizeof(key));     // so that padding does not affect comparisons
+
+		CFileStatus status;
+		if (!pdoc->pfile1_->GetStatus(status))
+			return false;
+		key.length = pdoc->length();
+		key.mtime = status.m_mtime.GetTime();
+
+		CString ss = pdoc->ptree_->DumpXML();
+		key.template_crc = crc_32(ss.GetString(), ss.GetLength() * sizeof(TCHAR));
+
+		unsigned char buf[SAMPLE_LEN];
+		for (int ii = 0; ii < NUM_SAMPLES; ++ii)
+		{
+			FILE_ADDRESS addr = 0;
+			if (key.length > SAMPLE_LEN)
+				addr = (key.length - SAMPLE_LEN) * ii / (NUM_SAMPLES - 1);
+			size_t got = pdoc->GetData(buf, SAMPLE_LEN, addr);
+			key.sample_crc[ii] = crc_32(buf, got);
+		}
+		return true;
+	}
+
+	// Gets all the elements of the template in document order
+	void get_template_elts(CXmlTree *ptree, std::vector<CXmlTree::CElt> &elts)
+	{
+		elts.clear();
+
+		MSXML2::IXMLDOMNodePtr pnode = ptree->GetRoot().m_pelt;
+		int depth = 0;                  // how far below the root pnode is
+		while (pnode != NULL)
+		{
+			bool is_elt = pnode->nodeType == MSXML2::NODE_ELEMENT;
+			if (is_elt)
+				elts.push_back(CXmlTree::CElt(pnode, ptree));
+
+			if (is_elt && pnode->firstChild != NULL)
+			{
+				pnode = pnode->firstChild;
+				++depth;
+				continue;
+			}
+
+			// Move to the next sibling or the next sibling of the closest ancestor that has one
+			while (depth > 0 && pnode->nextSibling == NULL)
+			{
+				pnode = pnode->parentNode;
+				--depth;
+			}
+			if (depth == 0)
+				break;
+			pnode = pnode->nextSibling;
+		}
+	}
+}
+
+// Returns the full path of the cache file for this document (or an empty string if the
+// document is not in the recent file list).  If create is true and the document does not
+// have a cache file yet a new (unused) name is chosen.
+CString CHexEditDoc::template_cache_name(bool create)
+{
+	CHexFileList *pfl = theApp.GetFileList();
+	int idx = pfl->GetIndex(pfile1_->GetFilePath());
+	CString dir;
+	if (idx == -1 || !::GetDataPath(dir))
+		return CString();
+	dir += DIRNAME_TEMPLATECACHE;
+
+	CString name = pfl->GetData(idx, CHexFileList::TEMPLATECACHE);
+	if (name.IsEmpty() && create)
+	{
+		MakeSureDirectoryPathExists(dir);
+
+		// Try different file names till we find a vacant slot
+		for (int jj = 1; jj < 1000000; ++jj)
+		{
+			CString tt;
+			tt.Format("HETC%04d.BIN", jj);
+			if (_access(dir + tt, 0) < 0 && errno == ENOENT)
+			{
+				name = tt;
+				pfl->SetData(idx, CHexFileList::TEMPLATECACHE, name);   // no need to save full path
+				break;
+			}
+		}
+	}
+
+	if (name.IsEmpty())
+		return CString();
+	return dir + name;
+}
+
+// Returns true if the template tree for the current file and template can be cached
+bool CHexEditDoc::can_cache_template()
+{
+	return pfile1_ != NULL && !IsDevice() && !IsModified() &&
+		   ptree_ != NULL && !ptree_->Error() && !ptree_->IsModified() && !DffdEditMode();
+}
+
+// Saves the tree built by ScanFile (or the bg template scan) to the cache file, but only if
+// the scan was slow enough that it is worth avoiding next time the file is opened.
+void CHexEditDoc::save_template_cache(bool extra)
+{
+	if (!df_mess_.IsEmpty() || df_address_.empty() || !can_cache_template())
+		return;
+	if (clock() - df_scan_start_ < CLOCKS_PER_SEC)
+		return;                         // scan was quick anyway
+
+	template_cache_file tc;
+	if (!get_cache_key(this, tc.key))
+		return;
+
+	CString filename = template_cache_name(true);
+	if (filename.IsEmpty())
+		return;
+
+	// Work out the number of the template element of each tree element
+	std::vector<CXmlTree::CElt> elts;
+	get_template_elts(ptree_, elts);
+	std::map<MSXML2::IXMLDOMElementPtr::Interface *, std::uint32_t> elt_num;
+	for (size_t jj = 0; jj < elts.size(); ++jj)
+		elt_num[(MSXML2::IXMLDOMElementPtr::Interface *)elts[jj].m_pelt] = std::uint32_t(jj);
+
+	size_t num_elts = df_address_.size();
+	std::vector<std::uint32_t> elt(num_elts);
+	std::vector<std::uint64_t> info_end(num_elts);  // end of each elt's info string in info
+	std::vector<wchar_t> info;
+	for (size_t ii = 0; ii < num_elts; ++ii)
+	{
+		std::map<MSXML2::IXMLDOMElementPtr::Interface *, std::uint32_t>::const_iterator pe =
+			elt_num.find((MSXML2::IXMLDOMElementPtr::Interface *)df_elt_[ii].m_pelt);
+		if (pe == elt_num.end())
+		{
+			ASSERT(0);                  // all elts should be in the template
+			return;
+		}
+		elt[ii] = pe->second;
+
+		info.insert(info.end(), df_info_[ii].GetString(), df_info_[ii].GetString() + df_info_[ii].GetLength());
+		info_end[ii] = info.size();
+	}
+
+	std::vector<std::int64_t> layout;
+	for (range_set<FILE_ADDRESS>::range_t::const_iterator pr = df_layout_.range_.begin(); pr != df_layout_.range_.end(); ++pr)
+	{
+		layout.push_back(pr->sfirst);
+		layout.push_back(pr->slast);
+	}
+	std::vector<std::uint64_t> extra_elts(df_extra_.begin(), df_extra_.end());
+	std::vector<std::uint64_t> dep_elt(df_dep_elt_list_.begin(), df_dep_elt_list_.end());
+
+	tc.extra = extra ? 1 : 0;
+	tc.max_indent = max_indent_;
+	tc.num_elts = num_elts;
+	tc.num_info = info.size();
+	tc.num_layout = layout.size()/2;
+	tc.num_dep = df_dep_address_.size();
+	tc.address = df_address_.data();
+	tc.size = df_size_.data();
+	tc.extra_elt = extra_elts.data();
+	tc.elt = elt.data();
+	tc.info_end = info_end.data();
+	tc.type = df_type_.data();
+	tc.indent = df_indent_.data();
+	tc.info = info.data();
+	tc.layout = layout.data();
+	tc.dep_address = df_dep_address_.data();
+	tc.dep_size = df_dep_size_.data();
+	tc.dep_elt = dep_elt.data();
+
+	try
+	{
+		CFile ff(filename, CFile::modeCreate | CFile::modeWrite | CFile::shareExclusive | CFile::typeBinary);
+		tc.write([&ff](const void *buf, size_t len)
+		{
+			const char *pc = static_cast<const char *>(buf);
+			for (size_t done = 0; done < len; )
+			{
+				UINT towrite = UINT(std::min<size_t>(len - done, 1 << 30));
+				ff.Write(pc + done, towrite);
+				done += towrite;
+			}
+		});
+		ff.Close();
+	}
+	catch (CFileException *pfe)
+	{
+		TRACE("Error writing template cache: %s\n", (LPCTSTR)::FileErrorMessage(pfe, CFile::modeWrite));
+		pfe->Delete();
+		::DeleteFile(filename);         // don't leave a partial file
+	}
+}
+
+// Restores the template tree from the cache file if it is still valid, which avoids
+// scanning the file.  Returns false (and the file needs to be scanned) if not.
+bool CHexEditDoc::load_template_cache()
+{
+	if (!can_cache_template())
+		return false;
+
+	CString filename = template_cache_name(false);
+	if (filename.IsEmpty())
+		return false;
+
+	HANDLE hf = ::CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hf == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool retval = false;
+	LARGE_INTEGER file_len;
+	HANDLE hmap = NULL;
+	const unsigned char *base = NULL;
+	if (::GetFileSizeEx(hf, &file_len) && file_len.QuadPart > 0 &&
+		std::uint64_t(file_len.QuadPart) <= std::uint64_t(SIZE_MAX) &&
+		(hmap = ::CreateFileMapping(hf, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL &&
+		(base = (const unsigned char *)::MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0)) != NULL)
+	{
+		CWaitCursor wait;
+		bool extra;
+		retval = restore_template_cache(base, size_t(file_len.QuadPart), extra);
+		if (retval)
+		{
+			df_init_ = TRUE;
+			update_needed_ = false;
+			report_scan(extra);
+		}
+	}
+
+	if (base != NULL)
+		::UnmapViewOfFile(base);
+	if (hmap != NULL)
+		::CloseHandle(hmap);
+	::CloseHandle(hf);
+	return retval;
+}
+
+// Does the work of load_template_cache once the cache file has been mapped
+bool CHexEditDoc::restore_template_cache(const unsigned char *base, size_t file_len, bool &extra)
+{
+	template_cache_file::key_t key;
+	if (!get_cache_key(this, key))
+		return false;
+
+	std::vector<CXmlTree::CElt> elts;
+	get_template_elts(ptree_, elts);
+
+	// This checks that the file is for the current file and template and is not corrupt
+	template_cache_file tc;
+	if (!tc.read(base, file_len, key, elts.size()))
+		return false;
+
+	clear_tree();
+	df_mess_.Empty();
+	size_t nn = size_t(tc.num_elts);
+	df_address_.assign(tc.address, tc.address + nn);
+	df_size_.assign(tc.size, tc.size + nn);
+	df_extra_.assign(tc.extra_elt, tc.extra_elt + nn);
+	df_type_.assign(tc.type, tc.type + nn);
+	df_indent_.assign(tc.indent, tc.indent + nn);
+	max_indent_ = (unsigned char)tc.max_indent;
+
+	df_elt_.reserve(nn);
+	df_info_.reserve(nn);
+	std::uint64_t info_start = 0;
+	for (size_t ii = 0; ii < nn; ++ii)
+	{
+		df_elt_.push_back(elts[tc.elt[ii]]);
+		if (tc.info_end[ii] > info_start)
+			df_info_.push_back(ExprStringType(tc.info + info_start, int(tc.info_end[ii] - info_start)));
+		else
+			df_info_.push_back(ExprStringType());
+		info_start = tc.info_end[ii];
+	}
+
+	for (std::uint64_t jj = 0; jj < tc.num_layout; ++jj)
+		df_layout_.insert_range(df_layout_.end(), tc.layout[jj*2], tc.layout[jj*2 + 1]);
+	size_t num_dep = size_t(tc.num_dep);
+	df_dep_address_.assign(tc.dep_address, tc.dep_address + num_dep);
+	df_dep_size_.assign(tc.dep_size, tc.dep_size + num_dep);
+	df_dep_elt_list_.assign(tc.dep_elt, tc.dep_elt + num_dep);
+
+	// Rebuild the enums used by integer data elements (checking each template element once)
+	std::set<MSXML2::IXMLDOMElementPtr::Interface *> done;
+	for (size_t ii = 0; ii < nn; ++ii)
+	{
+		int df_type = abs(df_type_[ii]);
+		if (df_type >= DF_CHAR && df_type < DF_LAST_INT &&
+			done.insert((MSXML2::IXMLDOMElementPtr::Interface *)df_elt_[ii].m_pelt).second)
+		{
+			CString strDomain = df_elt_[ii].GetAttr("domain");
+			if (!strDomain.IsEmpty() && strDomain[0] == '{')
+				(void)add_enum(df_elt_[ii], strDomain);
+		}
+	}
+
+	build_index();
+	extra = tc.extra != 0;
+	return true;
+}
@@ -0,0 +1,199 @@
+// TemplateCacheFile.cpp : implementation of the template_cache_file class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <cstring>
+
+#include "TemplateCacheFile.h"
+#include "Misc.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+namespace
+{
+	const char cache_magic[8] = { 'H', 'E', 'T', 'C', '0', '0', '0', '2' };
+
+	// The start of the cache file.  It is followed by the arrays of the tree (in the order
+	// given by get_sections) each padded with zeroes to a multiple of 8 bytes.
+	struct cache_header
+	{
+		char magic[8];
+		template_cache_file::key_t key;
+		std::uint32_t extra;
+		std::uint32_t max_indent;
+		std::uint64_t num_elts;
+		std::uint64_t num_info;
+		std::uint64_t num_layout;
+		std::uint64_t num_dep;
+		std::uint32_t crc;              // CRC of the header (with crc zero) and the rest of the file
+		std::uint32_t unused;
+	};
+
+	enum { NUM_SECTIONS = 12 };
+
+	std::uint64_t pad8(std::uint64_t len) { return (len + 7) & ~std::uint64_t(7); }
+
+	// Gets the length of count elements of elt_size bytes - returns false on overflow
+	bool mul(std::uint64_t count, std::uint64_t elt_size, std::uint64_t &len)
+	{
+		if (count > UINT64_MAX / elt_size)
+			return false;
+		len = count * elt_size;
+		return true;
+	}
+
+	// Gets the length in bytes of each array of the tree.  Returns false if the counts
+	// are too big (as they may be if the file is corrupt).
+	bool get_sections(const cache_header &hdr, std::uint64_t (&len)[NUM_SECTIONS])
+	{
+		return mul(hdr.num_elts, sizeof(std::int64_t), len[0]) &&      // address
+			   mul(hdr.num_elts, sizeof(std::int64_t), len[1]) &&      // size
+			   mul(hdr.num_elts, sizeof(std::uint64_t), len[2]) &&     // extra_elt
+			   mul(hdr.num_elts, sizeof(std::uint32_t), len[3]) &&     // elt
+			   mul(hdr.num_elts, sizeof(std::uint64_t), len[4]) &&     // info_end
+			   mul(hdr.num_elts, sizeof(signed char), len[5]) &&       // type
+			   mul(hdr.num_elts, sizeof(unsigned char), len[6]) &&     // indent
+			   mul(hdr.num_info, sizeof(wchar_t), len[7]) &&           // info
+			   hdr.num_layout <= UINT64_MAX/2 &&
+			   mul(hdr.num_layout*2, sizeof(std::int64_t), len[8]) &&  // layout
+			   mul(hdr.num_dep, sizeof(std::int64_t), len[9]) &&       // dep_address
+			   mul(hdr.num_dep, sizeof(std::int64_t), len[10]) &&      // dep_size
+			   mul(hdr.num_dep, sizeof(std::uint64_t), len[11]);       // dep_elt
+	}
+}
+
+template_cache_file::template_cache_file()
+	: extra(0), max_indent(0), num_elts(0), num_info(0), num_layout(0), num_dep(0),
+	  address(NULL), size(NULL), extra_elt(NULL), elt(NULL), info_end(NULL), type(NULL), indent(NULL),
+	  info(NULL), layout(NULL), dep_address(NULL), dep_size(NULL), dep_elt(NULL)
+{
+	memset(&key, 0, sizeof(key));
+}
+
+void template_cache_file::write(const writer_t &out) const
+{
+	cache_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, cache_magic, sizeof(hdr.magic));
+	hdr.key = key;
+	hdr.extra = extra;
+	hdr.max_indent = max_indent;
+	hdr.num_elts = num_elts;
+	hdr.num_info = num_info;
+	hdr.num_layout = num_layout;
+	hdr.num_dep = num_dep;
+
+	const void *data[NUM_SECTIONS] =
+	{
+		address, size, extra_elt, elt, info_end, type, indent, info, layout, dep_address, dep_size, dep_elt
+	};
+	std::uint64_t len[NUM_SECTIONS];
+	VERIFY(get_sections(hdr, len));
+
+	// The CRC includes the padding so that every byte of the file is checked
+	static const char zeroes[8] = { 0 };
+	ASSERT(sizeof(hdr)%8 == 0);
+	void *hcrc = crc_32_init();
+	crc_32_update(hcrc, &hdr, sizeof(hdr));
+	for (int ii = 0; ii < NUM_SECTIONS; ++ii)
+	{
+		if (len[ii] > 0)
+			crc_32_update(hcrc, data[ii], size_t(len[ii]));
+		if (len[ii]%8 != 0)
+			crc_32_update(hcrc, zeroes, size_t(8 - len[ii]%8));
+	}
+	hdr.crc = std::uint32_t(crc_32_final(hcrc));
+
+	out(&hdr, sizeof(hdr));
+	for (int ii = 0; ii < NUM_SECTIONS; ++ii)
+	{
+		if (len[ii] > 0)
+			out(data[ii], size_t(len[ii]));
+		if (len[ii]%8 != 0)
+			out(zeroes, size_t(8 - len[ii]%8));
+	}
+}
+
+bool template_cache_file::read(const unsigned char *base, std::size_t file_len, const key_t &expected, std::size_t num_template_elts)
+{
+	cache_header hdr;
+	if (file_len < sizeof(hdr))
+		return false;
+	memcpy(&hdr, base, sizeof(hdr));
+	if (memcmp(hdr.magic, cache_magic, sizeof(hdr.magic)) != 0)
+		return false;
+	if (memcmp(&hdr.key, &expected, sizeof(expected)) != 0)
+		return false;                   // file or template has changed
+
+	// Find the arrays, checking that they are all inside the file
+	std::uint64_t len[NUM_SECTIONS];
+	if (!get_sections(hdr, len))
+		return false;
+	const unsigned char *data[NUM_SECTIONS];
+	std::uint64_t pos = sizeof(hdr);
+	for (int ii = 0; ii < NUM_SECTIONS; ++ii)
+	{
+		if (len[ii] > file_len - pos)
+			return false;               // truncated
+		data[ii] = base + size_t(pos);
+		pos += pad8(len[ii]);
+		if (pos > file_len)
+			return false;
+	}
+
+	// Check the CRC (now that we know that all the lengths are OK)
+	std::uint32_t crc = hdr.crc;
+	hdr.crc = 0;
+	void *hcrc = crc_32_init();
+	crc_32_update(hcrc, &hdr, sizeof(hdr));
+	crc_32_update(hcrc, base + sizeof(hdr), size_t(pos - sizeof(hdr)));
+	if (std::uint32_t(crc_32_final(hcrc)) != crc)
+		return false;
+
+	key = hdr.key;
+	extra = hdr.extra;
+	max_indent = hdr.max_indent;
+	num_elts = hdr.num_elts;
+	num_info = hdr.num_info;
+	num_layout = hdr.num_layout;
+	num_dep = hdr.num_dep;
+	address     = (const std::int64_t *)data[0];
+	size        = (const std::int64_t *)data[1];
+	extra_elt   = (const std::uint64_t *)data[2];
+	elt         = (const std::uint32_t *)data[3];
+	info_end    = (const std::uint64_t *)data[4];
+	type        = (const signed char *)data[5];
+	indent      = (const unsigned char *)data[6];
+	info        = (const wchar_t *)data[7];
+	layout      = (const std::int64_t *)data[8];
+	dep_address = (const std::int64_t *)data[9];
+	dep_size    = (const std::int64_t *)data[10];
+	dep_elt     = (const std::uint64_t *)data[11];
+
+	// Check that all indices are in range
+	if (num_elts == 0)
+		return false;
+	std::uint64_t info_start = 0;
+	for (std::uint64_t ii = 0; ii < num_elts; ++ii)
+	{
+		if (elt[ii] >= num_template_elts || info_end[ii] < info_start || info_end[ii] > num_info)
+			return false;
+		info_start = info_end[ii];
+	}
+	for (std::uint64_t jj = 0; jj < num_dep; ++jj)
+		if (dep_elt[jj] >= num_elts)
+			return false;
+
+	return true;
+}
@@ -0,0 +1,68 @@
+// TemplateCacheFile.h : format of the files used to save template trees between sessions
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// A template tree saved in a template cache file (see TemplateCache.cpp).  This just
+// describes the tree as pointers to arrays parallel to the tree vectors of the document
+// (df_address_ etc), which point to the document's vectors when writing the file and
+// into the (memory mapped) file after reading it.  Since a cache file could have been
+// truncated or corrupted read() checks the whole file before anything is used.
+struct template_cache_file
+{
+	enum { NUM_SAMPLES = 64, SAMPLE_LEN = 4096 };
+
+	// Identifies the version of the data file and the template that a cache file is for
+	struct key_t
+	{
+		std::int64_t length;
+		std::int64_t mtime;
+		std::uint32_t template_crc;
+		std::uint32_t sample_crc[NUM_SAMPLES];
+	};
+
+	typedef std::function<void(const void *buf, std::size_t len)> writer_t;
+
+	template_cache_file();
+
+	// Writes the whole file using out, which should throw on error
+	void write(const writer_t &out) const;
+
+	// Sets up the pointers into a cache file of file_len bytes at base.  Returns false if
+	// the file is not for key or is truncated or invalid.  num_template_elts is the number
+	// of elements in the template so that the template element numbers can be checked.
+	bool read(const unsigned char *base, std::size_t file_len, const key_t &key, std::size_t num_template_elts);
+
+	key_t key;
+	std::uint32_t extra;                // data past expected EOF (see report_scan)
+	std::uint32_t max_indent;
+	std::uint64_t num_elts;             // number of elements in the tree (df_address_ etc)
+	std::uint64_t num_info;             // total characters in all df_info_ strings
+	std::uint64_t num_layout;           // number of segments in df_layout_
+	std::uint64_t num_dep;              // number of entries in df_dep_address_ etc
+
+	const std::int64_t *address;        // [num_elts]
+	const std::int64_t *size;           // [num_elts]
+	const std::uint64_t *extra_elt;     // [num_elts] df_extra_
+	const std::uint32_t *elt;           // [num_elts] template element number (see get_template_elts)
+	const std::uint64_t *info_end;      // [num_elts] end of each element's df_info_ string in info
+	const signed char *type;            // [num_elts]
+	const unsigned char *indent;        // [num_elts]
+	const wchar_t *info;                // [num_info] all df_info_ strings one after the other
+	const std::int64_t *layout;         // [num_layout*2] first and last of each segment
+	const std::int64_t *dep_address;    // [num_dep]
+	const std::int64_t *dep_size;       // [num_dep]
+	const std::uint64_t *dep_elt;       // [num_dep] df_dep_elt_list_
+};
@@ -0,0 +1,405 @@
+// TemplateExport.cpp : export of template arrays as tables (part of CHexEditDoc)
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+#include "HexEdit.h"
+#include "HexEditDoc.h"
+#include "MainFrm.h"
+#include "Serialization/TableExporter.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+// An array in a template (eg the records of a database file) can be exported as a table
+// where each element of the array is a row and each data element within it is a column.
+// Columns are named using the path of the data element relative to the array element
+// (eg "header.flags" or "points[2].x").
+//
+// Arrays of fixed size elements (DF_FORF) can have millions of elements but only the first
+// theApp.max_fix_for_elts_ are in the tree - the rest are represented by one DF_MORE entry.
+// These are exported by reading the file in large blocks and getting the values using the
+// tree entries of the first element offset to the address of each of the other elements.
+// Formatting the values is the slow part, so blocks are read and formatted by worker threads
+// (see export_more) while the calling thread writes the rows of each block in order.
+//
+// The caller still waits for the export to finish (with a wait cursor and progress) as the
+// tree (df_address_ etc) must not change until it is done, and the export can only be done
+// when the template scan has finished as the array may not be complete until then.
+
+// Exports the array at df_*[ii] (which must be a DF_FORF or DF_FORV) using the exporter.
+// Returns false if the array could not be exported or there was an error writing the table.
+bool CHexEditDoc::ExportTemplateTable(size_t ii, hex::TableExporter &exporter)
+{
+	ASSERT(!df_scanning_);
+	if (ii >= df_type_.size() || (df_type_[ii] != DF_FORF && df_type_[ii] != DF_FORV) || df_address_[ii] == -1)
+		return false;
+
+	const int ind = df_indent_[ii];
+	size_t end = ii + 1;
+	while (end < df_indent_.size() && df_indent_[end] > ind)
+		++end;
+
+	// Find the array elements (rows) and any DF_MORE entry (for elements not in the tree)
+	std::vector<size_t> rows;
+	size_t more = 0;
+	for (size_t jj = ii + 1; jj < end; ++jj)
+	{
+		if (df_indent_[jj] != ind + 1)
+			continue;
+		if (df_type_[jj] == DF_MORE)
+			more = jj;
+		else
+			rows.push_back(jj);
+	}
+	size_t num_rows = rows.size();
+	rows.push_back(more != 0 ? more : end);        // end of the last row
+
+	// Attributes are slow to get from the XML so cache them for each XML element
+	typedef std::map<MSXML2::IXMLDOMElementPtr::Interface *, CString> attr_cache_t;
+	attr_cache_t name_cache, display_cache;
+	auto get_attr = [&](attr_cache_t &cache, size_t jj, const char *attr) -> const CString &
+	{
+		MSXML2::IXMLDOMElementPtr::Interface *pelt = (MSXML2::IXMLDOMElementPtr::Interface *)df_elt_[jj].m_pelt;
+		attr_cache_t::iterator pa = cache.find(pelt);
+		if (pa == cache.end())
+			pa = cache.insert(std::make_pair(pelt, df_elt_[jj].GetAttr(attr))).first;
+		return pa->second;
+	};
+
+	auto col_type = [](int df_type) -> hex::ColumnType
+	{
+		if (df_type >= DF_INT8 && df_type < DF_LAST_INT)
+			return hex::ColumnType::Integer;
+		else if (df_type >= DF_REAL32 && df_type < DF_LAST_NUM)
+			return hex::ColumnType::Real;
+		else
+			return hex::ColumnType::Text;   // chars, strings and dates
+	};
+
+	// Work out the columns from the data elements of every row.  A row can have different
+	// elements to others (eg due to an "if" or "switch") so the table has the union of them.
+	std::vector<hex::Column> columns;
+	std::map<CString, size_t> col_index;
+	std::vector<std::pair<size_t, size_t> > leaf_col;  // elt and column of all data elts
+	std::vector<size_t> row_leaf;                       // start of each row in leaf_col
+	std::vector<CString> path;                          // path of the current elt at each level
+	std::vector<signed char> path_type;                 // type of the current elt at each level
+	std::vector<int> child_num;                         // children seen (so far) at each level
+
+	for (size_t rr = 0; rr < num_rows; ++rr)
+	{
+		row_leaf.push_back(leaf_col.size());
+		for (size_t jj = rows[rr]; jj < rows[rr + 1]; ++jj)
+		{
+			if (df_type_[jj] == DF_DEFINE_STRUCT)
+			{
+				// Skip struct definitions as they contain no data
+				while (jj + 1 < rows[rr + 1] && df_indent_[jj + 1] > df_indent_[jj])
+					++jj;
+				continue;
+			}
+
+			int level = df_indent_[jj] - (ind + 1);
+			path.resize(level + 1);
+			path_type.resize(level + 1);
+			child_num.resize(level + 1);
+			path_type[level] = df_type_[jj];
+			child_num[level] = 0;
+
+			if (level == 0)
+				path[0] = get_attr(name_cache, jj, "name");
+			else
+			{
+				CString comp;
+				if (path_type[level - 1] == DF_FORF || path_type[level - 1] == DF_FORV)
+					comp.Format("[%d]", child_num[level - 1]++);
+				else if (df_type_[jj] != DF_IF && df_type_[jj] != DF_SWITCH && df_type_[jj] != DF_JUMP)
+					comp = get_attr(name_cache, jj, "name");
+
+				if (comp.IsEmpty())
+					path[level] = path[level - 1];
+				else if (path[level - 1].IsEmpty() || comp[0] == '[')
+					path[level] = path[level - 1] + comp;
+				else
+					path[level] = path[level - 1] + "." + comp;
+			}
+
+			// Add data elements (but not BLOBs or fill) as columns
+			if (abs(df_type_[jj]) > DF_NO_TYPE)
+			{
+				CString name = path[level].IsEmpty() ? CString("value") : path[level];
+				hex::ColumnType type = col_type(abs(df_type_[jj]));
+
+				std::map<CString, size_t>::const_iterator pc = col_index.find(name);
+				if (pc == col_index.end())
+				{
+					pc = col_index.insert(std::make_pair(name, columns.size())).first;
+					columns.push_back(hex::Column{ name, type });
+				}
+				else if (columns[pc->second].type != type)
+					columns[pc->second].type = hex::ColumnType::Text;     // mixed types so just use the text
+				leaf_col.push_back(std::make_pair(jj, pc->second));
+			}
+		}
+	}
+	row_leaf.push_back(leaf_col.size());
+
+	if (columns.empty())
+		return false;
+
+	// Check if we can export the elements that are not in the tree.  We can't if the values
+	// of the 1st element are not at the same relative address in the others.
+	FILE_ADDRESS elt_size = 0;
+	if (more != 0 && num_rows > 0 && df_extra_[more] > 0 && df_address_[rows[0]] != -1)
+	{
+		elt_size = df_size_[more] / FILE_ADDRESS(df_extra_[more]);
+		for (size_t jj = rows[0]; jj < rows[1]; ++jj)
+		{
+			int df_type = abs(df_type_[jj]);
+			if (df_type == DF_JUMP || df_type == DF_FORV || (df_type >= DF_BITFIELD8 && df_type <= DF_BITFIELD64))
+				elt_size = 0;
+		}
+	}
+	FILE_ADDRESS total_rows = FILE_ADDRESS(num_rows) + (elt_size > 0 ? FILE_ADDRESS(df_extra_[more]) : 0);
+
+	// Get the "display" attribute of every data element now so that the worker threads
+	// (see export_more) don't need the cache
+	std::vector<CString> leaf_display(leaf_col.size());
+	for (size_t ll = 0; ll < leaf_col.size(); ++ll)
+		leaf_display[ll] = get_attr(display_cache, leaf_col[ll].first, "display");
+
+	CHexExpr ee(this);
+	std::vector<hex::Cell> cells(columns.size());
+	CMainFrame *mm = (CMainFrame *)AfxGetMainWnd();
+	clock_t last_checked = clock();
+
+	// Gets the cells of one row using the data elements in leaf_col[first] to leaf_col[last - 1]
+	auto get_row = [this, &leaf_col, &leaf_display](CHexExpr &ee, size_t first, size_t last, std::vector<hex::Cell> &cells)
+	{
+		for (size_t col = 0; col < cells.size(); ++col)
+			cells[col].isNull = true;
+
+		for (size_t ll = first; ll < last; ++ll)
+		{
+			size_t jj = leaf_col[ll].first;
+			hex::Cell &cell = cells[leaf_col[ll].second];
+
+			__int64 sym_size, sym_address;
+			CHexExpr::value_t val = ee.get_value(int(jj), sym_size, sym_address);
+			if (val.typ == CHexExpr::TYPE_NONE || val.error)
+				continue;                   // leave as null
+
+			cell.isNull = false;
+			cell.intValue = val.typ == CHexExpr::TYPE_INT ? val.int64 : 0;
+			cell.realValue = val.typ == CHexExpr::TYPE_REAL ? val.real64 : 0.0;
+
+			const CString &strFormat = leaf_display[ll];
+			int df_type = abs(df_type_[jj]);
+			bool unsgned = (df_type >= DF_UINT8 && df_type <= DF_UINT64) || (df_type >= DF_BITFIELD8 && df_type <= DF_BITFIELD64);
+			ExprStringType ss = strFormat.IsEmpty() ? get_str(val, int(jj)) : val.GetDataString(strFormat, int(sym_size), unsgned);
+			cell.text = CW2A(ss, CP_UTF8);
+		}
+	};
+
+	auto update_progress = [&](FILE_ADDRESS row)
+	{
+		// Update progress no more than once every 5 seconds
+		if ((clock() - last_checked)/CLOCKS_PER_SEC > 5)
+		{
+			mm->Progress(int((row*100)/total_rows));
+			last_checked = clock();
+		}
+	};
+
+	exporter.WriteHeader(columns);
+
+	// Export the elements in the tree
+	for (size_t rr = 0; rr < num_rows && exporter.Error().IsEmpty(); ++rr)
+	{
+		get_row(ee, row_leaf[rr], row_leaf[rr + 1], cells);
+		exporter.WriteRow(cells);
+		update_progress(FILE_ADDRESS(rr));
+	}
+
+	// Export the rest of the elements
+	if (elt_size > 0 && exporter.Error().IsEmpty())
+	{
+		export_more(exporter, df_address_[more], elt_size, df_extra_[more], df_address_[rows[0]],
+					[&](CHexExpr &ee, std::vector<hex::Cell> &cells) { get_row(ee, row_leaf[0], row_leaf[1], cells); },
+					columns.size(), [&](size_t done) { update_progress(FILE_ADDRESS(num_rows + done)); });
+	}
+
+	exporter.WriteEpilogue();
+	mm->Progress(-1);
+
+	return exporter.Error().IsEmpty();
+}
+
+// Exports count array elements (of elt_size bytes each, starting at addr) that are not in the
+// tree.  Blocks of elements (up to 4096 or 1 MByte) are read and get_row is called to get
+// the cells of each element using a CHexExpr whose source is offset from first_addr (the
+// address of the first element which is in the tree) to the element.
+//
+// This is done by worker threads, each with its own CHexExpr and, if the file has not been
+// modified, its own file handle (else reads go through GetData which does one at a time).
+// This thread writes the rows of each block in order as soon as it is finished.  Workers
+// don't get more than a few blocks ahead of the writing so memory use is limited.  If a
+// worker fails (eg a read error on its file) this thread does the block it was doing.
+void CHexEditDoc::export_more(hex::TableExporter &exporter, FILE_ADDRESS addr, FILE_ADDRESS elt_size, size_t count,
+							  FILE_ADDRESS first_addr, std::function<void(CHexExpr &, std::vector<hex::Cell> &)> get_row,
+							  size_t num_cols, std::function<void(size_t)> progress)
+{
+	typedef std::vector<std::vector<hex::Cell> > rows_t;
+	const size_t block_rows = size_t(std::max<FILE_ADDRESS>(1, std::min<FILE_ADDRESS>(4096, (1024*1024) / elt_size)));
+	const size_t num_blocks = (count + block_rows - 1) / block_rows;
+	const int threads = int(std::min<size_t>(std::min<unsigned>(std::max<unsigned>(std::thread::hardware_concurrency(), 1), 8), num_blocks));
+	const size_t ahead = size_t(threads) * 2;     // max blocks that are formatted but not yet written
+
+	bool unmodified;
+	{
+		CSingleLock sl(&docdata_, TRUE); // Protect shared data access
+		unmodified = loc_.size() == 1 && (loc_.front().dlen >> 62) == 1 && loc_.front().fileaddr == 0;
+	}
+	CString file_name = pfile1_ != NULL ? pfile1_->GetFilePath() : CString();
+	bool device = IsDevice() != FALSE;
+
+	// Reads a block (using pfile if not NULL else GetData) and gets the cells of its rows
+	auto do_block = [&](CHexExpr &ee, CFile64 *pfile, std::vector<unsigned char> &buf, size_t blk) -> std::unique_ptr<rows_t>
+	{
+		size_t first = blk * block_rows, nn = std::min(block_rows, count - first);
+		FILE_ADDRESS blk_addr = addr + FILE_ADDRESS(first)*elt_size;
+		size_t got;
+		if (pfile != NULL)
+		{
+			pfile->Seek(blk_addr, CFile::begin);
+			got = pfile->Read(&buf[0], UINT(nn*elt_size));
+		}
+		else
+			got = GetData(&buf[0], size_t(nn*elt_size), blk_addr);
+
+		std::unique_ptr<rows_t> rows(new rows_t(nn, std::vector<hex::Cell>(num_cols)));
+		for (size_t kk = 0; kk < nn; ++kk)
+		{
+			ee.SetSource(blk_addr + FILE_ADDRESS(kk)*elt_size - first_addr, &buf[0], blk_addr, got);
+			get_row(ee, (*rows)[kk]);
+		}
+		ee.SetSource(0);
+		return rows;
+	};
+
+	std::mutex mutex;                   // protects the following
+	std::condition_variable cv;
+	size_t next_block = 0;              // next block for a worker to do
+	size_t written = 0;                 // blocks written so far
+	int active = threads;               // workers that have not finished
+	bool stop = false;                  // error writing so workers should stop
+	std::vector<std::unique_ptr<rows_t> > done(num_blocks);  // rows of finished blocks not yet written
+	std::vector<char> lost(num_blocks); // blocks that a worker failed to do
+
+	auto worker = [&]()
+	{
+		size_t blk = size_t(-1);
+		std::unique_ptr<CFile64> pfile;
+		try
+		{
+			// Open our own copy of the file if possible
+			if (unmodified && !file_name.IsEmpty())
+			{
+				pfile.reset(device ? new CFileNC() : new CFile64());
+				if (!pfile->Open(file_name, CFile::modeRead|CFile::shareDenyNone|CFile::typeBinary))
+					pfile.reset();
+			}
+
+			CHexExpr ee(this);
+			std::vector<unsigned char> buf(size_t(block_rows * elt_size));
+			for (;;)
+			{
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					cv.wait(lock, [&]() { return stop || next_block >= num_blocks || next_block < written + ahead; });
+					if (stop || next_block >= num_blocks)
+						break;
+					blk = next_block++;
+				}
+
+				std::unique_ptr<rows_t> rows = do_block(ee, pfile.get(), buf, blk);
+
+				std::lock_guard<std::mutex> lock(mutex);
+				done[blk] = std::move(rows);
+				blk = size_t(-1);
+				cv.notify_all();
+			}
+		}
+		catch (CException *pe)
+		{
+			pe->Delete();
+			std::lock_guard<std::mutex> lock(mutex);
+			if (blk != size_t(-1))
+				lost[blk] = 1;
+		}
+		if (pfile)
+			pfile->Abort();             // close without throwing
+
+		std::lock_guard<std::mutex> lock(mutex);
+		--active;
+		cv.notify_all();
+	};
+
+	std::vector<std::thread> workers;
+	for (int ii = 0; ii < threads; ++ii)
+		workers.push_back(std::thread(worker));
+
+	// Write the blocks in order as they are finished
+	CHexExpr ee(this);
+	std::vector<unsigned char> buf;
+	for (size_t blk = 0; blk < num_blocks && exporter.Error().IsEmpty(); ++blk)
+	{
+		std::unique_ptr<rows_t> rows;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [&]() { return done[blk] || lost[blk] || (active == 0 && blk >= next_block); });
+			rows = std::move(done[blk]);
+		}
+		if (!rows)
+		{
+			// The worker doing this block failed (or all workers have) so do it here
+			buf.resize(size_t(block_rows * elt_size));
+			rows = do_block(ee, NULL, buf, blk);
+		}
+
+		for (size_t kk = 0; kk < rows->size() && exporter.Error().IsEmpty(); ++kk)
+			exporter.WriteRow((*rows)[kk]);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++written;
+			if (blk >= next_block)
+				next_block = blk + 1;   // in case we did it
+			cv.notify_all();
+		}
+		progress(blk * block_rows);
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+		cv.notify_all();
+	}
+	for (std::thread &tt : workers)
+		tt.join();
+}
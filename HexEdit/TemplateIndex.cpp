@@ -0,0 +1,151 @@
+// TemplateIndex.cpp : implementation of the template_index class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+
+#include "TemplateIndex.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+void template_index::clear()
+{
+	pending_.clear();
+	start_.clear();
+	size_.clear();
+	elt_.clear();
+	colour_.clear();
+	big_size_.clear();
+	max_end_.clear();
+	max_level_ = -1;
+}
+
+// Adds an element's extent.  The index can't be searched until build() is called.
+void template_index::add(std::int64_t address, std::int64_t size, std::size_t elt, std::uint32_t colour /*= no_colour*/)
+{
+	ASSERT(address >= 0 && size >= 0 && elt < big_size);
+	entry ent = { address, size, std::uint32_t(elt), colour };
+	pending_.push_back(ent);
+}
+
+// Adds the entries of another (built) index, eg to merge the parts of the index of the
+// elements published during a background scan (see CHexEditDoc::publish_index).
+void template_index::add(const template_index &other)
+{
+	ASSERT(other.pending_.empty());
+	pending_.reserve(pending_.size() + other.size());
+	for (std::size_t pos = 0; pos < other.size(); ++pos)
+	{
+		entry ent = { other.start_[pos], other.end(pos) - other.start_[pos], other.elt_[pos], other.colour_[pos] };
+		pending_.push_back(ent);
+	}
+}
+
+// Sorts the added entries on address and stores them in the columns.
+void template_index::build()
+{
+	// Template elements are nearly always generated in address order so this is fast
+	if (!std::is_sorted(pending_.begin(), pending_.end()))
+		std::sort(pending_.begin(), pending_.end());
+
+	// Merge in any entries from a previous build (already sorted)
+	std::vector<entry> tmp;
+	tmp.reserve(pending_.size() + start_.size());
+	for (std::size_t pos = 0; pos < start_.size(); ++pos)
+	{
+		entry ent = { start_[pos], end(pos) - start_[pos], elt_[pos], colour_[pos] };
+		tmp.push_back(ent);
+	}
+	std::size_t old_size = tmp.size();
+	tmp.insert(tmp.end(), pending_.begin(), pending_.end());
+	std::inplace_merge(tmp.begin(), tmp.begin() + old_size, tmp.end());
+	clear();
+
+	start_.reserve(tmp.size());
+	size_.reserve(tmp.size());
+	elt_.reserve(tmp.size());
+	colour_.reserve(tmp.size());
+
+	for (std::size_t pos = 0; pos < tmp.size(); ++pos)
+	{
+		start_.push_back(tmp[pos].start);
+		if (tmp[pos].size < big_size)
+			size_.push_back(std::uint32_t(tmp[pos].size));
+		else
+		{
+			size_.push_back(big_size);
+			big_size_.push_back(std::make_pair(std::uint32_t(pos), tmp[pos].size));
+		}
+		elt_.push_back(tmp[pos].elt);
+		colour_.push_back(tmp[pos].colour);
+	}
+	build_tree();
+}
+
+// Fills in max_end_ for the implicit tree (see span_index::build).  Nodes at level k are at
+// positions with k trailing 1 bits and a node whose right child is missing (when the number
+// of entries is not 2^n - 1) uses the max_end_ of the last node at the same level.
+void template_index::build_tree()
+{
+	std::size_t nn = start_.size();
+	max_end_.resize(nn);
+	max_level_ = -1;
+	if (nn == 0)
+		return;
+
+	std::size_t pos, last_pos = 0;
+	std::int64_t last = 0;
+	for (pos = 0; pos < nn; pos += 2)
+		last_pos = pos, last = max_end_[pos] = end(pos);
+
+	int kk;
+	for (kk = 1; (std::size_t(1) << kk) <= nn; ++kk)
+	{
+		std::size_t xx = std::size_t(1) << (kk - 1), p0 = (xx << 1) - 1, step = xx << 2;
+		for (pos = p0; pos < nn; pos += step)
+		{
+			std::int64_t el = max_end_[pos - xx];                  // left child always exists
+			std::int64_t er = pos + xx < nn ? max_end_[pos + xx] : last;
+			max_end_[pos] = std::max(end(pos), std::max(el, er));
+		}
+		last_pos = (last_pos >> kk & 1) != 0 ? last_pos - xx : last_pos + xx;
+		if (last_pos < nn && max_end_[last_pos] > last)
+			last = max_end_[last_pos];
+	}
+	max_level_ = kk - 1;
+}
+
+// Returns the address one past the end of an entry
+std::int64_t template_index::end(std::size_t pos) const
+{
+	if (size_[pos] != big_size)
+		return start_[pos] + size_[pos];
+
+	std::vector<std::pair<std::uint32_t, std::int64_t> >::const_iterator pp =
+		std::lower_bound(big_size_.begin(), big_size_.end(), std::make_pair(std::uint32_t(pos), std::int64_t(-1)));
+	ASSERT(pp != big_size_.end() && pp->first == pos);
+	return start_[pos] + pp->second;
+}
+
+// Returns the lowest element number of the entries containing addr, or npos if none.
+std::size_t template_index::find(std::int64_t addr) const
+{
+	std::size_t retval = npos;
+	for_each_in(addr, addr + 1, [&](std::size_t pos)
+	{
+		if (retval == npos || elt_[pos] < retval)
+			retval = elt_[pos];
+	});
+	return retval;
+}
@@ -0,0 +1,111 @@
+// TemplateIndex.h : index of the file extents of template (data format) elements
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// A template can generate millions of data elements so searching them all for the ones
+// at an address (or overlapping the visible part of the file) is slow.  This index
+// stores the extent of each data element in separate arrays (columns) sorted on address.
+// Elements can overlap (eg, when a JUMP goes backwards or a STRUCT contains its fields) so the
+// columns are also an implicit binary tree, as in span_index (see SpanIndex.h): the entry at
+// pos is a node at the level given by the number of trailing 1 bits of pos and max_end_[pos]
+// is the largest end address of its subtree.  So finding the k entries that overlap an
+// address range is O(log n + k) however large the elements before it are.
+class template_index
+{
+public:
+	static constexpr std::size_t npos = std::size_t(-1);
+	static constexpr std::uint32_t no_colour = 0xFFFFFFFF;  // element has no colour
+
+	// Construction
+	void clear();
+	void add(std::int64_t address, std::int64_t size, std::size_t elt, std::uint32_t colour = no_colour);
+	void add(const template_index &other);                  // add all the entries of another index
+	void build();                                           // call after adding, before searching
+
+	// Attributes
+	std::size_t size() const { return start_.size(); }
+	bool empty() const { return start_.empty(); }
+	std::int64_t address(std::size_t pos) const { return start_[pos]; }
+	std::int64_t end(std::size_t pos) const;
+	std::size_t elt(std::size_t pos) const { return elt_[pos]; }
+	std::uint32_t colour(std::size_t pos) const { return colour_[pos]; }
+
+	// Operations
+	std::size_t find(std::int64_t addr) const;              // lowest element number containing addr
+
+	// Calls ff(pos) for every entry (in address order) that overlaps [ss, ee).  The tree is
+	// walked in order skipping subtrees that all end by ss or all start at or after ee.
+	template <class F> void for_each_in(std::int64_t ss, std::int64_t ee, F ff) const
+	{
+		ASSERT(pending_.empty());     // build() not called
+		std::size_t nn = start_.size();
+		if (max_level_ < 0 || ss >= ee)
+			return;
+
+		struct item { std::size_t node; int level; bool left_done; };
+		item stack[64];
+		int top = 0;
+		stack[top++] = { (std::size_t(1) << max_level_) - 1, max_level_, false };
+		while (top > 0)
+		{
+			item it = stack[--top];
+			if (it.level <= 3)
+			{
+				// Small subtree - just scan it
+				std::size_t i0 = it.node >> it.level << it.level;
+				std::size_t i1 = std::min(nn, i0 + (std::size_t(1) << (it.level + 1)) - 1);
+				for (std::size_t pos = i0; pos < i1 && start_[pos] < ee; ++pos)
+					if (end(pos) > ss)
+						ff(pos);
+			}
+			else if (!it.left_done)
+			{
+				std::size_t left = it.node - (std::size_t(1) << (it.level - 1));   // may be past the end
+				stack[top++] = { it.node, it.level, true };
+				if (left >= nn || max_end_[left] > ss)
+					stack[top++] = { left, it.level - 1, false };
+			}
+			else if (it.node < nn && start_[it.node] < ee)
+			{
+				if (end(it.node) > ss)
+					ff(it.node);
+				stack[top++] = { it.node + (std::size_t(1) << (it.level - 1)), it.level - 1, false };
+			}
+		}
+	}
+
+private:
+	static constexpr std::uint32_t big_size = 0xFFFFFFFF;   // size_ value when size is in big_size_
+
+	struct entry
+	{
+		std::int64_t start, size;
+		std::uint32_t elt, colour;
+		bool operator<(const entry &rhs) const { return start < rhs.start || (start == rhs.start && elt < rhs.elt); }
+	};
+	std::vector<entry> pending_;                            // entries added since the last build()
+
+	std::vector<std::int64_t> start_;                       // address of each element (sorted)
+	std::vector<std::uint32_t> size_;                       // element lengths (almost always < 4GB)
+	std::vector<std::uint32_t> elt_;                        // element number (index into CHexEditDoc::df_address_ etc)
+	std::vector<std::uint32_t> colour_;                     // COLORREF or no_colour
+	std::vector<std::pair<std::uint32_t, std::int64_t> > big_size_; // sizes too big for size_ (sorted on pos)
+	std::vector<std::int64_t> max_end_;                     // largest end address of the subtree of each node
+	int max_level_ = -1;                                    // level of the root (-1 if empty)
+
+	void build_tree();
+};
@@ -0,0 +1,265 @@
+// ThreeWayMerge.cpp : implementation of the three_way_merge class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+#include "ThreeWayMerge.h"
+#include "AnchoredDiff.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+static const std::size_t buf_size = 1024*1024;  // buffer size for comparing and merging
+
+// Reads len bytes (or up to EOF) returning the number of bytes read
+static std::size_t read_all(const three_way_merge::reader_t &read, unsigned char *buf, std::size_t len, std::int64_t addr)
+{
+	std::size_t got = 0;
+	while (got < len)
+	{
+		std::size_t nn = read(buf + got, len - got, addr + got);
+		if (nn == 0 || nn > len - got)
+			break;              // EOF or error
+		got += nn;
+	}
+	return got;
+}
+
+three_way_merge::three_way_merge(opener_t open_base, std::int64_t len_base, opener_t open_a, std::int64_t len_a,
+                                 opener_t open_b, std::int64_t len_b)
+	: open_base_(open_base), open_a_(open_a), open_b_(open_b),
+	  len_base_(len_base), len_a_(len_a), len_b_(len_b), conflicts_(0), stop_(false)
+{
+}
+
+bool three_way_merge::run(progress_t progress /*=progress_t()*/)
+{
+	regions_.clear();
+	conflicts_ = 0;
+	stop_ = false;
+
+	// Compare base with A and base with B at the same time
+	std::vector<edit> ea, eb;
+	std::atomic<double> done_a(0.0), done_b(0.0);
+	bool ok_a = false, ok_b = false;
+	std::mutex mutex;                   // protects finished
+	std::condition_variable cv;         // signalled when a compare finishes
+	int finished = 0;
+
+	auto worker = [&](opener_t open_other, std::int64_t len_other, std::vector<edit> &edits, std::atomic<double> &done, bool &ok)
+	{
+		try
+		{
+			ok = diff(open_other, len_other, edits, done);
+		}
+		catch (...)
+		{
+			ok = false;
+		}
+		if (!ok)
+			stop_ = true;               // no point in the other continuing
+
+		std::lock_guard<std::mutex> lock(mutex);
+		++finished;
+		cv.notify_one();
+	};
+	std::thread thread_a([&] { worker(open_a_, len_a_, ea, done_a, ok_a); });
+	std::thread thread_b([&] { worker(open_b_, len_b_, eb, done_b, ok_b); });
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!cv.wait_for(lock, std::chrono::milliseconds(POLL_MS), [&] { return finished == 2; }))
+		{
+			lock.unlock();
+			if (progress && !progress(0.45*(done_a + done_b)))
+				stop_ = true;
+			lock.lock();
+		}
+	}
+	thread_a.join();
+	thread_b.join();
+	if (stop_ || !ok_a || !ok_b)
+		return false;
+
+	make_regions(ea, eb);
+	return !progress || progress(1.0);
+}
+
+bool three_way_merge::merge(std::ostream &out, resolve_t resolve /*=RESOLVE_NONE*/, progress_t progress /*=progress_t()*/)
+{
+	if (conflicts_ > 0 && resolve == RESOLVE_NONE)
+		return false;
+
+	reader_t read_base = open_base_(), read_a = open_a_(), read_b = open_b_();
+	std::int64_t total = 0, done = 0, next_progress = buf_size;
+	for (const region &rr : regions_)
+		total += rr.kind == KIND_SAME ? rr.base_len :
+		         rr.kind == KIND_B || (rr.kind == KIND_CONFLICT && resolve == RESOLVE_B) ? rr.b_len : rr.a_len;
+
+	std::vector<unsigned char> buf(buf_size);
+	for (const region &rr : regions_)
+	{
+		const reader_t *pread;
+		std::int64_t addr, len;
+		if (rr.kind == KIND_SAME)
+			pread = &read_base, addr = rr.base, len = rr.base_len;
+		else if (rr.kind == KIND_B || (rr.kind == KIND_CONFLICT && resolve == RESOLVE_B))
+			pread = &read_b, addr = rr.b, len = rr.b_len;
+		else
+			pread = &read_a, addr = rr.a, len = rr.a_len;
+
+		while (len > 0)
+		{
+			std::size_t nn = std::size_t(std::min<std::int64_t>(buf_size, len));
+			if (read_all(*pread, &buf[0], nn, addr) != nn ||
+				!out.write(reinterpret_cast<const char *>(&buf[0]), std::streamsize(nn)))
+			{
+				return false;
+			}
+			addr += nn;
+			len -= nn;
+			done += nn;
+			if (progress && done >= next_progress)
+			{
+				if (!progress(double(done)/double(total)))
+					return false;
+				next_progress = done + buf_size;
+			}
+		}
+	}
+	return bool(out.flush());
+}
+
+// Compares the base file with another file (run in its own thread) to get the edits that
+// turn the base file into the other file
+bool three_way_merge::diff(opener_t open_other, std::int64_t len_other, std::vector<edit> &edits, std::atomic<double> &done)
+{
+	reader_t read_base = open_base_(), read_other = open_other();
+
+	// A is the other file so that an INSERT is bytes added to the base file
+	anchored_diff ad(read_other, len_other, read_base, len_base_);
+	if (!ad.run([&](double dd) { done = dd; return !stop_; }))
+		return false;
+
+	edits.clear();
+	for (const anchored_diff::block &bb : ad.blocks())
+	{
+		edit ee = { bb.b, bb.kind == anchored_diff::KIND_INSERT ? 0 : bb.len,
+		            bb.a, bb.kind == anchored_diff::KIND_DELETE ? 0 : bb.len };
+		if (!edits.empty() && edits.back().base + edits.back().base_len == ee.base &&
+			edits.back().other + edits.back().other_len == ee.other)
+		{
+			// Join adjacent edits (eg a replacement followed by an insertion)
+			edits.back().base_len += ee.base_len;
+			edits.back().other_len += ee.other_len;
+		}
+		else
+			edits.push_back(ee);
+	}
+	done = 1.0;
+	return true;
+}
+
+// Walks the edits of A and B in base address order grouping those that overlap into regions
+void three_way_merge::make_regions(const std::vector<edit> &ea, const std::vector<edit> &eb)
+{
+	reader_t read_a = open_a_(), read_b = open_b_();
+	const std::int64_t none = std::numeric_limits<std::int64_t>::max();
+	std::int64_t pos = 0;               // end of the last region (in the base file)
+	std::int64_t delta_a = 0, delta_b = 0;  // address in A/B less address in base after the last region
+	std::size_t ia = 0, ib = 0;         // next edit of each file
+
+	auto add_same = [&](std::int64_t end)
+	{
+		if (end > pos)
+		{
+			region rr = { KIND_SAME, pos, end - pos, pos + delta_a, end - pos, pos + delta_b, end - pos };
+			regions_.push_back(rr);
+			pos = end;
+		}
+	};
+
+	while (ia < ea.size() || ib < eb.size())
+	{
+		std::int64_t start = std::min(ia < ea.size() ? ea[ia].base : none, ib < eb.size() ? eb[ib].base : none);
+		add_same(start);
+
+		// Add edits that overlap the region (or are insertions at its start) until there are no more
+		std::int64_t end = start;
+		std::size_t ja = ia, jb = ib;
+		for (bool more = true; more; )
+		{
+			more = false;
+			if (ja < ea.size() && (ea[ja].base < end || ea[ja].base == start))
+			{
+				end = std::max(end, ea[ja].base + ea[ja].base_len);
+				++ja;
+				more = true;
+			}
+			if (jb < eb.size() && (eb[jb].base < end || eb[jb].base == start))
+			{
+				end = std::max(end, eb[jb].base + eb[jb].base_len);
+				++jb;
+				more = true;
+			}
+		}
+
+		region rr;
+		rr.kind = ja == ia ? KIND_B : jb == ib ? KIND_A : KIND_BOTH;
+		rr.base = start;
+		rr.base_len = end - start;
+		rr.a = start + delta_a;
+		rr.b = start + delta_b;
+		for ( ; ia < ja; ++ia)
+			delta_a += ea[ia].other_len - ea[ia].base_len;
+		for ( ; ib < jb; ++ib)
+			delta_b += eb[ib].other_len - eb[ib].base_len;
+		rr.a_len = end + delta_a - rr.a;
+		rr.b_len = end + delta_b - rr.b;
+
+		// If both files changed the region it is only a conflict if they changed it differently
+		if (rr.kind == KIND_BOTH && (rr.a_len != rr.b_len || !same_bytes(read_a, rr.a, read_b, rr.b, rr.a_len)))
+		{
+			rr.kind = KIND_CONFLICT;
+			++conflicts_;
+		}
+		regions_.push_back(rr);
+		pos = end;
+	}
+	add_same(len_base_);
+}
+
+// Returns true if len bytes at a and b are the same
+bool three_way_merge::same_bytes(const reader_t &read_a, std::int64_t a, const reader_t &read_b, std::int64_t b, std::int64_t len)
+{
+	std::vector<unsigned char> bufa(std::size_t(std::min<std::int64_t>(buf_size, len))), bufb(bufa.size());
+	for (std::int64_t done = 0; done < len; )
+	{
+		std::size_t nn = std::size_t(std::min<std::int64_t>(buf_size, len - done));
+		if (read_all(read_a, &bufa[0], nn, a + done) != nn || read_all(read_b, &bufb[0], nn, b + done) != nn ||
+			std::memcmp(&bufa[0], &bufb[0], nn) != 0)
+		{
+			return false;
+		}
+		done += nn;
+	}
+	return true;
+}
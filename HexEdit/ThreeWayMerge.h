@@ -0,0 +1,94 @@
+// ThreeWayMerge.h : compare two changed copies of a file with the original and merge them
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <vector>
+
+// Given a base file and two files (A and B) that were each made by changing a copy of it,
+// this finds what was changed in each and whether the changes conflict:
+//
+// 1. Base is compared with A and with B using anchored_diff.  The two compares are run at the
+//    same time in their own threads, while the thread that called run() polls for progress
+//    (so that it can respond quickly to a request to stop, as with parallel_compare).
+// 2. The differences of each compare are turned into a list of edits of the base file, ie a
+//    range of base bytes replaced by a range of bytes of A (or B), either of which may be empty.
+// 3. The two lists are walked together in base address order.  Edits from either list that
+//    overlap (or are insertions at the same address) are grouped into one region.  If a region
+//    has edits from only one file it is taken from that file.  If it has edits from both then
+//    it is a conflict unless both files have the same bytes there.
+//
+// The result is a list of regions covering the whole base file, from which a merged file can be
+// written in one pass with merge().  Readers are created with opener functions so that each
+// thread has its own (eg its own file handle).
+class three_way_merge
+{
+public:
+	typedef std::function<std::size_t(unsigned char *buf, std::size_t len, std::int64_t addr)> reader_t;
+	typedef std::function<reader_t()> opener_t;     // creates a reader for use by one thread
+	typedef std::function<bool(double done)> progress_t;   // done is 0 to 1; return false to abort
+
+	enum { POLL_MS = 50 };
+
+	enum kind_t
+	{
+		KIND_SAME,              // not changed in either file
+		KIND_A,                 // changed in A only
+		KIND_B,                 // changed in B only
+		KIND_BOTH,              // changed in both but to the same bytes
+		KIND_CONFLICT,          // changed differently in A and B
+	};
+	struct region
+	{
+		kind_t kind;
+		std::int64_t base, base_len;    // the range of the base file
+		std::int64_t a, a_len;          // what it became in A
+		std::int64_t b, b_len;          // what it became in B
+	};
+
+	// How merge() handles conflicts
+	enum resolve_t { RESOLVE_NONE, RESOLVE_A, RESOLVE_B };
+
+	three_way_merge(opener_t open_base, std::int64_t len_base, opener_t open_a, std::int64_t len_a,
+	                opener_t open_b, std::int64_t len_b);
+
+	bool run(progress_t progress = progress_t());       // returns false if aborted (or a read failed)
+	const std::vector<region> &regions() const { return regions_; }    // in address order
+	std::size_t conflicts() const { return conflicts_; }
+
+	// Writes the merged file to a binary stream.  Returns false on error, or (without writing
+	// anything) if there are conflicts and resolve is RESOLVE_NONE.
+	bool merge(std::ostream &out, resolve_t resolve = RESOLVE_NONE, progress_t progress = progress_t());
+
+private:
+	// Replacement of base bytes by bytes of the other file (A or B)
+	struct edit
+	{
+		std::int64_t base, base_len;
+		std::int64_t other, other_len;
+	};
+
+	opener_t open_base_, open_a_, open_b_;
+	std::int64_t len_base_, len_a_, len_b_;
+	std::vector<region> regions_;
+	std::size_t conflicts_;
+
+	std::atomic<bool> stop_;
+
+	bool diff(opener_t open_other, std::int64_t len_other, std::vector<edit> &edits, std::atomic<double> &done);
+	void make_regions(const std::vector<edit> &ea, const std::vector<edit> &eb);
+	bool same_bytes(const reader_t &read_a, std::int64_t a, const reader_t &read_b, std::int64_t b, std::int64_t len);
+};
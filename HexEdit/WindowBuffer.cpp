@@ -0,0 +1,103 @@
+// WindowBuffer.cpp : implementation of the window_buffer class
+//
+// Copyright (c) 2016 by Andrew W. Phillips.
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "WindowBuffer.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+std::size_t window_buffer::fetch(std::int64_t start, std::int64_t end, const reader_t &read)
+{
+	ASSERT(start >= 0 && end >= start);
+	std::size_t len = std::size_t(end - start);
+	if (data_.size() < len)
+		data_.resize(len);
+
+	// Move the bytes we already have (if any) to where they are in the new window
+	std::int64_t lo = std::max(start, start_), hi = std::min(end, start_ + std::int64_t(valid_));
+	if (lo < hi)
+	{
+		if (start != start_)
+			std::memmove(&data_[std::size_t(lo - start)], &data_[std::size_t(lo - start_)], std::size_t(hi - lo));
+		start_ = start;
+		valid_ = std::size_t(hi - start);
+
+		// Get bytes before those we had (if scrolled up) - if we can't get them all then the
+		// file must have got shorter so the bytes we had after them are no good
+		std::size_t before = std::size_t(lo - start), got;
+		if (before > 0 && (got = read_into(0, before, read)) < before)
+			valid_ = got;
+	}
+	else
+	{
+		start_ = start;
+		valid_ = 0;
+	}
+
+	// Read again bytes that were changed
+	dirty_lo_ = std::max(dirty_lo_, start_);
+	dirty_hi_ = std::min(dirty_hi_, start_ + std::int64_t(valid_));
+	if (dirty_lo_ < dirty_hi_)
+	{
+		std::size_t pos = std::size_t(dirty_lo_ - start_), nn = std::size_t(dirty_hi_ - dirty_lo_);
+		if (read_into(pos, nn, read) < nn)
+			valid_ = pos;           // file is shorter than we thought
+	}
+	dirty_lo_ = dirty_hi_ = 0;
+
+	// Get bytes after those we had (if any)
+	if (valid_ < len)
+		valid_ += read_into(valid_, len - valid_, read);
+	return std::min(valid_, len);
+}
+
+void window_buffer::invalidate(std::int64_t from, std::int64_t to /*=max*/)
+{
+	if (from >= to || from >= start_ + std::int64_t(valid_) || to <= start_)
+		return;                     // none of the bytes we have changed
+
+	if (to >= start_ + std::int64_t(valid_))
+	{
+		// Discard everything after from (since the bytes were moved)
+		valid_ = from > start_ ? std::size_t(from - start_) : 0;
+	}
+	else if (dirty_lo_ < dirty_hi_)
+	{
+		dirty_lo_ = std::min(dirty_lo_, from);
+		dirty_hi_ = std::max(dirty_hi_, to);
+	}
+	else
+	{
+		dirty_lo_ = from;
+		dirty_hi_ = to;
+	}
+}
+
+// Reads len bytes (or up to EOF) into data_ at pos returning the number of bytes read
+std::size_t window_buffer::read_into(std::size_t pos, std::size_t len, const reader_t &read)
+{
+	std::size_t got = 0;
+	while (got < len)
+	{
+		std::size_t nn = read(&data_[pos + got], len - got, start_ + std::int64_t(pos + got));
+		if (nn == 0 || nn > len - got)
+			break;              // EOF or error
+		got += nn;
+	}
+	bytes_read_ += got;
+	return got;
+}
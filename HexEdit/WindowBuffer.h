@@ -0,0 +1,57 @@
+// WindowBuffer.h : keeps the bytes of the displayed part of a file between repaints
+//
+// Copyright (c) 2016 by Andrew W. Phillips
+//
+// This file is distributed under the MIT license, which basically says
+// you can do what you want with it and I take no responsibility for bugs.
+// See http://www.opensource.org/licenses/mit-license.php for full details.
+//
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+// The hex view used to get the bytes of each line it drew with its own call to
+// CHexEditDoc::GetData, each of which locks the document and searches its list of changes
+// from the start.  Instead the view now gets all the bytes of the window with one call to
+// fetch() per repaint.  The bytes are kept in this buffer so that the next fetch() only reads
+// the bytes that were not in the last window, or that were changed since (see invalidate()).
+// Eg after scrolling down by a line only the bytes of the new bottom line are read.
+//
+// The valid bytes are always at the start of the buffer (from the start of the window).  Bytes
+// that were changed in place are remembered as one "dirty" range which is read again by the
+// next fetch().  An insertion or deletion moves all following bytes so everything from where
+// it happened is discarded.
+class window_buffer
+{
+public:
+	typedef std::function<std::size_t(unsigned char *buf, std::size_t len, std::int64_t addr)> reader_t;
+
+	window_buffer() : start_(0), valid_(0), dirty_lo_(0), dirty_hi_(0), bytes_read_(0) { }
+
+	// Gets the bytes from start to end (reading only those not already in the buffer) and
+	// returns how many there are - fewer than end-start if the file ends before end.
+	std::size_t fetch(std::int64_t start, std::int64_t end, const reader_t &read);
+	const unsigned char *data() const { return data_.empty() ? NULL : &data_[0]; }  // byte at start (after fetch)
+
+	// Bytes from "from" to "to" have changed.  Leave "to" out if bytes were inserted or deleted.
+	void invalidate(std::int64_t from, std::int64_t to = std::numeric_limits<std::int64_t>::max());
+	void clear() { valid_ = 0; dirty_lo_ = dirty_hi_ = 0; }
+
+	std::int64_t bytes_read() const { return bytes_read_; }   // total bytes read by fetch() (for testing)
+
+private:
+	std::vector<unsigned char> data_;
+	std::int64_t start_;                // address of data_[0]
+	std::size_t valid_;                 // number of valid bytes at the start of data_
+	std::int64_t dirty_lo_, dirty_hi_;  // addresses of changed bytes (if dirty_lo_ < dirty_hi_)
+	std::int64_t bytes_read_;
+
+	std::size_t read_into(std::size_t pos, std::size_t len, const reader_t &read);
+};
@@ -13,7 +13,7 @@
 CXmlTree::CXmlTree(const LPCTSTR filename /*=NULL*/) :
 	m_pdoc{}, m_filename{}, m_modified{ false }, m_error{ false }
 {
-	HRESULT hr = m_pdoc.CreateInstance(MSXML2::CLSID_DOMDocument);
+	HRESULT hr = m_pdoc.CreateInstance(MSXML2::CLSID_FreeThreadedDOMDocument);  // template may be scanned in bg thread
 	if (FAILED(hr))
 	{
 		throw _com_error{ hr };
@@ -5,7 +5,8 @@
 // You can freely use this software for any purpose
 // as long as you preserve this copyright notice.
 
-#include <list>
+#include <vector>
+#include <algorithm>                // for lower_bound/upper_bound
 #include <iterator>
 #include <utility>                  // for make_pair<T1,T2>()
 #include <functional>               // for less<T>
@@ -20,6 +21,12 @@
 /// This collection stores consecutive spans of values as their start and end points.
 /// As such, this is best used for sets that are likely to be densely filled, but
 /// will be less efficient than a regular `std::set` when sparsely filled.
+///
+/// The segments are kept in order in a vector so that searches are binary searches
+/// (O(log n) for n segments).  Adding values past the end of the set (eg building
+/// a set from sorted values) just extends or appends the last segment.  Note that
+/// as with std::vector, inserting or erasing invalidates all iterators except the
+/// ones returned.
 template <class T, class Pred = std::less<T>,
 		  class Alloc = std::allocator<T> >
 class range_set
@@ -58,7 +65,7 @@ public:
 		// Constructor
 		segment(T fst, T lst) : sfirst(fst), slast(lst) { }
 	};
-	typedef std::list<segment> range_t;
+	typedef std::vector<segment> range_t;
 	mutable range_t range_; // All segments for this range_set
 
 private:
@@ -71,142 +78,102 @@ private:
 	// NOTE: When member variables are added: member swap() must
 	//     be updated, perhaps and operator==() and operator<().
 
+	// Returns the first segment that ends after v (ie the one containing v
+	// or the first one after it).
+	typename range_t::iterator seg_after(const T &v) const
+	{
+		return std::upper_bound(range_.begin(), range_.end(), v,
+			[this](const T &vv, const segment &seg) { return compare_(vv, seg.slast); });
+	}
+	// Returns the first segment that does not end before v, ie it contains v
+	// or is the segment that ends at v (so a range starting at v joins it).
+	typename range_t::iterator seg_touching(const T &v) const
+	{
+		return std::lower_bound(range_.begin(), range_.end(), v,
+			[this](const segment &seg, const T &vv) { return compare_(seg.slast, vv); });
+	}
+	// Returns the first segment at or after pp that starts after v
+	typename range_t::iterator seg_starting_after(typename range_t::iterator pp, const T &v) const
+	{
+		return std::upper_bound(pp, range_.end(), v,
+			[this](const T &vv, const segment &seg) { return compare_(vv, seg.sfirst); });
+	}
+	const_iterator iter_at(typename range_t::iterator pp) const
+	{
+		return const_iterator(pp, this, pp == range_.end() ? T() : pp->sfirst);
+	}
+
+	// Note that the position (pp) of the old list-based version is no longer
+	// needed as binary searches are quick.
 	std::pair<const_iterator, const_iterator>
-	insert_helper(typename range_t::iterator pp, const T &ss,const T &ee)
+	insert_helper(typename range_t::iterator, const T &ss, const T &ee)
 	{
 		if (!compare_(ss, ee))
 			return std::make_pair(end(), end());
 
-		T new_end = ee;     // Keep end since we have to modify
-
-		// Make sure hint is at or before the correct segment
-		range_t::iterator prev = pp;
-		for ( ; pp != range_.begin(); pp = prev)
+		// Fast path for adding at or past the end (as when building from sorted values)
+		if (range_.empty() || !compare_(ss, range_.back().slast))
 		{
-			--prev;
-			if (compare_(prev->slast, ss))
-				break;
+			if (range_.empty() || compare_(range_.back().slast, ss))
+				range_.push_back(segment(ss, ee));      // after a gap
+			else if (compare_(range_.back().slast, ee))
+				range_.back().slast = ee;               // joins last segment
+			return std::make_pair(const_iterator(range_.end() - 1, this, ss), end());
 		}
 
-		// Search until we find where the new range fits or
-		// we reach the end of the list
-		for ( ; pp != range_.end() && 
-				!compare_(new_end, pp->sfirst); ++pp)
-		{
-			if (!compare_(pp->slast, ss))
-			{
-				// The new range overlaps this one.  At least
-				// we don't need to add any list elements
-				// (although we may need to delete some).
-
-				// Make sure we retain all of the current seg
-				if (compare_(ss, pp->sfirst))
-					pp->sfirst = ss;
-				if (compare_(new_end, pp->slast))
-					new_end = pp->slast;
-
-				// Delete following ranges subsumed (if any)
-				range_t::iterator pnext;
-				for (pnext = pp, ++pnext;
-					 pnext != range_.end() && 
-						 !compare_(new_end,pnext->sfirst);
-					 pnext = pp, ++pnext)
-				{
-					// Delete the segment but make sure we
-					// retain up to the end of it
-					if (compare_(new_end, pnext->slast))
-						new_end = pnext->slast;
-					range_.erase(pnext);
-				}
+		// Find the segments that the new range overlaps or touches
+		typename range_t::iterator pfirst = seg_touching(ss);
+		typename range_t::iterator plast = seg_starting_after(pfirst, ee);
 
-				pp->slast = new_end;
-				return std::make_pair(
-					const_iterator(pp, this, ss),
-					const_iterator(pnext, this,
-								   pnext==range_.end() ? 
-									   T() : pnext->sfirst));
-			}
+		if (pfirst == plast)
+		{
+			// Add a new segment in the gap before pfirst
+			pfirst = range_.insert(pfirst, segment(ss, ee));
+			return std::make_pair(const_iterator(pfirst, this, ss), iter_at(pfirst + 1));
 		}
 
-		// Add a new range in the gap before pp or at the end
-		range_.insert(pp, segment(ss, new_end));
-		range_t::iterator pprev = pp; --pprev;
-
-		// pprev now points to the new seg inserted before pp
-		return std::make_pair(
-			const_iterator(pprev, this, ss),
-			const_iterator(pp, this,
-						   pp==range_.end() ? T() :pp->sfirst));
+		// Join all of them into the first one, retaining all of each
+		if (compare_(ss, pfirst->sfirst))
+			pfirst->sfirst = ss;
+		pfirst->slast = compare_(ee, (plast - 1)->slast) ? (plast - 1)->slast : ee;
+		pfirst = range_.erase(pfirst + 1, plast) - 1;
+		return std::make_pair(const_iterator(pfirst, this, ss), iter_at(pfirst + 1));
 	}
-	const_iterator erase_helper(typename range_t::iterator pp, 
-								const T &ss, const T &ee)
+	const_iterator erase_helper(typename range_t::iterator, const T &ss, const T &ee)
 	{
 		if (!compare_(ss, ee)) return lower_bound(ss);
 
-		// Make sure hint is at or before the correct segment
-		range_t::iterator prev = pp;
-		for ( ; pp != range_.begin(); pp = prev)
-		{
-			--prev;
-			if (compare_(prev->slast, ss))
-				break;
-		}
-
-		for ( ; pp != range_.end(); ++pp)
-		{
-			if (!compare_(pp->sfirst, ee))
-			{
-				// Nothing to erase (all in gap before this seg)
-				return const_iterator(pp, this, pp->sfirst);
-			}
-			else if (!compare_(pp->sfirst, ss) && 
-					 compare_(ee, pp->slast))
-			{
-				// Chop off bottom of current range only
-				pp->sfirst = ee;
-				return const_iterator(pp, this, ee);
-			}
-			else if (compare_(ee, pp->slast))
-			{
-				// Split this range in twain
-				range_.insert(pp, segment(pp->sfirst, ss));
-				pp->sfirst = ee;
-				return const_iterator(pp, this, ee);
-			}
-			else if (compare_(ss, pp->slast))
-			{
-				// Chops off top of this range
-				if (compare_(pp->sfirst, ss))
-				{
-					pp->slast = ss;
-					++pp;
-				}
+		// Find the segments with values in the range
+		typename range_t::iterator pfirst = seg_after(ss);
+		typename range_t::iterator plast = std::lower_bound(pfirst, range_.end(), ee,
+			[this](const segment &seg, const T &vv) { return compare_(seg.sfirst, vv); });
 
-				// Delete ranges that are totally enclosed
-				while (pp != range_.end() && 
-					   !compare_(ee, pp->slast))
-				{
-					range_t::iterator pnext = pp; ++pnext;
-					range_.erase(pp);
-					pp = pnext;
-				}
+		if (pfirst == plast)
+			return iter_at(pfirst);     // Nothing to erase (all in gap before this seg)
 
-				// Chop off bottom of last if necessary
-				if (pp != range_.end() && 
-					compare_(pp->sfirst, ee))
-				{
-					pp->sfirst = ee;
-				}
+		// Work out what is left of the first and last segments
+		bool keep_bottom = compare_(pfirst->sfirst, ss);
+		bool keep_top = compare_(ee, (plast - 1)->slast);
+		segment bottom(pfirst->sfirst, ss), top(ee, (plast - 1)->slast);
 
-				if (pp != range_.end())
-					return const_iterator(pp, this, pp->sfirst);
-				else
-					return end();
-			}
-		} /* for */
+		if (keep_bottom && keep_top && plast - pfirst == 1)
+		{
+			// Split this range in twain
+			pfirst = range_.insert(pfirst, bottom);
+			(pfirst + 1)->sfirst = ee;
+			return const_iterator(pfirst + 1, this, ee);
+		}
 
-		// Nothing to erase (all are past the last segment)
-		return end();
+		// Replace the segments with what is left of them (if anything)
+		if (keep_bottom)
+			*pfirst++ = bottom;
+		if (keep_top)
+			*pfirst++ = top;
+		pfirst = range_.erase(pfirst, plast);
+		if (keep_top)
+			return const_iterator(pfirst - 1, this, ee);
+		else
+			return iter_at(pfirst);
 	}
 
 	T one_more(const T &v) const
@@ -223,11 +190,54 @@ private:
 		return increasing_ ? v - T(1) : v + T(1);
 	}
 
+	// Operations for combine(): bit (in first set)*2 + (in second set)
+	// says whether a value is in the result
+	enum { OP_UNION = 0xE, OP_INTERSECTION = 0x8, OP_DIFFERENCE = 0x4, OP_SYMMETRIC = 0x6 };
+
+	// Makes a set from this set and rr in one pass through the segments of
+	// both, by walking the segment ends of both in order and noting where
+	// the values change between being in and out of the result.
+	range_set combine(const range_set &rr, int op) const
+	{
+		assert(increasing_ == rr.increasing_);
+		range_set retval(compare_, allocator_);
+		const range_t &aa = range_, &bb = rr.range_;
+		const std::size_t na = aa.size()*2, nb = bb.size()*2;
+		std::size_t ia = 0, ib = 0;     // Next segment end (2 per segment)
+		bool in = false;                // Currently in the result?
+		T start = T();                  // Start of current result segment
+
+		while (ia < na || ib < nb)
+		{
+			T va = T(), vb = T();
+			if (ia < na)
+				va = ia%2 == 0 ? aa[ia/2].sfirst : aa[ia/2].slast;
+			if (ib < nb)
+				vb = ib%2 == 0 ? bb[ib/2].sfirst : bb[ib/2].slast;
+
+			// Take the lowest end (from both sets if they are the same)
+			bool take_a = ia < na && (ib == nb || !compare_(vb, va));
+			bool take_b = ib < nb && (ia == na || !compare_(va, vb));
+			T vv = take_a ? va : vb;
+			if (take_a) ++ia;
+			if (take_b) ++ib;
+
+			// An odd index means we are now inside a segment of that set
+			bool now = ((op >> ((ia%2)*2 + ib%2)) & 1) != 0;
+			if (now && !in)
+				start = vv;
+			else if (!now && in)
+				retval.range_.push_back(segment(start, vv));
+			in = now;
+		}
+		return retval;
+	}
+
 public:
 	// Iterators
 	class const_iterator :
 		public std::iterator<std::bidirectional_iterator_tag,
-							 const T, difference_type>
+							 const T, difference_type, const T *, T>
 	{
 	private:
 		// Since the container does not "contain" all the actual
@@ -262,7 +272,9 @@ public:
 		// Use compiler generated copy constructor,
 		// copy assignment operator, and destructor
 
-		const_reference operator*() const
+		// Returns the value (not a reference) as the value is stored in the
+		// iterator - std::reverse_iterator dereferences a temporary copy.
+		value_type operator*() const
 		{
 			// Check that the iterator is valid and
 			// that we don't dereference end()
@@ -380,8 +392,12 @@ public:
 		: range_set{ init.begin(), init.end(), p, a }
 	{ }
 
-	// Use compiler generated copy constructor,
-	// copy assignment operator, and destructor
+	// Use compiler generated copy and move constructors,
+	// assignment operators, and destructor
+	range_set(const range_set &) = default;
+	range_set(range_set &&) = default;
+	range_set &operator=(const range_set &) = default;
+	range_set &operator=(range_set &&) = default;
 
 	const_iterator begin() const
 	{
@@ -431,7 +447,7 @@ public:
 	}
 	bool empty() const
 	{
-		return (size() == 0);
+		return range_.empty();          // Segments are never empty
 	}
 
 	// Modifiers
@@ -557,6 +573,56 @@ public:
 	{
 		range_.clear();
 	}
+
+	/// \brief  Adjusts the set for values inserted or removed at \p addr (eg when
+	///         bytes are inserted into or deleted from a file).
+	///
+	/// \param  addr    Where the values are inserted or removed.
+	/// \param  offset  The number of values inserted (> 0) or removed (< 0).
+	///
+	/// \details
+	/// When inserting, values from \p addr on are moved up by \p offset, and a
+	/// segment containing \p addr is stretched to include the inserted values.
+	/// When removing, values from \p addr up to \p addr - \p offset are erased,
+	/// the values after them are moved down and segments that then abut are
+	/// joined.  This is done in one pass and is only for sets in increasing order.
+	void shift(const value_type &addr, const value_type &offset)
+	{
+		assert(increasing_);
+		typename range_t::iterator pp;
+		if (offset > T(0))
+		{
+			pp = seg_after(addr);
+			if (pp != range_.end() && !compare_(addr, pp->sfirst))
+				(pp++)->slast += offset;        // Stretch segment with addr
+		}
+		else if (offset < T(0))
+		{
+			(void)erase_helper(range_.begin(), addr, addr - offset);
+			pp = seg_touching(addr);
+			if (pp != range_.end() && pp->slast == addr)
+			{
+				// Join segment ending at addr with one that now follows it
+				typename range_t::iterator next = pp + 1;
+				if (next != range_.end() && next->sfirst == addr - offset)
+				{
+					pp->slast = next->slast + offset;
+					pp = range_.erase(next);
+				}
+				else
+					++pp;
+			}
+		}
+		else
+			return;
+
+		// Move all following segments
+		for ( ; pp != range_.end(); ++pp)
+		{
+			pp->sfirst += offset;
+			pp->slast += offset;
+		}
+	}
 	void swap(range_set &rr)
 	{
 		range_.swap(rr.range_);
@@ -578,16 +644,11 @@ public:
 	// Searches
 	const_iterator find(const key_type &k) const
 	{
-		for (range_t::iterator pp = range_.begin();
-			 pp != range_.end(); ++pp)
-		{
-			if (compare_(k, pp->sfirst))
-				break;                      // Return end()
-			else if (compare_(k, pp->slast))
-				return const_iterator(pp, this, k); // Found!
-		}
-
-		return const_iterator(range_.end(), this, T());
+		typename range_t::iterator pp = seg_after(k);
+		if (pp != range_.end() && !compare_(k, pp->sfirst))
+			return const_iterator(pp, this, k); // Found!
+		else
+			return end();
 	}
 	size_type count(const key_type &k) const
 	{
@@ -596,17 +657,11 @@ public:
 
 	const_iterator lower_bound(const key_type &k) const
 	{
-		range_t::iterator pp;
-		for (pp = range_.begin();
-			 pp != range_.end(); ++pp)
-		{
-			if (compare_(k, pp->sfirst))
-				return const_iterator(pp, this, pp->sfirst);
-			else if (compare_(k, pp->slast))
-				return const_iterator(pp, this, k);    // Found!
-		}
-
-		return const_iterator(pp, this, T());   // Return end()
+		typename range_t::iterator pp = seg_after(k);
+		if (pp != range_.end() && !compare_(k, pp->sfirst))
+			return const_iterator(pp, this, k);    // Found!
+		else
+			return iter_at(pp);
 	}
 	const_iterator upper_bound(const key_type &k) const
 	{
@@ -625,6 +680,84 @@ public:
 		return std::make_pair(low, up);
 	}
 
+	// Set algebra.  These are done by merging the segments of
+	// both sets so take time proportional to the number of
+	// segments, rather than inserting or erasing each segment.
+	friend range_set operator|(const range_set &rs1,
+							   const range_set &rs2)
+	{
+		return rs1.combine(rs2, OP_UNION);
+	}
+	friend range_set operator&(const range_set &rs1,
+							   const range_set &rs2)
+	{
+		return rs1.combine(rs2, OP_INTERSECTION);
+	}
+	friend range_set operator-(const range_set &rs1,
+							   const range_set &rs2)
+	{
+		return rs1.combine(rs2, OP_DIFFERENCE);
+	}
+	friend range_set operator^(const range_set &rs1,
+							   const range_set &rs2)
+	{
+		return rs1.combine(rs2, OP_SYMMETRIC);
+	}
+	range_set &operator|=(const range_set &rr)
+	{
+		return *this = combine(rr, OP_UNION);
+	}
+	range_set &operator&=(const range_set &rr)
+	{
+		return *this = combine(rr, OP_INTERSECTION);
+	}
+	range_set &operator-=(const range_set &rr)
+	{
+		return *this = combine(rr, OP_DIFFERENCE);
+	}
+	range_set &operator^=(const range_set &rr)
+	{
+		return *this = combine(rr, OP_SYMMETRIC);
+	}
+
+	/// \brief  Returns the values from \p ss (inclusive) to \p ee (exclusive)
+	///         that are not in this set.
+	range_set complement(const value_type &ss, const value_type &ee) const
+	{
+		range_set retval(compare_, allocator_);
+		if (!compare_(ss, ee))
+			return retval;
+
+		T gap = ss;                     // Start of the current gap
+		for (typename range_t::iterator pp = seg_after(ss);
+			 pp != range_.end() && compare_(pp->sfirst, ee); ++pp)
+		{
+			if (compare_(gap, pp->sfirst))
+				retval.range_.push_back(segment(gap, pp->sfirst));
+			gap = pp->slast;
+		}
+		if (compare_(gap, ee))
+			retval.range_.push_back(segment(gap, ee));
+		return retval;
+	}
+
+	/// \brief  Returns true if all values from \p ss (inclusive) to \p ee
+	///         (exclusive) are in this set.
+	bool contains_range(const value_type &ss, const value_type &ee) const
+	{
+		if (!compare_(ss, ee))
+			return true;
+		typename range_t::iterator pp = seg_after(ss);
+		return pp != range_.end() && !compare_(ss, pp->sfirst) && !compare_(pp->slast, ee);
+	}
+
+	/// \brief  Returns the segment containing \p k or, if \p k is not in the
+	///         set, the first segment after it (or range_.end() if none).
+	typename range_t::const_iterator find_segment(const key_type &k) const
+	{
+		return seg_after(k);
+	}
+
 	// Get a range_set as zero or more comma-separated
 	// ranges (segments). Each segment is a single value
 	// or 2 values separated by ':' or '-'.
@@ -1272,6 +1272,7 @@
 #define IDC_COMPARE_MINMATCH            1689
 #define IDC_COMPARE_MINMATCH_SPIN       1690
 #define IDC_COMPARE_STATIC1             1691
+#define IDC_COMPARE_ANCHORED            1721
 #define IDC_STATS_SHA256                1692
 #define IDC_STATS_SHA512                1693
 #define IDC_BMP_FORMAT                  1695
@@ -1801,6 +1802,8 @@
 #define ID_HELP_REPORTANISSUE           39240
 #define ID_HELP_REPORTANISSUE39241      39241
 #define ID_HELP_REPORT_ISSUE            39242
+#define ID_DFFD_EXPORT                  39243
+#define ID_AERIAL_HEAT                  39244
 #define IDS_WARNING_DO_NOT_RENUMBER     52700
 #define IDS_BOOKMARK_NOFILE             52701
 #define IDS_BOOKMARK_NOTFOUND           52702
@@ -1869,8 +1872,8 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_3D_CONTROLS                     1
 #define _APS_NEXT_RESOURCE_VALUE        531
-#define _APS_NEXT_COMMAND_VALUE         39243
-#define _APS_NEXT_CONTROL_VALUE         1721
+#define _APS_NEXT_COMMAND_VALUE         39245
+#define _APS_NEXT_CONTROL_VALUE         1722
 #define _APS_NEXT_SYMED_VALUE           252
 #endif
 #endif
@@ -0,0 +1,227 @@
+// HexPatch.cpp : Defines the entry point for the console application.
+//
+// Makes and applies binary delta files using the same compare as HexEdit.
+//
+
+#include "stdafx.h"
+
+#include "../HexEdit/BinaryPatch.h"
+#include "../HexEdit/ThreeWayMerge.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+static void Usage()
+{
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "   HexPatch DIFF [-z] [-q] <oldfile> <newfile> <deltafile>\n");
+	fprintf(stderr, "   HexPatch PATCH [-q] <oldfile> <deltafile> <newfile>\n");
+	fprintf(stderr, "   HexPatch INFO <deltafile>\n");
+	fprintf(stderr, "   HexPatch MERGE [-a|-b] [-q] <basefile> <afile> <bfile> <outfile>\n");
+	fprintf(stderr, "   -z = compress the delta file, -q = don't show progress\n");
+	fprintf(stderr, "   -a/-b = use the changes of afile/bfile where they conflict\n");
+}
+
+// Returns a reader for an open file (the stream must stay open while it is used)
+static binary_patch::reader_t FileReader(std::ifstream &ifs)
+{
+	return [&ifs](unsigned char *buf, std::size_t len, std::int64_t addr) -> std::size_t
+	{
+		ifs.clear();
+		if (!ifs.seekg(std::streamoff(addr)))
+			return 0;
+		ifs.read(reinterpret_cast<char *>(buf), std::streamsize(len));
+		return std::size_t(ifs.gcount());
+	};
+}
+
+static bool OpenInput(std::ifstream &ifs, const char *name, std::int64_t &len)
+{
+	ifs.open(name, std::ios::in | std::ios::binary);
+	if (!ifs.is_open() || !ifs.seekg(0, std::ios::end))
+	{
+		fprintf(stderr, "Could not open %s\n", name);
+		return false;
+	}
+	len = std::int64_t(ifs.tellg());
+	return true;
+}
+
+// Returns an opener that gives each thread its own stream for the file
+static three_way_merge::opener_t FileOpener(const char *name)
+{
+	std::string filename = name;
+	return [filename]() -> three_way_merge::reader_t
+	{
+		auto pifs = std::make_shared<std::ifstream>(filename.c_str(), std::ios::in | std::ios::binary);
+		if (!pifs->is_open())
+			throw std::runtime_error("Could not open " + filename);
+		return [pifs](unsigned char *buf, std::size_t len, std::int64_t addr) -> std::size_t
+		{
+			pifs->clear();
+			if (!pifs->seekg(std::streamoff(addr)))
+				return 0;
+			pifs->read(reinterpret_cast<char *>(buf), std::streamsize(len));
+			return std::size_t(pifs->gcount());
+		};
+	};
+}
+
+static bool OpenOutput(std::ofstream &ofs, const char *name)
+{
+	ofs.open(name, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!ofs.is_open())
+	{
+		fprintf(stderr, "Could not create %s\n", name);
+		return false;
+	}
+	return true;
+}
+
+static binary_patch::progress_t Progress(bool quiet)
+{
+	if (quiet)
+		return binary_patch::progress_t();
+	auto last = std::make_shared<int>(-1);
+	return [last](double done) -> bool
+	{
+		int pc = int(done * 100.0);
+		if (pc != *last)
+		{
+			fprintf(stderr, "\r%3d%%", pc);
+			*last = pc;
+		}
+		return true;
+	};
+}
+
+// Removes a partly written output file and reports the error
+static int Failed(binary_patch::status_t status, std::ofstream &ofs, const char *name, bool quiet)
+{
+	if (!quiet)
+		fprintf(stderr, "\n");
+	fprintf(stderr, "%s\n", binary_patch::message(status));
+	ofs.close();
+	std::remove(name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+		return Usage(), 2;
+
+	std::string cmd = argv[1];
+	std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+	bool compress = false, quiet = false;
+	three_way_merge::resolve_t resolve = three_way_merge::RESOLVE_NONE;
+	std::vector<const char *> files;
+	for (int ii = 2; ii < argc; ++ii)
+	{
+		if (strcmp(argv[ii], "-z") == 0)
+			compress = true;
+		else if (strcmp(argv[ii], "-a") == 0)
+			resolve = three_way_merge::RESOLVE_A;
+		else if (strcmp(argv[ii], "-b") == 0)
+			resolve = three_way_merge::RESOLVE_B;
+		else if (strcmp(argv[ii], "-q") == 0)
+			quiet = true;
+		else
+			files.push_back(argv[ii]);
+	}
+
+	if (cmd == "DIFF" && files.size() == 3)
+	{
+		std::ifstream old_file, new_file;
+		std::ofstream delta;
+		std::int64_t old_len, new_len;
+		if (!OpenInput(old_file, files[0], old_len) || !OpenInput(new_file, files[1], new_len) || !OpenOutput(delta, files[2]))
+			return 1;
+
+		binary_patch::status_t status = binary_patch::make(FileReader(old_file), old_len, FileReader(new_file), new_len,
+		                                                   delta, compress, Progress(quiet));
+		if (status != binary_patch::STATUS_OK)
+			return Failed(status, delta, files[2], quiet);
+		delta.close();
+		if (!quiet)
+		{
+			std::ifstream result(files[2], std::ios::in | std::ios::binary | std::ios::ate);
+			fprintf(stderr, "\rDelta is %lld bytes\n", (long long)result.tellg());
+		}
+	}
+	else if (cmd == "PATCH" && files.size() == 3)
+	{
+		std::ifstream old_file, delta;
+		std::ofstream new_file;
+		std::int64_t old_len, delta_len;
+		if (!OpenInput(old_file, files[0], old_len) || !OpenInput(delta, files[1], delta_len))
+			return 1;
+		delta.seekg(0);
+		if (!OpenOutput(new_file, files[2]))
+			return 1;
+
+		binary_patch::status_t status = binary_patch::apply(FileReader(old_file), old_len, delta, new_file, Progress(quiet));
+		if (status != binary_patch::STATUS_OK)
+			return Failed(status, new_file, files[2], quiet);
+		new_file.close();
+		if (!quiet)
+			fprintf(stderr, "\rPatched %s\n", files[2]);
+	}
+	else if (cmd == "INFO" && files.size() == 1)
+	{
+		std::ifstream delta(files[0], std::ios::in | std::ios::binary);
+		binary_patch::header hdr;
+		binary_patch::status_t status = binary_patch::read_header(delta, hdr);
+		if (!delta.is_open() || status != binary_patch::STATUS_OK)
+		{
+			fprintf(stderr, "%s\n", delta.is_open() ? binary_patch::message(status) : "Could not open delta file");
+			return 1;
+		}
+		printf("Format version: %d\n", hdr.version);
+		printf("Compressed:     %s\n", (hdr.flags & binary_patch::FLAG_COMPRESSED) != 0 ? "yes" : "no");
+		printf("Old file:       %lld bytes, CRC %08X\n", (long long)hdr.len_old, unsigned(hdr.crc_old));
+		printf("New file:       %lld bytes\n", (long long)hdr.len_new);
+	}
+	else if (cmd == "MERGE" && files.size() == 4)
+	{
+		std::ifstream base_file, a_file, b_file;
+		std::int64_t base_len, a_len, b_len;
+		if (!OpenInput(base_file, files[0], base_len) || !OpenInput(a_file, files[1], a_len) || !OpenInput(b_file, files[2], b_len))
+			return 1;
+
+		three_way_merge twm(FileOpener(files[0]), base_len, FileOpener(files[1]), a_len, FileOpener(files[2]), b_len);
+		if (!twm.run(Progress(quiet)))
+		{
+			fprintf(stderr, "\nError reading files\n");
+			return 1;
+		}
+		if (!quiet)
+			fprintf(stderr, "\r%d conflicts\n", int(twm.conflicts()));
+		if (twm.conflicts() > 0 && resolve == three_way_merge::RESOLVE_NONE)
+		{
+			// List the conflicts (as base file addresses) so they can be checked in HexEdit
+			for (const three_way_merge::region &rr : twm.regions())
+				if (rr.kind == three_way_merge::KIND_CONFLICT)
+					printf("Conflict at %lld (%lld bytes)\n", (long long)rr.base, (long long)rr.base_len);
+			return 1;
+		}
+
+		std::ofstream out_file;
+		if (!OpenOutput(out_file, files[3]))
+			return 1;
+		if (!twm.merge(out_file, resolve, Progress(quiet)))
+		{
+			fprintf(stderr, "\nError writing %s\n", files[3]);
+			out_file.close();
+			std::remove(files[3]);
+			return 1;
+		}
+		if (!quiet)
+			fprintf(stderr, "\rMerged %s\n", files[3]);
+	}
+	else
+		return Usage(), 2;
+
+	return 0;
+}
@@ -0,0 +1,36 @@
+// stdafx.h : include file for standard system include files,
+// or project specific include files that are used frequently, but
+// are changed infrequently
+//
+// HexPatch does not use MFC (so that it can also be built on other systems)
+// but the HexEdit source files it uses expect ASSERT and DEBUG_NEW.
+//
+
+#pragma once
+
+#ifdef _WIN32
+#include "targetver.h"
+#endif
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef ASSERT
+#define ASSERT(f) assert(f)
+#endif
+#ifndef DEBUG_NEW
+#define DEBUG_NEW new
+#endif
@@ -0,0 +1,153 @@
+#include "Stdafx.h"
+
+#include "AerialHeat.h"
+
+#include <catch.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static aerial_metrics metrics_of(const std::vector<unsigned char> &buf)
+{
+    aerial_metrics mm;
+    mm.add(buf.data(), buf.size());
+    return mm;
+}
+
+static std::vector<unsigned char> random_bytes(std::size_t len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    std::vector<unsigned char> buf(len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    return buf;
+}
+
+TEST_CASE("aerial_metrics entropy")
+{
+    CHECK(metrics_of(std::vector<unsigned char>(1000, 0x55)).entropy() == Approx(0.0));
+
+    std::vector<unsigned char> two(1024);
+    for (std::size_t ii = 0; ii < two.size(); ++ii)
+        two[ii] = ii % 2 ? 0x00 : 0xFF;
+    CHECK(metrics_of(two).entropy() == Approx(1.0));
+
+    std::vector<unsigned char> all(256 * 16);
+    for (std::size_t ii = 0; ii < all.size(); ++ii)
+        all[ii] = static_cast<unsigned char>(ii);
+    CHECK(metrics_of(all).entropy() == Approx(8.0));
+
+    CHECK(aerial_metrics().entropy() == 0.0);
+}
+
+TEST_CASE("aerial_metrics byte class ratios")
+{
+    std::vector<unsigned char> buf = { 0, 0, 'A', 'b', '\n', 0x80, 0xFF, 0x7F };
+    aerial_metrics mm = metrics_of(buf);
+    CHECK(mm.count() == 8);
+    CHECK(mm.zero_ratio() == Approx(0.25));
+    CHECK(mm.ascii_ratio() == Approx(0.375));
+    CHECK(mm.high_ratio() == Approx(0.25));
+}
+
+TEST_CASE("aerial_metrics adding in pieces")
+{
+    // Word alignment (for the ARM score) must be kept across calls
+    std::vector<unsigned char> buf = random_bytes(1001, 7);
+    aerial_metrics whole = metrics_of(buf);
+    aerial_metrics parts;
+    parts.add(buf.data(), 3);
+    parts.add(buf.data() + 3, 6);
+    parts.add(buf.data() + 9, buf.size() - 9);
+
+    CHECK(parts.count() == whole.count());
+    CHECK(parts.entropy() == Approx(whole.entropy()));
+    CHECK(parts.arm_score() == Approx(whole.arm_score()));
+    CHECK(parts.x86_score() == Approx(whole.x86_score()));
+}
+
+TEST_CASE("aerial_metrics classification")
+{
+    SECTION("padding")
+    {
+        CHECK(metrics_of(std::vector<unsigned char>(4096, 0)).kind() == aerial_metrics::KIND_ZERO);
+        CHECK(metrics_of(std::vector<unsigned char>(4096, 0xFF)).kind() == aerial_metrics::KIND_FILL);
+    }
+
+    SECTION("text")
+    {
+        const char *text = "The quick brown fox jumps over the lazy dog.\r\n";
+        std::vector<unsigned char> buf;
+        while (buf.size() < 4096)
+            buf.insert(buf.end(), text, text + strlen(text));
+        CHECK(metrics_of(buf).kind() == aerial_metrics::KIND_TEXT);
+    }
+
+    SECTION("random")
+    {
+        CHECK(metrics_of(random_bytes(256, 1)).kind() == aerial_metrics::KIND_RANDOM);
+        CHECK(metrics_of(random_bytes(65536, 2)).kind() == aerial_metrics::KIND_RANDOM);
+    }
+
+    SECTION("A32 code")
+    {
+        // Unconditional instructions with varying operands (eg E59F1004 = LDR R1, [PC, #4])
+        std::vector<unsigned char> buf = random_bytes(4096, 3);
+        for (std::size_t ii = 3; ii < buf.size(); ii += 4)
+            buf[ii] = static_cast<unsigned char>(0xE0 | (buf[ii] & 0x0F));
+        aerial_metrics mm = metrics_of(buf);
+        CHECK(mm.arm_score() > 1.0);
+        CHECK(mm.kind() == aerial_metrics::KIND_ARM);
+    }
+
+    SECTION("x86 code")
+    {
+        // mov rax,[rbp-8]; mov edi,eax; call rel32; test eax,eax; jz rel8; lea rcx,[rsp+20h]; ret
+        const unsigned char code[] = { 0x48, 0x8B, 0x45, 0xF8, 0x89, 0xC7, 0xE8, 0x10, 0x20, 0x00, 0x00,
+                                       0x85, 0xC0, 0x74, 0x07, 0x48, 0x8D, 0x4C, 0x24, 0x20, 0xC3 };
+        std::vector<unsigned char> buf;
+        while (buf.size() < 4096)
+            buf.insert(buf.end(), code, code + sizeof(code));
+        aerial_metrics mm = metrics_of(buf);
+        CHECK(mm.x86_score() > 0.5);
+        CHECK(mm.kind() == aerial_metrics::KIND_X86);
+    }
+}
+
+TEST_CASE("aerial_metrics heat map elts")
+{
+    std::vector<unsigned char> buf(1024 + 300, 0);
+    std::vector<unsigned char> rnd = random_bytes(256, 4);
+    std::copy(rnd.begin(), rnd.end(), buf.begin() + 256);
+
+    unsigned char dest[6 * 3];
+    REQUIRE(aerial_metrics::reduce(buf.data(), buf.size(), aerial_metrics::MIN_LEVEL, dest) == 6);
+
+    unsigned char zero[3], random[3];
+    metrics_of(std::vector<unsigned char>(256, 0)).colour(zero);
+    metrics_of(rnd).colour(random);
+    CHECK(memcmp(dest, zero, 3) == 0);
+    CHECK(memcmp(dest + 3, random, 3) == 0);
+    CHECK(memcmp(dest + 15, zero, 3) == 0);     // short last elt
+}
+
+TEST_CASE("aerial_metrics - benchmarks", "[!benchmark]")
+{
+    const std::size_t buf_len = 16 * 1024 * 1024;
+    std::vector<unsigned char> buf = random_bytes(buf_len, std::random_device{}());
+    std::memset(buf.data(), 0, buf_len / 4);    // include some padding (runs of the same byte)
+    std::vector<unsigned char> dest(buf_len / 256 * 3);
+
+    for (int level = aerial_metrics::MIN_LEVEL; level <= 16; ++level)
+    {
+        const int repeats = 4;
+        auto start = std::chrono::steady_clock::now();
+        for (int rr = 0; rr < repeats; ++rr)
+            aerial_metrics::reduce(buf.data(), buf_len, level, dest.data());
+        std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+        WARN("BPE " << (1 << level) << ": " << double(buf_len) * repeats / secs.count() / 1e9 << " GB/s");
+    }
+}
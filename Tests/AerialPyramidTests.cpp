@@ -0,0 +1,145 @@
+#include "Stdafx.h"
+
+#include "AerialPyramid.h"
+
+#include <catch.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Makes count elts where the blue, green and red values of each are all the same value
+static std::vector<unsigned char> grey_elts(std::int64_t count, unsigned char value)
+{
+    return std::vector<unsigned char>(static_cast<std::size_t>(count) * aerial_pyramid::BYTES_PER_ELT, value);
+}
+
+TEST_CASE("aerial_pyramid tile sizes")
+{
+    aerial_pyramid pyramid;
+    pyramid.set_length(aerial_pyramid::TILE_ELTS * 2 + 10);
+
+    CHECK(aerial_pyramid::level_of(1) == 0);
+    CHECK(aerial_pyramid::level_of(2) == 1);
+    CHECK(aerial_pyramid::level_of(3) == 2);
+    CHECK(aerial_pyramid::level_of(65536) == 16);
+
+    CHECK(pyramid.tile_elts(0, 0) == aerial_pyramid::TILE_ELTS);
+    CHECK(pyramid.tile_elts(0, 2) == 10);
+    CHECK(pyramid.tile_elts(0, 3) == 0);
+    CHECK(pyramid.tile_elts(1, 1) == 5);
+    CHECK(pyramid.tile_elts(2, 0) == aerial_pyramid::TILE_ELTS/2 + 3);   // last elt is partial
+}
+
+TEST_CASE("aerial_pyramid put and copy")
+{
+    aerial_pyramid pyramid;
+    pyramid.set_length(100);
+
+    std::int64_t first, last;
+    REQUIRE(pyramid.need(0, 0, first, last));
+    CHECK(first == 0);
+    CHECK(last == 100);
+
+    std::vector<unsigned char> bits = grey_elts(100, 7);
+    pyramid.put(0, 0, 0, bits.data(), 100);
+    CHECK_FALSE(pyramid.need(0, 0, first, last));
+    CHECK(pyramid.memory() == 300);
+
+    // Elts past EOF are filled
+    std::vector<unsigned char> dest(110 * aerial_pyramid::BYTES_PER_ELT);
+    CHECK(pyramid.copy(0, 0, 110, dest.data(), 0xC0));
+    CHECK(dest[0] == 7);
+    CHECK(dest[299] == 7);
+    CHECK(dest[300] == 0xC0);
+
+    // A level that has not been calculated
+    CHECK_FALSE(pyramid.copy(1, 0, 10, dest.data(), 0xC0));
+    CHECK(dest[0] == 0xC0);
+}
+
+TEST_CASE("aerial_pyramid downsample")
+{
+    aerial_pyramid pyramid;
+    pyramid.set_length(aerial_pyramid::TILE_ELTS + 3);
+
+    CHECK_FALSE(pyramid.downsample(1, 0));         // finer tiles not available
+
+    std::vector<unsigned char> bits = grey_elts(aerial_pyramid::TILE_ELTS, 10);
+    bits[3] = 20;                                   // blue of elt 1
+    pyramid.put(0, 0, 0, bits.data(), aerial_pyramid::TILE_ELTS);
+    CHECK_FALSE(pyramid.downsample(1, 0));         // 2nd tile still needed
+
+    std::vector<unsigned char> tail = grey_elts(3, 40);
+    pyramid.put(0, 1, 0, tail.data(), 3);
+    REQUIRE(pyramid.downsample(1, 0));
+
+    std::vector<unsigned char> dest(pyramid.tile_elts(1, 0) * aerial_pyramid::BYTES_PER_ELT);
+    REQUIRE(dest.size() == (aerial_pyramid::TILE_ELTS/2 + 2) * aerial_pyramid::BYTES_PER_ELT);
+    CHECK(pyramid.copy(1, 0, pyramid.tile_elts(1, 0), dest.data(), 0));
+    CHECK(dest[0] == 15);                           // (10 + 20)/2
+    CHECK(dest[1] == 10);
+    CHECK(dest[dest.size() - 1] == 40);             // partial last elt
+}
+
+TEST_CASE("aerial_pyramid invalidate replaced bytes")
+{
+    aerial_pyramid pyramid;
+    pyramid.set_length(1000);
+
+    std::vector<unsigned char> bits = grey_elts(1000, 1);
+    pyramid.put(0, 0, 0, bits.data(), 1000);
+    pyramid.put(2, 0, 0, bits.data(), 250);
+    unsigned gen = pyramid.generation();
+
+    pyramid.invalidate(10, 12);
+    CHECK(pyramid.generation() != gen);
+
+    std::int64_t first, last;
+    REQUIRE(pyramid.need(0, 0, first, last));
+    CHECK(first == 10);
+    CHECK(last == 12);
+    REQUIRE(pyramid.need(2, 0, first, last));
+    CHECK(first == 2);
+    CHECK(last == 3);
+
+    // Stale values are still copied but reported as incomplete
+    std::vector<unsigned char> dest(1000 * aerial_pyramid::BYTES_PER_ELT);
+    CHECK_FALSE(pyramid.copy(0, 0, 1000, dest.data(), 0));
+    CHECK(pyramid.copy(0, 100, 10, dest.data(), 0));
+
+    pyramid.put(0, 0, 10, bits.data(), 2);
+    CHECK_FALSE(pyramid.need(0, 0, first, last));
+}
+
+TEST_CASE("aerial_pyramid discard and trim")
+{
+    aerial_pyramid pyramid;
+    pyramid.set_length(aerial_pyramid::TILE_ELTS * 3);
+
+    std::vector<unsigned char> bits = grey_elts(aerial_pyramid::TILE_ELTS, 1);
+    pyramid.put(0, 0, 0, bits.data(), aerial_pyramid::TILE_ELTS);
+    pyramid.put(0, 1, 0, bits.data(), aerial_pyramid::TILE_ELTS);
+    pyramid.put(0, 2, 0, bits.data(), aerial_pyramid::TILE_ELTS);
+    REQUIRE(pyramid.num_tiles() == 3);
+
+    // Bytes inserted in the 2nd tile
+    pyramid.discard(aerial_pyramid::TILE_ELTS + 5);
+    CHECK(pyramid.has_tile(0, 0));
+    CHECK_FALSE(pyramid.has_tile(0, 1));
+    CHECK_FALSE(pyramid.has_tile(0, 2));
+
+    pyramid.put(0, 1, 0, bits.data(), aerial_pyramid::TILE_ELTS);
+    std::vector<unsigned char> dest(3);
+    pyramid.copy(0, 0, 1, dest.data(), 0);          // tile 0 is now the most recently used
+    pyramid.trim(bits.size(), pyramid.clock() + 1);
+    CHECK(pyramid.has_tile(0, 0));
+    CHECK_FALSE(pyramid.has_tile(0, 1));
+    CHECK(pyramid.memory() == bits.size());
+
+    // Recently used tiles are kept even if over the limit
+    unsigned keep = pyramid.clock() + 1;
+    pyramid.put(0, 1, 0, bits.data(), aerial_pyramid::TILE_ELTS);
+    pyramid.touch(0, 0);
+    pyramid.trim(0, keep);
+    CHECK(pyramid.num_tiles() == 2);
+}
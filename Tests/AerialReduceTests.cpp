@@ -0,0 +1,131 @@
+#include "Stdafx.h"
+
+#include "AerialReduce.h"
+
+#include <catch.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// The original per-byte loop of the aerial view scan (one COLORREF lookup per byte and a
+// divide per elt) used to check the results of the kernel.
+static std::size_t reduce_reference(const std::uint32_t *colours, const unsigned char *buf, std::size_t len, int level, unsigned char *dest)
+{
+    const std::size_t bpe = std::size_t(1) << level;
+    std::size_t elts = 0;
+    for (const unsigned char *pbuf = buf; pbuf < buf + len; pbuf += bpe, dest += 3, ++elts)
+    {
+        unsigned r = 0, g = 0, b = 0;
+        const unsigned char *pend = pbuf + bpe < buf + len ? pbuf + bpe : buf + len;
+        for (const unsigned char *pp = pbuf; pp < pend; ++pp)
+        {
+            r += colours[*pp] & 0xFF;
+            g += (colours[*pp] >> 8) & 0xFF;
+            b += (colours[*pp] >> 16) & 0xFF;
+        }
+        unsigned count = unsigned(pend - pbuf);
+        dest[0] = static_cast<unsigned char>(b / count);
+        dest[1] = static_cast<unsigned char>(g / count);
+        dest[2] = static_cast<unsigned char>(r / count);
+    }
+    return elts;
+}
+
+static std::vector<std::uint32_t> random_colours(std::mt19937 &rng)
+{
+    std::vector<std::uint32_t> colours(256);
+    for (auto &cc : colours)
+        cc = rng() & 0xFFFFFF;
+    return colours;
+}
+
+TEST_CASE("aerial_reducer single byte elts")
+{
+    aerial_reducer reducer;
+    reducer.set_colour(0x41, 0x00332211);      // 0x00BBGGRR
+
+    const unsigned char buf[] = { 0x41, 0x00 };
+    unsigned char dest[6] = { 0 };
+    REQUIRE(reducer.reduce(buf, 2, 0, dest) == 2);
+    CHECK(dest[0] == 0x33);                     // blue first
+    CHECK(dest[1] == 0x22);
+    CHECK(dest[2] == 0x11);
+    CHECK(dest[3] == 0);
+}
+
+TEST_CASE("aerial_reducer matches the per-byte loop")
+{
+    std::mt19937 rng{ 12345 };
+    std::vector<std::uint32_t> colours = random_colours(rng);
+    aerial_reducer reducer;
+    reducer.set_colours(colours);
+
+    std::vector<unsigned char> buf(300000);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+
+    for (int level = 0; level <= 16; ++level)
+    {
+        // Include lengths that leave a short last elt
+        const std::size_t lengths[] = { buf.size(), (std::size_t(3) << level) + 1, std::size_t(1) << level, 7 };
+        for (std::size_t len : lengths)
+        {
+            if (len > buf.size())
+                continue;
+            INFO("level " << level << " length " << len);
+
+            std::vector<unsigned char> expected(buf.size() * 3), actual(buf.size() * 3);
+            std::size_t ne = reduce_reference(colours.data(), buf.data(), len, level, expected.data());
+            REQUIRE(reducer.reduce(buf.data(), len, level, actual.data()) == ne);
+            CHECK(std::equal(expected.begin(), expected.begin() + ne*3, actual.begin()));
+        }
+    }
+}
+
+TEST_CASE("aerial_reducer maximum sums")
+{
+    // All bytes white - the sums of big elts must not overflow
+    aerial_reducer reducer;
+    for (int ii = 0; ii < 256; ++ii)
+        reducer.set_colour(ii, 0x00FFFFFF);
+
+    std::vector<unsigned char> buf(65536 * 2 + 100, 0xFF);
+    unsigned char dest[9] = { 0 };
+    REQUIRE(reducer.reduce(buf.data(), buf.size(), 16, dest) == 3);
+    for (unsigned char cc : dest)
+        CHECK(cc == 0xFF);
+}
+
+TEST_CASE("aerial_reducer - benchmarks", "[!benchmark]")
+{
+    std::mt19937 rng{ std::random_device{}() };
+    std::vector<std::uint32_t> colours = random_colours(rng);
+    aerial_reducer reducer;
+    reducer.set_colours(colours);
+
+    const std::size_t buf_len = 16 * 1024 * 1024;
+    std::vector<unsigned char> buf(buf_len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    std::vector<unsigned char> dest(buf_len * 3);
+
+    // Reports the throughput (GBytes of file per second) of the kernel and the per-byte loop
+    auto gb_per_sec = [&](auto &&fn)
+    {
+        const int repeats = 4;
+        auto start = std::chrono::steady_clock::now();
+        for (int rr = 0; rr < repeats; ++rr)
+            fn();
+        std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+        return double(buf_len) * repeats / secs.count() / 1e9;
+    };
+
+    for (int level = 0; level <= 16; ++level)
+    {
+        double kernel = gb_per_sec([&] { reducer.reduce(buf.data(), buf_len, level, dest.data()); });
+        double reference = gb_per_sec([&] { reduce_reference(colours.data(), buf.data(), buf_len, level, dest.data()); });
+        WARN("BPE " << (1 << level) << ": kernel " << kernel << " GB/s, per-byte loop " << reference << " GB/s");
+    }
+}
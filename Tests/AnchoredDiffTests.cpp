@@ -0,0 +1,226 @@
+#include "Stdafx.h"
+
+#include "AnchoredDiff.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+static bytes random_bytes(std::size_t len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    bytes buf(len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    return buf;
+}
+
+static anchored_diff::reader_t reader(const bytes &data)
+{
+    return [&data](unsigned char *buf, std::size_t len, std::int64_t addr) -> std::size_t
+    {
+        if (addr >= std::int64_t(data.size()))
+            return 0;
+        std::size_t nn = std::min(len, std::size_t(data.size() - addr));
+        std::memcpy(buf, data.data() + addr, nn);
+        return nn;
+    };
+}
+
+static std::vector<anchored_diff::block> diff(const bytes &aa, const bytes &bb)
+{
+    anchored_diff dd(reader(aa), aa.size(), reader(bb), bb.size());
+    REQUIRE(dd.run());
+    return dd.blocks();
+}
+
+// Applies the differences to B and checks that the result is A
+static void check_rebuild(const bytes &aa, const bytes &bb, const std::vector<anchored_diff::block> &blocks)
+{
+    bytes result;
+    std::int64_t pb = 0;
+    for (const auto &blk : blocks)
+    {
+        REQUIRE(blk.b >= pb);
+        result.insert(result.end(), bb.begin() + std::size_t(pb), bb.begin() + std::size_t(blk.b));
+        pb = blk.b;
+        if (blk.kind != anchored_diff::KIND_DELETE)
+            result.insert(result.end(), aa.begin() + std::size_t(blk.a), aa.begin() + std::size_t(blk.a + blk.len));
+        if (blk.kind != anchored_diff::KIND_INSERT)
+            pb += blk.len;
+        CHECK(std::int64_t(result.size()) == blk.a + (blk.kind == anchored_diff::KIND_DELETE ? 0 : blk.len));
+    }
+    result.insert(result.end(), bb.begin() + std::size_t(pb), bb.end());
+    CHECK(result == aa);
+}
+
+TEST_CASE("anchored_diff chunks")
+{
+    bytes data = random_bytes(4 * 1024 * 1024, 1);
+    std::vector<anchored_diff::chunk> chunks;
+    REQUIRE(anchored_diff::make_chunks(reader(data), data.size(), chunks));
+
+    std::int64_t next = 0;
+    for (std::size_t ii = 0; ii < chunks.size(); ++ii)
+    {
+        CHECK(chunks[ii].start == next);
+        CHECK(chunks[ii].len <= anchored_diff::MAX_CHUNK);
+        if (ii + 1 < chunks.size())
+            CHECK(chunks[ii].len >= anchored_diff::MIN_CHUNK);
+        next += chunks[ii].len;
+    }
+    CHECK(next == std::int64_t(data.size()));
+
+    // Average chunk size should be about MIN_CHUNK + 2^AVG_BITS
+    double avg = double(data.size()) / chunks.size();
+    CHECK(avg > 6000.0);
+    CHECK(avg < 14000.0);
+
+    SECTION("boundaries after an insertion are unchanged")
+    {
+        bytes other(data.begin(), data.begin() + 1000000);
+        bytes extra = random_bytes(777, 2);
+        other.insert(other.end(), extra.begin(), extra.end());
+        other.insert(other.end(), data.begin() + 1000000, data.end());
+        std::vector<anchored_diff::chunk> chunks2;
+        REQUIRE(anchored_diff::make_chunks(reader(other), other.size(), chunks2));
+
+        std::size_t same = 0;
+        for (const auto &cc : chunks)
+            if (cc.start > 1000000 + anchored_diff::MAX_CHUNK)
+                same += std::count_if(chunks2.begin(), chunks2.end(), [&](const anchored_diff::chunk &c2)
+                    { return c2.start == cc.start + 777 && c2.len == cc.len && c2.hash == cc.hash; });
+        std::size_t after = std::count_if(chunks.begin(), chunks.end(), [](const anchored_diff::chunk &cc)
+            { return cc.start > 1000000 + anchored_diff::MAX_CHUNK; });
+        CHECK(same == after);
+    }
+}
+
+TEST_CASE("anchored_diff identical and empty files")
+{
+    bytes data = random_bytes(300000, 3);
+    CHECK(diff(data, data).empty());
+    CHECK(diff(bytes(), bytes()).empty());
+
+    auto blocks = diff(data, bytes());
+    REQUIRE(blocks.size() == 1);
+    CHECK(blocks[0].kind == anchored_diff::KIND_INSERT);
+    CHECK(blocks[0].len == std::int64_t(data.size()));
+}
+
+TEST_CASE("anchored_diff replacements")
+{
+    bytes bb = random_bytes(500000, 4);
+    bytes aa = bb;
+    aa[10] ^= 1;
+    aa[200000] ^= 0xFF;
+    aa[200001] ^= 0xFF;
+    auto blocks = diff(aa, bb);
+
+    REQUIRE(blocks.size() == 2);
+    CHECK(blocks[0].kind == anchored_diff::KIND_REPLACE);
+    CHECK(blocks[0].a == 10);
+    CHECK(blocks[0].len == 1);
+    CHECK(blocks[1].kind == anchored_diff::KIND_REPLACE);
+    CHECK(blocks[1].a == 200000);
+    CHECK(blocks[1].b == 200000);
+    CHECK(blocks[1].len == 2);
+    check_rebuild(aa, bb, blocks);
+}
+
+TEST_CASE("anchored_diff large insertion and deletion")
+{
+    bytes bb = random_bytes(3 * 1024 * 1024, 5);
+    bytes extra = random_bytes(1024 * 1024 + 13, 6);
+    bytes aa(bb.begin(), bb.begin() + 1234567);
+    aa.insert(aa.end(), extra.begin(), extra.end());
+    aa.insert(aa.end(), bb.begin() + 1234567, bb.end());
+
+    SECTION("insertion")
+    {
+        auto blocks = diff(aa, bb);
+        REQUIRE(blocks.size() == 1);
+        CHECK(blocks[0].kind == anchored_diff::KIND_INSERT);
+        CHECK(blocks[0].a == 1234567);
+        CHECK(blocks[0].b == 1234567);
+        CHECK(blocks[0].len == std::int64_t(extra.size()));
+        check_rebuild(aa, bb, blocks);
+    }
+
+    SECTION("deletion")
+    {
+        auto blocks = diff(bb, aa);
+        REQUIRE(blocks.size() == 1);
+        CHECK(blocks[0].kind == anchored_diff::KIND_DELETE);
+        CHECK(blocks[0].a == 1234567);
+        CHECK(blocks[0].b == 1234567);
+        CHECK(blocks[0].len == std::int64_t(extra.size()));
+        check_rebuild(bb, aa, blocks);
+    }
+}
+
+TEST_CASE("anchored_diff moved block")
+{
+    // Move 200 KB from near the start to near the end
+    bytes bb = random_bytes(2 * 1024 * 1024, 7);
+    const std::size_t from = 100000, len = 200000, to = 1800000;
+    bytes aa(bb.begin(), bb.begin() + from);
+    aa.insert(aa.end(), bb.begin() + from + len, bb.begin() + to);
+    aa.insert(aa.end(), bb.begin() + from, bb.begin() + from + len);
+    aa.insert(aa.end(), bb.begin() + to, bb.end());
+    REQUIRE(aa.size() == bb.size());
+
+    auto blocks = diff(aa, bb);
+    REQUIRE(blocks.size() == 2);
+    CHECK(blocks[0].kind == anchored_diff::KIND_DELETE);
+    CHECK(blocks[0].b == std::int64_t(from));
+    CHECK(blocks[0].len == std::int64_t(len));
+    CHECK(blocks[1].kind == anchored_diff::KIND_INSERT);
+    CHECK(blocks[1].a == std::int64_t(to - len));
+    CHECK(blocks[1].len == std::int64_t(len));
+    check_rebuild(aa, bb, blocks);
+}
+
+TEST_CASE("anchored_diff mixed changes and runs of zeroes")
+{
+    bytes bb = random_bytes(1500000, 8);
+    std::fill(bb.begin() + 400000, bb.begin() + 800000, 0);
+    bytes aa = bb;
+    aa.erase(aa.begin() + 600000, aa.begin() + 650000);     // some of the zeroes
+    aa.insert(aa.begin() + 1000000, 5000, 0x55);
+    aa[1200000] = ~aa[1200000];
+    aa.insert(aa.begin() + 100, 3, 0xAA);
+
+    check_rebuild(aa, bb, diff(aa, bb));
+    check_rebuild(bb, aa, diff(bb, aa));
+}
+
+TEST_CASE("anchored_diff abort")
+{
+    bytes data = random_bytes(300000, 9);
+    anchored_diff dd(reader(data), data.size(), reader(data), data.size());
+    double last = -1.0;
+    CHECK(!dd.run([&](double done) { CHECK(done >= last); last = done; return done < 0.5; }));
+}
+
+TEST_CASE("anchored_diff - benchmarks", "[!benchmark]")
+{
+    bytes bb = random_bytes(64 * 1024 * 1024, std::random_device{}());
+    bytes extra = random_bytes(4 * 1024 * 1024, 10);
+    bytes aa(bb.begin(), bb.begin() + bb.size() / 3);
+    aa.insert(aa.end(), extra.begin(), extra.end());
+    aa.insert(aa.end(), bb.begin() + bb.size() / 3, bb.end());
+
+    auto start = std::chrono::steady_clock::now();
+    auto blocks = diff(aa, bb);
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    CHECK(blocks.size() == 1);
+    WARN("anchored compare: " << double(aa.size() + bb.size()) / secs.count() / 1e9 << " GB/s");
+}
@@ -0,0 +1,202 @@
+#include "Stdafx.h"
+
+#include "BinaryPatch.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+static bytes random_bytes(std::size_t len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    bytes buf(len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    return buf;
+}
+
+static binary_patch::reader_t reader(const bytes &data)
+{
+    return [&data](unsigned char *buf, std::size_t len, std::int64_t addr) -> std::size_t
+    {
+        if (addr >= std::int64_t(data.size()))
+            return 0;
+        std::size_t nn = std::min(len, std::size_t(data.size() - addr));
+        std::memcpy(buf, data.data() + addr, nn);
+        return nn;
+    };
+}
+
+static std::string make_delta(const bytes &old_data, const bytes &new_data, bool compress)
+{
+    std::ostringstream delta(std::ios::binary);
+    REQUIRE(binary_patch::make(reader(old_data), old_data.size(), reader(new_data), new_data.size(), delta, compress) ==
+            binary_patch::STATUS_OK);
+    return delta.str();
+}
+
+static binary_patch::status_t apply_delta(const bytes &old_data, const std::string &delta, bytes &result)
+{
+    std::istringstream is(delta, std::ios::binary);
+    std::ostringstream os(std::ios::binary);
+    binary_patch::status_t retval = binary_patch::apply(reader(old_data), old_data.size(), is, os);
+    std::string ss = os.str();
+    result.assign(ss.begin(), ss.end());
+    return retval;
+}
+
+TEST_CASE("binary_patch round trip")
+{
+    bytes old_data = random_bytes(2000000, 1);
+    bytes new_data = old_data;
+    bytes extra = random_bytes(5000, 2);
+    new_data.insert(new_data.begin() + 300000, extra.begin(), extra.end());    // insertion
+    new_data.erase(new_data.begin() + 900000, new_data.begin() + 950000);       // deletion
+    new_data[1500000] ^= 0xFF;                                                  // replacements
+    new_data[1500005] ^= 0xFF;
+    std::fill(new_data.end() - 1000, new_data.end(), 0);
+
+    for (bool compress : { false, true })
+    {
+        std::string delta = make_delta(old_data, new_data, compress);
+        CHECK(delta.size() < 10000);
+
+        bytes result;
+        CHECK(apply_delta(old_data, delta, result) == binary_patch::STATUS_OK);
+        CHECK(result == new_data);
+
+        std::istringstream is(delta, std::ios::binary);
+        binary_patch::header hdr;
+        REQUIRE(binary_patch::read_header(is, hdr) == binary_patch::STATUS_OK);
+        CHECK(hdr.flags == (compress ? unsigned(binary_patch::FLAG_COMPRESSED) : 0));
+        CHECK(hdr.len_old == std::int64_t(old_data.size()));
+        CHECK(hdr.len_new == std::int64_t(new_data.size()));
+    }
+
+    SECTION("unrelated and empty files")
+    {
+        bytes other = random_bytes(100000, 3), empty;
+        bytes result;
+        CHECK(apply_delta(other, make_delta(other, new_data, true), result) == binary_patch::STATUS_OK);
+        CHECK(result == new_data);
+        CHECK(apply_delta(empty, make_delta(empty, other, false), result) == binary_patch::STATUS_OK);
+        CHECK(result == other);
+        CHECK(apply_delta(other, make_delta(other, empty, false), result) == binary_patch::STATUS_OK);
+        CHECK(result.empty());
+    }
+
+    SECTION("errors")
+    {
+        std::string delta = make_delta(old_data, new_data, false);
+        bytes result;
+
+        bytes wrong = old_data;
+        wrong[12345] ^= 1;
+        CHECK(apply_delta(wrong, delta, result) == binary_patch::STATUS_WRONG_SOURCE);
+        CHECK(result.empty());
+        CHECK(apply_delta(bytes(old_data.begin(), old_data.end() - 1), delta, result) == binary_patch::STATUS_WRONG_SOURCE);
+
+        CHECK(apply_delta(old_data, "not a delta", result) == binary_patch::STATUS_BAD_DELTA);
+        CHECK(apply_delta(old_data, delta.substr(0, delta.size() - 10), result) == binary_patch::STATUS_BAD_DELTA);
+
+        std::string bad = delta;
+        bad[bad.size() - 1] ^= 1;       // CRC of the new file
+        CHECK(apply_delta(old_data, bad, result) == binary_patch::STATUS_BAD_RESULT);
+
+        std::string zdelta = make_delta(old_data, new_data, true);
+        zdelta[zdelta.size()/2] ^= 0x55;
+        CHECK(apply_delta(old_data, zdelta, result) != binary_patch::STATUS_OK);
+    }
+
+    SECTION("abort")
+    {
+        std::ostringstream delta(std::ios::binary);
+        CHECK(binary_patch::make(reader(old_data), old_data.size(), reader(new_data), new_data.size(), delta, false,
+                                 [](double done) { return done < 0.5; }) == binary_patch::STATUS_ABORTED);
+    }
+}
+
+// Pseudo-random file contents generated from the address (so that huge files need no memory)
+static void gen_bytes(unsigned char *buf, std::size_t len, std::int64_t addr)
+{
+    for (std::size_t ii = 0; ii < len; )
+    {
+        std::uint64_t zz = std::uint64_t((addr + ii) >> 3) * 0x9E3779B97F4A7C15ULL;
+        zz = (zz ^ (zz >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        zz = (zz ^ (zz >> 27)) * 0x94D049BB133111EBULL;
+        zz ^= zz >> 31;
+        for (int bb = int((addr + ii) & 7); bb < 8 && ii < len; ++bb, ++ii)
+            buf[ii] = static_cast<unsigned char>(zz >> (8 * bb));
+    }
+}
+
+// Stream buffer that throws away what is written (apply checks the CRC anyway)
+class null_buf : public std::streambuf
+{
+protected:
+    std::streamsize xsputn(const char *, std::streamsize nn) override { return nn; }
+    int_type overflow(int_type cc) override { return traits_type::not_eof(cc); }
+};
+
+TEST_CASE("binary_patch - benchmarks", "[!benchmark]")
+{
+    const std::int64_t len_old = 2LL * 1024 * 1024 * 1024;
+    const std::int64_t ins_at = len_old / 3, ins_len = 100000;
+    const std::int64_t del_at = 2 * len_old / 3, del_len = 250000;
+    const std::int64_t len_new = len_old + ins_len - del_len;
+
+    binary_patch::reader_t read_old = [](unsigned char *buf, std::size_t len, std::int64_t addr) -> std::size_t
+    {
+        gen_bytes(buf, len, addr);
+        return len;
+    };
+    // The new file has bytes inserted at ins_at, deleted at del_at and a few changes near the end
+    binary_patch::reader_t read_new = [=](unsigned char *buf, std::size_t len, std::int64_t addr) -> std::size_t
+    {
+        len = std::size_t(std::min<std::int64_t>(len, len_new - addr));
+        for (std::size_t ii = 0; ii < len; )
+        {
+            std::int64_t aa = addr + ii, end, offset;
+            if (aa < ins_at)
+                end = ins_at, offset = 0;
+            else if (aa < ins_at + ins_len)
+                end = ins_at + ins_len, offset = 0x1000000000LL;
+            else if (aa < del_at)
+                end = del_at, offset = -ins_len;
+            else
+                end = len_new, offset = del_len - ins_len;
+            std::size_t nn = std::size_t(std::min<std::int64_t>(end - aa, len - ii));
+            gen_bytes(buf + ii, nn, aa + offset);
+            ii += nn;
+        }
+        for (std::int64_t aa = (addr + 1000002) / 1000003 * 1000003; aa < addr + std::int64_t(len); aa += 1000003)
+            if (aa >= del_at)
+                buf[aa - addr] ^= 1;
+        return len;
+    };
+
+    std::ostringstream delta(std::ios::binary);
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(binary_patch::make(read_old, len_old, read_new, len_new, delta, true) == binary_patch::STATUS_OK);
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    WARN("make delta of 2 GB files: " << double(len_old + len_new) / secs.count() / 1e9 << " GB/s, delta " <<
+         delta.str().size() << " bytes");
+
+    std::istringstream is(delta.str(), std::ios::binary);
+    null_buf nb;
+    std::ostream os(&nb);
+    start = std::chrono::steady_clock::now();
+    REQUIRE(binary_patch::apply(read_old, len_old, is, os) == binary_patch::STATUS_OK);
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("apply delta: " << double(len_new) / secs.count() / 1e9 << " GB/s");
+}
@@ -0,0 +1,141 @@
+#include "Stdafx.h"
+#include "utils/TestFiles.h"
+
+#include "BlockStorage.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+static bytes random_bytes(std::size_t len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    bytes buf(len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    return buf;
+}
+
+static std::string mutable_file()
+{
+    return std::string(static_cast<LPCTSTR>(TestFiles::GetMutableFilePath()));
+}
+
+TEST_CASE("block_storage")
+{
+    std::uint32_t error = 0;
+    std::unique_ptr<block_storage> storage(block_storage::open(mutable_file(), block_storage::OPEN_WRITE, &error));
+    REQUIRE(storage);
+    CHECK(error == 0);
+    CHECK(!storage->is_device());
+    CHECK(storage->sector_size() == 1);
+
+    REQUIRE(storage->set_length(0));
+    CHECK(storage->length() == 0);
+
+    SECTION("read and write")
+    {
+        bytes data = random_bytes(100000, 1);
+        REQUIRE(storage->write(0, data.data(), data.size()) == data.size());
+        REQUIRE(storage->flush());
+        CHECK(storage->length() == 100000);
+
+        bytes buf(1000);
+        REQUIRE(storage->read(5000, buf.data(), buf.size()) == buf.size());
+        CHECK(std::equal(buf.begin(), buf.end(), data.begin() + 5000));
+
+        // Read past the end returns what there is
+        CHECK(storage->read(99500, buf.data(), buf.size()) == 500);
+        CHECK(storage->read(200000, buf.data(), buf.size()) == 0);
+        CHECK(storage->last_error() == 0);
+
+        storage->advise(0, 100000, block_storage::ACCESS_SEQUENTIAL);
+        REQUIRE(storage->set_length(50000));
+        CHECK(storage->length() == 50000);
+    }
+
+    SECTION("allocated ranges")
+    {
+        // Only sparse files (all that support holes on Linux, only those marked sparse on Windows) know
+        REQUIRE(storage->set_length(4 * 1024 * 1024));
+        REQUIRE(storage->write(1024 * 1024, "123456789", 9) == 9);
+        block_storage::ranges_t ranges;
+        if (storage->allocated_ranges(0, storage->length(), ranges))
+        {
+            bool has_written = false;
+            for (const auto &rr : ranges)
+            {
+                CHECK(rr.first < rr.second);
+                if (rr.first <= 1024 * 1024 && 1024 * 1024 + 9 <= rr.second)
+                    has_written = true;
+            }
+            CHECK(has_written);
+        }
+    }
+
+    SECTION("sector_reader")
+    {
+        bytes data = random_bytes(256 * 1024, 2);
+        REQUIRE(storage->write(0, data.data(), data.size()) == data.size());
+
+        storage_device dev(storage.get());
+        sector_reader reader(&dev, 16 * 1024);
+        aligned_buffer buf(data.size(), 4096);
+        REQUIRE(reader.read(0, buf.data(), buf.size()));
+        CHECK(std::equal(data.begin(), data.end(), buf.data()));
+        CHECK(reader.bad().empty());
+    }
+
+    SECTION("direct")
+    {
+        bytes data = random_bytes(64 * 1024, 3);
+        REQUIRE(storage->write(0, data.data(), data.size()) == data.size());
+        storage.reset();
+
+        std::unique_ptr<block_storage> direct(block_storage::open(mutable_file(), block_storage::OPEN_DIRECT, &error));
+        REQUIRE(direct);
+        std::size_t sec_size = direct->sector_size();
+        REQUIRE(sec_size > 1);
+        aligned_buffer buf(4 * sec_size, sec_size);
+        REQUIRE(direct->read(sec_size, buf.data(), buf.size()) == buf.size());
+        CHECK(std::equal(buf.data(), buf.data() + buf.size(), data.begin() + sec_size));
+    }
+}
+
+TEST_CASE("block_storage - benchmarks", "[!benchmark]")
+{
+    const std::size_t len = 256 * 1024 * 1024, block = 1024 * 1024;
+    std::unique_ptr<block_storage> storage(block_storage::open(mutable_file(), block_storage::OPEN_WRITE));
+    REQUIRE(storage);
+    bytes data = random_bytes(block, 4);
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t addr = 0; addr < len; addr += block)
+        REQUIRE(storage->write(addr, data.data(), block) == block);
+    REQUIRE(storage->flush());
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    WARN("write: " << double(len) / secs.count() / 1e9 << " GB/s");
+    storage.reset();
+
+    for (int flags : { int(block_storage::OPEN_SEQUENTIAL), int(block_storage::OPEN_DIRECT) })
+    {
+        storage.reset(block_storage::open(mutable_file(), flags));
+        REQUIRE(storage);
+        aligned_buffer buf(block, 4096);
+        start = std::chrono::steady_clock::now();
+        for (std::size_t addr = 0; addr < len; addr += block)
+            REQUIRE(storage->read(addr, buf.data(), block) == block);
+        secs = std::chrono::steady_clock::now() - start;
+        WARN((flags == block_storage::OPEN_DIRECT ? "direct" : "cached") << " read: " << double(len) / secs.count() / 1e9 << " GB/s");
+    }
+    storage.reset(block_storage::open(mutable_file(), block_storage::OPEN_WRITE));
+    REQUIRE(storage);
+    storage->set_length(0);
+}
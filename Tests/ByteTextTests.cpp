@@ -0,0 +1,171 @@
+#include "Stdafx.h"
+
+#include "ByteText.h"
+#include "Misc.h"
+
+#include <catch.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+static bytes random_bytes(std::size_t len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    bytes buf(len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    return buf;
+}
+
+// The way hex text was made before
+static std::string old_hex_bytes(const bytes &buf, std::size_t len, bool upper)
+{
+    const char *hex = upper ? "0123456789ABCDEF?" : "0123456789abcdef?";
+    std::string ss;
+    for (std::size_t ii = 0; ii < len; ++ii)
+    {
+        ss += hex[(buf[ii]>>4)&0xF];
+        ss += hex[buf[ii]&0xF];
+        ss += ' ';
+    }
+    return ss;
+}
+
+static std::string hex_string(const bytes &buf, std::size_t len, bool upper)
+{
+    std::vector<char> out(3*len + 1);
+    char *end = hex_bytes(out.data(), buf.data(), len, upper);
+    return std::string(out.data(), end);
+}
+
+static std::string hex_number(std::uint64_t val, int width, bool upper)
+{
+    char out[40];
+    return std::string(out, format_hex(out, val, width, upper));
+}
+
+static std::string dec_number(std::int64_t val, int width)
+{
+    char out[40];
+    return std::string(out, format_dec(out, val, width));
+}
+
+static std::string printf_string(const char *format, int width, long long val)
+{
+    char out[40];
+    snprintf(out, sizeof(out), format, width, val);
+    return out;
+}
+
+TEST_CASE("byte_text")
+{
+    SECTION("tables")
+    {
+        for (int ii = 0; ii < 256; ++ii)
+        {
+            char ss[4];
+            snprintf(ss, sizeof(ss), "%02X", ii);
+            CHECK(std::string(hex_text((unsigned char)ii, true), 2) == ss);
+            snprintf(ss, sizeof(ss), "%02x", ii);
+            CHECK(std::string(hex_text((unsigned char)ii, false), 2) == ss);
+        }
+        for (int ii = 0; ii < 100; ++ii)
+        {
+            char ss[4];
+            snprintf(ss, sizeof(ss), "%02d", ii);
+            CHECK(std::string(dec_text(ii), 2) == ss);
+        }
+    }
+
+    SECTION("hex_bytes")
+    {
+        bytes buf = random_bytes(1000, 1);
+        simd_t saved = GetSimdLevel();
+        for (std::size_t len = 0; len < 100; ++len)
+        {
+            for (bool upper : { true, false })
+            {
+                std::string expected = old_hex_bytes(buf, len, upper);
+                CHECK(hex_string(buf, len, upper) == expected);     // SIMD if available
+                SetSimdLevel(SIMD_SSE2);
+                CHECK(hex_string(buf, len, upper) == expected);     // tables only
+                SetSimdLevel(saved);
+            }
+        }
+        CHECK(hex_string(buf, buf.size(), true) == old_hex_bytes(buf, buf.size(), true));
+    }
+
+    SECTION("format_hex")
+    {
+        const std::uint64_t vals[] = { 0, 1, 0xF, 0x10, 0xAB, 0x100, 0x1234, 0xABCDE, 0x7FFFFFFF, 0x123456789ULL,
+                                       0x7FFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL };
+        for (std::uint64_t val : vals)
+        {
+            for (int width : { 0, 1, 2, 5, 8, 16, 20 })
+            {
+                CHECK(hex_number(val, width, true) == printf_string("%0*llX", width, (long long)val));
+                CHECK(hex_number(val, width, false) == printf_string("%0*llx", width, (long long)val));
+            }
+        }
+    }
+
+    SECTION("format_dec")
+    {
+        const std::int64_t vals[] = { 0, 1, 9, 10, 99, 100, 101, 12345, -1, -10, -12345, 1000000000000LL,
+                                      INT64_MAX, INT64_MIN };
+        for (std::int64_t val : vals)
+            for (int width : { 0, 1, 3, 6, 10, 25 })
+                CHECK(dec_number(val, width) == printf_string("%*lld", width, (long long)val));
+    }
+}
+
+TEST_CASE("byte_text - benchmarks", "[!benchmark]")
+{
+    const int row_len = 64;
+    bytes buf = random_bytes(64 * 1024 * 1024, 2);
+    std::vector<char> out(3 * buf.size());
+
+    auto start = std::chrono::steady_clock::now();
+    std::size_t total = 0;
+    const char *hex = "0123456789ABCDEF?";
+    for (std::size_t row = 0; row < buf.size(); row += row_len)
+    {
+        char *pout = out.data();
+        for (const unsigned char *pin = &buf[row]; pin < &buf[row] + row_len; ++pin)
+        {
+            *pout++ = hex[(*pin>>4)&0xF];
+            *pout++ = hex[*pin&0xF];
+            *pout++ = ' ';
+        }
+        total += out[0];
+    }
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    WARN("hex digits string: " << buf.size() / secs.count() / 1e9 << " GB/s");
+
+    start = std::chrono::steady_clock::now();
+    for (std::size_t row = 0; row < buf.size(); row += row_len)
+        total += *hex_bytes(out.data(), &buf[row], row_len, true);
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("hex_bytes: " << buf.size() / secs.count() / 1e9 << " GB/s");
+
+    const int count = 10000000;
+    char addr[40];
+    start = std::chrono::steady_clock::now();
+    for (int ii = 0; ii < count; ++ii)
+        total += snprintf(addr, sizeof(addr), "%0*llX:", 10, (long long)ii * 64);
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("sprintf address: " << count / secs.count() / 1e6 << " M/s");
+
+    start = std::chrono::steady_clock::now();
+    for (int ii = 0; ii < count; ++ii)
+        total += format_hex(addr, std::uint64_t(ii) * 64, 10, true) - addr;
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("format_hex address: " << count / secs.count() / 1e6 << " M/s");
+    CHECK(total != 0);      // so the loops are not optimised away
+}
@@ -7,6 +7,8 @@
 #include <catch.hpp>
 
 #include <cstdint>
+#include <utility>
+#include <vector>
 
 TEST_CASE("CFile64::CFile64()")
 {
@@ -231,6 +233,41 @@ TEST_CASE("CFile64 Write")
     }
 }
 
+TEST_CASE("CFile64 position")
+{
+    CFile64 file{ TestFiles::Get256FilePath(), CFile64::modeRead };
+    uint8_t buffer[16];
+
+    // Reads carry on from the end of the previous read and stop at end of file
+    REQUIRE(file.Seek(250, CFile64::begin) == 250);
+    CHECK(file.Read(buffer, 4) == 4);
+    CHECK(buffer[0] == 250);
+    CHECK(file.Read(buffer, 16) == 2);
+    CHECK(buffer[0] == 254);
+    CHECK(file.GetPosition() == 256);
+    CHECK(file.Read(buffer, 16) == 0);
+
+    CHECK(file.Seek(-6, CFile64::current) == 250);
+    CHECK(file.Seek(-6, CFile64::end) == 250);
+    CHECK(file.Seek(300, CFile64::begin) == 300);   // past the end is OK
+    CHECK(file.Read(buffer, 16) == 0);
+    CHECK(file.GetPosition() == 300);
+
+    // but not before the start
+    bool thrown = false;
+    try
+    {
+        file.Seek(-1, CFile64::begin);
+    }
+    catch (CFileException* ex)
+    {
+        thrown = true;
+        ex->Delete();
+    }
+    CHECK(thrown);
+    CHECK(file.GetPosition() == 300);
+}
+
 TEST_CASE("CFile64::SetLength")
 {
     CFile64 file{ TestFiles::GetMutableFilePath(), CFile64::modeReadWrite };
@@ -241,3 +278,49 @@ TEST_CASE("CFile64::SetLength")
     file.SetLength(0);
     REQUIRE(file.GetLength() == 0);
 }
+
+TEST_CASE("CFile64::GetAllocatedRanges")
+{
+    std::vector<std::pair<LONGLONG, LONGLONG> > ranges;
+
+    SECTION("not sparse")
+    {
+        CFile64 file{ TestFiles::Get256FilePath(), CFile64::modeRead };
+        CHECK(file.GetAllocatedRanges(0, 256, ranges) == FALSE);
+        CHECK(ranges.empty());
+    }
+
+    SECTION("sparse")
+    {
+        CFile64 file{ TestFiles::GetMutableFilePath(), CFile64::modeReadWrite };
+        file.SetLength(0);
+
+        DWORD returned;
+        REQUIRE(::DeviceIoControl(file.GetHandle(), FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL) != FALSE);
+        const LONGLONG len = 4 * 1024 * 1024;
+        file.SetLength(len);
+        file.Seek(1024 * 1024, CFile64::begin);
+        file.Write("123456789", 9);
+        file.Flush();
+
+        REQUIRE(file.GetAllocatedRanges(0, len, ranges) == TRUE);
+        REQUIRE(!ranges.empty());
+
+        // Only the area around what was written has disk space
+        LONGLONG allocated = 0, prev_end = 0;
+        bool has_written = false;
+        for (const auto &rr : ranges)
+        {
+            CHECK(rr.first >= prev_end);
+            CHECK(rr.second > rr.first);
+            allocated += rr.second - rr.first;
+            if (rr.first <= 1024 * 1024 && 1024 * 1024 + 9 <= rr.second)
+                has_written = true;
+            prev_end = rr.second;
+        }
+        CHECK(has_written);
+        CHECK(allocated <= len / 8);
+
+        file.SetLength(0);
+    }
+}
@@ -0,0 +1,196 @@
+#include "Stdafx.h"
+
+#include "DiffIndex.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+typedef diff_index::addr_vec addr_vec;
+
+// Differences of one file as separate vectors (as kept by CHexEditDoc::CompResult)
+struct diff_vecs
+{
+    addr_vec rep_this, rep_other, rep_len;
+    addr_vec ins_this, ins_other, ins_len;
+    addr_vec del_this, del_other, del_len;
+
+    void build(diff_index &di) const
+    {
+        di.build(rep_this, rep_other, rep_len, ins_this, ins_other, ins_len, del_this, del_other, del_len);
+    }
+};
+
+// Makes random non-overlapping diffs, with some at the same address
+static diff_vecs random_diffs(std::size_t count, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    diff_vecs dv;
+    std::int64_t addr = 0;
+    for (std::size_t ii = 0; ii < count; ++ii)
+    {
+        addr += rng() % 100;
+        std::int64_t len = 1 + rng() % 20;
+        switch (rng() % 3)
+        {
+        case 0:
+            dv.rep_this.push_back(addr); dv.rep_other.push_back(addr + 7); dv.rep_len.push_back(len);
+            addr += len;
+            break;
+        case 1:
+            dv.ins_this.push_back(addr); dv.ins_other.push_back(addr + 7); dv.ins_len.push_back(len);
+            addr += len;
+            break;
+        case 2:
+            dv.del_this.push_back(addr); dv.del_other.push_back(addr + 7); dv.del_len.push_back(len);
+            break;
+        }
+    }
+    return dv;
+}
+
+// Finds the next diff the way it used to be done (look in each vector and take the closest)
+static std::pair<std::int64_t, std::int64_t> old_next(const diff_vecs &dv, std::int64_t from)
+{
+    std::pair<std::int64_t, std::int64_t> retval(INT64_MAX, 0);
+    std::size_t idx;
+    if ((idx = std::upper_bound(dv.rep_this.begin(), dv.rep_this.end(), from) - dv.rep_this.begin()) < dv.rep_this.size())
+        retval = { dv.rep_this[idx], dv.rep_len[idx] };
+    if ((idx = std::upper_bound(dv.ins_this.begin(), dv.ins_this.end(), from) - dv.ins_this.begin()) < dv.ins_this.size() &&
+        dv.ins_this[idx] < retval.first)
+        retval = { dv.ins_this[idx], -dv.ins_len[idx] };
+    if ((idx = std::upper_bound(dv.del_this.begin(), dv.del_this.end(), from) - dv.del_this.begin()) < dv.del_this.size() &&
+        dv.del_this[idx] < retval.first)
+        retval = { dv.del_this[idx], 0 };
+    if (retval.first == INT64_MAX)
+        retval.first = -1;
+    return retval;
+}
+
+static std::pair<std::int64_t, std::int64_t> old_prev(const diff_vecs &dv, std::int64_t from)
+{
+    std::pair<std::int64_t, std::int64_t> retval(-1, 0);
+    std::ptrdiff_t idx;
+    if ((idx = std::upper_bound(dv.rep_this.begin(), dv.rep_this.end(), from) - dv.rep_this.begin() - 1) >= 0)
+        retval = { dv.rep_this[idx], dv.rep_len[idx] };
+    if ((idx = std::upper_bound(dv.ins_this.begin(), dv.ins_this.end(), from) - dv.ins_this.begin() - 1) >= 0 &&
+        dv.ins_this[idx] > retval.first)
+        retval = { dv.ins_this[idx], -dv.ins_len[idx] };
+    if ((idx = std::upper_bound(dv.del_this.begin(), dv.del_this.end(), from) - dv.del_this.begin() - 1) >= 0 &&
+        dv.del_this[idx] > retval.first)
+        retval = { dv.del_this[idx], 0 };
+    return retval;
+}
+
+static std::pair<std::int64_t, std::int64_t> result(const diff_index::extent *pe)
+{
+    if (pe == NULL)
+        return { -1, 0 };
+    return { pe->addr, pe->diff_len() };
+}
+
+TEST_CASE("diff_index empty")
+{
+    diff_index di;
+    diff_vecs().build(di);
+    CHECK(di.empty());
+    CHECK(di.first() == NULL);
+    CHECK(di.last() == NULL);
+    CHECK(di.next(-1) == NULL);
+    CHECK(di.prev(100) == NULL);
+}
+
+TEST_CASE("diff_index order and types")
+{
+    diff_vecs dv;
+    dv.rep_this = { 10, 50 };  dv.rep_other = { 10, 40 };  dv.rep_len = { 5, 2 };
+    dv.ins_this = { 20 };      dv.ins_other = { 20 };      dv.ins_len = { 10 };
+    dv.del_this = { 50, 60 };  dv.del_other = { 42, 52 };  dv.del_len = { 3, 4 };
+    diff_index di;
+    dv.build(di);
+
+    REQUIRE(di.size() == 5);
+    CHECK(di[0].kind == diff_index::KIND_REPLACE);
+    CHECK(di[1].kind == diff_index::KIND_INSERT);
+    CHECK(di[1].other == 20);
+    CHECK(di[2].kind == diff_index::KIND_REPLACE);      // replacement before deletion at same address
+    CHECK(di[3].kind == diff_index::KIND_DELETE);
+    CHECK(di[3].addr == 50);
+    CHECK(di[3].len == 3);
+
+    CHECK(result(di.first()) == std::make_pair<std::int64_t, std::int64_t>(10, 5));
+    CHECK(result(di.last()) == std::make_pair<std::int64_t, std::int64_t>(60, 0));
+    CHECK(result(di.next(10)) == std::make_pair<std::int64_t, std::int64_t>(20, -10));
+    CHECK(result(di.next(49)) == std::make_pair<std::int64_t, std::int64_t>(50, 2));
+    CHECK(di.next(60) == NULL);
+    CHECK(result(di.prev(50)) == std::make_pair<std::int64_t, std::int64_t>(50, 2));
+    CHECK(result(di.prev(49)) == std::make_pair<std::int64_t, std::int64_t>(20, -10));
+    CHECK(di.prev(9) == NULL);
+}
+
+TEST_CASE("diff_index matches separate vectors")
+{
+    diff_vecs dv = random_diffs(10000, 1);
+    diff_index di;
+    dv.build(di);
+    REQUIRE(di.size() == 10000);
+
+    CHECK(result(di.first()) == old_next(dv, -1));
+    CHECK(result(di.last()) == old_prev(dv, INT64_MAX));
+    std::int64_t end = di.last()->addr + 100;
+    for (std::int64_t from = -1; from < end; from += 3)
+    {
+        CHECK(result(di.next(from)) == old_next(dv, from));
+        CHECK(result(di.prev(from)) == old_prev(dv, from));
+    }
+}
+
+TEST_CASE("diff_index merge")
+{
+    diff_vecs dv0, dv1;
+    dv0.rep_this = { 10, 30 };  dv0.rep_other = dv0.rep_this;  dv0.rep_len = { 1, 1 };
+    dv1.rep_this = { 5, 30 };   dv1.rep_other = dv1.rep_this;  dv1.rep_len = { 2, 2 };
+    dv1.del_this = { 40 };      dv1.del_other = dv1.del_this;  dv1.del_len = { 1 };
+    diff_index d0, d1, all;
+    dv0.build(d0);
+    dv1.build(d1);
+    all.merge({ &d0, &d1 });
+
+    REQUIRE(all.size() == 5);
+    CHECK(result(all.first()) == std::make_pair<std::int64_t, std::int64_t>(5, 2));
+    CHECK(all.first()->rev == 1);
+    CHECK(result(all.next(5)) == std::make_pair<std::int64_t, std::int64_t>(10, 1));
+    CHECK(all.next(10)->rev == 0);                      // most recent revision first at same address
+    CHECK(result(all.prev(39)) == std::make_pair<std::int64_t, std::int64_t>(30, 1));
+    CHECK(result(all.last()) == std::make_pair<std::int64_t, std::int64_t>(40, 0));
+    CHECK(all.next(40) == NULL);
+}
+
+TEST_CASE("diff_index - benchmarks", "[!benchmark]")
+{
+    diff_vecs dv = random_diffs(3000000, 2);
+
+    auto start = std::chrono::steady_clock::now();
+    diff_index di;
+    dv.build(di);
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    WARN("build index of " << di.size() << " diffs: " << secs.count() * 1e3 << " ms");
+
+    std::mt19937 rng{ 3 };
+    std::int64_t end = di.last()->addr;
+    const int lookups = 1000000;
+    std::int64_t sum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int ii = 0; ii < lookups; ++ii)
+    {
+        const diff_index::extent *pe = di.next(std::int64_t(rng() % end));
+        sum += pe->addr;
+    }
+    secs = std::chrono::steady_clock::now() - start;
+    CHECK(sum > 0);
+    WARN("next diff: " << secs.count() / lookups * 1e9 << " ns");
+}
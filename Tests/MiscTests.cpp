@@ -8,7 +8,10 @@
 #include <algorithm>
 #include <clocale>
 #include <cmath>
+#include <cstring>
 #include <random>
+#include <string>
+#include <vector>
 
 
 struct color_row
@@ -2010,3 +2013,149 @@ TEST_CASE("FindFirstDiff - benchmarks", "[!benchmark]")
         return FindFirstDiff_DwordScan(xptr, yptr, buffer_size);
     };
 }
+
+// Simple version of FindFirstDiff (same == false) and FindFirstSame (same == true) to check against
+static std::size_t FindFirst_Reference(const std::uint8_t* x, const std::uint8_t* y, std::size_t len, bool same)
+{
+    std::size_t ii = 0;
+    while (ii < len && (x[ii] == y[ii]) != same)
+        ++ii;
+    return ii;
+}
+
+TEST_CASE("FindFirstDiff/FindFirstSame - all instruction sets")
+{
+    const simd_t saved = GetSimdLevel();
+    std::mt19937 rng{ 1 };
+    std::vector<std::uint8_t> xbuf(400), ybuf(400), zbuf(400);
+
+    for (int level = SIMD_SSE2; level <= SimdSupported(); ++level)
+    {
+        SetSimdLevel(simd_t(level));
+        REQUIRE(GetSimdLevel() == level);
+        CAPTURE(level);
+
+        for (int trial = 0; trial < 3000; ++trial)
+        {
+            // Buffers with different alignments, of all lengths up to a few chunks
+            const std::size_t xoff = rng() % 64, yoff = rng() % 64, len = rng() % 300;
+            std::uint8_t* x = xbuf.data() + xoff;
+            std::uint8_t* y = ybuf.data() + yoff;
+            std::uint8_t* z = zbuf.data() + yoff;
+            for (std::size_t ii = 0; ii < len; ++ii)
+            {
+                x[ii] = std::uint8_t(rng());
+                y[ii] = x[ii];
+                z[ii] = std::uint8_t(~x[ii]);
+            }
+            if (len > 0 && trial % 4 != 0)
+            {
+                const std::size_t pos = rng() % len;
+                y[pos]++;
+                z[pos] = x[pos];
+            }
+            CAPTURE(xoff, yoff, len);
+
+            CHECK(FindFirstDiff(x, y, len) == FindFirst_Reference(x, y, len, false));
+            CHECK(FindFirstSame(x, z, len) == FindFirst_Reference(x, z, len, true));
+        }
+    }
+    SetSimdLevel(saved);
+}
+
+TEST_CASE("Search4 - all instruction sets")
+{
+    const simd_t saved = GetSimdLevel();
+    std::mt19937 rng{ 2 };
+    std::vector<std::uint8_t> buf(1000), find(100);
+
+    for (int trial = 0; trial < 2000; ++trial)
+    {
+        for (auto& bb : buf)
+            bb = std::uint8_t(rng() % 4);      // few values so there are lots of short matches
+        const std::size_t off = rng() % 16, len = 16 + rng() % 900, pos = rng() % len;
+        const int min_match = 7 + rng() % 8;
+        for (std::size_t ii = 0; ii < find.size(); ++ii)
+            find[ii] = std::uint8_t(4 + rng() % 4);
+        for (std::size_t ii = 0; ii < std::size_t(min_match) + 3 && pos + ii < len; ++ii)
+            find[ii] = buf[off + pos + ii];    // plant a match (may be too short at the end of the buffer)
+        CAPTURE(trial, off, len, pos, min_match);
+
+        const std::uint8_t* expected = nullptr;
+        int expected_offset = -1;
+        for (int level = SIMD_SSE2; level <= SimdSupported(); ++level)
+        {
+            SetSimdLevel(simd_t(level));
+            CAPTURE(level);
+            int offset = -1;
+            const std::uint8_t* found = Search4(buf.data() + off, len, find.data(), 0, find.size(), offset, min_match);
+            if (found != nullptr)
+            {
+                REQUIRE(offset >= 0);
+                REQUIRE(offset <= 3);
+                CHECK(std::memcmp(found, find.data() + offset, min_match) == 0);
+            }
+            if (pos + min_match + 3 <= len)
+                CHECK((found != nullptr && found <= buf.data() + off + pos));
+
+            // All instruction sets must find the same match
+            if (level == SIMD_SSE2)
+            {
+                expected = found;
+                expected_offset = offset;
+            }
+            else
+            {
+                CHECK(found == expected);
+                CHECK(offset == expected_offset);
+            }
+        }
+    }
+    SetSimdLevel(saved);
+}
+
+TEST_CASE("FindFirstDiff - instruction sets", "[!benchmark]")
+{
+    static const char* names[] = { "SSE2", "AVX2", "AVX-512" };
+    constexpr std::size_t buffer_size = 64 * 1024;
+
+    std::vector<std::uint8_t> x(buffer_size + 64), y(buffer_size + 64), early(buffer_size + 64), late(buffer_size + 64);
+    std::mt19937 rng{ std::random_device{}() };
+    for (std::size_t i = 0; i < x.size(); i++)
+        x[i] = y[i] = early[i] = late[i] = rng() & 0xFF;
+    early[1 + 100]++;                       // diff near the start
+    late[1 + buffer_size - 7]++;            // diff in the last chunk
+
+    // Start 1 byte into the buffers so they are not aligned
+    const std::uint8_t* xptr = x.data() + 1;
+    const std::uint8_t* yptr = y.data() + 1;
+    const std::uint8_t* eptr = early.data() + 1;
+    const std::uint8_t* lptr = late.data() + 1;
+    const std::uint8_t* to_find = y.data() + 1 + buffer_size - 32;   // match is near the end
+
+    const simd_t saved = GetSimdLevel();
+    for (int level = SIMD_SSE2; level <= SimdSupported(); ++level)
+    {
+        SetSimdLevel(simd_t(level));
+        const std::string name = names[level];
+
+        BENCHMARK(name + " equal")
+        {
+            return FindFirstDiff(xptr, yptr, buffer_size);
+        };
+        BENCHMARK(name + " early diff")
+        {
+            return FindFirstDiff(xptr, eptr, buffer_size);
+        };
+        BENCHMARK(name + " late diff")
+        {
+            return FindFirstDiff(xptr, lptr, buffer_size);
+        };
+        BENCHMARK(name + " Search4")
+        {
+            int offset;
+            return Search4(xptr, buffer_size, to_find, 0, 20, offset, 16);
+        };
+    }
+    SetSimdLevel(saved);
+}
@@ -0,0 +1,175 @@
+#include "Stdafx.h"
+
+#include "ParallelCompare.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+static bytes random_bytes(std::size_t len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    bytes buf(len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    return buf;
+}
+
+static parallel_compare::opener_t opener(const bytes &data)
+{
+    return [&data]() -> parallel_compare::reader_t
+    {
+        return [&data](unsigned char *buf, std::size_t len, std::int64_t addr) -> std::size_t
+        {
+            if (addr >= std::int64_t(data.size()))
+                return 0;
+            std::size_t nn = std::min(len, std::size_t(data.size() - addr));
+            std::memcpy(buf, data.data() + addr, nn);
+            return nn;
+        };
+    };
+}
+
+// Simple byte by byte compare to check against
+static parallel_compare::diffs_t expected_diffs(const bytes &aa, const bytes &bb)
+{
+    parallel_compare::diffs_t retval;
+    std::size_t len = std::min(aa.size(), bb.size());
+    for (std::size_t ii = 0; ii < len; ++ii)
+    {
+        if (aa[ii] == bb[ii])
+            continue;
+        if (!retval.empty() && retval.back().first + retval.back().second == std::int64_t(ii))
+            ++retval.back().second;
+        else
+            retval.push_back(std::make_pair(std::int64_t(ii), std::int64_t(1)));
+    }
+    return retval;
+}
+
+TEST_CASE("parallel_compare finds the same differences as a simple compare")
+{
+    bytes aa = random_bytes(3 * parallel_compare::BUF_SIZE + 12345, 1);
+    bytes bb = aa;
+    std::mt19937 rng{ 2 };
+    for (int ii = 0; ii < 200; ++ii)
+    {
+        std::size_t pos = rng() % bb.size(), len = rng() % 300;
+        for (std::size_t jj = pos; jj < pos + len && jj < bb.size(); ++jj)
+            bb[jj] = ~bb[jj];
+    }
+
+    // Differences straddling the ends of ranges and buffers
+    for (std::size_t jj = parallel_compare::BUF_SIZE - 10; jj < parallel_compare::BUF_SIZE + 10; ++jj)
+        bb[jj] = ~aa[jj];
+    for (std::size_t jj = 99990; jj < 100010; ++jj)
+        bb[jj] = ~aa[jj];
+
+    for (int threads : { 1, 3, 8 })
+    {
+        for (std::int64_t range_size : { std::int64_t(100000), std::int64_t(parallel_compare::RANGE_SIZE) })
+        {
+            parallel_compare pc(opener(aa), opener(bb), aa.size(), threads, range_size);
+            REQUIRE(pc.run());
+            CHECK(pc.diffs() == expected_diffs(aa, bb));
+        }
+    }
+}
+
+TEST_CASE("parallel_compare identical, empty and all different")
+{
+    bytes aa = random_bytes(500000, 3);
+
+    parallel_compare same(opener(aa), opener(aa), aa.size(), 4, 65536);
+    REQUIRE(same.run());
+    CHECK(same.diffs().empty());
+
+    bytes empty;
+    parallel_compare none(opener(empty), opener(empty), 0);
+    REQUIRE(none.run());
+    CHECK(none.diffs().empty());
+
+    bytes bb(aa);
+    for (auto &cc : bb)
+        cc = ~cc;
+    parallel_compare all(opener(aa), opener(bb), aa.size(), 4, 65536);
+    REQUIRE(all.run());
+    REQUIRE(all.diffs().size() == 1);
+    CHECK(all.diffs()[0].first == 0);
+    CHECK(all.diffs()[0].second == std::int64_t(aa.size()));
+}
+
+TEST_CASE("parallel_compare skips holes")
+{
+    // Both files have a hole (of zeroes) in the middle
+    const std::int64_t hole_start = 1000000, hole_end = 3000000;
+    bytes aa = random_bytes(4000000, 5);
+    std::fill(aa.begin() + hole_start, aa.begin() + hole_end, 0);
+    bytes bb = aa;
+    bb[10] = ~bb[10];
+    bb[hole_end + 10] = ~bb[hole_end + 10];
+
+    std::atomic<std::int64_t> bytes_read(0);
+    auto counting = [&bytes_read](const bytes &data) -> parallel_compare::opener_t
+    {
+        return [&bytes_read, &data]() -> parallel_compare::reader_t
+        {
+            auto read = opener(data)();
+            return [&bytes_read, read](unsigned char *buf, std::size_t len, std::int64_t addr)
+            {
+                std::size_t nn = read(buf, len, addr);
+                bytes_read += nn;
+                return nn;
+            };
+        };
+    };
+
+    parallel_compare pc(counting(aa), counting(bb), aa.size(), 3, 500000);
+    pc.set_holes([=](std::int64_t addr) { return addr >= hole_start && addr < hole_end ? hole_end : addr; });
+    REQUIRE(pc.run());
+    CHECK(pc.diffs() == expected_diffs(aa, bb));
+    CHECK(bytes_read == 2 * (std::int64_t(aa.size()) - (hole_end - hole_start)));
+}
+
+TEST_CASE("parallel_compare stop")
+{
+    bytes aa = random_bytes(8 * 1024 * 1024, 4);
+    auto slow = [&aa]() -> parallel_compare::reader_t
+    {
+        auto read = opener(aa)();
+        return [read](unsigned char *buf, std::size_t len, std::int64_t addr)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            return read(buf, len, addr);
+        };
+    };
+    parallel_compare pc(slow, slow, aa.size(), 2, 1024 * 1024);
+    int polls = 0;
+    CHECK(!pc.run([&](std::int64_t) { return ++polls < 2; }));
+}
+
+TEST_CASE("parallel_compare - benchmarks", "[!benchmark]")
+{
+    bytes aa = random_bytes(256 * 1024 * 1024, std::random_device{}());
+    bytes bb = aa;
+    for (std::size_t ii = 0; ii < bb.size(); ii += 1000003)
+        bb[ii] = ~bb[ii];
+
+    for (int threads = 1; threads <= 8; threads *= 2)
+    {
+        auto start = std::chrono::steady_clock::now();
+        parallel_compare pc(opener(aa), opener(bb), aa.size(), threads, 16 * 1024 * 1024);
+        pc.run();
+        std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+        WARN(threads << " threads: " << double(aa.size()) / secs.count() / 1e9 << " GB/s");
+    }
+}
@@ -5,6 +5,11 @@
 
 #include <catch.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <random>
+#include <set>
 #include <string>
 #include <sstream>
 
@@ -1008,3 +1013,269 @@ TEST_CASE("range_set - reverse iterators")
     }
 }
 
+// Checks that the set has the same values as the std::set and that its segments are in
+// order, not empty and not adjacent (adjacent segments should have been joined)
+static bool same_as(const range_set<int> &set, const std::set<int> &expected)
+{
+    for (std::size_t ii = 0; ii < set.range_.size(); ++ii)
+    {
+        if (set.range_[ii].sfirst >= set.range_[ii].slast ||
+            (ii > 0 && set.range_[ii - 1].slast >= set.range_[ii].sfirst))
+        {
+            return false;
+        }
+    }
+    return std::equal(set.begin(), set.end(), expected.begin(), expected.end());
+}
+
+TEST_CASE("range_set - random changes match std::set")
+{
+    std::mt19937 rng{ 1 };
+    range_set<int> set;
+    std::set<int> expected;
+
+    for (int ii = 0; ii < 2000; ++ii)
+    {
+        int ss = int(rng() % 1000), ee = ss + int(rng() % 30);
+        switch (rng() % 4)
+        {
+        case 0:
+            set.insert_range(ss, ee);
+            for (int vv = ss; vv < ee; ++vv)
+                expected.insert(vv);
+            break;
+        case 1:
+            set.erase_range(ss, ee);
+            expected.erase(expected.lower_bound(ss), expected.lower_bound(ee));
+            break;
+        case 2:
+            CHECK(set.insert(ss).second == expected.insert(ss).second);
+            break;
+        case 3:
+            CHECK(set.erase(ss) == expected.erase(ss));
+            break;
+        }
+        REQUIRE(same_as(set, expected));
+    }
+
+    for (int vv = -1; vv < 1040; ++vv)
+    {
+        CHECK(set.count(vv) == expected.count(vv));
+        auto plower = set.lower_bound(vv);
+        auto pexp = expected.lower_bound(vv);
+        CHECK((plower == set.end()) == (pexp == expected.end()));
+        if (plower != set.end() && pexp != expected.end())
+            CHECK(*plower == *pexp);
+    }
+}
+
+static std::string to_text(const range_set<int> &set)
+{
+    std::ostringstream stream;
+    stream << set;
+    return stream.str();
+}
+
+static range_set<int> random_set(std::mt19937 &rng, std::set<int> &expected)
+{
+    range_set<int> set;
+    for (int ii = 0; ii < 50; ++ii)
+    {
+        int ss = int(rng() % 1000), ee = ss + int(rng() % 30);
+        set.insert_range(ss, ee);
+        for (int vv = ss; vv < ee; ++vv)
+            expected.insert(vv);
+    }
+    return set;
+}
+
+TEST_CASE("range_set - set algebra")
+{
+    std::mt19937 rng{ 2 };
+
+    for (int ii = 0; ii < 100; ++ii)
+    {
+        std::set<int> s1, s2, expected;
+        range_set<int> set1 = random_set(rng, s1), set2 = random_set(rng, s2);
+
+        std::set_union(s1.begin(), s1.end(), s2.begin(), s2.end(), std::inserter(expected, expected.end()));
+        REQUIRE(same_as(set1 | set2, expected));
+        expected.clear();
+        std::set_intersection(s1.begin(), s1.end(), s2.begin(), s2.end(), std::inserter(expected, expected.end()));
+        REQUIRE(same_as(set1 & set2, expected));
+        expected.clear();
+        std::set_difference(s1.begin(), s1.end(), s2.begin(), s2.end(), std::inserter(expected, expected.end()));
+        REQUIRE(same_as(set1 - set2, expected));
+        expected.clear();
+        std::set_symmetric_difference(s1.begin(), s1.end(), s2.begin(), s2.end(), std::inserter(expected, expected.end()));
+        REQUIRE(same_as(set1 ^ set2, expected));
+
+        expected.clear();
+        int ss = int(rng() % 1000), ee = ss + int(rng() % 100);
+        for (int vv = ss; vv < ee; ++vv)
+            if (s1.count(vv) == 0)
+                expected.insert(vv);
+        REQUIRE(same_as(set1.complement(ss, ee), expected));
+        CHECK(set1.contains_range(ss, ee) == expected.empty());
+
+        // The segment containing ss or the next one after it
+        auto pseg = set1.find_segment(ss);
+        auto pnext = s1.lower_bound(ss);
+        if (pnext == s1.end())
+            CHECK(pseg == set1.range_.end());
+        else
+            CHECK((pseg != set1.range_.end() && pseg->sfirst <= *pnext && *pnext < pseg->slast &&
+                   (s1.count(ss) == 0 || pseg->sfirst <= ss)));
+
+        range_set<int> tmp = set1;
+        tmp |= set2;
+        CHECK(tmp == (set1 | set2));
+        tmp = set1;
+        tmp &= set2;
+        CHECK(tmp == (set1 & set2));
+        tmp = set1;
+        tmp -= set2;
+        CHECK(tmp == (set1 - set2));
+        tmp = set1;
+        tmp ^= set2;
+        CHECK(tmp == (set1 ^ set2));
+    }
+
+    SECTION("abutting segments are joined")
+    {
+        range_set<int> set1{ 1, 2, 3 }, set2{ 4, 5 };
+        CHECK((set1 | set2).range_.size() == 1);
+        CHECK((set1 ^ set2).range_.size() == 1);
+        CHECK((set1 & set2).empty());
+    }
+
+    SECTION("empty sets")
+    {
+        range_set<int> empty, set{ 1, 2, 5 };
+        CHECK((empty | set) == set);
+        CHECK((set | empty) == set);
+        CHECK((set & empty).empty());
+        CHECK((set - empty) == set);
+        CHECK((empty - set).empty());
+        CHECK(set.complement(0, 10) == range_set<int>({ 0, 3, 4, 6, 7, 8, 9 }));
+        CHECK(set.complement(5, 5).empty());
+    }
+}
+
+TEST_CASE("range_set - shift")
+{
+    range_set<int> set;
+    set.insert_range(10, 20);
+    set.insert_range(30, 40);
+
+    SECTION("insert before segments")
+    {
+        set.shift(5, 3);
+        CHECK(to_text(set) == "13:22,33:42");
+    }
+    SECTION("insert within segment stretches it")
+    {
+        set.shift(15, 3);
+        CHECK(to_text(set) == "10:22,33:42");
+    }
+    SECTION("insert at start of segment stretches it")
+    {
+        set.shift(30, 3);
+        CHECK(to_text(set) == "10:19,30:42");
+    }
+    SECTION("insert at end of segment moves following")
+    {
+        set.shift(20, 3);
+        CHECK(to_text(set) == "10:19,33:42");
+    }
+    SECTION("remove within segment")
+    {
+        set.shift(12, -5);
+        CHECK(to_text(set) == "10:14,25:34");
+    }
+    SECTION("remove gap joins segments")
+    {
+        set.shift(20, -10);
+        CHECK(to_text(set) == "10:29");
+    }
+    SECTION("remove across segments")
+    {
+        set.shift(15, -20);
+        CHECK(to_text(set) == "10:19");
+    }
+    SECTION("remove after segments")
+    {
+        set.shift(50, -5);
+        CHECK(to_text(set) == "10:19,30:39");
+    }
+}
+
+TEST_CASE("range_set - move")
+{
+    range_set<int> set{ 1, 2, 3, 7 };
+    const range_set<int> copy = set;
+
+    range_set<int> moved(std::move(set));
+    CHECK(moved == copy);
+
+    range_set<int> assigned;
+    assigned = std::move(moved);
+    CHECK(assigned == copy);
+}
+
+TEST_CASE("range_set - benchmarks", "[!benchmark]")
+{
+    const int count = 1000000;          // number of segments
+
+    // Build from sorted values
+    auto start = std::chrono::steady_clock::now();
+    range_set<int> set;
+    for (int ii = 0; ii < count; ++ii)
+        set.insert_range(ii * 10, ii * 10 + 5);
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    REQUIRE(set.range_.size() == count);
+    WARN("build " << count << " segments: " << secs.count() * 1e3 << " ms");
+
+    std::mt19937 rng{ 1 };
+    int found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int ii = 0; ii < count; ++ii)
+        found += int(set.count(int(rng() % (count * 10))));
+    secs = std::chrono::steady_clock::now() - start;
+    CHECK(found > 0);
+    WARN("count: " << secs.count() / count * 1e9 << " ns");
+
+    start = std::chrono::steady_clock::now();
+    for (int ii = 0; ii < count; ++ii)
+        found += *set.lower_bound(int(rng() % (count * 10 - 10)));
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("lower_bound: " << secs.count() / count * 1e9 << " ns");
+
+    // Changes in the middle have to move the following segments
+    const int changes = 1000;
+    start = std::chrono::steady_clock::now();
+    for (int ii = 0; ii < changes; ++ii)
+    {
+        int vv = int(rng() % (count * 10));
+        set.erase_range(vv, vv + 2);
+        set.insert_range(vv, vv + 1);
+    }
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("erase_range + insert_range: " << secs.count() / changes * 1e6 << " us");
+
+    // Combine with a set of the same size offset from it
+    range_set<int> other;
+    for (int ii = 0; ii < count; ++ii)
+        other.insert_range(ii * 10 + 3, ii * 10 + 8);
+    start = std::chrono::steady_clock::now();
+    range_set<int> both = set | other;
+    secs = std::chrono::steady_clock::now() - start;
+    CHECK(!both.empty());
+    WARN("union: " << secs.count() * 1e3 << " ms");
+
+    start = std::chrono::steady_clock::now();
+    for (int ii = 0; ii < changes; ++ii)
+        set.shift(int(rng() % (count * 10)), ii % 2 == 0 ? 3 : -3);
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("shift: " << secs.count() / changes * 1e6 << " us");
+}
@@ -0,0 +1,217 @@
+#include "Stdafx.h"
+
+#include "RepeatIndex.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+static repeat_index::reader_t reader(const bytes &data)
+{
+    return [&data](unsigned char *buf, std::size_t len, std::int64_t addr) -> std::size_t
+    {
+        if (addr < 0 || addr >= std::int64_t(data.size()))
+            return 0;
+        std::size_t nn = std::min(len, std::size_t(data.size() - addr));
+        std::memcpy(buf, data.data() + addr, nn);
+        return nn;
+    };
+}
+
+// Checks the index against comparing every full row with the previous one
+static bool matches(const repeat_index &idx, const bytes &data, int row_size, int offset)
+{
+    std::int64_t rows = (std::int64_t(data.size()) + offset) / row_size + 1;
+    for (std::int64_t row = 0; row < rows; ++row)
+    {
+        std::int64_t addr = row * row_size - offset;
+        bool expected = addr - row_size >= 0 && addr + row_size <= std::int64_t(data.size()) &&
+                        std::memcmp(&data[std::size_t(addr)], &data[std::size_t(addr - row_size)], row_size) == 0;
+        if (idx.repeated(row) != expected)
+            return false;
+    }
+    return true;
+}
+
+// Data with some runs of identical rows
+static bytes make_data(std::mt19937 &rng, std::size_t len)
+{
+    bytes data(len);
+    for (std::size_t ii = 0; ii < len; )
+    {
+        std::size_t run = std::min<std::size_t>(len - ii, rng() % 200);
+        unsigned char fill = rng() % 3 == 0 ? 0 : static_cast<unsigned char>(rng());
+        bool random = rng() % 2 == 0;
+        for (std::size_t jj = 0; jj < run; ++jj)
+            data[ii + jj] = random ? static_cast<unsigned char>(rng()) : fill;
+        ii += run;
+    }
+    return data;
+}
+
+TEST_CASE("repeat_index - scan")
+{
+    std::mt19937 rng{ 1 };
+    bytes data = make_data(rng, 20000);
+
+    for (int row_size : { 1, 4, 16, 33 })
+    {
+        for (int offset : { 0, 3 })
+        {
+            offset %= row_size;
+            repeat_index idx;
+            idx.reset(row_size, offset, data.size());
+            CHECK(!idx.done());
+            CHECK(!idx.repeated(5));
+            while (!idx.scan(reader(data), 1000))
+                ;
+            CHECK(idx.done());
+            CHECK(matches(idx, data, row_size, offset));
+        }
+    }
+
+    SECTION("run_end")
+    {
+        bytes zeroes(1600, 0);
+        zeroes[800] = 1;
+        repeat_index idx;
+        idx.reset(16, 0, zeroes.size());
+        REQUIRE(idx.scan(reader(zeroes)));
+        CHECK(!idx.repeated(0));
+        CHECK(idx.run_end(0) == 0);
+        CHECK(idx.run_end(1) == 50);    // row 50 has the 1
+        CHECK(idx.run_end(10) == 50);
+        CHECK(idx.run_end(50) == 50);
+        CHECK(idx.run_end(51) == 51);   // row 51 is different to 50
+        CHECK(idx.run_end(52) == 100);
+    }
+
+    SECTION("range")
+    {
+        const int row_size = 16, offset = 5;
+        repeat_index idx;
+        idx.reset(row_size, offset, data.size());
+        idx.scan(reader(data), 100, 200);
+        idx.scan(reader(data), 150, 300);   // overlaps rows already checked
+        CHECK(!idx.done());
+
+        // Rows outside the range are still not known
+        repeat_index all;
+        all.reset(row_size, offset, data.size());
+        REQUIRE(all.scan(reader(data), data.size() * 2));
+        for (std::int64_t row = 0; row < std::int64_t(data.size()) / row_size + 1; ++row)
+            REQUIRE(idx.repeated(row) == (row >= 100 && row < 300 && all.repeated(row)));
+
+        idx.scan(reader(data), 0, std::int64_t(data.size()));
+        CHECK(idx.done());
+        CHECK(matches(idx, data, row_size, offset));
+    }
+}
+
+TEST_CASE("repeat_index - scan_lines")
+{
+    // 11 different rows, 999 repeats of the last then 10 more different rows
+    const int row_size = 16;
+    bytes data(row_size * 1020, 0);
+    for (int row = 0; row < 20; ++row)
+        data[(row < 10 ? row : row + 1000) * row_size] = static_cast<unsigned char>(row + 1);
+
+    std::size_t bytes_read = 0;
+    repeat_index::reader_t counting_reader = [&data, &bytes_read](unsigned char *buf, std::size_t len, std::int64_t addr)
+    {
+        std::size_t nn = reader(data)(buf, len, addr);
+        bytes_read += nn;
+        return nn;
+    };
+
+    repeat_index idx;
+    idx.reset(row_size, 0, data.size());
+    CHECK(idx.scan_lines(counting_reader, 0, 1020, 5) == 5);
+    CHECK(bytes_read <= 6 * row_size);              // only the rows needed (and the one before) are read
+    CHECK(!idx.done());
+
+    // The run takes one line but is checked to the end
+    CHECK(idx.scan_lines(counting_reader, 5, 1020, 7) == 1010);
+    CHECK(idx.repeated(1009));
+    CHECK(!idx.repeated(1010));
+    CHECK(idx.run_end(11) == 1010);
+
+    // Rows already checked are not read again
+    bytes_read = 0;
+    CHECK(idx.scan_lines(counting_reader, 0, 1020, 12) == 1010);
+    CHECK(bytes_read == 0);
+    CHECK(idx.scan_lines(counting_reader, 0, 1020, 100) == 1020);
+    CHECK(idx.done());
+    CHECK(matches(idx, data, row_size, 0));
+}
+
+TEST_CASE("repeat_index - changes")
+{
+    std::mt19937 rng{ 2 };
+    const int row_size = 16, offset = 5;
+    bytes data = make_data(rng, 10000);
+    repeat_index idx;
+    idx.reset(row_size, offset, data.size());
+    REQUIRE(idx.scan(reader(data), data.size() * 2));
+
+    for (int ii = 0; ii < 500; ++ii)
+    {
+        std::size_t addr = rng() % (data.size() + 1);
+        std::size_t len = rng() % 3 == 0 ? row_size * (1 + rng() % 4) : 1 + rng() % 40;
+        switch (rng() % 3)
+        {
+        case 0:
+            len = std::min(len, data.size() - addr);
+            for (std::size_t jj = 0; jj < len; ++jj)
+                data[addr + jj] = rng() % 2 == 0 ? 0 : static_cast<unsigned char>(rng());
+            idx.change(addr, len, len, data.size());
+            break;
+        case 1:
+            data.insert(data.begin() + addr, len, static_cast<unsigned char>(rng() % 2));
+            idx.change(addr, 0, len, data.size());
+            break;
+        case 2:
+            len = std::min(len, data.size() - addr);
+            data.erase(data.begin() + addr, data.begin() + addr + len);
+            idx.change(addr, len, 0, data.size());
+            break;
+        }
+        REQUIRE(idx.scan(reader(data), data.size() * 2));
+        REQUIRE(matches(idx, data, row_size, offset));
+    }
+}
+
+TEST_CASE("repeat_index - benchmarks", "[!benchmark]")
+{
+    bytes data(512 * 1024 * 1024, 0);
+    for (std::size_t ii = 0; ii < data.size(); ii += 64 * 1024 * 1024)
+        data[ii] = 1;
+
+    repeat_index idx;
+    auto start = std::chrono::steady_clock::now();
+    idx.reset(16, 0, data.size());
+    while (!idx.scan(reader(data)))
+        ;
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    CHECK(idx.repeats().range_.size() == 16);
+    WARN("scan mostly zero: " << double(data.size()) / secs.count() / 1e9 << " GB/s");
+
+    // Inserting whole rows only moves the following rows
+    const int changes = 10000;
+    start = std::chrono::steady_clock::now();
+    for (int ii = 0; ii < changes; ++ii)
+    {
+        std::int64_t addr = std::int64_t(ii) * 50000;
+        idx.change(addr, 0, 16, data.size() + 16);
+        idx.change(addr, 16, 0, data.size());
+    }
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("change: " << secs.count() / (changes * 2) * 1e6 << " us");
+}
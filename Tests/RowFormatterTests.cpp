@@ -0,0 +1,199 @@
+#include "Stdafx.h"
+
+#include "RowFormatter.h"
+
+#include <catch.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+static bytes random_bytes(std::size_t len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    bytes buf(len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    return buf;
+}
+
+// Colours like the default scheme: control chars, ASCII and the rest in different colours
+static std::vector<std::uint32_t> make_colours()
+{
+    std::vector<std::uint32_t> colours(256);
+    for (int ii = 0; ii < 256; ++ii)
+        colours[ii] = ii < 32 ? 1 : ii < 128 ? 2 : 3;
+    return colours;
+}
+
+static unsigned char e2a[256];
+
+static row_formatter::options make_options(const std::vector<std::uint32_t> &colours)
+{
+    for (int ii = 0; ii < 256; ++ii)
+        e2a[ii] = ii >= 0xC1 && ii <= 0xC9 ? 'A' + (ii - 0xC1) : 0;
+
+    row_formatter::options opt;
+    opt.ascii = true;
+    opt.ebcdic = false;
+    opt.oem = false;
+    opt.control = 0;
+    opt.first_char = 32;
+    opt.last_char = 255;
+    opt.group_by = 4;
+    opt.upper_case = true;
+    opt.e2a = e2a;
+    opt.colours = &colours[0];
+    return opt;
+}
+
+// Puts the text of all runs into one string by cell (wide chars become '.')
+static std::string layout(const row_formatter &rf)
+{
+    std::string retval;
+    for (const auto &rr : rf.runs())
+    {
+        if (retval.size() < rr.cell + rr.len)
+            retval.resize(rr.cell + rr.len, ' ');
+        for (std::size_t ii = 0; ii < rr.len; ++ii)
+            retval[rr.cell + ii] = rr.glyph == row_formatter::GLYPH_TEXT ? rf.narrow(rr)[ii] :
+                                   rf.wide(rr)[ii] == L' ' ? ' ' : '.';
+    }
+    return retval;
+}
+
+TEST_CASE("row_formatter hex area")
+{
+    std::vector<std::uint32_t> colours = make_colours();
+    row_formatter rf(make_options(colours));
+    const unsigned char buf[] = { 'A', 'B', 'C', 'D', 'E', 0x01, 0x02, 0xFF, 'a' };
+
+    rf.hex_area(buf, 0, sizeof(buf));
+    CHECK(layout(rf) == "41 42 43 44  45 01 02 FF  61");
+    REQUIRE(rf.runs().size() == 4);          // split by colour only
+    CHECK(rf.runs()[0].cell == 0);
+    CHECK(rf.runs()[1].cell == rf.hex_cell(5));
+    CHECK(rf.runs()[1].colour == 1);
+    CHECK(rf.runs()[2].colour == 3);
+    CHECK(rf.runs()[3].colour == 2);
+
+    rf.hex_area(buf, 2, 4);                  // part of a row
+    CHECK(rf.runs().size() == 1);
+    CHECK(rf.runs()[0].cell == 6);
+    CHECK(std::string(rf.narrow(rf.runs()[0]), rf.runs()[0].len) == "43 44");
+
+    rf.hex_area(buf, 3, 3);
+    CHECK(rf.runs().empty());
+}
+
+TEST_CASE("row_formatter char area")
+{
+    std::vector<std::uint32_t> colours(256, 0);    // all the same colour
+    row_formatter::options opt = make_options(colours);
+    row_formatter rf(opt);
+    const unsigned char buf[] = { 'H', 'i', '\n', 0x00, 0x07, 0x01, 0x80, '~', 0x7F };
+
+    SECTION("ASCII")
+    {
+        rf.char_area(buf, 0, sizeof(buf), false);
+        CHECK(layout(rf) == "Hi.....~.");
+        REQUIRE(rf.runs().size() == 5);
+        CHECK(rf.runs()[1].glyph == row_formatter::GLYPH_DOT);     // control chars
+        CHECK(rf.runs()[2].glyph == row_formatter::GLYPH_BAD);     // out of range
+        CHECK(rf.runs()[4].glyph == row_formatter::GLYPH_BAD);
+    }
+
+    SECTION("control chars")
+    {
+        opt.control = 1;
+        rf.set_options(opt);
+        rf.char_area(buf, 0, sizeof(buf), false);
+        CHECK(layout(rf) == "HiJ@GA.~.");
+        CHECK(rf.runs().size() == 4);
+
+        opt.control = 2;
+        rf.set_options(opt);
+        rf.char_area(buf, 0, sizeof(buf), false);
+        CHECK(layout(rf) == "Hin0a..~.");
+
+        opt.control = 3;                    // not shown at all
+        rf.set_options(opt);
+        rf.char_area(buf, 0, sizeof(buf), false);
+        CHECK(layout(rf) == "Hi    .~.");
+    }
+
+    SECTION("ANSI")
+    {
+        opt.ascii = false;
+        rf.set_options(opt);
+        rf.char_area(buf, 0, sizeof(buf), false);
+        CHECK(layout(rf) == "Hi....\x80~\x7F");
+        CHECK(rf.runs().size() == 3);
+    }
+
+    SECTION("EBCDIC")
+    {
+        opt.ebcdic = true;
+        rf.set_options(opt);
+        const unsigned char ebc[] = { 0xC1, 0xC2, 0x00, 0x40, 0xC9 };
+        rf.char_area(ebc, 0, sizeof(ebc), false);
+        CHECK(layout(rf) == "AB..I");
+        CHECK(rf.runs()[1].glyph == row_formatter::GLYPH_DOT);
+    }
+
+    SECTION("vertical display")
+    {
+        rf.char_area(buf, 0, sizeof(buf), true);
+        CHECK(layout(rf) == "Hi.. ...~ .");
+        CHECK(rf.char_cell(8, true) == 10);
+        for (const auto &rr : rf.runs())
+            CHECK(rr.glyph != row_formatter::GLYPH_BAD);
+
+        rf.hex_digits(buf, 0, sizeof(buf), 4);
+        CHECK(layout(rf) == "4600 0087 7");
+        rf.hex_digits(buf, 0, sizeof(buf), 0);
+        CHECK(layout(rf) == "89A0 710E F");
+    }
+}
+
+TEST_CASE("row_formatter - benchmarks", "[!benchmark]")
+{
+    std::vector<std::uint32_t> colours = make_colours();
+    row_formatter rf(make_options(colours));
+    const std::size_t row_size = 256, rows = 100000;
+    bytes data = random_bytes(row_size * 64, 1);
+    bytes text(row_size * 64);
+    for (std::size_t ii = 0; ii < text.size(); ++ii)
+        text[ii] = 'a' + ii % 26;               // all one colour so each row is one run
+
+    std::size_t runs = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t ii = 0; ii < rows; ++ii)
+    {
+        const unsigned char *row = &data[(ii % 64) * row_size];
+        rf.hex_area(row, 0, row_size);
+        runs += rf.runs().size();
+        rf.char_area(row, 0, row_size, false);
+        runs += rf.runs().size();
+    }
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    WARN("random bytes: " << rows / secs.count() << " rows/s (" << double(runs) / rows << " runs per row)");
+
+    runs = 0;
+    start = std::chrono::steady_clock::now();
+    for (std::size_t ii = 0; ii < rows; ++ii)
+    {
+        const unsigned char *row = &text[(ii % 64) * row_size];
+        rf.hex_area(row, 0, row_size);
+        runs += rf.runs().size();
+        rf.char_area(row, 0, row_size, false);
+        runs += rf.runs().size();
+    }
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("text: " << rows / secs.count() << " rows/s (" << double(runs) / rows << " runs per row)");
+    CHECK(runs == 2 * rows);
+}
@@ -0,0 +1,168 @@
+#include "Stdafx.h"
+#include "utils/SimulatedDevice.h"
+
+#include "SectorReader.h"
+
+#include <catch.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+static bytes random_bytes(std::size_t len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    bytes buf(len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    return buf;
+}
+
+TEST_CASE("sector_reader")
+{
+    const std::size_t sec_size = 512, len = 1024 * 1024;
+    bytes data = random_bytes(len, 1);
+    SimulatedDevice dev(data, sec_size, 8);
+    sector_reader reader(&dev, 64 * 1024, 1);
+    bytes buf(len);
+
+    SECTION("good device")
+    {
+        REQUIRE(reader.read(0, buf.data(), len));
+        CHECK(buf == data);
+        CHECK(reader.bad().empty());
+        CHECK(dev.MaxInProgress() == 8);
+        CHECK(dev.Log().size() == len / (64 * 1024));
+
+        // Part of the device not starting at a block boundary
+        bytes part(100 * sec_size);
+        REQUIRE(reader.read(3 * sec_size, part.data(), part.size()));
+        CHECK(std::equal(part.begin(), part.end(), data.begin() + 3 * sec_size));
+    }
+
+    SECTION("bad sectors")
+    {
+        dev.Fail(10);                       // always bad
+        dev.Fail(1000, -1, 1117);           // always bad (ERROR_IO_DEVICE)
+        dev.Fail(1001, 1);                  // bad once (OK when retried)
+        REQUIRE(!reader.read(0, buf.data(), len));
+
+        // The read does not wait for the retries - the failed blocks are zero for now
+        CHECK(reader.pending(10));
+        CHECK(reader.pending(1001));
+        CHECK(buf[1001 * sec_size] == 0);
+        reader.finish_retries();
+        CHECK(!reader.pending(10));
+        CHECK(!reader.pending(1001));
+
+        CHECK(reader.bad().size() == 2);
+        CHECK(reader.error(10) == 23);
+        CHECK(reader.error(1000) == 1117);
+        CHECK(reader.error(1001) == 0);
+
+        // All the blocks were read before any retries, then every sector of the failed blocks
+        // on its own (and the bad ones once more)
+        const auto &log = dev.Log();
+        CHECK(log.size() == len / (64 * 1024) + 2 * 128 + 2);
+        for (std::size_t ii = 0; ii < log.size(); ++ii)
+        {
+            if (ii < len / (64 * 1024))
+                CHECK(log[ii].second == 64 * 1024);
+            else
+                CHECK(log[ii].second == sec_size);
+        }
+
+        // Sectors read by the retries are kept for the next read so only the good blocks are read again
+        std::size_t reads = log.size();
+        REQUIRE(!reader.read(0, buf.data(), len));
+        CHECK(dev.Log().size() == reads + len / (64 * 1024) - 2);
+        for (std::size_t ii = 0; ii < len; ++ii)
+        {
+            std::int64_t sec = ii / sec_size;
+            if (sec == 10 || sec == 1000)
+                REQUIRE(buf[ii] == 0);
+            else
+                REQUIRE(buf[ii] == data[ii]);
+        }
+
+        // Known bad sectors are not read again
+        reads = log.size();
+        REQUIRE(!reader.read(8 * sec_size, buf.data(), 4 * sec_size));
+        CHECK(buf[2 * sec_size] == 0);
+        CHECK(dev.Log().size() == reads + 2);
+        for (std::size_t ii = reads; ii < dev.Log().size(); ++ii)
+            CHECK((dev.Log()[ii].first > std::int64_t(10 * sec_size) ||
+                   dev.Log()[ii].first + std::int64_t(dev.Log()[ii].second) <= std::int64_t(10 * sec_size)));
+
+        // Until they are forgotten
+        reader.forget_bad();
+        CHECK(reader.bad().empty());
+        CHECK(!reader.read(8 * sec_size, buf.data(), 4 * sec_size));
+        reader.finish_retries();
+        CHECK(reader.bad().size() == 1);
+    }
+
+    SECTION("retries continue during later reads")
+    {
+        dev.Fail(10);
+        REQUIRE(!reader.read(0, buf.data(), 64 * 1024));
+        std::vector<std::int64_t> pending;
+        reader.pending(0, 64 * 1024, pending);
+        CHECK(pending.size() == 128);
+
+        // Reading another block also starts retries in the free request slots but does not wait for them
+        bytes part(64 * 1024);
+        REQUIRE(reader.read(64 * 1024, part.data(), part.size()));
+        CHECK(std::equal(part.begin(), part.end(), data.begin() + 64 * 1024));
+        CHECK(dev.Log().size() == 2 + 7);
+
+        reader.finish_retries();
+        pending.clear();
+        reader.pending(0, 64 * 1024, pending);
+        CHECK(pending.empty());
+        CHECK(reader.error(10) == 23);
+    }
+
+    SECTION("shared bad sector map")
+    {
+        auto shared = std::make_shared<bad_sector_map>();
+        SimulatedDevice dev1(data, sec_size, 8), dev2(data, sec_size, 8);
+        dev1.Fail(10);
+        dev2.Fail(10);
+        sector_reader reader1(&dev1, 64 * 1024, 1, shared), reader2(&dev2, 64 * 1024, 1, shared);
+
+        REQUIRE(!reader1.read(0, buf.data(), 64 * 1024));
+        CHECK(reader2.pending(10));         // so reader2 does not retry it too
+        reader1.finish_retries();
+        CHECK(reader2.error(10) == 23);
+
+        // reader2 does not read the sector found bad by reader1
+        REQUIRE(!reader2.read(0, buf.data(), 64 * 1024));
+        for (const auto &rr : dev2.Log())
+            CHECK((rr.first > std::int64_t(10 * sec_size) || rr.first + std::int64_t(rr.second) <= std::int64_t(10 * sec_size)));
+        CHECK(std::equal(buf.begin() + 11 * sec_size, buf.begin() + 64 * 1024, data.begin() + 11 * sec_size));
+    }
+
+    SECTION("read a sector another reader is retrying")
+    {
+        auto shared = std::make_shared<bad_sector_map>();
+        SimulatedDevice dev1(data, sec_size, 8), dev2(data, sec_size, 8);
+        dev1.Fail(10);
+        dev2.Fail(20);
+        sector_reader reader1(&dev1, 64 * 1024, 1, shared), reader2(&dev2, 64 * 1024, 1, shared);
+
+        REQUIRE(!reader1.read(0, buf.data(), 64 * 1024));
+        REQUIRE(!reader2.read(0, buf.data(), 64 * 1024));
+        CHECK(reader2.pending(10));
+
+        bytes sec(sec_size);
+        REQUIRE(reader2.read_sector(10, sec.data()));
+        CHECK(std::equal(sec.begin(), sec.end(), data.begin() + 10 * sec_size));
+        CHECK(reader1.pending(10));         // the map is not changed
+        CHECK(!reader2.read_sector(20, sec.data()));
+        CHECK(sec[0] == 0);
+    }
+}
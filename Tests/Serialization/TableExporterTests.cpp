@@ -0,0 +1,179 @@
+#include "Stdafx.h"
+#include "../utils/ErrorFile.h"
+#include "../utils/File.h"
+
+#include "Serialization/TableExporter.h"
+
+#include "catch.hpp"
+
+#include <cstring>
+#include <vector>
+
+
+static hex::Cell text_cell(const char* text)
+{
+    return hex::Cell{ false, 0, 0.0, text };
+}
+
+static hex::Cell int_cell(std::int64_t value)
+{
+    CStringA text;
+    text.Format("%lld", value);
+    return hex::Cell{ false, value, 0.0, text };
+}
+
+static hex::Cell null_cell()
+{
+    return hex::Cell{ true, 0, 0.0, "" };
+}
+
+static std::vector<std::uint8_t> read_all_bytes(CFile& stream)
+{
+    std::vector<std::uint8_t> result(static_cast<std::size_t>(stream.GetLength()));
+    stream.SeekToBegin();
+    if (!result.empty())
+    {
+        stream.Read(result.data(), static_cast<UINT>(result.size()));
+    }
+    return result;
+}
+
+template <class T>
+static T get_at(const std::vector<std::uint8_t>& bytes, std::size_t& pos)
+{
+    T value;
+    REQUIRE(pos + sizeof(T) <= bytes.size());
+    std::memcpy(&value, bytes.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+}
+
+
+TEST_CASE("CsvTableExporter header and rows")
+{
+    auto stream = std::make_unique<CMemFile>();
+    CMemFile* pStream = stream.get();
+
+    hex::CsvTableExporter exporter{ std::move(stream) };
+
+    exporter.WriteHeader({ { "id", hex::ColumnType::Integer }, { "name", hex::ColumnType::Text } });
+    exporter.WriteRow({ int_cell(1), text_cell("plain") });
+    exporter.WriteRow({ int_cell(-2), null_cell() });
+    exporter.WriteEpilogue();
+
+    CString written = File::ReadAllText(*pStream);
+
+    CHECK(written == "id,name\r\n1,plain\r\n-2,\r\n");
+    CHECK(exporter.RowsWritten() == 2);
+    CHECK(exporter.Error() == "");
+}
+
+TEST_CASE("CsvTableExporter quoting")
+{
+    auto stream = std::make_unique<CMemFile>();
+    CMemFile* pStream = stream.get();
+
+    hex::CsvTableExporter exporter{ std::move(stream) };
+
+    exporter.WriteHeader({ { "a,b", hex::ColumnType::Text } });
+    exporter.WriteRow({ text_cell("say \"hi\"") });
+    exporter.WriteRow({ text_cell("two\r\nlines") });
+    exporter.WriteEpilogue();
+
+    CString written = File::ReadAllText(*pStream);
+
+    CHECK(written == "\"a,b\"\r\n\"say \"\"hi\"\"\"\r\n\"two\r\nlines\"\r\n");
+}
+
+TEST_CASE("ColumnarTableExporter layout")
+{
+    auto stream = std::make_unique<CMemFile>();
+    CMemFile* pStream = stream.get();
+
+    {
+        hex::ColumnarTableExporter exporter{ std::move(stream), 2 };
+
+        exporter.WriteHeader({ { "n", hex::ColumnType::Integer }, { "s", hex::ColumnType::Text } });
+        exporter.WriteRow({ int_cell(10), text_cell("ab") });
+        exporter.WriteRow({ null_cell(), text_cell("c") });
+        exporter.WriteRow({ int_cell(30), null_cell() });
+        exporter.WriteEpilogue();
+
+        CHECK(exporter.RowsWritten() == 3);
+        CHECK(exporter.Error() == "");
+
+        // the destructor closes the stream, so read it now
+        std::vector<std::uint8_t> bytes = read_all_bytes(*pStream);
+        std::size_t pos = 0;
+
+        REQUIRE(bytes.size() > 8);
+        CHECK(std::memcmp(bytes.data(), "HXCOLS01", 8) == 0);
+        pos = 8;
+
+        CHECK(get_at<std::uint32_t>(bytes, pos) == 2);
+        CHECK(get_at<std::uint8_t>(bytes, pos) == std::uint8_t(hex::ColumnType::Integer));
+        CHECK(get_at<std::uint32_t>(bytes, pos) == 1);
+        CHECK(get_at<char>(bytes, pos) == 'n');
+        CHECK(get_at<std::uint8_t>(bytes, pos) == std::uint8_t(hex::ColumnType::Text));
+        CHECK(get_at<std::uint32_t>(bytes, pos) == 1);
+        CHECK(get_at<char>(bytes, pos) == 's');
+
+        // first row group (2 rows)
+        CHECK(get_at<std::uint32_t>(bytes, pos) == 2);
+        CHECK(get_at<std::uint8_t>(bytes, pos) == 0x01);
+        CHECK(get_at<std::int64_t>(bytes, pos) == 10);
+        CHECK(get_at<std::int64_t>(bytes, pos) == 0);
+        CHECK(get_at<std::uint8_t>(bytes, pos) == 0x03);
+        CHECK(get_at<std::uint32_t>(bytes, pos) == 0);
+        CHECK(get_at<std::uint32_t>(bytes, pos) == 2);
+        CHECK(get_at<std::uint32_t>(bytes, pos) == 3);
+        CHECK(get_at<char>(bytes, pos) == 'a');
+        CHECK(get_at<char>(bytes, pos) == 'b');
+        CHECK(get_at<char>(bytes, pos) == 'c');
+
+        // second row group (1 row)
+        CHECK(get_at<std::uint32_t>(bytes, pos) == 1);
+        CHECK(get_at<std::uint8_t>(bytes, pos) == 0x01);
+        CHECK(get_at<std::int64_t>(bytes, pos) == 30);
+        CHECK(get_at<std::uint8_t>(bytes, pos) == 0x00);
+        CHECK(get_at<std::uint32_t>(bytes, pos) == 0);
+        CHECK(get_at<std::uint32_t>(bytes, pos) == 0);
+
+        // end marker and total row count
+        CHECK(get_at<std::uint32_t>(bytes, pos) == 0);
+        CHECK(get_at<std::uint64_t>(bytes, pos) == 3);
+        CHECK(pos == bytes.size());
+    }
+}
+
+TEST_CASE("TableExporter write error")
+{
+    auto stream = std::make_unique<CErrorFile>(CErrorFile::noError);
+    CErrorFile* pStream = stream.get();
+
+    hex::CsvTableExporter exporter{ std::move(stream) };
+
+    pStream->writeThrows = true;
+    exporter.WriteHeader({ { "x", hex::ColumnType::Text } });
+    exporter.WriteRow({ text_cell("value") });
+    exporter.WriteEpilogue();
+
+    // actual error message doesn't really matter here, just that we get the error.
+    CHECK(exporter.Error() != "");
+
+    // make sure the dtor doesn't throw
+    pStream->writeThrows = false;
+}
+
+TEST_CASE("TableExporter destructor CFileException does not propagate")
+{
+    auto stream = std::make_unique<CErrorFile>(CErrorFile::closeError);
+
+    {
+        hex::ColumnarTableExporter exporter{ std::move(stream) };
+        exporter.WriteHeader({ { "x", hex::ColumnType::Integer } });
+        exporter.WriteRow({ int_cell(1) });
+    }
+
+    // no exception thrown by destructor.
+}
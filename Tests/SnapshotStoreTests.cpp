@@ -0,0 +1,170 @@
+#include "Stdafx.h"
+
+#include "SnapshotStore.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+static const char *store_name = "SnapshotStoreTests.tmp";
+
+static bytes random_bytes(std::size_t len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    bytes buf(len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    return buf;
+}
+
+static snapshot_store::reader_t reader(const bytes &data)
+{
+    return [&data](unsigned char *buf, std::size_t len, std::int64_t addr) -> std::size_t
+    {
+        if (addr >= std::int64_t(data.size()))
+            return 0;
+        std::size_t nn = std::min(len, std::size_t(data.size() - addr));
+        std::memcpy(buf, data.data() + addr, nn);
+        return nn;
+    };
+}
+
+// Reads a whole version back from the store
+static bytes version(snapshot_store &ss, int ver)
+{
+    bytes buf(std::size_t(ss.length(ver)));
+    if (!buf.empty())
+        REQUIRE(ss.read(ver, buf.data(), buf.size(), 0) == buf.size());
+    return buf;
+}
+
+TEST_CASE("snapshot_store versions")
+{
+    snapshot_store ss(store_name);
+    REQUIRE(ss.ok());
+    CHECK(ss.versions() == 0);
+
+    bytes v1 = random_bytes(1000000, 1);
+    REQUIRE(ss.take(reader(v1), v1.size()));
+    CHECK(ss.versions() == 1);
+    CHECK(version(ss, 0) == v1);
+    CHECK(version(ss, 1) == v1);                    // no previous version yet
+    CHECK(ss.changed_bytes() == 0);
+
+    SECTION("unchanged")
+    {
+        std::int64_t size = ss.store_size();
+        REQUIRE(ss.take(reader(v1), v1.size()));
+        CHECK(ss.versions() == 2);
+        CHECK(ss.changed().empty());
+        CHECK(ss.store_size() == size);
+        std::vector<snapshot_store::change> changes;
+        REQUIRE(ss.diff(changes));
+        CHECK(changes.empty());
+    }
+
+    SECTION("appended")
+    {
+        bytes v2 = v1;
+        bytes extra = random_bytes(300000, 2);
+        v2.insert(v2.end(), extra.begin(), extra.end());
+        REQUIRE(ss.take(reader(v2), v2.size()));
+        CHECK(version(ss, 0) == v2);
+        CHECK(version(ss, 1) == v1);
+
+        // Only the (partial) last block of v1 and the new blocks should have been stored
+        REQUIRE(ss.changed().size() == 1);
+        CHECK(ss.changed()[0].start == (1000000 / snapshot_store::BLOCK_SIZE) * snapshot_store::BLOCK_SIZE);
+        CHECK(ss.store_size() < std::int64_t(v2.size() + 2 * snapshot_store::BLOCK_SIZE));
+
+        std::vector<snapshot_store::change> changes;
+        REQUIRE(ss.diff(changes));
+        REQUIRE(changes.size() == 1);
+        CHECK(changes[0].kind == snapshot_store::KIND_INSERT);
+        CHECK(changes[0].addr == 1000000);
+        CHECK(changes[0].len == 300000);
+
+        SECTION("and truncated")
+        {
+            bytes v3(v1.begin(), v1.begin() + 500000);
+            REQUIRE(ss.take(reader(v3), v3.size()));
+            CHECK(version(ss, 0) == v3);
+            CHECK(version(ss, 1) == v2);
+            REQUIRE(ss.diff(changes));
+            REQUIRE(changes.size() == 1);
+            CHECK(changes[0].kind == snapshot_store::KIND_DELETE);
+            CHECK(changes[0].addr == 500000);
+            CHECK(changes[0].len == 800000);
+        }
+    }
+
+    SECTION("changed in place")
+    {
+        bytes v2 = v1;
+        v2[10] ^= 1;
+        v2[500000] ^= 1;
+        v2[500001] ^= 1;
+        REQUIRE(ss.take(reader(v2), v2.size()));
+        CHECK(ss.changed().size() == 2);
+        CHECK(ss.changed_bytes() == 2 * snapshot_store::BLOCK_SIZE);
+
+        std::vector<snapshot_store::change> changes;
+        REQUIRE(ss.diff(changes));
+        REQUIRE(changes.size() == 2);
+        CHECK(changes[0].kind == snapshot_store::KIND_REPLACE);
+        CHECK(changes[0].addr == 10);
+        CHECK(changes[0].len == 1);
+        CHECK(changes[1].addr == 500000);
+        CHECK(changes[1].len == 2);
+
+        bytes v3 = v2;
+        v3[20] ^= 1;
+        v3[600000] ^= 1;
+        REQUIRE(ss.take(reader(v3), v3.size()));
+        CHECK(version(ss, 0) == v3);
+        CHECK(version(ss, 1) == v2);
+
+        // Blocks only used by v1 are reused for the next version
+        std::int64_t size = ss.store_size();
+        bytes v4 = v3;
+        v4[30] ^= 1;
+        v4[700000] ^= 1;
+        REQUIRE(ss.take(reader(v4), v4.size()));
+        CHECK(ss.store_size() == size);
+        CHECK(version(ss, 0) == v4);
+        CHECK(version(ss, 1) == v3);
+    }
+
+    SECTION("abort leaves versions unchanged")
+    {
+        bytes v2 = random_bytes(4000000, 3);
+        CHECK(!ss.take(reader(v2), v2.size(), [](double done) { return done < 0.5; }));
+        CHECK(ss.versions() == 1);
+        CHECK(version(ss, 0) == v1);
+    }
+}
+
+TEST_CASE("snapshot_store - benchmarks", "[!benchmark]")
+{
+    bytes data = random_bytes(256 * 1024 * 1024, 4);
+    snapshot_store ss(store_name);
+    REQUIRE(ss.take(reader(data), data.size()));
+
+    bytes extra = random_bytes(1024 * 1024, 5);
+    data.insert(data.end(), extra.begin(), extra.end());
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(ss.take(reader(data), data.size()));
+    std::vector<snapshot_store::change> changes;
+    REQUIRE(ss.diff(changes));
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    CHECK(changes.size() == 1);
+    WARN("snapshot of appended file: " << double(data.size()) / secs.count() / 1e9 << " GB/s, store " <<
+         ss.store_size() / (1024 * 1024) << " MB");
+}
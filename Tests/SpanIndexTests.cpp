@@ -0,0 +1,284 @@
+#include "Stdafx.h"
+
+#include "SpanIndex.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+typedef span_index::span span;
+
+// Sorts spans so that spans that start at the same address are in a known order
+static std::vector<span> sorted(std::vector<span> spans)
+{
+    std::sort(spans.begin(), spans.end(), [](const span &a, const span &b)
+    {
+        return a.start != b.start ? a.start < b.start : a.end != b.end ? a.end < b.end : a.colour < b.colour;
+    });
+    return spans;
+}
+
+// Finds the overlapping spans of one layer the slow way
+static std::vector<span> slow_find(std::vector<span> spans, int layer, std::int64_t lo, std::int64_t hi)
+{
+    std::stable_sort(spans.begin(), spans.end(), [](const span &a, const span &b) { return a.start < b.start; });
+    std::vector<span> retval;
+    for (span ss : spans)
+    {
+        if (ss.start < ss.end && ss.start < hi && ss.end > lo)
+        {
+            ss.start = std::max(ss.start, lo);
+            ss.end = std::min(ss.end, hi);
+            ss.layer = layer;
+            retval.push_back(ss);
+        }
+    }
+    return retval;
+}
+
+static bool operator==(const span &a, const span &b)
+{
+    return a.start == b.start && a.end == b.end && a.colour == b.colour && a.layer == b.layer;
+}
+
+static std::vector<span> random_spans(std::size_t count, std::int64_t max_addr, std::int64_t max_len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    std::vector<span> spans(count);
+    for (std::size_t ii = 0; ii < count; ++ii)
+    {
+        spans[ii].start = std::int64_t(rng() % max_addr);
+        spans[ii].end = spans[ii].start + std::int64_t(rng() % max_len);
+        spans[ii].colour = std::uint32_t(ii);
+        spans[ii].layer = 0;
+    }
+    return spans;
+}
+
+TEST_CASE("span_index")
+{
+    span_index si(3);
+
+    SECTION("empty")
+    {
+        std::vector<span> out;
+        si.find(0, 100, 7, out);
+        CHECK(out.empty());
+        CHECK(!si.valid(0));
+        si.set(0, std::vector<span>());
+        CHECK(si.valid(0));
+        si.find(0, 100, 7, out);
+        CHECK(out.empty());
+    }
+
+    SECTION("address and length vectors")
+    {
+        std::vector<std::int64_t> addr = { 10, 20, 40, 100 }, len = { 5, 10, 0, 1 };
+        si.set(1, addr, len, 0xFF);
+        CHECK(si.size(1) == 3);     // empty block ignored
+
+        std::vector<span> out;
+        si.find(12, 30, 2, out);
+        REQUIRE(out.size() == 2);
+        CHECK(out[0] == span{ 12, 15, 0xFF, 1 });
+        CHECK(out[1] == span{ 20, 30, 0xFF, 1 });
+
+        out.clear();
+        si.find(12, 30, 1, out);    // layer not in mask
+        CHECK(out.empty());
+        si.find(15, 20, 2, out);    // in the gap
+        CHECK(out.empty());
+        si.find(100, 101, 2, out);
+        CHECK(out.size() == 1);
+    }
+
+    SECTION("layers are returned in order")
+    {
+        si.set(2, { { 0, 10, 2, 0 } });
+        si.set(0, { { 5, 6, 0, 0 } });
+        si.set(1, { { 8, 20, 1, 0 } });
+        std::vector<span> out;
+        si.find(0, 100, 7, out);
+        REQUIRE(out.size() == 3);
+        CHECK(out[0].layer == 0);
+        CHECK(out[1].layer == 1);
+        CHECK(out[2].layer == 2);
+        CHECK(out[2].colour == 2);
+
+        si.invalidate(1);
+        CHECK(si.valid(0));
+        CHECK(!si.valid(1));
+        si.invalidate_all();
+        CHECK(!si.valid(0));
+    }
+
+    SECTION("overlapping spans match a linear scan")
+    {
+        for (std::size_t count : { 1, 2, 3, 7, 8, 9, 15, 16, 17, 100, 1000, 5000 })
+        {
+            std::vector<span> spans = random_spans(count, 100000, count < 100 ? 50000 : 500, unsigned(count));
+            si.set(0, spans);
+            std::mt19937 rng{ 1 };
+            for (int ii = 0; ii < 200; ++ii)
+            {
+                std::int64_t lo = std::int64_t(rng() % 110000), hi = lo + std::int64_t(rng() % 2000);
+                std::vector<span> out;
+                si.find(lo, hi, 1, out);
+                CHECK(out == slow_find(spans, 0, lo, hi));
+            }
+        }
+    }
+
+    SECTION("shift")
+    {
+        si.set(0, { { 10, 20, 0, 0 }, { 20, 30, 1, 0 }, { 40, 50, 2, 0 } });
+        std::vector<span> out;
+
+        si.shift(0, 20, 5);         // span starting at the insertion grows
+        si.find(0, 100, 1, out);
+        CHECK(out == (std::vector<span>{ { 10, 20, 0, 0 }, { 20, 35, 1, 0 }, { 45, 55, 2, 0 } }));
+
+        out.clear();
+        si.shift(0, 15, -25);       // deletes the end of the first span and all of the second
+        si.find(0, 100, 1, out);
+        CHECK(out == (std::vector<span>{ { 10, 15, 0, 0 }, { 20, 30, 2, 0 } }));
+
+        // Random inserts and deletes of random (overlapping) spans
+        for (std::size_t count : { 1, 2, 3, 7, 8, 9, 100, 1000 })
+        {
+            std::vector<span> spans = random_spans(count, 10000, count < 100 ? 5000 : 50, unsigned(count));
+            si.set(0, spans);
+            std::mt19937 rng{ 3 };
+            for (int ii = 0; ii < 50; ++ii)
+            {
+                std::int64_t addr = std::int64_t(rng() % 11000), offset = std::int64_t(rng() % 400) - 200;
+                si.shift(0, addr, offset);
+                for (span &ss : spans)
+                {
+                    if (offset > 0)
+                    {
+                        if (ss.start > addr) ss.start += offset;
+                        if (ss.end > addr) ss.end += offset;
+                    }
+                    else
+                    {
+                        auto move = [=](std::int64_t aa) { return aa <= addr ? aa : aa < addr - offset ? addr : aa + offset; };
+                        ss.start = move(ss.start);
+                        ss.end = move(ss.end);
+                    }
+                }
+                out.clear();
+                si.find(0, 20000, 1, out);
+                REQUIRE(sorted(out) == sorted(slow_find(spans, 0, 0, 20000)));   // spans that start at addr may be in any order
+                for (int jj = 0; jj < 20; ++jj)
+                {
+                    std::int64_t flo = std::int64_t(rng() % 11000), fhi = flo + 1 + std::int64_t(rng() % 200);
+                    out.clear();
+                    si.find(flo, fhi, 1, out);
+                    CHECK(sorted(out) == sorted(slow_find(spans, 0, flo, fhi)));
+                }
+            }
+        }
+    }
+
+    SECTION("extend and splice")
+    {
+        si.set(0, { { 10, 20, 0, 0 }, { 20, 30, 1, 0 }, { 40, 50, 2, 0 } });
+        std::int64_t lo = 25, hi = 25;
+        si.extend(0, lo, hi);
+        CHECK(lo == 10);            // spans that touch are included
+        CHECK(hi == 30);
+        si.splice(0, lo, hi, { { 12, 14, 3, 0 }, { 10, 11, 4, 0 } });
+        std::vector<span> out;
+        si.find(0, 100, 1, out);
+        CHECK(out == (std::vector<span>{ { 10, 11, 4, 0 }, { 12, 14, 3, 0 }, { 40, 50, 2, 0 } }));
+
+        for (std::size_t count : { 1, 2, 3, 7, 8, 9, 100, 1000 })
+        {
+            std::vector<span> spans = random_spans(count, 10000, 20, unsigned(count));
+            si.set(0, spans);
+            std::mt19937 rng{ 4 };
+            for (int ii = 0; ii < 50; ++ii)
+            {
+                lo = std::int64_t(rng() % 11000);
+                hi = lo + std::int64_t(rng() % 30);
+                si.extend(0, lo, hi);
+                for (const span &ss : spans)
+                    CHECK((ss.start >= ss.end || ss.end < lo || ss.start > hi || (ss.start >= lo && ss.end <= hi)));
+
+                std::vector<span> repl = random_spans(rng() % 4, hi - lo + 1, 10, unsigned(ii));
+                for (span &ss : repl)
+                {
+                    ss.start += lo;
+                    ss.end = std::min(ss.end + lo, hi);
+                }
+                si.splice(0, lo, hi, repl);
+                spans.erase(std::remove_if(spans.begin(), spans.end(), [=](const span &ss) { return ss.start >= lo && ss.end <= hi; }),
+                            spans.end());
+                spans.insert(spans.end(), repl.begin(), repl.end());
+
+                out.clear();
+                si.find(0, 20000, 1, out);
+                REQUIRE(sorted(out) == sorted(slow_find(spans, 0, 0, 20000)));
+                for (int jj = 0; jj < 20; ++jj)
+                {
+                    std::int64_t flo = std::int64_t(rng() % 11000), fhi = flo + 1 + std::int64_t(rng() % 200);
+                    out.clear();
+                    si.find(flo, fhi, 1, out);
+                    CHECK(sorted(out) == sorted(slow_find(spans, 0, flo, fhi)));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("span_index - benchmarks", "[!benchmark]")
+{
+    const std::size_t count = 1000000;
+    std::vector<span> spans = random_spans(count, std::int64_t(count) * 100, 200, 1);
+
+    auto start = std::chrono::steady_clock::now();
+    span_index si(1);
+    si.set(0, spans);
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    WARN("build " << count << " spans: " << secs.count() * 1e3 << " ms");
+
+    // A window of 64 lines of 32 bytes
+    const int queries = 100000;
+    std::mt19937 rng{ 2 };
+    std::vector<span> out;
+    std::size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int ii = 0; ii < queries; ++ii)
+    {
+        std::int64_t lo = std::int64_t(rng() % (count * 100));
+        out.clear();
+        si.find(lo, lo + 2048, 1, out);
+        found += out.size();
+    }
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("find: " << secs.count() / queries * 1e6 << " us per window (" << double(found) / queries << " spans)");
+
+    // The old way - scan from the start until past the window
+    std::stable_sort(spans.begin(), spans.end(), [](const span &a, const span &b) { return a.start < b.start; });
+    found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int ii = 0; ii < queries / 100; ++ii)
+    {
+        std::int64_t lo = std::int64_t(rng() % (count * 100));
+        for (const span &ss : spans)
+        {
+            if (ss.start >= lo + 2048)
+                break;
+            if (ss.end > lo)
+                ++found;
+        }
+    }
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("linear scan: " << secs.count() / (queries / 100) * 1e6 << " us per window");
+    CHECK(found > 0);
+}
@@ -0,0 +1,214 @@
+#include "Stdafx.h"
+
+#include "TemplateCacheFile.h"
+
+#include <catch.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+namespace
+{
+    // A small template tree with some of everything
+    struct test_tree
+    {
+        std::vector<std::int64_t> address, size;
+        std::vector<std::uint64_t> extra_elt;
+        std::vector<std::uint32_t> elt;
+        std::vector<std::uint64_t> info_end;
+        std::vector<signed char> type;
+        std::vector<unsigned char> indent;
+        std::vector<wchar_t> info;
+        std::vector<std::int64_t> layout;
+        std::vector<std::int64_t> dep_address, dep_size;
+        std::vector<std::uint64_t> dep_elt;
+
+        test_tree()
+            : address{ 0, 0, 4, 8 }, size{ 12, 4, 4, 4 }, extra_elt{ 0, 1, 2, 3 }, elt{ 0, 1, 2, 2 },
+              info_end{ 0, 3, 3, 5 }, type{ 1, 20, -21, 22 }, indent{ 1, 2, 2, 2 },
+              info{ L'a', L'b', L'c', L'd', L'e' }, layout{ 0, 11, 20, 29 },
+              dep_address{ 4 }, dep_size{ 4 }, dep_elt{ 3 }
+        {
+        }
+
+        template_cache_file file(const template_cache_file::key_t &key) const
+        {
+            template_cache_file tc;
+            tc.key = key;
+            tc.extra = 1;
+            tc.max_indent = 2;
+            tc.num_elts = address.size();
+            tc.num_info = info.size();
+            tc.num_layout = layout.size() / 2;
+            tc.num_dep = dep_address.size();
+            tc.address = address.data();
+            tc.size = size.data();
+            tc.extra_elt = extra_elt.data();
+            tc.elt = elt.data();
+            tc.info_end = info_end.data();
+            tc.type = type.data();
+            tc.indent = indent.data();
+            tc.info = info.data();
+            tc.layout = layout.data();
+            tc.dep_address = dep_address.data();
+            tc.dep_size = dep_size.data();
+            tc.dep_elt = dep_elt.data();
+            return tc;
+        }
+    };
+
+    template_cache_file::key_t test_key(std::int64_t length = 1000)
+    {
+        template_cache_file::key_t key;
+        std::memset(&key, 0, sizeof(key));
+        key.length = length;
+        key.mtime = 12345;
+        key.template_crc = 0xDEADBEEF;
+        for (int ii = 0; ii < template_cache_file::NUM_SAMPLES; ++ii)
+            key.sample_crc[ii] = ii * 7;
+        return key;
+    }
+
+    bytes write_file(const template_cache_file &tc)
+    {
+        bytes retval;
+        tc.write([&retval](const void *buf, std::size_t len)
+        {
+            const unsigned char *pp = static_cast<const unsigned char *>(buf);
+            retval.insert(retval.end(), pp, pp + len);
+        });
+        return retval;
+    }
+
+    const std::size_t num_template_elts = 3;
+}
+
+TEST_CASE("template_cache_file round trip", "[template cache]")
+{
+    test_tree tree;
+    bytes file = write_file(tree.file(test_key()));
+    REQUIRE(file.size() % 8 == 0);
+
+    template_cache_file tc;
+    REQUIRE(tc.read(file.data(), file.size(), test_key(), num_template_elts));
+
+    CHECK(tc.extra == 1);
+    CHECK(tc.max_indent == 2);
+    REQUIRE(tc.num_elts == tree.address.size());
+    REQUIRE(tc.num_info == tree.info.size());
+    REQUIRE(tc.num_layout == tree.layout.size() / 2);
+    REQUIRE(tc.num_dep == tree.dep_address.size());
+
+    CHECK(std::vector<std::int64_t>(tc.address, tc.address + tc.num_elts) == tree.address);
+    CHECK(std::vector<std::int64_t>(tc.size, tc.size + tc.num_elts) == tree.size);
+    CHECK(std::vector<std::uint64_t>(tc.extra_elt, tc.extra_elt + tc.num_elts) == tree.extra_elt);
+    CHECK(std::vector<std::uint32_t>(tc.elt, tc.elt + tc.num_elts) == tree.elt);
+    CHECK(std::vector<std::uint64_t>(tc.info_end, tc.info_end + tc.num_elts) == tree.info_end);
+    CHECK(std::vector<signed char>(tc.type, tc.type + tc.num_elts) == tree.type);
+    CHECK(std::vector<unsigned char>(tc.indent, tc.indent + tc.num_elts) == tree.indent);
+    CHECK(std::vector<wchar_t>(tc.info, tc.info + tc.num_info) == tree.info);
+    CHECK(std::vector<std::int64_t>(tc.layout, tc.layout + tc.num_layout * 2) == tree.layout);
+    CHECK(std::vector<std::int64_t>(tc.dep_address, tc.dep_address + tc.num_dep) == tree.dep_address);
+    CHECK(std::vector<std::int64_t>(tc.dep_size, tc.dep_size + tc.num_dep) == tree.dep_size);
+    CHECK(std::vector<std::uint64_t>(tc.dep_elt, tc.dep_elt + tc.num_dep) == tree.dep_elt);
+}
+
+TEST_CASE("template_cache_file stale key", "[template cache]")
+{
+    test_tree tree;
+    bytes file = write_file(tree.file(test_key()));
+    template_cache_file tc;
+
+    SECTION("file length changed")
+    {
+        CHECK_FALSE(tc.read(file.data(), file.size(), test_key(1001), num_template_elts));
+    }
+
+    SECTION("file contents changed")
+    {
+        template_cache_file::key_t key = test_key();
+        key.sample_crc[template_cache_file::NUM_SAMPLES - 1] ^= 1;
+        CHECK_FALSE(tc.read(file.data(), file.size(), key, num_template_elts));
+    }
+
+    SECTION("template changed")
+    {
+        template_cache_file::key_t key = test_key();
+        key.template_crc = 0;
+        CHECK_FALSE(tc.read(file.data(), file.size(), key, num_template_elts));
+
+        // Template now has fewer elements than are used in the tree
+        CHECK_FALSE(tc.read(file.data(), file.size(), test_key(), 2));
+    }
+}
+
+TEST_CASE("template_cache_file truncated or corrupt", "[template cache]")
+{
+    test_tree tree;
+    bytes file = write_file(tree.file(test_key()));
+    template_cache_file tc;
+
+    SECTION("truncated")
+    {
+        for (std::size_t len = 0; len < file.size(); ++len)
+            CHECK_FALSE(tc.read(file.data(), len, test_key(), num_template_elts));
+    }
+
+    SECTION("any byte changed")
+    {
+        for (std::size_t ii = 0; ii < file.size(); ++ii)
+        {
+            bytes bad(file);
+            bad[ii] ^= 0x10;
+            CHECK_FALSE(tc.read(bad.data(), bad.size(), test_key(), num_template_elts));
+        }
+    }
+
+    SECTION("counts that overflow")
+    {
+        // num_elts is just after the key, extra and max_indent
+        std::size_t num_elts_pos = 8 + sizeof(template_cache_file::key_t) + 8;
+        std::uint64_t huge[] = { UINT64_MAX, UINT64_MAX / 8 + 1, UINT64_MAX / 4 + 1, (UINT64_MAX >> 1) + 1 };
+        for (std::uint64_t num : huge)
+        {
+            bytes bad(file);
+            std::memcpy(&bad[num_elts_pos], &num, sizeof(num));
+            CHECK_FALSE(tc.read(bad.data(), bad.size(), test_key(), num_template_elts));
+        }
+    }
+
+    SECTION("empty tree")
+    {
+        test_tree empty;
+        template_cache_file etc = empty.file(test_key());
+        etc.num_elts = etc.num_info = etc.num_layout = etc.num_dep = 0;
+        bytes efile = write_file(etc);
+        CHECK_FALSE(tc.read(efile.data(), efile.size(), test_key(), num_template_elts));
+    }
+
+    SECTION("bad indices")
+    {
+        // Written with a valid CRC so only the range checks can find these
+        test_tree bad_dep;
+        bad_dep.dep_elt[0] = bad_dep.address.size();
+        bytes bfile = write_file(bad_dep.file(test_key()));
+        CHECK_FALSE(tc.read(bfile.data(), bfile.size(), test_key(), num_template_elts));
+
+        test_tree bad_elt;
+        bad_elt.elt[1] = num_template_elts;
+        bfile = write_file(bad_elt.file(test_key()));
+        CHECK_FALSE(tc.read(bfile.data(), bfile.size(), test_key(), num_template_elts));
+
+        test_tree bad_info;
+        bad_info.info_end[2] = 2;           // before the end of the previous string
+        bfile = write_file(bad_info.file(test_key()));
+        CHECK_FALSE(tc.read(bfile.data(), bfile.size(), test_key(), num_template_elts));
+
+        bad_info.info_end[2] = bad_info.info.size() + 1;
+        bfile = write_file(bad_info.file(test_key()));
+        CHECK_FALSE(tc.read(bfile.data(), bfile.size(), test_key(), num_template_elts));
+    }
+}
@@ -0,0 +1,155 @@
+#include "Stdafx.h"
+
+#include "TemplateIndex.h"
+
+#include <catch.hpp>
+
+#include <cstdint>
+#include <vector>
+
+static std::vector<std::size_t> elts_in(const template_index& index, std::int64_t start, std::int64_t end)
+{
+    std::vector<std::size_t> result;
+    index.for_each_in(start, end, [&](std::size_t pos) { result.push_back(index.elt(pos)); });
+    return result;
+}
+
+TEST_CASE("template_index empty")
+{
+    template_index index;
+    index.build();
+
+    CHECK(index.empty());
+    CHECK(index.find(0) == template_index::npos);
+    CHECK(elts_in(index, 0, 100).empty());
+}
+
+TEST_CASE("template_index sequential elements")
+{
+    template_index index;
+
+    // 1000 consecutive 4 byte elements (element numbers start at 1 as 0 is the root)
+    for (std::size_t ii = 0; ii < 1000; ++ii)
+        index.add(ii * 4, 4, ii + 1, ii % 2 == 0 ? 0x0000FF : template_index::no_colour);
+    index.build();
+
+    REQUIRE(index.size() == 1000);
+
+    SECTION("find")
+    {
+        CHECK(index.find(0) == 1);
+        CHECK(index.find(3) == 1);
+        CHECK(index.find(4) == 2);
+        CHECK(index.find(3999) == 1000);
+        CHECK(index.find(4000) == template_index::npos);
+        CHECK(index.find(-1) == template_index::npos);
+    }
+
+    SECTION("for_each_in")
+    {
+        CHECK(elts_in(index, 6, 10) == std::vector<std::size_t>{ 2, 3 });
+        CHECK(elts_in(index, 8, 12) == std::vector<std::size_t>{ 3 });
+        CHECK(elts_in(index, 12, 12).empty());
+        CHECK(elts_in(index, 3990, 5000).size() == 3);
+    }
+
+    SECTION("colour")
+    {
+        std::vector<std::size_t> found;
+        index.for_each_in(8, 9, [&](std::size_t pos) { found.push_back(pos); });
+        REQUIRE(found.size() == 1);
+        std::size_t pos = found[0];
+        CHECK(index.elt(pos) == 3);
+        CHECK(index.colour(pos) == 0x0000FF);
+        CHECK(index.colour(pos + 1) == template_index::no_colour);
+    }
+}
+
+TEST_CASE("template_index overlapping elements")
+{
+    template_index index;
+
+    // A large element near the start (eg, from a JUMP) overlaps many later small ones
+    index.add(10, 1000, 5);
+    for (std::size_t ii = 0; ii < 500; ++ii)
+        index.add(ii * 2, 2, ii + 10);
+    index.add(0, 4, 1);         // added out of order
+    index.build();
+
+    CHECK(index.find(0) == 1);
+    CHECK(index.find(9) == 14);
+    CHECK(index.find(10) == 5);
+    CHECK(index.find(998) == 5);
+    CHECK(index.find(1009) == 5);
+    CHECK(index.find(1010) == template_index::npos);
+
+    std::vector<std::size_t> elts = elts_in(index, 900, 904);
+    CHECK(elts == std::vector<std::size_t>{ 5, 460, 461 });
+
+    elts = elts_in(index, 1005, 1006);
+    CHECK(elts == std::vector<std::size_t>{ 5 });
+}
+
+TEST_CASE("template_index early large element")
+{
+    template_index index;
+
+    // An element covering the whole file does not make searches later in the file slow
+    // (or miss anything) - every result is checked against a brute force search
+    index.add(0, 1000000, 1);
+    for (std::size_t ii = 0; ii < 10000; ++ii)
+        index.add(ii * 100, ii % 7 == 0 ? 350 : 50, ii + 2);
+    index.build();
+
+    for (std::int64_t start = 0; start < 1000100; start += 4321)
+    {
+        std::vector<std::size_t> expected;
+        if (start < 1000000)
+            expected.push_back(1);
+        for (std::size_t ii = 0; ii < 10000; ++ii)
+        {
+            std::int64_t ss = ii * 100, ee = ss + (ii % 7 == 0 ? 350 : 50);
+            if (ss < start + 200 && ee > start)
+                expected.push_back(ii + 2);
+        }
+        CHECK(elts_in(index, start, start + 200) == expected);
+    }
+}
+
+TEST_CASE("template_index merge")
+{
+    // Two parts, as when published elements of a background scan are merged
+    template_index first, second;
+    for (std::size_t ii = 0; ii < 100; ++ii)
+        first.add(ii * 10, 10, ii + 1);
+    first.build();
+    second.add(0, 2000, 101);                   // overlaps everything in first
+    for (std::size_t ii = 100; ii < 200; ++ii)
+        second.add(ii * 10, 10, ii + 2);
+    second.build();
+
+    template_index merged(first);
+    merged.add(second);
+    merged.build();
+
+    REQUIRE(merged.size() == 201);
+    CHECK(merged.find(5) == 1);
+    CHECK(merged.find(1005) == 101);
+    CHECK(merged.find(2000) == template_index::npos);
+    CHECK(elts_in(merged, 995, 1005) == std::vector<std::size_t>{ 101, 100, 102 });
+}
+
+TEST_CASE("template_index large elements")
+{
+    template_index index;
+    const std::int64_t big = std::int64_t(1) << 33;
+
+    index.add(0, big, 1);
+    index.add(big, 100, 2);
+    index.build();
+
+    CHECK(index.end(0) == big);
+    CHECK(index.find(big - 1) == 1);
+    CHECK(index.find(big) == 2);
+    CHECK(index.find(big + 100) == template_index::npos);
+}
@@ -0,0 +1,165 @@
+#include "Stdafx.h"
+
+#include "ThreeWayMerge.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+static bytes random_bytes(std::size_t len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    bytes buf(len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    return buf;
+}
+
+static three_way_merge::opener_t opener(const bytes &data)
+{
+    return [&data]() -> three_way_merge::reader_t
+    {
+        return [&data](unsigned char *buf, std::size_t len, std::int64_t addr) -> std::size_t
+        {
+            if (addr >= std::int64_t(data.size()))
+                return 0;
+            std::size_t nn = std::min(len, std::size_t(data.size() - addr));
+            std::memcpy(buf, data.data() + addr, nn);
+            return nn;
+        };
+    };
+}
+
+static bool merge(three_way_merge &twm, bytes &result, three_way_merge::resolve_t resolve = three_way_merge::RESOLVE_NONE)
+{
+    std::ostringstream os(std::ios::binary);
+    bool retval = twm.merge(os, resolve);
+    std::string ss = os.str();
+    result.assign(ss.begin(), ss.end());
+    return retval;
+}
+
+static void insert(bytes &data, std::size_t at, const bytes &extra)
+{
+    data.insert(data.begin() + at, extra.begin(), extra.end());
+}
+
+TEST_CASE("three_way_merge")
+{
+    bytes base = random_bytes(1000000, 1);
+    bytes file_a = base, file_b = base;
+
+    SECTION("separate changes are merged")
+    {
+        file_a[500000] ^= 1;                                            // replacement in A
+        insert(file_a, 100000, random_bytes(3000, 2));                  // insertion in A
+        file_b[800000] ^= 1;
+        file_b.erase(file_b.begin() + 300000, file_b.begin() + 310000); // deletion in B
+
+        three_way_merge twm(opener(base), base.size(), opener(file_a), file_a.size(), opener(file_b), file_b.size());
+        REQUIRE(twm.run());
+        CHECK(twm.conflicts() == 0);
+
+        bytes expected = base;
+        expected[800000] ^= 1;
+        expected[500000] ^= 1;
+        expected.erase(expected.begin() + 300000, expected.begin() + 310000);
+        insert(expected, 100000, bytes(file_a.begin() + 100000, file_a.begin() + 103000));
+        bytes result;
+        REQUIRE(merge(twm, result));
+        CHECK(result == expected);
+
+        // Regions cover the whole base file and alternate between same and changed
+        std::int64_t addr = 0, changed = 0;
+        for (const auto &rr : twm.regions())
+        {
+            CHECK(rr.base == addr);
+            addr += rr.base_len;
+            if (rr.kind != three_way_merge::KIND_SAME)
+                ++changed;
+        }
+        CHECK(addr == std::int64_t(base.size()));
+        CHECK(changed == 4);
+    }
+
+    SECTION("same change in both is not a conflict")
+    {
+        bytes extra = random_bytes(5000, 3);
+        insert(file_a, 200000, extra);
+        insert(file_b, 200000, extra);
+        file_b[900000] ^= 1;
+
+        three_way_merge twm(opener(base), base.size(), opener(file_a), file_a.size(), opener(file_b), file_b.size());
+        REQUIRE(twm.run());
+        CHECK(twm.conflicts() == 0);
+        CHECK(std::count_if(twm.regions().begin(), twm.regions().end(),
+                            [](const three_way_merge::region &rr) { return rr.kind == three_way_merge::KIND_BOTH; }) == 1);
+        bytes result;
+        REQUIRE(merge(twm, result));
+        CHECK(result == file_b);
+    }
+
+    SECTION("conflicts")
+    {
+        file_a[400000] = 1;
+        file_b[400000] = 2;
+        file_b[400001] ^= 1;
+        insert(file_a, 700000, random_bytes(100, 4));   // insertions at the same place
+        insert(file_b, 700000, random_bytes(200, 5));
+
+        three_way_merge twm(opener(base), base.size(), opener(file_a), file_a.size(), opener(file_b), file_b.size());
+        REQUIRE(twm.run());
+        CHECK(twm.conflicts() == 2);
+
+        bytes result;
+        CHECK(!merge(twm, result));
+        CHECK(result.empty());
+        REQUIRE(merge(twm, result, three_way_merge::RESOLVE_A));
+        CHECK(result == file_a);
+        REQUIRE(merge(twm, result, three_way_merge::RESOLVE_B));
+        CHECK(result == file_b);
+    }
+
+    SECTION("abort")
+    {
+        bytes big_base = random_bytes(20000000, 6), big_a = big_base;
+        big_a[10] ^= 1;
+        three_way_merge twm(opener(big_base), big_base.size(), opener(big_a), big_a.size(), opener(big_base), big_base.size());
+        CHECK(!twm.run([](double) { return false; }));
+    }
+}
+
+TEST_CASE("three_way_merge - benchmarks", "[!benchmark]")
+{
+    bytes base = random_bytes(512 * 1024 * 1024, 7);
+    bytes file_a = base, file_b = base;
+    for (std::size_t ii = 1; ii < 100; ++ii)
+    {
+        file_a[ii * 5000000] ^= 1;
+        file_b[ii * 5000000 + 2500000] ^= 1;
+    }
+    insert(file_a, 100000000, random_bytes(100000, 8));
+    file_b.erase(file_b.begin() + 301000000, file_b.begin() + 301100000);
+
+    auto start = std::chrono::steady_clock::now();
+    three_way_merge twm(opener(base), base.size(), opener(file_a), file_a.size(), opener(file_b), file_b.size());
+    REQUIRE(twm.run());
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    CHECK(twm.conflicts() == 0);
+    WARN("three-way compare: " << double(base.size() + file_a.size() + file_b.size()) / secs.count() / 1e9 << " GB/s");
+
+    start = std::chrono::steady_clock::now();
+    bytes result;
+    REQUIRE(merge(twm, result));
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("merge: " << double(result.size()) / secs.count() / 1e9 << " GB/s");
+}
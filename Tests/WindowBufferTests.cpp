@@ -0,0 +1,166 @@
+#include "Stdafx.h"
+
+#include "WindowBuffer.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+typedef std::vector<unsigned char> bytes;
+
+static bytes random_bytes(std::size_t len, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    bytes buf(len);
+    for (auto &bb : buf)
+        bb = static_cast<unsigned char>(rng());
+    return buf;
+}
+
+// Returns a reader of a vector, counting the calls (like one CHexEditDoc::GetData call each)
+static window_buffer::reader_t reader(const bytes &data, int &calls)
+{
+    return [&data, &calls](unsigned char *buf, std::size_t len, std::int64_t addr) -> std::size_t
+    {
+        ++calls;
+        if (addr >= std::int64_t(data.size()))
+            return 0;
+        std::size_t nn = std::min(len, std::size_t(data.size() - addr));
+        std::memcpy(buf, data.data() + addr, nn);
+        return nn;
+    };
+}
+
+static bool same(const window_buffer &wb, const bytes &data, std::int64_t start, std::size_t len)
+{
+    return std::memcmp(wb.data(), data.data() + start, len) == 0;
+}
+
+TEST_CASE("window_buffer")
+{
+    const std::size_t row = 32, rows = 40;
+    bytes data = random_bytes(100000, 1);
+    int calls = 0;
+    window_buffer wb;
+
+    REQUIRE(wb.fetch(1000, 1000 + row*rows, reader(data, calls)) == row*rows);
+    CHECK(same(wb, data, 1000, row*rows));
+    CHECK(wb.bytes_read() == row*rows);
+
+    SECTION("same window is not read again")
+    {
+        REQUIRE(wb.fetch(1000, 1000 + row*rows, reader(data, calls)) == row*rows);
+        CHECK(wb.bytes_read() == row*rows);
+    }
+
+    SECTION("scrolling only reads new rows")
+    {
+        REQUIRE(wb.fetch(1000 + row, 1000 + row*(rows+1), reader(data, calls)) == row*rows);
+        CHECK(same(wb, data, 1000 + row, row*rows));
+        CHECK(wb.bytes_read() == row*(rows+1));
+
+        REQUIRE(wb.fetch(1000 - 2*row, 1000 + row*(rows-2), reader(data, calls)) == row*rows);
+        CHECK(same(wb, data, 1000 - 2*row, row*rows));
+        CHECK(wb.bytes_read() == row*(rows+4));
+
+        REQUIRE(wb.fetch(50000, 50000 + row*rows, reader(data, calls)) == row*rows);   // jump
+        CHECK(same(wb, data, 50000, row*rows));
+        CHECK(wb.bytes_read() == row*(2*rows+4));
+    }
+
+    SECTION("window size changes")
+    {
+        REQUIRE(wb.fetch(1000, 1000 + row*rows*2, reader(data, calls)) == row*rows*2);
+        CHECK(same(wb, data, 1000, row*rows*2));
+        CHECK(wb.bytes_read() == row*rows*2);
+        REQUIRE(wb.fetch(1000 + row, 1000 + row*3, reader(data, calls)) == row*2);
+        CHECK(same(wb, data, 1000 + row, row*2));
+        CHECK(wb.bytes_read() == row*rows*2);
+    }
+
+    SECTION("replaced bytes are read again")
+    {
+        data[1100] ^= 1;
+        data[1200] ^= 1;
+        wb.invalidate(1100, 1101);
+        wb.invalidate(1200, 1201);
+        wb.invalidate(99000, 99001);        // outside the window
+        REQUIRE(wb.fetch(1000, 1000 + row*rows, reader(data, calls)) == row*rows);
+        CHECK(same(wb, data, 1000, row*rows));
+        CHECK(wb.bytes_read() == row*rows + 101);
+    }
+
+    SECTION("insertion and deletion")
+    {
+        bytes extra = random_bytes(10, 2);
+        data.insert(data.begin() + 1500, extra.begin(), extra.end());
+        wb.invalidate(1500);
+        REQUIRE(wb.fetch(1000, 1000 + row*rows, reader(data, calls)) == row*rows);
+        CHECK(same(wb, data, 1000, row*rows));
+        CHECK(wb.bytes_read() == row*rows + (1000 + row*rows - 1500));
+
+        data.erase(data.begin(), data.begin() + 100);
+        wb.invalidate(0);
+        REQUIRE(wb.fetch(1000, 1000 + row*rows, reader(data, calls)) == row*rows);
+        CHECK(same(wb, data, 1000, row*rows));
+        CHECK(wb.bytes_read() == row*rows*2 + (1000 + row*rows - 1500));
+    }
+
+    SECTION("end of file")
+    {
+        std::int64_t start = data.size() - 100;
+        REQUIRE(wb.fetch(start, start + row*rows, reader(data, calls)) == 100);
+        CHECK(same(wb, data, start, 100));
+
+        bytes extra = random_bytes(50, 3);
+        data.insert(data.end(), extra.begin(), extra.end());
+        wb.invalidate(start + 100);
+        REQUIRE(wb.fetch(start, start + row*rows, reader(data, calls)) == 150);
+        CHECK(same(wb, data, start, 150));
+
+        data.resize(data.size() - 120);
+        wb.invalidate(start + 30);
+        REQUIRE(wb.fetch(start, start + row*rows, reader(data, calls)) == 30);
+        CHECK(same(wb, data, start, 30));
+    }
+
+    SECTION("clear")
+    {
+        wb.clear();
+        REQUIRE(wb.fetch(1000, 1000 + row*rows, reader(data, calls)) == row*rows);
+        CHECK(wb.bytes_read() == 2*row*rows);
+    }
+}
+
+TEST_CASE("window_buffer - benchmarks", "[!benchmark]")
+{
+    // Scroll a 64 line window of 64 byte rows down through a file one line at a time, compared
+    // with getting every line of the window separately on each repaint
+    const std::size_t row = 64, rows = 64, steps = 100000;
+    bytes data = random_bytes(row * (steps + rows), 4);
+    int calls = 0;
+    auto read = reader(data, calls);
+
+    bytes line(row);
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t ii = 0; ii < steps; ++ii)
+        for (std::size_t jj = 0; jj < rows; ++jj)
+            read(&line[0], row, std::int64_t((ii + jj) * row));
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    WARN("read per line: " << steps / secs.count() << " repaints/s, " << double(calls) / steps << " reads per repaint");
+
+    calls = 0;
+    window_buffer wb;
+    start = std::chrono::steady_clock::now();
+    for (std::size_t ii = 0; ii < steps; ++ii)
+        wb.fetch(ii * row, (ii + rows) * row, read);
+    secs = std::chrono::steady_clock::now() - start;
+    WARN("window buffer: " << steps / secs.count() << " repaints/s, " << double(calls) / steps << " reads per repaint, " <<
+         double(wb.bytes_read()) / steps << " bytes read per repaint");
+    CHECK(wb.bytes_read() == std::int64_t(row * (steps + rows - 1)));
+}
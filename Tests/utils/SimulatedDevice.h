@@ -0,0 +1,93 @@
+#pragma once
+#include "SectorReader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+
+
+/// \brief  A sector_device that reads from memory and can simulate bad sectors.
+///
+/// \remarks
+/// Started reads are completed by wait() in the order they were started.  A read that
+/// includes a failing sector fails as a whole (as for a real device).  Every read is logged
+/// so that tests can check the order and size of reads.
+class SimulatedDevice : public sector_device
+{
+public:
+    SimulatedDevice(const std::vector<unsigned char>& data, std::size_t sectorSize, int maxRequests = 8)
+        : _data(data), _sectorSize(sectorSize), _maxRequests(maxRequests), _maxInProgress(0)
+    {
+    }
+
+    /// \brief  Makes a sector fail the next \p times reads of it (-1 = always).
+    void Fail(std::int64_t sector, int times = -1, std::uint32_t error = 23 /* ERROR_CRC */)
+    {
+        _failing[sector] = std::make_pair(times, error);
+    }
+
+    virtual std::size_t sector_size() const override { return _sectorSize; }
+    virtual std::int64_t length() const override { return std::int64_t(_data.size()); }
+    virtual int max_requests() const override { return _maxRequests; }
+
+    virtual bool start(request* req) override
+    {
+        if (int(_inProgress.size()) >= _maxRequests ||
+            req->addr % _sectorSize != 0 || req->len % _sectorSize != 0 ||
+            req->addr < 0 || req->addr + std::int64_t(req->len) > length())
+        {
+            req->status = 87;       // ERROR_INVALID_PARAMETER
+            return false;
+        }
+        _inProgress.push_back(req);
+        _maxInProgress = std::max(_maxInProgress, int(_inProgress.size()));
+        _log.push_back(std::make_pair(req->addr, req->len));
+        return true;
+    }
+
+    virtual request* wait() override
+    {
+        if (_inProgress.empty())
+            return nullptr;
+
+        request* req = _inProgress.front();
+        _inProgress.pop_front();
+
+        req->status = 0;
+        for (std::int64_t sec = req->addr / _sectorSize; sec < (req->addr + std::int64_t(req->len)) / std::int64_t(_sectorSize); ++sec)
+        {
+            auto pp = _failing.find(sec);
+            if (pp != _failing.end() && pp->second.first != 0)
+            {
+                if (pp->second.first > 0)
+                    --pp->second.first;
+                req->status = pp->second.second;
+            }
+        }
+
+        if (req->status == 0)
+            std::memcpy(req->buf, &_data[std::size_t(req->addr)], req->len);
+        else
+            std::memset(req->buf, 0xCD, req->len);
+        return req;
+    }
+
+    /// \brief  The address and length of every read started.
+    const std::vector<std::pair<std::int64_t, std::size_t> >& Log() const { return _log; }
+
+    /// \brief  The most reads that were in progress at once.
+    int MaxInProgress() const { return _maxInProgress; }
+
+private:
+    std::vector<unsigned char> _data;
+    std::size_t _sectorSize;
+    int _maxRequests;
+    int _maxInProgress;
+    std::map<std::int64_t, std::pair<int, std::uint32_t> > _failing;
+    std::deque<request*> _inProgress;
+    std::vector<std::pair<std::int64_t, std::size_t> > _log;
+};